@@ -47,6 +47,31 @@ grub_pci_iterate (grub_pci_iteratefunc_t hook, void *hook_data)
   pci_iterator_destroy (iter);
 }
 
+void
+grub_pci_iterate_class (grub_uint32_t class, grub_uint32_t mask,
+			grub_pci_iteratefunc_t hook, void *hook_data)
+{
+  struct pci_device_iterator *iter;
+  struct pci_slot_match slot;
+  struct pci_device *dev;
+  slot.domain = PCI_MATCH_ANY;
+  slot.bus = PCI_MATCH_ANY;
+  slot.dev = PCI_MATCH_ANY;
+  slot.func = PCI_MATCH_ANY;
+  iter = pci_slot_match_iterator_create (&slot);
+  while ((dev = pci_device_next (iter)))
+    if ((dev->device_class & mask) == (class & mask)
+	&& hook (dev, dev->vendor_id | (dev->device_id << 16), hook_data))
+      break;
+  pci_iterator_destroy (iter);
+}
+
+/* libpciaccess keeps its own list of devices.  */
+void
+grub_pci_rescan (void)
+{
+}
+
 void *
 grub_pci_device_map_range (grub_pci_device_t dev, grub_addr_t base,
 			   grub_size_t size)
@@ -97,8 +97,10 @@ grub_pci_make_address (grub_pci_device_t dev, int reg)
     | (dev.function << 8) | reg;
 }
 
-void
-grub_pci_iterate (grub_pci_iteratefunc_t hook, void *hook_data)
+/* Call HOOK for every function present, probing config space.  Return 1 if
+   HOOK stopped the scan.  */
+static int
+grub_pci_scan (grub_pci_iteratefunc_t hook, void *hook_data)
 {
   grub_pci_device_t dev;
   grub_pci_address_t addr;
@@ -126,7 +128,7 @@ grub_pci_iterate (grub_pci_iteratefunc_t hook, void *hook_data)
 		}
 
 	      if (hook (dev, id, hook_data))
-		return;
+		return 1;
 
 	      /* Probe only func = 0 if the device if not multifunction */
 	      if (dev.function == 0)
@@ -139,6 +141,139 @@ grub_pci_iterate (grub_pci_iteratefunc_t hook, void *hook_data)
 	    }
 	}
     }
+  return 0;
+}
+
+/* Scanning all buses takes thousands of config space accesses, so the
+   functions found are remembered, in bus order, until grub_pci_rescan.  */
+struct grub_pci_cached_device
+{
+  grub_pci_device_t dev;
+  grub_pci_id_t id;
+  /* Class, subclass and programming interface.  */
+  grub_uint32_t class;
+};
+
+static struct grub_pci_cached_device *pci_devices;
+static grub_size_t pci_ndevices, pci_nallocated;
+static int pci_scanned;
+
+/* Helper for grub_pci_fill_cache.  */
+static int
+grub_pci_cache_device (grub_pci_device_t dev, grub_pci_id_t id,
+		       void *data __attribute__ ((unused)))
+{
+  struct grub_pci_cached_device *d;
+
+  if (pci_ndevices == pci_nallocated)
+    {
+      grub_size_t n = pci_nallocated ? 2 * pci_nallocated : 32;
+
+      d = grub_realloc (pci_devices, n * sizeof (*d));
+      if (!d)
+	return 1;
+      pci_devices = d;
+      pci_nallocated = n;
+    }
+
+  d = &pci_devices[pci_ndevices++];
+  d->dev = dev;
+  d->id = id;
+  d->class = grub_pci_read (grub_pci_make_address (dev, GRUB_PCI_REG_CLASS))
+    >> 8;
+  return 0;
+}
+
+/* Scan the buses into the cache unless done already.  Return 0 when the
+   cache can't be filled, for instance before the heap is set up.  */
+static int
+grub_pci_fill_cache (void)
+{
+  if (pci_scanned)
+    return 1;
+
+  if (grub_pci_scan (grub_pci_cache_device, NULL))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_pci_rescan ();
+      return 0;
+    }
+
+  pci_scanned = 1;
+  return 1;
+}
+
+void
+grub_pci_rescan (void)
+{
+  grub_free (pci_devices);
+  pci_devices = NULL;
+  pci_ndevices = pci_nallocated = 0;
+  pci_scanned = 0;
+}
+
+void
+grub_pci_iterate (grub_pci_iteratefunc_t hook, void *hook_data)
+{
+  grub_size_t i;
+
+  if (!grub_pci_fill_cache ())
+    {
+      grub_pci_scan (hook, hook_data);
+      return;
+    }
+
+  for (i = 0; i < pci_ndevices; i++)
+    if (hook (pci_devices[i].dev, pci_devices[i].id, hook_data))
+      return;
+}
+
+/* Context for grub_pci_iterate_class.  */
+struct grub_pci_iterate_class_ctx
+{
+  grub_uint32_t class;
+  grub_uint32_t mask;
+  grub_pci_iteratefunc_t hook;
+  void *hook_data;
+};
+
+/* Helper for grub_pci_iterate_class.  */
+static int
+grub_pci_iterate_class_iter (grub_pci_device_t dev, grub_pci_id_t id,
+			     void *data)
+{
+  struct grub_pci_iterate_class_ctx *ctx = data;
+  grub_uint32_t class;
+
+  class = grub_pci_read (grub_pci_make_address (dev, GRUB_PCI_REG_CLASS)) >> 8;
+  if ((class & ctx->mask) != ctx->class)
+    return 0;
+  return ctx->hook (dev, id, ctx->hook_data);
+}
+
+void
+grub_pci_iterate_class (grub_uint32_t class, grub_uint32_t mask,
+			grub_pci_iteratefunc_t hook, void *hook_data)
+{
+  grub_size_t i;
+
+  if (!grub_pci_fill_cache ())
+    {
+      struct grub_pci_iterate_class_ctx ctx = {
+	.class = class & mask,
+	.mask = mask,
+	.hook = hook,
+	.hook_data = hook_data
+      };
+
+      grub_pci_scan (grub_pci_iterate_class_iter, &ctx);
+      return;
+    }
+
+  for (i = 0; i < pci_ndevices; i++)
+    if ((pci_devices[i].class & mask) == (class & mask)
+	&& hook (pci_devices[i].dev, pci_devices[i].id, hook_data))
+      return;
 }
 
 grub_uint8_t
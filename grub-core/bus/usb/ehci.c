@@ -81,7 +81,7 @@ enum
 
 #define GRUB_EHCI_N_FRAMELIST   1024
 #define GRUB_EHCI_N_QH  256
-#define GRUB_EHCI_N_TD  640
+#define GRUB_EHCI_N_TD  1024
 
 #define GRUB_EHCI_QH_EMPTY 1
 
@@ -294,7 +294,7 @@ struct grub_ehci_td
   /* EHCI driver part */
   grub_uint32_t link_td;	/* pointer to next free/chained TD */
   grub_uint32_t size;
-  grub_uint32_t pad[1];		/* padding to some multiple of 32 bytes */
+  grub_uint32_t tr_index;	/* index of first transaction in this TD */
 };
 
 /* EHCI Queue Head */
@@ -353,6 +353,20 @@ sync_all_caches (struct grub_ehci *e)
     grub_arch_sync_dma_caches (e->framelist_virt, 4096);
 }
 
+/* Transfer paths sync only descriptors they actually touch, flushing
+ * whole TD and QH areas on every poll is too expensive. */
+static inline void
+sync_qh (grub_ehci_qh_t qh)
+{
+  grub_arch_sync_dma_caches (qh, sizeof (struct grub_ehci_qh));
+}
+
+static inline void
+sync_td (grub_ehci_td_t td)
+{
+  grub_arch_sync_dma_caches (td, sizeof (struct grub_ehci_td));
+}
+
 /* EHCC registers access functions */
 static inline grub_uint32_t
 grub_ehci_ehcc_read32 (struct grub_ehci *e, grub_uint32_t addr)
@@ -1139,14 +1153,17 @@ grub_ehci_free_tds (struct grub_ehci *e, grub_ehci_td_t td,
     {
       grub_ehci_td_t tdprev;
 
+      sync_td (td);
       token = grub_le_to_cpu32 (td->token);
       to_transfer = (token & GRUB_EHCI_TOTAL_MASK) >> GRUB_EHCI_TOTAL_OFF;
 
       /* Check state of TD - if it did not transfer
-       * whole data then set last_trans - it should be last executed TD
-       * in case when something went wrong. */
+       * whole data then set last_trans - it should be last executed
+       * transaction in case when something went wrong. One TD can
+       * carry several max. packet sized transactions. */
       if (transfer && (td->size != to_transfer))
-	transfer->last_trans = i;
+	transfer->last_trans = td->tr_index
+	  + (td->size - to_transfer - 1) / transfer->max;
 
       *actual += td->size - to_transfer;
 
@@ -1165,7 +1182,7 @@ grub_ehci_free_tds (struct grub_ehci *e, grub_ehci_td_t td,
    * transferred (it should be all data in this case), set it
    * to index of last TD, i.e. i-1 */
   if (transfer && (transfer->last_trans < 0) && (*actual != 0))
-    transfer->last_trans = i - 1;
+    transfer->last_trans = transfer->transcnt - 1;
 
   /* XXX: Fix it: last_trans may be set to bad index.
    * Probably we should test more error flags to distinguish
@@ -1272,6 +1289,7 @@ grub_ehci_transaction (struct grub_ehci *e,
 
   /* Remember data size for future use... */
   td->size = (grub_uint32_t) size;
+  sync_td (td);
 
   grub_dprintf ("ehci", "td=%p\n", td);
   grub_dprintf ("ehci", "HW: next_td=%08x, alt_next_td=%08x\n",
@@ -1308,7 +1326,7 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
   struct grub_ehci *e = (struct grub_ehci *) dev->data;
   grub_ehci_td_t td = NULL;
   grub_ehci_td_t td_prev = NULL;
-  int i;
+  int i, j;
   struct grub_ehci_transfer_controller_data *cdata;
   grub_uint32_t status;
 
@@ -1363,13 +1381,30 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
   cdata->td_alt_virt->next_td = grub_cpu_to_le32_compile_time (GRUB_EHCI_TERMINATE);
   cdata->td_alt_virt->alt_next_td = grub_cpu_to_le32_compile_time (GRUB_EHCI_TERMINATE);
   cdata->td_alt_virt->token = grub_cpu_to_le32_compile_time (GRUB_EHCI_STATUS_HALTED);
+  sync_td (cdata->td_alt_virt);
 
-  /* Allocate appropriate number of TDs and set */
-  for (i = 0; i < transfer->transcnt; i++)
+  /* Allocate appropriate number of TDs and set. Consecutive full sized
+   * transactions of the same direction with contiguous data are queued
+   * in one TD, EHCI splits them into packets itself and keeps toggle. */
+  for (i = 0; i < transfer->transcnt; i = j)
     {
       grub_usb_transaction_t tr = &transfer->transactions[i];
+      grub_size_t size = tr->size;
+
+      for (j = i + 1; j < transfer->transcnt; j++)
+	{
+	  grub_usb_transaction_t next = &transfer->transactions[j];
+
+	  if (transfer->transactions[j - 1].size != transfer->max
+	      || next->pid != tr->pid
+	      || next->data != tr->data + size
+	      || ((tr->data % GRUB_EHCI_BUFPAGELEN) + size + next->size
+		  > GRUB_EHCI_MAXBUFLEN))
+	    break;
+	  size += next->size;
+	}
 
-      td = grub_ehci_transaction (e, tr->pid, tr->toggle, tr->size,
+      td = grub_ehci_transaction (e, tr->pid, tr->toggle, size,
 				  tr->data, cdata->td_alt_virt);
 
       if (!td)			/* de-allocate and free all */
@@ -1383,6 +1418,7 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
 	  grub_dprintf ("ehci", "setup_transfer: no TD\n");
 	  return GRUB_USB_ERR_INTERNAL;
 	}
+      td->tr_index = i;
 
       /* Register new TD in cdata or previous TD */
       if (!cdata->td_first_virt)
@@ -1392,6 +1428,7 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
 	  td_prev->link_td = grub_dma_virt2phys (td, e->td_chunk);
 	  td_prev->next_td =
 	    grub_cpu_to_le32 (grub_dma_virt2phys (td, e->td_chunk));
+	  sync_td (td_prev);
 	}
       td_prev = td;
     }
@@ -1401,6 +1438,7 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
   cdata->td_last_phys = grub_dma_virt2phys (td, e->td_chunk);
   /* Last TD should not have set alternate TD */
   cdata->td_last_virt->alt_next_td = grub_cpu_to_le32_compile_time (GRUB_EHCI_TERMINATE);
+  sync_td (cdata->td_last_virt);
 
   grub_dprintf ("ehci", "setup_transfer: cdata=%p, qh=%p\n",
 		cdata,cdata->qh_virt);
@@ -1422,7 +1460,7 @@ grub_ehci_setup_transfer (grub_usb_controller_t dev,
    * i.e. reset token */
   cdata->qh_virt->td_overlay.token = grub_cpu_to_le32_compile_time (0);
 
-  sync_all_caches (e);
+  sync_qh (cdata->qh_virt);
 
   /* Finito */
   transfer->controller_data = cdata;
@@ -1449,6 +1487,7 @@ grub_ehci_pre_finish_transfer (grub_usb_transfer_t transfer)
 				      grub_cpu_to_le32_compile_time
 				      (GRUB_EHCI_STATUS_HALTED)) &
     grub_cpu_to_le32_compile_time (~GRUB_EHCI_STATUS_ACTIVE);
+  sync_qh (cdata->qh_virt);
 
   /* Print debug data here if necessary */
 
@@ -1472,8 +1511,6 @@ grub_ehci_parse_notrun (grub_usb_controller_t dev,
   grub_ehci_free_td (e, cdata->td_alt_virt);
   grub_free (cdata);
 
-  sync_all_caches (e);
-
   /* Additionally, do something with EHCI to make it running (what?) */
   /* Try enable EHCI and AL */
   grub_ehci_oper_write32 (e, GRUB_EHCI_COMMAND,
@@ -1509,8 +1546,6 @@ grub_ehci_parse_halt (grub_usb_controller_t dev,
   grub_ehci_free_td (e, cdata->td_alt_virt);
   grub_free (cdata);
 
-  sync_all_caches (e);
-
   /* Evaluation of error code - currently we don't have GRUB USB error
    * codes for some EHCI states, GRUB_USB_ERR_DATA is used for them.
    * Order of evaluation is critical, specially bubble/stall. */
@@ -1544,8 +1579,6 @@ grub_ehci_parse_success (grub_usb_controller_t dev,
   grub_ehci_free_td (e, cdata->td_alt_virt);
   grub_free (cdata);
 
-  sync_all_caches (e);
-
   return GRUB_USB_ERR_NONE;
 }
 
@@ -1557,14 +1590,17 @@ grub_ehci_check_transfer (grub_usb_controller_t dev,
   struct grub_ehci *e = dev->data;
   struct grub_ehci_transfer_controller_data *cdata =
     transfer->controller_data;
-  grub_uint32_t token, token_ftd;
+  grub_uint32_t token, token_ftd, status;
 
-  sync_all_caches (e);
+  sync_qh (cdata->qh_virt);
+  sync_td (cdata->td_first_virt);
+
+  /* One register read per poll is enough, MMIO is slow.  */
+  status = grub_ehci_oper_read32 (e, GRUB_EHCI_STATUS);
 
   grub_dprintf ("ehci",
 		"check_transfer: EHCI STATUS=%08x, cdata=%p, qh=%p\n",
-		grub_ehci_oper_read32 (e, GRUB_EHCI_STATUS),
-		cdata, cdata->qh_virt);
+		status, cdata, cdata->qh_virt);
   grub_dprintf ("ehci", "check_transfer: qh_hptr=%08x, ep_char=%08x\n",
 		grub_le_to_cpu32 (cdata->qh_virt->qh_hptr),
 		grub_le_to_cpu32 (cdata->qh_virt->ep_char));
@@ -1579,11 +1615,9 @@ grub_ehci_check_transfer (grub_usb_controller_t dev,
 		grub_le_to_cpu32 (cdata->qh_virt->td_overlay.buffer_page[0]));
 
   /* Check if EHCI is running and AL is enabled */
-  if ((grub_ehci_oper_read32 (e, GRUB_EHCI_STATUS)
-       & GRUB_EHCI_ST_HC_HALTED) != 0)
+  if ((status & GRUB_EHCI_ST_HC_HALTED) != 0)
     return grub_ehci_parse_notrun (dev, transfer, actual);
-  if ((grub_ehci_oper_read32 (e, GRUB_EHCI_STATUS)
-       & (GRUB_EHCI_ST_AS_STATUS | GRUB_EHCI_ST_PS_STATUS)) == 0)
+  if ((status & (GRUB_EHCI_ST_AS_STATUS | GRUB_EHCI_ST_PS_STATUS)) == 0)
     return grub_ehci_parse_notrun (dev, transfer, actual);
 
   token = grub_le_to_cpu32 (cdata->qh_virt->td_overlay.token);
@@ -1985,8 +2019,10 @@ static struct grub_usb_controller_dev usb_controller = {
   .hubports = grub_ehci_hubports,
   .portstatus = grub_ehci_portstatus,
   .detect_dev = grub_ehci_detect_dev,
-  /* estimated max. count of TDs for one bulk transfer */
-  .max_bulk_tds = GRUB_EHCI_N_TD * 3 / 4 
+  /* estimated max. count of transactions for one bulk transfer - one TD
+   * carries at least 16 full sized packets, so this needs at most
+   * a quarter of all TDs */
+  .max_bulk_tds = GRUB_EHCI_N_TD * 4
 };
 
 GRUB_MOD_INIT (ehci)
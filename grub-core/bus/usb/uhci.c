@@ -365,7 +365,8 @@ grub_uhci_pci_iter (grub_pci_device_t dev,
 static void
 grub_uhci_inithw (void)
 {
-  grub_pci_iterate (grub_uhci_pci_iter, NULL);
+  /* USB controllers with the UHCI interface.  */
+  grub_pci_iterate_class (0x0c0300, 0xffffff, grub_uhci_pci_iter, NULL);
 }
 
 static grub_uhci_td_t
@@ -115,7 +115,7 @@ grub_usb_device_initialize (grub_usb_device_t dev)
   struct grub_usb_desc_device *descdev;
   struct grub_usb_desc_config config;
   grub_usb_err_t err;
-  int i;
+  int i, k;
 
   /* First we have to read first 8 bytes only and determine
    * max. size of packet */
@@ -149,6 +149,7 @@ grub_usb_device_initialize (grub_usb_device_t dev)
       int currif;
       char *data;
       struct grub_usb_desc *desc;
+      struct grub_usb_desc_endp *endp;
 
       /* First just read the first 4 bytes of the configuration
 	 descriptor, after that it is known how many bytes really have
@@ -206,10 +207,39 @@ grub_usb_device_initialize (grub_usb_device_t dev)
             }
 
 	  /* Point to the first endpoint.  */
-	  dev->config[i].interf[currif].descendp
-	    = (struct grub_usb_desc_endp *) &data[pos];
-	  pos += (sizeof (struct grub_usb_desc_endp)
-		  * dev->config[i].interf[currif].descif->endpointcnt);
+	  endp = (struct grub_usb_desc_endp *) &data[pos];
+	  dev->config[i].interf[currif].descendp = endp;
+
+	  /* SuperSpeed devices put a companion descriptor behind every
+	     endpoint, move the endpoints together so that they can be
+	     used as an array.  */
+	  for (k = 0; k < dev->config[i].interf[currif].descif->endpointcnt
+		 && pos < config.totallen; )
+	    {
+	      desc = (struct grub_usb_desc *) &data[pos];
+	      if (!desc->length)
+		{
+		  err = GRUB_USB_ERR_BADDEVICE;
+		  goto fail;
+		}
+	      if (desc->type == GRUB_USB_DESCRIPTOR_ENDPOINT)
+		{
+		  if (desc->length < sizeof (*endp)
+		      || pos + sizeof (*endp) > config.totallen)
+		    {
+		      err = GRUB_USB_ERR_BADDEVICE;
+		      goto fail;
+		    }
+		  grub_memmove (&endp[k], desc, sizeof (*endp));
+		  k++;
+		}
+	      else if (desc->type == GRUB_USB_DESCRIPTOR_SS_ENDPOINT_COMPANION
+		       && k > 0 && pos + 2 < config.totallen)
+		dev->ss_maxburst[endp[k - 1].endp_addr] = data[pos + 2];
+	      else if (desc->type == GRUB_USB_DESCRIPTOR_INTERFACE)
+		break;
+	      pos += desc->length;
+	    }
 	}
     }
 
@@ -350,6 +350,19 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   return err;
 }
 
+/* Return the largest data length which is queued to the host controller
+   as a single transfer on ENDPOINT.  */
+grub_size_t
+grub_usb_bulk_max_transfer (grub_usb_device_t dev,
+			    struct grub_usb_desc_endp *endpoint)
+{
+  if (!dev->controller.dev->max_bulk_tds)
+    return MAX_USB_TRANSFER_LEN;
+
+  return dev->controller.dev->max_bulk_tds
+    * grub_usb_bulk_maxpacket (dev, endpoint);
+}
+
 static grub_usb_err_t
 grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
 				   struct grub_usb_desc_endp *endpoint,
@@ -359,16 +372,9 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
   grub_size_t actual, transferred;
   grub_usb_err_t err = GRUB_USB_ERR_NONE;
   grub_size_t current_size, position;
-  grub_size_t max_bulk_transfer_len = MAX_USB_TRANSFER_LEN;
-  grub_size_t max;
+  grub_size_t max_bulk_transfer_len;
 
-  if (dev->controller.dev->max_bulk_tds)
-    {
-      max = grub_usb_bulk_maxpacket (dev, endpoint);
-
-      /* Calculate max. possible length of bulk transfer */
-      max_bulk_transfer_len = dev->controller.dev->max_bulk_tds * max;
-    }
+  max_bulk_transfer_len = grub_usb_bulk_max_transfer (dev, endpoint);
 
   for (position = 0, transferred = 0;
        position < size; position += max_bulk_transfer_len)
@@ -376,8 +382,10 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
       current_size = size - position;
       if (current_size >= max_bulk_transfer_len)
 	current_size = max_bulk_transfer_len;
+      /* Large transfers are queued to the controller as a whole, give
+	 them time proportional to their size (at least 1 MiB/s).  */
       err = grub_usb_bulk_readwrite (dev, endpoint, current_size,
-              &data[position], type, 1000, &actual);
+              &data[position], type, 1000 + (current_size >> 10), &actual);
       transferred += actual;
       if (err || (current_size != actual)) break;
     }
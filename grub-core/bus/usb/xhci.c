@@ -0,0 +1,2003 @@
+/* xhci.c - XHCI Support.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/usb.h>
+#include <grub/usbtrans.h>
+#include <grub/misc.h>
+#include <grub/pci.h>
+#include <grub/cpu/pci.h>
+#include <grub/time.h>
+#include <grub/loader.h>
+#include <grub/disk.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* This simple GRUB implementation of XHCI driver:
+ *      - assumes no IRQ, the event ring is polled
+ *      - uses a single event ring segment and one transfer ring
+ *        segment per endpoint
+ *      - is not supporting isochronous transfers nor streams
+ *      - is not supporting SuperSpeed hubs (USB 2.0 hubs work)
+ *      - assumes DMA memory is mapped 1:1 and cache coherent (x86)
+ *
+ * The USB core assigns device addresses itself by sending SET_ADDRESS,
+ * while an XHCI host controller does it on its own with the Address
+ * Device command.  So the slot of a freshly reset device is addressed
+ * with BSR=1 (default state) on its first control transfer and the
+ * SET_ADDRESS request is turned into Address Device with BSR=0.  The
+ * location of the device (root port and route string) is known from
+ * the last port reset, which the USB core serializes.
+ */
+
+/* Capability registers offsets */
+enum
+{
+  GRUB_XHCI_CAPLENGTH = 0x00,	/* byte */
+  GRUB_XHCI_HCIVERSION = 0x02,	/* word */
+  GRUB_XHCI_HCSPARAMS1 = 0x04,
+  GRUB_XHCI_HCSPARAMS2 = 0x08,
+  GRUB_XHCI_HCSPARAMS3 = 0x0c,
+  GRUB_XHCI_HCCPARAMS1 = 0x10,
+  GRUB_XHCI_DBOFF = 0x14,
+  GRUB_XHCI_RTSOFF = 0x18
+};
+
+#define GRUB_XHCI_HCS1_MAX_SLOTS(p)	((p) & 0xff)
+#define GRUB_XHCI_HCS1_MAX_PORTS(p)	(((p) >> 24) & 0xff)
+#define GRUB_XHCI_HCS2_MAX_SCRATCH(p)	((((p) >> 21) & 0x1f) << 5 \
+					 | (((p) >> 27) & 0x1f))
+
+/* Capability register HCCPARAMS1 bits */
+enum
+{
+  GRUB_XHCI_HCC_AC64 = (1 << 0),
+  GRUB_XHCI_HCC_CSZ = (1 << 2),
+  GRUB_XHCI_HCC_PPC = (1 << 3)
+};
+
+#define GRUB_XHCI_HCC_XECP(p)	(((p) >> 16) & 0xffff)
+
+/* Operational registers offsets */
+enum
+{
+  GRUB_XHCI_USBCMD = 0x00,
+  GRUB_XHCI_USBSTS = 0x04,
+  GRUB_XHCI_PAGESIZE = 0x08,
+  GRUB_XHCI_DNCTRL = 0x14,
+  GRUB_XHCI_CRCR = 0x18,	/* 64 bits */
+  GRUB_XHCI_DCBAAP = 0x30,	/* 64 bits */
+  GRUB_XHCI_CONFIG = 0x38,
+  GRUB_XHCI_PORTSC = 0x400	/* + 0x10 * port */
+};
+
+/* Operational register USBCMD bits */
+enum
+{
+  GRUB_XHCI_CMD_RUNSTOP = (1 << 0),
+  GRUB_XHCI_CMD_HCRST = (1 << 1)
+};
+
+/* Operational register USBSTS bits */
+enum
+{
+  GRUB_XHCI_STS_HCH = (1 << 0),
+  GRUB_XHCI_STS_HSE = (1 << 2),
+  GRUB_XHCI_STS_CNR = (1 << 11)
+};
+
+#define GRUB_XHCI_CRCR_RCS	(1 << 0)
+
+/* PORTSC bits */
+enum
+{
+  GRUB_XHCI_PORTSC_CCS = (1 << 0),
+  GRUB_XHCI_PORTSC_PED = (1 << 1),
+  GRUB_XHCI_PORTSC_PR = (1 << 4),
+  GRUB_XHCI_PORTSC_PP = (1 << 9),
+  GRUB_XHCI_PORTSC_SPEED_MASK = (0xf << 10),
+  GRUB_XHCI_PORTSC_PIC_MASK = (3 << 14),
+  GRUB_XHCI_PORTSC_CSC = (1 << 17),
+  GRUB_XHCI_PORTSC_PEC = (1 << 18),
+  GRUB_XHCI_PORTSC_WRC = (1 << 19),
+  GRUB_XHCI_PORTSC_OCC = (1 << 20),
+  GRUB_XHCI_PORTSC_PRC = (1 << 21),
+  GRUB_XHCI_PORTSC_PLC = (1 << 22),
+  GRUB_XHCI_PORTSC_CEC = (1 << 23),
+  GRUB_XHCI_PORTSC_WAKE_MASK = (7 << 25)
+};
+
+#define GRUB_XHCI_PORTSC_SPEED_SHIFT	10
+
+/* Bits which are written back unchanged when PORTSC is modified,
+   all others are either RW1C, RW1S or written as zero.  */
+#define GRUB_XHCI_PORTSC_PRESERVE	(GRUB_XHCI_PORTSC_PP \
+					 | GRUB_XHCI_PORTSC_PIC_MASK \
+					 | GRUB_XHCI_PORTSC_WAKE_MASK)
+
+/* Protocol speed IDs (default mapping) */
+enum
+{
+  GRUB_XHCI_SPEED_FULL = 1,
+  GRUB_XHCI_SPEED_LOW = 2,
+  GRUB_XHCI_SPEED_HIGH = 3,
+  GRUB_XHCI_SPEED_SUPER = 4
+};
+
+/* Runtime registers, interrupter 0 */
+enum
+{
+  GRUB_XHCI_IMAN = 0x20,
+  GRUB_XHCI_IMOD = 0x24,
+  GRUB_XHCI_ERSTSZ = 0x28,
+  GRUB_XHCI_ERSTBA = 0x30,	/* 64 bits */
+  GRUB_XHCI_ERDP = 0x38		/* 64 bits */
+};
+
+#define GRUB_XHCI_ERDP_EHB	(1 << 3)
+
+/* Extended capabilities */
+enum
+{
+  GRUB_XHCI_EXT_CAP_LEGACY = 1,
+  GRUB_XHCI_EXT_CAP_PROTOCOL = 2
+};
+
+/* USBLEGSUP bits */
+enum
+{
+  GRUB_XHCI_BIOS_OWNED = (1 << 16),
+  GRUB_XHCI_OS_OWNED = (1 << 24)
+};
+
+/* USBLEGCTLSTS: keep reserved bits, disable SMIs, clear SMI events */
+#define GRUB_XHCI_LEGCTL_KEEP	((7 << 1) | (0xff << 5) | (7 << 17))
+#define GRUB_XHCI_LEGCTL_EVENTS	(7 << 29)
+
+/* Intel PCH port switching registers in the PCI configuration space */
+enum
+{
+  GRUB_XHCI_INTEL_XUSB2PR = 0xd0,
+  GRUB_XHCI_INTEL_XUSB2PRM = 0xd4,
+  GRUB_XHCI_INTEL_USB3_PSSEN = 0xd8,
+  GRUB_XHCI_INTEL_USB3PRM = 0xdc
+};
+
+struct grub_xhci_trb
+{
+  grub_uint32_t param_lo;
+  grub_uint32_t param_hi;
+  grub_uint32_t status;
+  grub_uint32_t control;
+};
+
+/* TRB control field bits */
+enum
+{
+  GRUB_XHCI_TRB_CYCLE = (1 << 0),
+  GRUB_XHCI_TRB_TC = (1 << 1),	/* Link TRB: toggle cycle */
+  GRUB_XHCI_TRB_ISP = (1 << 2),
+  GRUB_XHCI_TRB_CH = (1 << 4),
+  GRUB_XHCI_TRB_IOC = (1 << 5),
+  GRUB_XHCI_TRB_IDT = (1 << 6),
+  GRUB_XHCI_TRB_BSR = (1 << 9),	/* Address Device */
+  GRUB_XHCI_TRB_DIR_IN = (1 << 16)	/* Data/Status stage */
+};
+
+#define GRUB_XHCI_TRB_TYPE(t)		((t) << 10)
+#define GRUB_XHCI_TRB_GET_TYPE(c)	(((c) >> 10) & 0x3f)
+#define GRUB_XHCI_TRB_SLOT(s)		((grub_uint32_t) (s) << 24)
+#define GRUB_XHCI_TRB_GET_SLOT(c)	((c) >> 24)
+#define GRUB_XHCI_TRB_EP(e)		((e) << 16)
+#define GRUB_XHCI_TRB_GET_EP(c)		(((c) >> 16) & 0x1f)
+#define GRUB_XHCI_TRB_TRT(t)		((t) << 16)	/* Setup stage */
+#define GRUB_XHCI_TRB_TD_SIZE(s)	((s) << 17)
+#define GRUB_XHCI_TRB_LEN_MASK		0x1ffff
+#define GRUB_XHCI_EVENT_CODE(s)		((s) >> 24)
+#define GRUB_XHCI_EVENT_LEN(s)		((s) & 0xffffff)
+
+/* TRB types */
+enum
+{
+  GRUB_XHCI_TRB_NORMAL = 1,
+  GRUB_XHCI_TRB_SETUP = 2,
+  GRUB_XHCI_TRB_DATA = 3,
+  GRUB_XHCI_TRB_STATUS = 4,
+  GRUB_XHCI_TRB_LINK = 6,
+  GRUB_XHCI_TRB_ENABLE_SLOT = 9,
+  GRUB_XHCI_TRB_DISABLE_SLOT = 10,
+  GRUB_XHCI_TRB_ADDRESS_DEVICE = 11,
+  GRUB_XHCI_TRB_CONFIGURE_EP = 12,
+  GRUB_XHCI_TRB_EVALUATE_CTX = 13,
+  GRUB_XHCI_TRB_RESET_EP = 14,
+  GRUB_XHCI_TRB_STOP_EP = 15,
+  GRUB_XHCI_TRB_SET_TR_DEQ = 16,
+  GRUB_XHCI_TRB_TRANSFER_EVENT = 32,
+  GRUB_XHCI_TRB_CMD_COMPLETION = 33
+};
+
+/* Setup stage transfer types */
+enum
+{
+  GRUB_XHCI_TRT_NO_DATA = 0,
+  GRUB_XHCI_TRT_OUT = 2,
+  GRUB_XHCI_TRT_IN = 3
+};
+
+/* Completion codes */
+enum
+{
+  GRUB_XHCI_CC_SUCCESS = 1,
+  GRUB_XHCI_CC_DATA_BUFFER = 2,
+  GRUB_XHCI_CC_BABBLE = 3,
+  GRUB_XHCI_CC_TRANSACTION = 4,
+  GRUB_XHCI_CC_STALL = 6,
+  GRUB_XHCI_CC_SHORT_PACKET = 13
+};
+
+/* Endpoint types in the endpoint context */
+enum
+{
+  GRUB_XHCI_EP_BULK_OUT = 2,
+  GRUB_XHCI_EP_INTERRUPT_OUT = 3,
+  GRUB_XHCI_EP_CONTROL = 4,
+  GRUB_XHCI_EP_BULK_IN = 6,
+  GRUB_XHCI_EP_INTERRUPT_IN = 7
+};
+
+#define GRUB_XHCI_EP_STATE_MASK		7
+#define GRUB_XHCI_EP_STATE_RUNNING	1
+
+/* Number of TRBs in one ring segment, the last one is the Link TRB.  */
+#define GRUB_XHCI_RING_TRBS	256
+#define GRUB_XHCI_EVENT_TRBS	256
+/* Context index of the default control endpoint.  */
+#define GRUB_XHCI_EP0		1
+#define GRUB_XHCI_MAX_ADDR	128
+/* A TRB buffer must not cross a 64K boundary.  */
+#define GRUB_XHCI_TRB_MAX_LEN	0x10000
+/* The transfer rings are large, the limit is given by the size of
+   a single bulk transfer the USB core allocates at once.  */
+#define GRUB_XHCI_MAX_BULK_TDS	1024
+
+struct grub_xhci_ring
+{
+  struct grub_pci_dma_chunk *chunk;
+  volatile struct grub_xhci_trb *trbs;
+  grub_uint32_t phys;
+  unsigned enqueue;
+  grub_uint32_t cycle;
+};
+
+struct grub_xhci_transfer_controller_data;
+
+struct grub_xhci_ep
+{
+  struct grub_xhci_ring ring;
+  enum
+  {
+    GRUB_XHCI_EP_DISABLED,
+    GRUB_XHCI_EP_ENABLED,
+    /* Enabled, but the data toggle must be reset before next use.  */
+    GRUB_XHCI_EP_NEEDS_RESET
+  } state;
+  struct grub_xhci_transfer_controller_data *active;
+};
+
+struct grub_xhci_slot
+{
+  int id;
+  struct grub_pci_dma_chunk *out_chunk;
+  volatile grub_uint8_t *out_ctx;
+  grub_uint32_t out_phys;
+  struct grub_pci_dma_chunk *in_chunk;
+  volatile grub_uint8_t *in_ctx;
+  grub_uint32_t in_phys;
+  grub_uint32_t route;
+  int root_port;
+  int depth;
+  unsigned mps0;
+  struct grub_xhci_ep eps[32];
+};
+
+struct grub_xhci_transfer_controller_data
+{
+  struct grub_xhci_slot *slot;
+  int dci;
+  unsigned first;
+  unsigned last;
+  int control;
+  int done;
+  int actual_valid;
+  grub_uint8_t code;
+  grub_usb_err_t err;
+  grub_size_t actual;
+};
+
+struct grub_xhci
+{
+  volatile grub_uint8_t *iobase;	/* Capability registers */
+  volatile grub_uint8_t *oper;		/* Operational registers */
+  volatile grub_uint8_t *runtime;	/* Runtime registers */
+  volatile grub_uint32_t *doorbell;
+  unsigned max_slots;
+  unsigned max_ports;
+  unsigned ctxsize;
+  grub_uint8_t *port_usb3;	/* Per port: 1 if it is a USB 3 port */
+  struct grub_pci_dma_chunk *dcbaa_chunk;
+  volatile grub_uint32_t *dcbaa;
+  grub_uint32_t dcbaa_phys;
+  struct grub_pci_dma_chunk *scratch_array_chunk;
+  struct grub_pci_dma_chunk *scratch_chunk;
+  struct grub_xhci_ring cmd_ring;
+  struct grub_xhci_ring event_ring;
+  struct grub_pci_dma_chunk *erst_chunk;
+  grub_uint32_t erst_phys;
+  unsigned ev_dequeue;
+  grub_uint32_t ev_cycle;
+  /* Command in flight */
+  grub_uint32_t cmd_trb;
+  int cmd_done;
+  grub_uint8_t cmd_code;
+  grub_uint8_t cmd_slot;
+  struct grub_xhci_slot **slots;
+  grub_uint8_t addr_slot[GRUB_XHCI_MAX_ADDR];
+  /* Slot of the device which still has the default address 0 */
+  int default_slot;
+  /* Location of the port which was reset last */
+  int reset_root_port;
+  grub_uint32_t reset_route;
+  int reset_depth;
+  grub_usb_speed_t reset_speed;
+  struct grub_xhci *next;
+};
+
+static struct grub_xhci *xhci;
+
+/* Registers access functions */
+static inline grub_uint32_t
+grub_xhci_read32 (volatile grub_uint8_t *base, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (*(volatile grub_uint32_t *) (base + addr));
+}
+
+static inline void
+grub_xhci_write32 (volatile grub_uint8_t *base, grub_uint32_t addr,
+		   grub_uint32_t value)
+{
+  *(volatile grub_uint32_t *) (base + addr) = grub_cpu_to_le32 (value);
+}
+
+/* All our structures are below 4G, upper halves are always zero.  */
+static inline void
+grub_xhci_write64 (volatile grub_uint8_t *base, grub_uint32_t addr,
+		   grub_uint32_t value)
+{
+  grub_xhci_write32 (base, addr, value);
+  grub_xhci_write32 (base, addr + 4, 0);
+}
+
+static inline grub_uint32_t
+grub_xhci_port_read (struct grub_xhci *x, unsigned int port)
+{
+  return grub_xhci_read32 (x->oper, GRUB_XHCI_PORTSC + port * 0x10);
+}
+
+static inline void
+grub_xhci_port_setbits (struct grub_xhci *x, unsigned int port,
+			grub_uint32_t bits)
+{
+  grub_xhci_write32 (x->oper, GRUB_XHCI_PORTSC + port * 0x10,
+		     (grub_xhci_port_read (x, port)
+		      & GRUB_XHCI_PORTSC_PRESERVE) | bits);
+  grub_xhci_port_read (x, port);
+}
+
+static grub_usb_speed_t
+grub_xhci_port_speed (grub_uint32_t portsc)
+{
+  switch ((portsc & GRUB_XHCI_PORTSC_SPEED_MASK)
+	  >> GRUB_XHCI_PORTSC_SPEED_SHIFT)
+    {
+    case GRUB_XHCI_SPEED_LOW:
+      return GRUB_USB_SPEED_LOW;
+    case GRUB_XHCI_SPEED_FULL:
+      return GRUB_USB_SPEED_FULL;
+    case GRUB_XHCI_SPEED_HIGH:
+      return GRUB_USB_SPEED_HIGH;
+    case 0:
+      return GRUB_USB_SPEED_NONE;
+    default:
+      return GRUB_USB_SPEED_SUPER;
+    }
+}
+
+static grub_uint32_t
+grub_xhci_speed_id (grub_usb_speed_t speed)
+{
+  switch (speed)
+    {
+    case GRUB_USB_SPEED_LOW:
+      return GRUB_XHCI_SPEED_LOW;
+    case GRUB_USB_SPEED_HIGH:
+      return GRUB_XHCI_SPEED_HIGH;
+    case GRUB_USB_SPEED_SUPER:
+      return GRUB_XHCI_SPEED_SUPER;
+    case GRUB_USB_SPEED_FULL:
+    default:
+      return GRUB_XHCI_SPEED_FULL;
+    }
+}
+
+/* Context access, input contexts start with the Input Control Context
+   so INDEX 0 is the control context, 1 the slot and 1 + DCI an
+   endpoint.  Output contexts start with the slot context.  */
+static inline volatile grub_uint32_t *
+grub_xhci_in_ctx (struct grub_xhci *x, struct grub_xhci_slot *s, int index)
+{
+  return (volatile grub_uint32_t *) (s->in_ctx + index * x->ctxsize);
+}
+
+static inline volatile grub_uint32_t *
+grub_xhci_out_ctx (struct grub_xhci *x, struct grub_xhci_slot *s, int index)
+{
+  return (volatile grub_uint32_t *) (s->out_ctx + index * x->ctxsize);
+}
+
+static void
+grub_xhci_ctx_copy (struct grub_xhci *x, volatile grub_uint32_t *dst,
+		    volatile grub_uint32_t *src)
+{
+  unsigned i;
+
+  for (i = 0; i < x->ctxsize / 4; i++)
+    dst[i] = src[i];
+}
+
+static void
+grub_xhci_in_ctx_clear (struct grub_xhci *x, struct grub_xhci_slot *s)
+{
+  grub_memset ((void *) s->in_ctx, 0, 33 * x->ctxsize);
+}
+
+/* Rings */
+static void
+grub_xhci_ring_reset (struct grub_xhci_ring *ring, unsigned ntrbs)
+{
+  grub_memset ((void *) ring->trbs, 0, ntrbs * sizeof (ring->trbs[0]));
+  ring->enqueue = 0;
+  ring->cycle = GRUB_XHCI_TRB_CYCLE;
+  /* Link TRB at the end points back to the start.  */
+  ring->trbs[ntrbs - 1].param_lo = grub_cpu_to_le32 (ring->phys);
+  ring->trbs[ntrbs - 1].param_hi = 0;
+}
+
+static grub_err_t
+grub_xhci_ring_alloc (struct grub_xhci_ring *ring, unsigned ntrbs)
+{
+  /* A ring segment must not cross a 64K boundary.  */
+  ring->chunk = grub_memalign_dma32 (4096, ntrbs * sizeof (ring->trbs[0]));
+  if (!ring->chunk)
+    return grub_errno;
+  ring->trbs = grub_dma_get_virt (ring->chunk);
+  ring->phys = grub_dma_get_phys (ring->chunk);
+  grub_xhci_ring_reset (ring, ntrbs);
+  return GRUB_ERR_NONE;
+}
+
+/* Put one TRB on a transfer or command ring and return its index.  */
+static unsigned
+grub_xhci_ring_enqueue (struct grub_xhci_ring *ring, grub_uint32_t param_lo,
+			grub_uint32_t param_hi, grub_uint32_t status,
+			grub_uint32_t control)
+{
+  volatile struct grub_xhci_trb *trb = &ring->trbs[ring->enqueue];
+  unsigned idx = ring->enqueue;
+
+  trb->param_lo = grub_cpu_to_le32 (param_lo);
+  trb->param_hi = grub_cpu_to_le32 (param_hi);
+  trb->status = grub_cpu_to_le32 (status);
+  trb->control = grub_cpu_to_le32 (control | ring->cycle);
+
+  if (++ring->enqueue == GRUB_XHCI_RING_TRBS - 1)
+    {
+      /* Hand over the Link TRB, keeping the chain bit of a TD which
+	 continues behind it.  */
+      ring->trbs[ring->enqueue].control
+	= grub_cpu_to_le32 (GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_LINK)
+			    | GRUB_XHCI_TRB_TC
+			    | (control & GRUB_XHCI_TRB_CH) | ring->cycle);
+      ring->enqueue = 0;
+      ring->cycle ^= GRUB_XHCI_TRB_CYCLE;
+    }
+  return idx;
+}
+
+static inline unsigned
+grub_xhci_ring_next (unsigned idx)
+{
+  return (idx + 1) % (GRUB_XHCI_RING_TRBS - 1);
+}
+
+static inline unsigned
+grub_xhci_ring_distance (unsigned from, unsigned to)
+{
+  return (to + GRUB_XHCI_RING_TRBS - 1 - from) % (GRUB_XHCI_RING_TRBS - 1);
+}
+
+/* Event handling */
+static void
+grub_xhci_transfer_event (struct grub_xhci *x,
+			  volatile struct grub_xhci_trb *ev)
+{
+  grub_uint32_t control = grub_le_to_cpu32 (ev->control);
+  grub_uint32_t status = grub_le_to_cpu32 (ev->status);
+  grub_uint32_t ptr = grub_le_to_cpu32 (ev->param_lo);
+  unsigned slotid = GRUB_XHCI_TRB_GET_SLOT (control);
+  int dci = GRUB_XHCI_TRB_GET_EP (control);
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_ring *ring;
+  grub_uint8_t code = GRUB_XHCI_EVENT_CODE (status);
+  unsigned idx, i;
+
+  if (slotid == 0 || slotid > x->max_slots || !x->slots[slotid])
+    return;
+  cdata = x->slots[slotid]->eps[dci].active;
+  if (!cdata || cdata->done)
+    return;
+  ring = &x->slots[slotid]->eps[dci].ring;
+
+  if (ev->param_hi || ptr < ring->phys
+      || ptr >= ring->phys + (GRUB_XHCI_RING_TRBS - 1)
+      * sizeof (struct grub_xhci_trb))
+    return;
+  idx = (ptr - ring->phys) / sizeof (struct grub_xhci_trb);
+
+  /* Ignore stale events of a transfer which has finished earlier.  */
+  if (grub_xhci_ring_distance (cdata->first, idx)
+      > grub_xhci_ring_distance (cdata->first, cdata->last))
+    return;
+
+  if (!cdata->actual_valid)
+    {
+      grub_size_t actual = 0;
+
+      for (i = cdata->first; ; i = grub_xhci_ring_next (i))
+	{
+	  grub_uint32_t c = grub_le_to_cpu32 (ring->trbs[i].control);
+	  grub_uint32_t len = grub_le_to_cpu32 (ring->trbs[i].status)
+	    & GRUB_XHCI_TRB_LEN_MASK;
+
+	  if (GRUB_XHCI_TRB_GET_TYPE (c) == GRUB_XHCI_TRB_NORMAL
+	      || GRUB_XHCI_TRB_GET_TYPE (c) == GRUB_XHCI_TRB_DATA)
+	    {
+	      if (i != idx)
+		actual += len;
+	      else if (GRUB_XHCI_EVENT_LEN (status) < len)
+		actual += len - GRUB_XHCI_EVENT_LEN (status);
+	    }
+	  if (i == idx)
+	    break;
+	}
+      cdata->actual = actual;
+      cdata->actual_valid = (code != GRUB_XHCI_CC_SUCCESS || idx == cdata->last);
+    }
+
+  /* After a short data stage the controller continues with the
+     status stage of a control transfer and reports it separately.  */
+  if (code == GRUB_XHCI_CC_SUCCESS && idx != cdata->last)
+    return;
+  if (code == GRUB_XHCI_CC_SHORT_PACKET && cdata->control
+      && idx != cdata->last)
+    return;
+
+  cdata->code = code;
+  cdata->done = 1;
+}
+
+static void
+grub_xhci_process_events (struct grub_xhci *x)
+{
+  int handled = 0;
+
+  while (1)
+    {
+      volatile struct grub_xhci_trb *ev
+	= &x->event_ring.trbs[x->ev_dequeue];
+      grub_uint32_t control = grub_le_to_cpu32 (ev->control);
+
+      if ((control & GRUB_XHCI_TRB_CYCLE) != x->ev_cycle)
+	break;
+
+      switch (GRUB_XHCI_TRB_GET_TYPE (control))
+	{
+	case GRUB_XHCI_TRB_TRANSFER_EVENT:
+	  grub_xhci_transfer_event (x, ev);
+	  break;
+	case GRUB_XHCI_TRB_CMD_COMPLETION:
+	  if (grub_le_to_cpu32 (ev->param_lo) == x->cmd_trb)
+	    {
+	      x->cmd_code = GRUB_XHCI_EVENT_CODE (grub_le_to_cpu32 (ev->status));
+	      x->cmd_slot = GRUB_XHCI_TRB_GET_SLOT (control);
+	      x->cmd_done = 1;
+	    }
+	  break;
+	default:
+	  /* Port status changes are found by polling PORTSC.  */
+	  break;
+	}
+
+      if (++x->ev_dequeue == GRUB_XHCI_EVENT_TRBS)
+	{
+	  x->ev_dequeue = 0;
+	  x->ev_cycle ^= GRUB_XHCI_TRB_CYCLE;
+	}
+      handled = 1;
+    }
+
+  if (handled)
+    grub_xhci_write64 (x->runtime, GRUB_XHCI_ERDP,
+		       (x->event_ring.phys
+			+ x->ev_dequeue * sizeof (struct grub_xhci_trb))
+		       | GRUB_XHCI_ERDP_EHB);
+}
+
+/* Commands */
+static grub_usb_err_t
+grub_xhci_command (struct grub_xhci *x, grub_uint32_t param,
+		   grub_uint32_t control)
+{
+  grub_uint64_t maxtime;
+  unsigned idx;
+
+  idx = grub_xhci_ring_enqueue (&x->cmd_ring, param, 0, 0, control);
+  x->cmd_trb = x->cmd_ring.phys + idx * sizeof (struct grub_xhci_trb);
+  x->cmd_done = 0;
+  x->doorbell[0] = 0;
+
+  /* Address Device waits for the device, give it enough time.  */
+  maxtime = grub_get_time_ms () + 5000;
+  while (1)
+    {
+      grub_xhci_process_events (x);
+      if (x->cmd_done)
+	break;
+      if (grub_get_time_ms () > maxtime
+	  || (grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS)
+	      & (GRUB_XHCI_STS_HCH | GRUB_XHCI_STS_HSE)))
+	{
+	  grub_dprintf ("xhci", "command %d timed out\n",
+			GRUB_XHCI_TRB_GET_TYPE (control));
+	  return GRUB_USB_ERR_TIMEOUT;
+	}
+      grub_cpu_idle ();
+    }
+
+  if (x->cmd_code != GRUB_XHCI_CC_SUCCESS)
+    {
+      grub_dprintf ("xhci", "command %d failed: %d\n",
+		    GRUB_XHCI_TRB_GET_TYPE (control), x->cmd_code);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_command_ep (struct grub_xhci *x, struct grub_xhci_slot *s,
+		      int dci, grub_uint32_t type)
+{
+  return grub_xhci_command (x, 0, GRUB_XHCI_TRB_TYPE (type)
+			    | GRUB_XHCI_TRB_SLOT (s->id)
+			    | GRUB_XHCI_TRB_EP (dci));
+}
+
+/* Point the controller to the end of our ring, skipping anything not
+   processed yet.  */
+static grub_usb_err_t
+grub_xhci_set_dequeue (struct grub_xhci *x, struct grub_xhci_slot *s,
+		       int dci)
+{
+  struct grub_xhci_ring *ring = &s->eps[dci].ring;
+
+  return grub_xhci_command (x, (ring->phys
+				+ ring->enqueue * sizeof (struct grub_xhci_trb))
+			    | ring->cycle,
+			    GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_SET_TR_DEQ)
+			    | GRUB_XHCI_TRB_SLOT (s->id)
+			    | GRUB_XHCI_TRB_EP (dci));
+}
+
+/* Slots */
+static void
+grub_xhci_free_slot (struct grub_xhci_slot *s)
+{
+  int i;
+
+  for (i = 0; i < 32; i++)
+    if (s->eps[i].ring.chunk)
+      grub_dma_free (s->eps[i].ring.chunk);
+  if (s->in_chunk)
+    grub_dma_free (s->in_chunk);
+  if (s->out_chunk)
+    grub_dma_free (s->out_chunk);
+  grub_free (s);
+}
+
+static void
+grub_xhci_disable_slot (struct grub_xhci *x, int slotid)
+{
+  struct grub_xhci_slot *s = x->slots[slotid];
+  int i;
+
+  if (!s)
+    return;
+
+  grub_dprintf ("xhci", "disabling slot %d\n", slotid);
+
+  grub_xhci_command (x, 0, GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_DISABLE_SLOT)
+		     | GRUB_XHCI_TRB_SLOT (slotid));
+  x->dcbaa[2 * slotid] = 0;
+  x->slots[slotid] = NULL;
+  for (i = 0; i < GRUB_XHCI_MAX_ADDR; i++)
+    if (x->addr_slot[i] == slotid)
+      x->addr_slot[i] = 0;
+  if (x->default_slot == slotid)
+    x->default_slot = 0;
+
+  grub_xhci_free_slot (s);
+}
+
+static unsigned
+grub_xhci_default_mps0 (grub_usb_speed_t speed)
+{
+  switch (speed)
+    {
+    case GRUB_USB_SPEED_HIGH:
+      return 64;
+    case GRUB_USB_SPEED_SUPER:
+      return 512;
+    default:
+      return 8;
+    }
+}
+
+/* Enable a slot for the device which was reset last and put it into
+   the default state.  */
+static grub_usb_err_t
+grub_xhci_enable_default_slot (struct grub_xhci *x, grub_usb_device_t dev)
+{
+  struct grub_xhci_slot *s;
+  volatile grub_uint32_t *ctx;
+  grub_usb_err_t err;
+  grub_uint32_t tt = 0;
+
+  if (!x->reset_root_port)
+    return GRUB_USB_ERR_INTERNAL;
+
+  err = grub_xhci_command (x, 0,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ENABLE_SLOT));
+  if (err)
+    return err;
+  if (x->cmd_slot == 0 || x->cmd_slot > x->max_slots)
+    return GRUB_USB_ERR_INTERNAL;
+
+  s = grub_zalloc (sizeof (*s));
+  if (!s)
+    goto fail;
+  s->id = x->cmd_slot;
+  s->out_chunk = grub_memalign_dma32 (64, 32 * x->ctxsize);
+  s->in_chunk = grub_memalign_dma32 (64, 33 * x->ctxsize);
+  if (!s->out_chunk || !s->in_chunk
+      || grub_xhci_ring_alloc (&s->eps[GRUB_XHCI_EP0].ring,
+			       GRUB_XHCI_RING_TRBS))
+    goto fail;
+  s->out_ctx = grub_dma_get_virt (s->out_chunk);
+  s->out_phys = grub_dma_get_phys (s->out_chunk);
+  s->in_ctx = grub_dma_get_virt (s->in_chunk);
+  s->in_phys = grub_dma_get_phys (s->in_chunk);
+  grub_memset ((void *) s->out_ctx, 0, 32 * x->ctxsize);
+  grub_xhci_in_ctx_clear (x, s);
+
+  s->root_port = x->reset_root_port;
+  s->route = x->reset_route;
+  s->depth = x->reset_depth;
+  /* The speed of a root port device is known only after the reset.  */
+  if (x->reset_speed != GRUB_USB_SPEED_NONE)
+    dev->speed = x->reset_speed;
+  s->mps0 = grub_xhci_default_mps0 (dev->speed);
+  s->eps[GRUB_XHCI_EP0].state = GRUB_XHCI_EP_ENABLED;
+
+  /* Full/low speed device behind a high speed hub uses its TT.  */
+  if ((dev->speed == GRUB_USB_SPEED_LOW || dev->speed == GRUB_USB_SPEED_FULL)
+      && dev->split_hubaddr > 0 && dev->split_hubaddr < GRUB_XHCI_MAX_ADDR)
+    tt = x->addr_slot[dev->split_hubaddr] | (dev->split_hubport << 8);
+
+  ctx = grub_xhci_in_ctx (x, s, 0);
+  ctx[1] = grub_cpu_to_le32_compile_time ((1 << 0) | (1 << 1));
+  ctx = grub_xhci_in_ctx (x, s, 1);
+  ctx[0] = grub_cpu_to_le32 (s->route
+			     | (grub_xhci_speed_id (dev->speed) << 20)
+			     | (1 << 27));
+  ctx[1] = grub_cpu_to_le32 (s->root_port << 16);
+  ctx[2] = grub_cpu_to_le32 (tt);
+  ctx = grub_xhci_in_ctx (x, s, 1 + GRUB_XHCI_EP0);
+  ctx[1] = grub_cpu_to_le32 ((3 << 1) | (GRUB_XHCI_EP_CONTROL << 3)
+			     | (s->mps0 << 16));
+  ctx[2] = grub_cpu_to_le32 (s->eps[GRUB_XHCI_EP0].ring.phys
+			     | GRUB_XHCI_TRB_CYCLE);
+  ctx[3] = 0;
+  ctx[4] = grub_cpu_to_le32_compile_time (8);
+
+  x->dcbaa[2 * s->id] = grub_cpu_to_le32 (s->out_phys);
+  x->dcbaa[2 * s->id + 1] = 0;
+  x->slots[s->id] = s;
+
+  err = grub_xhci_command (x, s->in_phys,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ADDRESS_DEVICE)
+			   | GRUB_XHCI_TRB_BSR | GRUB_XHCI_TRB_SLOT (s->id));
+  if (err)
+    {
+      grub_xhci_disable_slot (x, s->id);
+      return err;
+    }
+
+  grub_dprintf ("xhci", "slot %d: port %d route %05x speed %d\n",
+		s->id, s->root_port, s->route, dev->speed);
+
+  x->default_slot = s->id;
+  return GRUB_USB_ERR_NONE;
+
+ fail:
+  grub_xhci_command (x, 0, GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_DISABLE_SLOT)
+		     | GRUB_XHCI_TRB_SLOT (x->cmd_slot));
+  if (s)
+    grub_xhci_free_slot (s);
+  return GRUB_USB_ERR_INTERNAL;
+}
+
+/* Move the default slot to the addressed state and bind it to the
+   address the USB core has chosen.  */
+static grub_usb_err_t
+grub_xhci_set_address (struct grub_xhci *x, int addr)
+{
+  struct grub_xhci_slot *s;
+  volatile grub_uint32_t *ctx;
+  grub_usb_err_t err;
+
+  if (!x->default_slot || addr <= 0 || addr >= GRUB_XHCI_MAX_ADDR)
+    return GRUB_USB_ERR_INTERNAL;
+  s = x->slots[x->default_slot];
+
+  /* The address may belong to a device which has gone.  */
+  if (x->addr_slot[addr])
+    grub_xhci_disable_slot (x, x->addr_slot[addr]);
+
+  ctx = grub_xhci_in_ctx (x, s, 0);
+  ctx[0] = 0;
+  ctx[1] = grub_cpu_to_le32_compile_time ((1 << 0) | (1 << 1));
+  err = grub_xhci_command (x, s->in_phys,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ADDRESS_DEVICE)
+			   | GRUB_XHCI_TRB_SLOT (s->id));
+  if (err)
+    return err;
+
+  grub_dprintf ("xhci", "slot %d: address %d (USB address %d)\n", s->id,
+		addr, grub_le_to_cpu32 (grub_xhci_out_ctx (x, s, 0)[3]) & 0xff);
+
+  x->addr_slot[addr] = s->id;
+  x->default_slot = 0;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Tell the controller about the real max. packet size of EP0.  */
+static grub_usb_err_t
+grub_xhci_update_mps0 (struct grub_xhci *x, struct grub_xhci_slot *s,
+		       grub_usb_device_t dev)
+{
+  volatile grub_uint32_t *ctx;
+  unsigned mps0 = dev->descdev.maxsize0;
+  grub_usb_err_t err;
+
+  if (dev->speed == GRUB_USB_SPEED_SUPER && mps0 < 16)
+    mps0 = 1 << mps0;
+  if (!mps0 || mps0 == s->mps0)
+    return GRUB_USB_ERR_NONE;
+
+  grub_xhci_in_ctx_clear (x, s);
+  ctx = grub_xhci_in_ctx (x, s, 0);
+  ctx[1] = grub_cpu_to_le32_compile_time (1 << GRUB_XHCI_EP0);
+  ctx = grub_xhci_in_ctx (x, s, 1 + GRUB_XHCI_EP0);
+  grub_xhci_ctx_copy (x, ctx, grub_xhci_out_ctx (x, s, GRUB_XHCI_EP0));
+  ctx[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (ctx[1]) & 0xffff)
+			     | (mps0 << 16));
+  err = grub_xhci_command (x, s->in_phys,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_EVALUATE_CTX)
+			   | GRUB_XHCI_TRB_SLOT (s->id));
+  if (err)
+    return err;
+  s->mps0 = mps0;
+  return GRUB_USB_ERR_NONE;
+}
+
+static struct grub_usb_desc_endp *
+grub_xhci_find_endp (grub_usb_device_t dev, int endp_addr)
+{
+  int i, j;
+
+  if (!dev->config[0].descconf)
+    return NULL;
+  for (i = 0; i < dev->config[0].descconf->numif; i++)
+    {
+      struct grub_usb_interface *interf = &dev->config[0].interf[i];
+
+      if (!interf->descif)
+	continue;
+      for (j = 0; j < interf->descif->endpointcnt; j++)
+	if (interf->descendp[j].endp_addr == endp_addr)
+	  return &interf->descendp[j];
+    }
+  return NULL;
+}
+
+/* Add the endpoint used by TRANSFER to the slot, or drop and add it
+   again to reset its data toggle / sequence number.  */
+static grub_usb_err_t
+grub_xhci_configure_ep (struct grub_xhci *x, struct grub_xhci_slot *s,
+			grub_usb_transfer_t transfer, int dci)
+{
+  struct grub_xhci_ep *ep = &s->eps[dci];
+  struct grub_usb_desc_endp *endp;
+  grub_usb_device_t dev = transfer->dev;
+  volatile grub_uint32_t *ctx;
+  grub_uint32_t type, mps, burst = 0, interval = 0, entries;
+  int in = (transfer->endpoint & 0x80) != 0;
+  grub_usb_err_t err;
+
+  if (ep->state == GRUB_XHCI_EP_ENABLED)
+    return GRUB_USB_ERR_NONE;
+
+  endp = grub_xhci_find_endp (dev, transfer->endpoint);
+  if (endp && grub_usb_get_ep_type (endp) == GRUB_USB_EP_INTERRUPT)
+    type = in ? GRUB_XHCI_EP_INTERRUPT_IN : GRUB_XHCI_EP_INTERRUPT_OUT;
+  else
+    type = in ? GRUB_XHCI_EP_BULK_IN : GRUB_XHCI_EP_BULK_OUT;
+  mps = endp ? (endp->maxpacket & 0x7ff) : (unsigned) transfer->max;
+
+  if (dev->speed == GRUB_USB_SPEED_SUPER)
+    burst = dev->ss_maxburst[transfer->endpoint];
+  else if (dev->speed == GRUB_USB_SPEED_HIGH && endp
+	   && (type == GRUB_XHCI_EP_INTERRUPT_IN
+	       || type == GRUB_XHCI_EP_INTERRUPT_OUT))
+    burst = (endp->maxpacket >> 11) & 3;
+
+  if (endp && (type == GRUB_XHCI_EP_INTERRUPT_IN
+	       || type == GRUB_XHCI_EP_INTERRUPT_OUT))
+    {
+      if (dev->speed == GRUB_USB_SPEED_HIGH
+	  || dev->speed == GRUB_USB_SPEED_SUPER)
+	/* bInterval is already an exponent of 125us units.  */
+	interval = endp->interval ? endp->interval - 1 : 0;
+      else
+	{
+	  /* bInterval is in frames, convert to 125us units and round
+	     down to a power of two.  */
+	  unsigned frames = endp->interval ? endp->interval : 1;
+
+	  interval = 3;
+	  while ((2U << (interval - 3)) <= frames && interval < 10)
+	    interval++;
+	}
+      if (interval > 15)
+	interval = 15;
+    }
+
+  /* Stop a running endpoint before it's dropped.  */
+  if (ep->state == GRUB_XHCI_EP_NEEDS_RESET
+      && (grub_le_to_cpu32 (grub_xhci_out_ctx (x, s, dci)[0])
+	  & GRUB_XHCI_EP_STATE_MASK) == GRUB_XHCI_EP_STATE_RUNNING)
+    grub_xhci_command_ep (x, s, dci, GRUB_XHCI_TRB_STOP_EP);
+
+  if (!ep->ring.chunk)
+    {
+      if (grub_xhci_ring_alloc (&ep->ring, GRUB_XHCI_RING_TRBS))
+	return GRUB_USB_ERR_INTERNAL;
+    }
+  else
+    grub_xhci_ring_reset (&ep->ring, GRUB_XHCI_RING_TRBS);
+
+  grub_xhci_in_ctx_clear (x, s);
+  ctx = grub_xhci_in_ctx (x, s, 0);
+  if (ep->state == GRUB_XHCI_EP_NEEDS_RESET)
+    ctx[0] = grub_cpu_to_le32 (1 << dci);
+  ctx[1] = grub_cpu_to_le32 ((1 << 0) | (1 << dci));
+
+  ctx = grub_xhci_in_ctx (x, s, 1);
+  grub_xhci_ctx_copy (x, ctx, grub_xhci_out_ctx (x, s, 0));
+  entries = grub_le_to_cpu32 (ctx[0]) >> 27;
+  if ((unsigned) dci > entries)
+    entries = dci;
+  ctx[0] = grub_cpu_to_le32 ((grub_le_to_cpu32 (ctx[0]) & 0x07ffffff)
+			     | (entries << 27));
+  if (dev->descdev.class == GRUB_USB_CLASS_HUB)
+    {
+      /* Hub flag, multi-TT and number of ports are needed for the
+	 transaction translation of full/low speed devices.  */
+      ctx[0] = grub_cpu_to_le32 (grub_le_to_cpu32 (ctx[0]) | (1 << 26)
+				 | ((dev->speed == GRUB_USB_SPEED_HIGH
+				     && dev->descdev.protocol == 2) << 25));
+      ctx[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (ctx[1]) & 0x00ffffff)
+				 | ((dev->nports & 0xff) << 24));
+    }
+
+  ctx = grub_xhci_in_ctx (x, s, 1 + dci);
+  ctx[0] = grub_cpu_to_le32 (interval << 16);
+  ctx[1] = grub_cpu_to_le32 ((3 << 1) | (type << 3) | (burst << 8)
+			     | (mps << 16));
+  ctx[2] = grub_cpu_to_le32 (ep->ring.phys | GRUB_XHCI_TRB_CYCLE);
+  ctx[3] = 0;
+  if (type == GRUB_XHCI_EP_INTERRUPT_IN || type == GRUB_XHCI_EP_INTERRUPT_OUT)
+    ctx[4] = grub_cpu_to_le32 (mps | ((mps * (burst + 1)) << 16));
+  else
+    ctx[4] = grub_cpu_to_le32_compile_time (3072);
+
+  err = grub_xhci_command (x, s->in_phys,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_CONFIGURE_EP)
+			   | GRUB_XHCI_TRB_SLOT (s->id));
+  if (err)
+    {
+      ep->state = GRUB_XHCI_EP_DISABLED;
+      return err;
+    }
+
+  grub_dprintf ("xhci", "slot %d: endpoint %02x (dci %d) type %d mps %d\n",
+		s->id, transfer->endpoint, dci, type, mps);
+
+  ep->state = GRUB_XHCI_EP_ENABLED;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Let the controller follow the requests which change the state of
+   the device behind its back.  Returns non-zero if the request was
+   completely handled here.  */
+static int
+grub_xhci_control_request (struct grub_xhci *x, struct grub_xhci_slot *s,
+			   struct grub_usb_packet_setup *setup,
+			   grub_usb_err_t *err)
+{
+  int i;
+
+  *err = GRUB_USB_ERR_NONE;
+
+  if (setup->reqtype == (GRUB_USB_REQTYPE_OUT | GRUB_USB_REQTYPE_STANDARD
+			 | GRUB_USB_REQTYPE_TARGET_DEV)
+      && setup->request == GRUB_USB_REQ_SET_ADDRESS)
+    {
+      *err = grub_xhci_set_address (x, grub_le_to_cpu16 (setup->value));
+      return 1;
+    }
+
+  /* SET_CONFIGURATION resets all data toggles.  */
+  if (setup->reqtype == (GRUB_USB_REQTYPE_OUT | GRUB_USB_REQTYPE_STANDARD
+			 | GRUB_USB_REQTYPE_TARGET_DEV)
+      && setup->request == GRUB_USB_REQ_SET_CONFIGURATION)
+    for (i = 2; i < 32; i++)
+      if (s->eps[i].state == GRUB_XHCI_EP_ENABLED)
+	s->eps[i].state = GRUB_XHCI_EP_NEEDS_RESET;
+
+  if (setup->reqtype == (GRUB_USB_REQTYPE_OUT | GRUB_USB_REQTYPE_STANDARD
+			 | GRUB_USB_REQTYPE_TARGET_ENDP)
+      && setup->request == GRUB_USB_REQ_CLEAR_FEATURE
+      && grub_le_to_cpu16 (setup->value) == GRUB_USB_FEATURE_ENDP_HALT)
+    {
+      int endp = grub_le_to_cpu16 (setup->index) & 0xff;
+      int dci = (endp & 0xf) * 2 + ((endp & 0x80) ? 1 : 0);
+
+      if (dci > GRUB_XHCI_EP0 && s->eps[dci].state == GRUB_XHCI_EP_ENABLED)
+	s->eps[dci].state = GRUB_XHCI_EP_NEEDS_RESET;
+    }
+
+  /* A hub port reset: the next device to address is behind it.  */
+  if (setup->reqtype == (GRUB_USB_REQTYPE_OUT | GRUB_USB_REQTYPE_CLASS
+			 | GRUB_USB_REQTYPE_TARGET_OTHER)
+      && setup->request == GRUB_USB_REQ_SET_FEATURE
+      && grub_le_to_cpu16 (setup->value) == GRUB_USB_HUB_FEATURE_PORT_RESET
+      && s->depth < 5)
+    {
+      int port = grub_le_to_cpu16 (setup->index);
+
+      if (x->default_slot)
+	grub_xhci_disable_slot (x, x->default_slot);
+      x->reset_root_port = s->root_port;
+      x->reset_route = s->route
+	| ((grub_uint32_t) (port > 15 ? 15 : port) << (4 * s->depth));
+      x->reset_depth = s->depth + 1;
+      x->reset_speed = GRUB_USB_SPEED_NONE;
+    }
+
+  return 0;
+}
+
+/* Queue a data buffer described by the USB core transactions FROM..TO
+   (exclusive) as a chain of TRBs.  */
+static grub_usb_err_t
+grub_xhci_queue_data (struct grub_usb_transfer *transfer,
+		      struct grub_xhci_ring *ring, int from, int to,
+		      grub_uint32_t first_type, grub_uint32_t flags,
+		      grub_uint32_t last_flags, unsigned mps,
+		      unsigned *first_idx, unsigned *last_idx)
+{
+  grub_size_t total = 0, done = 0;
+  grub_uint32_t addr, end;
+  int i, n = 0;
+  int first = 1;
+
+  for (i = from; i < to; i++)
+    total += transfer->transactions[i].size;
+
+  /* Count the TRBs first: contiguous transactions are merged and the
+     result is split at 64K boundaries.  */
+  for (i = from; i < to; )
+    {
+      addr = transfer->transactions[i].data;
+      end = addr + transfer->transactions[i].size;
+      for (i++; i < to && transfer->transactions[i].data == end; i++)
+	end += transfer->transactions[i].size;
+      if (end == addr)
+	n++;
+      else
+	n += (end - (addr & ~(GRUB_XHCI_TRB_MAX_LEN - 1))
+	      + GRUB_XHCI_TRB_MAX_LEN - 1) / GRUB_XHCI_TRB_MAX_LEN;
+    }
+  if (n == 0 || n > GRUB_XHCI_RING_TRBS - 8)
+    return GRUB_USB_ERR_INTERNAL;
+
+  for (i = from; i < to; )
+    {
+      addr = transfer->transactions[i].data;
+      end = addr + transfer->transactions[i].size;
+      for (i++; i < to && transfer->transactions[i].data == end; i++)
+	end += transfer->transactions[i].size;
+
+      do
+	{
+	  grub_uint32_t len = end - addr;
+	  grub_uint32_t control;
+	  grub_size_t td_size;
+	  unsigned idx;
+
+	  if (len > GRUB_XHCI_TRB_MAX_LEN
+	      - (addr & (GRUB_XHCI_TRB_MAX_LEN - 1)))
+	    len = GRUB_XHCI_TRB_MAX_LEN - (addr & (GRUB_XHCI_TRB_MAX_LEN - 1));
+	  done += len;
+	  n--;
+
+	  /* Number of packets which still remain after this TRB.  */
+	  td_size = n ? (total - done + mps - 1) / mps : 0;
+	  if (td_size > 31)
+	    td_size = 31;
+
+	  control = GRUB_XHCI_TRB_TYPE (first ? first_type
+					: GRUB_XHCI_TRB_NORMAL) | flags;
+	  if (first)
+	    control |= last_flags & GRUB_XHCI_TRB_DIR_IN;
+	  control |= n ? GRUB_XHCI_TRB_CH : (last_flags & ~GRUB_XHCI_TRB_DIR_IN);
+
+	  idx = grub_xhci_ring_enqueue (ring, addr, 0,
+					len | GRUB_XHCI_TRB_TD_SIZE (td_size),
+					control);
+	  if (first)
+	    *first_idx = idx;
+	  *last_idx = idx;
+	  first = 0;
+	  addr += len;
+	}
+      while (addr != end);
+    }
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_setup_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_slot *s;
+  struct grub_xhci_ring *ring;
+  grub_usb_err_t err;
+  int slotid, dci;
+  unsigned last_idx;
+
+  cdata = grub_zalloc (sizeof (*cdata));
+  if (!cdata)
+    return GRUB_USB_ERR_INTERNAL;
+  transfer->controller_data = cdata;
+
+  if (transfer->devaddr == 0)
+    {
+      if (!x->default_slot)
+	{
+	  err = grub_xhci_enable_default_slot (x, transfer->dev);
+	  if (err)
+	    goto fail;
+	}
+      slotid = x->default_slot;
+    }
+  else if (transfer->devaddr < GRUB_XHCI_MAX_ADDR)
+    slotid = x->addr_slot[transfer->devaddr];
+  else
+    slotid = 0;
+  if (!slotid || !x->slots[slotid])
+    {
+      err = GRUB_USB_ERR_INTERNAL;
+      goto fail;
+    }
+  s = x->slots[slotid];
+  cdata->slot = s;
+
+  if (transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL)
+    {
+      struct grub_usb_packet_setup setup;
+      grub_uint32_t setup_raw[2];
+      grub_uint32_t trt = GRUB_XHCI_TRT_NO_DATA;
+      grub_uint32_t status_dir = GRUB_XHCI_TRB_DIR_IN;
+      unsigned first_idx;
+
+      /* The setup packet goes into the TRB itself, the DMA memory is
+	 identity mapped.  */
+      grub_memcpy (&setup, (void *) (grub_addr_t)
+		   transfer->transactions[0].data, sizeof (setup));
+
+      if (grub_xhci_control_request (x, s, &setup, &err))
+	{
+	  if (err)
+	    goto fail;
+	  cdata->done = 1;
+	  cdata->code = GRUB_XHCI_CC_SUCCESS;
+	  return GRUB_USB_ERR_NONE;
+	}
+      err = grub_xhci_update_mps0 (x, s, transfer->dev);
+      if (err)
+	goto fail;
+
+      dci = GRUB_XHCI_EP0;
+      ring = &s->eps[dci].ring;
+      cdata->control = 1;
+
+      if (transfer->transcnt > 2)
+	{
+	  if (transfer->transactions[1].pid == GRUB_USB_TRANSFER_TYPE_IN)
+	    {
+	      trt = GRUB_XHCI_TRT_IN;
+	      status_dir = 0;
+	    }
+	  else
+	    trt = GRUB_XHCI_TRT_OUT;
+	}
+
+      grub_memcpy (setup_raw, &setup, sizeof (setup_raw));
+      first_idx = grub_xhci_ring_enqueue (ring, grub_le_to_cpu32 (setup_raw[0]),
+					  grub_le_to_cpu32 (setup_raw[1]),
+					  sizeof (setup),
+					  GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_SETUP)
+					  | GRUB_XHCI_TRB_IDT
+					  | GRUB_XHCI_TRB_TRT (trt));
+      if (trt != GRUB_XHCI_TRT_NO_DATA)
+	{
+	  unsigned data_first;
+
+	  err = grub_xhci_queue_data (transfer, ring, 1,
+				      transfer->transcnt - 1,
+				      GRUB_XHCI_TRB_DATA,
+				      trt == GRUB_XHCI_TRT_IN
+				      ? GRUB_XHCI_TRB_ISP : 0,
+				      trt == GRUB_XHCI_TRT_IN
+				      ? GRUB_XHCI_TRB_DIR_IN : 0,
+				      s->mps0, &data_first, &last_idx);
+	  if (err)
+	    goto fail;
+	}
+      last_idx = grub_xhci_ring_enqueue (ring, 0, 0, 0,
+					 GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_STATUS)
+					 | GRUB_XHCI_TRB_IOC | status_dir);
+      cdata->first = first_idx;
+    }
+  else
+    {
+      dci = (transfer->endpoint & 0xf) * 2
+	+ ((transfer->endpoint & 0x80) ? 1 : 0);
+      err = grub_xhci_configure_ep (x, s, transfer, dci);
+      if (err)
+	goto fail;
+      ring = &s->eps[dci].ring;
+
+      if (transfer->transcnt == 0)
+	cdata->first = last_idx
+	  = grub_xhci_ring_enqueue (ring, 0, 0, 0,
+				    GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_NORMAL)
+				    | GRUB_XHCI_TRB_IOC);
+      else
+	{
+	  err = grub_xhci_queue_data (transfer, ring, 0, transfer->transcnt,
+				      GRUB_XHCI_TRB_NORMAL,
+				      transfer->dir == GRUB_USB_TRANSFER_TYPE_IN
+				      ? GRUB_XHCI_TRB_ISP : 0,
+				      GRUB_XHCI_TRB_IOC, transfer->max,
+				      &cdata->first, &last_idx);
+	  if (err)
+	    goto fail;
+	}
+    }
+
+  cdata->dci = dci;
+  cdata->last = last_idx;
+  s->eps[dci].active = cdata;
+
+  /* Ring the doorbell of the endpoint.  */
+  x->doorbell[s->id] = grub_cpu_to_le32 (dci);
+
+  return GRUB_USB_ERR_NONE;
+
+ fail:
+  grub_free (cdata);
+  transfer->controller_data = NULL;
+  return err;
+}
+
+static grub_usb_err_t
+grub_xhci_check_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer, grub_size_t *actual)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata
+    = transfer->controller_data;
+  grub_usb_err_t err;
+
+  *actual = 0;
+
+  if (!cdata->done)
+    {
+      grub_xhci_process_events (x);
+      if (!cdata->done)
+	{
+	  if (grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS)
+	      & (GRUB_XHCI_STS_HCH | GRUB_XHCI_STS_HSE))
+	    {
+	      grub_dprintf ("xhci", "controller died\n");
+	      cdata->slot->eps[cdata->dci].active = NULL;
+	      grub_free (cdata);
+	      return GRUB_USB_ERR_UNRECOVERABLE;
+	    }
+	  return GRUB_USB_ERR_WAIT;
+	}
+    }
+
+  if (cdata->slot)
+    cdata->slot->eps[cdata->dci].active = NULL;
+
+  switch (cdata->code)
+    {
+    case GRUB_XHCI_CC_SUCCESS:
+    case GRUB_XHCI_CC_SHORT_PACKET:
+      err = GRUB_USB_ERR_NONE;
+      break;
+    case GRUB_XHCI_CC_STALL:
+      err = GRUB_USB_ERR_STALL;
+      break;
+    case GRUB_XHCI_CC_BABBLE:
+      err = GRUB_USB_ERR_BABBLE;
+      break;
+    case GRUB_XHCI_CC_DATA_BUFFER:
+    case GRUB_XHCI_CC_TRANSACTION:
+      err = GRUB_USB_ERR_DATA;
+      break;
+    default:
+      err = GRUB_USB_ERR_INTERNAL;
+      break;
+    }
+
+  if (err)
+    {
+      grub_dprintf ("xhci", "slot %d dci %d: completion code %d\n",
+		    cdata->slot ? cdata->slot->id : 0, cdata->dci, cdata->code);
+      /* The endpoint is halted now, make it usable again.  */
+      if (cdata->slot && x->slots[cdata->slot->id] == cdata->slot)
+	{
+	  grub_xhci_command_ep (x, cdata->slot, cdata->dci,
+				GRUB_XHCI_TRB_RESET_EP);
+	  grub_xhci_set_dequeue (x, cdata->slot, cdata->dci);
+	}
+    }
+
+  *actual = cdata->actual;
+  if (transfer->transcnt && cdata->actual && transfer->max)
+    {
+      transfer->last_trans = (cdata->actual - 1) / transfer->max;
+      if (transfer->last_trans >= transfer->transcnt)
+	transfer->last_trans = transfer->transcnt - 1;
+    }
+
+  grub_free (cdata);
+  return err;
+}
+
+static grub_usb_err_t
+grub_xhci_cancel_transfer (grub_usb_controller_t dev,
+			   grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata
+    = transfer->controller_data;
+  struct grub_xhci_slot *s = cdata->slot;
+
+  if (s)
+    {
+      s->eps[cdata->dci].active = NULL;
+      if (!cdata->done && x->slots[s->id] == s)
+	{
+	  grub_xhci_command_ep (x, s, cdata->dci, GRUB_XHCI_TRB_STOP_EP);
+	  grub_xhci_set_dequeue (x, s, cdata->dci);
+	}
+    }
+
+  grub_free (cdata);
+  return GRUB_USB_ERR_NONE;
+}
+
+static int
+grub_xhci_hubports (grub_usb_controller_t dev)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+
+  grub_dprintf ("xhci", "root hub ports=%d\n", x->max_ports);
+  return x->max_ports;
+}
+
+static grub_usb_err_t
+grub_xhci_portstatus (grub_usb_controller_t dev,
+		      unsigned int port, unsigned int enable)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint64_t endtime;
+  grub_uint32_t status;
+
+  grub_dprintf ("xhci", "portstatus: port=%d, enable=%d, status=0x%08x\n",
+		port, enable, grub_xhci_port_read (x, port));
+
+  if (!enable)
+    {
+      grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PED);
+      endtime = grub_get_time_ms () + 1000;
+      while (grub_xhci_port_read (x, port) & GRUB_XHCI_PORTSC_PED)
+	if (grub_get_time_ms () > endtime)
+	  return GRUB_USB_ERR_TIMEOUT;
+      return GRUB_USB_ERR_NONE;
+    }
+
+  /* A device which was being addressed on another port is gone.  */
+  if (x->default_slot)
+    grub_xhci_disable_slot (x, x->default_slot);
+
+  grub_boot_time ("Resetting port %d", port);
+
+  grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PR);
+  endtime = grub_get_time_ms () + 1000;
+  while (!(grub_xhci_port_read (x, port) & GRUB_XHCI_PORTSC_PRC))
+    if (grub_get_time_ms () > endtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  status = grub_xhci_port_read (x, port);
+  grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PRC
+			  | GRUB_XHCI_PORTSC_WRC | GRUB_XHCI_PORTSC_PEC);
+
+  grub_boot_time ("Port %d reset", port);
+
+  if (!(status & GRUB_XHCI_PORTSC_PED))
+    {
+      grub_dprintf ("xhci", "portstatus: port %d not enabled: 0x%08x\n",
+		    port, status);
+      return GRUB_USB_ERR_BADDEVICE;
+    }
+
+  x->reset_root_port = port + 1;
+  x->reset_route = 0;
+  x->reset_depth = 0;
+  x->reset_speed = grub_xhci_port_speed (status);
+
+  /* "Reset recovery time" (USB spec.) */
+  grub_millisleep (10);
+
+  grub_dprintf ("xhci", "portstatus: end, status=0x%08x\n",
+		grub_xhci_port_read (x, port));
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_speed_t
+grub_xhci_detect_dev (grub_usb_controller_t dev, int port, int *changed)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint32_t status;
+  grub_usb_speed_t speed;
+
+  status = grub_xhci_port_read (x, port);
+
+  if (status & GRUB_XHCI_PORTSC_CSC)
+    {
+      *changed = 1;
+      grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_CSC);
+    }
+  else
+    *changed = 0;
+
+  if (!(status & GRUB_XHCI_PORTSC_CCS))
+    return GRUB_USB_SPEED_NONE;
+
+  /* The speed of a USB 2 port is known only after the port reset,
+     portstatus corrects it then.  */
+  speed = grub_xhci_port_speed (status);
+  if (speed == GRUB_USB_SPEED_NONE)
+    speed = x->port_usb3[port] ? GRUB_USB_SPEED_SUPER : GRUB_USB_SPEED_FULL;
+  return speed;
+}
+
+/* Halt if XHCI HC not halted */
+static grub_usb_err_t
+grub_xhci_halt (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  if (grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS) & GRUB_XHCI_STS_HCH)
+    return GRUB_USB_ERR_NONE;
+
+  grub_xhci_write32 (x->oper, GRUB_XHCI_USBCMD,
+		     grub_xhci_read32 (x->oper, GRUB_XHCI_USBCMD)
+		     & ~GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 1000;
+  while (!(grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS) & GRUB_XHCI_STS_HCH))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  return GRUB_USB_ERR_NONE;
+}
+
+/* XHCI HC reset */
+static grub_usb_err_t
+grub_xhci_reset (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_write32 (x->oper, GRUB_XHCI_USBCMD, GRUB_XHCI_CMD_HCRST);
+  /* Some controllers hang if the register is touched too early.  */
+  grub_millisleep (1);
+  maxtime = grub_get_time_ms () + 1000;
+  while (grub_xhci_read32 (x->oper, GRUB_XHCI_USBCMD) & GRUB_XHCI_CMD_HCRST
+	 || (grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS)
+	     & GRUB_XHCI_STS_CNR))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Start the controller with the (already allocated) data structures.  */
+static grub_usb_err_t
+grub_xhci_start (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+  unsigned i;
+
+  grub_xhci_write32 (x->oper, GRUB_XHCI_CONFIG, x->max_slots);
+  grub_xhci_write64 (x->oper, GRUB_XHCI_DCBAAP, x->dcbaa_phys);
+  grub_xhci_write64 (x->oper, GRUB_XHCI_CRCR,
+		     x->cmd_ring.phys | GRUB_XHCI_CRCR_RCS);
+  grub_xhci_write32 (x->oper, GRUB_XHCI_DNCTRL, 0);
+
+  grub_xhci_write32 (x->runtime, GRUB_XHCI_IMOD, 0);
+  grub_xhci_write32 (x->runtime, GRUB_XHCI_ERSTSZ, 1);
+  grub_xhci_write64 (x->runtime, GRUB_XHCI_ERDP, x->event_ring.phys);
+  grub_xhci_write64 (x->runtime, GRUB_XHCI_ERSTBA, x->erst_phys);
+
+  grub_xhci_write32 (x->oper, GRUB_XHCI_USBCMD, GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 1000;
+  while (grub_xhci_read32 (x->oper, GRUB_XHCI_USBSTS) & GRUB_XHCI_STS_HCH)
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  /* Power on all ports if the controller has port power control.  */
+  if (grub_xhci_read32 (x->iobase, GRUB_XHCI_HCCPARAMS1) & GRUB_XHCI_HCC_PPC)
+    for (i = 0; i < x->max_ports; i++)
+      if (!(grub_xhci_port_read (x, i) & GRUB_XHCI_PORTSC_PP))
+	grub_xhci_port_setbits (x, i, GRUB_XHCI_PORTSC_PP);
+
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Walk the extended capabilities: take the controller over from the
+   BIOS and find out which ports are USB 3 ports.  */
+static void
+grub_xhci_ext_caps (struct grub_xhci *x)
+{
+  grub_uint32_t offset, cap;
+  grub_uint64_t maxtime;
+
+  offset = GRUB_XHCI_HCC_XECP (grub_xhci_read32 (x->iobase,
+						 GRUB_XHCI_HCCPARAMS1)) * 4;
+  while (offset)
+    {
+      cap = grub_xhci_read32 (x->iobase, offset);
+
+      if ((cap & 0xff) == GRUB_XHCI_EXT_CAP_LEGACY)
+	{
+	  if (cap & GRUB_XHCI_BIOS_OWNED)
+	    {
+	      grub_boot_time ("Taking ownership of XHCI controller");
+	      grub_xhci_write32 (x->iobase, offset, cap | GRUB_XHCI_OS_OWNED);
+	      maxtime = grub_get_time_ms () + 1000;
+	      while ((grub_xhci_read32 (x->iobase, offset)
+		      & GRUB_XHCI_BIOS_OWNED)
+		     && grub_get_time_ms () < maxtime);
+	      if (grub_xhci_read32 (x->iobase, offset) & GRUB_XHCI_BIOS_OWNED)
+		{
+		  grub_dprintf ("xhci", "XHCI change ownership timeout\n");
+		  /* Change ownership in "hard way" - reset BIOS ownership */
+		  grub_xhci_write32 (x->iobase, offset,
+				     (cap & ~GRUB_XHCI_BIOS_OWNED)
+				     | GRUB_XHCI_OS_OWNED);
+		}
+	    }
+	  else
+	    grub_xhci_write32 (x->iobase, offset, cap | GRUB_XHCI_OS_OWNED);
+
+	  /* Disable SMI, just to be sure.  */
+	  grub_xhci_write32 (x->iobase, offset + 4,
+			     (grub_xhci_read32 (x->iobase, offset + 4)
+			      & GRUB_XHCI_LEGCTL_KEEP)
+			     | GRUB_XHCI_LEGCTL_EVENTS);
+	}
+      else if ((cap & 0xff) == GRUB_XHCI_EXT_CAP_PROTOCOL && (cap >> 24) >= 3)
+	{
+	  grub_uint32_t ports = grub_xhci_read32 (x->iobase, offset + 8);
+	  unsigned first = ports & 0xff, count = (ports >> 8) & 0xff, i;
+
+	  for (i = first; i < first + count && i <= x->max_ports; i++)
+	    if (i > 0)
+	      x->port_usb3[i - 1] = 1;
+	}
+
+      if (!((cap >> 8) & 0xff))
+	break;
+      offset += ((cap >> 8) & 0xff) * 4;
+    }
+}
+
+/* Route the ports shared with the EHCI controller of Intel chipsets
+   to XHCI, otherwise USB 3 devices end up on EHCI at high speed.  */
+static void
+grub_xhci_intel_switch_ports (grub_pci_device_t dev, grub_pci_id_t pciid)
+{
+  grub_pci_address_t addr;
+  grub_uint32_t mask;
+
+  if ((pciid & 0xffff) != 0x8086)
+    return;
+  switch (pciid >> 16)
+    {
+    case 0x1e31:		/* Panther Point */
+    case 0x8c31:		/* Lynx Point */
+    case 0x9c31:		/* Lynx Point LP */
+    case 0x9cb1:		/* Wildcat Point LP */
+      break;
+    default:
+      return;
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_XHCI_INTEL_USB3PRM);
+  mask = grub_pci_read (addr);
+  addr = grub_pci_make_address (dev, GRUB_XHCI_INTEL_USB3_PSSEN);
+  grub_pci_write (addr, mask);
+
+  addr = grub_pci_make_address (dev, GRUB_XHCI_INTEL_XUSB2PRM);
+  mask = grub_pci_read (addr);
+  addr = grub_pci_make_address (dev, GRUB_XHCI_INTEL_XUSB2PR);
+  grub_pci_write (addr, mask);
+
+  grub_dprintf ("xhci", "switched Intel ports to XHCI\n");
+}
+
+/* PCI iteration function... */
+static int
+grub_xhci_pci_iter (grub_pci_device_t dev, grub_pci_id_t pciid,
+		    void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t base, base_h;
+  grub_uint32_t hcsparams1, hcsparams2, hccparams1;
+  grub_uint32_t pagesize, size;
+  unsigned nscratch, i;
+  volatile grub_uint32_t *erst;
+  struct grub_xhci *x;
+  grub_uint8_t caplen;
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: class OK\n");
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  base = grub_pci_read (addr);
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+  base_h = grub_pci_read (addr);
+  /* Stop if registers are mapped above 4G - GRUB does not currently
+   * work with registers mapped above 4G */
+  if (((base & GRUB_PCI_ADDR_MEM_TYPE_MASK) != GRUB_PCI_ADDR_MEM_TYPE_32)
+      && (base_h != 0))
+    {
+      grub_dprintf ("xhci",
+		    "XHCI grub_xhci_pci_iter: registers above 4G are not supported\n");
+      return 0;
+    }
+  base &= GRUB_PCI_ADDR_MEM_MASK;
+  if (!base)
+    {
+      grub_dprintf ("xhci", "XHCI: XHCI is not mapped\n");
+      return 0;
+    }
+
+  /* Set bus master - needed for coreboot, VMware, broken BIOSes etc. */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr,
+		       GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER
+		       | grub_pci_read_word (addr));
+
+  /* Allocate memory for the controller and fill basic values. */
+  x = grub_zalloc (sizeof (*x));
+  if (!x)
+    return 1;
+
+  x->iobase = grub_pci_device_map_range (dev, base, 0x20);
+  caplen = x->iobase[GRUB_XHCI_CAPLENGTH];
+  hcsparams1 = grub_xhci_read32 (x->iobase, GRUB_XHCI_HCSPARAMS1);
+  hcsparams2 = grub_xhci_read32 (x->iobase, GRUB_XHCI_HCSPARAMS2);
+  hccparams1 = grub_xhci_read32 (x->iobase, GRUB_XHCI_HCCPARAMS1);
+  x->max_slots = GRUB_XHCI_HCS1_MAX_SLOTS (hcsparams1);
+  x->max_ports = GRUB_XHCI_HCS1_MAX_PORTS (hcsparams1);
+  x->ctxsize = (hccparams1 & GRUB_XHCI_HCC_CSZ) ? 64 : 32;
+
+  /* Map everything up to the last doorbell / interrupter 0.  */
+  size = caplen + GRUB_XHCI_PORTSC + x->max_ports * 0x10;
+  if (size < grub_xhci_read32 (x->iobase, GRUB_XHCI_DBOFF)
+      + (x->max_slots + 1) * 4)
+    size = grub_xhci_read32 (x->iobase, GRUB_XHCI_DBOFF)
+      + (x->max_slots + 1) * 4;
+  if (size < grub_xhci_read32 (x->iobase, GRUB_XHCI_RTSOFF) + 0x40)
+    size = grub_xhci_read32 (x->iobase, GRUB_XHCI_RTSOFF) + 0x40;
+  x->iobase = grub_pci_device_map_range (dev, base, size);
+  x->oper = x->iobase + caplen;
+  x->runtime = x->iobase + (grub_xhci_read32 (x->iobase, GRUB_XHCI_RTSOFF)
+			    & ~0x1f);
+  x->doorbell = (volatile grub_uint32_t *)
+    (x->iobase + (grub_xhci_read32 (x->iobase, GRUB_XHCI_DBOFF) & ~0x3));
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: iobase: %08x\n", base);
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: VERSION: %04x\n",
+		grub_le_to_cpu16 (*(volatile grub_uint16_t *)
+				  (x->iobase + GRUB_XHCI_HCIVERSION)));
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: slots=%d, ports=%d, "
+		"ctxsize=%d, AC64=%d\n", x->max_slots, x->max_ports,
+		x->ctxsize, !!(hccparams1 & GRUB_XHCI_HCC_AC64));
+
+  if (!x->max_slots || !x->max_ports)
+    goto fail;
+
+  x->port_usb3 = grub_zalloc (x->max_ports);
+  x->slots = grub_zalloc ((x->max_slots + 1) * sizeof (x->slots[0]));
+  if (!x->port_usb3 || !x->slots)
+    goto fail;
+
+  grub_xhci_intel_switch_ports (dev, pciid);
+  grub_xhci_ext_caps (x);
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: ownership OK\n");
+
+  /* Wait until the controller is ready, then halt and reset it.  */
+  if (grub_xhci_halt (x) != GRUB_USB_ERR_NONE
+      || grub_xhci_reset (x) != GRUB_USB_ERR_NONE)
+    {
+      grub_error (GRUB_ERR_TIMEOUT, "XHCI grub_xhci_pci_iter: XHCI reset timeout");
+      goto fail;
+    }
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: reset OK\n");
+
+  /* Device Context Base Address Array.  */
+  x->dcbaa_chunk = grub_memalign_dma32 (64, (x->max_slots + 1) * 8);
+  if (!x->dcbaa_chunk)
+    goto fail;
+  x->dcbaa = grub_dma_get_virt (x->dcbaa_chunk);
+  x->dcbaa_phys = grub_dma_get_phys (x->dcbaa_chunk);
+  grub_memset ((void *) x->dcbaa, 0, (x->max_slots + 1) * 8);
+
+  /* Scratchpad buffers the controller asks for.  */
+  nscratch = GRUB_XHCI_HCS2_MAX_SCRATCH (hcsparams2);
+  pagesize = (grub_xhci_read32 (x->oper, GRUB_XHCI_PAGESIZE) & 0xffff) << 12;
+  if (nscratch)
+    {
+      volatile grub_uint32_t *array;
+      grub_uint32_t phys;
+
+      if (!pagesize)
+	goto fail;
+      x->scratch_array_chunk = grub_memalign_dma32 (64, nscratch * 8);
+      x->scratch_chunk = grub_memalign_dma32 (pagesize, nscratch * pagesize);
+      if (!x->scratch_array_chunk || !x->scratch_chunk)
+	goto fail;
+      array = grub_dma_get_virt (x->scratch_array_chunk);
+      phys = grub_dma_get_phys (x->scratch_chunk);
+      grub_memset ((void *) grub_dma_get_virt (x->scratch_chunk), 0,
+		   nscratch * pagesize);
+      for (i = 0; i < nscratch; i++)
+	{
+	  array[2 * i] = grub_cpu_to_le32 (phys + i * pagesize);
+	  array[2 * i + 1] = 0;
+	}
+      x->dcbaa[0] = grub_cpu_to_le32 (grub_dma_get_phys (x->scratch_array_chunk));
+      x->dcbaa[1] = 0;
+    }
+
+  /* Command ring, event ring and its segment table.  */
+  if (grub_xhci_ring_alloc (&x->cmd_ring, GRUB_XHCI_RING_TRBS)
+      || grub_xhci_ring_alloc (&x->event_ring, GRUB_XHCI_EVENT_TRBS))
+    goto fail;
+  x->ev_dequeue = 0;
+  x->ev_cycle = GRUB_XHCI_TRB_CYCLE;
+  x->erst_chunk = grub_memalign_dma32 (64, 16);
+  if (!x->erst_chunk)
+    goto fail;
+  erst = grub_dma_get_virt (x->erst_chunk);
+  x->erst_phys = grub_dma_get_phys (x->erst_chunk);
+  erst[0] = grub_cpu_to_le32 (x->event_ring.phys);
+  erst[1] = 0;
+  erst[2] = grub_cpu_to_le32_compile_time (GRUB_XHCI_EVENT_TRBS);
+  erst[3] = 0;
+
+  if (grub_xhci_start (x) != GRUB_USB_ERR_NONE)
+    {
+      grub_error (GRUB_ERR_TIMEOUT, "XHCI grub_xhci_pci_iter: XHCI start timeout");
+      goto fail;
+    }
+
+  /* Link to xhci now that initialisation is successful.  */
+  x->next = xhci;
+  xhci = x;
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: OK at all\n");
+
+  return 0;
+
+ fail:
+  grub_xhci_halt (x);
+  grub_xhci_reset (x);
+  if (x->erst_chunk)
+    grub_dma_free (x->erst_chunk);
+  if (x->event_ring.chunk)
+    grub_dma_free (x->event_ring.chunk);
+  if (x->cmd_ring.chunk)
+    grub_dma_free (x->cmd_ring.chunk);
+  if (x->scratch_chunk)
+    grub_dma_free (x->scratch_chunk);
+  if (x->scratch_array_chunk)
+    grub_dma_free (x->scratch_array_chunk);
+  if (x->dcbaa_chunk)
+    grub_dma_free (x->dcbaa_chunk);
+  grub_free (x->slots);
+  grub_free (x->port_usb3);
+  grub_free (x);
+
+  return 0;
+}
+
+static int
+grub_xhci_iterate (grub_usb_controller_iterate_hook_t hook, void *hook_data)
+{
+  struct grub_xhci *x;
+  struct grub_usb_controller dev;
+
+  for (x = xhci; x; x = x->next)
+    {
+      dev.data = x;
+      if (hook (&dev, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static void
+grub_xhci_inithw (void)
+{
+  /* USB controllers with the XHCI interface.  */
+  grub_pci_iterate_class (0x0c0330, 0xffffff, grub_xhci_pci_iter, NULL);
+}
+
+static grub_err_t
+grub_xhci_restore_hw (void)
+{
+  struct grub_xhci *x;
+
+  /* The controller was only halted, all slots are still valid.  */
+  for (x = xhci; x; x = x->next)
+    {
+      grub_xhci_write32 (x->oper, GRUB_XHCI_USBCMD,
+			 grub_xhci_read32 (x->oper, GRUB_XHCI_USBCMD)
+			 | GRUB_XHCI_CMD_RUNSTOP);
+      grub_xhci_read32 (x->oper, GRUB_XHCI_USBCMD);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_xhci_fini_hw (int noreturn)
+{
+  struct grub_xhci *x;
+
+  /* We should disable all XHCI HW to prevent any DMA access etc. */
+  for (x = xhci; x; x = x->next)
+    {
+      grub_xhci_halt (x);
+      if (noreturn)
+	grub_xhci_reset (x);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_usb_controller_dev usb_controller = {
+  .name = "xhci",
+  .iterate = grub_xhci_iterate,
+  .setup_transfer = grub_xhci_setup_transfer,
+  .check_transfer = grub_xhci_check_transfer,
+  .cancel_transfer = grub_xhci_cancel_transfer,
+  .hubports = grub_xhci_hubports,
+  .portstatus = grub_xhci_portstatus,
+  .detect_dev = grub_xhci_detect_dev,
+  /* Packets per bulk transfer, XHCI chains them into few large TRBs */
+  .max_bulk_tds = GRUB_XHCI_MAX_BULK_TDS
+};
+
+GRUB_MOD_INIT (xhci)
+{
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_trb) == 16);
+
+  grub_stop_disk_firmware ();
+
+  grub_boot_time ("Initing XHCI hardware");
+  grub_xhci_inithw ();
+  grub_boot_time ("Registering XHCI driver");
+  grub_usb_controller_dev_register (&usb_controller);
+  grub_boot_time ("XHCI driver registered");
+  grub_loader_register_preboot_hook (grub_xhci_fini_hw, grub_xhci_restore_hw,
+				     GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI (xhci)
+{
+  grub_xhci_fini_hw (0);
+  grub_usb_controller_dev_unregister (&usb_controller);
+}
@@ -24,6 +24,7 @@
 #include <grub/kernel.h>
 #include <grub/mm.h>
 #include <grub/i18n.h>
+#include <grub/boottime.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -141,11 +142,14 @@ grub_loader_boot (void)
 {
   grub_err_t err = GRUB_ERR_NONE;
   struct grub_preboot *cur;
+  grub_uint64_t start;
 
   if (! grub_loader_loaded)
     return grub_error (GRUB_ERR_NO_KERNEL,
 		       N_("you need to load the kernel first"));
 
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_LOADER);
+
   grub_machine_fini (grub_loader_flags);
 
   for (cur = preboots_head; cur; cur = cur->next)
@@ -155,9 +159,14 @@ grub_loader_boot (void)
 	{
 	  for (cur = cur->prev; cur; cur = cur->prev)
 	    cur->preboot_rest_func ();
+	  grub_boot_phase_end (GRUB_BOOT_PHASE_LOADER, start, NULL);
 	  return err;
 	}
     }
+
+  grub_boot_phase_end (GRUB_BOOT_PHASE_LOADER, start, "boot");
+  grub_boot_phases_export ();
+
   err = (grub_loader_boot_func) ();
 
   for (cur = preboots_tail; cur; cur = cur->prev)
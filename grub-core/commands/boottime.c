@@ -20,22 +20,77 @@
 #include <grub/misc.h>
 #include <grub/command.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
+#include <grub/boottime.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+static const char *const phase_names[GRUB_BOOT_PHASE_COUNT] =
+  {
+    [GRUB_BOOT_PHASE_DISK_READ] = "disk",
+    [GRUB_BOOT_PHASE_FILE_OPEN] = "open",
+    [GRUB_BOOT_PHASE_MODULE_LOAD] = "module",
+    [GRUB_BOOT_PHASE_SCRIPT] = "script",
+    [GRUB_BOOT_PHASE_MENU] = "menu",
+    [GRUB_BOOT_PHASE_LOADER] = "loader",
+  };
+
+/* Print US microseconds as seconds.  */
+static void
+print_us (grub_uint64_t us)
+{
+  grub_printf ("%4llu.%06llus", (unsigned long long) (us / 1000000),
+	       (unsigned long long) (us % 1000000));
+}
 
 static grub_err_t
 grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
 		   int argc __attribute__ ((unused)),
 		   char *argv[] __attribute__ ((unused)))
 {
+  unsigned i;
+#if BOOT_TIME_STATS
   struct grub_boot_time *cur;
   grub_uint64_t last_time = 0, start_time = 0;
-  if (!grub_boot_time_head)
+#endif
+
+  grub_printf_ (N_("Time since start: "));
+  print_us (grub_get_time_us ());
+  grub_printf ("\n\n%-8s %8s %12s %12s\n", "phase", "count", "total", "max");
+  for (i = 0; i < GRUB_BOOT_PHASE_COUNT; i++)
+    {
+      grub_printf ("%-8s %8llu ", phase_names[i],
+		   (unsigned long long) grub_boot_phases[i].count);
+      print_us (grub_boot_phases[i].total);
+      grub_printf (" ");
+      print_us (grub_boot_phases[i].max);
+      grub_printf ("\n");
+    }
+
+  if (grub_boot_nspans)
+    grub_printf ("\n%12s %12s %-8s %s\n", "start", "duration", "phase",
+		 "step");
+  for (i = 0; i < grub_boot_nspans; i++)
     {
-      grub_puts_ (N_("No boot time statistics is available\n"));
-      return 0;
+      const struct grub_boot_span *span = &grub_boot_spans[i];
+      unsigned d;
+
+      print_us (span->start);
+      grub_printf (" ");
+      print_us (span->duration);
+      grub_printf (" %-8s ", phase_names[span->phase]);
+      for (d = 0; d < span->depth; d++)
+	grub_printf ("  ");
+      grub_printf ("%s\n", span->label);
     }
+  if (grub_boot_spans_dropped)
+    grub_printf_ (N_("%u more steps were not recorded\n"),
+		  grub_boot_spans_dropped);
+
+#if BOOT_TIME_STATS
+  if (!grub_boot_time_head)
+    return 0;
+  grub_printf ("\n");
   start_time = last_time = grub_boot_time_head->tp;
   for (cur = grub_boot_time_head; cur; cur = cur->next)
     {
@@ -47,9 +102,9 @@ grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
 		   tmabs / 1000, tmabs % 1000, tmrel / 1000, tmrel % 1000, cur->file, cur->line,
 		   cur->msg);
     }
+#endif
  return 0;
 }
-
 static grub_command_t cmd_boottime;
 
 GRUB_MOD_INIT(boottime)
@@ -36,10 +36,11 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
   if (hits + misses)
     {
       unsigned long ratio = hits * 10000 / (hits + misses);
-      grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu\n"), hits, ratio / 100, ratio % 100,
+		    misses);
+      grub_printf_ (N_("Disk cache layout: %u sets of %u ways\n"),
+		    GRUB_DISK_CACHE_SETS, GRUB_DISK_CACHE_WAYS);
     }
   else
     grub_printf ("%s\n", _("No disk cache statistics available\n"));    
@@ -65,7 +65,8 @@ hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result)
 {
   void *context;
   grub_uint8_t *readbuf;
-#define BUF_SIZE 4096
+  grub_off_t prefetch_end = 0;
+#define BUF_SIZE 0x10000
   readbuf = grub_malloc (BUF_SIZE);
   if (!readbuf)
     return grub_errno;
@@ -77,6 +78,8 @@ hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result)
   while (1)
     {
       grub_ssize_t r;
+      /* Keep the next buffer requested while this one is hashed.  */
+      grub_file_prefetch_ahead (file, &prefetch_end, 2 * BUF_SIZE);
       r = grub_file_read (file, readbuf, BUF_SIZE);
       if (r < 0)
 	goto fail;
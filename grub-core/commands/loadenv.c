@@ -319,9 +319,11 @@ check_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   return GRUB_ERR_NONE;
 }
 
+/* Write ENVBLK back, skipping the sectors whose contents are the same as
+   in ORIG, the block as it was read.  */
 static int
-write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
-                  grub_file_t file)
+write_blocklists (grub_envblk_t envblk, const char *orig,
+                  struct blocklist *blocklists, grub_file_t file)
 {
   char *buf;
   grub_disk_t disk;
@@ -336,9 +338,25 @@ write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   index = 0;
   for (p = blocklists; p; index += p->length, p = p->next)
     {
-      if (grub_disk_write (disk, p->sector - part_start,
-                           p->offset, p->length, buf + index))
-        return 0;
+      grub_disk_addr_t sector = p->sector - part_start;
+      unsigned offset = p->offset;
+      unsigned done, len;
+
+      for (done = 0; done < p->length; done += len)
+        {
+          sector += offset >> GRUB_DISK_SECTOR_BITS;
+          offset &= GRUB_DISK_SECTOR_SIZE - 1;
+          len = GRUB_DISK_SECTOR_SIZE - offset;
+          if (len > p->length - done)
+            len = p->length - done;
+
+          if (grub_memcmp (buf + index + done, orig + index + done, len) != 0
+              && grub_disk_write (disk, sector, offset, len,
+                                  buf + index + done))
+            return 0;
+
+          offset += len;
+        }
     }
 
   return 1;
@@ -381,6 +399,7 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
   struct grub_arg_list *state = ctxt->state;
   grub_file_t file;
   grub_envblk_t envblk;
+  char *orig = 0;
   struct grub_cmd_save_env_ctx ctx = {
     .head = 0,
     .tail = 0
@@ -410,6 +429,11 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
   if (check_blocklists (envblk, ctx.head, file))
     goto fail;
 
+  orig = grub_malloc (grub_envblk_size (envblk));
+  if (! orig)
+    goto fail;
+  grub_memcpy (orig, grub_envblk_buffer (envblk), grub_envblk_size (envblk));
+
   while (argc)
     {
       const char *value;
@@ -430,9 +454,13 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
       args++;
     }
 
-  write_blocklists (envblk, ctx.head, file);
+  /* Spare the disk a write of what is already there.  */
+  if (grub_memcmp (orig, grub_envblk_buffer (envblk),
+		   grub_envblk_size (envblk)) != 0)
+    write_blocklists (envblk, orig, ctx.head, file);
 
  fail:
+  grub_free (orig);
   if (envblk)
     grub_envblk_close (envblk);
   free_blocklists (ctx.head);
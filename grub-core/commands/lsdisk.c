@@ -0,0 +1,159 @@
+/* lsdisk.c - show per-disk I/O statistics.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"stats", 's', 0, N_("Show request size and latency histograms."), 0, 0},
+    {"reset", 'r', 0, N_("Reset the counters."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+/* Print US microseconds as seconds.  */
+static void
+print_time (grub_uint64_t us)
+{
+  grub_printf ("%llu.%06llus", (unsigned long long) (us / 1000000),
+	       (unsigned long long) (us % 1000000));
+}
+
+static void
+print_stats (const struct grub_disk_stats *st, int histograms)
+{
+  unsigned i;
+
+  grub_printf ("%s:\n", st->name);
+  grub_printf_ (N_("  Requested: %llu reads, %llu KiB in "),
+		(unsigned long long) st->reads,
+		(unsigned long long) (st->bytes >> 10));
+  print_time (st->time);
+  grub_printf_ (N_(", %llu errors\n"), (unsigned long long) st->errors);
+  grub_printf_ (N_("  Cache: %llu hits, %llu misses\n"),
+		(unsigned long long) st->cache_hits,
+		(unsigned long long) st->cache_misses);
+  grub_printf_ (N_("  Device: %llu reads, %llu KiB in "),
+		(unsigned long long) st->dev_reads,
+		(unsigned long long) (st->dev_bytes >> 10));
+  print_time (st->dev_time);
+  grub_printf_ (N_(", longest "));
+  print_time (st->dev_max_time);
+  grub_printf_ (N_(", %llu errors\n"), (unsigned long long) st->dev_errors);
+
+  if (!histograms || !st->dev_reads)
+    return;
+
+  grub_printf_ (N_("  Device reads by size:\n"));
+  for (i = 0; i < GRUB_DISK_STATS_BUCKETS; i++)
+    {
+      grub_uint64_t size = (grub_uint64_t) GRUB_DISK_SECTOR_SIZE << i;
+
+      if (!st->dev_size_hist[i])
+	continue;
+      if (i == GRUB_DISK_STATS_BUCKETS - 1)
+	grub_printf ("    > %6llu KiB: %u\n", (unsigned long long) (size >> 11),
+		     st->dev_size_hist[i]);
+      else if (size < 1024)
+	grub_printf ("    <= %6llu B: %u\n", (unsigned long long) size,
+		     st->dev_size_hist[i]);
+      else
+	grub_printf ("    <= %4llu KiB: %u\n", (unsigned long long) (size >> 10),
+		     st->dev_size_hist[i]);
+    }
+
+  grub_printf_ (N_("  Device reads by latency:\n"));
+  for (i = 0; i < GRUB_DISK_STATS_BUCKETS; i++)
+    {
+      grub_uint64_t us = 1ULL << i;
+
+      if (!st->dev_time_hist[i])
+	continue;
+      if (i == GRUB_DISK_STATS_BUCKETS - 1)
+	grub_printf ("    > %6llu us: %u\n", (unsigned long long) (us >> 1),
+		     st->dev_time_hist[i]);
+      else
+	grub_printf ("    <= %6llu us: %u\n", (unsigned long long) us,
+		     st->dev_time_hist[i]);
+    }
+}
+
+static grub_err_t
+grub_cmd_lsdisk (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_disk_stats *st;
+  int i;
+
+  for (st = grub_disk_stats_list; st; st = st->next)
+    {
+      if (argc)
+	{
+	  for (i = 0; i < argc; i++)
+	    {
+	      grub_size_t len = grub_strlen (args[i]);
+
+	      /* Accept the (hd0) form too.  */
+	      if (args[i][0] == '(' && len >= 2 && args[i][len - 1] == ')'
+		  && grub_strncmp (st->name, args[i] + 1, len - 2) == 0
+		  && st->name[len - 2] == '\0')
+		break;
+	      if (grub_strcmp (st->name, args[i]) == 0)
+		break;
+	    }
+	  if (i == argc)
+	    continue;
+	}
+
+      if (ctxt->state[1].set)
+	{
+	  struct grub_disk_stats *next = st->next;
+	  char *name = st->name;
+
+	  grub_memset (st, 0, sizeof (*st));
+	  st->next = next;
+	  st->name = name;
+	  continue;
+	}
+
+      print_stats (st, ctxt->state[0].set);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(lsdisk)
+{
+  cmd = grub_register_extcmd ("lsdisk", grub_cmd_lsdisk, 0,
+			      N_("[-s|-r] [DISK...]"),
+			      N_("Show the I/O statistics of the disks used so far."),
+			      options);
+}
+
+GRUB_MOD_FINI(lsdisk)
+{
+  grub_unregister_extcmd (cmd);
+}
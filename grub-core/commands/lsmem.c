@@ -0,0 +1,100 @@
+/* lsmem.c - show heap usage statistics.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"classes", 'c', 0, N_("Show usage per block size class."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_err_t
+grub_cmd_lsmem (grub_extcmd_context_t ctxt,
+		int argc __attribute__ ((unused)),
+		char **args __attribute__ ((unused)))
+{
+  struct grub_mm_stats *stats;
+  unsigned c;
+
+  /* Too big for the stack and allocating it shows up in the counters,
+     but only by one block.  */
+  stats = grub_malloc (sizeof (*stats));
+  if (!stats)
+    return grub_errno;
+  grub_mm_get_stats (stats);
+
+  grub_printf_ (N_("Heap: %" PRIuGRUB_SIZE " KiB in %u regions\n"),
+		stats->total >> 10, stats->regions);
+  grub_printf_ (N_("In use: %" PRIuGRUB_SIZE " KiB in %lu blocks,"
+		   " peak %" PRIuGRUB_SIZE " KiB\n"),
+		stats->in_use >> 10, stats->in_use_blocks,
+		stats->peak >> 10);
+  grub_printf_ (N_("Free: %" PRIuGRUB_SIZE " KiB in %lu blocks,"
+		   " largest %" PRIuGRUB_SIZE " KiB\n"),
+		stats->free >> 10, stats->free_blocks,
+		stats->largest_free >> 10);
+  grub_printf_ (N_("Kept for reuse: %" PRIuGRUB_SIZE " KiB\n"),
+		stats->binned >> 10);
+  if (stats->free)
+    {
+      /* Share of the free space which isn't part of the largest block.  */
+      unsigned long frag = (unsigned long)
+	(((grub_uint64_t) (stats->free - stats->largest_free) * 10000)
+	 / stats->free);
+      grub_printf_ (N_("Fragmentation: %lu.%02lu%%\n"),
+		    frag / 100, frag % 100);
+    }
+  grub_printf_ (N_("Allocations: %lu, frees: %lu\n"),
+		stats->allocs, stats->frees);
+
+  if (ctxt->state[0].set)
+    for (c = 0; c < GRUB_MM_STATS_CLASSES; c++)
+      {
+	if (!stats->classes[c].allocs)
+	  continue;
+	grub_printf_ (N_("%9" PRIuGRUB_SIZE "+ B: %lu blocks,"
+			 " %" PRIuGRUB_SIZE " KiB in use, %lu allocations\n"),
+		      stats->classes[c].min_size, stats->classes[c].blocks,
+		      stats->classes[c].bytes >> 10,
+		      stats->classes[c].allocs);
+      }
+
+  grub_free (stats);
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(lsmem)
+{
+  cmd = grub_register_extcmd ("lsmem", grub_cmd_lsmem, 0, "[-c]",
+			      N_("Show heap usage statistics."), options);
+}
+
+GRUB_MOD_FINI(lsmem)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -95,7 +95,7 @@ grub_normal_add_menu_entry (int argc, const char **args,
   if (! menu)
     return grub_error (GRUB_ERR_MENU, "no menu context");
 
-  last = &menu->entry_list;
+  last = menu->last_entry ? &menu->last_entry->next : &menu->entry_list;
 
   menu_sourcecode = grub_xasprintf ("%s%s", prefix ?: "", sourcecode);
   if (! menu_sourcecode)
@@ -189,6 +189,7 @@ grub_normal_add_menu_entry (int argc, const char **args,
   (*last)->sourcecode = menu_sourcecode;
   (*last)->submenu = submenu;
 
+  menu->last_entry = *last;
   menu->size++;
   return GRUB_ERR_NONE;
 
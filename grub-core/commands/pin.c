@@ -0,0 +1,341 @@
+/* pin.c - Read files from where they were when the config was made.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/mm.h>
+#include <grub/disk.h>
+#include <grub/env.h>
+#include <grub/command.h>
+#include <grub/crypto.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* "pin FILE SIZE SHA256 BLOCKLIST", written by grub-mkconfig, says where
+   the sectors of FILE were on its device.  Opening FILE then reads those
+   sectors in a few large reads instead of looking the file up in its
+   filesystem, and uses them if their SHA-256 is still the one recorded.
+   Otherwise the file was changed or moved, and is opened as usual.  */
+
+#define PIN_HASH_SIZE	32
+
+struct pin_extent
+{
+  grub_disk_addr_t start;
+  grub_disk_addr_t len;
+};
+
+struct pin
+{
+  struct pin *next;
+  char *device;
+  char *path;
+  grub_off_t size;
+  grub_uint8_t sum[PIN_HASH_SIZE];
+  struct pin_extent *extents;
+  unsigned nextents;
+};
+
+static struct pin *pins;
+
+static void
+pin_free (struct pin *p)
+{
+  grub_free (p->device);
+  grub_free (p->path);
+  grub_free (p->extents);
+  grub_free (p);
+}
+
+static grub_ssize_t
+pin_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_memcpy (buf, (char *) file->data + file->offset, len);
+  return len;
+}
+
+static grub_err_t
+pin_close (grub_file_t file)
+{
+  grub_free (file->data);
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_fs pin_fs =
+  {
+    .name = "pin",
+    .dir = 0,
+    .open = 0,
+    .read = pin_read,
+    .close = pin_close,
+    .label = 0,
+    .next = 0
+  };
+
+/* Read the sectors of P into memory and check them.  */
+static char *
+pin_load (struct pin *p, grub_disk_t disk)
+{
+  const gcry_md_spec_t *md;
+  grub_uint8_t sum[PIN_HASH_SIZE];
+  grub_off_t off = 0;
+  char *buf;
+  unsigned i;
+
+  md = grub_crypto_lookup_md_by_name ("sha256");
+  if (! md || md->mdlen != PIN_HASH_SIZE)
+    return 0;
+
+  buf = grub_malloc (p->size);
+  if (! buf)
+    return 0;
+
+  for (i = 0; i < p->nextents && off < p->size; i++)
+    {
+      grub_off_t len = p->extents[i].len << GRUB_DISK_SECTOR_BITS;
+
+      if (len > p->size - off)
+	len = p->size - off;
+      if (grub_disk_read (disk, p->extents[i].start, 0, len, buf + off))
+	break;
+      off += len;
+    }
+
+  if (off == p->size)
+    {
+      grub_crypto_hash (md, sum, buf, p->size);
+      if (grub_crypto_memcmp (sum, p->sum, PIN_HASH_SIZE) == 0)
+	return buf;
+    }
+
+  grub_free (buf);
+  return 0;
+}
+
+static int
+pin_open (grub_file_t file, const char *name)
+{
+  struct pin *p;
+  const char *path, *device;
+  grub_size_t devlen;
+  char *buf;
+
+  if (! file->device->disk)
+    return 0;
+
+  if (name[0] == '(')
+    {
+      path = grub_strchr (name, ')');
+      if (! path)
+	return 0;
+      device = name + 1;
+      devlen = path - device;
+      path++;
+    }
+  else
+    {
+      device = grub_env_get ("root");
+      if (! device)
+	return 0;
+      devlen = grub_strlen (device);
+      path = name;
+    }
+
+  for (p = pins; p; p = p->next)
+    if (grub_strncmp (p->device, device, devlen) == 0
+	&& p->device[devlen] == '\0' && grub_strcmp (p->path, path) == 0)
+      break;
+  if (! p)
+    return 0;
+
+  buf = pin_load (p, file->device->disk);
+  if (! buf)
+    {
+      grub_dprintf ("pin", "%s changed since it was pinned\n", name);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  grub_dprintf ("pin", "%s read from its pinned sectors\n", name);
+  file->fs = &pin_fs;
+  file->size = p->size;
+  file->data = buf;
+  return 1;
+}
+
+/* Parse "START+LENGTH[,START+LENGTH]..." in sectors.  */
+static grub_err_t
+pin_parse_blocklist (struct pin *p, char *s)
+{
+  char *c;
+
+  p->nextents = 1;
+  for (c = s; *c; c++)
+    if (*c == ',')
+      p->nextents++;
+
+  p->extents = grub_malloc (p->nextents * sizeof (p->extents[0]));
+  if (! p->extents)
+    return grub_errno;
+
+  for (c = s, p->nextents = 0; *c; p->nextents++)
+    {
+      struct pin_extent *e = &p->extents[p->nextents];
+
+      e->start = grub_strtoull (c, &c, 0);
+      if (grub_errno)
+	return grub_errno;
+      if (*c != '+')
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid blocklist"));
+      e->len = grub_strtoull (c + 1, &c, 0);
+      if (grub_errno)
+	return grub_errno;
+      if (*c == ',')
+	c++;
+      else if (*c)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid blocklist"));
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_pin (grub_command_t cmd __attribute__ ((unused)),
+	      int argc, char **args)
+{
+  struct pin *p, **q;
+  const char *path, *root;
+  char *end;
+  unsigned i;
+
+  if (argc != 4)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("four arguments expected"));
+
+  p = grub_zalloc (sizeof (*p));
+  if (! p)
+    return grub_errno;
+
+  if (args[0][0] == '(')
+    {
+      path = grub_strchr (args[0], ')');
+      if (! path)
+	{
+	  pin_free (p);
+	  return grub_error (GRUB_ERR_BAD_FILENAME, N_("missing `%c' symbol"),
+			     ')');
+	}
+      p->device = grub_strndup (args[0] + 1, path - args[0] - 1);
+      path++;
+    }
+  else
+    {
+      root = grub_env_get ("root");
+      if (! root)
+	{
+	  pin_free (p);
+	  return grub_error (GRUB_ERR_BAD_DEVICE, N_("no device is set"));
+	}
+      p->device = grub_strdup (root);
+      path = args[0];
+    }
+  p->path = grub_strdup (path);
+  if (! p->device || ! p->path)
+    {
+      pin_free (p);
+      return grub_errno;
+    }
+
+  p->size = grub_strtoull (args[1], &end, 0);
+  if (grub_errno || *end)
+    {
+      pin_free (p);
+      return grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+    }
+
+  if (grub_strlen (args[2]) != 2 * PIN_HASH_SIZE)
+    {
+      pin_free (p);
+      return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid SHA-256 sum"));
+    }
+  for (i = 0; i < 2 * PIN_HASH_SIZE; i++)
+    {
+      char ch = grub_tolower (args[2][i]);
+      int v;
+
+      if (ch >= '0' && ch <= '9')
+	v = ch - '0';
+      else if (ch >= 'a' && ch <= 'f')
+	v = ch - 'a' + 10;
+      else
+	{
+	  pin_free (p);
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid SHA-256 sum"));
+	}
+      p->sum[i / 2] = (p->sum[i / 2] << 4) | v;
+    }
+
+  if (pin_parse_blocklist (p, args[3]))
+    {
+      pin_free (p);
+      return grub_errno;
+    }
+
+  /* A newer pin of the same file replaces the old one.  */
+  for (q = &pins; *q; q = &(*q)->next)
+    if (grub_strcmp ((*q)->device, p->device) == 0
+	&& grub_strcmp ((*q)->path, p->path) == 0)
+      {
+	struct pin *old = *q;
+
+	*q = old->next;
+	pin_free (old);
+	break;
+      }
+
+  p->next = pins;
+  pins = p;
+  return GRUB_ERR_NONE;
+}
+
+static grub_command_t cmd;
+
+GRUB_MOD_INIT(pin)
+{
+  cmd = grub_register_command ("pin", grub_cmd_pin,
+			       N_("FILE SIZE SHA256 BLOCKLIST"),
+			       N_("Read FILE from BLOCKLIST while its SHA-256"
+				  " sum matches."));
+  grub_file_pinned_open = pin_open;
+}
+
+GRUB_MOD_FINI(pin)
+{
+  struct pin *p, *next;
+
+  grub_file_pinned_open = 0;
+  grub_unregister_command (cmd);
+  for (p = pins; p; p = next)
+    {
+      next = p->next;
+      pin_free (p);
+    }
+  pins = 0;
+}
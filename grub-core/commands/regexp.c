@@ -99,50 +99,143 @@ set_matches (char **varnames, char *str, grub_size_t nmatches,
   return GRUB_ERR_NONE;
 }
 
-static grub_err_t
-grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
+/* The patterns compiled last.  Scripts tend to match one pattern over and
+   over, e.g. against the version of every kernel found, and a compiled
+   pattern keeps the DFA states its earlier matches built.  */
+#define REGEX_CACHE_SIZE	8
+
+static struct
 {
+  char *pattern;
   regex_t regex;
-  int ret;
+  unsigned long last_use;
+} regex_cache[REGEX_CACHE_SIZE];
+static unsigned long regex_clock;
+
+static void
+regex_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (regex_cache); i++)
+    if (regex_cache[i].pattern)
+      {
+	regfree (&regex_cache[i].regex);
+	grub_free (regex_cache[i].pattern);
+	regex_cache[i].pattern = 0;
+      }
+}
+
+static grub_err_t
+regex_error (int ret, regex_t *regex)
+{
   grub_size_t s;
   char *comperr;
   grub_err_t err;
+
+  s = regerror (ret, regex, 0, 0);
+  comperr = grub_malloc (s);
+  if (!comperr)
+    return grub_errno;
+  regerror (ret, regex, comperr, s);
+  err = grub_error (GRUB_ERR_TEST_FAILURE, "%s", comperr);
+  grub_free (comperr);
+  return err;
+}
+
+/* Return PATTERN compiled, or NULL with the error set.  */
+static regex_t *
+get_regex (const char *pattern)
+{
+  unsigned i, victim = 0;
+  int ret;
+
+  regex_clock++;
+  for (i = 0; i < ARRAY_SIZE (regex_cache); i++)
+    {
+      if (regex_cache[i].pattern
+	  && grub_strcmp (regex_cache[i].pattern, pattern) == 0)
+	{
+	  regex_cache[i].last_use = regex_clock;
+	  return &regex_cache[i].regex;
+	}
+      if (regex_cache[victim].pattern
+	  && (!regex_cache[i].pattern
+	      || regex_cache[i].last_use < regex_cache[victim].last_use))
+	victim = i;
+    }
+
+  if (regex_cache[victim].pattern)
+    {
+      regfree (&regex_cache[victim].regex);
+      grub_free (regex_cache[victim].pattern);
+      regex_cache[victim].pattern = 0;
+    }
+
+  ret = regcomp (&regex_cache[victim].regex, pattern, REG_EXTENDED);
+  if (ret)
+    {
+      regex_error (ret, &regex_cache[victim].regex);
+      regfree (&regex_cache[victim].regex);
+      return 0;
+    }
+  regex_cache[victim].pattern = grub_strdup (pattern);
+  if (!regex_cache[victim].pattern)
+    {
+      regfree (&regex_cache[victim].regex);
+      return 0;
+    }
+  regex_cache[victim].last_use = regex_clock;
+  return &regex_cache[victim].regex;
+}
+
+static grub_err_t
+grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  regex_t *regex;
+  char **varnames = ctxt->state[0].args;
+  int ret, i;
+  grub_size_t nmatches = 0;
+  grub_err_t err;
   regmatch_t *matches = 0;
 
   if (argc != 2)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
 
-  ret = regcomp (&regex, args[0], REG_EXTENDED);
-  if (ret)
-    goto fail;
+  regex = get_regex (args[0]);
+  if (!regex)
+    return grub_errno;
 
-  matches = grub_zalloc (sizeof (*matches) * (regex.re_nsub + 1));
-  if (! matches)
-    goto fail;
+  /* Only ask for the groups that are stored: without them the match needs
+     no backtracking to find where the groups are.  */
+  for (i = 0; varnames && varnames[i]; i++)
+    {
+      unsigned long j = 1;
+
+      if (grub_strchr (varnames[i], ':'))
+	j = grub_strtoul (varnames[i], 0, 10);
+      if (j > regex->re_nsub)
+	j = regex->re_nsub;
+      if (j + 1 > nmatches)
+	nmatches = j + 1;
+    }
 
-  ret = regexec (&regex, args[1], regex.re_nsub + 1, matches, 0);
-  if (!ret)
+  if (nmatches)
     {
-      err = set_matches (ctxt->state[0].args, args[1],
-			 regex.re_nsub + 1, matches);
-      regfree (&regex);
-      grub_free (matches);
-      return err;
+      matches = grub_zalloc (sizeof (*matches) * nmatches);
+      if (! matches)
+	return grub_errno;
     }
 
- fail:
-  grub_free (matches);
-  s = regerror (ret, &regex, 0, 0);
-  comperr = grub_malloc (s);
-  if (!comperr)
+  ret = regexec (regex, args[1], nmatches, matches, 0);
+  if (ret)
     {
-      regfree (&regex);
-      return grub_errno;
+      grub_free (matches);
+      return regex_error (ret, regex);
     }
-  regerror (ret, &regex, comperr, s);
-  err = grub_error (GRUB_ERR_TEST_FAILURE, "%s", comperr);
-  regfree (&regex);
-  grub_free (comperr);
+
+  err = set_matches (varnames, args[1], nmatches, matches);
+  grub_free (matches);
   return err;
 }
 
@@ -164,5 +257,7 @@ GRUB_MOD_INIT(regexp)
 GRUB_MOD_FINI(regexp)
 {
   grub_unregister_extcmd (cmd);
+  regex_cache_flush ();
   grub_wildcard_translator = 0;
+  grub_filename_translator.flush ();
 }
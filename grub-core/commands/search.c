@@ -30,6 +30,7 @@
 #include <grub/i18n.h>
 #include <grub/disk.h>
 #include <grub/partition.h>
+#include <grub/boot_hint.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -40,6 +41,9 @@ struct cache_entry
   char *value;
 };
 
+/* Devices found earlier.  Searches by UUID or label remember what every
+   device they probe has, so that this ends up as an index of all devices
+   seen and later searches for other keys check there first.  */
 static struct cache_entry *cache;
 
 /* Context for FUNC_NAME.  */
@@ -54,6 +58,53 @@ struct search_ctx
   int is_cache;
 };
 
+#ifdef DO_SEARCH_FS_UUID
+#define compare_fn grub_strcasecmp
+#else
+#define compare_fn grub_strcmp
+#endif
+
+#ifdef DO_SEARCH_FILE
+#define HINT_KIND "file"
+#elif defined (DO_SEARCH_FS_UUID)
+#define HINT_KIND "fs_uuid"
+#else
+#define HINT_KIND "label"
+#endif
+
+/* Remember that KEY is on the device NAME, unless some device is already
+   remembered for KEY.  */
+static void
+cache_add (const char *key, const char *name)
+{
+  struct cache_entry *cache_ent;
+
+  for (cache_ent = cache; cache_ent; cache_ent = cache_ent->next)
+    if (compare_fn (cache_ent->key, key) == 0)
+      return;
+
+  cache_ent = grub_malloc (sizeof (*cache_ent));
+  if (cache_ent)
+    {
+      cache_ent->key = grub_strdup (key);
+      cache_ent->value = grub_strdup (name);
+      if (cache_ent->value && cache_ent->key)
+	{
+	  cache_ent->next = cache;
+	  cache = cache_ent;
+	}
+      else
+	{
+	  grub_free (cache_ent->value);
+	  grub_free (cache_ent->key);
+	  grub_free (cache_ent);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+  else
+    grub_errno = GRUB_ERR_NONE;
+}
+
 /* Helper for FUNC_NAME.  */
 static int
 iterate_device (const char *name, void *data)
@@ -66,12 +117,6 @@ iterate_device (const char *name, void *data)
       name[0] == 'f' && name[1] == 'd' && name[2] >= '0' && name[2] <= '9')
     return 1;
 
-#ifdef DO_SEARCH_FS_UUID
-#define compare_fn grub_strcasecmp
-#else
-#define compare_fn grub_strcmp
-#endif
-
 #ifdef DO_SEARCH_FILE
     {
       char *buf;
@@ -116,6 +161,8 @@ iterate_device (const char *name, void *data)
 		{
 		  if (compare_fn (quid, ctx->key) == 0)
 		    found = 1;
+		  else if (!ctx->is_cache)
+		    cache_add (quid, name);
 
 		  grub_free (quid);
 		}
@@ -127,32 +174,12 @@ iterate_device (const char *name, void *data)
 #endif
 
   if (!ctx->is_cache && found && ctx->count == 0)
-    {
-      struct cache_entry *cache_ent;
-      cache_ent = grub_malloc (sizeof (*cache_ent));
-      if (cache_ent)
-	{
-	  cache_ent->key = grub_strdup (ctx->key);
-	  cache_ent->value = grub_strdup (name);
-	  if (cache_ent->value && cache_ent->key)
-	    {
-	      cache_ent->next = cache;
-	      cache = cache_ent;
-	    }
-	  else
-	    {
-	      grub_free (cache_ent->value);
-	      grub_free (cache_ent->key);
-	      grub_free (cache_ent);
-	      grub_errno = GRUB_ERR_NONE;
-	    }
-	}
-      else
-	grub_errno = GRUB_ERR_NONE;
-    }
+    cache_add (ctx->key, name);
 
   if (found)
     {
+      if (ctx->var && ctx->count == 0)
+	grub_boot_hint_set (HINT_KIND, ctx->key, name);
       ctx->count++;
       if (ctx->var)
 	grub_env_set (ctx->var, name);
@@ -193,6 +220,7 @@ try (struct search_ctx *ctx)
   unsigned i;
   struct cache_entry **prev;
   struct cache_entry *cache_ent;
+  const char *hint;
 
   for (prev = &cache, cache_ent = *prev; cache_ent;
        prev = &cache_ent->next, cache_ent = *prev)
@@ -217,6 +245,25 @@ try (struct search_ctx *ctx)
 	}
     }
 
+  /* Where an earlier boot found it.  */
+  hint = ctx->var ? grub_boot_hint_get (HINT_KIND, ctx->key) : NULL;
+  if (hint)
+    {
+      char *dev = grub_strdup (hint);
+      int ret = 0;
+
+      if (dev)
+	{
+	  ctx->is_cache = 1;
+	  ret = iterate_device (dev, ctx);
+	  ctx->is_cache = 0;
+	  grub_free (dev);
+	}
+      grub_errno = GRUB_ERR_NONE;
+      if (ret)
+	return;
+    }
+
   for (i = 0; i < ctx->nhints; i++)
     {
       char *end;
@@ -257,6 +304,7 @@ try (struct search_ctx *ctx)
 	    return;
 	}
     }
+  grub_device_prefetch_all ();
   grub_device_iterate (iterate_device, ctx);
 }
 
@@ -23,6 +23,8 @@
 #include <grub/env.h>
 #include <grub/fs.h>
 #include <grub/device.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/file.h>
 #include <grub/command.h>
 #include <grub/i18n.h>
@@ -48,6 +50,73 @@ struct test_parse_ctx
   char *filename;
 };
 
+/* Number of paths remembered by get_fileinfo, must be a power of 2.  */
+#define STAT_CACHE_SIZE	64
+
+/* The result of get_fileinfo for PATH on a disk.  */
+struct stat_cache_entry
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* NULL if the entry is unused.  */
+  char *path;
+  int exists;
+  struct grub_dirhook_info info;
+};
+
+static struct stat_cache_entry stat_cache[STAT_CACHE_SIZE];
+
+/* The value of grub_disk_cache_generation the entries were made with.  */
+static unsigned long stat_cache_generation;
+
+static void
+stat_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < STAT_CACHE_SIZE; i++)
+    {
+      grub_free (stat_cache[i].path);
+      stat_cache[i].path = NULL;
+    }
+}
+
+/* Return the entry PATH on DEV belongs in, or NULL if DEV's contents
+   aren't known to stay put between disk cache invalidations.  */
+static struct stat_cache_entry *
+stat_cache_slot (grub_device_t dev, const char *path)
+{
+  grub_uint32_t hash = 2166136261U;
+  const char *ptr;
+
+  if (! dev->disk || dev->disk->dev->id == GRUB_DISK_DEVICE_PROCFS_ID)
+    return NULL;
+
+  if (stat_cache_generation != grub_disk_cache_generation)
+    {
+      stat_cache_flush ();
+      stat_cache_generation = grub_disk_cache_generation;
+    }
+
+  for (ptr = path; *ptr; ptr++)
+    hash = (hash ^ (grub_uint8_t) *ptr) * 16777619;
+  hash ^= (grub_uint32_t) dev->disk->id * 31 + dev->disk->dev->id;
+  hash ^= (grub_uint32_t) grub_partition_get_start (dev->disk->partition);
+  hash *= 16777619;
+  return &stat_cache[(hash ^ (hash >> 16)) & (STAT_CACHE_SIZE - 1)];
+}
+
+static int
+stat_cache_match (const struct stat_cache_entry *e, grub_device_t dev,
+		  const char *path)
+{
+  return (e->path && e->dev_id == dev->disk->dev->id
+	  && e->disk_id == dev->disk->id
+	  && e->part_start == grub_partition_get_start (dev->disk->partition)
+	  && grub_strcmp (e->path, path) == 0);
+}
+
 /* Take care of discarding and inverting. */
 static void
 update_val (int val, struct test_parse_ctx *ctx)
@@ -73,7 +142,10 @@ find_file (const char *cur_filename, const struct grub_dirhook_info *info,
   return 0;
 }
 
-/* Check if file exists and fetch its information. */
+/* Check if file exists and fetch its information.  As long as the disk
+   cache isn't invalidated, the answer for a path on a given disk is
+   remembered, which spares probing the filesystem and listing the
+   directory again.  */
 static void
 get_fileinfo (char *path, struct test_parse_ctx *ctx)
 {
@@ -81,6 +153,7 @@ get_fileinfo (char *path, struct test_parse_ctx *ctx)
   char *device_name;
   grub_fs_t fs;
   grub_device_t dev;
+  struct stat_cache_entry *e;
 
   ctx->file_exists = 0;
   device_name = grub_file_get_device_name (path);
@@ -91,14 +164,6 @@ get_fileinfo (char *path, struct test_parse_ctx *ctx)
       return;
     }
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    {
-      grub_free (device_name);
-      grub_device_close (dev);
-      return;
-    }
-
   pathname = grub_strchr (path, ')');
   if (! pathname)
     pathname = path;
@@ -109,6 +174,25 @@ get_fileinfo (char *path, struct test_parse_ctx *ctx)
   while (*pathname && pathname[grub_strlen (pathname) - 1] == '/')
     pathname[grub_strlen (pathname) - 1] = 0;
 
+  e = stat_cache_slot (dev, pathname);
+  if (e && stat_cache_match (e, dev, pathname))
+    {
+      ctx->file_exists = e->exists;
+      if (e->exists)
+	ctx->file_info = e->info;
+      grub_free (device_name);
+      grub_device_close (dev);
+      return;
+    }
+
+  fs = grub_fs_probe (dev);
+  if (! fs)
+    {
+      grub_free (device_name);
+      grub_device_close (dev);
+      return;
+    }
+
   /* Split into path and filename. */
   ctx->filename = grub_strrchr (pathname, '/');
   if (! ctx->filename)
@@ -143,6 +227,25 @@ get_fileinfo (char *path, struct test_parse_ctx *ctx)
   else
     (fs->dir) (dev, path, find_file, ctx);
 
+  /* Failed lookups leave an error behind, so don't cache them.  */
+  if (e && grub_errno == GRUB_ERR_NONE)
+    {
+      char *copy = grub_strdup (pathname);
+
+      if (copy)
+	{
+	  grub_free (e->path);
+	  e->path = copy;
+	  e->dev_id = dev->disk->dev->id;
+	  e->disk_id = dev->disk->id;
+	  e->part_start = grub_partition_get_start (dev->disk->partition);
+	  e->exists = ctx->file_exists;
+	  e->info = ctx->file_info;
+	}
+      else
+	grub_errno = GRUB_ERR_NONE;
+    }
+
   grub_device_close (dev);
   grub_free (path);
   grub_free (device_name);
@@ -452,4 +555,5 @@ GRUB_MOD_FINI(test)
 {
   grub_unregister_command (cmd_1);
   grub_unregister_command (cmd_2);
+  stat_cache_flush ();
 }
@@ -19,6 +19,7 @@
 
 #include <grub/mm.h>
 #include <grub/file.h>
+#include <grub/disk.h>
 #include <grub/time.h>
 #include <grub/misc.h>
 #include <grub/dl.h>
@@ -29,83 +30,352 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 #define DEFAULT_BLOCK_SIZE	65536
+#define MAX_BLOCK_SIZES		16
+/* Default number of reads in random mode, if the file has more blocks.  */
+#define DEFAULT_RANDOM_COUNT	1024
+
+enum
+  {
+    OPTION_SIZE,
+    OPTION_MODE,
+    OPTION_COUNT,
+    OPTION_DEVICE,
+    OPTION_COLD,
+    OPTION_WARM,
+    OPTION_NO_DECOMPRESS,
+    OPTION_MACHINE
+  };
 
 static const struct grub_arg_option options[] =
   {
-    {"size", 's', 0, N_("Specify size for each read operation"), 0, ARG_TYPE_INT},
+    {"size", 's', 0, N_("Specify size for each read operation, or a"
+			" comma-separated list of sizes to try in turn."),
+     N_("SIZE[,SIZE...]"), ARG_TYPE_STRING},
+    {"mode", 'm', 0, N_("Read sequentially, at random offsets or both."),
+     "seq|random|both", ARG_TYPE_STRING},
+    {"count", 'n', 0, N_("Number of reads in random mode."), N_("N"),
+     ARG_TYPE_INT},
+    {"device", 'd', 0, N_("Read the named device directly, bypassing"
+			  " the filesystem."), 0, 0},
+    {"cold", 'c', 0, N_("Flush the disk cache before the run."), 0, 0},
+    {"warm", 'w', 0, N_("Read the same blocks once before the timed run."),
+     0, 0},
+    {"no-decompress", 'u', 0, N_("Don't decompress the file."), 0, 0},
+    {"machine", 'x', 0, N_("Print one line of KEY=VALUE pairs per run."),
+     0, 0},
     {0, 0, 0, 0, 0, 0}
   };
 
-static grub_err_t
-grub_cmd_testspeed (grub_extcmd_context_t ctxt, int argc, char **args)
+/* What is being read: a file, or a whole device.  */
+struct speed_target
 {
-  struct grub_arg_list *state = ctxt->state;
-  grub_uint64_t start;
-  grub_uint64_t end;
-  grub_ssize_t block_size;
-  grub_disk_addr_t total_size;
-  char *buffer;
+  const char *name;
+  int raw;
+  int no_decompress;
   grub_file_t file;
-  grub_uint64_t whole, fraction;
+  grub_disk_t disk;
+  grub_uint64_t size;
+};
 
-  if (argc == 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+struct speed_result
+{
+  grub_uint64_t bytes;
+  grub_uint64_t reads;
+  grub_uint64_t time;
+};
 
-  block_size = (state[0].set) ?
-    grub_strtoul (state[0].arg, 0, 0) : DEFAULT_BLOCK_SIZE;
+static grub_err_t
+target_open (struct speed_target *t)
+{
+  if (t->raw)
+    {
+      const char *name = t->name;
+      grub_size_t len = grub_strlen (name);
+      char *copy = NULL;
 
-  if (block_size <= 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+      if (name[0] == '(' && len >= 2 && name[len - 1] == ')')
+	{
+	  copy = grub_strndup (name + 1, len - 2);
+	  if (!copy)
+	    return grub_errno;
+	  name = copy;
+	}
+      t->disk = grub_disk_open (name);
+      grub_free (copy);
+      if (!t->disk)
+	return grub_errno;
+      t->size = grub_disk_get_size (t->disk);
+      if (t->size == GRUB_DISK_SIZE_UNKNOWN)
+	{
+	  grub_disk_close (t->disk);
+	  t->disk = NULL;
+	  return grub_error (GRUB_ERR_BAD_DEVICE, N_("unknown disk size"));
+	}
+      t->size <<= GRUB_DISK_SECTOR_BITS;
+      return GRUB_ERR_NONE;
+    }
 
-  buffer = grub_malloc (block_size);
-  if (buffer == NULL)
+  if (t->no_decompress)
+    grub_file_filter_disable_compression ();
+  t->file = grub_file_open (t->name);
+  if (!t->file)
     return grub_errno;
+  t->size = grub_file_size (t->file);
+  return GRUB_ERR_NONE;
+}
 
-  file = grub_file_open (args[0]);
-  if (file == NULL)
-    goto quit;
+static void
+target_close (struct speed_target *t)
+{
+  if (t->file)
+    grub_file_close (t->file);
+  if (t->disk)
+    grub_disk_close (t->disk);
+  t->file = NULL;
+  t->disk = NULL;
+}
 
-  total_size = 0;
-  start = grub_get_time_ms ();
+static grub_ssize_t
+target_read (struct speed_target *t, grub_uint64_t offset, char *buf,
+	     grub_size_t len)
+{
+  if (t->disk)
+    {
+      if (grub_disk_read (t->disk, offset >> GRUB_DISK_SECTOR_BITS,
+			  offset & (GRUB_DISK_SECTOR_SIZE - 1), len, buf))
+	return -1;
+      return len;
+    }
+
+  if (t->file->offset != offset)
+    grub_file_seek (t->file, offset);
+  return grub_file_read (t->file, buf, len);
+}
+
+/* A small xorshift generator, seeded the same way for the warm-up and the
+   timed run so that both touch the same blocks.  */
+static grub_uint64_t
+next_random (grub_uint64_t *state)
+{
+  grub_uint64_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+static grub_err_t
+run_pattern (struct speed_target *t, int random, grub_size_t block_size,
+	     grub_uint64_t count, char *buffer, struct speed_result *res)
+{
+  grub_uint64_t start, offset = 0, seed = 0x9e3779b97f4a7c15ULL;
+  grub_uint64_t blocks;
+  grub_err_t err;
+
+  err = target_open (t);
+  if (err)
+    return err;
+
+  res->bytes = res->reads = 0;
+  blocks = grub_divmod64 (t->size, block_size, 0);
+  if (blocks == 0)
+    blocks = 1;
+  if (count == 0)
+    count = (blocks < DEFAULT_RANDOM_COUNT) ? blocks : DEFAULT_RANDOM_COUNT;
+
+  start = grub_get_time_us ();
   while (1)
     {
-      grub_ssize_t size = grub_file_read (file, buffer, block_size);
+      grub_size_t len = block_size;
+      grub_ssize_t size;
+
+      if (random)
+	{
+	  grub_uint64_t block;
+
+	  if (res->reads == count)
+	    break;
+	  grub_divmod64 (next_random (&seed), blocks, &block);
+	  offset = block * block_size;
+	}
+      else if (offset >= t->size)
+	break;
+
+      if (len > t->size - offset)
+	len = t->size - offset;
+      size = target_read (t, offset, buffer, len);
       if (size <= 0)
 	break;
-      total_size += size;
+      res->bytes += size;
+      res->reads++;
+      offset += size;
     }
-  end = grub_get_time_ms ();
-  grub_file_close (file);
+  res->time = grub_get_time_us () - start;
 
+  target_close (t);
+  return grub_errno;
+}
+
+static void
+print_result (const char *mode, grub_size_t block_size, const char *cache,
+	      const struct speed_result *res, int machine)
+{
+  grub_uint64_t whole, fraction;
+
+  if (machine)
+    {
+      grub_printf ("mode=%s size=%" PRIuGRUB_SIZE " cache=%s bytes=%llu"
+		   " reads=%llu usec=%llu bps=%llu\n",
+		   mode, block_size, cache,
+		   (unsigned long long) res->bytes,
+		   (unsigned long long) res->reads,
+		   (unsigned long long) res->time,
+		   (unsigned long long) (res->time
+					 ? grub_divmod64 (res->bytes * 1000000ULL,
+							  res->time, 0) : 0));
+      return;
+    }
+
+  grub_printf_ (N_("%s reads of %" PRIuGRUB_SIZE " bytes, %s cache:\n"),
+		mode, block_size, cache);
   grub_printf_ (N_("File size: %s\n"),
-		grub_get_human_size (total_size, GRUB_HUMAN_SIZE_NORMAL));
-  whole = grub_divmod64 (end - start, 1000, &fraction);
-  grub_printf_ (N_("Elapsed time: %d.%03d s \n"),
+		grub_get_human_size (res->bytes, GRUB_HUMAN_SIZE_NORMAL));
+  whole = grub_divmod64 (res->time, 1000000, &fraction);
+  grub_printf_ (N_("Elapsed time: %d.%06d s \n"),
 		(unsigned) whole,
 		(unsigned) fraction);
 
-  if (end != start)
+  if (res->time)
     {
       grub_uint64_t speed =
-	grub_divmod64 (total_size * 100ULL * 1000ULL, end - start, 0);
+	grub_divmod64 (res->bytes * 100ULL * 1000000ULL, res->time, 0);
 
       grub_printf_ (N_("Speed: %s \n"),
 		    grub_get_human_size (speed,
 					 GRUB_HUMAN_SIZE_SPEED));
     }
+}
+
+static grub_err_t
+grub_cmd_testspeed (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_size_t block_sizes[MAX_BLOCK_SIZES];
+  unsigned nsizes = 0, i;
+  grub_size_t max_size = 0;
+  int modes[2], nmodes = 0, m;
+  const char *caches[2];
+  int ncaches = 0, c;
+  grub_uint64_t count = 0;
+  struct speed_target target;
+  char *buffer;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (argc == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  if (state[OPTION_SIZE].set)
+    {
+      char *p = state[OPTION_SIZE].arg;
+
+      while (*p)
+	{
+	  unsigned long size;
+
+	  if (nsizes == MAX_BLOCK_SIZES)
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("too many block sizes"));
+	  size = grub_strtoul (p, &p, 0);
+	  if (grub_errno)
+	    return grub_errno;
+	  if (size == 0 || (*p && *p != ','))
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+	  block_sizes[nsizes++] = size;
+	  if (*p)
+	    p++;
+	}
+    }
+  if (nsizes == 0)
+    block_sizes[nsizes++] = DEFAULT_BLOCK_SIZE;
+  for (i = 0; i < nsizes; i++)
+    if (max_size < block_sizes[i])
+      max_size = block_sizes[i];
+
+  if (!state[OPTION_MODE].set
+      || grub_strcmp (state[OPTION_MODE].arg, "seq") == 0)
+    modes[nmodes++] = 0;
+  else if (grub_strcmp (state[OPTION_MODE].arg, "random") == 0)
+    modes[nmodes++] = 1;
+  else if (grub_strcmp (state[OPTION_MODE].arg, "both") == 0)
+    {
+      modes[nmodes++] = 0;
+      modes[nmodes++] = 1;
+    }
+  else
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid mode `%s'"),
+		       state[OPTION_MODE].arg);
+
+  if (state[OPTION_COUNT].set)
+    {
+      count = grub_strtoull (state[OPTION_COUNT].arg, 0, 0);
+      if (grub_errno)
+	return grub_errno;
+    }
+
+  if (state[OPTION_COLD].set)
+    caches[ncaches++] = "cold";
+  if (state[OPTION_WARM].set)
+    caches[ncaches++] = "warm";
+  if (ncaches == 0)
+    caches[ncaches++] = "current";
+
+  buffer = grub_malloc (max_size);
+  if (buffer == NULL)
+    return grub_errno;
+
+  grub_memset (&target, 0, sizeof (target));
+  target.name = args[0];
+  target.raw = state[OPTION_DEVICE].set;
+  target.no_decompress = state[OPTION_NO_DECOMPRESS].set;
+
+  for (m = 0; m < nmodes && !err; m++)
+    for (i = 0; i < nsizes && !err; i++)
+      for (c = 0; c < ncaches && !err; c++)
+	{
+	  struct speed_result res;
+
+	  if (grub_strcmp (caches[c], "cold") == 0)
+	    grub_disk_cache_invalidate_all ();
+	  else if (grub_strcmp (caches[c], "warm") == 0)
+	    {
+	      err = run_pattern (&target, modes[m], block_sizes[i], count,
+				 buffer, &res);
+	      if (err)
+		break;
+	    }
+
+	  err = run_pattern (&target, modes[m], block_sizes[i], count,
+			     buffer, &res);
+	  if (err)
+	    break;
+	  print_result (modes[m] ? "random" : "seq", block_sizes[i],
+			caches[c], &res, state[OPTION_MACHINE].set);
+	}
 
- quit:
   grub_free (buffer);
 
-  return grub_errno;
+  return err;
 }
 
 static grub_extcmd_t cmd;
 
 GRUB_MOD_INIT(testspeed)
 {
-  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0, N_("[-s SIZE] FILENAME"),
-			      N_("Test file read speed."),
+  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0,
+			      N_("[-s SIZE[,SIZE...]] [-m seq|random|both] [-n N]"
+				 " [-d] [-c] [-w] [-u] [-x] FILENAME|DEVICE"),
+			      N_("Test file or device read speed."),
 			      options);
 }
 
@@ -30,15 +30,10 @@
 #include <grub/env.h>
 #include <grub/kernel.h>
 #include <grub/extcmd.h>
+#include <grub/loader.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-struct grub_verified
-{
-  grub_file_t file;
-  void *buf;
-};
-typedef struct grub_verified *grub_verified_t;
 
 enum
   {
@@ -445,22 +440,26 @@ rsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
   return ret;
 }
 
-static grub_err_t
-grub_verify_signature_real (char *buf, grub_size_t size,
-			    grub_file_t f, grub_file_t sig,
-			    struct grub_public_key *pkey)
+/* A signature whose header was read, waiting for the signed data to be
+   hashed.  */
+struct verify_state
 {
-  grub_size_t len;
-  grub_uint8_t v;
-  grub_uint8_t h;
-  grub_uint8_t t;
-  grub_uint8_t pk;
   const gcry_md_spec_t *hash;
+  void *context;
+  grub_uint8_t v;
   struct signature_v4_header v4;
-  grub_err_t err;
-  grub_size_t i;
-  gcry_mpi_t mpis[10];
+};
+
+/* Read the header of the signature in SIG and set up ST to hash the signed
+   data with.  */
+static grub_err_t
+verify_begin (grub_file_t sig, struct verify_state *st)
+{
+  grub_size_t len;
   grub_uint8_t type = 0;
+  grub_err_t err;
+
+  st->context = NULL;
 
   err = read_packet_header (sig, &type, &len);
   if (err)
@@ -469,38 +468,55 @@ grub_verify_signature_real (char *buf, grub_size_t size,
   if (type != 0x2)
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  if (grub_file_read (sig, &v, sizeof (v)) != sizeof (v))
+  if (grub_file_read (sig, &st->v, sizeof (st->v)) != sizeof (st->v))
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  if (v != 4)
+  if (st->v != 4)
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  if (grub_file_read (sig, &v4, sizeof (v4)) != sizeof (v4))
+  if (grub_file_read (sig, &st->v4, sizeof (st->v4)) != sizeof (st->v4))
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  h = v4.hash;
-  t = v4.type;
-  pk = v4.pkeyalgo;
-  
-  if (t != 0)
+  if (st->v4.type != 0)
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  if (h >= ARRAY_SIZE (hashes) || hashes[h] == NULL)
+  if (st->v4.hash >= ARRAY_SIZE (hashes) || hashes[st->v4.hash] == NULL)
     return grub_error (GRUB_ERR_BAD_SIGNATURE, "unknown hash");
 
-  if (pk >= ARRAY_SIZE (pkalgos) || pkalgos[pk].name == NULL)
+  if (st->v4.pkeyalgo >= ARRAY_SIZE (pkalgos)
+      || pkalgos[st->v4.pkeyalgo].name == NULL)
     return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
 
-  hash = grub_crypto_lookup_md_by_name (hashes[h]);
-  if (!hash)
-    return grub_error (GRUB_ERR_BAD_SIGNATURE, "hash `%s' not loaded", hashes[h]);
+  st->hash = grub_crypto_lookup_md_by_name (hashes[st->v4.hash]);
+  if (!st->hash)
+    return grub_error (GRUB_ERR_BAD_SIGNATURE, "hash `%s' not loaded",
+		       hashes[st->v4.hash]);
+
+  st->context = grub_zalloc (st->hash->contextsize);
+  if (!st->context)
+    return grub_errno;
+  st->hash->init (st->context);
 
   grub_dprintf ("crypt", "alive\n");
 
+  return GRUB_ERR_NONE;
+}
+
+/* The signed data was all hashed into ST: read the rest of the signature
+   in SIG and check it.  */
+static grub_err_t
+verify_end (grub_file_t sig, struct verify_state *st,
+	    struct grub_public_key *pkey)
+{
+  const gcry_md_spec_t *hash = st->hash;
+  void *context = st->context;
+  grub_uint8_t pk = st->v4.pkeyalgo;
+  grub_size_t i;
+  gcry_mpi_t mpis[10];
+
   {
-    void *context = NULL;
     unsigned char *hval;
-    grub_ssize_t rem = grub_be_to_cpu16 (v4.hashed_sub);
+    grub_ssize_t rem = grub_be_to_cpu16 (st->v4.hashed_sub);
     grub_uint32_t headlen = grub_cpu_to_be32 (rem + 6);
     grub_uint8_t s;
     grub_uint16_t unhashed_sub;
@@ -511,27 +527,12 @@ grub_verify_signature_real (char *buf, grub_size_t size,
     struct grub_public_subkey *sk;
     grub_uint8_t *readbuf = NULL;
 
-    context = grub_zalloc (hash->contextsize);
     readbuf = grub_zalloc (READBUF_SIZE);
-    if (!context || !readbuf)
+    if (!readbuf)
       goto fail;
 
-    hash->init (context);
-    if (buf)
-      hash->write (context, buf, size);
-    else 
-      while (1)
-	{
-	  r = grub_file_read (f, readbuf, READBUF_SIZE);
-	  if (r < 0)
-	    goto fail;
-	  if (r == 0)
-	    break;
-	  hash->write (context, readbuf, r);
-	}
-
-    hash->write (context, &v, sizeof (v));
-    hash->write (context, &v4, sizeof (v4));
+    hash->write (context, &st->v, sizeof (st->v));
+    hash->write (context, &st->v4, sizeof (st->v4));
     while (rem)
       {
 	r = grub_file_read (sig, readbuf,
@@ -543,7 +544,7 @@ grub_verify_signature_real (char *buf, grub_size_t size,
 	hash->write (context, readbuf, r);
 	rem -= r;
       }
-    hash->write (context, &v, sizeof (v));
+    hash->write (context, &st->v, sizeof (st->v));
     s = 0xff;
     hash->write (context, &s, sizeof (s));
     hash->write (context, &headlen, sizeof (headlen));
@@ -649,13 +650,11 @@ grub_verify_signature_real (char *buf, grub_size_t size,
     if ((*pkalgos[pk].algo)->verify (0, hmpi, mpis, sk->mpis, 0, 0))
       goto fail;
 
-    grub_free (context);
     grub_free (readbuf);
 
     return GRUB_ERR_NONE;
 
   fail:
-    grub_free (context);
     grub_free (readbuf);
     if (!grub_errno)
       return grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
@@ -663,6 +662,47 @@ grub_verify_signature_real (char *buf, grub_size_t size,
   }
 }
 
+static grub_err_t
+grub_verify_signature_real (char *buf, grub_size_t size,
+			    grub_file_t f, grub_file_t sig,
+			    struct grub_public_key *pkey)
+{
+  struct verify_state st;
+  grub_uint8_t *readbuf = NULL;
+  grub_ssize_t r;
+  grub_err_t err;
+
+  err = verify_begin (sig, &st);
+  if (err)
+    goto out;
+
+  if (buf)
+    st.hash->write (st.context, buf, size);
+  else
+    {
+      readbuf = grub_malloc (READBUF_SIZE);
+      if (!readbuf)
+	{
+	  err = grub_errno;
+	  goto out;
+	}
+      while ((r = grub_file_read (f, readbuf, READBUF_SIZE)) > 0)
+	st.hash->write (st.context, readbuf, r);
+      if (r < 0)
+	{
+	  err = grub_errno;
+	  goto out;
+	}
+    }
+
+  err = verify_end (sig, &st, pkey);
+
+ out:
+  grub_free (readbuf);
+  grub_free (st.context);
+  return err;
+}
+
 grub_err_t
 grub_verify_signature (grub_file_t f, grub_file_t sig,
 		       struct grub_public_key *pkey)
@@ -815,30 +855,371 @@ grub_cmd_verify_signature (grub_extcmd_context_t ctxt,
 
 static int sec = 0;
 
+/* Set when the data of a file was handed out and then failed verification,
+   booting is refused from then on.  */
+static int verify_failed;
+static struct grub_preboot *preboot_hnd;
+
+/* Signed files are read into memory and verified when opened.  Files whose
+   opener deferred verification are instead verified while they are read:
+   the data is hashed on its way to the reader and the signature checked
+   when the last byte went through, or at the latest when the file is
+   closed.  The first bytes are
+   kept so that probing the start again doesn't need another read, the last
+   ones so that trailers can be read ahead of the hash.  A reader going back
+   further than what is kept makes the whole file be read into memory.  */
+#define VERIFIED_START_SIZE	4096
+#define VERIFIED_TAIL_SIZE	65536
+
+struct grub_verified
+{
+  grub_file_t file;
+  /* The whole file, once it had to be read into memory.  */
+  void *buf;
+  /* The signature, until it was checked.  */
+  grub_file_t sig;
+  struct verify_state state;
+  /* The digest of the data, kept from when the signature was checked.  */
+  grub_uint8_t digest[GRUB_CRYPTO_MAX_MDLEN];
+  /* [0, hashed) went through the hash, a copy of it is in START while it
+     fits.  */
+  grub_off_t hashed;
+  grub_uint8_t *start;
+  /* [tail_at, size), read ahead of the hash.  */
+  grub_uint8_t *tail;
+  grub_off_t tail_at;
+  /* Some data was handed out.  */
+  int used;
+  int failed;
+};
+typedef struct grub_verified *grub_verified_t;
+
 static void
 verified_free (grub_verified_t verified)
 {
   if (verified)
     {
+      if (verified->sig)
+	grub_file_close (verified->sig);
+      grub_free (verified->state.context);
+      grub_free (verified->start);
+      grub_free (verified->tail);
       grub_free (verified->buf);
       grub_free (verified);
     }
 }
 
+/* Put the digest of what was hashed into CONTEXT so far into OUT, without
+   disturbing CONTEXT.  */
+static grub_err_t
+data_digest (const gcry_md_spec_t *hash, const void *context,
+	     grub_uint8_t *out)
+{
+  void *copy;
+
+  copy = grub_malloc (hash->contextsize);
+  if (!copy)
+    return grub_errno;
+  grub_memcpy (copy, context, hash->contextsize);
+  hash->final (copy);
+  grub_memcpy (out, hash->read (copy), hash->mdlen);
+  grub_free (copy);
+  return GRUB_ERR_NONE;
+}
+
+/* Hash the LEN bytes of BUF following the hashed part of FILE and check the
+   signature once the end was reached.  */
+static grub_err_t
+verified_hash (grub_file_t file, const void *buf, grub_size_t len)
+{
+  grub_verified_t verified = file->data;
+  grub_err_t err;
+
+  if (len)
+    {
+      verified->state.hash->write (verified->state.context, buf, len);
+      if (verified->start && verified->hashed + len <= VERIFIED_START_SIZE)
+	grub_memcpy (verified->start + verified->hashed, buf, len);
+      else
+	{
+	  grub_free (verified->start);
+	  verified->start = NULL;
+	}
+      verified->hashed += len;
+    }
+  if (verified->hashed < file->size)
+    return GRUB_ERR_NONE;
+
+  err = data_digest (verified->state.hash, verified->state.context,
+		     verified->digest);
+  if (!err)
+    err = verify_end (verified->sig, &verified->state, NULL);
+  grub_file_close (verified->sig);
+  verified->sig = NULL;
+  return err;
+}
+
+/* Hash the data of FILE up to OFFSET without handing it out.  */
+static grub_err_t
+verified_skip (grub_file_t file, grub_off_t offset)
+{
+  grub_verified_t verified = file->data;
+  grub_uint8_t *scratch;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  scratch = grub_malloc (READBUF_SIZE);
+  if (!scratch)
+    return grub_errno;
+
+  grub_file_seek (verified->file, verified->hashed);
+  while (!err && verified->hashed < offset)
+    {
+      grub_size_t n = offset - verified->hashed;
+
+      if (n > READBUF_SIZE)
+	n = READBUF_SIZE;
+      if (grub_file_read (verified->file, scratch, n) != (grub_ssize_t) n)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("premature end of file %s"), file->name);
+	  err = grub_errno;
+	  break;
+	}
+      err = verified_hash (file, scratch, n);
+    }
+
+  grub_free (scratch);
+  return err;
+}
+
+/* Hash the rest of FILE and check the signature.  */
+static grub_err_t
+verified_finish (grub_file_t file)
+{
+  grub_verified_t verified = file->data;
+  grub_off_t end = verified->tail ? verified->tail_at : file->size;
+  grub_err_t err;
+
+  if (!verified->sig)
+    return GRUB_ERR_NONE;
+
+  if (verified->hashed < end)
+    {
+      err = verified_skip (file, end);
+      if (err || !verified->sig)
+	return err;
+    }
+
+  return verified_hash (file, verified->tail
+			? verified->tail + (verified->hashed - verified->tail_at)
+			: NULL, file->size - verified->hashed);
+}
+
+/* Read the last bytes of FILE, from at most where the hash is.  */
+static grub_err_t
+verified_load_tail (grub_file_t file)
+{
+  grub_verified_t verified = file->data;
+  grub_off_t at = 0;
+  grub_uint8_t *tail;
+
+  if (file->size > VERIFIED_TAIL_SIZE)
+    at = file->size - VERIFIED_TAIL_SIZE;
+  if (at < verified->hashed)
+    at = verified->hashed;
+
+  tail = grub_malloc (file->size - at);
+  if (!tail)
+    return grub_errno;
+  grub_file_seek (verified->file, at);
+  if (grub_file_read (verified->file, tail, file->size - at)
+      != (grub_ssize_t) (file->size - at))
+    {
+      grub_free (tail);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    file->name);
+      return grub_errno;
+    }
+
+  verified->tail = tail;
+  verified->tail_at = at;
+  return GRUB_ERR_NONE;
+}
+
+/* Read all of FILE into memory, making sure that what was handed out
+   already is what gets verified.  */
+static grub_err_t
+verified_load (grub_file_t file)
+{
+  grub_verified_t verified = file->data;
+  const gcry_md_spec_t *hash = verified->state.hash;
+  grub_off_t end = verified->tail ? verified->tail_at : file->size;
+  grub_uint8_t streamed[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t *buf;
+  void *context;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (file->size >> (sizeof (grub_size_t) * GRUB_CHAR_BIT - 1))
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "big file signature isn't implemented yet");
+
+  if (verified->sig)
+    {
+      err = data_digest (hash, verified->state.context, streamed);
+      if (err)
+	return err;
+    }
+  else
+    grub_memcpy (streamed, verified->digest, hash->mdlen);
+
+  buf = grub_malloc (file->size);
+  context = grub_zalloc (hash->contextsize);
+  if (!buf || !context)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+
+  grub_file_seek (verified->file, 0);
+  if (grub_file_read (verified->file, buf, end) != (grub_ssize_t) end)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    file->name);
+      err = grub_errno;
+      goto fail;
+    }
+  if (verified->tail)
+    grub_memcpy (buf + end, verified->tail, file->size - end);
+
+  hash->init (context);
+  hash->write (context, buf, verified->hashed);
+  hash->final (context);
+  if (grub_memcmp (hash->read (context), streamed, hash->mdlen) != 0)
+    {
+      err = grub_error (GRUB_ERR_BAD_SIGNATURE,
+			"file `%s' changed while being read", file->name);
+      goto fail;
+    }
+  grub_free (context);
+
+  verified->buf = buf;
+  if (verified->sig)
+    return verified_hash (file, buf + verified->hashed,
+			  file->size - verified->hashed);
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (context);
+  grub_free (buf);
+  return err;
+}
+
 static grub_ssize_t
 verified_read (struct grub_file *file, char *buf, grub_size_t len)
 {
   grub_verified_t verified = file->data;
+  grub_off_t off = file->offset;
+  grub_size_t done = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (verified->failed)
+    {
+      grub_error (GRUB_ERR_BAD_SIGNATURE, N_("bad signature"));
+      return -1;
+    }
+
+  verified->used = 1;
+  while (!err && done < len)
+    {
+      grub_size_t n = len - done;
+
+      if (verified->buf)
+	{
+	  grub_memcpy (buf + done, (char *) verified->buf + off, n);
+	  return len;
+	}
+
+      if (off < verified->hashed)
+	{
+	  if (!verified->start)
+	    {
+	      err = verified_load (file);
+	      continue;
+	    }
+	  if (n > verified->hashed - off)
+	    n = verified->hashed - off;
+	  grub_memcpy (buf + done, verified->start + off, n);
+	}
+      else if (verified->tail && off >= verified->tail_at)
+	{
+	  grub_memcpy (buf + done, verified->tail + (off - verified->tail_at),
+		       n);
+	  if (off == verified->hashed)
+	    err = verified_hash (file, buf + done, n);
+	}
+      else if (off == verified->hashed)
+	{
+	  grub_off_t end = verified->tail ? verified->tail_at : file->size;
 
-  grub_memcpy (buf, (char *) verified->buf + file->offset, len);
+	  if (n > end - off)
+	    n = end - off;
+	  grub_file_seek (verified->file, off);
+	  if (grub_file_read (verified->file, buf + done, n)
+	      != (grub_ssize_t) n)
+	    {
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_FILE_READ_ERROR,
+			    N_("premature end of file %s"), file->name);
+	      err = grub_errno;
+	      break;
+	    }
+	  err = verified_hash (file, buf + done, n);
+	}
+      else if (!verified->tail && file->size - off <= VERIFIED_TAIL_SIZE)
+	{
+	  err = verified_load_tail (file);
+	  continue;
+	}
+      else
+	{
+	  err = verified_skip (file, off);
+	  continue;
+	}
+
+      off += n;
+      done += n;
+    }
+
+  if (err)
+    {
+      verified->failed = 1;
+      verify_failed = 1;
+      return -1;
+    }
   return len;
 }
 
+static void
+verified_prefetch (struct grub_file *file, grub_off_t offset, grub_size_t len)
+{
+  grub_verified_t verified = file->data;
+
+  if (!verified->buf)
+    grub_file_prefetch (verified->file, offset, len);
+}
+
 static grub_err_t
 verified_close (struct grub_file *file)
 {
   grub_verified_t verified = file->data;
 
+  /* Whatever was handed out must be checked before it is relied on.  */
+  if (verified->used && !verified->failed && verified_finish (file))
+    verify_failed = 1;
+
   grub_file_close (verified->file);
   verified_free (verified);
   file->data = 0;
@@ -854,6 +1235,7 @@ struct grub_fs verified_fs =
 {
   .name = "verified_read",
   .read = verified_read,
+  .prefetch = verified_prefetch,
   .close = verified_close
 };
 
@@ -862,10 +1244,11 @@ grub_pubkey_open (grub_file_t io, const char *filename)
 {
   grub_file_t sig;
   char *fsuf, *ptr;
-  grub_err_t err;
   grub_file_filter_t curfilt[GRUB_FILE_FILTER_MAX];
   grub_file_t ret;
   grub_verified_t verified;
+  grub_err_t err = GRUB_ERR_NONE;
+  int deferred = grub_file_verify_deferred;
 
   if (!sec)
     return io;
@@ -899,53 +1282,62 @@ grub_pubkey_open (grub_file_t io, const char *filename)
 
   ret->fs = &verified_fs;
   ret->not_easily_seekable = 0;
-  if (ret->size >> (sizeof (grub_size_t) * GRUB_CHAR_BIT - 1))
-    {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  "big file signature isn't implemented yet");
-      grub_file_close (sig);
-      grub_free (ret);
-      return NULL;
-    }
-  verified = grub_malloc (sizeof (*verified));
+  /* All reads must go through the hash.  */
+  ret->head_len = 0;
+  verified = grub_zalloc (sizeof (*verified));
   if (!verified)
     {
       grub_file_close (sig);
       grub_free (ret);
       return NULL;
     }
-  verified->buf = grub_malloc (ret->size);
-  if (!verified->buf)
-    {
-      grub_file_close (sig);
-      grub_free (verified);
-      grub_free (ret);
-      return NULL;
-    }
-  if (grub_file_read (io, verified->buf, ret->size) != (grub_ssize_t) ret->size)
+  verified->file = io;
+  verified->sig = sig;
+  ret->data = verified;
+
+  if (verify_begin (sig, &verified->state) != GRUB_ERR_NONE)
     {
-      if (!grub_errno)
-	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-		    filename);
-      grub_file_close (sig);
       verified_free (verified);
       grub_free (ret);
       return NULL;
     }
 
-  err = grub_verify_signature_real (verified->buf, ret->size, 0, sig, NULL);
-  grub_file_close (sig);
+  if (deferred)
+    {
+      verified->start = grub_malloc (VERIFIED_START_SIZE);
+      if (!verified->start)
+	err = grub_errno;
+      else if (ret->size == 0)
+	err = verified_finish (ret);
+    }
+  else
+    err = verified_load (ret);
   if (err)
     {
       verified_free (verified);
       grub_free (ret);
       return NULL;
     }
-  verified->file = io;
-  ret->data = verified;
+
   return ret;
 }
 
+static grub_err_t
+verify_preboot (int noreturn __attribute__ ((unused)))
+{
+  if (verify_failed)
+    return grub_error (GRUB_ERR_BAD_SIGNATURE,
+		       "a file failed signature verification after it was"
+		       " read, refusing to boot");
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+verify_preboot_restore (void)
+{
+  return GRUB_ERR_NONE;
+}
+
 static char *
 grub_env_write_sec (struct grub_env_var *var __attribute__ ((unused)),
 		    const char *val)
@@ -985,6 +1377,9 @@ GRUB_MOD_INIT(verify)
     sec = 0;
     
   grub_file_filter_register (GRUB_FILE_FILTER_PUBKEY, grub_pubkey_open);
+  preboot_hnd = grub_loader_register_preboot_hook (verify_preboot,
+						   verify_preboot_restore,
+						   GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
 
   grub_register_variable_hook ("check_signatures", 0, grub_env_write_sec);
   grub_env_export ("check_signatures");
@@ -1035,6 +1430,7 @@ GRUB_MOD_INIT(verify)
 GRUB_MOD_FINI(verify)
 {
   grub_file_filter_unregister (GRUB_FILE_FILTER_PUBKEY);
+  grub_loader_unregister_preboot_hook (preboot_hnd);
   grub_unregister_extcmd (cmd);
   grub_unregister_extcmd (cmd_trust);
   grub_unregister_command (cmd_list);
@@ -26,20 +26,64 @@
 
 #include <regex.h>
 
+/* A compiled pattern for one path component.  Patterns with at most one
+   `*' and nothing else special are matched by comparing the text around
+   the `*' with the ends of the name, the others go through regex.  */
+struct pattern
+{
+  struct pattern *next;
+  /* The component as written, which identifies the pattern.  */
+  char *glob;
+  int simple;
+  /* For simple patterns, the `*' in GLOB if any, and the lengths of the
+     text before and after it.  */
+  const char *star;
+  grub_size_t prefix_len, suffix_len;
+  regex_t regexp;
+};
+
+/* Number of compiled patterns kept by pattern_get.  */
+#define PATTERN_CACHE_MAX	8
+
+/* Most recently used first.  */
+static struct pattern *patterns;
+
+/* An entry of a listing.  */
+struct listing_entry
+{
+  char *name;
+  int case_insensitive;
+};
+
+/* A directory listed during one expansion, which is not listed again by
+   the same expansion.  */
+struct listing
+{
+  struct listing *next;
+  /* The device as written and the path with no trailing slash.  */
+  char *dir;
+  int failed;
+  grub_size_t nentries, alloc;
+  struct listing_entry *entries;
+};
+
 static inline int isregexop (char ch);
 static char ** merge (char **lhs, char **rhs);
 static char *make_dir (const char *prefix, const char *start, const char *end);
 static int make_regex (const char *regex_start, const char *regex_end,
 		       regex_t *regexp);
 static void split_path (const char *path, const char **suffix_end, const char **regex_end);
-static char ** match_devices (const regex_t *regexp, int noparts);
-static char ** match_files (const char *prefix, const char *suffix_start,
-			    const char *suffix_end, const regex_t *regexp);
+static char ** match_devices (const struct pattern *pat, int noparts);
+static char ** match_files (struct listing **listings, const char *prefix,
+			    const char *suffix_start, const char *suffix_end,
+			    const struct pattern *pat);
 
 static grub_err_t wildcard_expand (const char *s, char ***strs);
+static void wildcard_flush (void);
 
 struct grub_script_wildcard_translator grub_filename_translator = {
   .expand = wildcard_expand,
+  .flush = wildcard_flush,
 };
 
 static char **
@@ -173,6 +217,121 @@ make_regex (const char *start, const char *end, regex_t *regexp)
   return 0;
 }
 
+static void
+pattern_free (struct pattern *pat)
+{
+  if (! pat->simple)
+    regfree (&pat->regexp);
+  grub_free (pat->glob);
+  grub_free (pat);
+}
+
+static void
+wildcard_flush (void)
+{
+  struct pattern *pat;
+
+  while (patterns)
+    {
+      pat = patterns;
+      patterns = pat->next;
+      pattern_free (pat);
+    }
+}
+
+/* Return the pattern for the component from START to END, compiling it
+   unless it was used recently.  */
+static struct pattern *
+pattern_get (const char *start, const char *end)
+{
+  struct pattern **prev, *pat;
+  grub_size_t len = end - start;
+  const char *ptr;
+  int n = 0;
+
+  for (prev = &patterns; *prev; prev = &(*prev)->next, n++)
+    if (grub_strncmp ((*prev)->glob, start, len) == 0
+	&& (*prev)->glob[len] == '\0')
+      {
+	pat = *prev;
+	*prev = pat->next;
+	pat->next = patterns;
+	patterns = pat;
+	return pat;
+      }
+
+  pat = grub_zalloc (sizeof (*pat));
+  if (! pat)
+    return 0;
+  pat->glob = grub_strndup (start, len);
+  if (! pat->glob)
+    {
+      grub_free (pat);
+      return 0;
+    }
+
+  /* make_regex passes `^' and `$' on as they are.  */
+  pat->simple = 1;
+  for (ptr = pat->glob; *ptr && pat->simple; ptr++)
+    switch (*ptr)
+      {
+      case '*':
+	if (pat->star)
+	  pat->simple = 0;
+	pat->star = ptr;
+	break;
+      case '\\':
+      case '?':
+      case '^':
+      case '$':
+	pat->simple = 0;
+	break;
+      }
+
+  if (pat->simple)
+    {
+      pat->prefix_len = pat->star ? (grub_size_t) (pat->star - pat->glob) : len;
+      pat->suffix_len = pat->star ? len - pat->prefix_len - 1 : 0;
+      grub_dprintf ("expand", "Simple pattern %s\n", pat->glob);
+    }
+  else if (make_regex (start, end, &pat->regexp))
+    {
+      grub_free (pat->glob);
+      grub_free (pat);
+      return 0;
+    }
+
+  /* Forget the least recently used pattern.  */
+  if (n >= PATTERN_CACHE_MAX)
+    {
+      for (prev = &patterns; (*prev)->next; prev = &(*prev)->next);
+      pattern_free (*prev);
+      *prev = 0;
+    }
+
+  pat->next = patterns;
+  patterns = pat;
+  return pat;
+}
+
+static int
+pattern_match (const struct pattern *pat, const char *name)
+{
+  grub_size_t len;
+
+  if (! pat->simple)
+    return regexec (&pat->regexp, name, 0, 0, 0) == 0;
+
+  if (! pat->star)
+    return grub_strcmp (name, pat->glob) == 0;
+
+  len = grub_strlen (name);
+  return (len >= pat->prefix_len + pat->suffix_len
+	  && grub_memcmp (name, pat->glob, pat->prefix_len) == 0
+	  && grub_memcmp (name + len - pat->suffix_len, pat->star + 1,
+			  pat->suffix_len) == 0);
+}
+
 /* Split `str' into two parts: (1) dirname that is regexop free (2)
    dirname that has a regexop.  */
 static void
@@ -213,7 +372,7 @@ split_path (const char *str, const char **noregexop, const char **regexop)
 /* Context for match_devices.  */
 struct match_devices_ctx
 {
-  const regex_t *regexp;
+  const struct pattern *pat;
   int noparts;
   int ndev;
   char **devs;
@@ -236,7 +395,7 @@ match_devices_iter (const char *name, void *data)
     return 1;
 
   grub_dprintf ("expand", "matching: %s\n", buffer);
-  if (regexec (ctx->regexp, buffer, 0, 0, 0))
+  if (! pattern_match (ctx->pat, buffer))
     {
       grub_dprintf ("expand", "not matched\n");
       grub_free (buffer);
@@ -257,10 +416,10 @@ match_devices_iter (const char *name, void *data)
 }
 
 static char **
-match_devices (const regex_t *regexp, int noparts)
+match_devices (const struct pattern *pat, int noparts)
 {
   struct match_devices_ctx ctx = {
-    .regexp = regexp,
+    .pat = pat,
     .noparts = noparts,
     .ndev = 0,
     .devs = 0
@@ -282,184 +441,205 @@ match_devices (const regex_t *regexp, int noparts)
   return 0;
 }
 
-/* Context for match_files.  */
-struct match_files_ctx
+static void
+listings_free (struct listing *listings)
 {
-  const regex_t *regexp;
-  char **files;
-  unsigned nfile;
-  char *dir;
-};
+  struct listing *l;
+  grub_size_t i;
 
-/* Helper for match_files.  */
+  while (listings)
+    {
+      l = listings;
+      listings = l->next;
+      for (i = 0; i < l->nentries; i++)
+	grub_free (l->entries[i].name);
+      grub_free (l->entries);
+      grub_free (l->dir);
+      grub_free (l);
+    }
+}
+
+/* Helper for get_listing.  */
 static int
-match_files_iter (const char *name,
-		  const struct grub_dirhook_info *info __attribute__((unused)),
+get_listing_iter (const char *name, const struct grub_dirhook_info *info,
 		  void *data)
 {
-  struct match_files_ctx *ctx = data;
-  char **t;
-  char *buffer;
+  struct listing *l = data;
+  struct listing_entry *e;
 
-  /* skip . and .. names */
-  if (grub_strcmp(".", name) == 0 || grub_strcmp("..", name) == 0)
-    return 0;
+  if (l->nentries == l->alloc)
+    {
+      e = grub_realloc (l->entries, (2 * l->alloc + 16) * sizeof (*e));
+      if (! e)
+	return 1;
+      l->entries = e;
+      l->alloc = 2 * l->alloc + 16;
+    }
 
-  grub_dprintf ("expand", "matching: %s in %s\n", name, ctx->dir);
-  if (regexec (ctx->regexp, name, 0, 0, 0))
-    return 0;
+  e = &l->entries[l->nentries];
+  e->name = grub_strdup (name);
+  if (! e->name)
+    return 1;
+  e->case_insensitive = info->case_insensitive;
+  l->nentries++;
+  return 0;
+}
 
-  grub_dprintf ("expand", "matched\n");
+/* Return the listing of DIR, listing it unless it's in LISTINGS already.
+   A listing that couldn't be made completely is marked as failed.  */
+static struct listing *
+get_listing (struct listing **listings, const char *dir)
+{
+  struct listing *l;
+  const char *path;
+  char *device_name, *end;
+  grub_device_t dev;
+  grub_fs_t fs;
 
-  buffer = grub_xasprintf ("%s%s", ctx->dir, name);
-  if (! buffer)
-    return 1;
+  l = grub_zalloc (sizeof (*l));
+  if (! l)
+    return 0;
 
-  t = grub_realloc (ctx->files, sizeof (char*) * (ctx->nfile + 2));
-  if (! t)
+  /* The same directory is often written with and without a trailing
+     slash, and an empty path is the root.  */
+  if (dir[0] == '(' && grub_strchr (dir, ')'))
+    path = grub_strchr (dir, ')') + 1;
+  else
+    path = dir;
+  l->dir = grub_malloc (grub_strlen (dir) + 2);
+  if (! l->dir)
     {
-      grub_free (buffer);
-      return 1;
+      grub_free (l);
+      return 0;
     }
+  grub_strcpy (l->dir, dir);
+  path = l->dir + (path - dir);
+  for (end = l->dir + grub_strlen (l->dir); end > path + 1 && end[-1] == '/';
+       end--);
+  if (end == path)
+    *end++ = '/';
+  *end = '\0';
+
+  for (; *listings; listings = &(*listings)->next)
+    if (grub_strcmp ((*listings)->dir, l->dir) == 0)
+      {
+	grub_free (l->dir);
+	grub_free (l);
+	return *listings;
+      }
+
+  grub_dprintf ("expand", "listing %s\n", l->dir);
+  grub_error_push ();
+  l->failed = 1;
+  device_name = grub_file_get_device_name (dir);
+  dev = grub_device_open (device_name);
+  if (dev)
+    {
+      fs = grub_fs_probe (dev);
+      if (fs && fs->dir (dev, path, get_listing_iter, l) == GRUB_ERR_NONE
+	  && grub_errno == GRUB_ERR_NONE)
+	l->failed = 0;
+      grub_device_close (dev);
+    }
+  grub_free (device_name);
+  grub_error_pop ();
 
-  ctx->files = t;
-  ctx->files[ctx->nfile++] = buffer;
-  ctx->files[ctx->nfile] = 0;
-  return 0;
+  *listings = l;
+  return l;
 }
 
 static char **
-match_files (const char *prefix, const char *suffix, const char *end,
-	     const regex_t *regexp)
+match_files (struct listing **listings, const char *prefix,
+	     const char *suffix, const char *end, const struct pattern *pat)
 {
-  struct match_files_ctx ctx = {
-    .regexp = regexp,
-    .nfile = 0,
-    .files = 0
-  };
-  int i;
-  const char *path;
-  char *device_name;
-  grub_fs_t fs;
-  grub_device_t dev;
+  struct listing *l;
+  char **files = 0;
+  unsigned nfile = 0;
+  char *dir;
+  grub_size_t i;
 
-  dev = 0;
-  device_name = 0;
   grub_error_push ();
 
-  ctx.dir = make_dir (prefix, suffix, end);
-  if (! ctx.dir)
-    goto fail;
-
-  device_name = grub_file_get_device_name (ctx.dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
+  dir = make_dir (prefix, suffix, end);
+  if (! dir)
     goto fail;
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
+  l = get_listing (listings, dir);
+  if (! l || l->failed)
     goto fail;
 
-  if (ctx.dir[0] == '(')
+  for (i = 0; i < l->nentries; i++)
     {
-      path = grub_strchr (ctx.dir, ')');
-      if (!path)
-	goto fail;
-      path++;
-    }
-  else
-    path = ctx.dir;
+      const char *name = l->entries[i].name;
+      char **t;
+      char *buffer;
 
-  if (fs->dir (dev, path, match_files_iter, &ctx))
-    goto fail;
+      /* skip . and .. names */
+      if (grub_strcmp(".", name) == 0 || grub_strcmp("..", name) == 0)
+	continue;
 
-  grub_free (ctx.dir);
-  grub_device_close (dev);
-  grub_free (device_name);
-  grub_error_pop ();
-  return ctx.files;
+      grub_dprintf ("expand", "matching: %s in %s\n", name, dir);
+      if (! pattern_match (pat, name))
+	continue;
 
- fail:
+      grub_dprintf ("expand", "matched\n");
 
-  grub_free (ctx.dir);
+      buffer = grub_xasprintf ("%s%s", dir, name);
+      if (! buffer)
+	goto fail;
 
-  for (i = 0; ctx.files && ctx.files[i]; i++)
-    grub_free (ctx.files[i]);
+      t = grub_realloc (files, sizeof (char*) * (nfile + 2));
+      if (! t)
+	{
+	  grub_free (buffer);
+	  goto fail;
+	}
 
-  grub_free (ctx.files);
+      files = t;
+      files[nfile++] = buffer;
+      files[nfile] = 0;
+    }
 
-  if (dev)
-    grub_device_close (dev);
+  grub_free (dir);
+  grub_error_pop ();
+  return files;
 
-  grub_free (device_name);
+ fail:
 
-  grub_error_pop ();
-  return 0;
-}
+  grub_free (dir);
 
-/* Context for check_file.  */
-struct check_file_ctx
-{
-  const char *basename;
-  int found;
-};
+  for (i = 0; files && files[i]; i++)
+    grub_free (files[i]);
 
-/* Helper for check_file.  */
-static int
-check_file_iter (const char *name, const struct grub_dirhook_info *info,
-		 void *data)
-{
-  struct check_file_ctx *ctx = data;
+  grub_free (files);
 
-  if (ctx->basename[0] == 0
-      || (info->case_insensitive ? grub_strcasecmp (name, ctx->basename) == 0
-	  : grub_strcmp (name, ctx->basename) == 0))
-    {
-      ctx->found = 1;
-      return 1;
-    }
-  
+  grub_error_pop ();
   return 0;
 }
 
 static int
-check_file (const char *dir, const char *basename)
+check_file (struct listing **listings, const char *dir, const char *basename)
 {
-  struct check_file_ctx ctx = {
-    .basename = basename,
-    .found = 0
-  };
-  grub_fs_t fs;
-  grub_device_t dev;
-  const char *device_name, *path;
-
-  device_name = grub_file_get_device_name (dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
-
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    goto fail;
+  struct listing *l;
+  grub_size_t i;
 
-  if (dir[0] == '(')
+  l = get_listing (listings, dir);
+  if (! l)
     {
-      path = grub_strchr (dir, ')');
-      if (!path)
-	goto fail;
-      path++;
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
     }
-  else
-    path = dir;
 
-  fs->dir (dev, path[0] ? path : "/", check_file_iter, &ctx);
-  if (grub_errno == 0 && basename[0] == 0)
-    ctx.found = 1;
+  if (basename[0] == 0)
+    return ! l->failed;
 
- fail:
-  grub_errno = 0;
+  for (i = 0; i < l->nentries; i++)
+    if (l->entries[i].case_insensitive
+	? grub_strcasecmp (l->entries[i].name, basename) == 0
+	: grub_strcmp (l->entries[i].name, basename) == 0)
+      return 1;
 
-  return ctx.found;
+  return 0;
 }
 
 static void
@@ -493,7 +673,8 @@ wildcard_expand (const char *s, char ***strs)
   int had_regexp = 0;
 
   unsigned i;
-  regex_t regexp;
+  struct pattern *pat;
+  struct listing *listings = 0;
 
   *strs = 0;
   if (s[0] != '/' && s[0] != '(' && s[0] != '*')
@@ -545,7 +726,7 @@ wildcard_expand (const char *s, char ***strs)
 		      continue;
 		    }
 		  *p = 0;
-		  if (!check_file (n, p + 1))
+		  if (!check_file (&listings, n, p + 1))
 		    {
 		      grub_dprintf ("expand", "file <%s> in <%s> not found\n",
 				    p + 1, n);
@@ -570,7 +751,8 @@ wildcard_expand (const char *s, char ***strs)
 	  continue;
 	}
 
-      if (make_regex (noregexop, regexop, &regexp))
+      pat = pattern_get (noregexop, regexop);
+      if (! pat)
 	goto fail;
 
       had_regexp = 1;
@@ -578,10 +760,10 @@ wildcard_expand (const char *s, char ***strs)
       if (paths == 0)
 	{
 	  if (start == noregexop) /* device part has regexop */
-	    paths = match_devices (&regexp, *start != '(');
+	    paths = match_devices (pat, *start != '(');
 
 	  else  /* device part explicit wo regexop */
-	    paths = match_files ("", start, noregexop, &regexp);
+	    paths = match_files (&listings, "", start, noregexop, pat);
 	}
       else
 	{
@@ -591,7 +773,7 @@ wildcard_expand (const char *s, char ***strs)
 	    {
 	      char **p;
 
-	      p = match_files (paths[i], start, noregexop, &regexp);
+	      p = match_files (&listings, paths[i], start, noregexop, pat);
 	      grub_free (paths[i]);
 	      if (! p)
 		continue;
@@ -604,7 +786,6 @@ wildcard_expand (const char *s, char ***strs)
 	  paths = r;
 	}
 
-      regfree (&regexp);
       if (! paths)
 	goto done;
 
@@ -613,14 +794,15 @@ wildcard_expand (const char *s, char ***strs)
 
  done:
 
+  listings_free (listings);
   *strs = paths;
   return 0;
 
  fail:
 
+  listings_free (listings);
   for (i = 0; paths && paths[i]; i++)
     grub_free (paths[i]);
   grub_free (paths);
-  regfree (&regexp);
   return grub_errno;
 }
@@ -101,7 +101,15 @@ struct grub_ahci_received_fis
 
 enum
   {
-    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f
+    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f,
+    GRUB_AHCI_HBA_CAP_NCS_MASK = 0x1f00,
+    GRUB_AHCI_HBA_CAP_SNCQ = 0x40000000
+  };
+#define GRUB_AHCI_HBA_CAP_NCS_SHIFT 8
+
+enum
+  {
+    GRUB_AHCI_HBA_PORT_IS_TFES = 0x40000000
   };
 
 enum
@@ -119,6 +127,11 @@ enum
     GRUB_AHCI_BIOS_HANDOFF_RWC = 8
   };
 
+/* Commands kept in flight by the queued path and the size of each.  */
+#define GRUB_AHCI_NCQ_MAX_DEPTH 8
+#define GRUB_AHCI_NCQ_CMD_SIZE 0x40000
+/* Command tables must be aligned on 128 bytes.  */
+#define GRUB_AHCI_CMD_TABLE_STRIDE 256
 
 struct grub_ahci_device
 {
@@ -132,6 +145,10 @@ struct grub_ahci_device
   struct grub_pci_dma_chunk *command_table_chunk;
   volatile struct grub_ahci_cmd_table *command_table;
   struct grub_pci_dma_chunk *rfis;
+  /* Command tables and bounce buffers of the queued slots, allocated on
+     first use.  */
+  struct grub_pci_dma_chunk *ncq_table_chunk;
+  struct grub_pci_dma_chunk *ncq_buf[GRUB_AHCI_NCQ_MAX_DEPTH];
   int present;
   int atapi;
 };
@@ -171,19 +188,10 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 		   void *data __attribute__ ((unused)))
 {
   grub_pci_address_t addr;
-  grub_uint32_t class;
   grub_uint32_t bar;
   unsigned i, nports;
   volatile struct grub_ahci_hba *hba;
 
-  /* Read class.  */
-  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
-  class = grub_pci_read (addr);
-
-  /* Check if this class ID matches that of a PCI IDE Controller.  */
-  if (class >> 8 != 0x010601)
-    return 0;
-
   addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG5);
 
   bar = grub_pci_read (addr);
@@ -648,7 +656,8 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 static grub_err_t
 grub_ahci_initialize (void)
 {
-  grub_pci_iterate (grub_ahci_pciinit, NULL);
+  /* SATA controllers with the AHCI interface.  */
+  grub_pci_iterate_class (0x010601, 0xffffff, grub_ahci_pciinit, NULL);
   return grub_errno;
 }
 
@@ -660,6 +669,7 @@ grub_ahci_fini_hw (int noreturn __attribute__ ((unused)))
   for (dev = grub_ahci_devices; dev; dev = dev->next)
     {
       grub_uint64_t endtime;
+      unsigned i;
 
       dev->hba->ports[dev->port].command &= ~GRUB_AHCI_HBA_PORT_CMD_FRE;
       endtime = grub_get_time_ms () + 1000;
@@ -684,6 +694,15 @@ grub_ahci_fini_hw (int noreturn __attribute__ ((unused)))
       dev->command_list_chunk = NULL;
       dev->command_table_chunk = NULL;
       dev->rfis = NULL;
+      if (dev->ncq_table_chunk)
+	grub_dma_free (dev->ncq_table_chunk);
+      dev->ncq_table_chunk = NULL;
+      for (i = 0; i < GRUB_AHCI_NCQ_MAX_DEPTH; i++)
+	{
+	  if (dev->ncq_buf[i])
+	    grub_dma_free (dev->ncq_buf[i]);
+	  dev->ncq_buf[i] = NULL;
+	}
     }
   return GRUB_ERR_NONE;
 }
@@ -695,9 +714,12 @@ reinit_port (struct grub_ahci_device *dev)
   struct grub_pci_dma_chunk *command_table;
   grub_uint64_t endtime;
 
-  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head));
+  command_list = grub_memalign_dma32 (1024,
+				      sizeof (struct grub_ahci_cmd_head) * 32);
   if (!command_list)
     return 1;
+  grub_memset ((char *) grub_dma_get_virt (command_list), 0,
+	       sizeof (struct grub_ahci_cmd_head) * 32);
 
   command_table = grub_memalign_dma32 (1024,
 				       sizeof (struct grub_ahci_cmd_table));
@@ -1084,6 +1106,202 @@ grub_ahci_readwrite (grub_ata_t disk,
   return grub_ahci_readwrite_real (disk->data, parms, spinup, 0);
 }
 
+static grub_err_t
+grub_ahci_ncq_setup (struct grub_ahci_device *dev, unsigned depth)
+{
+  unsigned i;
+
+  if (!dev->ncq_table_chunk)
+    {
+      dev->ncq_table_chunk
+	= grub_memalign_dma32 (1024, GRUB_AHCI_CMD_TABLE_STRIDE
+			       * GRUB_AHCI_NCQ_MAX_DEPTH);
+      if (!dev->ncq_table_chunk)
+	return grub_errno;
+    }
+
+  for (i = 0; i < depth; i++)
+    if (!dev->ncq_buf[i])
+      {
+	dev->ncq_buf[i] = grub_memalign_dma32 (1024, GRUB_AHCI_NCQ_CMD_SIZE);
+	if (!dev->ncq_buf[i])
+	  return grub_errno;
+      }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Fill command slot SLOT with a queued read or write of COUNT sectors at
+   SECTOR, using the slot number as tag.  */
+static void
+grub_ahci_ncq_prepare (struct grub_ahci_device *dev, unsigned slot,
+		       grub_disk_addr_t sector, grub_size_t count,
+		       grub_size_t size, int rw)
+{
+  volatile struct grub_ahci_cmd_table *table;
+  grub_uint64_t table_phys;
+
+  table = (volatile struct grub_ahci_cmd_table *)
+    ((char *) grub_dma_get_virt (dev->ncq_table_chunk)
+     + (slot - 1) * GRUB_AHCI_CMD_TABLE_STRIDE);
+  table_phys = grub_dma_get_phys (dev->ncq_table_chunk)
+    + (slot - 1) * GRUB_AHCI_CMD_TABLE_STRIDE;
+
+  grub_memset ((char *) table, 0, sizeof (*table));
+  table->cfis[0] = GRUB_AHCI_FIS_REG_H2D;
+  table->cfis[1] = 0x80;
+  table->cfis[2] = rw ? GRUB_ATA_CMD_WRITE_FPDMA_QUEUED
+    : GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+  /* The sector count goes into the features registers ...  */
+  table->cfis[3] = count & 0xff;
+  table->cfis[11] = (count >> 8) & 0xff;
+  table->cfis[4] = sector & 0xff;
+  table->cfis[5] = (sector >> 8) & 0xff;
+  table->cfis[6] = (sector >> 16) & 0xff;
+  table->cfis[7] = 0x40;
+  table->cfis[8] = (sector >> 24) & 0xff;
+  table->cfis[9] = (sector >> 32) & 0xff;
+  table->cfis[10] = (sector >> 40) & 0xff;
+  /* ... and the tag into the sector count one.  */
+  table->cfis[12] = slot << 3;
+
+  table->prdt[0].data_base = grub_dma_get_phys (dev->ncq_buf[slot - 1]);
+  table->prdt[0].unused = 0;
+  table->prdt[0].size = size - 1;
+
+  dev->command_list[slot].config
+    = (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
+    | (1 << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+    | (rw ? GRUB_AHCI_CONFIG_WRITE : GRUB_AHCI_CONFIG_READ);
+  dev->command_list[slot].transferred = 0;
+  dev->command_list[slot].command_table_base = table_phys;
+  grub_memset ((char *) dev->command_list[slot].unused, 0,
+	       sizeof (dev->command_list[slot].unused));
+}
+
+/* Transfer SIZE sectors with up to GRUB_AHCI_NCQ_MAX_DEPTH FPDMA QUEUED
+   commands outstanding, refilling a slot as soon as SActive reports the
+   command in it as done.  Slot 0 stays with the non-queued commands,
+   which leave its SActive bit set.  */
+static grub_err_t
+grub_ahci_readwrite_ncq (struct grub_ata *ata, grub_disk_addr_t sector,
+			 grub_size_t size, char *buf, int rw)
+{
+  struct grub_ahci_device *dev = ata->data;
+  volatile struct grub_ahci_hba_port *port = &dev->hba->ports[dev->port];
+  grub_size_t cmd_start[GRUB_AHCI_NCQ_MAX_DEPTH];
+  grub_size_t cmd_count[GRUB_AHCI_NCQ_MAX_DEPTH];
+  grub_size_t per_cmd, issued = 0;
+  grub_uint32_t busy = 0, slots;
+  unsigned depth, nslots, slot;
+  grub_uint64_t endtime;
+  const char *failure = NULL;
+  grub_err_t err;
+
+  nslots = ((dev->hba->cap & GRUB_AHCI_HBA_CAP_NCS_MASK)
+	    >> GRUB_AHCI_HBA_CAP_NCS_SHIFT) + 1;
+  depth = ata->ncq_depth - 1;
+  if (depth > nslots - 1)
+    depth = nslots - 1;
+  if (depth > GRUB_AHCI_NCQ_MAX_DEPTH)
+    depth = GRUB_AHCI_NCQ_MAX_DEPTH;
+
+  if (!(dev->hba->cap & GRUB_AHCI_HBA_CAP_SNCQ) || dev->atapi || depth < 2)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "AHCI NCQ isn't supported");
+
+  err = grub_ahci_ncq_setup (dev, depth);
+  if (err)
+    return err;
+
+  grub_ahci_reset_port (dev, 0);
+  port->sata_error = port->sata_error;
+  port->intstatus = 0xffffffff;
+
+  slots = ((1U << depth) - 1) << 1;
+  if ((port->command_issue | port->sata_active) & slots)
+    return grub_error (GRUB_ERR_IO, "AHCI command slots are busy");
+
+  per_cmd = GRUB_AHCI_NCQ_CMD_SIZE >> ata->log_sector_size;
+
+  grub_dprintf ("ahci", "NCQ %s of %llu sectors, depth %u\n",
+		rw ? "write" : "read", (unsigned long long) size, depth);
+
+  endtime = grub_get_time_ms () + 20000;
+  while (issued < size || busy)
+    {
+      grub_uint32_t done;
+
+      for (slot = 1; slot <= depth && issued < size; slot++)
+	{
+	  grub_size_t count;
+
+	  if (busy & (1U << slot))
+	    continue;
+
+	  count = size - issued;
+	  if (count > per_cmd)
+	    count = per_cmd;
+	  if (rw)
+	    grub_memcpy ((char *) grub_dma_get_virt (dev->ncq_buf[slot - 1]),
+			 buf + (issued << ata->log_sector_size),
+			 count << ata->log_sector_size);
+	  grub_ahci_ncq_prepare (dev, slot, sector + issued, count,
+				 count << ata->log_sector_size, rw);
+	  cmd_start[slot - 1] = issued;
+	  cmd_count[slot - 1] = count;
+	  issued += count;
+	  busy |= 1U << slot;
+
+	  port->sata_active = 1U << slot;
+	  port->command_issue = 1U << slot;
+	}
+
+      if ((port->intstatus & GRUB_AHCI_HBA_PORT_IS_TFES)
+	  || (port->task_file_data & GRUB_ATA_STATUS_ERR))
+	{
+	  failure = "AHCI NCQ command failed";
+	  break;
+	}
+
+      /* The HBA clears the issue bit once the command is sent and the
+	 device clears the SActive one once it is done.  */
+      done = busy & ~(port->sata_active | port->command_issue);
+      if (!done)
+	{
+	  if (grub_get_time_ms () > endtime)
+	    {
+	      failure = "AHCI transfer timed out";
+	      break;
+	    }
+	  continue;
+	}
+
+      for (slot = 1; slot <= depth; slot++)
+	if (done & (1U << slot))
+	  {
+	    if (!rw)
+	      grub_memcpy (buf + (cmd_start[slot - 1] << ata->log_sector_size),
+			   (char *) grub_dma_get_virt (dev->ncq_buf[slot - 1]),
+			   cmd_count[slot - 1] << ata->log_sector_size);
+	    busy &= ~(1U << slot);
+	  }
+      endtime = grub_get_time_ms () + 20000;
+    }
+
+  if (failure)
+    {
+      grub_dprintf ("ahci", "AHCI NCQ status <%x %x %x %x %x>\n",
+		    port->command_issue, port->sata_active, port->intstatus,
+		    port->task_file_data, port->sata_error);
+      /* Stopping the port drops whatever is still queued.  */
+      grub_ahci_reset_port (dev, 1);
+      return grub_error (GRUB_ERR_IO, "%s", failure);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ahci_open (int id, int devnum, struct grub_ata *ata)
 {
@@ -1115,6 +1333,7 @@ static struct grub_ata_dev grub_ahci_dev =
     .iterate = grub_ahci_iterate,
     .open = grub_ahci_open,
     .readwrite = grub_ahci_readwrite,
+    .readwrite_ncq = grub_ahci_readwrite_ncq,
   };
 
 
@@ -56,6 +56,7 @@ grub_ata_dumpinfo (struct grub_ata *dev, grub_uint16_t *info)
       grub_dprintf ("ata", "Addressing: %d\n", dev->addr);
       grub_dprintf ("ata", "Sectors: %lld\n", (unsigned long long) dev->size);
       grub_dprintf ("ata", "Sector size: %u\n", 1U << dev->log_sector_size);
+      grub_dprintf ("ata", "NCQ depth: %u\n", dev->ncq_depth);
     }
 }
 
@@ -168,6 +169,13 @@ grub_ata_identify (struct grub_ata *dev)
 	dev->addr = GRUB_ATA_LBA;
     }
 
+  /* Native command queuing always uses 48-bit addresses.  */
+  if (dev->addr == GRUB_ATA_LBA48
+      && (info16[76] & grub_cpu_to_le16_compile_time ((1 << 8))))
+    dev->ncq_depth = (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1;
+  else
+    dev->ncq_depth = 0;
+
   /* Determine the amount of sectors.  */
   if (dev->addr != GRUB_ATA_LBA48)
     dev->size = grub_le_to_cpu32 (info32[30]);
@@ -326,6 +334,23 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   else
     batch = 1;
 
+  /* With several commands queued the device works on the next one while
+     the previous one is transferred.  */
+  if (ata->dma && ata->ncq_depth > 1 && ata->dev->readwrite_ncq
+      && size > batch)
+    {
+      grub_err_t err;
+
+      err = ata->dev->readwrite_ncq (ata, sector, size, buf, rw);
+      if (err == GRUB_ERR_NONE)
+	return GRUB_ERR_NONE;
+
+      /* Go back to one command at a time for good.  */
+      grub_dprintf ("ata", "disabling NCQ: %s\n", grub_errmsg);
+      ata->ncq_depth = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   while (nsectors < size)
     {
       struct grub_disk_ata_pass_through_parms parms;
@@ -26,6 +26,8 @@
 #include <grub/file.h>
 #include <grub/procfs.h>
 #include <grub/partition.h>
+#include <grub/boot_hint.h>
+#include <grub/mp.h>
 
 #ifdef GRUB_UTIL
 #include <grub/emu/hostdisk.h>
@@ -54,21 +56,32 @@ static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
 static grub_cryptodisk_t cryptodisk_list = NULL;
 static grub_uint8_t last_cryptodisk_id = 0;
 
+/* The number of XTS tweaks computed and applied at once.  */
+#define XTS_BATCH 32
+
+/* Requests at least this large are split over all processors.  */
+#define MP_MIN_BYTES 65536
+
+/* Fill TWEAKS with the N successive XTS tweaks starting with T, and leave
+   the next one in T.  The tweaks are little-endian 128-bit numbers, so
+   multiplying them by x is a shift across two 64-bit words.  */
 static void
-gf_mul_x (grub_uint8_t *g)
+xts_tweaks (grub_uint64_t *tweaks, grub_uint64_t t[2], unsigned n)
 {
-  int over = 0, over2 = 0;
-  unsigned j;
+  grub_uint64_t lo = grub_le_to_cpu64 (t[0]), hi = grub_le_to_cpu64 (t[1]);
+  grub_uint64_t carry;
+  unsigned k;
 
-  for (j = 0; j < GRUB_CRYPTODISK_GF_BYTES; j++)
+  for (k = 0; k < n; k++)
     {
-      over2 = !!(g[j] & 0x80);
-      g[j] <<= 1;
-      g[j] |= over;
-      over = over2;
+      tweaks[2 * k] = grub_cpu_to_le64 (lo);
+      tweaks[2 * k + 1] = grub_cpu_to_le64 (hi);
+      carry = hi >> 63;
+      hi = (hi << 1) | (lo >> 63);
+      lo = (lo << 1) ^ (carry ? GF_POLYNOM : 0);
     }
-  if (over)
-    g[0] ^= GF_POLYNOM;
+  t[0] = grub_cpu_to_le64 (lo);
+  t[1] = grub_cpu_to_le64 (hi);
 }
 
 
@@ -221,10 +234,110 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+static void
+zone_key_swap (struct grub_cryptodisk *dev,
+	       struct grub_cryptodisk_zone_key *zk, grub_uint64_t zone)
+{
+  struct grub_cryptodisk_zone_key tmp;
+
+  tmp = *zk;
+  zk->zone = dev->last_rekey;
+  zk->cipher = dev->cipher;
+  zk->secondary_cipher = dev->secondary_cipher;
+  grub_memcpy (zk->key, dev->key, dev->keysize);
+  zk->keysize = dev->keysize;
+  zk->last_use = dev->zone_key_clock;
+
+  dev->last_rekey = zone;
+  dev->cipher = tmp.cipher;
+  dev->secondary_cipher = tmp.secondary_cipher;
+  grub_memcpy (dev->key, tmp.key, tmp.keysize);
+  dev->keysize = tmp.keysize;
+}
+
+/* Make the key of ZONE the current one.  The keys of the last zones used
+   stay expanded in cipher handles of their own, so that reads going back
+   and forth between zones neither derive nor expand them again.  */
 static gcry_err_code_t
-grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
-			   grub_uint8_t * data, grub_size_t len,
-			   grub_disk_addr_t sector, int do_encrypt)
+cryptodisk_rekey (struct grub_cryptodisk *dev, grub_uint64_t zone)
+{
+  struct grub_cryptodisk_zone_key *zk, *victim = NULL;
+  gcry_err_code_t err;
+  unsigned i;
+
+  if (zone == dev->last_rekey)
+    return GPG_ERR_NO_ERROR;
+
+  /* ESSIV and LRW have more state derived from the key.  */
+  if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_ESSIV
+      || dev->mode == GRUB_CRYPTODISK_MODE_LRW)
+    goto uncached;
+
+  if (!dev->zone_keys)
+    {
+      dev->zone_keys = grub_zalloc (GRUB_CRYPTODISK_ZONE_KEYS
+				    * sizeof (dev->zone_keys[0]));
+      if (!dev->zone_keys)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  goto uncached;
+	}
+    }
+
+  dev->zone_key_clock++;
+  for (i = 0; i < GRUB_CRYPTODISK_ZONE_KEYS; i++)
+    {
+      zk = &dev->zone_keys[i];
+      if (zk->cipher && zk->zone == zone)
+	{
+	  zone_key_swap (dev, zk, zone);
+	  return GPG_ERR_NO_ERROR;
+	}
+      if (!victim || (victim->cipher
+		      && (!zk->cipher || zk->last_use < victim->last_use)))
+	victim = zk;
+    }
+
+  if (!victim->cipher)
+    {
+      victim->cipher = grub_crypto_cipher_open (dev->cipher->cipher);
+      if (victim->cipher && dev->secondary_cipher)
+	{
+	  victim->secondary_cipher
+	    = grub_crypto_cipher_open (dev->secondary_cipher->cipher);
+	  if (!victim->secondary_cipher)
+	    {
+	      grub_crypto_cipher_close (victim->cipher);
+	      victim->cipher = NULL;
+	    }
+	}
+      if (!victim->cipher)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  goto uncached;
+	}
+    }
+
+  /* Park the current key and derive the new one into the handles of the
+     one pushed out.  */
+  zone_key_swap (dev, victim, zone);
+  err = dev->rekey (dev, zone);
+  if (err)
+    dev->last_rekey = (grub_uint64_t) -1;
+  return err;
+
+ uncached:
+  err = dev->rekey (dev, zone);
+  if (err)
+    return err;
+  dev->last_rekey = zone;
+  return GPG_ERR_NO_ERROR;
+}
+
+static gcry_err_code_t
+grub_cryptodisk_endecrypt_serial (struct grub_cryptodisk *dev,
+				  grub_uint8_t * data, grub_size_t len,
+				  grub_disk_addr_t sector, int do_encrypt)
 {
   grub_size_t i;
   gcry_err_code_t err;
@@ -246,14 +359,9 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 
       if (dev->rekey)
 	{
-	  grub_uint64_t zone = sector >> dev->rekey_shift;
-	  if (zone != dev->last_rekey)
-	    {
-	      err = dev->rekey (dev, zone);
-	      if (err)
-		return err;
-	      dev->last_rekey = zone;
-	    }
+	  err = cryptodisk_rekey (dev, sector >> dev->rekey_shift);
+	  if (err)
+	    return err;
 	}
 
       grub_memset (iv, 0, sizeof (iv));
@@ -330,30 +438,39 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	  break;
 	case GRUB_CRYPTODISK_MODE_XTS:
 	  {
-	    unsigned j;
+	    grub_uint64_t tweaks[2 * XTS_BATCH];
+	    grub_uint64_t t[2];
+	    grub_size_t j, run;
+
+	    /* XTS is only defined for 128-bit blocks.  */
+	    if (dev->cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES)
+	      return GPG_ERR_INV_ARG;
+
 	    err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
 					   dev->cipher->cipher->blocksize);
 	    if (err)
 	      return err;
-	    
-	    for (j = 0; j < (1U << dev->log_sector_size);
-		 j += dev->cipher->cipher->blocksize)
+	    grub_memcpy (t, iv, sizeof (t));
+
+	    /* Compute the tweaks for a run of blocks, so that the whole run
+	       goes through the cipher in one call.  */
+	    for (j = 0; j < (1U << dev->log_sector_size); j += run)
 	      {
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
+		run = (1U << dev->log_sector_size) - j;
+		if (run > sizeof (tweaks))
+		  run = sizeof (tweaks);
+		xts_tweaks (tweaks, t, run / GRUB_CRYPTODISK_GF_BYTES);
+
+		grub_crypto_xor (data + i + j, data + i + j, tweaks, run);
 		if (do_encrypt)
-		  err = grub_crypto_ecb_encrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
+		  err = grub_crypto_ecb_encrypt (dev->cipher, data + i + j,
+						 data + i + j, run);
 		else
-		  err = grub_crypto_ecb_decrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
+		  err = grub_crypto_ecb_decrypt (dev->cipher, data + i + j,
+						 data + i + j, run);
 		if (err)
 		  return err;
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
-		gf_mul_x ((grub_uint8_t *) iv);
+		grub_crypto_xor (data + i + j, data + i + j, tweaks, run);
 	      }
 	  }
 	  break;
@@ -395,6 +512,93 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
   return GPG_ERR_NO_ERROR;
 }
 
+struct endecrypt_ctx
+{
+  struct grub_cryptodisk *dev;
+  grub_uint8_t *data;
+  grub_size_t len;
+  grub_size_t chunk;
+  grub_disk_addr_t sector;
+  int do_encrypt;
+  gcry_err_code_t err;
+};
+
+static void
+endecrypt_task (void *data, unsigned int index)
+{
+  struct endecrypt_ctx *ctx = data;
+  grub_size_t off = (grub_size_t) index * ctx->chunk;
+  grub_size_t len = ctx->len - off;
+  gcry_err_code_t err;
+
+  if (len > ctx->chunk)
+    len = ctx->chunk;
+  err = grub_cryptodisk_endecrypt_serial (ctx->dev, ctx->data + off, len,
+					  ctx->sector
+					  + (off >> ctx->dev->log_sector_size),
+					  ctx->do_encrypt);
+  if (err)
+    ctx->err = err;
+}
+
+static gcry_err_code_t
+grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
+			   grub_uint8_t * data, grub_size_t len,
+			   grub_disk_addr_t sector, int do_encrypt)
+{
+  struct endecrypt_ctx ctx;
+  unsigned int nproc;
+
+  /* Sectors are independent, except that rekeying changes the cipher and
+     the hashed IV allocates memory.  */
+  if (len < MP_MIN_BYTES
+      || dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH
+      || (nproc = grub_mp_nproc ()) < 2)
+    return grub_cryptodisk_endecrypt_serial (dev, data, len, sector,
+					     do_encrypt);
+
+  /* A run within one zone is split once its key is set.  */
+  if (dev->rekey)
+    {
+      grub_uint64_t zone = sector >> dev->rekey_shift;
+      gcry_err_code_t err;
+
+      if (((sector + (len >> dev->log_sector_size) - 1) >> dev->rekey_shift)
+	  != zone)
+	return grub_cryptodisk_endecrypt_serial (dev, data, len, sector,
+						 do_encrypt);
+      err = cryptodisk_rekey (dev, zone);
+      if (err)
+	return err;
+    }
+
+  /* The generic AES derives its decryption key schedule in the cipher
+     context on the first block decrypted after setkey.  Have that done
+     here rather than by several processors at once.  */
+  if (!do_encrypt)
+    {
+      grub_uint8_t block[GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE];
+      gcry_err_code_t err;
+
+      grub_memset (block, 0, sizeof (block));
+      err = grub_crypto_ecb_decrypt (dev->cipher, block, block,
+				     dev->cipher->cipher->blocksize);
+      if (err)
+	return err;
+    }
+
+  ctx.dev = dev;
+  ctx.data = data;
+  ctx.len = len;
+  ctx.sector = sector;
+  ctx.do_encrypt = do_encrypt;
+  ctx.err = GPG_ERR_NO_ERROR;
+  ctx.chunk = ALIGN_UP (len / nproc, (1U << dev->log_sector_size));
+  grub_mp_run (endecrypt_task, &ctx,
+	       (len + ctx.chunk - 1) / ctx.chunk);
+  return ctx.err;
+}
+
 gcry_err_code_t
 grub_cryptodisk_decrypt (struct grub_cryptodisk *dev,
 			 grub_uint8_t * data, grub_size_t len,
@@ -534,6 +738,9 @@ grub_cryptodisk_open (const char *name, grub_disk_t disk)
       dev->source_disk = grub_disk_open (dev->source);
       if (!dev->source_disk)
 	return grub_errno;
+      /* The plaintext is cached, keeping the ciphertext as well would
+	 only halve what fits.  */
+      dev->source_disk->nocache = 1;
     }
 
   disk->data = dev;
@@ -812,6 +1019,15 @@ static char *search_uuid;
 static void
 cryptodisk_close (grub_cryptodisk_t dev)
 {
+  unsigned i;
+
+  if (dev->zone_keys)
+    for (i = 0; i < GRUB_CRYPTODISK_ZONE_KEYS; i++)
+      {
+	grub_crypto_cipher_close (dev->zone_keys[i].cipher);
+	grub_crypto_cipher_close (dev->zone_keys[i].secondary_cipher);
+      }
+  grub_free (dev->zone_keys);
   grub_crypto_cipher_close (dev->cipher);
   grub_crypto_cipher_close (dev->secondary_cipher);
   grub_crypto_cipher_close (dev->essiv_cipher);
@@ -922,7 +1138,12 @@ grub_cryptodisk_scan_device (const char *name,
   
   if (err)
     grub_print_error ();
-  return have_it && search_uuid ? 1 : 0;
+  if (have_it && search_uuid)
+    {
+      grub_boot_hint_set ("crypto_uuid", search_uuid, name);
+      return 1;
+    }
+  return 0;
 }
 
 static grub_err_t
@@ -937,6 +1158,7 @@ grub_cmd_cryptomount (grub_extcmd_context_t ctxt, int argc, char **args)
   if (state[0].set)
     {
       grub_cryptodisk_t dev;
+      const char *hint;
 
       dev = grub_cryptodisk_get_by_uuid (args[0]);
       if (dev)
@@ -948,7 +1170,18 @@ grub_cmd_cryptomount (grub_extcmd_context_t ctxt, int argc, char **args)
 
       check_boot = state[2].set;
       search_uuid = args[0];
-      grub_device_iterate (&grub_cryptodisk_scan_device, NULL);
+      hint = grub_boot_hint_get ("crypto_uuid", args[0]);
+      if (hint)
+	{
+	  char *name = grub_strdup (hint);
+
+	  if (name)
+	    grub_cryptodisk_scan_device (name, NULL);
+	  grub_free (name);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      if (!have_it)
+	grub_device_iterate (&grub_cryptodisk_scan_device, NULL);
       search_uuid = NULL;
 
       if (!have_it)
@@ -19,6 +19,7 @@
 
 #include <grub/dl.h>
 #include <grub/disk.h>
+#include <grub/device.h>
 #include <grub/mm.h>
 #include <grub/err.h>
 #include <grub/misc.h>
@@ -123,6 +124,26 @@ is_valid_diskfilter_name (const char *name)
 	  || grub_memcmp (name, "ldm/", sizeof ("ldm/") - 1) == 0);
 }
 
+/* The array looked for by the scan in progress, if it only tries the
+   DISKFILTER drivers which can provide it.  */
+static const char *scan_target;
+
+/* Whether DISKFILTER names its arrays like NAME.  */
+static int
+can_provide (grub_diskfilter_t diskfilter, const char *name)
+{
+  int lvm = (grub_memcmp (name, "lvm/", sizeof ("lvm/") - 1) == 0
+	     || grub_memcmp (name, "lvmid/", sizeof ("lvmid/") - 1) == 0);
+  int ldm = (grub_memcmp (name, "ldm/", sizeof ("ldm/") - 1) == 0);
+
+  if (grub_strcmp (diskfilter->name, "lvm") == 0)
+    return lvm;
+  if (grub_strcmp (diskfilter->name, "ldm") == 0)
+    return ldm;
+  /* All the RAID drivers make md devices.  */
+  return !lvm && !ldm;
+}
+
 /* Helper for scan_disk.  */
 static int
 scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
@@ -154,6 +175,8 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 
   for (diskfilter = grub_diskfilter_list; diskfilter; diskfilter = diskfilter->next)
     {
+      if (scan_target && !can_provide (diskfilter, scan_target))
+	continue;
 #ifdef GRUB_UTIL
       grub_util_info ("Scanning for %s devices on disk %s", 
 		      diskfilter->name, name);
@@ -209,14 +232,18 @@ scan_disk (const char *name, int accept_diskfilter)
   return 0;
 }
 
+/* Stop once the array named DATA, if any, can be read.  */
 static int
-scan_disk_hook (const char *name, void *data __attribute__ ((unused)))
+scan_disk_hook (const char *name, void *data)
 {
-  return scan_disk (name, 0);
+  const char *arname = data;
+
+  scan_disk (name, 0);
+  return arname && is_lv_readable (find_lv (arname), 1);
 }
 
 static void
-scan_devices (const char *arname)
+scan_devices_real (const char *arname)
 {
   grub_disk_dev_t p;
   grub_disk_pull_t pull;
@@ -230,9 +257,7 @@ scan_devices (const char *arname)
       if (p->id != GRUB_DISK_DEVICE_DISKFILTER_ID
 	  && p->iterate)
 	{
-	  if ((p->iterate) (scan_disk_hook, NULL, pull))
-	    return;
-	  if (arname && is_lv_readable (find_lv (arname), 1))
+	  if ((p->iterate) (scan_disk_hook, (void *) arname, pull))
 	    return;
 	}
 
@@ -258,6 +283,32 @@ scan_devices (const char *arname)
      grub_error (GRUB_ERR_UNKNOWN_DEVICE, "DISKFILTER scan depth exceeded");
 }
 
+/* Scan the disks for DISKFILTER arrays, until ARNAME, if given, can be
+   read.  For ARNAME the disks are first only probed by the drivers which
+   name their arrays alike, and then by all of them in case ARNAME is built
+   on top of another kind of array, like LVM on mdraid.  Disks found to be
+   members of arrays are not probed again.  */
+static void
+scan_devices (const char *arname)
+{
+  const char *saved_target = scan_target;
+
+  grub_device_prefetch_all ();
+
+  if (arname)
+    {
+      scan_target = arname;
+      scan_devices_real (arname);
+      scan_target = saved_target;
+      if (is_lv_readable (find_lv (arname), 1) || grub_errno)
+	return;
+    }
+
+  scan_target = NULL;
+  scan_devices_real (arname);
+  scan_target = saved_target;
+}
+
 static int
 grub_diskfilter_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
 			 grub_disk_pull_t pull)
@@ -576,8 +627,8 @@ validate_segment (struct grub_diskfilter_segment *seg)
 }
 
 static grub_err_t
-read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
-	      grub_size_t size, char *buf)
+read_segment_chunks (struct grub_diskfilter_segment *seg,
+		     grub_disk_addr_t sector, grub_size_t size, char *buf)
 {
   grub_err_t err;
   switch (seg->type)
@@ -851,6 +902,189 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
     }
 }
 
+/* Whole rows are read at most this many bytes per member at a time.  */
+#define GRUB_DISKFILTER_ROWS_MAX_SIZE	(1 << 20)
+
+/* Return which data chunk of row ROW of the RAID0/4/5/6 segment SEG the
+   member DISKNR holds, or -1 if it holds parity there.  This is the
+   mapping read_segment_chunks walks.  */
+static int
+member_chunk (const struct grub_diskfilter_segment *seg, grub_uint64_t row,
+	      unsigned int disknr)
+{
+  unsigned int n = seg->type / 3, k;
+  grub_uint64_t p;
+
+  if (seg->type < 5)
+    return disknr < seg->node_count - n ? (int) disknr : -1;
+
+  grub_divmod64 (row, seg->node_count, &p);
+  if (! (seg->layout & GRUB_RAID_LAYOUT_RIGHT_MASK))
+    p = seg->node_count - 1 - p;
+
+  for (k = 0; k < seg->node_count - n; k++)
+    {
+      grub_uint64_t d = k;
+
+      if (seg->layout & GRUB_RAID_LAYOUT_SYMMETRIC_MASK)
+	d += p + n;
+      else
+	{
+	  grub_uint64_t q;
+
+	  q = p + (n - 1);
+	  if (q >= seg->node_count)
+	    q -= seg->node_count;
+
+	  if (d >= p)
+	    d += n;
+	  else if (d >= q)
+	    d += q + 1;
+	}
+      if (d >= seg->node_count)
+	d -= seg->node_count;
+      if (d == disknr)
+	return k;
+    }
+  return -1;
+}
+
+/* Read the NROWS whole rows from ROW of the RAID0/4/5/6 segment SEG with
+   one read per run of data chunks on each member rather than one per
+   chunk.  All the members are hinted first so that drivers able to read
+   in the background serve them side by side.  */
+static grub_err_t
+read_rows (struct grub_diskfilter_segment *seg, grub_uint64_t row,
+	   grub_uint64_t nrows, char *buf)
+{
+  grub_size_t chunk_size = (grub_size_t) seg->stripe_size
+    << GRUB_DISK_SECTOR_BITS;
+  grub_size_t row_size = chunk_size * (seg->node_count - seg->type / 3);
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned int disknr;
+  int pass;
+  char *tmp;
+
+  grub_dprintf ("diskfilter", "reading %llu rows from row %llu\n",
+		(unsigned long long) nrows, (unsigned long long) row);
+
+  tmp = grub_malloc (nrows * chunk_size);
+  if (!tmp)
+    return grub_errno;
+
+  for (pass = 0; pass < 2; pass++)
+    for (disknr = 0; disknr < seg->node_count; disknr++)
+      {
+	const struct grub_diskfilter_node *node = &seg->nodes[disknr];
+	grub_uint64_t r, r2, i;
+
+	for (r = 0; r < nrows; r = r2)
+	  {
+	    if (member_chunk (seg, row + r, disknr) < 0)
+	      {
+		r2 = r + 1;
+		continue;
+	      }
+	    for (r2 = r + 1; r2 < nrows
+		   && member_chunk (seg, row + r2, disknr) >= 0; r2++);
+
+	    if (pass == 0)
+	      {
+		if (node->pv && node->pv->disk)
+		  grub_disk_prefetch (node->pv->disk,
+				      (row + r) * seg->stripe_size
+				      + node->start + node->pv->start_sector,
+				      0, (r2 - r) * chunk_size);
+		continue;
+	      }
+
+	    err = grub_diskfilter_read_node (node,
+					     (row + r) * seg->stripe_size,
+					     (r2 - r) * seg->stripe_size, tmp);
+	    if (err)
+	      goto out;
+
+	    for (i = r; i < r2; i++)
+	      grub_memcpy (buf + i * row_size
+			   + member_chunk (seg, row + i, disknr) * chunk_size,
+			   tmp + (i - r) * chunk_size, chunk_size);
+	  }
+      }
+
+ out:
+  grub_free (tmp);
+  return err;
+}
+
+static grub_err_t
+read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      grub_size_t size, char *buf)
+{
+  if (seg->stripe_size
+      && ((seg->type == GRUB_DISKFILTER_STRIPED && seg->node_count > 1)
+	  || seg->type == GRUB_DISKFILTER_RAID4
+	  || seg->type == GRUB_DISKFILTER_RAID5
+	  || seg->type == GRUB_DISKFILTER_RAID6))
+    {
+      grub_uint64_t row_sectors, first, last, batch;
+      grub_err_t err;
+
+      row_sectors = (grub_uint64_t) seg->stripe_size
+	* (seg->node_count - seg->type / 3);
+      first = grub_divmod64 (sector + row_sectors - 1, row_sectors, 0);
+      last = grub_divmod64 (sector + size, row_sectors, 0);
+
+      if (first < last)
+	{
+	  grub_size_t head = first * row_sectors - sector;
+
+	  if (head)
+	    {
+	      err = read_segment_chunks (seg, sector, head, buf);
+	      if (err)
+		return err;
+	      buf += head << GRUB_DISK_SECTOR_BITS;
+	      sector += head;
+	      size -= head;
+	    }
+
+	  batch = GRUB_DISKFILTER_ROWS_MAX_SIZE
+	    / ((grub_size_t) seg->stripe_size << GRUB_DISK_SECTOR_BITS);
+	  if (!batch)
+	    batch = 1;
+
+	  while (first < last)
+	    {
+	      grub_uint64_t nrows = last - first;
+
+	      if (nrows > batch)
+		nrows = batch;
+
+	      err = read_rows (seg, first, nrows, buf);
+	      /* Let the chunk by chunk path recover from missing members.  */
+	      if (err == GRUB_ERR_READ_ERROR || err == GRUB_ERR_UNKNOWN_DEVICE)
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  err = read_segment_chunks (seg, sector, nrows * row_sectors,
+					     buf);
+		}
+	      if (err)
+		return err;
+
+	      buf += (nrows * row_sectors) << GRUB_DISK_SECTOR_BITS;
+	      sector += nrows * row_sectors;
+	      size -= nrows * row_sectors;
+	      first += nrows;
+	    }
+
+	  if (!size)
+	    return GRUB_ERR_NONE;
+	}
+    }
+
+  return read_segment_chunks (seg, sector, size, buf);
+}
+
 static grub_err_t
 read_lv (struct grub_diskfilter_lv *lv, grub_disk_addr_t sector,
 	 grub_size_t size, char *buf)
@@ -1214,6 +1448,9 @@ insert_array (grub_disk_t disk, const struct grub_diskfilter_pv_id *id,
 	pv->disk = grub_disk_open (disk->name);
 	if (!pv->disk)
 	  return grub_errno;
+	/* Reads of the array are cached as such, the members are only
+	   read through.  Other openers of a member still cache it.  */
+	pv->disk->nocache = 1;
 	/* This could happen to LVM on RAID, pv->disk points to the
 	   raid device, we shouldn't change it.  */
 	pv->start_sector -= pv->part_start;
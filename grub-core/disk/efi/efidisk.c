@@ -23,6 +23,7 @@
 #include <grub/misc.h>
 #include <grub/err.h>
 #include <grub/term.h>
+#include <grub/time.h>
 #include <grub/efi/api.h>
 #include <grub/efi/efi.h>
 #include <grub/efi/disk.h>
@@ -33,11 +34,52 @@ struct grub_efidisk_data
   grub_efi_device_path_t *device_path;
   grub_efi_device_path_t *last_device_path;
   grub_efi_block_io_t *block_io;
+  /* NULL if the firmware can't read asynchronously from this device.  */
+  grub_efi_block_io2_t *block_io2;
+  /* Largest transfer of one firmware call, in bytes.  */
+  grub_size_t max_transfer;
   struct grub_efidisk_data *next;
 };
 
+/* A read started by grub_efidisk_prefetch, which grub_efidisk_read waits
+   for and takes the data from.  */
+struct grub_efidisk_prefetch
+{
+  struct grub_efidisk_prefetch *next;
+  struct grub_efidisk_data *d;
+  grub_efi_uint32_t media_id;
+  grub_efi_lba_t lba;
+  grub_size_t count;
+  char *buf;
+  grub_efi_block_io2_token_t token;
+  int done;
+  /* Set if the firmware never finished the read, so that BUF and the
+     event can't be given back.  */
+  int abandoned;
+  /* Set if BUF is the caller's memory rather than our own.  */
+  int borrowed;
+  grub_uint64_t time;
+};
+
+/* Limits on the reads in flight or done but not yet taken, how long, in
+   milliseconds, data nobody asked for is kept, and how long a read may
+   take.  */
+#define EFIDISK_PREFETCH_MAX		64
+#define EFIDISK_PREFETCH_MAX_SIZE	(128 << 10)
+#define EFIDISK_PREFETCH_TIMEOUT	4000
+#define EFIDISK_PREFETCH_WAIT		10000
+
+/* Transfers are tried this big first.  Some firmware fails reads of more
+   than 640 KiB, so after the first failure a device stays below that.  */
+#define EFIDISK_MAX_TRANSFER		(4 << 20)
+#define EFIDISK_SAFE_TRANSFER		0xa0000
+
+static struct grub_efidisk_prefetch *prefetches;
+static unsigned n_prefetches;
+
 /* GUID.  */
 static grub_efi_guid_t block_io_guid = GRUB_EFI_BLOCK_IO_GUID;
+static grub_efi_guid_t block_io2_guid = GRUB_EFI_BLOCK_IO2_GUID;
 
 static struct grub_efidisk_data *fd_devices;
 static struct grub_efidisk_data *hd_devices;
@@ -98,6 +140,9 @@ make_devices (void)
       d->device_path = dp;
       d->last_device_path = ldp;
       d->block_io = bio;
+      d->block_io2 = grub_efi_open_protocol (*handle, &block_io2_guid,
+					     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+      d->max_transfer = EFIDISK_MAX_TRANSFER;
       d->next = devices;
       devices = d;
     }
@@ -355,6 +400,103 @@ name_devices (struct grub_efidisk_data *devices)
     }
 }
 
+/* Wait until the firmware is done with PF.  */
+static void
+prefetch_wait (struct grub_efidisk_prefetch *pf)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_uint64_t limit = grub_get_time_ms () + EFIDISK_PREFETCH_WAIT;
+
+  while (! pf->done)
+    {
+      if (efi_call_1 (b->check_event, pf->token.event) == GRUB_EFI_SUCCESS)
+	pf->done = 1;
+      else if (grub_get_time_ms () > limit)
+	{
+	  pf->done = 1;
+	  pf->abandoned = 1;
+	  pf->token.transaction_status = GRUB_EFI_TIMEOUT;
+	  /* The memory goes back to the caller, so the firmware must not
+	     write to it anymore.  Resetting aborts the pending reads.  */
+	  if (pf->borrowed)
+	    efi_call_2 (pf->d->block_io2->reset, pf->d->block_io2, 0);
+	}
+    }
+}
+
+static void
+prefetch_free (struct grub_efidisk_prefetch **pfp)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efidisk_prefetch *pf = *pfp;
+
+  prefetch_wait (pf);
+  *pfp = pf->next;
+  n_prefetches--;
+  if (pf->abandoned && ! pf->borrowed)
+    return;
+  efi_call_1 (b->close_event, pf->token.event);
+  if (! pf->borrowed)
+    grub_free (pf->buf);
+  grub_free (pf);
+}
+
+/* Drop the reads of D overlapping COUNT blocks from LBA, or all of them if
+   COUNT is 0.  */
+static void
+prefetch_drop (struct grub_efidisk_data *d, grub_efi_lba_t lba,
+	       grub_size_t count)
+{
+  struct grub_efidisk_prefetch **pfp;
+
+  for (pfp = &prefetches; *pfp; )
+    {
+      struct grub_efidisk_prefetch *pf = *pfp;
+
+      if (pf->d == d
+	  && (count == 0
+	      || (pf->lba < lba + count && lba < pf->lba + pf->count)))
+	prefetch_free (pfp);
+      else
+	pfp = &pf->next;
+    }
+}
+
+/* Return whether a read of D overlaps COUNT blocks from LBA.  */
+static int
+prefetch_overlaps (struct grub_efidisk_data *d, grub_efi_lba_t lba,
+		   grub_size_t count)
+{
+  struct grub_efidisk_prefetch *pf;
+
+  for (pf = prefetches; pf; pf = pf->next)
+    if (pf->d == d && pf->lba < lba + count && lba < pf->lba + pf->count)
+      return 1;
+  return 0;
+}
+
+/* Drop the finished reads nobody took in time.  */
+static void
+prefetch_expire (void)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efidisk_prefetch **pfp;
+  grub_uint64_t now = grub_get_time_ms ();
+
+  for (pfp = &prefetches; *pfp; )
+    {
+      struct grub_efidisk_prefetch *pf = *pfp;
+
+      if (! pf->done
+	  && efi_call_1 (b->check_event, pf->token.event) == GRUB_EFI_SUCCESS)
+	pf->done = 1;
+      if (pf->done && now - pf->time > EFIDISK_PREFETCH_TIMEOUT)
+	prefetch_free (pfp);
+      else
+	pfp = &pf->next;
+    }
+}
+
 static void
 free_devices (struct grub_efidisk_data *devices)
 {
@@ -363,6 +505,7 @@ free_devices (struct grub_efidisk_data *devices)
   for (p = devices; p; p = q)
     {
       q = p->next;
+      prefetch_drop (p, 0, 0);
       grub_free (p);
     }
 }
@@ -503,8 +646,9 @@ grub_efidisk_open (const char *name, struct grub_disk *disk)
     return grub_error (GRUB_ERR_IO, "invalid buffer alignment %d", m->io_align);
 
   disk->total_sectors = m->last_block + 1;
-  /* Don't increase this value due to bug in some EFI.  */
-  disk->max_agglomerate = 0xa0000 >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+  /* grub_efidisk_readwrite splits what the firmware can't take at once.  */
+  disk->max_agglomerate = EFIDISK_MAX_TRANSFER >> (GRUB_DISK_CACHE_BITS
+						   + GRUB_DISK_SECTOR_BITS);
   if (m->block_size & (m->block_size - 1) || !m->block_size)
     return grub_error (GRUB_ERR_IO, "invalid sector size %d",
 		       m->block_size);
@@ -531,63 +675,279 @@ grub_efidisk_readwrite (struct grub_disk *disk, grub_disk_addr_t sector,
 {
   struct grub_efidisk_data *d;
   grub_efi_block_io_t *bio;
-  grub_efi_status_t status;
+  grub_efi_status_t status = GRUB_EFI_SUCCESS;
   grub_size_t io_align, num_bytes;
-  char *aligned_buf;
+  char *aligned_buf = NULL;
+  int bounce;
 
   d = disk->data;
   bio = d->block_io;
 
   /* Set alignment to 1 if 0 specified */
   io_align = bio->media->io_align ? bio->media->io_align : 1;
-  num_bytes = size << disk->log_sector_size;
+  bounce = ((grub_addr_t) buf & (io_align - 1)) != 0;
 
-  if ((grub_addr_t) buf & (io_align - 1))
+  while (size)
     {
-      aligned_buf = grub_memalign (io_align, num_bytes);
-      if (! aligned_buf)
-	return GRUB_EFI_OUT_OF_RESOURCES;
-      if (wr)
+      grub_size_t n = d->max_transfer >> disk->log_sector_size;
+
+      if (n == 0)
+	n = 1;
+      if (n > size)
+	n = size;
+      num_bytes = n << disk->log_sector_size;
+
+      if (bounce && ! aligned_buf)
+	{
+	  aligned_buf = grub_memalign (io_align, num_bytes);
+	  if (! aligned_buf)
+	    return GRUB_EFI_OUT_OF_RESOURCES;
+	}
+      if (bounce && wr)
 	grub_memcpy (aligned_buf, buf, num_bytes);
+
+      status = efi_call_5 ((wr ? bio->write_blocks : bio->read_blocks), bio,
+			   bio->media->media_id, (grub_efi_uint64_t) sector,
+			   (grub_efi_uintn_t) num_bytes,
+			   bounce ? aligned_buf : buf);
+
+      if (status != GRUB_EFI_SUCCESS && status != GRUB_EFI_NO_MEDIA
+	  && num_bytes > EFIDISK_SAFE_TRANSFER)
+	{
+	  /* Retry with the size that always worked.  */
+	  grub_dprintf ("efidisk", "%s: transfer of 0x%lx bytes failed,"
+			" limiting to 0x%x\n", disk->name,
+			(unsigned long) num_bytes, EFIDISK_SAFE_TRANSFER);
+	  d->max_transfer = EFIDISK_SAFE_TRANSFER;
+	  continue;
+	}
+      if (status != GRUB_EFI_SUCCESS)
+	break;
+
+      if (bounce && ! wr)
+	grub_memcpy (buf, aligned_buf, num_bytes);
+
+      sector += n;
+      size -= n;
+      buf += num_bytes;
     }
-  else
+
+  grub_free (aligned_buf);
+  return status;
+}
+
+/* Start one read of SIZE sectors from SECTOR with Block I/O 2, into DEST
+   if it isn't NULL.  DEST must be aligned for the device and must stay
+   valid until the read is taken or dropped.  */
+static grub_err_t
+prefetch_start (struct grub_disk *disk, grub_disk_addr_t sector,
+		grub_size_t size, char *dest)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efidisk_data *d = disk->data;
+  grub_efi_block_io2_t *bio2 = d->block_io2;
+  struct grub_efidisk_prefetch *pf;
+  grub_size_t io_align;
+  grub_efi_status_t st;
+
+  for (pf = prefetches; pf; pf = pf->next)
+    if (pf->d == d && pf->lba <= sector
+	&& sector + size <= pf->lba + pf->count)
+      return GRUB_ERR_NONE;
+
+  pf = grub_zalloc (sizeof (*pf));
+  if (! pf)
+    return grub_errno;
+  io_align = bio2->media->io_align ? bio2->media->io_align : 1;
+  pf->borrowed = (dest != NULL);
+  pf->buf = dest ? : grub_memalign (io_align, size << disk->log_sector_size);
+  if (! pf->buf)
     {
-      aligned_buf = buf;
+      grub_free (pf);
+      return grub_errno;
     }
 
-  status =  efi_call_5 ((wr ? bio->write_blocks : bio->read_blocks), bio,
-			bio->media->media_id, (grub_efi_uint64_t) sector,
-			(grub_efi_uintn_t) num_bytes, aligned_buf);
+  st = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK, NULL, NULL,
+		   &pf->token.event);
+  if (st != GRUB_EFI_SUCCESS)
+    {
+      if (! dest)
+	grub_free (pf->buf);
+      grub_free (pf);
+      return GRUB_ERR_NONE;
+    }
 
-  if ((grub_addr_t) buf & (io_align - 1))
+  pf->d = d;
+  pf->media_id = bio2->media->media_id;
+  pf->lba = sector;
+  pf->count = size;
+  pf->time = grub_get_time_ms ();
+  st = efi_call_6 (bio2->read_blocks_ex, bio2, pf->media_id, sector,
+		   &pf->token, size << disk->log_sector_size, pf->buf);
+  if (st != GRUB_EFI_SUCCESS)
     {
-      if (!wr)
-	grub_memcpy (buf, aligned_buf, num_bytes);
-      grub_free (aligned_buf);
+      efi_call_1 (b->close_event, pf->token.event);
+      if (! dest)
+	grub_free (pf->buf);
+      grub_free (pf);
+      return GRUB_ERR_NONE;
     }
 
-  return status;
+  pf->next = prefetches;
+  prefetches = pf;
+  n_prefetches++;
+  grub_dprintf ("efidisk", "prefetching 0x%lx sectors at 0x%llx of %s\n",
+		(unsigned long) size, (unsigned long long) sector, disk->name);
+  return GRUB_ERR_NONE;
+}
+
+/* Start reading SIZE sectors from SECTOR with Block I/O 2, if the device
+   has it, without waiting for the data, into DEST if it isn't NULL.
+   Large ranges are split so that their pieces can be taken as they are
+   read.  */
+static grub_err_t
+prefetch_queue (struct grub_disk *disk, grub_disk_addr_t sector,
+		grub_size_t size, char *dest)
+{
+  struct grub_efidisk_data *d = disk->data;
+  grub_size_t max = EFIDISK_PREFETCH_MAX_SIZE >> disk->log_sector_size;
+
+  if (! d->block_io2 || max == 0)
+    return GRUB_ERR_NONE;
+
+  prefetch_expire ();
+  while (size && n_prefetches < EFIDISK_PREFETCH_MAX)
+    {
+      grub_size_t n = size < max ? size : max;
+      grub_err_t err;
+
+      err = prefetch_start (disk, sector, n, dest);
+      if (err)
+	return err;
+      sector += n;
+      size -= n;
+      if (dest)
+	dest += n << disk->log_sector_size;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_efidisk_prefetch (struct grub_disk *disk, grub_disk_addr_t sector,
+		       grub_size_t size)
+{
+  return prefetch_queue (disk, sector, size, NULL);
+}
+
+/* Copy to BUF the leading blocks of the SIZE ones from SECTOR that a
+   prefetched read has, and return how many.  A read is given back once
+   its last block is taken.  */
+static grub_size_t
+prefetch_take (struct grub_disk *disk, grub_disk_addr_t sector,
+	       grub_size_t size, char *buf)
+{
+  struct grub_efidisk_data *d = disk->data;
+  struct grub_efidisk_prefetch **pfp;
+
+  for (pfp = &prefetches; *pfp; pfp = &(*pfp)->next)
+    {
+      struct grub_efidisk_prefetch *pf = *pfp;
+      grub_size_t n;
+      int ok;
+
+      if (pf->d != d || sector < pf->lba || sector >= pf->lba + pf->count)
+	continue;
+
+      n = pf->lba + pf->count - sector;
+      if (n > size)
+	n = size;
+      prefetch_wait (pf);
+      ok = (pf->token.transaction_status == GRUB_EFI_SUCCESS
+	    && pf->media_id == d->block_io->media->media_id);
+      if (ok && ! pf->borrowed)
+	grub_memcpy (buf, pf->buf + ((sector - pf->lba)
+				     << disk->log_sector_size),
+		     n << disk->log_sector_size);
+      /* The caller keeps what it reads in the disk cache.  */
+      if (! ok || sector + n == pf->lba + pf->count)
+	prefetch_free (pfp);
+      return ok ? n : 0;
+    }
+  return 0;
+}
+
+/* Return how many of the SIZE blocks from SECTOR come before the first
+   one a prefetched read has.  */
+static grub_size_t
+prefetch_gap (struct grub_disk *disk, grub_disk_addr_t sector,
+	      grub_size_t size)
+{
+  struct grub_efidisk_data *d = disk->data;
+  struct grub_efidisk_prefetch *pf;
+
+  for (pf = prefetches; pf; pf = pf->next)
+    if (pf->d == d && pf->lba > sector && pf->lba - sector < size)
+      size = pf->lba - sector;
+  return size;
 }
 
 static grub_err_t
 grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
 		   grub_size_t size, char *buf)
 {
+  struct grub_efidisk_data *d = disk->data;
   grub_efi_status_t status;
+  grub_disk_addr_t start = sector;
+  grub_size_t total = size;
+  int direct = 0;
 
   grub_dprintf ("efidisk",
 		"reading 0x%lx sectors at the sector 0x%llx from %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
-  status = grub_efidisk_readwrite (disk, sector, size, buf, 0);
+  /* Have the pieces of a large read in flight together when the firmware
+     can queue them, unless read-ahead already asked for some of it.  They
+     go straight into BUF when it is aligned well enough.  */
+  if (d->block_io2
+      && (size << disk->log_sector_size) >= 2 * EFIDISK_PREFETCH_MAX_SIZE
+      && ! prefetch_overlaps (d, sector, size))
+    {
+      grub_size_t io_align = d->block_io2->media->io_align ? : 1;
 
-  if (status == GRUB_EFI_NO_MEDIA)
-    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("no media in `%s'"), disk->name);
-  else if (status != GRUB_EFI_SUCCESS)
-    return grub_error (GRUB_ERR_READ_ERROR,
-		       N_("failure reading sector 0x%llx from `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+      direct = ((grub_addr_t) buf & (io_align - 1)) == 0;
+      prefetch_queue (disk, sector, size, direct ? buf : NULL);
+    }
+
+  while (size)
+    {
+      grub_size_t n = 0;
+
+      if (prefetches)
+	n = prefetch_take (disk, sector, size, buf);
+      if (! n)
+	{
+	  n = prefetches ? prefetch_gap (disk, sector, size) : size;
+	  status = grub_efidisk_readwrite (disk, sector, n, buf, 0);
+
+	  if (status != GRUB_EFI_SUCCESS)
+	    {
+	      /* BUF is no longer ours to fill.  */
+	      if (direct)
+		prefetch_drop (d, start, total);
+	      if (status == GRUB_EFI_NO_MEDIA)
+		return grub_error (GRUB_ERR_OUT_OF_RANGE,
+				   N_("no media in `%s'"), disk->name);
+	      return grub_error (GRUB_ERR_READ_ERROR,
+				 N_("failure reading sector 0x%llx from `%s'"),
+				 (unsigned long long) sector,
+				 disk->name);
+	    }
+	}
+
+      sector += n;
+      size -= n;
+      buf += n << disk->log_sector_size;
+    }
 
   return GRUB_ERR_NONE;
 }
@@ -602,6 +962,9 @@ grub_efidisk_write (struct grub_disk *disk, grub_disk_addr_t sector,
 		"writing 0x%lx sectors at the sector 0x%llx to %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
+  if (prefetches)
+    prefetch_drop (disk->data, sector, size);
+
   status = grub_efidisk_readwrite (disk, sector, size, (char *) buf, 1);
 
   if (status == GRUB_EFI_NO_MEDIA)
@@ -623,6 +986,7 @@ static struct grub_disk_dev grub_efidisk_dev =
     .close = grub_efidisk_close,
     .read = grub_efidisk_read,
     .write = grub_efidisk_write,
+    .prefetch = grub_efidisk_prefetch,
     .next = 0
   };
 
@@ -647,6 +1011,20 @@ grub_efidisk_init (void)
   grub_disk_dev_register (&grub_efidisk_dev);
 }
 
+/* Return the alignment in bytes that buffers read from DISK straight
+   from the firmware need, or 1 if DISK isn't an EFI disk.  */
+grub_size_t
+grub_efidisk_get_io_align (grub_disk_t disk)
+{
+  struct grub_efidisk_data *d;
+
+  if (! disk || disk->dev->id != GRUB_DISK_DEVICE_EFIDISK_ID)
+    return 1;
+
+  d = disk->data;
+  return d->block_io->media->io_align ? : 1;
+}
+
 /* Some utility functions to map GRUB devices with EFI devices.  */
 grub_efi_handle_t
 grub_efidisk_get_device_handle (grub_disk_t disk)
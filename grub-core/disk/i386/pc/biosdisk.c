@@ -329,6 +329,152 @@ grub_biosdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
   return 0;
 }
 
+/* BIOSes with EDD 3.0 can take a flat 64-bit buffer address instead of a
+   segment:offset one, so that transfers go straight to their target rather
+   than through the scratch area a few sectors at a time.  Not all of those
+   claiming EDD 3.0 get it right, so it is used only for drives not matching
+   the table below, and only when reading the first sector gives the same
+   bytes both ways.  A BIOS writing somewhere else entirely can't be caught
+   by that, so those belong in the table.  */
+struct grub_biosdisk_flat_quirk
+{
+  /* As in the drive parameters, NULL matching any.  */
+  const char *host_bus;
+  const char *interface_type;
+};
+
+static const struct grub_biosdisk_flat_quirk flat_quirks[] =
+  {
+    /* USB and FireWire are often emulated through buffers of the BIOS in
+       conventional memory, ignoring the flat address.  */
+    { NULL, "USB" },
+    { NULL, "1394" },
+  };
+
+enum
+  {
+    FLAT_UNKNOWN,
+    FLAT_YES,
+    FLAT_NO
+  };
+
+/* Whether flat addresses work, per BIOS drive, so that the probe is done
+   once rather than at every open.  */
+static grub_uint8_t flat_state[256];
+
+/* Like the reference implementation, never ask for more at once.  */
+#define GRUB_BIOSDISK_FLAT_MAX_SECTORS	0x7f
+
+/* Return whether the space-padded FIELD of SIZE bytes is NAME.  */
+static int
+field_is (const grub_uint8_t *field, grub_size_t size, const char *name)
+{
+  grub_size_t len = grub_strlen (name);
+
+  if (len > size || grub_memcmp (field, name, len) != 0)
+    return 0;
+  for (; len < size; len++)
+    if (field[len] != ' ' && field[len] != '\0')
+      return 0;
+  return 1;
+}
+
+/* Transfer SIZE sectors at SECTOR of DRIVE straight to or from BUF.
+   Return the BIOS status, zero on success.  */
+static int
+grub_biosdisk_rw_flat (int cmd, int drive, grub_disk_addr_t sector,
+		       grub_size_t size, void *buf)
+{
+  struct grub_biosdisk_dap64 *dap;
+
+  dap = (struct grub_biosdisk_dap64 *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
+  dap->length = sizeof (*dap);
+  dap->reserved = 0;
+  dap->blocks = size;
+  dap->buffer = 0xffffffff;
+  dap->block = sector;
+  dap->flat_buffer = (grub_addr_t) buf;
+
+  return grub_biosdisk_rw_int13_extensions (cmd + 0x42, drive, dap);
+}
+
+/* Return whether DRIVE, whose parameters are DRP, takes flat addresses.  */
+static int
+grub_biosdisk_flat_works (int drive, int version,
+			  const struct grub_biosdisk_drp *drp,
+			  int log_sector_size)
+{
+  grub_uint8_t *state = &flat_state[drive & 0xff];
+  grub_size_t size = (grub_size_t) 1 << log_sector_size;
+  struct grub_biosdisk_dap *dap;
+  grub_uint8_t *buf;
+  unsigned i;
+
+  if (*state != FLAT_UNKNOWN)
+    return *state == FLAT_YES;
+  *state = FLAT_NO;
+
+  if (version < 0x30 || drp->signature_dpi != 0xbedd
+      || drp->size < (const grub_uint8_t *) drp->interface_path
+		     - (const grub_uint8_t *) drp)
+    return 0;
+
+  for (i = 0; i < ARRAY_SIZE (flat_quirks); i++)
+    if ((! flat_quirks[i].host_bus
+	 || field_is (drp->name_of_host_bus, sizeof (drp->name_of_host_bus),
+		      flat_quirks[i].host_bus))
+	&& (! flat_quirks[i].interface_type
+	    || field_is (drp->name_of_interface_type,
+			 sizeof (drp->name_of_interface_type),
+			 flat_quirks[i].interface_type)))
+      {
+	grub_dprintf ("disk", "biosdisk 0x%x: no flat addresses on %s/%s\n",
+		      drive, flat_quirks[i].host_bus ? : "*",
+		      flat_quirks[i].interface_type ? : "*");
+	return 0;
+      }
+
+  buf = grub_memalign (16, size);
+  if (! buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      *state = FLAT_UNKNOWN;
+      return 0;
+    }
+  grub_memset (buf, 0x5a, size);
+
+  /* The DRP is in the scratch area too, so it is of no use after this.  */
+  if (grub_biosdisk_rw_flat (0, drive, 0, 1, buf))
+    goto out;
+
+  dap = (struct grub_biosdisk_dap *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR + size);
+  dap->length = sizeof (*dap);
+  dap->reserved = 0;
+  dap->blocks = 1;
+  dap->buffer = GRUB_MEMORY_MACHINE_SCRATCH_SEG << 16;
+  dap->block = 0;
+  if (grub_biosdisk_rw_int13_extensions (0x42, drive, dap))
+    goto out;
+
+  if (grub_memcmp (buf, (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR, size) == 0)
+    *state = FLAT_YES;
+
+ out:
+  grub_free (buf);
+  grub_dprintf ("disk", "biosdisk 0x%x: flat addresses %s\n", drive,
+		*state == FLAT_YES ? "work" : "don't work");
+  return *state == FLAT_YES;
+}
+
+/* A transfer with a flat address failed: stop using them for DATA.  */
+static void
+grub_biosdisk_flat_failed (struct grub_biosdisk_data *data)
+{
+  grub_dprintf ("disk", "biosdisk 0x%x: flat transfer failed\n", data->drive);
+  data->flags &= ~GRUB_BIOSDISK_FLAG_FLAT;
+  flat_state[data->drive & 0xff] = FLAT_NO;
+}
+
 static grub_err_t
 grub_biosdisk_open (const char *name, grub_disk_t disk)
 {
@@ -393,6 +539,10 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
 		       (1 << disk->log_sector_size) < drp->bytes_per_sector;
 		       disk->log_sector_size++);
 		}
+
+	      if (grub_biosdisk_flat_works (drive, version, drp,
+					    disk->log_sector_size))
+		data->flags |= GRUB_BIOSDISK_FLAG_FLAT;
 	    }
 	}
     }
@@ -431,12 +581,18 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
     }
 
   disk->total_sectors = total_sectors;
-  /* Limit the max to 0x7f because of Phoenix EDD.  */
-  disk->max_agglomerate = 0x7f >> GRUB_DISK_CACHE_BITS;
+  /* Limit the max to 0x7f because of Phoenix EDD.  Transfers with flat
+     addresses are split by grub_biosdisk_read and don't go through the
+     scratch area, so they can be as big as for other disks.  */
+  if (! (data->flags & GRUB_BIOSDISK_FLAG_FLAT))
+    disk->max_agglomerate = 0x7f >> GRUB_DISK_CACHE_BITS;
   COMPILE_TIME_ASSERT ((0x7f >> GRUB_DISK_CACHE_BITS
 			<< (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS))
 		       + sizeof (struct grub_biosdisk_dap)
 		       < GRUB_MEMORY_MACHINE_SCRATCH_SIZE);
+  /* Floppies are slow enough that reading ahead a lot on a miss hurts.  */
+  if (! (drive & 0x80))
+    disk->cache_bits = GRUB_DISK_CACHE_MIN_BITS;
 
   disk->data = data;
 
@@ -573,10 +729,50 @@ get_safe_sectors (grub_disk_t disk, grub_disk_addr_t sector)
   return size;
 }
 
+/* Transfer what can be of SIZE sectors at SECTOR straight to or from BUF.
+   Return the number of sectors transferred.  */
+static grub_size_t
+grub_biosdisk_rw_direct (int cmd, grub_disk_t disk, grub_disk_addr_t sector,
+			 grub_size_t size, char *buf)
+{
+  struct grub_biosdisk_data *data = disk->data;
+  grub_size_t done = 0;
+
+  /* Some BIOSes insist on aligned buffers for DMA.  */
+  if (((grub_addr_t) buf & 3) != 0)
+    return 0;
+
+  while (done < size && (data->flags & GRUB_BIOSDISK_FLAG_FLAT))
+    {
+      grub_size_t len = size - done;
+
+      if (len > GRUB_BIOSDISK_FLAT_MAX_SECTORS)
+	len = GRUB_BIOSDISK_FLAT_MAX_SECTORS;
+
+      if (grub_biosdisk_rw_flat (cmd, data->drive, sector + done, len,
+				 buf + (done << disk->log_sector_size)))
+	{
+	  /* The rest goes through the scratch area, which retries.  */
+	  grub_biosdisk_flat_failed (data);
+	  break;
+	}
+      done += len;
+    }
+
+  return done;
+}
+
 static grub_err_t
 grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
+  grub_size_t done;
+
+  done = grub_biosdisk_rw_direct (GRUB_BIOSDISK_READ, disk, sector, size, buf);
+  buf += done << disk->log_sector_size;
+  sector += done;
+  size -= done;
+
   while (size)
     {
       grub_size_t len;
@@ -606,10 +802,17 @@ grub_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		     grub_size_t size, const char *buf)
 {
   struct grub_biosdisk_data *data = disk->data;
+  grub_size_t done;
 
   if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
     return grub_error (GRUB_ERR_IO, N_("cannot write to CD-ROM"));
 
+  done = grub_biosdisk_rw_direct (GRUB_BIOSDISK_WRITE, disk, sector, size,
+				 (char *) buf);
+  buf += done << disk->log_sector_size;
+  sector += done;
+  size -= done;
+
   while (size)
     {
       grub_size_t len;
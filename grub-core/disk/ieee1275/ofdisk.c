@@ -25,9 +25,6 @@
 #include <grub/i18n.h>
 #include <grub/time.h>
 
-static char *last_devpath;
-static grub_ieee1275_ihandle_t last_ihandle;
-
 struct ofdisk_hash_ent
 {
   char *devpath;
@@ -36,6 +33,8 @@ struct ofdisk_hash_ent
   int is_boot;
   int is_removable;
   int block_size_fails;
+  /* Once known.  */
+  grub_uint32_t block_size;
   /* Pointer to shortest available name on nodes representing canonical names,
      otherwise NULL.  */
   const char *shortest;
@@ -44,12 +43,74 @@ struct ofdisk_hash_ent
 };
 
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op);
 
 #define OFDISK_HASH_SZ	8
 static struct ofdisk_hash_ent *ofdisk_hash[OFDISK_HASH_SZ];
 
+/* Opening a device can take tens of milliseconds, so the ihandles of the
+   devices used last stay open, rather than only the one of the last device,
+   which reads alternating between disks would keep reopening.  */
+#define OFDISK_IHANDLES	4
+
+struct ofdisk_ihandle
+{
+  /* The open_path of a hash entry, which are never freed.  */
+  const char *devpath;
+  grub_ieee1275_ihandle_t ihandle;
+  unsigned long last_use;
+};
+
+static struct ofdisk_ihandle ofdisk_ihandles[OFDISK_IHANDLES];
+static unsigned long ofdisk_ihandle_clock;
+
+/* Return an ihandle of DEVPATH, opening it if needed, or 0.  */
+static grub_ieee1275_ihandle_t
+ofdisk_ihandle_get (const char *devpath)
+{
+  struct ofdisk_ihandle *h, *victim = &ofdisk_ihandles[0];
+
+  for (h = ofdisk_ihandles; h < ofdisk_ihandles + OFDISK_IHANDLES; h++)
+    {
+      if (h->ihandle && h->devpath == devpath)
+	{
+	  h->last_use = ++ofdisk_ihandle_clock;
+	  return h->ihandle;
+	}
+      /* Prefer a free slot, then the least recently used.  */
+      if (victim->ihandle && (! h->ihandle || h->last_use < victim->last_use))
+	victim = h;
+    }
+
+  if (victim->ihandle)
+    grub_ieee1275_close (victim->ihandle);
+  victim->ihandle = 0;
+  victim->devpath = NULL;
+
+  grub_ieee1275_open (devpath, &victim->ihandle);
+  if (! victim->ihandle)
+    return 0;
+  victim->devpath = devpath;
+  victim->last_use = ++ofdisk_ihandle_clock;
+  return victim->ihandle;
+}
+
+/* Close the ihandle of DEVPATH, or all of them if DEVPATH is NULL.  */
+static void
+ofdisk_ihandle_close (const char *devpath)
+{
+  struct ofdisk_ihandle *h;
+
+  for (h = ofdisk_ihandles; h < ofdisk_ihandles + OFDISK_IHANDLES; h++)
+    if (h->ihandle && (! devpath || h->devpath == devpath))
+      {
+	grub_ieee1275_close (h->ihandle);
+	h->ihandle = 0;
+	h->devpath = NULL;
+      }
+}
+
 static int
 ofdisk_hash_fn (const char *devpath)
 {
@@ -509,7 +570,7 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
     disk->id = (unsigned long) op;
     disk->data = op->open_path;
 
-    err = grub_ofdisk_get_block_size (devpath, &block_size, op);
+    err = grub_ofdisk_get_block_size (&block_size, op);
     if (err)
       {
         grub_free (devpath);
@@ -532,42 +593,32 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
 static void
 grub_ofdisk_close (grub_disk_t disk)
 {
-  if (disk->data == last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-    }
+  /* The ihandle stays open for the next user of the device.  */
   disk->data = 0;
 }
 
 static grub_err_t
-grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector)
+grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_ieee1275_ihandle_t *ihandle)
 {
   grub_ssize_t status;
   unsigned long long pos;
 
-  if (disk->data != last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-
-      grub_ieee1275_open (disk->data, &last_ihandle);
-      if (! last_ihandle)
-	return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
-      last_devpath = disk->data;      
-    }
+  *ihandle = ofdisk_ihandle_get (disk->data);
+  if (! *ihandle)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
 
   pos = sector << disk->log_sector_size;
 
-  grub_ieee1275_seek (last_ihandle, pos, &status);
+  grub_ieee1275_seek (*ihandle, pos, &status);
   if (status < 0)
-    return grub_error (GRUB_ERR_READ_ERROR,
-		       "seek error, can't seek block %llu",
-		       (long long) sector);
+    {
+      /* Start afresh next time, in case the device went bad.  */
+      ofdisk_ihandle_close (disk->data);
+      return grub_error (GRUB_ERR_READ_ERROR,
+			 "seek error, can't seek block %llu",
+			 (long long) sector);
+    }
   return 0;
 }
 
@@ -577,10 +628,11 @@ grub_ofdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 {
   grub_err_t err;
   grub_ssize_t actual;
-  err = grub_ofdisk_prepare (disk, sector);
+  grub_ieee1275_ihandle_t ihandle;
+  err = grub_ofdisk_prepare (disk, sector, &ihandle);
   if (err)
     return err;
-  grub_ieee1275_read (last_ihandle, buf, size  << disk->log_sector_size,
+  grub_ieee1275_read (ihandle, buf, size  << disk->log_sector_size,
 		      &actual);
   if (actual != (grub_ssize_t) (size  << disk->log_sector_size))
     return grub_error (GRUB_ERR_READ_ERROR, N_("failure reading sector 0x%llx "
@@ -597,10 +649,11 @@ grub_ofdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 {
   grub_err_t err;
   grub_ssize_t actual;
-  err = grub_ofdisk_prepare (disk, sector);
+  grub_ieee1275_ihandle_t ihandle;
+  err = grub_ofdisk_prepare (disk, sector, &ihandle);
   if (err)
     return err;
-  grub_ieee1275_write (last_ihandle, buf, size  << disk->log_sector_size,
+  grub_ieee1275_write (ihandle, buf, size  << disk->log_sector_size,
 		       &actual);
   if (actual != (grub_ssize_t) (size << disk->log_sector_size))
     return grub_error (GRUB_ERR_WRITE_ERROR, N_("failure writing sector 0x%llx "
@@ -666,10 +719,7 @@ insert_bootpath (void)
 void
 grub_ofdisk_fini (void)
 {
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-  last_ihandle = 0;
-  last_devpath = NULL;
+  ofdisk_ihandle_close (NULL);
 
   grub_disk_dev_unregister (&grub_ofdisk_dev);
 }
@@ -685,7 +735,7 @@ grub_ofdisk_init (void)
 }
 
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op)
 {
   struct size_args_ieee1275
@@ -698,24 +748,22 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
       grub_ieee1275_cell_t size2;
     } args_ieee1275;
 
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
+  grub_ieee1275_ihandle_t ihandle;
 
-  last_ihandle = 0;
-  last_devpath = NULL;
+  *block_size = op->block_size;
+  if (op->block_size)
+    return GRUB_ERR_NONE;
 
-  grub_ieee1275_open (device, &last_ihandle);
-  if (! last_ihandle)
+  ihandle = ofdisk_ihandle_get (op->open_path);
+  if (! ihandle)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
 
-  *block_size = 0;
-
   if (op->block_size_fails >= 2)
     return GRUB_ERR_NONE;
 
   INIT_IEEE1275_COMMON (&args_ieee1275.common, "call-method", 2, 2);
   args_ieee1275.method = (grub_ieee1275_cell_t) "block-size";
-  args_ieee1275.ihandle = last_ihandle;
+  args_ieee1275.ihandle = ihandle;
   args_ieee1275.result = 1;
 
   if (IEEE1275_CALL_ENTRY_FN (&args_ieee1275) == -1)
@@ -734,6 +782,7 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
 	   && args_ieee1275.size1 >= 512 && args_ieee1275.size1 <= 16384)
     {
       op->block_size_fails = 0;
+      op->block_size = args_ieee1275.size1;
       *block_size = args_ieee1275.size1;
     }
 
@@ -175,6 +175,10 @@ grub_loopback_open (const char *name, grub_disk_t disk)
 				- GRUB_DISK_CACHE_BITS);
 
   disk->id = dev->id;
+  /* Reads of a plain file on a disk are cached there already.  Files
+     which are decompressed or come from the network are worth caching.  */
+  disk->nocache = (dev->file->device->disk
+		   && ! dev->file->not_easily_seekable);
 
   disk->data = dev;
 
@@ -207,6 +211,17 @@ grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
   return 0;
 }
 
+static grub_err_t
+grub_loopback_prefetch (grub_disk_t disk, grub_disk_addr_t sector,
+			grub_size_t size)
+{
+  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+
+  grub_file_prefetch (file, sector << GRUB_DISK_SECTOR_BITS,
+		      size << GRUB_DISK_SECTOR_BITS);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_loopback_write (grub_disk_t disk __attribute ((unused)),
 		     grub_disk_addr_t sector __attribute ((unused)),
@@ -225,6 +240,7 @@ static struct grub_disk_dev grub_loopback_dev =
     .open = grub_loopback_open,
     .read = grub_loopback_read,
     .write = grub_loopback_write,
+    .prefetch = grub_loopback_prefetch,
     .next = 0
   };
 
@@ -316,7 +316,9 @@ luks_recover_key (grub_disk_t source,
   grub_uint8_t *split_key = NULL;
   char passphrase[MAX_PASSPHRASE] = "";
   grub_uint8_t candidate_digest[sizeof (header.mkDigest)];
-  unsigned i;
+  unsigned order[ARRAY_SIZE (header.keyblock)];
+  unsigned nslots = 0;
+  unsigned i, j;
   grub_size_t length;
   grub_err_t err;
   grub_size_t max_stripes = 1;
@@ -331,10 +333,29 @@ luks_recover_key (grub_disk_t source,
   if (keysize > GRUB_CRYPTODISK_MAX_KEYLEN)
     return grub_error (GRUB_ERR_BAD_FS, "key is too long");
 
+  /* Each attempt costs a full PBKDF2 run and nothing tells which slot holds
+     the passphrase, so try the slots with the fewest iterations first.  */
   for (i = 0; i < ARRAY_SIZE (header.keyblock); i++)
-    if (grub_be_to_cpu32 (header.keyblock[i].active) == LUKS_KEY_ENABLED
-	&& grub_be_to_cpu32 (header.keyblock[i].stripes) > max_stripes)
-      max_stripes = grub_be_to_cpu32 (header.keyblock[i].stripes);
+    {
+      grub_uint32_t iterations;
+
+      if (grub_be_to_cpu32 (header.keyblock[i].active) != LUKS_KEY_ENABLED)
+	continue;
+
+      if (grub_be_to_cpu32 (header.keyblock[i].stripes) > max_stripes)
+	max_stripes = grub_be_to_cpu32 (header.keyblock[i].stripes);
+
+      iterations = grub_be_to_cpu32 (header.keyblock[i].passwordIterations);
+      for (j = nslots; j > 0; j--)
+	{
+	  if (grub_be_to_cpu32 (header.keyblock[order[j - 1]]
+				.passwordIterations) <= iterations)
+	    break;
+	  order[j] = order[j - 1];
+	}
+      order[j] = i;
+      nslots++;
+    }
 
   split_key = grub_malloc (keysize * max_stripes);
   if (!split_key)
@@ -355,16 +376,13 @@ luks_recover_key (grub_disk_t source,
     }
 
   /* Try to recover master key from each active keyslot.  */
-  for (i = 0; i < ARRAY_SIZE (header.keyblock); i++)
+  for (j = 0; j < nslots; j++)
     {
       gcry_err_code_t gcry_err;
       grub_uint8_t candidate_key[GRUB_CRYPTODISK_MAX_KEYLEN];
       grub_uint8_t digest[GRUB_CRYPTODISK_MAX_KEYLEN];
 
-      /* Check if keyslot is enabled.  */
-      if (grub_be_to_cpu32 (header.keyblock[i].active) != LUKS_KEY_ENABLED)
-	continue;
-
+      i = order[j];
       grub_dprintf ("luks", "Trying keyslot %d\n", i);
 
       /* Calculate the PBKDF2 of the user supplied passphrase.  */
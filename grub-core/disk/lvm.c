@@ -34,749 +34,953 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 
-/* Go the string STR and return the number after STR.  *P will point
-   at the number.  In case STR is not found, *P will be NULL and the
-   return value will be 0.  */
-static grub_uint64_t
-grub_lvm_getvalue (char **p, const char *str)
+/* The LVM2 text metadata is a tree of sections ("name { ... }") holding
+   assignments ("key = value") whose values are strings, numbers or
+   arrays of those.  It is tokenized in a single pass into the nodes
+   below, which point into the metadata buffer instead of copying it.  */
+enum grub_lvm_node_type
+  {
+    GRUB_LVM_NODE_SECTION,
+    GRUB_LVM_NODE_ARRAY,
+    GRUB_LVM_NODE_STRING,
+    GRUB_LVM_NODE_NUMBER
+  };
+
+struct grub_lvm_node
 {
-  *p = grub_strstr (*p, str);
-  if (! *p)
-    return 0;
-  *p += grub_strlen (str);
-  return grub_strtoull (*p, p, 10);
+  enum grub_lvm_node_type type;
+  /* Key or section name, NULL for array elements.  */
+  const char *name;
+  grub_size_t name_len;
+  const char *str;
+  grub_size_t str_len;
+  grub_uint64_t num;
+  /* Members of a section or elements of an array.  */
+  struct grub_lvm_node *child;
+  struct grub_lvm_node *next;
+};
+
+#define GRUB_LVM_NODE_CHUNK 256
+#define GRUB_LVM_MAX_DEPTH 16
+
+struct grub_lvm_node_chunk
+{
+  struct grub_lvm_node_chunk *next;
+  unsigned used;
+  struct grub_lvm_node nodes[GRUB_LVM_NODE_CHUNK];
+};
+
+struct grub_lvm_parser
+{
+  char *p;
+  /* Sections nested deeper than this are skipped without building
+     nodes for them.  */
+  int max_depth;
+  struct grub_lvm_node_chunk *chunks;
+};
+
+static struct grub_lvm_node *
+grub_lvm_new_node (struct grub_lvm_parser *ps)
+{
+  struct grub_lvm_node *node;
+
+  if (!ps->chunks || ps->chunks->used == GRUB_LVM_NODE_CHUNK)
+    {
+      struct grub_lvm_node_chunk *chunk;
+
+      chunk = grub_malloc (sizeof (*chunk));
+      if (!chunk)
+	return NULL;
+      chunk->next = ps->chunks;
+      chunk->used = 0;
+      ps->chunks = chunk;
+    }
+  node = &ps->chunks->nodes[ps->chunks->used++];
+  grub_memset (node, 0, sizeof (*node));
+  return node;
 }
 
-#if 0
-static int
-grub_lvm_checkvalue (char **p, char *str, char *tmpl)
+static void
+grub_lvm_parser_fini (struct grub_lvm_parser *ps)
 {
-  int tmpllen = grub_strlen (tmpl);
-  *p = grub_strstr (*p, str);
-  if (! *p)
-    return 0;
-  *p += grub_strlen (str);
-  if (**p != '"')
-    return 0;
-  return (grub_memcmp (*p + 1, tmpl, tmpllen) == 0 && (*p)[tmpllen + 1] == '"');
+  while (ps->chunks)
+    {
+      struct grub_lvm_node_chunk *next = ps->chunks->next;
+      grub_free (ps->chunks);
+      ps->chunks = next;
+    }
 }
-#endif
 
-static int
-grub_lvm_check_flag (char *p, const char *str, const char *flag)
+/* Skip white space and comments.  */
+static void
+grub_lvm_skip_space (struct grub_lvm_parser *ps)
 {
-  grub_size_t len_str = grub_strlen (str), len_flag = grub_strlen (flag);
   while (1)
     {
-      char *q;
-      p = grub_strstr (p, str);
-      if (! p)
-	return 0;
-      p += len_str;
-      if (grub_memcmp (p, " = [", sizeof (" = [") - 1) != 0)
-	continue;
-      q = p + sizeof (" = [") - 1;
-      while (1)
-	{
-	  while (grub_isspace (*q))
-	    q++;
-	  if (*q != '"')
-	    return 0;
-	  q++;
-	  if (grub_memcmp (q, flag, len_flag) == 0 && q[len_flag] == '"')
-	    return 1;
-	  while (*q != '"')
-	    q++;
-	  q++;
-	  if (*q == ']')
-	    return 0;
-	  q++;
-	}
+      while (grub_isspace (*ps->p))
+	ps->p++;
+      if (*ps->p != '#')
+	return;
+      while (*ps->p && *ps->p != '\n')
+	ps->p++;
     }
 }
 
-static struct grub_diskfilter_vg * 
-grub_lvm_detect (grub_disk_t disk,
-		 struct grub_diskfilter_pv_id *id,
-		 grub_disk_addr_t *start_sector)
+static grub_size_t
+grub_lvm_word_len (const char *p)
 {
-  grub_err_t err;
-  grub_uint64_t mda_offset, mda_size;
-  char buf[GRUB_LVM_LABEL_SIZE];
-  char vg_id[GRUB_LVM_ID_STRLEN+1];
-  char pv_id[GRUB_LVM_ID_STRLEN+1];
-  char *metadatabuf, *p, *q, *vgname;
-  struct grub_lvm_label_header *lh = (struct grub_lvm_label_header *) buf;
-  struct grub_lvm_pv_header *pvh;
-  struct grub_lvm_disk_locn *dlocn;
-  struct grub_lvm_mda_header *mdah;
-  struct grub_lvm_raw_locn *rlocn;
-  unsigned int i, j;
-  grub_size_t vgname_len;
-  struct grub_diskfilter_vg *vg;
-  struct grub_diskfilter_pv *pv;
+  const char *q;
 
-  /* Search for label. */
-  for (i = 0; i < GRUB_LVM_LABEL_SCAN_SECTORS; i++)
-    {
-      err = grub_disk_read (disk, i, 0, sizeof(buf), buf);
-      if (err)
-	goto fail;
+  for (q = p; *q && !grub_isspace (*q); q++)
+    if (grub_strchr ("={}[],\"#", *q))
+      break;
+  return q - p;
+}
 
-      if ((! grub_strncmp ((char *)lh->id, GRUB_LVM_LABEL_ID,
-			   sizeof (lh->id)))
-	  && (! grub_strncmp ((char *)lh->type, GRUB_LVM_LVM2_LABEL,
-			      sizeof (lh->type))))
-	break;
+static int
+grub_lvm_parse_scalar (struct grub_lvm_parser *ps, struct grub_lvm_node *node)
+{
+  char *p = ps->p;
+
+  if (*p == '"')
+    {
+      node->type = GRUB_LVM_NODE_STRING;
+      node->str = ++p;
+      while (*p != '"')
+	{
+	  if (*p == '\\' && p[1])
+	    p++;
+	  if (!*p)
+	    return -1;
+	  p++;
+	}
+      node->str_len = p - node->str;
+      ps->p = p + 1;
+      return 0;
     }
 
-  /* Return if we didn't find a label. */
-  if (i == GRUB_LVM_LABEL_SCAN_SECTORS)
+  if (grub_isdigit (*p) || (*p == '-' && grub_isdigit (p[1])))
     {
-#ifdef GRUB_UTIL
-      grub_util_info ("no LVM signature found");
-#endif
-      goto fail;
+      node->type = GRUB_LVM_NODE_NUMBER;
+      node->num = grub_strtoull (p + (*p == '-'), &ps->p, 10);
+      if (*p == '-')
+	node->num = -node->num;
+      /* Fractional parts are of no interest to us.  */
+      ps->p += grub_lvm_word_len (ps->p);
+      return 0;
     }
 
-  pvh = (struct grub_lvm_pv_header *) (buf + grub_le_to_cpu32(lh->offset_xl));
+  return -1;
+}
 
-  for (i = 0, j = 0; i < GRUB_LVM_ID_LEN; i++)
+/* Parse the members of a section up to its closing brace, or up to the
+   end of the text at the top level.  When LIST is NULL the members are
+   checked but not kept.  */
+static int
+grub_lvm_parse_members (struct grub_lvm_parser *ps,
+			struct grub_lvm_node **list, int depth)
+{
+  struct grub_lvm_node dummy;
+
+  if (depth > GRUB_LVM_MAX_DEPTH)
+    return -1;
+
+  while (1)
     {
-      pv_id[j++] = pvh->pv_uuid[i];
-      if ((i != 1) && (i != 29) && (i % 4 == 1))
-	pv_id[j++] = '-';
+      struct grub_lvm_node *node = &dummy;
+      grub_size_t len;
+
+      grub_lvm_skip_space (ps);
+      if (!*ps->p)
+	return depth ? -1 : 0;
+      if (*ps->p == '}')
+	{
+	  if (!depth)
+	    return -1;
+	  ps->p++;
+	  return 0;
+	}
+
+      len = grub_lvm_word_len (ps->p);
+      if (!len)
+	return -1;
+      if (list)
+	{
+	  node = grub_lvm_new_node (ps);
+	  if (!node)
+	    return -1;
+	  *list = node;
+	  list = &node->next;
+	}
+      node->name = ps->p;
+      node->name_len = len;
+      ps->p += len;
+
+      grub_lvm_skip_space (ps);
+      if (*ps->p == '{')
+	{
+	  ps->p++;
+	  node->type = GRUB_LVM_NODE_SECTION;
+	  if (grub_lvm_parse_members (ps, (list && depth < ps->max_depth)
+				      ? &node->child : NULL, depth + 1))
+	    return -1;
+	  continue;
+	}
+      if (*ps->p != '=')
+	return -1;
+      ps->p++;
+      grub_lvm_skip_space (ps);
+
+      if (*ps->p != '[')
+	{
+	  if (grub_lvm_parse_scalar (ps, node))
+	    return -1;
+	  continue;
+	}
+
+      ps->p++;
+      node->type = GRUB_LVM_NODE_ARRAY;
+      {
+	struct grub_lvm_node **elems = list ? &node->child : NULL;
+
+	while (1)
+	  {
+	    struct grub_lvm_node *elem = &dummy;
+
+	    grub_lvm_skip_space (ps);
+	    if (*ps->p == ']')
+	      {
+		ps->p++;
+		break;
+	      }
+	    if (elems)
+	      {
+		elem = grub_lvm_new_node (ps);
+		if (!elem)
+		  return -1;
+		*elems = elem;
+		elems = &elem->next;
+	      }
+	    if (grub_lvm_parse_scalar (ps, elem))
+	      return -1;
+	    grub_lvm_skip_space (ps);
+	    if (*ps->p == ',')
+	      ps->p++;
+	    else if (*ps->p != ']')
+	      return -1;
+	  }
+      }
     }
-  pv_id[j] = '\0';
+}
 
-  dlocn = pvh->disk_areas_xl;
+static struct grub_lvm_node *
+grub_lvm_parse (struct grub_lvm_parser *ps, char *text, int max_depth)
+{
+  struct grub_lvm_node *root = NULL;
 
-  dlocn++;
-  /* Is it possible to have multiple data/metadata areas? I haven't
-     seen devices that have it. */
-  if (dlocn->offset)
+  ps->p = text;
+  ps->max_depth = max_depth;
+  ps->chunks = NULL;
+  if (grub_lvm_parse_members (ps, &root, 0))
     {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  "we don't support multiple LVM data areas");
-
 #ifdef GRUB_UTIL
-      grub_util_info ("we don't support multiple LVM data areas");
+      grub_util_info ("error parsing metadata");
 #endif
-      goto fail;
+      return NULL;
     }
+  return root;
+}
 
-  dlocn++;
-  mda_offset = grub_le_to_cpu64 (dlocn->offset);
-  mda_size = grub_le_to_cpu64 (dlocn->size);
+static int
+grub_lvm_name_is (const struct grub_lvm_node *node, const char *name)
+{
+  grub_size_t len = grub_strlen (name);
 
-  /* It's possible to have multiple copies of metadata areas, we just use the
-     first one.  */
+  return (node->name && node->name_len == len
+	  && grub_memcmp (node->name, name, len) == 0);
+}
 
-  /* Allocate buffer space for the circular worst-case scenario. */
-  metadatabuf = grub_malloc (2 * mda_size);
-  if (! metadatabuf)
-    goto fail;
+static const struct grub_lvm_node *
+grub_lvm_find (const struct grub_lvm_node *section, const char *name,
+	       enum grub_lvm_node_type type)
+{
+  const struct grub_lvm_node *node;
 
-  err = grub_disk_read (disk, 0, mda_offset, mda_size, metadatabuf);
-  if (err)
-    goto fail2;
+  for (node = section->child; node; node = node->next)
+    if (node->type == type && grub_lvm_name_is (node, name))
+      return node;
+  return NULL;
+}
 
-  mdah = (struct grub_lvm_mda_header *) metadatabuf;
-  if ((grub_strncmp ((char *)mdah->magic, GRUB_LVM_FMTT_MAGIC,
-		     sizeof (mdah->magic)))
-      || (grub_le_to_cpu32 (mdah->version) != GRUB_LVM_FMTT_VERSION))
+/* Store the number assigned to NAME in SECTION into *VAL.  Return 0 if
+   there is no such number.  */
+static int
+grub_lvm_getvalue (const struct grub_lvm_node *section, const char *name,
+		   grub_uint64_t *val)
+{
+  const struct grub_lvm_node *node;
+
+  node = grub_lvm_find (section, name, GRUB_LVM_NODE_NUMBER);
+  if (!node)
     {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  "unknown LVM metadata header");
 #ifdef GRUB_UTIL
-      grub_util_info ("unknown LVM metadata header");
+      grub_util_info ("unknown %s", name);
 #endif
-      goto fail2;
+      return 0;
     }
+  *val = node->num;
+  return 1;
+}
 
-  rlocn = mdah->raw_locns;
-  if (grub_le_to_cpu64 (rlocn->offset) + grub_le_to_cpu64 (rlocn->size) >
-      grub_le_to_cpu64 (mdah->size))
-    {
-      /* Metadata is circular. Copy the wrap in place. */
-      grub_memcpy (metadatabuf + mda_size,
-		   metadatabuf + GRUB_LVM_MDA_HEADER_SIZE,
-		   grub_le_to_cpu64 (rlocn->offset) +
-		   grub_le_to_cpu64 (rlocn->size) -
-		   grub_le_to_cpu64 (mdah->size));
-    }
-  p = q = metadatabuf + grub_le_to_cpu64 (rlocn->offset);
+static int
+grub_lvm_check_flag (const struct grub_lvm_node *section, const char *str,
+		     const char *flag)
+{
+  const struct grub_lvm_node *node;
+  grub_size_t len_flag = grub_strlen (flag);
+
+  node = grub_lvm_find (section, str, GRUB_LVM_NODE_ARRAY);
+  if (!node)
+    return 0;
+  for (node = node->child; node; node = node->next)
+    if (node->type == GRUB_LVM_NODE_STRING && node->str_len == len_flag
+	&& grub_memcmp (node->str, flag, len_flag) == 0)
+      return 1;
+  return 0;
+}
 
-  while (*q != ' ' && q < metadatabuf + mda_size)
-    q++;
+/* Copy the ID assigned in SECTION, which must be GRUB_LVM_ID_STRLEN
+   long, into BUF.  */
+static int
+grub_lvm_get_id (const struct grub_lvm_node *section, char *buf)
+{
+  const struct grub_lvm_node *node;
 
-  if (q == metadatabuf + mda_size)
+  node = grub_lvm_find (section, "id", GRUB_LVM_NODE_STRING);
+  if (!node || node->str_len != GRUB_LVM_ID_STRLEN)
     {
 #ifdef GRUB_UTIL
-      grub_util_info ("error parsing metadata");
+      grub_util_info ("couldn't find ID");
 #endif
-      goto fail2;
+      return 0;
     }
+  grub_memcpy (buf, node->str, GRUB_LVM_ID_STRLEN);
+  return 1;
+}
 
-  vgname_len = q - p;
-  vgname = grub_malloc (vgname_len + 1);
-  if (!vgname)
-    goto fail2;
+/* Fill the nodes of SEG with the names in ARRAY, taking one element out
+   of every STEP and, if STRIPES is set, the extent number following
+   it.  Otherwise such a number, as in the name and extent pairs of
+   "mirrors", is skipped.  */
+static int
+grub_lvm_get_nodes (struct grub_diskfilter_segment *seg,
+		    const struct grub_lvm_node *array, unsigned step,
+		    int stripes, grub_uint64_t extent_size)
+{
+  const struct grub_lvm_node *elem;
+  unsigned int j, k;
 
-  grub_memcpy (vgname, p, vgname_len);
-  vgname[vgname_len] = '\0';
+  if (!array || !seg->node_count
+      || seg->node_count > GRUB_UINT_MAX / sizeof (seg->nodes[0]))
+    return 0;
+
+  seg->nodes = grub_zalloc (sizeof (seg->nodes[0]) * seg->node_count);
+  if (!seg->nodes)
+    return 0;
 
-  p = grub_strstr (q, "id = \"");
-  if (p == NULL)
+  elem = array->child;
+  for (j = 0; j < seg->node_count; j++)
     {
-#ifdef GRUB_UTIL
-      grub_util_info ("couldn't find ID");
-#endif
-      goto fail3;
+      for (k = 1; k < step && elem; k++)
+	elem = elem->next;
+      if (!elem || elem->type != GRUB_LVM_NODE_STRING)
+	return 0;
+      seg->nodes[j].name = grub_strndup (elem->str, elem->str_len);
+      if (!seg->nodes[j].name)
+	return 0;
+      elem = elem->next;
+      if (stripes)
+	{
+	  if (!elem || elem->type != GRUB_LVM_NODE_NUMBER)
+	    return 0;
+	  seg->nodes[j].start = elem->num * extent_size;
+	  elem = elem->next;
+	}
+      else if (elem && elem->type == GRUB_LVM_NODE_NUMBER)
+	elem = elem->next;
     }
-  p += sizeof ("id = \"") - 1;
-  grub_memcpy (vg_id, p, GRUB_LVM_ID_STRLEN);
-  vg_id[GRUB_LVM_ID_STRLEN] = '\0';
+  return 1;
+}
 
-  vg = grub_diskfilter_get_vg_by_uuid (GRUB_LVM_ID_STRLEN, vg_id);
+/* Parse one segment of an LV.  Return 1 on success, 0 on error and -1
+   if the segment is of a type we don't handle.  */
+static int
+grub_lvm_parse_segment (const struct grub_lvm_node *segment,
+			struct grub_diskfilter_segment *seg,
+			grub_uint64_t extent_size, int is_pvmove)
+{
+  const struct grub_lvm_node *type;
+  grub_uint64_t val;
 
-  if (! vg)
+  if (!grub_lvm_getvalue (segment, "start_extent", &seg->start_extent)
+      || !grub_lvm_getvalue (segment, "extent_count", &seg->extent_count))
+    return 0;
+
+  type = grub_lvm_find (segment, "type", GRUB_LVM_NODE_STRING);
+  if (!type)
+    return 0;
+
+  if (type->str_len == sizeof ("striped") - 1
+      && grub_memcmp (type->str, "striped", type->str_len) == 0)
     {
-      /* First time we see this volume group. We've to create the
-	 whole volume group structure. */
-      vg = grub_malloc (sizeof (*vg));
-      if (! vg)
-	goto fail3;
-      vg->name = vgname;
-      vg->uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
-      if (! vg->uuid)
-	goto fail3;
-      grub_memcpy (vg->uuid, vg_id, GRUB_LVM_ID_STRLEN);
-      vg->uuid_len = GRUB_LVM_ID_STRLEN;
-
-      vg->extent_size = grub_lvm_getvalue (&p, "extent_size = ");
-      if (p == NULL)
+      seg->type = GRUB_DISKFILTER_STRIPED;
+      if (!grub_lvm_getvalue (segment, "stripe_count", &val))
+	return 0;
+      seg->node_count = val;
+      if (seg->node_count != 1)
 	{
-#ifdef GRUB_UTIL
-	  grub_util_info ("unknown extent size");
-#endif
-	  goto fail4;
+	  if (!grub_lvm_getvalue (segment, "stripe_size", &val))
+	    return 0;
+	  seg->stripe_size = val;
 	}
 
-      vg->lvs = NULL;
-      vg->pvs = NULL;
+      return grub_lvm_get_nodes (seg, grub_lvm_find (segment, "stripes",
+						     GRUB_LVM_NODE_ARRAY),
+				 1, 1, extent_size);
+    }
+
+  if (type->str_len == sizeof ("mirror") - 1
+      && grub_memcmp (type->str, "mirror", type->str_len) == 0)
+    {
+      seg->type = GRUB_DISKFILTER_MIRROR;
+      if (!grub_lvm_getvalue (segment, "mirror_count", &val))
+	return 0;
+      seg->node_count = val;
+
+      if (!grub_lvm_get_nodes (seg, grub_lvm_find (segment, "mirrors",
+						   GRUB_LVM_NODE_ARRAY),
+			       1, 0, extent_size))
+	return 0;
+      /* Only first (original) is ok with in progress pvmove.  */
+      if (is_pvmove)
+	seg->node_count = 1;
+      return 1;
+    }
 
-      p = grub_strstr (p, "physical_volumes {");
-      if (p)
+  if (type->str_len == sizeof ("raidX") - 1
+      && grub_memcmp (type->str, "raid", sizeof ("raid") - 1) == 0
+      && ((type->str[sizeof ("raid") - 1] >= '4'
+	   && type->str[sizeof ("raid") - 1] <= '6')
+	  || type->str[sizeof ("raid") - 1] == '1'))
+    {
+      switch (type->str[sizeof ("raid") - 1])
 	{
-	  p += sizeof ("physical_volumes {") - 1;
+	case '1':
+	  seg->type = GRUB_DISKFILTER_MIRROR;
+	  break;
+	case '4':
+	  seg->type = GRUB_DISKFILTER_RAID4;
+	  seg->layout = GRUB_RAID_LAYOUT_LEFT_ASYMMETRIC;
+	  break;
+	case '5':
+	  seg->type = GRUB_DISKFILTER_RAID5;
+	  seg->layout = GRUB_RAID_LAYOUT_LEFT_SYMMETRIC;
+	  break;
+	case '6':
+	  seg->type = GRUB_DISKFILTER_RAID6;
+	  seg->layout = (GRUB_RAID_LAYOUT_RIGHT_ASYMMETRIC
+			 | GRUB_RAID_LAYOUT_MUL_FROM_POS);
+	  break;
+	}
+      if (!grub_lvm_getvalue (segment, "device_count", &val))
+	return 0;
+      seg->node_count = val;
 
-	  /* Add all the pvs to the volume group. */
-	  while (1)
-	    {
-	      grub_ssize_t s;
-	      while (grub_isspace (*p))
-		p++;
+      if (seg->type != GRUB_DISKFILTER_MIRROR)
+	{
+	  if (!grub_lvm_getvalue (segment, "stripe_size", &val))
+	    return 0;
+	  seg->stripe_size = val;
+	}
 
-	      if (*p == '}')
-		break;
+      /* The array alternates metadata and data subvolumes; we want the
+	 latter.  */
+      if (!grub_lvm_get_nodes (seg, grub_lvm_find (segment, "raids",
+						   GRUB_LVM_NODE_ARRAY),
+			       2, 0, extent_size))
+	return 0;
+      if (seg->type == GRUB_DISKFILTER_RAID4)
+	{
+	  char *tmp;
+	  tmp = seg->nodes[0].name;
+	  grub_memmove (seg->nodes, seg->nodes + 1,
+			sizeof (seg->nodes[0])
+			* (seg->node_count - 1));
+	  seg->nodes[seg->node_count - 1].name = tmp;
+	}
+      return 1;
+    }
 
-	      pv = grub_zalloc (sizeof (*pv));
-	      q = p;
-	      while (*q != ' ')
-		q++;
-
-	      s = q - p;
-	      pv->name = grub_malloc (s + 1);
-	      grub_memcpy (pv->name, p, s);
-	      pv->name[s] = '\0';
-
-	      p = grub_strstr (p, "id = \"");
-	      if (p == NULL)
-		goto pvs_fail;
-	      p += sizeof("id = \"") - 1;
-
-	      pv->id.uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
-	      if (!pv->id.uuid)
-		goto pvs_fail;
-	      grub_memcpy (pv->id.uuid, p, GRUB_LVM_ID_STRLEN);
-	      pv->id.uuidlen = GRUB_LVM_ID_STRLEN;
-
-	      pv->start_sector = grub_lvm_getvalue (&p, "pe_start = ");
-	      if (p == NULL)
-		{
 #ifdef GRUB_UTIL
-		  grub_util_info ("unknown pe_start");
+  grub_util_info ("unknown LVM type %.*s", (int) type->str_len, type->str);
 #endif
-		  goto pvs_fail;
-		}
+  return -1;
+}
 
-	      p = grub_strchr (p, '}');
-	      if (p == NULL)
-		{
+static void
+grub_lvm_free_lv (struct grub_diskfilter_lv *lv)
+{
+  unsigned int i, j;
+
+  if (lv->segments)
+    for (i = 0; i < lv->segment_count; i++)
+      {
+	if (lv->segments[i].nodes)
+	  for (j = 0; j < lv->segments[i].node_count; j++)
+	    grub_free (lv->segments[i].nodes[j].name);
+	grub_free (lv->segments[i].nodes);
+      }
+  grub_free (lv->segments);
+  grub_free (lv->fullname);
+  grub_free (lv->idname);
+  grub_free (lv->name);
+  grub_free (lv);
+}
+
+static void
+grub_lvm_free_vg (struct grub_diskfilter_vg *vg)
+{
+  while (vg->pvs)
+    {
+      struct grub_diskfilter_pv *pv = vg->pvs;
+      vg->pvs = pv->next;
+      grub_free (pv->name);
+      grub_free (pv->id.uuid);
+      grub_free (pv);
+    }
+  while (vg->lvs)
+    {
+      struct grub_diskfilter_lv *lv = vg->lvs;
+      vg->lvs = lv->next;
+      grub_lvm_free_lv (lv);
+    }
+  grub_free (vg->uuid);
+  grub_free (vg->name);
+  grub_free (vg);
+}
+
+/* Copy S of length LEN to OPTR doubling the dashes, as device-mapper
+   does in its names.  */
+static char *
+grub_lvm_escape_name (char *optr, const char *s, grub_size_t len)
+{
+  const char *iptr;
+
+  for (iptr = s; iptr < s + len; iptr++)
+    {
+      *optr++ = *iptr;
+      if (*iptr == '-')
+	*optr++ = '-';
+    }
+  return optr;
+}
+
+static struct grub_diskfilter_lv *
+grub_lvm_parse_lv (const struct grub_lvm_node *lvsec,
+		   struct grub_diskfilter_vg *vg, const char *vg_id)
+{
+  struct grub_diskfilter_lv *lv;
+  const struct grub_lvm_node *segment;
+  grub_uint64_t val;
+  grub_size_t vgname_len = grub_strlen (vg->name);
+  unsigned int i;
+  int is_pvmove;
+  char *optr;
+
+  lv = grub_zalloc (sizeof (*lv));
+  if (!lv)
+    return NULL;
+
+  lv->name = grub_strndup (lvsec->name, lvsec->name_len);
+  lv->fullname = grub_malloc (sizeof ("lvm/") - 1 + 2 * vgname_len
+			      + 1 + 2 * lvsec->name_len + 1);
+  lv->idname = grub_malloc (sizeof ("lvmid/")
+			    + 2 * GRUB_LVM_ID_STRLEN + 1);
+  if (!lv->name || !lv->fullname || !lv->idname)
+    goto fail;
+
+  grub_memcpy (lv->fullname, "lvm/", sizeof ("lvm/") - 1);
+  optr = lv->fullname + sizeof ("lvm/") - 1;
+  optr = grub_lvm_escape_name (optr, vg->name, vgname_len);
+  *optr++ = '-';
+  optr = grub_lvm_escape_name (optr, lvsec->name, lvsec->name_len);
+  *optr++ = 0;
+
+  grub_memcpy (lv->idname, "lvmid/", sizeof ("lvmid/") - 1);
+  grub_memcpy (lv->idname + sizeof ("lvmid/") - 1,
+	       vg_id, GRUB_LVM_ID_STRLEN);
+  lv->idname[sizeof ("lvmid/") - 1 + GRUB_LVM_ID_STRLEN] = '/';
+  if (!grub_lvm_get_id (lvsec, lv->idname + sizeof ("lvmid/") - 1
+			+ GRUB_LVM_ID_STRLEN + 1))
+    goto fail;
+  lv->idname[sizeof ("lvmid/") - 1 + 2 * GRUB_LVM_ID_STRLEN + 1] = '\0';
+
+  lv->size = 0;
+
+  lv->visible = grub_lvm_check_flag (lvsec, "status", "VISIBLE");
+  is_pvmove = grub_lvm_check_flag (lvsec, "status", "PVMOVE");
+
+  if (!grub_lvm_getvalue (lvsec, "segment_count", &val)
+      || !val || val > GRUB_UINT_MAX / sizeof (lv->segments[0]))
+    goto fail;
+  lv->segments = grub_zalloc (val * sizeof (lv->segments[0]));
+  if (!lv->segments)
+    goto fail;
+  lv->segment_count = val;
+
+  segment = lvsec->child;
+  for (i = 0; i < lv->segment_count; i++)
+    {
+      int r;
+
+      while (segment && (segment->type != GRUB_LVM_NODE_SECTION
+			 || segment->name_len < sizeof ("segment") - 1
+			 || grub_memcmp (segment->name, "segment",
+					 sizeof ("segment") - 1) != 0))
+	segment = segment->next;
+      if (!segment)
+	{
 #ifdef GRUB_UTIL
-		  grub_util_info ("error parsing pe_start");
+	  grub_util_info ("unknown segment");
 #endif
-		  goto pvs_fail;
-		}
-	      p++;
-
-	      pv->disk = NULL;
-	      pv->next = vg->pvs;
-	      vg->pvs = pv;
-
-	      continue;
-	    pvs_fail:
-	      grub_free (pv->name);
-	      grub_free (pv);
-	      goto fail4;
-	    }
+	  goto fail;
 	}
 
-      p = grub_strstr (p, "logical_volumes {");
-      if (p)
+      r = grub_lvm_parse_segment (segment, &lv->segments[i],
+				  vg->extent_size, is_pvmove);
+      if (r < 0)
 	{
-	  p += sizeof ("logical_volumes {") - 1;
+	  /* Found a non-supported type, give up and move on. */
+	  grub_lvm_free_lv (lv);
+	  grub_errno = GRUB_ERR_NONE;
+	  return NULL;
+	}
+      if (!r)
+	goto fail;
 
-	  /* And add all the lvs to the volume group. */
-	  while (1)
-	    {
-	      grub_ssize_t s;
-	      int skip_lv = 0;
-	      struct grub_diskfilter_lv *lv;
-	      struct grub_diskfilter_segment *seg;
-	      int is_pvmove;
+      lv->size += lv->segments[i].extent_count * vg->extent_size;
+      segment = segment->next;
+    }
 
-	      while (grub_isspace (*p))
-		p++;
+  lv->vg = vg;
+  return lv;
 
-	      if (*p == '}')
-		break;
+ fail:
+  grub_lvm_free_lv (lv);
+  if (grub_errno == GRUB_ERR_NONE)
+    grub_error (GRUB_ERR_BAD_FS, "error parsing LVM metadata");
+  return NULL;
+}
+
+static struct grub_diskfilter_vg *
+grub_lvm_parse_vg (const struct grub_lvm_node *vgsec, const char *vg_id)
+{
+  struct grub_diskfilter_vg *vg;
+  const struct grub_lvm_node *section, *node;
+
+  vg = grub_zalloc (sizeof (*vg));
+  if (! vg)
+    return NULL;
+  vg->name = grub_strndup (vgsec->name, vgsec->name_len);
+  vg->uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
+  if (! vg->name || ! vg->uuid)
+    goto fail;
+  grub_memcpy (vg->uuid, vg_id, GRUB_LVM_ID_STRLEN);
+  vg->uuid_len = GRUB_LVM_ID_STRLEN;
 
-	      lv = grub_zalloc (sizeof (*lv));
+  if (!grub_lvm_getvalue (vgsec, "extent_size", &vg->extent_size))
+    goto fail;
 
-	      q = p;
-	      while (*q != ' ')
-		q++;
+  section = grub_lvm_find (vgsec, "physical_volumes", GRUB_LVM_NODE_SECTION);
+  /* Add all the pvs to the volume group. */
+  for (node = section ? section->child : NULL; node; node = node->next)
+    {
+      struct grub_diskfilter_pv *pv;
 
-	      s = q - p;
-	      lv->name = grub_strndup (p, s);
-	      if (!lv->name)
-		goto lvs_fail;
+      if (node->type != GRUB_LVM_NODE_SECTION)
+	continue;
+
+      pv = grub_zalloc (sizeof (*pv));
+      if (!pv)
+	goto fail;
+      pv->next = vg->pvs;
+      vg->pvs = pv;
+
+      pv->name = grub_strndup (node->name, node->name_len);
+      pv->id.uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
+      if (!pv->name || !pv->id.uuid)
+	goto fail;
+      if (!grub_lvm_get_id (node, pv->id.uuid))
+	goto fail;
+      pv->id.uuidlen = GRUB_LVM_ID_STRLEN;
+
+      if (!grub_lvm_getvalue (node, "pe_start", &pv->start_sector))
+	goto fail;
+      pv->disk = NULL;
+    }
 
+  section = grub_lvm_find (vgsec, "logical_volumes", GRUB_LVM_NODE_SECTION);
+  /* And add all the lvs to the volume group. */
+  for (node = section ? section->child : NULL; node; node = node->next)
+    {
+      struct grub_diskfilter_lv *lv;
+
+      if (node->type != GRUB_LVM_NODE_SECTION)
+	continue;
+
+      lv = grub_lvm_parse_lv (node, vg, vg_id);
+      if (!lv)
+	{
+	  if (grub_errno)
+	    goto fail;
+	  continue;
+	}
+      lv->next = vg->lvs;
+      vg->lvs = lv;
+    }
+
+  /* Match lvs.  */
+  {
+    struct grub_diskfilter_lv *lv1;
+    struct grub_diskfilter_lv *lv2;
+    struct grub_diskfilter_pv *pv;
+    unsigned int i, j;
+
+    for (lv1 = vg->lvs; lv1; lv1 = lv1->next)
+      for (i = 0; i < lv1->segment_count; i++)
+	for (j = 0; j < lv1->segments[i].node_count; j++)
+	  {
+	    for (pv = vg->pvs; pv; pv = pv->next)
 	      {
-		const char *iptr;
-		char *optr;
-		lv->fullname = grub_malloc (sizeof ("lvm/") - 1 + 2 * vgname_len
-					    + 1 + 2 * s + 1);
-		if (!lv->fullname)
-		  goto lvs_fail;
-
-		grub_memcpy (lv->fullname, "lvm/", sizeof ("lvm/") - 1);
-		optr = lv->fullname + sizeof ("lvm/") - 1;
-		for (iptr = vgname; iptr < vgname + vgname_len; iptr++)
-		  {
-		    *optr++ = *iptr;
-		    if (*iptr == '-')
-		      *optr++ = '-';
-		  }
-		*optr++ = '-';
-		for (iptr = p; iptr < p + s; iptr++)
+		if (! grub_strcmp (pv->name,
+				   lv1->segments[i].nodes[j].name))
 		  {
-		    *optr++ = *iptr;
-		    if (*iptr == '-')
-		      *optr++ = '-';
+		    lv1->segments[i].nodes[j].pv = pv;
+		    break;
 		  }
-		*optr++ = 0;
-		lv->idname = grub_malloc (sizeof ("lvmid/")
-					  + 2 * GRUB_LVM_ID_STRLEN + 1);
-		if (!lv->idname)
-		  goto lvs_fail;
-		grub_memcpy (lv->idname, "lvmid/",
-			     sizeof ("lvmid/") - 1);
-		grub_memcpy (lv->idname + sizeof ("lvmid/") - 1,
-			     vg_id, GRUB_LVM_ID_STRLEN);
-		lv->idname[sizeof ("lvmid/") - 1 + GRUB_LVM_ID_STRLEN] = '/';
-
-		p = grub_strstr (q, "id = \"");
-		if (p == NULL)
-		  {
-#ifdef GRUB_UTIL
-		    grub_util_info ("couldn't find ID");
-#endif
-		    goto lvs_fail;
-		  }
-		p += sizeof ("id = \"") - 1;
-		grub_memcpy (lv->idname + sizeof ("lvmid/") - 1
-			     + GRUB_LVM_ID_STRLEN + 1,
-			     p, GRUB_LVM_ID_STRLEN);
-		lv->idname[sizeof ("lvmid/") - 1 + 2 * GRUB_LVM_ID_STRLEN + 1] = '\0';
 	      }
+	    if (lv1->segments[i].nodes[j].pv == NULL)
+	      for (lv2 = vg->lvs; lv2; lv2 = lv2->next)
+		if (grub_strcmp (lv2->name,
+				 lv1->segments[i].nodes[j].name) == 0)
+		  lv1->segments[i].nodes[j].lv = lv2;
+	  }
+  }
 
-	      lv->size = 0;
+  return vg;
 
-	      lv->visible = grub_lvm_check_flag (p, "status", "VISIBLE");
-	      is_pvmove = grub_lvm_check_flag (p, "status", "PVMOVE");
+ fail:
+  grub_lvm_free_vg (vg);
+  return NULL;
+}
 
-	      lv->segment_count = grub_lvm_getvalue (&p, "segment_count = ");
-	      if (p == NULL)
-		{
-#ifdef GRUB_UTIL
-		  grub_util_info ("unknown segment_count");
-#endif
-		  goto lvs_fail;
-		}
-	      lv->segments = grub_zalloc (sizeof (*seg) * lv->segment_count);
-	      seg = lv->segments;
+/* Read the text of the most recent metadata out of the metadata area
+   at MDA_OFFSET.  Only the header sector and the text itself are read,
+   not the whole area.  */
+static char *
+grub_lvm_read_metadata (grub_disk_t disk, grub_uint64_t mda_offset,
+			grub_uint64_t mda_size)
+{
+  char hdrbuf[GRUB_LVM_MDA_HEADER_SIZE];
+  struct grub_lvm_mda_header *mdah = (struct grub_lvm_mda_header *) hdrbuf;
+  struct grub_lvm_raw_locn *rlocn;
+  grub_uint64_t offset, size, area_size, first;
+  char *text;
 
-	      for (i = 0; i < lv->segment_count; i++)
-		{
+  if (grub_disk_read (disk, 0, mda_offset, sizeof (hdrbuf), hdrbuf))
+    return NULL;
 
-		  p = grub_strstr (p, "segment");
-		  if (p == NULL)
-		    {
+  if ((grub_strncmp ((char *)mdah->magic, GRUB_LVM_FMTT_MAGIC,
+		     sizeof (mdah->magic)))
+      || (grub_le_to_cpu32 (mdah->version) != GRUB_LVM_FMTT_VERSION))
+    {
+      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		  "unknown LVM metadata header");
 #ifdef GRUB_UTIL
-		      grub_util_info ("unknown segment");
+      grub_util_info ("unknown LVM metadata header");
 #endif
-		      goto lvs_segment_fail;
-		    }
+      return NULL;
+    }
 
-		  seg->start_extent = grub_lvm_getvalue (&p, "start_extent = ");
-		  if (p == NULL)
-		    {
-#ifdef GRUB_UTIL
-		      grub_util_info ("unknown start_extent");
-#endif
-		      goto lvs_segment_fail;
-		    }
-		  seg->extent_count = grub_lvm_getvalue (&p, "extent_count = ");
-		  if (p == NULL)
-		    {
+  rlocn = mdah->raw_locns;
+  offset = grub_le_to_cpu64 (rlocn->offset);
+  size = grub_le_to_cpu64 (rlocn->size);
+  area_size = grub_le_to_cpu64 (mdah->size);
+  if (area_size > mda_size)
+    area_size = mda_size;
+
+  if (offset < GRUB_LVM_MDA_HEADER_SIZE || offset >= area_size
+      || size == 0 || size > area_size - GRUB_LVM_MDA_HEADER_SIZE)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "invalid LVM metadata location");
 #ifdef GRUB_UTIL
-		      grub_util_info ("unknown extent_count");
+      grub_util_info ("invalid LVM metadata location");
 #endif
-		      goto lvs_segment_fail;
-		    }
+      return NULL;
+    }
 
-		  p = grub_strstr (p, "type = \"");
-		  if (p == NULL)
-		    goto lvs_segment_fail;
-		  p += sizeof("type = \"") - 1;
+  text = grub_malloc (size + 1);
+  if (!text)
+    return NULL;
+
+  /* Metadata is circular and may wrap around to just past the
+     header.  */
+  first = size;
+  if (offset + size > area_size)
+    first = area_size - offset;
+  if (grub_disk_read (disk, 0, mda_offset + offset, first, text)
+      || (first < size
+	  && grub_disk_read (disk, 0, mda_offset + GRUB_LVM_MDA_HEADER_SIZE,
+			     size - first, text + first)))
+    {
+      grub_free (text);
+      return NULL;
+    }
+  text[size] = '\0';
 
-		  lv->size += seg->extent_count * vg->extent_size;
+  return text;
+}
 
-		  if (grub_memcmp (p, "striped\"",
-				   sizeof ("striped\"") - 1) == 0)
-		    {
-		      struct grub_diskfilter_node *stripe;
+static struct grub_diskfilter_vg *
+grub_lvm_detect (grub_disk_t disk,
+		 struct grub_diskfilter_pv_id *id,
+		 grub_disk_addr_t *start_sector)
+{
+  grub_err_t err;
+  grub_uint64_t mda_offset, mda_size;
+  char buf[GRUB_LVM_LABEL_SIZE];
+  char vg_id[GRUB_LVM_ID_STRLEN+1];
+  char pv_id[GRUB_LVM_ID_STRLEN+1];
+  char *metadatabuf;
+  struct grub_lvm_label_header *lh = (struct grub_lvm_label_header *) buf;
+  struct grub_lvm_pv_header *pvh;
+  struct grub_lvm_disk_locn *dlocn;
+  struct grub_lvm_parser ps;
+  const struct grub_lvm_node *root, *vgsec;
+  unsigned int i, j;
+  struct grub_diskfilter_vg *vg;
+
+  /* Search for label. */
+  for (i = 0; i < GRUB_LVM_LABEL_SCAN_SECTORS; i++)
+    {
+      err = grub_disk_read (disk, i, 0, sizeof(buf), buf);
+      if (err)
+	goto fail;
 
-		      seg->type = GRUB_DISKFILTER_STRIPED;
-		      seg->node_count = grub_lvm_getvalue (&p, "stripe_count = ");
-		      if (p == NULL)
-			{
+      if ((! grub_strncmp ((char *)lh->id, GRUB_LVM_LABEL_ID,
+			   sizeof (lh->id)))
+	  && (! grub_strncmp ((char *)lh->type, GRUB_LVM_LVM2_LABEL,
+			      sizeof (lh->type))))
+	break;
+    }
+
+  /* Return if we didn't find a label. */
+  if (i == GRUB_LVM_LABEL_SCAN_SECTORS)
+    {
 #ifdef GRUB_UTIL
-			  grub_util_info ("unknown stripe_count");
+      grub_util_info ("no LVM signature found");
 #endif
-			  goto lvs_segment_fail;
-			}
+      goto fail;
+    }
 
-		      if (seg->node_count != 1)
-			seg->stripe_size = grub_lvm_getvalue (&p, "stripe_size = ");
+  pvh = (struct grub_lvm_pv_header *) (buf + grub_le_to_cpu32(lh->offset_xl));
 
-		      seg->nodes = grub_zalloc (sizeof (*stripe)
-						* seg->node_count);
-		      stripe = seg->nodes;
+  for (i = 0, j = 0; i < GRUB_LVM_ID_LEN; i++)
+    {
+      pv_id[j++] = pvh->pv_uuid[i];
+      if ((i != 1) && (i != 29) && (i % 4 == 1))
+	pv_id[j++] = '-';
+    }
+  pv_id[j] = '\0';
 
-		      p = grub_strstr (p, "stripes = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown stripes");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("stripes = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  p = grub_strchr (p, '"');
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  stripe->name = grub_malloc (s + 1);
-			  if (stripe->name == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (stripe->name, p, s);
-			  stripe->name[s] = '\0';
-
-			  p = q + 1;
-
-			  stripe->start = grub_lvm_getvalue (&p, ",")
-			    * vg->extent_size;
-			  if (p == NULL)
-			    continue;
-
-			  stripe++;
-			}
-		    }
-		  else if (grub_memcmp (p, "mirror\"", sizeof ("mirror\"") - 1)
-			   == 0)
-		    {
-		      seg->type = GRUB_DISKFILTER_MIRROR;
-		      seg->node_count = grub_lvm_getvalue (&p, "mirror_count = ");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown mirror_count");
-#endif
-			  goto lvs_segment_fail;
-			}
+  dlocn = pvh->disk_areas_xl;
 
-		      seg->nodes = grub_zalloc (sizeof (seg->nodes[0])
-						* seg->node_count);
+  dlocn++;
+  /* Is it possible to have multiple data/metadata areas? I haven't
+     seen devices that have it. */
+  if (dlocn->offset)
+    {
+      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		  "we don't support multiple LVM data areas");
 
-		      p = grub_strstr (p, "mirrors = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown mirrors");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("mirrors = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  char *lvname;
-
-			  p = grub_strchr (p, '"');
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  lvname = grub_malloc (s + 1);
-			  if (lvname == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (lvname, p, s);
-			  lvname[s] = '\0';
-			  seg->nodes[j].name = lvname;
-			  p = q + 1;
-			}
-		      /* Only first (original) is ok with in progress pvmove.  */
-		      if (is_pvmove)
-			seg->node_count = 1;
-		    }
-		  else if (grub_memcmp (p, "raid", sizeof ("raid") - 1) == 0
-			   && ((p[sizeof ("raid") - 1] >= '4'
-				&& p[sizeof ("raid") - 1] <= '6')
-			       || p[sizeof ("raid") - 1] == '1')
-			   && p[sizeof ("raidX") - 1] == '"')
-		    {
-		      switch (p[sizeof ("raid") - 1])
-			{
-			case '1':
-			  seg->type = GRUB_DISKFILTER_MIRROR;
-			  break;
-			case '4':
-			  seg->type = GRUB_DISKFILTER_RAID4;
-			  seg->layout = GRUB_RAID_LAYOUT_LEFT_ASYMMETRIC;
-			  break;
-			case '5':
-			  seg->type = GRUB_DISKFILTER_RAID5;
-			  seg->layout = GRUB_RAID_LAYOUT_LEFT_SYMMETRIC;
-			  break;
-			case '6':
-			  seg->type = GRUB_DISKFILTER_RAID6;
-			  seg->layout = (GRUB_RAID_LAYOUT_RIGHT_ASYMMETRIC
-					 | GRUB_RAID_LAYOUT_MUL_FROM_POS);
-			  break;
-			}
-		      seg->node_count = grub_lvm_getvalue (&p, "device_count = ");
-
-		      if (p == NULL)
-			{
 #ifdef GRUB_UTIL
-			  grub_util_info ("unknown device_count");
-#endif
-			  goto lvs_segment_fail;
-			}
-
-		      if (seg->type != GRUB_DISKFILTER_MIRROR)
-			{
-			  seg->stripe_size = grub_lvm_getvalue (&p, "stripe_size = ");
-			  if (p == NULL)
-			    {
-#ifdef GRUB_UTIL
-			      grub_util_info ("unknown stripe_size");
+      grub_util_info ("we don't support multiple LVM data areas");
 #endif
-			      goto lvs_segment_fail;
-			    }
-			}
+      goto fail;
+    }
 
-		      seg->nodes = grub_zalloc (sizeof (seg->nodes[0])
-						* seg->node_count);
+  dlocn++;
+  mda_offset = grub_le_to_cpu64 (dlocn->offset);
+  mda_size = grub_le_to_cpu64 (dlocn->size);
 
-		      p = grub_strstr (p, "raids = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown raids");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("raids = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  char *lvname;
-
-			  p = grub_strchr (p, '"');
-			  p = p ? grub_strchr (p + 1, '"') : 0;
-			  p = p ? grub_strchr (p + 1, '"') : 0;
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  lvname = grub_malloc (s + 1);
-			  if (lvname == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (lvname, p, s);
-			  lvname[s] = '\0';
-			  seg->nodes[j].name = lvname;
-			  p = q + 1;
-			}
-		      if (seg->type == GRUB_DISKFILTER_RAID4)
-			{
-			  char *tmp;
-			  tmp = seg->nodes[0].name;
-			  grub_memmove (seg->nodes, seg->nodes + 1,
-					sizeof (seg->nodes[0])
-					* (seg->node_count - 1));
-			  seg->nodes[seg->node_count - 1].name = tmp;
-			}
-		    }
-		  else
-		    {
-#ifdef GRUB_UTIL
-		      char *p2;
-		      p2 = grub_strchr (p, '"');
-		      if (p2)
-			*p2 = 0;
-		      grub_util_info ("unknown LVM type %s", p);
-		      if (p2)
-			*p2 ='"';
-#endif
-		      /* Found a non-supported type, give up and move on. */
-		      skip_lv = 1;
-		      break;
-		    }
-
-		  seg++;
-
-		  continue;
-		lvs_segment_fail2:
-		  grub_free (seg->nodes);
-		lvs_segment_fail:
-		  goto fail4;
-		}
-
-	      if (p != NULL)
-		p = grub_strchr (p, '}');
-	      if (p == NULL)
-		goto lvs_fail;
-	      p += 3;
-
-	      if (skip_lv)
-		{
-		  grub_free (lv->name);
-		  grub_free (lv);
-		  continue;
-		}
-
-	      lv->vg = vg;
-	      lv->next = vg->lvs;
-	      vg->lvs = lv;
-
-	      continue;
-	    lvs_fail:
-	      grub_free (lv->name);
-	      grub_free (lv);
-	      goto fail4;
-	    }
-	}
+  /* It's possible to have multiple copies of metadata areas, we just use the
+     first one.  */
+  metadatabuf = grub_lvm_read_metadata (disk, mda_offset, mda_size);
+  if (! metadatabuf)
+    goto fail;
 
-      /* Match lvs.  */
-      {
-	struct grub_diskfilter_lv *lv1;
-	struct grub_diskfilter_lv *lv2;
-	for (lv1 = vg->lvs; lv1; lv1 = lv1->next)
-	  for (i = 0; i < lv1->segment_count; i++)
-	    for (j = 0; j < lv1->segments[i].node_count; j++)
-	      {
-		if (vg->pvs)
-		  for (pv = vg->pvs; pv; pv = pv->next)
-		    {
-		      if (! grub_strcmp (pv->name,
-					 lv1->segments[i].nodes[j].name))
-			{
-			  lv1->segments[i].nodes[j].pv = pv;
-			  break;
-			}
-		    }
-		if (lv1->segments[i].nodes[j].pv == NULL)
-		  for (lv2 = vg->lvs; lv2; lv2 = lv2->next)
-		    if (grub_strcmp (lv2->name,
-				     lv1->segments[i].nodes[j].name) == 0)
-		      lv1->segments[i].nodes[j].lv = lv2;
-	      }
-	
-      }
-      if (grub_diskfilter_vg_register (vg))
-	goto fail4;
-    }
-  else
+  /* Parse only the top of the volume group section first: it is all we
+     need when another PV already brought the VG in.  */
+  root = grub_lvm_parse (&ps, metadatabuf, 1);
+  for (vgsec = root; vgsec; vgsec = vgsec->next)
+    if (vgsec->type == GRUB_LVM_NODE_SECTION)
+      break;
+  if (! vgsec || ! grub_lvm_get_id (vgsec, vg_id))
+    goto fail2;
+  vg_id[GRUB_LVM_ID_STRLEN] = '\0';
+
+  vg = grub_diskfilter_get_vg_by_uuid (GRUB_LVM_ID_STRLEN, vg_id);
+
+  if (! vg)
     {
-      grub_free (vgname);
+      /* First time we see this volume group. We've to create the
+	 whole volume group structure. */
+      grub_lvm_parser_fini (&ps);
+      root = grub_lvm_parse (&ps, metadatabuf, GRUB_LVM_MAX_DEPTH);
+      for (vgsec = root; vgsec; vgsec = vgsec->next)
+	if (vgsec->type == GRUB_LVM_NODE_SECTION)
+	  break;
+      if (! vgsec)
+	goto fail2;
+
+      vg = grub_lvm_parse_vg (vgsec, vg_id);
+      if (! vg)
+	goto fail2;
+      if (grub_diskfilter_vg_register (vg))
+	{
+	  grub_lvm_free_vg (vg);
+	  goto fail2;
+	}
     }
 
   id->uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
   if (!id->uuid)
-    goto fail4;
+    goto fail2;
   grub_memcpy (id->uuid, pv_id, GRUB_LVM_ID_STRLEN);
   id->uuidlen = GRUB_LVM_ID_STRLEN;
+  grub_lvm_parser_fini (&ps);
   grub_free (metadatabuf);
   *start_sector = -1;
   return vg;
 
   /* Failure path.  */
- fail4:
-  grub_free (vg);
- fail3:
-  grub_free (vgname);
-
  fail2:
+  grub_lvm_parser_fini (&ps);
   grub_free (metadatabuf);
  fail:
   return NULL;
 }
 
-
 
 static struct grub_diskfilter grub_lvm_dev = {
   .name = "lvm",
@@ -0,0 +1,940 @@
+/* nvme.c - NVM Express disk driver.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The controller is driven by polling, with one admin queue pair and one
+   I/O queue pair.  Transfers go through page-aligned bounce buffers, one
+   per command slot, so that the PRP lists describing them are built only
+   once.  */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/list.h>
+#include <grub/loader.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+enum
+  {
+    GRUB_NVME_REG_CAP_LO = 0x00,
+    GRUB_NVME_REG_CAP_HI = 0x04,
+    GRUB_NVME_REG_VS = 0x08,
+    GRUB_NVME_REG_INTMS = 0x0c,
+    GRUB_NVME_REG_CC = 0x14,
+    GRUB_NVME_REG_CSTS = 0x1c,
+    GRUB_NVME_REG_AQA = 0x24,
+    GRUB_NVME_REG_ASQ_LO = 0x28,
+    GRUB_NVME_REG_ASQ_HI = 0x2c,
+    GRUB_NVME_REG_ACQ_LO = 0x30,
+    GRUB_NVME_REG_ACQ_HI = 0x34,
+    GRUB_NVME_REG_DOORBELLS = 0x1000
+  };
+
+enum
+  {
+    GRUB_NVME_CAP_LO_MQES_MASK = 0xffff,
+    GRUB_NVME_CAP_LO_TO_SHIFT = 24,
+    GRUB_NVME_CAP_HI_DSTRD_MASK = 0xf,
+    GRUB_NVME_CAP_HI_CSS_NVM = 1 << 5,
+    GRUB_NVME_CAP_HI_MPSMIN_SHIFT = 16,
+    GRUB_NVME_CAP_HI_MPSMIN_MASK = 0xf
+  };
+
+enum
+  {
+    GRUB_NVME_CC_EN = 1,
+    GRUB_NVME_CC_SHN_NORMAL = 1 << 14,
+    GRUB_NVME_CC_SHN_MASK = 3 << 14,
+    GRUB_NVME_CC_IOSQES = 6 << 16,
+    GRUB_NVME_CC_IOCQES = 4 << 20
+  };
+
+enum
+  {
+    GRUB_NVME_CSTS_RDY = 1,
+    GRUB_NVME_CSTS_CFS = 2,
+    GRUB_NVME_CSTS_SHST_MASK = 3 << 2,
+    GRUB_NVME_CSTS_SHST_DONE = 2 << 2
+  };
+
+enum
+  {
+    GRUB_NVME_ADMIN_CREATE_SQ = 0x01,
+    GRUB_NVME_ADMIN_CREATE_CQ = 0x05,
+    GRUB_NVME_ADMIN_IDENTIFY = 0x06,
+    GRUB_NVME_CMD_WRITE = 0x01,
+    GRUB_NVME_CMD_READ = 0x02
+  };
+
+enum
+  {
+    GRUB_NVME_IDENTIFY_NAMESPACE = 0,
+    GRUB_NVME_IDENTIFY_CONTROLLER = 1,
+    GRUB_NVME_IDENTIFY_ACTIVE_NAMESPACES = 2
+  };
+
+#define GRUB_NVME_PAGE_SIZE 4096
+#define GRUB_NVME_ADMIN_QUEUE_SIZE 4
+#define GRUB_NVME_IO_QUEUE_SIZE 32
+/* Commands kept in flight on the I/O queue and the size of each.  */
+#define GRUB_NVME_MAX_DEPTH 8
+#define GRUB_NVME_CMD_SIZE 0x20000
+/* Namespaces looked at when the controller can't list the active ones.  */
+#define GRUB_NVME_MAX_SCAN_NAMESPACES 64
+#define GRUB_NVME_TIMEOUT 10000
+
+struct grub_nvme_sqe
+{
+  grub_uint8_t opcode;
+  grub_uint8_t flags;
+  grub_uint16_t cid;
+  grub_uint32_t nsid;
+  grub_uint64_t reserved;
+  grub_uint64_t mptr;
+  grub_uint64_t prp1;
+  grub_uint64_t prp2;
+  grub_uint32_t cdw10;
+  grub_uint32_t cdw11;
+  grub_uint32_t cdw12;
+  grub_uint32_t cdw13;
+  grub_uint32_t cdw14;
+  grub_uint32_t cdw15;
+};
+
+struct grub_nvme_cqe
+{
+  grub_uint32_t result;
+  grub_uint32_t reserved;
+  grub_uint16_t sq_head;
+  grub_uint16_t sq_id;
+  grub_uint16_t cid;
+  /* Phase tag in bit 0, status code above it.  */
+  grub_uint16_t status;
+};
+
+struct grub_nvme_queue
+{
+  struct grub_pci_dma_chunk *sq_chunk;
+  struct grub_pci_dma_chunk *cq_chunk;
+  volatile struct grub_nvme_sqe *sq;
+  volatile struct grub_nvme_cqe *cq;
+  unsigned qid;
+  unsigned size;
+  unsigned sq_tail;
+  unsigned cq_head;
+  grub_uint16_t phase;
+};
+
+struct grub_nvme_controller
+{
+  struct grub_nvme_controller *next;
+  struct grub_nvme_controller **prev;
+  grub_pci_device_t pcidev;
+  volatile grub_uint32_t *regs;
+  grub_size_t doorbell_stride;
+  grub_uint32_t timeout_ms;
+  unsigned max_queue_size;
+  struct grub_nvme_queue admin;
+  struct grub_nvme_queue io;
+  /* Controller and namespace data.  */
+  struct grub_pci_dma_chunk *identify;
+  unsigned depth;
+  /* Largest transfer of one command, in bytes.  */
+  grub_size_t cmd_size;
+  struct grub_pci_dma_chunk *buf[GRUB_NVME_MAX_DEPTH];
+  struct grub_pci_dma_chunk *prp_list[GRUB_NVME_MAX_DEPTH];
+  int running;
+};
+
+struct grub_nvme_namespace
+{
+  struct grub_nvme_namespace *next;
+  struct grub_nvme_namespace **prev;
+  struct grub_nvme_controller *ctrl;
+  grub_uint32_t nsid;
+  int num;
+  grub_uint64_t nsectors;
+  unsigned log_sector_size;
+};
+
+static struct grub_nvme_controller *grub_nvme_controllers;
+static struct grub_nvme_namespace *grub_nvme_namespaces;
+static int numdevs;
+
+static inline grub_uint32_t
+grub_nvme_read_reg (struct grub_nvme_controller *ctrl, unsigned reg)
+{
+  return grub_le_to_cpu32 (ctrl->regs[reg / 4]);
+}
+
+static inline void
+grub_nvme_write_reg (struct grub_nvme_controller *ctrl, unsigned reg,
+		     grub_uint32_t val)
+{
+  ctrl->regs[reg / 4] = grub_cpu_to_le32 (val);
+}
+
+static inline void
+grub_nvme_ring (struct grub_nvme_controller *ctrl, unsigned qid, int cq,
+		grub_uint32_t val)
+{
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_DOORBELLS
+		       + (2 * qid + !!cq) * ctrl->doorbell_stride, val);
+}
+
+static grub_err_t
+grub_nvme_wait_status (struct grub_nvme_controller *ctrl, grub_uint32_t mask,
+		       grub_uint32_t val)
+{
+  grub_uint64_t endtime;
+
+  endtime = grub_get_time_ms () + ctrl->timeout_ms;
+  while ((grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CSTS) & mask) != val)
+    {
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe controller status timed out");
+      grub_millisleep (1);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_alloc_queue (struct grub_nvme_queue *q, unsigned qid,
+		       unsigned size)
+{
+  q->sq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_sqe));
+  if (!q->sq_chunk)
+    return grub_errno;
+  q->cq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_cqe));
+  if (!q->cq_chunk)
+    {
+      grub_dma_free (q->sq_chunk);
+      q->sq_chunk = NULL;
+      return grub_errno;
+    }
+  q->sq = grub_dma_get_virt (q->sq_chunk);
+  q->cq = grub_dma_get_virt (q->cq_chunk);
+  grub_memset ((char *) q->sq, 0, size * sizeof (struct grub_nvme_sqe));
+  grub_memset ((char *) q->cq, 0, size * sizeof (struct grub_nvme_cqe));
+  q->qid = qid;
+  q->size = size;
+  q->sq_tail = 0;
+  q->cq_head = 0;
+  q->phase = 1;
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_free_queue (struct grub_nvme_queue *q)
+{
+  if (q->sq_chunk)
+    grub_dma_free (q->sq_chunk);
+  if (q->cq_chunk)
+    grub_dma_free (q->cq_chunk);
+  q->sq_chunk = NULL;
+  q->cq_chunk = NULL;
+}
+
+/* Put CMD at the tail of Q.  The doorbell is rung separately so that
+   several commands can be handed over at once.  */
+static void
+grub_nvme_submit (struct grub_nvme_queue *q, const struct grub_nvme_sqe *cmd)
+{
+  volatile grub_uint32_t *dst
+    = (volatile grub_uint32_t *) &q->sq[q->sq_tail];
+  const grub_uint32_t *src = (const grub_uint32_t *) cmd;
+  unsigned i;
+
+  for (i = 0; i < sizeof (*cmd) / 4; i++)
+    dst[i] = src[i];
+  q->sq_tail = (q->sq_tail + 1) % q->size;
+}
+
+/* Take the next completion from Q if there is one.  Return the
+   command id, or -1 if nothing has completed yet.  */
+static int
+grub_nvme_reap (struct grub_nvme_controller *ctrl, struct grub_nvme_queue *q,
+		grub_uint16_t *status, grub_uint32_t *result)
+{
+  volatile struct grub_nvme_cqe *cqe = &q->cq[q->cq_head];
+  grub_uint16_t st;
+  int cid;
+
+  st = grub_le_to_cpu16 (cqe->status);
+  if ((st & 1) != q->phase)
+    return -1;
+
+  cid = grub_le_to_cpu16 (cqe->cid);
+  *status = st >> 1;
+  if (result)
+    *result = grub_le_to_cpu32 (cqe->result);
+
+  q->cq_head++;
+  if (q->cq_head == q->size)
+    {
+      q->cq_head = 0;
+      q->phase ^= 1;
+    }
+  grub_nvme_ring (ctrl, q->qid, 1, q->cq_head);
+  return cid;
+}
+
+static grub_err_t
+grub_nvme_admin (struct grub_nvme_controller *ctrl, struct grub_nvme_sqe *cmd,
+		 grub_uint32_t *result)
+{
+  grub_uint64_t endtime;
+  grub_uint16_t status;
+
+  cmd->cid = 0;
+  grub_nvme_submit (&ctrl->admin, cmd);
+  grub_nvme_ring (ctrl, 0, 0, ctrl->admin.sq_tail);
+
+  endtime = grub_get_time_ms () + GRUB_NVME_TIMEOUT;
+  while (grub_nvme_reap (ctrl, &ctrl->admin, &status, result) < 0)
+    if (grub_get_time_ms () > endtime)
+      return grub_error (GRUB_ERR_IO, "NVMe admin command timed out");
+
+  if (status)
+    return grub_error (GRUB_ERR_IO, "NVMe admin command 0x%x failed: 0x%x",
+		       cmd->opcode, status);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_identify (struct grub_nvme_controller *ctrl, grub_uint32_t cns,
+		    grub_uint32_t nsid)
+{
+  struct grub_nvme_sqe cmd;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.opcode = GRUB_NVME_ADMIN_IDENTIFY;
+  cmd.nsid = grub_cpu_to_le32 (nsid);
+  cmd.prp1 = grub_cpu_to_le64 (grub_dma_get_phys (ctrl->identify));
+  cmd.cdw10 = grub_cpu_to_le32 (cns);
+  return grub_nvme_admin (ctrl, &cmd, NULL);
+}
+
+static grub_err_t
+grub_nvme_disable (struct grub_nvme_controller *ctrl)
+{
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_CC,
+		       grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CC)
+		       & ~GRUB_NVME_CC_EN);
+  return grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_RDY, 0);
+}
+
+/* Reset the controller and bring up the admin and I/O queues.  */
+static grub_err_t
+grub_nvme_start (struct grub_nvme_controller *ctrl)
+{
+  struct grub_nvme_sqe cmd;
+  unsigned io_size;
+  grub_err_t err;
+
+  if (grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CC) & GRUB_NVME_CC_EN)
+    {
+      err = grub_nvme_disable (ctrl);
+      if (err)
+	return err;
+    }
+
+  err = grub_nvme_alloc_queue (&ctrl->admin, 0, GRUB_NVME_ADMIN_QUEUE_SIZE);
+  if (err)
+    return err;
+  io_size = GRUB_NVME_IO_QUEUE_SIZE;
+  if (io_size > ctrl->max_queue_size)
+    io_size = ctrl->max_queue_size;
+  err = grub_nvme_alloc_queue (&ctrl->io, 1, io_size);
+  if (err)
+    goto fail;
+
+  /* Everything is polled.  */
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_INTMS, 0xffffffff);
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_AQA,
+		       ((GRUB_NVME_ADMIN_QUEUE_SIZE - 1) << 16)
+		       | (GRUB_NVME_ADMIN_QUEUE_SIZE - 1));
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_ASQ_LO,
+		       grub_dma_get_phys (ctrl->admin.sq_chunk));
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_ASQ_HI, 0);
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_ACQ_LO,
+		       grub_dma_get_phys (ctrl->admin.cq_chunk));
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_ACQ_HI, 0);
+
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_CC, GRUB_NVME_CC_IOSQES
+		       | GRUB_NVME_CC_IOCQES | GRUB_NVME_CC_EN);
+  err = grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_RDY | GRUB_NVME_CSTS_CFS,
+			       GRUB_NVME_CSTS_RDY);
+  if (err)
+    goto fail;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.opcode = GRUB_NVME_ADMIN_CREATE_CQ;
+  cmd.prp1 = grub_cpu_to_le64 (grub_dma_get_phys (ctrl->io.cq_chunk));
+  cmd.cdw10 = grub_cpu_to_le32 (((io_size - 1) << 16) | 1);
+  /* Physically contiguous, no interrupts.  */
+  cmd.cdw11 = grub_cpu_to_le32 (1);
+  err = grub_nvme_admin (ctrl, &cmd, NULL);
+  if (err)
+    goto fail_disable;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.opcode = GRUB_NVME_ADMIN_CREATE_SQ;
+  cmd.prp1 = grub_cpu_to_le64 (grub_dma_get_phys (ctrl->io.sq_chunk));
+  cmd.cdw10 = grub_cpu_to_le32 (((io_size - 1) << 16) | 1);
+  /* Completions go to queue 1, physically contiguous.  */
+  cmd.cdw11 = grub_cpu_to_le32 ((1 << 16) | 1);
+  err = grub_nvme_admin (ctrl, &cmd, NULL);
+  if (err)
+    goto fail_disable;
+
+  ctrl->running = 1;
+  return GRUB_ERR_NONE;
+
+ fail_disable:
+  grub_nvme_disable (ctrl);
+ fail:
+  grub_nvme_free_queue (&ctrl->io);
+  grub_nvme_free_queue (&ctrl->admin);
+  return err;
+}
+
+/* Hand the controller back: let it flush its caches and stop it, so that
+   the OS finds it idle.  */
+static void
+grub_nvme_stop (struct grub_nvme_controller *ctrl)
+{
+  if (!ctrl->running)
+    return;
+
+  grub_nvme_write_reg (ctrl, GRUB_NVME_REG_CC,
+		       (grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CC)
+			& ~GRUB_NVME_CC_SHN_MASK) | GRUB_NVME_CC_SHN_NORMAL);
+  if (grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_SHST_MASK,
+			     GRUB_NVME_CSTS_SHST_DONE))
+    grub_dprintf ("nvme", "shutdown didn't complete\n");
+  if (grub_nvme_disable (ctrl))
+    grub_dprintf ("nvme", "couldn't disable the controller\n");
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_nvme_free_queue (&ctrl->io);
+  grub_nvme_free_queue (&ctrl->admin);
+  ctrl->running = 0;
+}
+
+/* Allocate the bounce buffers and their PRP lists.  Entry I of a list
+   points to page I + 1 of the buffer, PRP1 covers the first one.  */
+static grub_err_t
+grub_nvme_alloc_buffers (struct grub_nvme_controller *ctrl)
+{
+  unsigned i, j;
+
+  for (i = 0; i < ctrl->depth; i++)
+    {
+      volatile grub_uint64_t *list;
+
+      ctrl->buf[i] = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					  ctrl->cmd_size);
+      if (!ctrl->buf[i])
+	return grub_errno;
+      ctrl->prp_list[i] = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					       GRUB_NVME_PAGE_SIZE);
+      if (!ctrl->prp_list[i])
+	return grub_errno;
+      list = grub_dma_get_virt (ctrl->prp_list[i]);
+      for (j = 1; j < ctrl->cmd_size / GRUB_NVME_PAGE_SIZE; j++)
+	list[j - 1] = grub_cpu_to_le64 (grub_dma_get_phys (ctrl->buf[i])
+					+ j * GRUB_NVME_PAGE_SIZE);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_scan_namespace (struct grub_nvme_controller *ctrl,
+			  grub_uint32_t nsid)
+{
+  struct grub_nvme_namespace *ns;
+  grub_uint8_t *id;
+  grub_uint32_t lbaf;
+  grub_uint64_t nsze;
+  unsigned lbads;
+
+  if (grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_NAMESPACE, nsid))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  id = (grub_uint8_t *) grub_dma_get_virt (ctrl->identify);
+  nsze = grub_le_to_cpu64 (grub_get_unaligned64 (id));
+  if (nsze == 0)
+    return;
+
+  lbaf = grub_le_to_cpu32 (grub_get_unaligned32 (id + 128
+						  + 4 * (id[26] & 0xf)));
+  lbads = (lbaf >> 16) & 0xff;
+  /* Separate metadata would need its own buffer.  */
+  if ((lbaf & 0xffff) != 0 || lbads < GRUB_DISK_SECTOR_BITS
+      || (1U << lbads) > ctrl->cmd_size)
+    {
+      grub_dprintf ("nvme", "namespace %u has an unsupported format 0x%x\n",
+		    nsid, lbaf);
+      return;
+    }
+
+  ns = grub_zalloc (sizeof (*ns));
+  if (!ns)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  ns->ctrl = ctrl;
+  ns->nsid = nsid;
+  ns->num = numdevs++;
+  ns->nsectors = nsze;
+  ns->log_sector_size = lbads;
+
+  grub_dprintf ("nvme", "nvme%d: namespace %u, %llu sectors of %u bytes\n",
+		ns->num, nsid, (unsigned long long) nsze, 1U << lbads);
+
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_namespaces), GRUB_AS_LIST (ns));
+}
+
+static void
+grub_nvme_scan_namespaces (struct grub_nvme_controller *ctrl,
+			   grub_uint32_t nn)
+{
+  grub_uint32_t *list;
+  grub_uint32_t nsid;
+  unsigned i;
+
+  /* NVMe 1.1 controllers can list the active namespaces.  The list is
+     copied since identifying each of them overwrites it.  */
+  list = grub_malloc (GRUB_NVME_PAGE_SIZE);
+  if (list && grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_ACTIVE_NAMESPACES,
+				  0) == GRUB_ERR_NONE)
+    {
+      grub_memcpy (list, (char *) grub_dma_get_virt (ctrl->identify),
+		   GRUB_NVME_PAGE_SIZE);
+      for (i = 0; i < GRUB_NVME_PAGE_SIZE / 4 && list[i]; i++)
+	grub_nvme_scan_namespace (ctrl, grub_le_to_cpu32 (list[i]));
+      grub_free (list);
+      return;
+    }
+  grub_free (list);
+  grub_errno = GRUB_ERR_NONE;
+
+  if (nn > GRUB_NVME_MAX_SCAN_NAMESPACES)
+    nn = GRUB_NVME_MAX_SCAN_NAMESPACES;
+  for (nsid = 1; nsid <= nn; nsid++)
+    grub_nvme_scan_namespace (ctrl, nsid);
+}
+
+static void
+grub_nvme_free_controller (struct grub_nvme_controller *ctrl)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_NVME_MAX_DEPTH; i++)
+    {
+      if (ctrl->buf[i])
+	grub_dma_free (ctrl->buf[i]);
+      if (ctrl->prp_list[i])
+	grub_dma_free (ctrl->prp_list[i]);
+    }
+  if (ctrl->identify)
+    grub_dma_free (ctrl->identify);
+  grub_free (ctrl);
+}
+
+static int
+grub_nvme_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *data __attribute__ ((unused)))
+{
+  struct grub_nvme_controller *ctrl;
+  grub_pci_address_t addr;
+  grub_uint32_t bar, cap_lo, cap_hi, nn;
+  grub_uint64_t base;
+  grub_uint8_t *id;
+  unsigned mpsmin, mdts;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      base |= (grub_uint64_t) grub_pci_read (addr) << 32;
+    }
+  if ((grub_addr_t) base != base)
+    {
+      grub_dprintf ("nvme", "%x:%x.%x: registers above 4 GiB\n",
+		    dev.bus, dev.device, dev.function);
+      return 0;
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  ctrl = grub_zalloc (sizeof (*ctrl));
+  if (!ctrl)
+    return 1;
+  ctrl->pcidev = dev;
+  ctrl->regs = grub_pci_device_map_range (dev, base,
+					  GRUB_NVME_REG_DOORBELLS);
+
+  cap_lo = grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CAP_LO);
+  cap_hi = grub_nvme_read_reg (ctrl, GRUB_NVME_REG_CAP_HI);
+  ctrl->doorbell_stride = 4 << (cap_hi & GRUB_NVME_CAP_HI_DSTRD_MASK);
+  ctrl->timeout_ms = ((cap_lo >> GRUB_NVME_CAP_LO_TO_SHIFT) + 1) * 500;
+  ctrl->max_queue_size = (cap_lo & GRUB_NVME_CAP_LO_MQES_MASK) + 1;
+  mpsmin = (cap_hi >> GRUB_NVME_CAP_HI_MPSMIN_SHIFT)
+    & GRUB_NVME_CAP_HI_MPSMIN_MASK;
+
+  grub_dprintf ("nvme", "dev: %x:%x.%x, version %x, cap %08x%08x\n",
+		dev.bus, dev.device, dev.function,
+		grub_nvme_read_reg (ctrl, GRUB_NVME_REG_VS), cap_hi, cap_lo);
+
+  /* 4 KiB pages and the NVM command set are all that is used here.  */
+  if (mpsmin != 0 || !(cap_hi & GRUB_NVME_CAP_HI_CSS_NVM)
+      || ctrl->max_queue_size < 2)
+    {
+      grub_dprintf ("nvme", "unsupported controller\n");
+      grub_free (ctrl);
+      return 0;
+    }
+
+  /* The doorbells of the two queue pairs.  */
+  ctrl->regs = grub_pci_device_map_range (dev, base, GRUB_NVME_REG_DOORBELLS
+					  + 4 * ctrl->doorbell_stride);
+
+  ctrl->identify = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					GRUB_NVME_PAGE_SIZE);
+  if (!ctrl->identify)
+    {
+      grub_free (ctrl);
+      return 1;
+    }
+
+  if (grub_nvme_start (ctrl)
+      || grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_CONTROLLER, 0))
+    {
+      grub_dprintf ("nvme", "couldn't start the controller: %s\n",
+		    grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_nvme_stop (ctrl);
+      grub_nvme_free_controller (ctrl);
+      return 0;
+    }
+
+  id = (grub_uint8_t *) grub_dma_get_virt (ctrl->identify);
+  mdts = id[77];
+  nn = grub_le_to_cpu32 (grub_get_unaligned32 (id + 516));
+
+  ctrl->cmd_size = GRUB_NVME_CMD_SIZE;
+  if (mdts && mdts < 32 && ((grub_size_t) GRUB_NVME_PAGE_SIZE << mdts)
+      < ctrl->cmd_size)
+    ctrl->cmd_size = (grub_size_t) GRUB_NVME_PAGE_SIZE << mdts;
+  ctrl->depth = GRUB_NVME_MAX_DEPTH;
+  if (ctrl->depth > ctrl->io.size - 1)
+    ctrl->depth = ctrl->io.size - 1;
+
+  if (grub_nvme_alloc_buffers (ctrl))
+    {
+      grub_nvme_stop (ctrl);
+      grub_nvme_free_controller (ctrl);
+      return 1;
+    }
+
+  grub_dprintf ("nvme", "%u namespaces, %u commands of %u bytes\n",
+		nn, ctrl->depth, (unsigned) ctrl->cmd_size);
+
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_controllers),
+		  GRUB_AS_LIST (ctrl));
+  grub_nvme_scan_namespaces (ctrl, nn);
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_size_t size, char *buf, int rw)
+{
+  struct grub_nvme_namespace *ns = disk->data;
+  struct grub_nvme_controller *ctrl = ns->ctrl;
+  grub_size_t cmd_start[GRUB_NVME_MAX_DEPTH];
+  grub_size_t cmd_count[GRUB_NVME_MAX_DEPTH];
+  grub_size_t per_cmd, issued = 0;
+  grub_uint32_t busy = 0;
+  grub_uint64_t endtime;
+  grub_uint16_t status, failed = 0;
+  int timed_out = 0;
+  unsigned slot;
+
+  if (!ctrl->running)
+    return grub_error (GRUB_ERR_IO, "NVMe controller is stopped");
+
+  per_cmd = ctrl->cmd_size >> ns->log_sector_size;
+
+  endtime = grub_get_time_ms () + GRUB_NVME_TIMEOUT;
+  while ((issued < size && !failed) || busy)
+    {
+      int submitted = 0;
+      int cid;
+
+      /* Keep every slot busy while there is something left to ask for.  */
+      for (slot = 0; slot < ctrl->depth && issued < size && !failed; slot++)
+	{
+	  struct grub_nvme_sqe cmd;
+	  grub_size_t count, bytes;
+	  grub_uint64_t phys;
+
+	  if (busy & (1U << slot))
+	    continue;
+
+	  count = size - issued;
+	  if (count > per_cmd)
+	    count = per_cmd;
+	  bytes = count << ns->log_sector_size;
+	  if (rw)
+	    grub_memcpy ((char *) grub_dma_get_virt (ctrl->buf[slot]),
+			 buf + (issued << ns->log_sector_size), bytes);
+
+	  phys = grub_dma_get_phys (ctrl->buf[slot]);
+	  grub_memset (&cmd, 0, sizeof (cmd));
+	  cmd.opcode = rw ? GRUB_NVME_CMD_WRITE : GRUB_NVME_CMD_READ;
+	  cmd.cid = grub_cpu_to_le16 (slot);
+	  cmd.nsid = grub_cpu_to_le32 (ns->nsid);
+	  cmd.prp1 = grub_cpu_to_le64 (phys);
+	  if (bytes > 2 * GRUB_NVME_PAGE_SIZE)
+	    cmd.prp2 = grub_cpu_to_le64 (grub_dma_get_phys (ctrl->prp_list[slot]));
+	  else if (bytes > GRUB_NVME_PAGE_SIZE)
+	    cmd.prp2 = grub_cpu_to_le64 (phys + GRUB_NVME_PAGE_SIZE);
+	  cmd.cdw10 = grub_cpu_to_le32 (sector + issued);
+	  cmd.cdw11 = grub_cpu_to_le32 ((sector + issued) >> 32);
+	  cmd.cdw12 = grub_cpu_to_le32 (count - 1);
+	  grub_nvme_submit (&ctrl->io, &cmd);
+
+	  cmd_start[slot] = issued;
+	  cmd_count[slot] = count;
+	  issued += count;
+	  busy |= 1U << slot;
+	  submitted = 1;
+	}
+      if (submitted)
+	grub_nvme_ring (ctrl, 1, 0, ctrl->io.sq_tail);
+
+      cid = grub_nvme_reap (ctrl, &ctrl->io, &status, NULL);
+      if (cid < 0)
+	{
+	  if (grub_get_time_ms () > endtime)
+	    {
+	      timed_out = 1;
+	      break;
+	    }
+	  continue;
+	}
+
+      if ((unsigned) cid >= ctrl->depth || !(busy & (1U << cid)))
+	{
+	  grub_dprintf ("nvme", "stray completion %d\n", cid);
+	  continue;
+	}
+      busy &= ~(1U << cid);
+      endtime = grub_get_time_ms () + GRUB_NVME_TIMEOUT;
+
+      if (status)
+	{
+	  grub_dprintf ("nvme", "command at %llu failed: 0x%x\n",
+			(unsigned long long) (sector + cmd_start[cid]),
+			status);
+	  failed = status;
+	  continue;
+	}
+      if (!rw)
+	grub_memcpy (buf + (cmd_start[cid] << ns->log_sector_size),
+		     (char *) grub_dma_get_virt (ctrl->buf[cid]),
+		     cmd_count[cid] << ns->log_sector_size);
+    }
+
+  if (timed_out)
+    {
+      /* Commands may still be outstanding, start over with empty
+	 queues.  */
+      grub_nvme_stop (ctrl);
+      if (grub_nvme_start (ctrl))
+	grub_errno = GRUB_ERR_NONE;
+      return grub_error (GRUB_ERR_IO, "NVMe transfer timed out");
+    }
+
+  if (failed)
+    return grub_error (rw ? GRUB_ERR_WRITE_ERROR : GRUB_ERR_READ_ERROR,
+		       "NVMe %s failed: 0x%x", rw ? "write" : "read", failed);
+
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_nvme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		   grub_disk_pull_t pull)
+{
+  struct grub_nvme_namespace *ns;
+  char name[20];
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  FOR_LIST_ELEMENTS(ns, grub_nvme_namespaces)
+    {
+      grub_snprintf (name, sizeof (name), "nvme%d", ns->num);
+      if (hook (name, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_open (const char *name, grub_disk_t disk)
+{
+  struct grub_nvme_namespace *ns;
+  int num;
+
+  if (grub_strncmp (name, "nvme", sizeof ("nvme") - 1) != 0
+      || !grub_isdigit (name[sizeof ("nvme") - 1]))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe disk");
+
+  num = grub_strtoul (name + sizeof ("nvme") - 1, 0, 10);
+  FOR_LIST_ELEMENTS(ns, grub_nvme_namespaces)
+    if (ns->num == num)
+      break;
+
+  if (!ns)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "no such NVMe disk");
+
+  disk->total_sectors = ns->nsectors;
+  disk->log_sector_size = ns->log_sector_size;
+  disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+  disk->id = ns->num;
+  disk->data = ns;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  return grub_nvme_readwrite (disk, sector, size, buf, 0);
+}
+
+static grub_err_t
+grub_nvme_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  return grub_nvme_readwrite (disk, sector, size, (char *) buf, 1);
+}
+
+static struct grub_disk_dev grub_nvme_dev =
+  {
+    .name = "nvme",
+    .id = GRUB_DISK_DEVICE_NVME_ID,
+    .iterate = grub_nvme_iterate,
+    .open = grub_nvme_open,
+    .read = grub_nvme_read,
+    .write = grub_nvme_write,
+    .next = 0
+  };
+
+static grub_err_t
+grub_nvme_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_nvme_controller *ctrl;
+
+  FOR_LIST_ELEMENTS(ctrl, grub_nvme_controllers)
+    grub_nvme_stop (ctrl);
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_restore_hw (void)
+{
+  struct grub_nvme_controller *ctrl;
+
+  FOR_LIST_ELEMENTS(ctrl, grub_nvme_controllers)
+    if (grub_nvme_start (ctrl))
+      {
+	grub_dprintf ("nvme", "couldn't restart the controller: %s\n",
+		      grub_errmsg);
+	grub_errno = GRUB_ERR_NONE;
+      }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_preboot *fini_hnd;
+
+GRUB_MOD_INIT(nvme)
+{
+  grub_stop_disk_firmware ();
+
+  /* Mass storage, non-volatile memory, NVM Express.  */
+  grub_pci_iterate_class (0x010802, 0xffffff, grub_nvme_pciinit, NULL);
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_disk_dev_register (&grub_nvme_dev);
+
+  fini_hnd = grub_loader_register_preboot_hook (grub_nvme_fini_hw,
+						grub_nvme_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI(nvme)
+{
+  struct grub_nvme_controller *ctrl, *next_ctrl;
+  struct grub_nvme_namespace *ns, *next_ns;
+
+  grub_nvme_fini_hw (0);
+  grub_loader_unregister_preboot_hook (fini_hnd);
+  grub_disk_dev_unregister (&grub_nvme_dev);
+
+  for (ns = grub_nvme_namespaces; ns; ns = next_ns)
+    {
+      next_ns = ns->next;
+      grub_free (ns);
+    }
+  grub_nvme_namespaces = NULL;
+  for (ctrl = grub_nvme_controllers; ctrl; ctrl = next_ctrl)
+    {
+      next_ctrl = ctrl->next;
+      grub_nvme_free_controller (ctrl);
+    }
+  grub_nvme_controllers = NULL;
+}
@@ -24,6 +24,12 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/crypto.h>
+#if defined (GRUB_MACHINE_EFI) && (defined (__i386__) || defined (__x86_64__))
+#include <grub/i386/cpuid.h>
+#define RAID6_SIMD	1
+#elif defined (GRUB_MACHINE_EFI) && defined (__aarch64__)
+#define RAID6_SIMD	1
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -33,16 +39,167 @@ static grub_uint8_t powx[255 * 2];
 static unsigned powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+/* Multiplying by a constant is linear over XOR, so the product of a byte
+   is the XOR of the products of its low and high nibbles.  A pair of
+   16-entry tables of those is exactly what a byte shuffle instruction
+   looks up, 16 bytes at a time.  */
+
+#ifdef RAID6_SIMD
+
+/* -1 until checked.  */
+static int raid6_simd = -1;
+
+#ifdef __aarch64__
+
+/* UEFI has the FP and Advanced SIMD units enabled.  */
+static int
+raid6_simd_supported (void)
+{
+  return 1;
+}
+
+/* Replace each byte of the NBLOCKS 16-byte blocks at BUF with
+   LO[low nibble] ^ HI[high nibble].  GRUB is compiled for the general
+   registers only, so only V0 to V4, which no calling convention
+   preserves, are used, and they are cleared.  */
+static void
+raid6_simd_mul (const grub_uint8_t *lo, const grub_uint8_t *hi,
+		grub_uint8_t *buf, grub_size_t nblocks)
+{
+  asm volatile (".arch armv8-a+simd\n\t"
+		"ld1 {v0.16b}, [%[lo]]\n\t"
+		"ld1 {v1.16b}, [%[hi]]\n\t"
+		"movi v2.16b, #0x0f\n"
+		"1:\n\t"
+		"ld1 {v3.16b}, [%[buf]]\n\t"
+		"ushr v4.16b, v3.16b, #4\n\t"
+		"and v3.16b, v3.16b, v2.16b\n\t"
+		"tbl v3.16b, {v0.16b}, v3.16b\n\t"
+		"tbl v4.16b, {v1.16b}, v4.16b\n\t"
+		"eor v3.16b, v3.16b, v4.16b\n\t"
+		"st1 {v3.16b}, [%[buf]], #16\n\t"
+		"subs %[n], %[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v4.16b, #0\n"
+		: [buf] "+r" (buf), [n] "+r" (nblocks)
+		: [lo] "r" (lo), [hi] "r" (hi)
+		: "cc", "memory");
+}
+
+#else
+
+#define CPUID_ECX_SSSE3		(1 << 9)
+#define CR0_EM			(1 << 2)
+#define CR0_TS			(1 << 3)
+#define CR4_OSFXSR		(1 << 9)
+
+/* GRUB never enables SSE itself: only use it when the firmware has.  */
+static int
+raid6_simd_supported (void)
+{
+  grub_uint32_t a, b, c, d;
+  unsigned long cr0, cr4;
+
+  if (! grub_cpu_is_cpuid_supported ())
+    return 0;
+
+  grub_cpuid (0, a, b, c, d);
+  if (a < 1)
+    return 0;
+  grub_cpuid (1, a, b, c, d);
+  if (! (c & CPUID_ECX_SSSE3))
+    return 0;
+
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+  return (cr4 & CR4_OSFXSR) && ! (cr0 & (CR0_EM | CR0_TS));
+}
+
+static const grub_uint8_t raid6_nibble_mask[16] =
+  {
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+  };
+
+/* Replace each byte of the NBLOCKS 16-byte blocks at BUF with
+   LO[low nibble] ^ HI[high nibble].  GRUB is compiled without SSE, so
+   only XMM0 to XMM5, which no calling convention preserves, are used, and
+   they are cleared.  */
+static void
+raid6_simd_mul (const grub_uint8_t *lo, const grub_uint8_t *hi,
+		grub_uint8_t *buf, grub_size_t nblocks)
+{
+  asm volatile ("movdqu (%[lo]), %%xmm0\n\t"
+		"movdqu (%[hi]), %%xmm1\n\t"
+		"movdqu (%[mask]), %%xmm2\n"
+		"1:\n\t"
+		"movdqu (%[buf]), %%xmm3\n\t"
+		"movdqa %%xmm3, %%xmm4\n\t"
+		"psrlw $4, %%xmm4\n\t"
+		"pand %%xmm2, %%xmm3\n\t"
+		"pand %%xmm2, %%xmm4\n\t"
+		"movdqa %%xmm0, %%xmm5\n\t"
+		"pshufb %%xmm3, %%xmm5\n\t"
+		"movdqa %%xmm1, %%xmm3\n\t"
+		"pshufb %%xmm4, %%xmm3\n\t"
+		"pxor %%xmm5, %%xmm3\n\t"
+		"movdqu %%xmm3, (%[buf])\n\t"
+		"add $16, %[buf]\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n"
+		: [buf] "+r" (buf), [n] "+r" (nblocks)
+		: [lo] "r" (lo), [hi] "r" (hi), [mask] "r" (raid6_nibble_mask)
+		: "cc", "memory");
+}
+
+#endif
+
+#endif
+
+/* Multiply every byte of BUF by x**MUL.  */
 static void
 grub_raid_block_mulx (unsigned mul, char *buf, grub_size_t size)
 {
   grub_size_t i;
   grub_uint8_t *p;
+  grub_uint8_t table[256];
+
+  table[0] = 0;
+  for (i = 1; i < 256; i++)
+    table[i] = powx[mul + powx_inv[i]];
 
   p = (grub_uint8_t *) buf;
+
+#ifdef RAID6_SIMD
+  if (raid6_simd < 0)
+    raid6_simd = raid6_simd_supported ();
+  if (raid6_simd && size >= 16)
+    {
+      grub_uint8_t lo[16], hi[16];
+
+      for (i = 0; i < 16; i++)
+	{
+	  lo[i] = table[i];
+	  hi[i] = table[i << 4];
+	}
+      raid6_simd_mul (lo, hi, p, size / 16);
+      p += size & ~(grub_size_t) 15;
+      size &= 15;
+    }
+#endif
+
   for (i = 0; i < size; i++, p++)
-    if (*p)
-      *p = powx[mul + powx_inv[*p]];
+    *p = table[*p];
 }
 
 static void
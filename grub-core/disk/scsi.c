@@ -511,7 +511,7 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
   bus = grub_strtoul (nameend + 1, 0, 0);
 
-  scsi = grub_malloc (sizeof (*scsi));
+  scsi = grub_zalloc (sizeof (*scsi));
   if (! scsi)
     return grub_errno;
 
@@ -607,11 +607,16 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
       disk->total_sectors = scsi->last_block + 1;
       /* PATA doesn't support more than 32K reads.
-	 Not sure about AHCI and USB. If it's confirmed that either of
-	 them can do bigger reads reliably this value can be moved to 'scsi'
-	 structure.  */
+	 Not sure about AHCI. Devices which can do bigger reads reliably
+	 set max_transfer.  */
       disk->max_agglomerate = 32768 >> (GRUB_DISK_SECTOR_BITS
 					+ GRUB_DISK_CACHE_BITS);
+      if (scsi->max_transfer >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS)
+	  > disk->max_agglomerate)
+	disk->max_agglomerate = scsi->max_transfer
+	  >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+      if (disk->max_agglomerate > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
 
       if (scsi->blocksize & (scsi->blocksize - 1) || !scsi->blocksize)
 	{
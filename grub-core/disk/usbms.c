@@ -28,6 +28,11 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define GRUB_USBMS_DIRECTION_BIT	7
 
+/* Upper limit of data length of one READ/WRITE command. Data stages up to
+ * this size are queued to the host controller as one transfer when it
+ * has enough transfer descriptors. */
+#define GRUB_USBMS_MAX_TRANSFER		(1 << 20)
+
 /* Length of CBI command should be always 12 bytes */
 #define GRUB_USBMS_CBI_CMD_SIZE         12
 /* CBI class-specific USB request ADSC - it sends CBI (scsi) command to
@@ -608,6 +613,9 @@ grub_usbms_write (struct grub_scsi *scsi, grub_size_t cmdsize, char *cmd,
 static grub_err_t
 grub_usbms_open (int id, int devnum, struct grub_scsi *scsi)
 {
+  grub_usbms_dev_t dev;
+  grub_size_t max;
+
   if (id != GRUB_SCSI_SUBSYSTEM_USBMS)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
 		       "not USB Mass Storage device");
@@ -619,8 +627,18 @@ grub_usbms_open (int id, int devnum, struct grub_scsi *scsi)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
 		       "unknown USB Mass Storage device");
 
-  scsi->data = grub_usbms_devices[devnum];
-  scsi->luns = grub_usbms_devices[devnum]->luns;
+  dev = grub_usbms_devices[devnum];
+  scsi->data = dev;
+  scsi->luns = dev->luns;
+
+  /* Let the SCSI layer issue commands as large as the host controller
+     can take in one transfer in both directions.  */
+  max = grub_usb_bulk_max_transfer (dev->dev, dev->in);
+  if (grub_usb_bulk_max_transfer (dev->dev, dev->out) < max)
+    max = grub_usb_bulk_max_transfer (dev->dev, dev->out);
+  if (max > GRUB_USBMS_MAX_TRANSFER)
+    max = GRUB_USBMS_MAX_TRANSFER;
+  scsi->max_transfer = max;
 
   return GRUB_ERR_NONE;
 }
@@ -54,6 +54,13 @@ struct char_index_entry
 #define FONT_WEIGHT_NORMAL 100
 #define FONT_WEIGHT_BOLD 200
 #define ASCII_BITMAP_SIZE 16
+/* Glyphs are read on demand, from all over the DATA section.  */
+#define FONT_FILE_BUFFER_SIZE 16384
+/* Read DATA sections up to this size into memory at load time.  */
+#define FONT_DATA_PRELOAD_MAX (4 << 20)
+/* Size of the width, height, xoff, yoff and dwidth fields before each
+   glyph bitmap.  */
+#define FONT_GLYPH_HEADER_SIZE 10
 
 /* Definition of font registry.  */
 struct grub_font_node *grub_font_list;
@@ -110,6 +117,65 @@ static struct grub_font null_font;
 /* Flag to ensure module is initialized only once.  */
 static grub_uint8_t font_loader_initialized;
 
+/* Results of searching all fonts for a glyph the requested font lacks,
+   including misses.  Without it every such character drawn walks the whole
+   font list again.  Entries are only valid for the font list generation
+   they were made in.  */
+#define FALLBACK_CACHE_SIZE 256
+
+static struct fallback_cache_entry
+{
+  grub_font_t font;
+  grub_uint32_t code;
+  unsigned generation;
+  struct grub_font_glyph *glyph;
+} fallback_cache[FALLBACK_CACHE_SIZE];
+
+/* For a requested font and a block of 1 << FALLBACK_BLOCK_BITS code
+   points, the fonts with any character in the block, best match first.
+   Characters missing from the cache above are looked up in these fonts
+   only, which matters for scripts such as CJK with far more characters in
+   use than that cache holds.  */
+#define FALLBACK_BLOCK_BITS 8
+#define FALLBACK_RANGE_CACHE_SIZE 64
+
+static struct fallback_range_entry
+{
+  grub_font_t font;
+  grub_uint32_t block;
+  unsigned generation;
+  unsigned nfonts;
+  grub_font_t *fonts;
+} fallback_range_cache[FALLBACK_RANGE_CACHE_SIZE];
+
+/* Bumped whenever fonts are added or removed.  Never 0, so that zeroed
+   cache entries never match.  */
+static unsigned font_list_generation = 1;
+
+static inline struct fallback_cache_entry *
+fallback_cache_slot (grub_font_t font, grub_uint32_t code)
+{
+  grub_uint32_t hash;
+
+  hash = code * 0x9e3779b1 ^ (grub_uint32_t) ((grub_addr_t) font >> 4);
+  return &fallback_cache[(hash ^ (hash >> 16)) & (FALLBACK_CACHE_SIZE - 1)];
+}
+
+static void
+font_list_changed (void)
+{
+  if (++font_list_generation == 0)
+    {
+      unsigned i;
+
+      grub_memset (fallback_cache, 0, sizeof (fallback_cache));
+      for (i = 0; i < FALLBACK_RANGE_CACHE_SIZE; i++)
+	grub_free (fallback_range_cache[i].fonts);
+      grub_memset (fallback_range_cache, 0, sizeof (fallback_range_cache));
+      font_list_generation = 1;
+    }
+}
+
 #if HAVE_FONT_SOURCE
 static struct grub_font_glyph *ascii_font_glyph[0x80];
 #endif
@@ -206,6 +272,9 @@ font_init (grub_font_t font)
   font->num_chars = 0;
   font->char_index = 0;
   font->bmp_idx = 0;
+  font->data = 0;
+  font->data_offset = 0;
+  font->data_size = 0;
 }
 
 /* Open the next section in the file.
@@ -418,7 +487,7 @@ grub_font_load (const char *filename)
 #endif
 
   if (filename[0] == '(' || filename[0] == '/' || filename[0] == '+')
-    file = grub_buffile_open (filename, 1024);
+    file = grub_buffile_open (filename, FONT_FILE_BUFFER_SIZE);
   else
     {
       const char *prefix = grub_env_get ("prefix");
@@ -438,7 +507,7 @@ grub_font_load (const char *filename)
       ptr = grub_stpcpy (ptr, filename);
       ptr = grub_stpcpy (ptr, ".pf2");
       *ptr = 0;
-      file = grub_buffile_open (fullname, 1024);
+      file = grub_buffile_open (fullname, FONT_FILE_BUFFER_SIZE);
       grub_free (fullname);
     }
   if (!file)
@@ -598,6 +667,7 @@ grub_font_load (const char *filename)
 			    sizeof (FONT_FORMAT_SECTION_NAMES_DATA) - 1) == 0)
 	{
 	  /* When the DATA section marker is reached, we stop reading.  */
+	  font->data_offset = grub_file_tell (file);
 	  break;
 	}
       else
@@ -636,6 +706,32 @@ grub_font_load (const char *filename)
       goto fail;
     }
 
+  /* Menus page through glyphs from all over the DATA section; when it is
+     small enough, one big read beats a seek and read per glyph.  */
+  if (font->data_offset && grub_file_size (file) != GRUB_FILE_SIZE_UNKNOWN
+      && grub_file_size (file) > font->data_offset
+      && grub_file_size (file) - font->data_offset <= FONT_DATA_PRELOAD_MAX)
+    {
+      grub_size_t size = grub_file_size (file) - font->data_offset;
+
+      font->data = grub_malloc (size);
+      if (font->data
+	  && grub_file_read (file, font->data, size) == (grub_ssize_t) size)
+	{
+	  font->data_size = size;
+	  grub_file_close (file);
+	  file = 0;
+	  font->file = 0;
+	}
+      else
+	{
+	  /* Fall back to reading glyphs on demand.  */
+	  grub_free (font->data);
+	  font->data = 0;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
   /* Add the font to the global font registry.  */
   if (register_font (font) != 0)
     goto fail;
@@ -652,25 +748,6 @@ fail:
   return 0;
 }
 
-/* Read a 16-bit big-endian integer from FILE, convert it to native byte
-   order, and store it in *VALUE.
-   Returns 0 on success, 1 on failure.  */
-static int
-read_be_uint16 (grub_file_t file, grub_uint16_t * value)
-{
-  if (grub_file_read (file, value, 2) != 2)
-    return 1;
-  *value = grub_be_to_cpu16 (*value);
-  return 0;
-}
-
-static int
-read_be_int16 (grub_file_t file, grub_int16_t * value)
-{
-  /* For the signed integer version, use the same code as for unsigned.  */
-  return read_be_uint16 (file, (grub_uint16_t *) value);
-}
-
 /* Return a pointer to the character index entry for the glyph corresponding to
    the codepoint CODE in the font FONT.  If not found, return zero.  */
 static inline struct char_index_entry *
@@ -724,6 +801,8 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
   if (index_entry)
     {
       struct grub_font_glyph *glyph = 0;
+      grub_uint8_t header[FONT_GLYPH_HEADER_SIZE];
+      const grub_uint8_t *data = 0;
       grub_uint16_t width;
       grub_uint16_t height;
       grub_int16_t xoff;
@@ -735,28 +814,53 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
 	/* Return cached glyph.  */
 	return index_entry->glyph;
 
-      if (!font->file)
-	/* No open file, can't load any glyphs.  */
-	return 0;
+      if (font->data)
+	{
+	  grub_off_t offset = index_entry->offset - font->data_offset;
 
-      /* Make sure we can find glyphs for error messages.  Push active
-         error message to error stack and reset error message.  */
-      grub_error_push ();
+	  if (index_entry->offset < font->data_offset
+	      || offset + FONT_GLYPH_HEADER_SIZE > font->data_size)
+	    {
+	      remove_font (font);
+	      return 0;
+	    }
+	  data = font->data + offset;
+	  grub_memcpy (header, data, FONT_GLYPH_HEADER_SIZE);
+	  data += FONT_GLYPH_HEADER_SIZE;
+	}
+      else
+	{
+	  if (!font->file)
+	    /* No open file, can't load any glyphs.  */
+	    return 0;
+
+	  /* Make sure we can find glyphs for error messages.  Push active
+	     error message to error stack and reset error message.  */
+	  grub_error_push ();
+
+	  /* Read the glyph width, height, and baseline in one go.  */
+	  grub_file_seek (font->file, index_entry->offset);
+	  if (grub_file_read (font->file, header, FONT_GLYPH_HEADER_SIZE)
+	      != FONT_GLYPH_HEADER_SIZE)
+	    {
+	      remove_font (font);
+	      return 0;
+	    }
+	}
 
-      grub_file_seek (font->file, index_entry->offset);
+      width = grub_be_to_cpu16 (grub_get_unaligned16 (header));
+      height = grub_be_to_cpu16 (grub_get_unaligned16 (header + 2));
+      xoff = grub_be_to_cpu16 (grub_get_unaligned16 (header + 4));
+      yoff = grub_be_to_cpu16 (grub_get_unaligned16 (header + 6));
+      dwidth = grub_be_to_cpu16 (grub_get_unaligned16 (header + 8));
 
-      /* Read the glyph width, height, and baseline.  */
-      if (read_be_uint16 (font->file, &width) != 0
-	  || read_be_uint16 (font->file, &height) != 0
-	  || read_be_int16 (font->file, &xoff) != 0
-	  || read_be_int16 (font->file, &yoff) != 0
-	  || read_be_int16 (font->file, &dwidth) != 0)
+      len = (width * height + 7) / 8;
+      if (data && (grub_size_t) (data - font->data) + len > font->data_size)
 	{
 	  remove_font (font);
 	  return 0;
 	}
 
-      len = (width * height + 7) / 8;
       glyph = grub_malloc (sizeof (struct grub_font_glyph) + len);
       if (!glyph)
 	{
@@ -771,6 +875,13 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
       glyph->offset_y = yoff;
       glyph->device_width = dwidth;
 
+      if (data)
+	{
+	  grub_memcpy (glyph->bitmap, data, len);
+	  index_entry->glyph = glyph;
+	  return glyph;
+	}
+
       /* Don't try to read empty bitmaps (e.g., space characters).  */
       if (len != 0)
 	{
@@ -809,6 +920,7 @@ free_font (grub_font_t font)
       grub_free (font->family);
       grub_free (font->char_index);
       grub_free (font->bmp_idx);
+      grub_free (font->data);
       grub_free (font);
     }
 }
@@ -828,6 +940,7 @@ register_font (grub_font_t font)
   node->value = font;
   node->next = grub_font_list;
   grub_font_list = node;
+  font_list_changed ();
 
   return 0;
 }
@@ -848,6 +961,7 @@ remove_font (grub_font_t font)
 
 	  /* Free the node, but not the font itself.  */
 	  grub_free (cur);
+	  font_list_changed ();
 
 	  return;
 	}
@@ -974,6 +1088,93 @@ get_font_diversity (grub_font_t a, grub_font_t b)
   return d;
 }
 
+/* Whether FONT has any character in BLOCK.  */
+static int
+font_has_block (grub_font_t font, grub_uint32_t block)
+{
+  grub_uint32_t first = block << FALLBACK_BLOCK_BITS;
+  grub_uint32_t lo = 0, hi = font->num_chars, mid;
+
+  if (!font->char_index)
+    return 0;
+
+  /* Find the first character not below FIRST.  */
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (font->char_index[mid].code < first)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return (lo < font->num_chars
+	  && (font->char_index[lo].code >> FALLBACK_BLOCK_BITS) == block);
+}
+
+/* Get the fonts to search for the characters of BLOCK that FONT lacks, in
+   the order the full search would prefer them.  Return NULL if out of
+   memory.  */
+static struct fallback_range_entry *
+fallback_range_get (grub_font_t font, grub_uint32_t block)
+{
+  struct fallback_range_entry *r;
+  struct grub_font_node *node;
+  grub_uint32_t hash;
+  unsigned n = 0;
+
+  hash = block * 0x9e3779b1 ^ (grub_uint32_t) ((grub_addr_t) font >> 4);
+  r = &fallback_range_cache[(hash ^ (hash >> 16))
+			    & (FALLBACK_RANGE_CACHE_SIZE - 1)];
+  if (r->generation == font_list_generation && r->font == font
+      && r->block == block)
+    return r;
+
+  grub_free (r->fonts);
+  r->fonts = 0;
+  r->nfonts = 0;
+  r->generation = 0;
+
+  for (node = grub_font_list; node; node = node->next)
+    n++;
+  if (n)
+    {
+      r->fonts = grub_malloc (n * sizeof (r->fonts[0]));
+      if (!r->fonts)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+    }
+
+  /* Insert each font after those no more diverse from FONT, so that ties
+     go to the font found first, like in the full search.  */
+  for (node = grub_font_list; node; node = node->next)
+    {
+      grub_font_t cur = node->value;
+      unsigned i;
+
+      if (!font_has_block (cur, block))
+	continue;
+
+      i = r->nfonts;
+      if (font)
+	{
+	  int d = get_font_diversity (cur, font);
+
+	  for (; i > 0 && d < get_font_diversity (r->fonts[i - 1], font); i--)
+	    r->fonts[i] = r->fonts[i - 1];
+	}
+      r->fonts[i] = cur;
+      r->nfonts++;
+    }
+
+  r->font = font;
+  r->block = block;
+  r->generation = font_list_generation;
+  return r;
+}
+
 /* Get a glyph corresponding to the codepoint CODE.  If FONT contains the
    specified glyph, then it is returned.  Otherwise, all other loaded fonts
    are searched until one is found that contains a glyph for CODE.
@@ -994,6 +1195,8 @@ grub_font_get_glyph_with_fallback (grub_font_t font, grub_uint32_t code)
      the best matching to the requested one.  */
   int best_diversity;
   struct grub_font_glyph *best_glyph;
+  struct fallback_cache_entry *slot;
+  struct fallback_range_entry *range;
 
   if (font)
     {
@@ -1003,10 +1206,26 @@ grub_font_get_glyph_with_fallback (grub_font_t font, grub_uint32_t code)
 	return glyph;
     }
 
-  /* Otherwise, search all loaded fonts for the glyph and use the one from
-     the font that best matches the requested font.  */
-  best_diversity = 10000;
+  slot = fallback_cache_slot (font, code);
+  if (slot->generation == font_list_generation && slot->font == font
+      && slot->code == code)
+    return slot->glyph;
+
+  /* Otherwise use the glyph of the font that best matches the requested
+     font, among the loaded fonts having characters near CODE.  */
   best_glyph = 0;
+  range = fallback_range_get (font, code >> FALLBACK_BLOCK_BITS);
+  if (range)
+    {
+      unsigned i;
+
+      for (i = 0; i < range->nfonts && !best_glyph; i++)
+	best_glyph = grub_font_get_glyph_internal (range->fonts[i], code);
+      goto done;
+    }
+
+  /* Without memory for that, search all loaded fonts.  */
+  best_diversity = 10000;
 
   for (node = grub_font_list; node; node = next)
     {
@@ -1017,7 +1236,10 @@ grub_font_get_glyph_with_fallback (grub_font_t font, grub_uint32_t code)
 
       glyph = grub_font_get_glyph_internal (curfont, code);
       if (glyph && !font)
-	return glyph;
+	{
+	  best_glyph = glyph;
+	  break;
+	}
       if (glyph)
 	{
 	  int d;
@@ -1031,6 +1253,12 @@ grub_font_get_glyph_with_fallback (grub_font_t font, grub_uint32_t code)
 	}
     }
 
+ done:
+  slot->font = font;
+  slot->code = code;
+  slot->glyph = best_glyph;
+  slot->generation = font_list_generation;
+
   return best_glyph;
 }
 
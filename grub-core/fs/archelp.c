@@ -20,6 +20,10 @@
 #include <grub/err.h>
 #include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/i18n.h>
 #include <grub/dl.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -54,11 +58,15 @@ canonicalize (char *name)
   *optr = 0;
 }
 
+/* If FN is a symlink on the path NAME, replace it in NAME with its
+   target and set *RESTART.  KNOWN_TARGET is the target of FN if it was
+   read already, NULL to read it now.  */
 static grub_err_t
 handle_symlink (struct grub_archelp_data *data,
 		struct grub_archelp_ops *arcops,
 		const char *fn, char **name,
-		grub_uint32_t mode, int *restart)
+		grub_uint32_t mode, int *restart,
+		const char *known_target)
 {
   grub_size_t flen;
   char *target;
@@ -92,7 +100,10 @@ handle_symlink (struct grub_archelp_data *data,
   if (prefixlen)
     prefixlen++;
 
-  linktarget = arcops->get_link_target (data);
+  if (known_target)
+    linktarget = grub_strdup (known_target);
+  else
+    linktarget = arcops->get_link_target (data);
   if (!linktarget)
     return grub_errno;
   if (linktarget[0] == '\0')
@@ -133,6 +144,304 @@ handle_symlink (struct grub_archelp_data *data,
   return GRUB_ERR_NONE;
 }
 
+/* Archives are read from the start, header by header, for every open and
+   every directory listing, which adds up for memdisk tarballs holding
+   hundreds of modules and theme files.  For the archive formats that can
+   seek to an entry, the names are read once into an index with a hash
+   table of them.  The indexes of the last few archives are kept until
+   the disk cache is invalidated, as every operation mounts again.  */
+
+#define ARCHELP_INDEX_MAX	4
+
+struct archelp_entry
+{
+  /* Canonicalized.  */
+  char *name;
+  /* The target of a symlink, NULL for other entries and for symlinks
+     with an empty target, which aren't followed.  */
+  char *link;
+  grub_off_t ofs;
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+};
+
+/* The entries with one name, as entry numbers plus 1, 0 for none.  An
+   unused slot has neither.  */
+struct archelp_slot
+{
+  grub_uint32_t hash;
+  /* The first entry that isn't a symlink to follow.  */
+  grub_uint32_t plain;
+  /* The first symlink to follow.  */
+  grub_uint32_t link;
+};
+
+struct archelp_index
+{
+  struct archelp_index *next;
+
+  /* Which archive this is.  */
+  struct grub_archelp_ops *ops;
+  unsigned long dev_id, disk_id;
+  grub_disk_addr_t part_start;
+
+  /* In archive order.  */
+  struct archelp_entry *entries;
+  grub_uint32_t nentries;
+
+  /* At most half full.  */
+  struct archelp_slot *slots;
+  grub_uint32_t mask;
+};
+
+static struct archelp_index *archelp_indexes;
+
+/* The value of grub_disk_cache_generation the indexes were made with.  */
+static unsigned long archelp_indexes_generation;
+
+static grub_uint32_t
+index_hash (const char *name, grub_size_t len)
+{
+  grub_uint32_t hash = 2166136261U;
+
+  while (len--)
+    hash = (hash ^ (grub_uint8_t) *name++) * 16777619U;
+  return hash;
+}
+
+/* Return the slot for the first LEN characters of NAME, which is unused
+   if none of the entries has that name.  */
+static struct archelp_slot *
+index_find (struct archelp_index *index, const char *name, grub_size_t len)
+{
+  grub_uint32_t hash = index_hash (name, len);
+  grub_uint32_t i;
+
+  for (i = hash & index->mask; ; i = (i + 1) & index->mask)
+    {
+      struct archelp_slot *slot = &index->slots[i];
+      const char *n;
+
+      if (!slot->plain && !slot->link)
+	{
+	  slot->hash = hash;
+	  return slot;
+	}
+      if (slot->hash != hash)
+	continue;
+      n = index->entries[(slot->plain ? : slot->link) - 1].name;
+      if (grub_memcmp (n, name, len) == 0 && n[len] == 0)
+	return slot;
+    }
+}
+
+static void
+index_free (struct archelp_index *index)
+{
+  grub_uint32_t i;
+
+  for (i = 0; i < index->nentries; i++)
+    {
+      grub_free (index->entries[i].name);
+      grub_free (index->entries[i].link);
+    }
+  grub_free (index->entries);
+  grub_free (index->slots);
+  grub_free (index);
+}
+
+static struct archelp_index *
+index_build (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops, grub_disk_t disk)
+{
+  struct archelp_index *index;
+  grub_uint32_t alloc = 0, i;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return NULL;
+  index->ops = arcops;
+  index->dev_id = disk->dev->id;
+  index->disk_id = disk->id;
+  index->part_start = grub_partition_get_start (disk->partition);
+
+  arcops->rewind (data);
+  while (1)
+    {
+      struct archelp_entry *e;
+      grub_off_t ofs = arcops->tell (data);
+      grub_int32_t mtime = 0;
+      grub_uint32_t mode;
+      char *name;
+
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+
+      if (index->nentries == alloc)
+	{
+	  struct archelp_entry *n = NULL;
+
+	  if (alloc < 0x4000000)
+	    {
+	      alloc = alloc ? 2 * alloc : 64;
+	      n = grub_realloc (index->entries, alloc * sizeof (*n));
+	    }
+	  if (!n)
+	    {
+	      grub_free (name);
+	      goto fail;
+	    }
+	  index->entries = n;
+	}
+
+      canonicalize (name);
+      e = &index->entries[index->nentries++];
+      e->name = name;
+      e->link = NULL;
+      e->ofs = ofs;
+      e->mtime = mtime;
+      e->mode = mode;
+
+      if ((mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_LNK
+	  && arcops->get_link_target)
+	{
+	  e->link = arcops->get_link_target (data);
+	  if (!e->link)
+	    goto fail;
+	  if (e->link[0] == '\0')
+	    {
+	      grub_free (e->link);
+	      e->link = NULL;
+	    }
+	}
+    }
+
+  for (index->mask = 63; index->mask / 2 < index->nentries;
+       index->mask = 2 * index->mask + 1);
+  index->slots = grub_zalloc ((index->mask + 1) * sizeof (index->slots[0]));
+  if (!index->slots)
+    goto fail;
+
+  for (i = 0; i < index->nentries; i++)
+    {
+      struct archelp_entry *e = &index->entries[i];
+      struct archelp_slot *slot;
+
+      slot = index_find (index, e->name, grub_strlen (e->name));
+      if (e->link)
+	{
+	  if (!slot->link)
+	    slot->link = i + 1;
+	}
+      else if (!slot->plain)
+	slot->plain = i + 1;
+    }
+
+  arcops->rewind (data);
+  return index;
+
+ fail:
+  index_free (index);
+  arcops->rewind (data);
+  return NULL;
+}
+
+/* Find the index of the archive of DATA, moving it to the front, or
+   build it.  NULL if the format can't be indexed or building failed, in
+   which case the archive is scanned as before.  */
+static struct archelp_index *
+index_get (struct grub_archelp_data *data, struct grub_archelp_ops *arcops)
+{
+  struct archelp_index **prev, *index;
+  grub_disk_addr_t part_start;
+  grub_disk_t disk;
+  int n = 0;
+
+  if (!arcops->tell || !arcops->seek || !arcops->get_disk)
+    return NULL;
+
+  if (archelp_indexes_generation != grub_disk_cache_generation)
+    {
+      while (archelp_indexes)
+	{
+	  index = archelp_indexes;
+	  archelp_indexes = index->next;
+	  index_free (index);
+	}
+      archelp_indexes_generation = grub_disk_cache_generation;
+    }
+
+  disk = arcops->get_disk (data);
+  part_start = grub_partition_get_start (disk->partition);
+  for (prev = &archelp_indexes; *prev; prev = &(*prev)->next, n++)
+    if ((*prev)->ops == arcops && (*prev)->dev_id == disk->dev->id
+	&& (*prev)->disk_id == disk->id && (*prev)->part_start == part_start)
+      {
+	index = *prev;
+	*prev = index->next;
+	index->next = archelp_indexes;
+	archelp_indexes = index;
+	return index;
+      }
+
+  index = index_build (data, arcops, disk);
+  if (!index)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  /* Forget the least recently used archive.  */
+  if (n >= ARCHELP_INDEX_MAX)
+    {
+      for (prev = &archelp_indexes; (*prev)->next; prev = &(*prev)->next);
+      index_free (*prev);
+      *prev = NULL;
+    }
+
+  index->next = archelp_indexes;
+  archelp_indexes = index;
+  return index;
+}
+
+/* Read the next entry of the archive, from INDEX at *POS if there is
+   one.  *LINK is set to the target of a symlink if it is known.  */
+static grub_err_t
+next_entry (struct grub_archelp_data *data,
+	    struct grub_archelp_ops *arcops,
+	    struct archelp_index *index, grub_uint32_t *pos,
+	    char **name, grub_int32_t *mtime, grub_uint32_t *mode,
+	    const char **link)
+{
+  struct archelp_entry *e;
+
+  *link = NULL;
+  if (!index)
+    {
+      if (arcops->find_file (data, name, mtime, mode))
+	return grub_errno;
+      if (*mode != GRUB_ARCHELP_ATTR_END)
+	canonicalize (*name);
+      return GRUB_ERR_NONE;
+    }
+
+  if (*pos == index->nentries)
+    {
+      *mode = GRUB_ARCHELP_ATTR_END;
+      return GRUB_ERR_NONE;
+    }
+  e = &index->entries[(*pos)++];
+  *name = grub_strdup (e->name);
+  if (!*name)
+    return grub_errno;
+  *mtime = e->mtime;
+  *mode = e->mode;
+  *link = e->link ? : "";
+  return GRUB_ERR_NONE;
+}
+
 grub_err_t
 grub_archelp_dir (struct grub_archelp_data *data,
 		  struct grub_archelp_ops *arcops,
@@ -142,6 +451,8 @@ grub_archelp_dir (struct grub_archelp_data *data,
   char *prev, *name, *path, *ptr;
   grub_size_t len;
   int symlinknest = 0;
+  struct archelp_index *index;
+  grub_uint32_t pos = 0;
 
   path = grub_strdup (path_in + 1);
   if (!path)
@@ -151,6 +462,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
     *ptr = 0;
 
   prev = 0;
+  index = index_get (data, arcops);
 
   len = grub_strlen (path);
   while (1)
@@ -158,15 +470,14 @@ grub_archelp_dir (struct grub_archelp_data *data,
       grub_int32_t mtime;
       grub_uint32_t mode;
       grub_err_t err;
+      const char *link;
 
-      if (arcops->find_file (data, &name, &mtime, &mode))
+      if (next_entry (data, arcops, index, &pos, &name, &mtime, &mode, &link))
 	goto fail;
 
       if (mode == GRUB_ARCHELP_ATTR_END)
 	break;
 
-      canonicalize (name);
-
       if (grub_memcmp (path, name, len) == 0
 	  && (name[len] == 0 || name[len] == '/' || len == 0))
 	{
@@ -203,7 +514,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 	    {
 	      int restart = 0;
 	      err = handle_symlink (data, arcops, name,
-				    &path, mode, &restart);
+				    &path, mode, &restart, link);
 	      grub_free (name);
 	      if (err)
 		goto fail;
@@ -216,7 +527,10 @@ grub_archelp_dir (struct grub_archelp_data *data,
 				  N_("too deep nesting of symlinks"));
 		      goto fail;
 		    }
-		  arcops->rewind (data);
+		  if (index)
+		    pos = 0;
+		  else
+		    arcops->rewind (data);
 		}
 	    }
 	}
@@ -232,6 +546,67 @@ fail:
   return grub_errno;
 }
 
+/* Find *NAME through INDEX and leave DATA at its entry.  The entry found
+   is the one scanning the archive would find first: the first entry that
+   is either the file or a symlink on its path.  */
+static grub_err_t
+open_indexed (struct grub_archelp_data *data,
+	      struct grub_archelp_ops *arcops,
+	      struct archelp_index *index, char **name,
+	      const char *name_in)
+{
+  int symlinknest = 0;
+
+  while (1)
+    {
+      struct archelp_entry *e;
+      grub_uint32_t best;
+      const char *p;
+      grub_uint32_t mode;
+      grub_int32_t mtime;
+      int restart;
+      char *fn;
+
+      best = index_find (index, *name, grub_strlen (*name))->plain;
+      for (p = *name; ; p++)
+	{
+	  grub_uint32_t link;
+
+	  if (*p != '/' && *p != '\0')
+	    continue;
+	  link = index_find (index, *name, p - *name)->link;
+	  if (link && (!best || link < best))
+	    best = link;
+	  if (*p == '\0')
+	    break;
+	}
+
+      if (!best)
+	return grub_error (GRUB_ERR_FILE_NOT_FOUND,
+			   N_("file `%s' not found"), name_in);
+
+      e = &index->entries[best - 1];
+      if (e->link)
+	{
+	  if (handle_symlink (data, arcops, e->name, name, e->mode,
+			      &restart, e->link))
+	    return grub_errno;
+	  if (++symlinknest == 8)
+	    return grub_error (GRUB_ERR_SYMLINK_LOOP,
+			       N_("too deep nesting of symlinks"));
+	  continue;
+	}
+
+      arcops->seek (data, e->ofs);
+      if (arcops->find_file (data, &fn, &mtime, &mode))
+	return grub_errno;
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	return grub_error (GRUB_ERR_BAD_FS, "archive changed");
+      grub_free (fn);
+      return GRUB_ERR_NONE;
+    }
+}
+
 grub_err_t
 grub_archelp_open (struct grub_archelp_data *data,
 		   struct grub_archelp_ops *arcops,
@@ -240,12 +615,23 @@ grub_archelp_open (struct grub_archelp_data *data,
   char *fn;
   char *name = grub_strdup (name_in + 1);
   int symlinknest = 0;
+  struct archelp_index *index;
 
   if (!name)
     return grub_errno;
 
   canonicalize (name);
 
+  index = index_get (data, arcops);
+  if (index)
+    {
+      grub_err_t err;
+
+      err = open_indexed (data, arcops, index, &name, name_in);
+      grub_free (name);
+      return err;
+    }
+
   while (1)
     {
       grub_uint32_t mode;
@@ -263,7 +649,7 @@ grub_archelp_open (struct grub_archelp_data *data,
 
       canonicalize (fn);
 
-      if (handle_symlink (data, arcops, fn, &name, mode, &restart))
+      if (handle_symlink (data, arcops, fn, &name, mode, &restart, NULL))
 	{
 	  grub_free (fn);
 	  goto fail;
@@ -25,8 +25,10 @@
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/lib/crc.h>
+#include <grub/crypto.h>
 #include <grub/deflate.h>
-#include <minilzo.h>
+#include <grub/zstd.h>
+#include <grub/lzo1x.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
 
@@ -88,6 +90,14 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* A chunk item with its stripes, for the logical range from START.  */
+struct grub_btrfs_chunk_map
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -98,6 +108,12 @@ struct grub_btrfs_data
   unsigned n_devices_attached;
   unsigned n_devices_allocated;
 
+  /* The chunks of the superblock and those looked up in the chunk tree so
+     far, sorted by logical address.  */
+  struct grub_btrfs_chunk_map *chunks;
+  unsigned n_chunks;
+  unsigned n_chunks_allocated;
+
   /* Cached extent data.  */
   grub_uint64_t extstart;
   grub_uint64_t extend;
@@ -105,6 +121,8 @@ struct grub_btrfs_data
   grub_uint64_t exttree;
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
+  /* The decompressed contents of the extent, once read.  */
+  char *extbuf;
 };
 
 struct grub_btrfs_chunk_item
@@ -119,6 +137,10 @@ struct grub_btrfs_chunk_item
 #define GRUB_BTRFS_CHUNK_TYPE_RAID1         0x10
 #define GRUB_BTRFS_CHUNK_TYPE_DUPLICATED    0x20
 #define GRUB_BTRFS_CHUNK_TYPE_RAID10        0x40
+#define GRUB_BTRFS_CHUNK_TYPE_RAID5         0x80
+#define GRUB_BTRFS_CHUNK_TYPE_RAID6         0x100
+#define GRUB_BTRFS_CHUNK_TYPE_RAID1C3       0x200
+#define GRUB_BTRFS_CHUNK_TYPE_RAID1C4       0x400
   grub_uint8_t dummy2[0xc];
   grub_uint16_t nstripes;
   grub_uint16_t nsubstripes;
@@ -212,6 +234,7 @@ struct grub_btrfs_extent_data
 #define GRUB_BTRFS_COMPRESSION_NONE 0
 #define GRUB_BTRFS_COMPRESSION_ZLIB 1
 #define GRUB_BTRFS_COMPRESSION_LZO  2
+#define GRUB_BTRFS_COMPRESSION_ZSTD 3
 
 #define GRUB_BTRFS_OBJECT_ID_CHUNK 0x100
 
@@ -606,15 +629,159 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
   return ctx.dev_found;
 }
 
+/* Return the chunk containing ADDR, if known.  */
+static struct grub_btrfs_chunk_map *
+chunk_map_find (struct grub_btrfs_data *data, grub_uint64_t addr)
+{
+  unsigned lo = 0, hi = data->n_chunks;
+
+  /* Find the last chunk starting at or before ADDR.  */
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (data->chunks[mid].start <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0
+      || addr - data->chunks[lo - 1].start >= data->chunks[lo - 1].size)
+    return NULL;
+  return &data->chunks[lo - 1];
+}
+
+/* Add CHUNK, of which the map takes ownership, for the range from START.  */
+static grub_err_t
+chunk_map_insert (struct grub_btrfs_data *data, grub_uint64_t start,
+		  struct grub_btrfs_chunk_item *chunk)
+{
+  unsigned i;
+
+  if (data->n_chunks == data->n_chunks_allocated)
+    {
+      struct grub_btrfs_chunk_map *tmp;
+      unsigned n = data->n_chunks_allocated ? : 8;
+
+      n *= 2;
+      tmp = grub_realloc (data->chunks, n * sizeof (data->chunks[0]));
+      if (!tmp)
+	return grub_errno;
+      data->chunks = tmp;
+      data->n_chunks_allocated = n;
+    }
+
+  for (i = data->n_chunks; i > 0 && data->chunks[i - 1].start > start; i--)
+    data->chunks[i] = data->chunks[i - 1];
+  data->chunks[i].start = start;
+  data->chunks[i].size = grub_le_to_cpu64 (chunk->size);
+  data->chunks[i].chunk = chunk;
+  data->n_chunks++;
+  return GRUB_ERR_NONE;
+}
+
+/* Put the chunks of the superblock in the map, which is enough to read the
+   chunk tree.  */
+static grub_err_t
+chunk_map_init (struct grub_btrfs_data *data)
+{
+  grub_uint8_t *ptr = data->sblock.bootstrap_mapping;
+  grub_uint8_t *end = ptr + sizeof (data->sblock.bootstrap_mapping);
+
+  while (ptr + sizeof (struct grub_btrfs_key)
+	 + sizeof (struct grub_btrfs_chunk_item) <= end)
+    {
+      struct grub_btrfs_key *key = (struct grub_btrfs_key *) ptr;
+      struct grub_btrfs_chunk_item *chunk, *copy;
+      grub_size_t chsize;
+      grub_err_t err;
+
+      if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+	break;
+      chunk = (struct grub_btrfs_chunk_item *) (key + 1);
+      chsize = sizeof (*chunk) + sizeof (struct grub_btrfs_chunk_stripe)
+	* grub_le_to_cpu16 (chunk->nstripes);
+      if ((grub_uint8_t *) chunk + chsize > end)
+	break;
+
+      copy = grub_malloc (chsize);
+      if (!copy)
+	return grub_errno;
+      grub_memcpy (copy, chunk, chsize);
+      err = chunk_map_insert (data, grub_le_to_cpu64 (key->offset), copy);
+      if (err)
+	{
+	  grub_free (copy);
+	  return err;
+	}
+      ptr += sizeof (*key) + chsize;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Rebuild the SIZE bytes at OFFSET of data stripe TARGET of row ROW of a
+   RAID5 or RAID6 chunk, which couldn't be read, from the other data stripes
+   and P.  */
+static grub_err_t
+raid_recover (struct grub_btrfs_data *data,
+	      struct grub_btrfs_chunk_item *chunk, unsigned nstripes,
+	      unsigned nparity, grub_uint64_t row, unsigned target,
+	      grub_uint64_t offset, grub_size_t size, void *buf)
+{
+  struct grub_btrfs_chunk_stripe *stripes;
+  grub_uint8_t *tmp;
+  unsigned i;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  grub_dprintf ("btrfs", "recovering data stripe %u of row %"
+		PRIxGRUB_UINT64_T "\n", target, row);
+
+  tmp = grub_malloc (size);
+  if (!tmp)
+    return grub_errno;
+  grub_memset (buf, 0, size);
+
+  stripes = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
+  for (i = 0; i <= nstripes - nparity; i++)
+    {
+      struct grub_btrfs_chunk_stripe *stripe;
+      grub_disk_addr_t paddr;
+      grub_uint64_t n;
+      grub_device_t dev;
+
+      if (i == target)
+	continue;
+      grub_divmod64 (row + i, nstripes, &n);
+      stripe = stripes + n;
+      paddr = grub_le_to_cpu64 (stripe->offset) + offset;
+
+      dev = find_device (data, stripe->device_id, 1);
+      if (!dev)
+	{
+	  err = grub_errno;
+	  break;
+	}
+      err = grub_disk_read (dev->disk, paddr >> GRUB_DISK_SECTOR_BITS,
+			    paddr & (GRUB_DISK_SECTOR_SIZE - 1), size, tmp);
+      if (err)
+	break;
+      grub_crypto_xor (buf, buf, tmp, size);
+    }
+
+  grub_free (tmp);
+  return err;
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
 {
   while (size > 0)
     {
-      grub_uint8_t *ptr;
-      struct grub_btrfs_key *key;
+      struct grub_btrfs_chunk_map *map;
       struct grub_btrfs_chunk_item *chunk;
+      grub_uint64_t chstart;
       grub_uint64_t csize;
       grub_err_t err = 0;
       struct grub_btrfs_key key_out;
@@ -626,26 +793,12 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
-      for (ptr = data->sblock.bootstrap_mapping;
-	   ptr < data->sblock.bootstrap_mapping
-	   + sizeof (data->sblock.bootstrap_mapping)
-	   - sizeof (struct grub_btrfs_key);)
+      map = chunk_map_find (data, addr);
+      if (map)
 	{
-	  key = (struct grub_btrfs_key *) ptr;
-	  if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
-	    break;
-	  chunk = (struct grub_btrfs_chunk_item *) (key + 1);
-	  grub_dprintf ("btrfs",
-			"%" PRIxGRUB_UINT64_T " %" PRIxGRUB_UINT64_T " \n",
-			grub_le_to_cpu64 (key->offset),
-			grub_le_to_cpu64 (chunk->size));
-	  if (grub_le_to_cpu64 (key->offset) <= addr
-	      && addr < grub_le_to_cpu64 (key->offset)
-	      + grub_le_to_cpu64 (chunk->size))
-	    goto chunk_found;
-	  ptr += sizeof (*key) + sizeof (*chunk)
-	    + sizeof (struct grub_btrfs_chunk_stripe)
-	    * grub_le_to_cpu16 (chunk->nstripes);
+	  chunk = map->chunk;
+	  chstart = map->start;
+	  goto chunk_found;
 	}
 
       key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
@@ -656,17 +809,16 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 &chaddr, &chsize, NULL, recursion_depth);
       if (err)
 	return err;
-      key = &key_out;
-      if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK
-	  || !(grub_le_to_cpu64 (key->offset) <= addr))
+      if (key_out.type != GRUB_BTRFS_ITEM_TYPE_CHUNK
+	  || !(grub_le_to_cpu64 (key_out.offset) <= addr))
 	return grub_error (GRUB_ERR_BAD_FS,
 			   "couldn't find the chunk descriptor");
+      chstart = grub_le_to_cpu64 (key_out.offset);
 
       chunk = grub_malloc (chsize);
       if (!chunk)
 	return grub_errno;
 
-      challoc = 1;
       err = grub_btrfs_read_logical (data, chaddr, chunk, chsize,
 				     recursion_depth);
       if (err)
@@ -675,19 +827,34 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  return err;
 	}
 
+      /* Keep it for the next reads from this chunk, unless it doesn't cover
+	 ADDR, which is reported below.  */
+      if (chsize < sizeof (*chunk)
+	  || addr - chstart >= grub_le_to_cpu64 (chunk->size)
+	  || chunk_map_insert (data, chstart, chunk) != GRUB_ERR_NONE)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  challoc = 1;
+	}
+
     chunk_found:
       {
 	grub_uint64_t stripen;
 	grub_uint64_t stripe_offset;
-	grub_uint64_t off = addr - grub_le_to_cpu64 (key->offset);
+	grub_uint64_t off = addr - chstart;
 	grub_uint64_t chunk_stripe_length;
 	grub_uint16_t nstripes;
 	unsigned redundancy = 1;
+	/* For RAID5 and RAID6.  */
+	unsigned nparity = 0, data_stripe = 0;
+	grub_uint64_t row = 0;
 	unsigned i, j;
 
 	if (grub_le_to_cpu64 (chunk->size) <= off)
 	  {
 	    grub_dprintf ("btrfs", "no chunk\n");
+	    if (challoc)
+	      grub_free (chunk);
 	    return grub_error (GRUB_ERR_BAD_FS,
 			       "couldn't find the chunk descriptor");
 	  }
@@ -698,7 +865,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		      "+0x%" PRIxGRUB_UINT64_T
 		      " (%d stripes (%d substripes) of %"
 		      PRIxGRUB_UINT64_T ")\n",
-		      grub_le_to_cpu64 (key->offset),
+		      chstart,
 		      grub_le_to_cpu64 (chunk->size),
 		      nstripes,
 		      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -730,6 +897,45 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	      redundancy = 2;
 	      break;
 	    }
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID1C3:
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID1C4:
+	    {
+	      grub_dprintf ("btrfs", "RAID1C%d\n", nstripes);
+	      stripen = 0;
+	      stripe_offset = off;
+	      csize = grub_le_to_cpu64 (chunk->size) - off;
+	      redundancy = nstripes;
+	      break;
+	    }
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID5:
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID6:
+	    {
+	      grub_uint64_t stripe_nr, low, d;
+
+	      nparity = (grub_le_to_cpu64 (chunk->type)
+			 & GRUB_BTRFS_CHUNK_TYPE_RAID5) ? 1 : 2;
+	      grub_dprintf ("btrfs", "RAID%d\n", nparity == 1 ? 5 : 6);
+	      if (nstripes <= nparity)
+		{
+		  if (challoc)
+		    grub_free (chunk);
+		  return grub_error (GRUB_ERR_BAD_FS, "too few RAID stripes");
+		}
+
+	      /* Each row holds NSTRIPES - NPARITY data stripes followed by
+		 P and, for RAID6, Q, rotated by one device every row:
+
+		   D0 D1 P  Q
+		   Q  D2 D3 P
+		   P  Q  D4 D5  */
+	      stripe_nr = grub_divmod64 (off, chunk_stripe_length, &low);
+	      row = grub_divmod64 (stripe_nr, nstripes - nparity, &d);
+	      data_stripe = d;
+	      grub_divmod64 (row + d, nstripes, &stripen);
+	      stripe_offset = chunk_stripe_length * row + low;
+	      csize = chunk_stripe_length - low;
+	      break;
+	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID0:
 	    {
 	      grub_uint64_t middle, high;
@@ -786,8 +992,8 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		grub_disk_addr_t paddr;
 
 		stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
-		/* Right now the redundancy handling is easy.
-		   With RAID5-like it will be more difficult.  */
+		/* Mirrors are consecutive stripes.  RAID5 and RAID6 have
+		   none and are rebuilt from the parity below.  */
 		stripe += stripen + i;
 
 		paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
@@ -797,7 +1003,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			      " (%d stripes (%d substripes) of %"
 			      PRIxGRUB_UINT64_T ") stripe %" PRIxGRUB_UINT64_T
 			      " maps to 0x%" PRIxGRUB_UINT64_T "\n",
-			      grub_le_to_cpu64 (key->offset),
+			      chstart,
 			      grub_le_to_cpu64 (chunk->size),
 			      grub_le_to_cpu16 (chunk->nstripes),
 			      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -825,6 +1031,9 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	    if (i != redundancy)
 	      break;
 	  }
+	if (err && nparity)
+	  err = raid_recover (data, chunk, nstripes, nparity, row, data_stripe,
+			      stripe_offset, csize, buf);
 	if (err)
 	  return grub_errno = err;
       }
@@ -837,6 +1046,22 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
   return GRUB_ERR_NONE;
 }
 
+static void
+grub_btrfs_unmount (struct grub_btrfs_data *data)
+{
+  unsigned i;
+  /* The device 0 is closed one layer upper.  */
+  for (i = 1; i < data->n_devices_attached; i++)
+    grub_device_close (data->devices_attached[i].dev);
+  grub_free (data->devices_attached);
+  for (i = 0; i < data->n_chunks; i++)
+    grub_free (data->chunks[i].chunk);
+  grub_free (data->chunks);
+  grub_free (data->extent);
+  grub_free (data->extbuf);
+  grub_free (data);
+}
+
 static struct grub_btrfs_data *
 grub_btrfs_mount (grub_device_t dev)
 {
@@ -872,20 +1097,16 @@ grub_btrfs_mount (grub_device_t dev)
   data->devices_attached[0].dev = dev;
   data->devices_attached[0].id = data->sblock.this_device.device_id;
 
+  err = chunk_map_init (data);
+  if (err)
+    {
+      grub_btrfs_unmount (data);
+      return NULL;
+    }
+
   return data;
 }
 
-static void
-grub_btrfs_unmount (struct grub_btrfs_data *data)
-{
-  unsigned i;
-  /* The device 0 is closed one layer upper.  */
-  for (i = 1; i < data->n_devices_attached; i++)
-    grub_device_close (data->devices_attached[i].dev);
-  grub_free (data->devices_attached);
-  grub_free (data->extent);
-  grub_free (data);
-}
 
 static grub_err_t
 grub_btrfs_read_inode (struct grub_btrfs_data *data,
@@ -945,7 +1166,7 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
 
   while (osize > 0)
     {
-      lzo_uint usize = GRUB_BTRFS_LZO_BLOCK_SIZE;
+      grub_ssize_t usize;
 
       /* Don't let following uint32_t cross the page boundary.  */
       if (((ibuf - ibuf0) & 0xffc) == 0xffc)
@@ -970,14 +1191,15 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
 	  if (!buf)
 	    return -1;
 
-	  if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, buf, &usize,
-	      NULL) != LZO_E_OK)
+	  usize = grub_lzo1x_decompress (ibuf, cblock_size, buf,
+					 GRUB_BTRFS_LZO_BLOCK_SIZE);
+	  if (usize < 0)
 	    {
 	      grub_free (buf);
 	      return -1;
 	    }
 
-	  if (to_copy > usize)
+	  if (to_copy > (grub_size_t) usize)
 	    to_copy = usize;
 	  grub_memcpy(obuf, buf + off, to_copy);
 
@@ -992,8 +1214,9 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
 	}
 
       /* Decompress whole block directly to output buffer.  */
-      if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)obuf,
-	  &usize, NULL) != LZO_E_OK)
+      usize = grub_lzo1x_decompress (ibuf, cblock_size, obuf,
+				     GRUB_BTRFS_LZO_BLOCK_SIZE);
+      if (usize < 0)
 	return -1;
 
       osize -= usize;
@@ -1024,6 +1247,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	  grub_size_t elemsize;
 
 	  grub_free (data->extent);
+	  grub_free (data->extbuf);
+	  data->extbuf = NULL;
 	  key_in.object_id = ino;
 	  key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
 	  key_in.offset = grub_cpu_to_le64 (pos);
@@ -1087,7 +1312,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
       if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
 	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZLIB
-	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO)
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZSTD)
 	{
 	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		      "compression type 0x%x not supported",
@@ -1127,6 +1353,20 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  != (grub_ssize_t) csize)
 		return -1;
 	    }
+	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+	    {
+	      if (grub_zstd_decompress (data->extent->inl, data->extsize -
+					((grub_uint8_t *) data->extent->inl
+					 - (grub_uint8_t *) data->extent),
+					extoff, buf, csize)
+		  != (grub_ssize_t) csize)
+		{
+		  if (!grub_errno)
+		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				"premature end of compressed");
+		  return -1;
+		}
+	    }
 	  else
 	    grub_memcpy (buf, data->extent->inl + extoff, csize);
 	  break;
@@ -1137,46 +1377,68 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	      break;
 	    }
 
-	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
+	  /* Decompress the whole extent the first time, rather than all of
+	     it up to the part wanted on every call.  */
+	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
+	      && !data->extbuf)
 	    {
 	      char *tmp;
 	      grub_uint64_t zsize;
+	      grub_size_t extlen = data->extend - data->extstart;
 	      grub_ssize_t ret;
 
 	      zsize = grub_le_to_cpu64 (data->extent->compressed_size);
 	      tmp = grub_malloc (zsize);
 	      if (!tmp)
 		return -1;
+	      data->extbuf = grub_malloc (extlen);
+	      if (!data->extbuf)
+		{
+		  grub_free (tmp);
+		  return -1;
+		}
 	      err = grub_btrfs_read_logical (data,
 					     grub_le_to_cpu64 (data->extent->laddr),
 					     tmp, zsize, 0);
 	      if (err)
 		{
 		  grub_free (tmp);
+		  grub_free (data->extbuf);
+		  data->extbuf = NULL;
 		  return -1;
 		}
 
 	      if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-		ret = grub_zlib_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		ret = grub_zlib_decompress (tmp, zsize,
+				    grub_le_to_cpu64 (data->extent->offset),
+				    data->extbuf, extlen);
 	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		ret = grub_btrfs_lzo_decompress (tmp, zsize,
+				    grub_le_to_cpu64 (data->extent->offset),
+				    data->extbuf, extlen);
+	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+		ret = grub_zstd_decompress (tmp, zsize,
+				    grub_le_to_cpu64 (data->extent->offset),
+				    data->extbuf, extlen);
 	      else
 		ret = -1;
 
 	      grub_free (tmp);
 
-	      if (ret != (grub_ssize_t) csize)
+	      if (ret != (grub_ssize_t) extlen)
 		{
+		  grub_free (data->extbuf);
+		  data->extbuf = NULL;
 		  if (!grub_errno)
 		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 				"premature end of compressed");
 		  return -1;
 		}
+	    }
 
+	  if (data->extbuf)
+	    {
+	      grub_memcpy (buf, data->extbuf + extoff, csize);
 	      break;
 	    }
 	  err = grub_btrfs_read_logical (data,
@@ -1766,6 +2028,8 @@ static struct grub_fs grub_btrfs_fs = {
 
 GRUB_MOD_INIT (btrfs)
 {
+  /* GRUB_BTRFS_SIGNATURE in the first superblock.  */
+  GRUB_FS_SIGNATURE (65600, "5f42485266535f4d");
   grub_fs_register (&grub_btrfs_fs);
 }
 
@@ -332,10 +332,22 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+
+  /* Set once DIROPEN is the opened file, whose extent tree leaf last used
+     is then kept in EXTENTS.  */
+  int cache_extents;
+  struct grub_ext4_extent *extents;
+  int n_extents;
+
+  /* The root directory inode, to turn DIROPEN back into the root when the
+     mount is given back to the mount cache.  */
+  struct grub_ext2_inode root_inode;
 };
 
 static grub_dl_t my_mod;
 
+static struct grub_fs grub_ext2_fs;
+
 
 
 /* Check is a = b^x for some x.  */
@@ -451,8 +463,52 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Look FILEBLOCK up in the N extents EXT of a leaf.  Return 0 if the leaf
+   doesn't tell, for blocks before its first extent or after its last one.
+   Otherwise store in *BLOCK the disk block, 0 for a hole, and in *RUN how
+   many blocks are alike from there on.  */
+static int
+grub_ext4_lookup_extent (const struct grub_ext4_extent *ext, int n,
+			 grub_uint32_t fileblock, grub_disk_addr_t *block,
+			 grub_disk_addr_t *run)
+{
+  int lo = 0, hi = n;
+  grub_uint32_t off;
+
+  /* Find the last extent starting at or before FILEBLOCK.  */
+  while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+
+      if (grub_le_to_cpu32 (ext[mid].block) <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0)
+    return 0;
+
+  ext += lo - 1;
+  off = fileblock - grub_le_to_cpu32 (ext->block);
+  if (off < grub_le_to_cpu16 (ext->len))
+    {
+      *block = grub_le_to_cpu16 (ext->start_hi);
+      *block = (*block << 32) + grub_le_to_cpu32 (ext->start) + off;
+      *run = grub_le_to_cpu16 (ext->len) - off;
+      return 1;
+    }
+
+  /* A hole up to the next extent.  */
+  if (lo == n)
+    return 0;
+  *block = 0;
+  *run = grub_le_to_cpu32 (ext[1].block) - fileblock;
+  return 1;
+}
+
 static grub_disk_addr_t
-grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *run)
 {
   struct grub_ext2_data *data = node->data;
   struct grub_ext2_inode *inode = &node->inode;
@@ -463,13 +519,20 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   grub_uint32_t indir;
   int shift;
 
+  *run = 1;
+
   if (inode->flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
     {
       struct grub_ext4_extent_header *leaf;
       struct grub_ext4_extent *ext;
-      int i;
+      int cache = data->cache_extents && node == &data->diropen;
       grub_disk_addr_t ret;
 
+      if (cache && data->extents
+	  && grub_ext4_lookup_extent (data->extents, data->n_extents,
+				      fileblock, &ret, run))
+	return ret;
+
       leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
       if (! leaf)
         {
@@ -478,32 +541,35 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
         }
 
       ext = (struct grub_ext4_extent *) (leaf + 1);
-      for (i = 0; i < grub_le_to_cpu16 (leaf->entries); i++)
-        {
-          if (fileblock < grub_le_to_cpu32 (ext[i].block))
-            break;
-        }
-
-      if (--i >= 0)
+      if (! grub_ext4_lookup_extent (ext, grub_le_to_cpu16 (leaf->entries),
+				     fileblock, &ret, run))
         {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
+	  if (grub_le_to_cpu16 (leaf->entries)
+	      && fileblock >= grub_le_to_cpu32 (ext[0].block))
+	    /* Past the last extent.  */
 	    ret = 0;
-          else
-            {
-              grub_disk_addr_t start;
+	  else
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
+	      ret = -1;
+	    }
+        }
 
-              start = grub_le_to_cpu16 (ext[i].start_hi);
-              start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
+      /* Keep the leaf for the next blocks of the open file.  */
+      if (cache && ret != (grub_disk_addr_t) -1)
+	{
+	  grub_size_t size = grub_le_to_cpu16 (leaf->entries) * sizeof (*ext);
 
-              ret = fileblock + start;
-            }
-        }
-      else
-        {
-          grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
-	  ret = -1;
-        }
+	  grub_free (data->extents);
+	  data->extents = grub_malloc (size ? : 1);
+	  if (data->extents)
+	    {
+	      grub_memcpy (data->extents, ext, size);
+	      data->n_extents = grub_le_to_cpu16 (leaf->entries);
+	    }
+	  else
+	    grub_errno = GRUB_ERR_NONE;
+	}
 
       if (leaf != (struct grub_ext4_extent_header *) inode->blocks.dir_blocks)
 	grub_free (leaf);
@@ -568,12 +634,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_runs (node->data->disk, node,
+				     read_hook, read_hook_data,
+				     pos, len, buf, grub_ext2_read_block,
+				     grub_cpu_to_le32 (node->inode.size)
+				     | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+				     LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -625,6 +691,13 @@ grub_ext2_mount (grub_disk_t disk)
 {
   struct grub_ext2_data *data;
 
+  data = grub_fs_mount_cache_get (&grub_ext2_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   data = grub_malloc (sizeof (struct grub_ext2_data));
   if (!data)
     return 0;
@@ -678,12 +751,15 @@ grub_ext2_mount (grub_disk_t disk)
   data->diropen.data = data;
   data->diropen.ino = 2;
   data->diropen.inode_read = 1;
+  data->cache_extents = 0;
+  data->extents = NULL;
 
   data->inode = &data->diropen.inode;
 
   grub_ext2_read_inode (data, 2, data->inode);
   if (grub_errno)
     goto fail;
+  data->root_inode = *data->inode;
 
   return data;
 
@@ -695,6 +771,29 @@ grub_ext2_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_ext2_free (void *data)
+{
+  grub_free (data);
+}
+
+/* Give DATA back to the mount cache once the operation is done.  */
+static void
+grub_ext2_unmount (struct grub_ext2_data *data)
+{
+  if (! data)
+    return;
+
+  grub_free (data->extents);
+  data->extents = NULL;
+  data->cache_extents = 0;
+  data->diropen.ino = 2;
+  data->diropen.inode_read = 1;
+  *data->inode = data->root_inode;
+
+  grub_fs_mount_cache_put (&grub_ext2_fs, data->disk, data, grub_ext2_free);
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -829,6 +928,48 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+static grub_uint64_t
+grub_ext2_node_key (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static grub_fshelp_node_t
+grub_ext2_key_node (grub_fshelp_node_t dir, grub_uint64_t key)
+{
+  struct grub_fshelp_node *node;
+
+  node = grub_malloc (sizeof (*node));
+  if (! node)
+    return 0;
+  node->data = dir->data;
+  node->ino = key;
+  node->inode_read = 0;
+  return node;
+}
+
+/* Look PATH up like grub_fshelp_find_file, remembering the names found.  */
+static grub_err_t
+grub_ext2_find_file (struct grub_ext2_data *data, const char *path,
+		     struct grub_fshelp_node **found,
+		     enum grub_fshelp_filetype expect)
+{
+  struct grub_fshelp_dcache dcache = {
+    .disk = data->disk,
+    .fs_id = ((grub_uint64_t) data->sblock.uuid[0]
+	      | (grub_uint64_t) data->sblock.uuid[1] << 16
+	      | (grub_uint64_t) data->sblock.uuid[2] << 32
+	      | (grub_uint64_t) data->sblock.uuid[3] << 48),
+    .node_key = grub_ext2_node_key,
+    .key_node = grub_ext2_key_node
+  };
+
+  return grub_fshelp_find_file_cached (path, &data->diropen, found,
+				       grub_ext2_iterate_dir,
+				       grub_ext2_read_symlink, expect,
+				       &dcache);
+}
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -846,9 +987,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_ext2_find_file (data, name, &fdiro, GRUB_FSHELP_REG);
   if (err)
     goto fail;
 
@@ -860,6 +999,8 @@ grub_ext2_open (struct grub_file *file, const char *name)
     }
 
   grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
+  data->diropen.ino = fdiro->ino;
+  data->cache_extents = 1;
   grub_free (fdiro);
 
   file->size = grub_le_to_cpu32 (data->inode->size);
@@ -872,7 +1013,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -882,7 +1023,9 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  struct grub_ext2_data *data = file->data;
+
+  grub_ext2_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -952,9 +1095,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_ext2_find_file (ctx.data, path, &fdiro, GRUB_FSHELP_DIR);
   if (grub_errno)
     goto fail;
 
@@ -963,7 +1104,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_unmount (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -985,9 +1126,9 @@ grub_ext2_label (grub_device_t device, char **label)
   else
     *label = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1016,9 +1157,9 @@ grub_ext2_uuid (grub_device_t device, char **uuid)
   else
     *uuid = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1038,9 +1179,9 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
   else
     *tm = grub_le_to_cpu32 (data->sblock.utime);
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 
@@ -1067,6 +1208,8 @@ static struct grub_fs grub_ext2_fs =
 
 GRUB_MOD_INIT(ext2)
 {
+  /* EXT2_MAGIC in the superblock at 1024.  */
+  GRUB_FS_SIGNATURE (1080, "53ef");
   grub_fs_register (&grub_ext2_fs);
   my_mod = mod;
 }
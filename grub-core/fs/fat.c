@@ -113,6 +113,13 @@ struct grub_fat_dir_entry
       grub_uint8_t character_count;
       grub_uint16_t str[15];
     }  GRUB_PACKED  volume_label;
+    struct {
+      grub_uint8_t reserved1[3];
+      grub_uint32_t checksum;
+      grub_uint8_t reserved2[12];
+      grub_uint32_t first_cluster;
+      grub_uint64_t data_length;
+    }  GRUB_PACKED  upcase_table;
   }  GRUB_PACKED type_specific;
 } GRUB_PACKED;
 
@@ -122,6 +129,7 @@ struct grub_fat_dir_node
   grub_uint32_t first_cluster;
   grub_uint64_t file_size;
   grub_uint64_t valid_size;
+  grub_uint16_t name_hash;
   int have_stream;
   int is_contiguous;
 };
@@ -182,6 +190,22 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+#ifdef MODE_EXFAT
+  /* The up-case table expanded to one entry per UTF-16 unit, loaded on
+     the first lookup.  */
+  grub_uint16_t *upcase;
+  int no_upcase;
+#endif
+};
+
+/* COUNT clusters of a file, from its logical cluster LOGICAL on, that follow
+   each other on disk from CLUSTER on.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t count;
 };
 
 struct grub_fshelp_node {
@@ -197,6 +221,14 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  /* Set for the opened file, whose cluster chain is then mapped in RUNS as
+     far as it has been followed.  */
+  int cache_runs;
+  int runs_complete;
+  struct grub_fat_run *runs;
+  grub_uint32_t n_runs;
+  grub_uint32_t n_runs_allocated;
 };
 
 static grub_dl_t my_mod;
@@ -230,7 +262,7 @@ grub_fat_mount (grub_disk_t disk)
   if (! disk)
     goto fail;
 
-  data = (struct grub_fat_data *) grub_malloc (sizeof (*data));
+  data = (struct grub_fat_data *) grub_zalloc (sizeof (*data));
   if (! data)
     goto fail;
 
@@ -444,6 +476,207 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_fat_unmount (struct grub_fat_data *data)
+{
+  if (!data)
+    return;
+#ifdef MODE_EXFAT
+  grub_free (data->upcase);
+#endif
+  grub_free (data);
+}
+
+/* Store in *NEXT the cluster that follows CLUSTER in the FAT.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t next_cluster;
+  grub_uint32_t fat_offset;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+
+  /* Read the FAT.  */
+  if (grub_disk_read (disk, data->fat_sector, fat_offset,
+		      (data->fat_size + 7) >> 3,
+		      (char *) &next_cluster))
+    return grub_errno;
+
+  next_cluster = grub_le_to_cpu32 (next_cluster);
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, next_cluster);
+
+  *next = next_cluster;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_fat_add_run (grub_fshelp_node_t node, grub_uint32_t logical,
+		  grub_uint32_t cluster)
+{
+  struct grub_fat_run *run;
+
+  if (cluster < 2 || cluster >= node->data->num_clusters)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", cluster);
+
+  if (node->n_runs == node->n_runs_allocated)
+    {
+      grub_size_t n = node->n_runs_allocated ? node->n_runs_allocated * 2 : 8;
+
+      if (n > GRUB_SIZE_MAX / sizeof (*run))
+	return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      run = grub_realloc (node->runs, n * sizeof (*run));
+      if (!run)
+	return grub_errno;
+      node->runs = run;
+      node->n_runs_allocated = n;
+    }
+
+  run = &node->runs[node->n_runs++];
+  run->logical = logical;
+  run->cluster = cluster;
+  run->count = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Follow the cluster chain of NODE until its map covers logical cluster
+   LAST, and on while the clusters stay contiguous, so that each run can be
+   read at once.  */
+static grub_err_t
+grub_fat_map_runs (grub_disk_t disk, grub_fshelp_node_t node,
+		   grub_uint32_t last)
+{
+  int extending = 1;
+
+  if (node->n_runs == 0 && grub_fat_add_run (node, 0, node->file_cluster))
+    return grub_errno;
+
+  while (!node->runs_complete)
+    {
+      struct grub_fat_run *run = &node->runs[node->n_runs - 1];
+      grub_uint32_t end = run->logical + run->count;
+      grub_uint32_t next;
+
+      if (end > last && !extending)
+	break;
+
+      if (grub_fat_next_cluster (disk, node->data,
+				 run->cluster + run->count - 1, &next))
+	return grub_errno;
+
+      /* Check the end.  */
+      if (next >= node->data->cluster_eof_mark)
+	node->runs_complete = 1;
+      else if (next == run->cluster + run->count
+	       && next < node->data->num_clusters)
+	run->count++;
+      else
+	{
+	  if (grub_fat_add_run (node, end, next))
+	    return grub_errno;
+	  extending = 0;
+	}
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Read through the cluster map of NODE, one disk read per run.  */
+static grub_ssize_t
+grub_fat_read_runs (grub_disk_t disk, grub_fshelp_node_t node,
+		    grub_disk_read_hook_t read_hook, void *read_hook_data,
+		    grub_off_t offset, grub_size_t len, char *buf)
+{
+  unsigned logical_cluster_bits = (node->data->cluster_bits
+				   + GRUB_DISK_SECTOR_BITS);
+  grub_uint32_t logical_cluster = offset >> logical_cluster_bits;
+  grub_uint32_t last = (offset + len - 1) >> logical_cluster_bits;
+  grub_ssize_t ret = 0;
+
+  offset &= (1ULL << logical_cluster_bits) - 1;
+
+  while (len)
+    {
+      struct grub_fat_run *run;
+      grub_uint32_t lo = 0, hi;
+      grub_uint64_t size;
+      grub_disk_addr_t sector;
+
+      run = node->n_runs ? &node->runs[node->n_runs - 1] : NULL;
+      if (!run || logical_cluster >= run->logical + run->count)
+	{
+	  if (grub_fat_map_runs (disk, node, last))
+	    return -1;
+	  run = &node->runs[node->n_runs - 1];
+	  if (logical_cluster >= run->logical + run->count)
+	    return ret;
+	}
+
+      /* Find the run holding LOGICAL_CLUSTER.  */
+      hi = node->n_runs;
+      while (hi - lo > 1)
+	{
+	  grub_uint32_t mid = lo + (hi - lo) / 2;
+
+	  if (node->runs[mid].logical <= logical_cluster)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+      run = &node->runs[lo];
+
+      sector = (node->data->cluster_sector
+		+ ((grub_disk_addr_t) (run->cluster - 2
+				       + logical_cluster - run->logical)
+		   << node->data->cluster_bits));
+      size = ((grub_uint64_t) (run->logical + run->count - logical_cluster)
+	      << logical_cluster_bits) - offset;
+      if (size > len)
+	size = len;
+
+      disk->read_hook = read_hook;
+      disk->read_hook_data = read_hook_data;
+      grub_disk_read (disk, sector, offset, size, buf);
+      disk->read_hook = 0;
+      if (grub_errno)
+	return -1;
+
+      len -= size;
+      buf += size;
+      ret += size;
+      logical_cluster += (offset + size) >> logical_cluster_bits;
+      offset = (offset + size) & ((1ULL << logical_cluster_bits) - 1);
+    }
+
+  return ret;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -491,6 +724,10 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
     }
 #endif
 
+  if (node->cache_runs)
+    return grub_fat_read_runs (disk, node, read_hook, read_hook_data,
+			       offset, len, buf);
+
   /* Calculate the logical cluster number and offset.  */
   logical_cluster_bits = (node->data->cluster_bits
 			  + GRUB_DISK_SECTOR_BITS);
@@ -509,45 +746,11 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 	{
 	  /* Find next cluster.  */
 	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
 
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
-
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
 	    return -1;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
 	  /* Check the end.  */
 	  if (next_cluster >= node->data->cluster_eof_mark)
 	    return ret;
@@ -598,12 +801,21 @@ struct grub_fat_iterate_context
   char *filename;
   grub_uint16_t *unibuf;
   grub_ssize_t offset;
+#ifdef MODE_EXFAT
+  /* When set, only the names of entries whose name hash is HASH are
+     decoded.  */
+  int use_hash;
+  grub_uint16_t hash;
+#endif
 };
 
 static grub_err_t
 grub_fat_iterate_init (struct grub_fat_iterate_context *ctxt)
 {
   ctxt->offset = -sizeof (struct grub_fat_dir_entry);
+#ifdef MODE_EXFAT
+  ctxt->use_hash = 0;
+#endif
 
 #ifndef MODE_EXFAT
   /* Allocate space enough to hold a long name.  */
@@ -655,6 +867,7 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
       if (dir.entry_type == 0x85)
 	{
 	  unsigned i, nsec, slots = 0;
+	  int skip_name = 0;
 
 	  nsec = dir.type_specific.file.secondary_count;
 
@@ -683,8 +896,13 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 		  ctxt->dir.have_stream = 1;
 		  ctxt->dir.is_contiguous = !!(sec.type_specific.stream_extension.flags
 					       & grub_cpu_to_le16_compile_time (FLAG_CONTIGUOUS));
+		  ctxt->dir.name_hash
+		    = grub_le_to_cpu16 (sec.type_specific.stream_extension.name_hash);
+		  skip_name = ctxt->use_hash && ctxt->dir.name_hash != ctxt->hash;
 		  break;
 		case 0xc1:
+		  if (skip_name)
+		    break;
 		  {
 		    int j;
 		    for (j = 0; j < 15; j++)
@@ -705,8 +923,11 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 	      continue;
 	    }
 
-	  *grub_utf16_to_utf8 ((grub_uint8_t *) ctxt->filename, ctxt->unibuf,
-			       slots * 15) = '\0';
+	  if (skip_name)
+	    ctxt->filename[0] = '\0';
+	  else
+	    *grub_utf16_to_utf8 ((grub_uint8_t *) ctxt->filename, ctxt->unibuf,
+				 slots * 15) = '\0';
 
 	  return 0;
 	}
@@ -854,6 +1075,137 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 
 #endif
 
+#ifdef MODE_EXFAT
+/* Load the up-case table of the volume of NODE into DATA->upcase.  It is
+   only used when it folds ASCII like grub_strcasecmp does.  */
+static grub_err_t
+grub_exfat_load_upcase (grub_fshelp_node_t node)
+{
+  struct grub_fat_data *data = node->data;
+  struct grub_fat_dir_entry dir;
+  grub_off_t offset;
+  grub_uint64_t size;
+  grub_uint16_t *raw;
+  grub_uint32_t i, n, c;
+  struct grub_fshelp_node root = {
+    .data = data,
+    .disk = node->disk,
+    .attr = GRUB_FAT_ATTR_DIRECTORY,
+    .file_size = 0,
+    .file_cluster = data->root_cluster,
+    .cur_cluster_num = ~0U,
+    .cur_cluster = 0,
+    .is_contiguous = 0,
+  };
+  struct grub_fshelp_node table = root;
+
+  for (offset = 0; ; offset += sizeof (dir))
+    {
+      if (grub_fat_read_data (node->disk, &root, 0, 0, offset, sizeof (dir),
+			      (char *) &dir) != sizeof (dir)
+	  || dir.entry_type == 0)
+	return grub_errno ? : grub_error (GRUB_ERR_BAD_FS,
+					  "no up-case table");
+      if (dir.entry_type == 0x82)
+	break;
+    }
+
+  size = grub_le_to_cpu64 (dir.type_specific.upcase_table.data_length);
+  if (size == 0 || size > 0x10000 * sizeof (grub_uint16_t) || (size & 1))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid up-case table");
+
+  table.attr = 0;
+  table.file_size = size;
+  table.file_cluster
+    = grub_le_to_cpu32 (dir.type_specific.upcase_table.first_cluster);
+
+  raw = grub_malloc (size);
+  if (!raw)
+    return grub_errno;
+  if (grub_fat_read_data (node->disk, &table, 0, 0, 0, size, (char *) raw)
+      != (grub_ssize_t) size)
+    {
+      grub_free (raw);
+      return grub_errno ? : grub_error (GRUB_ERR_BAD_FS,
+					"invalid up-case table");
+    }
+
+  data->upcase = grub_malloc (0x10000 * sizeof (grub_uint16_t));
+  if (!data->upcase)
+    {
+      grub_free (raw);
+      return grub_errno;
+    }
+
+  for (c = 0; c < 0x10000; c++)
+    data->upcase[c] = c;
+  /* 0xffff followed by a count stands for a run of characters which are
+     their own upper case.  */
+  for (i = 0, c = 0, n = size / 2; i < n && c < 0x10000; i++)
+    {
+      grub_uint16_t v = grub_le_to_cpu16 (raw[i]);
+
+      if (v == 0xffff && i + 1 < n)
+	c += grub_le_to_cpu16 (raw[++i]);
+      else
+	data->upcase[c++] = v;
+    }
+  grub_free (raw);
+
+  for (c = 0; c < 0x80; c++)
+    if (data->upcase[c] != (grub_uint16_t) grub_toupper (c))
+      {
+	grub_free (data->upcase);
+	data->upcase = NULL;
+	return grub_error (GRUB_ERR_BAD_FS, "unusual up-case table");
+      }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Compute in *HASH the name hash that an entry named NAME has in the
+   stream extension.  Return 0 on success or -1 when the hash can't be
+   used to rule out entries.  */
+static int
+grub_exfat_name_hash (grub_fshelp_node_t node, const char *name,
+		      grub_uint16_t *hash)
+{
+  struct grub_fat_data *data = node->data;
+  grub_uint16_t utf16[256];
+  const grub_uint8_t *end;
+  grub_size_t len, i;
+  grub_uint16_t h = 0;
+
+  if (!data->upcase && !data->no_upcase && grub_exfat_load_upcase (node))
+    {
+      grub_dprintf ("exfat", "not using name hashes: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      data->no_upcase = 1;
+    }
+  if (!data->upcase)
+    return -1;
+
+  /* Names which can't be converted, such as invalid UTF-8 or names with
+     unpaired surrogates that read back as '?', compare by their bytes.  */
+  if (grub_strchr (name, '?'))
+    return -1;
+  len = grub_utf8_to_utf16 (utf16, ARRAY_SIZE (utf16),
+			    (const grub_uint8_t *) name, -1, &end);
+  if (end[-1] != '\0' || len > 255)
+    return -1;
+
+  for (i = 0; i < len; i++)
+    {
+      grub_uint16_t c = data->upcase[utf16[i]];
+
+      h = ((h << 15) | (h >> 1)) + (c & 0xff);
+      h = ((h << 15) | (h >> 1)) + (c >> 8);
+    }
+  *hash = h;
+  return 0;
+}
+#endif
+
 static grub_err_t lookup_file (grub_fshelp_node_t node,
 			       const char *name,
 			       grub_fshelp_node_t *foundnode,
@@ -866,12 +1218,19 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
   if (err)
     return err;
 
+#ifdef MODE_EXFAT
+  if (grub_exfat_name_hash (node, name, &ctxt.hash) == 0)
+    ctxt.use_hash = 1;
+#endif
+
   while (!(err = grub_fat_iterate_dir_next (node, &ctxt)))
     {
 
 #ifdef MODE_EXFAT
       if (!ctxt.dir.have_stream)
 	continue;
+      if (ctxt.use_hash && ctxt.dir.name_hash != ctxt.hash)
+	continue;
 #else
       if (ctxt.dir.attr & GRUB_FAT_ATTR_VOLUME_ID)
 	continue;
@@ -896,6 +1255,11 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
 	  (*foundnode)->cur_cluster_num = ~0U;
+	  (*foundnode)->cache_runs = 0;
+	  (*foundnode)->runs_complete = 0;
+	  (*foundnode)->runs = NULL;
+	  (*foundnode)->n_runs = 0;
+	  (*foundnode)->n_runs_allocated = 0;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -977,7 +1341,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1015,6 +1379,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (err)
     goto fail;
 
+  found->cache_runs = 1;
   file->data = found;
   file->size = found->file_size;
 
@@ -1025,7 +1390,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1045,7 +1410,8 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
-  grub_free (node->data);
+  grub_free (node->runs);
+  grub_fat_unmount (node->data);
   grub_free (node);
 
   grub_dl_unref (my_mod);
@@ -1101,7 +1467,7 @@ grub_fat_label (grub_device_t device, char **label)
 				* GRUB_MAX_UTF8_PER_UTF16 + 1);
 	  if (!*label)
 	    {
-	      grub_free (root.data);
+	      grub_fat_unmount (root.data);
 	      return grub_errno;
 	    }
 	  chc = dir.type_specific.volume_label.character_count;
@@ -1113,7 +1479,7 @@ grub_fat_label (grub_device_t device, char **label)
 	}
     }
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
   return grub_errno;
 }
 
@@ -1160,7 +1526,7 @@ grub_fat_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
 
   return grub_errno;
 }
@@ -1190,7 +1556,7 @@ grub_fat_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   return grub_errno;
 }
@@ -1213,7 +1579,7 @@ grub_disk_addr_t
 
   *sec_per_lcn = 1ULL << data->cluster_bits;
 
-  grub_free (data);
+  grub_fat_unmount (data);
   return ret;
 }
 #endif
@@ -1250,6 +1616,10 @@ GRUB_MOD_INIT(fat)
 #endif
 {
   COMPILE_TIME_ASSERT (sizeof (struct grub_fat_dir_entry) == 32);
+#ifdef MODE_EXFAT
+  /* "EXFAT" OEM name.  FAT has no signature of its own.  */
+  GRUB_FS_SIGNATURE (3, "4558464154");
+#endif
   grub_fs_register (&grub_fat_fs);
   my_mod = mod;
 }
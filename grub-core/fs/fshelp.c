@@ -21,6 +21,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
@@ -54,8 +55,84 @@ struct grub_fshelp_find_file_ctx
 
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
+
+  /* How to remember the names looked up, if they are.  */
+  const struct grub_fshelp_dcache *dcache;
+};
+
+/* Number of names remembered by grub_fshelp_find_file_cached, must be a
+   power of 2.  */
+#define DCACHE_SIZE	512
+
+/* The result of looking NAME up in the directory DIR of a filesystem.  */
+struct dcache_entry
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t fs_id;
+  grub_uint64_t (*node_key) (grub_fshelp_node_t node);
+  grub_uint64_t dir;
+  /* NULL if the entry is unused.  */
+  char *name;
+  int found;
+  grub_uint64_t child;
+  enum grub_fshelp_filetype type;
 };
 
+static struct dcache_entry dcache_table[DCACHE_SIZE];
+
+/* The value of grub_disk_cache_generation the entries were made with.  */
+static unsigned long dcache_generation;
+
+static void
+dcache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      grub_free (dcache_table[i].name);
+      dcache_table[i].name = NULL;
+    }
+}
+
+/* Return the entry NAME in the directory with the key DIR belongs in.  */
+static struct dcache_entry *
+dcache_slot (const struct grub_fshelp_dcache *dc, grub_uint64_t dir,
+	     const char *name)
+{
+  grub_uint32_t hash = 2166136261U;
+  const char *ptr;
+
+  if (dcache_generation != grub_disk_cache_generation)
+    {
+      dcache_flush ();
+      dcache_generation = grub_disk_cache_generation;
+    }
+
+  for (ptr = name; *ptr; ptr++)
+    hash = (hash ^ (grub_uint8_t) *ptr) * 16777619;
+  hash ^= (grub_uint32_t) dir ^ (grub_uint32_t) (dir >> 32);
+  hash ^= (grub_uint32_t) dc->disk->id * 31 + dc->disk->dev->id;
+  hash *= 16777619;
+  return &dcache_table[(hash ^ (hash >> 16)) & (DCACHE_SIZE - 1)];
+}
+
+static int
+dcache_match (const struct dcache_entry *e,
+	      const struct grub_fshelp_dcache *dc, grub_uint64_t dir,
+	      const char *name)
+{
+  return (e->name && e->dir == dir
+	  && e->node_key == dc->node_key
+	  && e->fs_id == dc->fs_id
+	  && e->dev_id == dc->disk->dev->id
+	  && e->disk_id == dc->disk->id
+	  && e->part_start == grub_partition_get_start (dc->disk->partition)
+	  && grub_strcmp (e->name, name) == 0);
+}
+
 /* Helper for find_file_iter.  */
 static void
 free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_ctx *ctx)
@@ -158,6 +235,69 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+/* Look NAME up in the current directory, through the cache if there is
+   one.  FOUNDNODE is left NULL if there is no such file.  */
+static grub_err_t
+lookup_name (const char *name, grub_fshelp_node_t *foundnode,
+	     enum grub_fshelp_filetype *foundtype,
+	     iterate_dir_func iterate_dir, lookup_file_func lookup_file,
+	     struct grub_fshelp_find_file_ctx *ctx)
+{
+  grub_fshelp_node_t dir = ctx->currnode->node;
+  const struct grub_fshelp_dcache *dc = ctx->dcache;
+  struct dcache_entry *e = NULL;
+  grub_uint64_t key = 0;
+  grub_err_t err;
+  char *name_copy;
+
+  if (dc)
+    {
+      key = dc->node_key (dir);
+      e = dcache_slot (dc, key, name);
+      if (dcache_match (e, dc, key, name))
+	{
+	  if (!e->found)
+	    return GRUB_ERR_NONE;
+	  *foundnode = dc->key_node (dir, e->child);
+	  if (!*foundnode)
+	    return grub_errno;
+	  *foundtype = e->type;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (lookup_file)
+    err = lookup_file (dir, name, foundnode, foundtype);
+  else
+    err = directory_find_file (dir, name, foundnode, foundtype, iterate_dir);
+  if (err || !e)
+    return err;
+
+  /* Remembering the name is only an optimisation, so running out of memory
+     for it is not an error.  */
+  name_copy = grub_strdup (name);
+  if (!name_copy)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  grub_free (e->name);
+  e->dev_id = dc->disk->dev->id;
+  e->disk_id = dc->disk->id;
+  e->part_start = grub_partition_get_start (dc->disk->partition);
+  e->fs_id = dc->fs_id;
+  e->node_key = dc->node_key;
+  e->dir = key;
+  e->name = name_copy;
+  e->found = (*foundnode != NULL);
+  if (e->found)
+    {
+      e->child = dc->node_key (*foundnode);
+      e->type = *foundtype;
+    }
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -202,10 +342,8 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
-      else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+      err = lookup_name (name, &foundnode, &foundtype,
+			 iterate_dir, lookup_file, ctx);
       *next = c;
 
       if (err)
@@ -264,13 +402,15 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    const struct grub_fshelp_dcache *dcache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
-    .currnode = 0
+    .currnode = 0,
+    .dcache = dcache
   };
   grub_err_t err;
   enum grub_fshelp_filetype foundtype;
@@ -327,8 +467,21 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
+
+}
 
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      const struct grub_fshelp_dcache *dcache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, NULL,
+				     read_symlink, expecttype, dcache);
 }
 
 grub_err_t
@@ -340,27 +493,46 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
 
 }
 
-/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
-   beginning with the block POS.  READ_HOOK should be set before
-   reading a block from the file.  READ_HOOK_DATA is passed through as
-   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
-grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+/* Map BLOCK of NODE with whichever callback the filesystem has.  */
+static grub_disk_addr_t
+map_blocks (grub_fshelp_node_t node, grub_disk_addr_t block,
+	    grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					   grub_disk_addr_t block),
+	    grub_disk_addr_t (*get_run) (grub_fshelp_node_t node,
+					 grub_disk_addr_t block,
+					 grub_disk_addr_t *run),
+	    grub_disk_addr_t *run)
+{
+  *run = 1;
+  if (get_run)
+    return get_run (node, block, run);
+  return get_block (node, block);
+}
+
+/* Read the file with one disk read per stretch of blocks that follow each
+   other on disk, however the filesystem reports them.  The blocks are
+   mapped in order and each of them once, as some filesystems expect.  */
+static grub_ssize_t
+read_file_real (grub_disk_t disk, grub_fshelp_node_t node,
+		grub_disk_read_hook_t read_hook, void *read_hook_data,
+		grub_off_t pos, grub_size_t len, char *buf,
+		grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					       grub_disk_addr_t block),
+		grub_disk_addr_t (*get_run) (grub_fshelp_node_t node,
+					     grub_disk_addr_t block,
+					     grub_disk_addr_t *run),
+		grub_off_t filesize, int log2blocksize,
+		grub_disk_addr_t blocks_start)
 {
   grub_disk_addr_t i, blockcnt;
-  int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  grub_disk_addr_t next = 0, nextrun = 0;
+  int have_next = 0;
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_size_t blocksize = (grub_size_t) 1 << log2bytes;
 
   if (pos > filesize)
     {
@@ -373,57 +545,118 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
   if (pos + len > filesize)
     len = filesize - pos;
 
-  blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  blockcnt = ((len + pos) + blocksize - 1) >> log2bytes;
 
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
+  for (i = pos >> log2bytes; i < blockcnt;)
     {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
+      grub_disk_addr_t blknr, run;
+      grub_size_t skipfirst = 0, size;
 
-      int skipfirst = 0;
+      if (have_next)
+	{
+	  blknr = next;
+	  run = nextrun;
+	  have_next = 0;
+	}
+      else
+	{
+	  blknr = map_blocks (node, i, get_block, get_run, &run);
+	  if (grub_errno)
+	    return -1;
+	}
+      if (run == 0 || run > blockcnt - i)
+	run = blockcnt - i;
 
-      blknr = get_block (node, i);
-      if (grub_errno)
-	return -1;
+      /* Append the runs that continue this one on disk, or the holes that
+	 continue a hole.  */
+      while (i + run < blockcnt)
+	{
+	  next = map_blocks (node, i + run, get_block, get_run, &nextrun);
+	  if (grub_errno)
+	    return -1;
+	  if (nextrun == 0 || nextrun > blockcnt - i - run)
+	    nextrun = blockcnt - i - run;
+	  if (blknr ? next != blknr + run : next != 0)
+	    {
+	      have_next = 1;
+	      break;
+	    }
+	  run += nextrun;
+	}
 
-      blknr = blknr << log2blocksize;
+      size = run << log2bytes;
 
       /* Last block.  */
-      if (i == blockcnt - 1)
-	{
-	  blockend = (len + pos) & (blocksize - 1);
-
-	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
-	}
+      if (i + run == blockcnt && ((len + pos) & (blocksize - 1)))
+	size -= blocksize - ((len + pos) & (blocksize - 1));
 
       /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
+      if (i == (pos >> log2bytes))
 	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
+	  skipfirst = pos & (blocksize - 1);
+	  size -= skipfirst;
 	}
 
-      /* If the block number is 0 this block is not stored on disk but
-	 is zero filled instead.  */
+      /* If the block number is 0 these blocks are not stored on disk but
+	 are zero filled instead.  */
       if (blknr)
 	{
 	  disk->read_hook = read_hook;
 	  disk->read_hook_data = read_hook_data;
 
-	  grub_disk_read (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf);
+	  grub_disk_read (disk, (blknr << log2blocksize) + blocks_start,
+			  skipfirst, size, buf);
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
 	}
       else
-	grub_memset (buf, 0, blockend);
+	grub_memset (buf, 0, size);
 
-      buf += blocksize - skipfirst;
+      buf += size;
+      i += run;
     }
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the block POS.  READ_HOOK should be set before
+   reading a block from the file.  READ_HOOK_DATA is passed through as
+   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
+   file blocks to disk blocks.  The file is FILESIZE bytes big and the
+   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, get_block, NULL, filesize, log2blocksize,
+			 blocks_start);
+}
+
+grub_ssize_t
+grub_fshelp_read_file_runs (grub_disk_t disk, grub_fshelp_node_t node,
+			    grub_disk_read_hook_t read_hook,
+			    void *read_hook_data,
+			    grub_off_t pos, grub_size_t len, char *buf,
+			    grub_disk_addr_t (*get_run) (grub_fshelp_node_t node,
+							 grub_disk_addr_t block,
+							 grub_disk_addr_t *run),
+			    grub_off_t filesize, int log2blocksize,
+			    grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, NULL, get_run, filesize, log2blocksize,
+			 blocks_start);
+}
+
+GRUB_MOD_FINI(fshelp)
+{
+  dcache_flush ();
+}
@@ -1433,6 +1433,8 @@ static struct grub_fs grub_hfs_fs =
 
 GRUB_MOD_INIT(hfs)
 {
+  /* GRUB_HFS_MAGIC.  */
+  GRUB_FS_SIGNATURE (1024, "4244");
   grub_fs_register (&grub_hfs_fs);
   my_mod = mod;
 }
@@ -147,6 +147,14 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   grub_disk_addr_t blksleft = fileblock;
   struct grub_hfsplus_extent *extents = node->compressed 
     ? &node->resource_extents[0] : &node->extents[0];
+  struct grub_hfsplus_data *data = node->data;
+  /* Fragmented files are read block by block, so remember the extents
+     of the files which live as long as the mount instead of searching
+     the extent overflow tree again for every block.  */
+  int snapshot = (node == &data->opened_file
+		  || node == &data->catalog_tree.file
+		  || node == &data->attr_tree.file);
+  grub_size_t rec = 0;
 
   while (1)
     {
@@ -176,6 +184,12 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	  break;
 	}
 
+      if (snapshot && rec < node->overflow_records)
+	{
+	  extents = &node->overflow[8 * rec++];
+	  continue;
+	}
+
       /* Set up the key to look for in the extent overflow file.  */
       extoverflow.extkey.fileid = node->fileid;
       extoverflow.extkey.type = 0;
@@ -197,6 +211,24 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	grub_hfsplus_btree_recptr (&node->data->extoverflow_tree, nnode, ptr);
       extents = (struct grub_hfsplus_extent *) (key + 1);
 
+      if (snapshot)
+	{
+	  struct grub_hfsplus_extent *n;
+
+	  n = grub_realloc (node->overflow, (node->overflow_records + 1)
+			    * 8 * sizeof (*n));
+	  if (n)
+	    {
+	      node->overflow = n;
+	      grub_memcpy (&n[8 * node->overflow_records], extents,
+			   8 * sizeof (*n));
+	      node->overflow_records++;
+	      rec++;
+	    }
+	  else
+	    grub_errno = GRUB_ERR_NONE;
+	}
+
       /* The block wasn't found.  Perhaps the next iteration will find
 	 it.  The last block we found is stored in BLKSLEFT now.  */
     }
@@ -223,6 +255,21 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 				node->data->embedded_offset);
 }
 
+static void
+grub_hfsplus_unmount (struct grub_hfsplus_data *data)
+{
+  if (!data)
+    return;
+
+  grub_free (data->catalog_tree.cache);
+  grub_free (data->extoverflow_tree.cache);
+  grub_free (data->attr_tree.cache);
+  grub_free (data->catalog_tree.file.overflow);
+  grub_free (data->attr_tree.file.overflow);
+  grub_free (data->opened_file.overflow);
+  grub_free (data);
+}
+
 static struct grub_hfsplus_data *
 grub_hfsplus_mount (grub_disk_t disk)
 {
@@ -235,7 +282,7 @@ grub_hfsplus_mount (grub_disk_t disk)
     struct grub_hfsplus_volheader hfsplus;
   } volheader;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
 
@@ -380,7 +427,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a HFS+ filesystem");
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
   return 0;
 }
 
@@ -491,6 +538,56 @@ grub_hfsplus_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Read the node NODENO of BTREE into BUF, from the cache if possible.
+   Return 0 on success.  */
+static int
+grub_hfsplus_btree_read_node (struct grub_hfsplus_btree *btree,
+			      grub_uint64_t nodeno, char *buf)
+{
+  unsigned int i, victim;
+  grub_ssize_t len;
+
+  for (i = 0; i < btree->cache_count; i++)
+    if (btree->cache_node[i] == nodeno)
+      {
+	btree->cache_used[i] = ++btree->cache_tick;
+	grub_memcpy (buf, btree->cache + i * btree->nodesize,
+		     btree->nodesize);
+	return 0;
+      }
+
+  len = grub_hfsplus_read_file (&btree->file, 0, 0,
+				nodeno * btree->nodesize,
+				btree->nodesize, buf);
+  if (len <= 0)
+    return -1;
+  if (len != (grub_ssize_t) btree->nodesize)
+    return 0;
+
+  if (!btree->cache)
+    {
+      btree->cache = grub_malloc (GRUB_HFSPLUS_NODE_CACHE * btree->nodesize);
+      if (!btree->cache)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+    }
+
+  /* Replace the least recently used node.  */
+  if (btree->cache_count < GRUB_HFSPLUS_NODE_CACHE)
+    victim = btree->cache_count++;
+  else
+    for (victim = 0, i = 1; i < GRUB_HFSPLUS_NODE_CACHE; i++)
+      if (btree->cache_used[i] < btree->cache_used[victim])
+	victim = i;
+
+  btree->cache_node[victim] = nodeno;
+  btree->cache_used[victim] = ++btree->cache_tick;
+  grub_memcpy (btree->cache + victim * btree->nodesize, buf, btree->nodesize);
+  return 0;
+}
+
 static int
 grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 				 struct grub_hfsplus_btnode *first_node,
@@ -525,11 +622,9 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 	saved_node = first_node->next;
       node_count++;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (((grub_disk_addr_t)
-				    grub_be_to_cpu32 (first_node->next))
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      if (grub_hfsplus_btree_read_node (btree,
+					grub_be_to_cpu32 (first_node->next),
+					cnode) < 0)
 	return 1;
 
       /* Don't skip any record in the next iteration.  */
@@ -584,10 +679,7 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       node_count++;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (grub_disk_addr_t) currnode
-				  * (grub_disk_addr_t) btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
+      if (grub_hfsplus_btree_read_node (btree, currnode, node) < 0)
 	{
 	  grub_free (node);
 	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
@@ -854,6 +946,8 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
 
   file->size = fdiro->size;
   data->opened_file = *fdiro;
+  data->opened_file.overflow = NULL;
+  data->opened_file.overflow_records = 0;
   grub_free (fdiro);
 
   file->data = data;
@@ -864,7 +958,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -881,7 +975,7 @@ grub_hfsplus_close (grub_file_t file)
   grub_free (data->opened_file.cbuf);
   grub_free (data->opened_file.compress_index);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -960,7 +1054,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -995,7 +1089,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 				 grub_hfsplus_cmp_catkey_id, &node, &ptr)
       || !node)
     {
-      grub_free (data);
+      grub_hfsplus_unmount (data);
       return 0;
     }
 
@@ -1020,7 +1114,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 		       label_len) = '\0';
 
   grub_free (node);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return GRUB_ERR_NONE;
 }
@@ -1042,7 +1136,7 @@ grub_hfsplus_mtime (grub_device_t device, grub_int32_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 
@@ -1068,7 +1162,7 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 }
@@ -1094,6 +1188,10 @@ static struct grub_fs grub_hfsplus_fs =
 
 GRUB_MOD_INIT(hfsplus)
 {
+  /* GRUB_HFSPLUS_MAGIC, GRUB_HFSPLUSX_MAGIC or an HFS wrapper.  */
+  GRUB_FS_SIGNATURE (1024, "482b");
+  GRUB_FS_SIGNATURE (1024, "4858");
+  GRUB_FS_SIGNATURE (1024, "4244");
   grub_fs_register (&grub_hfsplus_fs);
   my_mod = mod;
 }
@@ -28,6 +28,7 @@
 #include <grub/fshelp.h>
 #include <grub/charset.h>
 #include <grub/datetime.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -653,18 +654,23 @@ susp_iterate_dir (struct grub_iso9660_susp_entry *entry,
   return 0;
 }
 
+/* Iterate over the entries of DIR that start from OFFSET up to END.  If
+   ENTRY isn't NULL, the offset of each entry is stored there before HOOK is
+   called for it.  */
 static int
-grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
-			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+iterate_dir_range (grub_fshelp_node_t dir, grub_off_t offset, grub_off_t end,
+		   grub_fshelp_iterate_dir_hook_t hook, void *hook_data,
+		   grub_off_t *entry)
 {
   struct grub_iso9660_dir dirent;
-  grub_off_t offset = 0;
   grub_off_t len;
   struct iterate_dir_ctx ctx;
 
   len = get_node_size (dir);
+  if (end > len)
+    end = len;
 
-  for (; offset < len; offset += dirent.len)
+  for (; offset < end; offset += dirent.len)
     {
       ctx.symlink = 0;
       ctx.was_continue = 0;
@@ -681,6 +687,7 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 
       {
 	char name[MAX_NAMELEN + 1];
+	grub_off_t start = offset;
 	int nameoffset = offset + sizeof (dirent);
 	struct grub_fshelp_node *node;
 	int sua_off = (sizeof (dirent) + dirent.namelen + 1
@@ -822,6 +829,8 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	    ctx.symlink = 0;
 	    ctx.was_continue = 0;
 	  }
+	if (entry)
+	  *entry = start;
 	if (hook (ctx.filename, ctx.type, node, hook_data))
 	  {
 	    if (ctx.filename_alloc)
@@ -838,6 +847,280 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 
 
 
+static int
+grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
+			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+{
+  return iterate_dir_range (dir, 0, get_node_size (dir), hook, hook_data,
+			    NULL);
+}
+
+/* Looking a name up in a directory scans all of its entries, Rock Ridge
+   ones included, which is slow for the large directories of distribution
+   images, all the more over a network.  The directories that names are
+   looked up in get a hash index of their entries.  It is kept across
+   mounts, as every operation mounts the image again, for the last few
+   directories.  */
+
+#define DIR_INDEX_MAX	16
+
+struct dir_index_slot
+{
+  grub_uint32_t hash;
+  /* Offset of the entry plus 1, 0 for an empty slot.  */
+  grub_uint32_t offset;
+};
+
+struct dir_index
+{
+  struct dir_index *next;
+
+  /* Which directory this is.  */
+  unsigned long dev_id, disk_id;
+  grub_disk_addr_t part_start;
+  struct grub_iso9660_date modified;
+  int rockridge, joliet;
+  grub_uint32_t first_sector;
+  grub_off_t size;
+
+  grub_uint32_t mask;
+  struct dir_index_slot *slots;
+};
+
+static struct dir_index *dir_indexes;
+
+static grub_uint32_t
+dir_index_hash (const char *name)
+{
+  grub_uint32_t hash = 2166136261U;
+
+  for (; *name; name++)
+    hash = (hash ^ (grub_uint8_t) grub_tolower (*name)) * 16777619U;
+  return hash;
+}
+
+static void
+dir_index_free (struct dir_index *index)
+{
+  grub_free (index->slots);
+  grub_free (index);
+}
+
+static int
+dir_index_is (const struct dir_index *index, grub_fshelp_node_t dir)
+{
+  grub_disk_t disk = dir->data->disk;
+
+  return (index->dev_id == disk->dev->id && index->disk_id == disk->id
+	  && index->part_start == grub_partition_get_start (disk->partition)
+	  && grub_memcmp (&index->modified, &dir->data->voldesc.modified,
+			  sizeof (index->modified)) == 0
+	  && index->rockridge == dir->data->rockridge
+	  && index->joliet == dir->data->joliet
+	  && index->first_sector == dir->dirents[0].first_sector
+	  && index->size == get_node_size (dir));
+}
+
+/* Context for dir_index_add.  */
+struct dir_index_ctx
+{
+  struct dir_index *index;
+  grub_off_t entry;
+  grub_uint32_t count;
+};
+
+/* Helper for dir_index_build.  */
+static int
+dir_index_add (const char *filename,
+	       enum grub_fshelp_filetype filetype __attribute__ ((unused)),
+	       grub_fshelp_node_t node, void *data)
+{
+  struct dir_index_ctx *ctx = data;
+  struct dir_index *index = ctx->index;
+  grub_uint32_t hash = dir_index_hash (filename);
+  grub_uint32_t i;
+
+  grub_free (node);
+
+  /* Keep the table at most half full.  */
+  if (++ctx->count > (index->mask + 1) / 2)
+    {
+      struct dir_index_slot *old = index->slots;
+      grub_uint32_t oldmask = index->mask, j;
+
+      if (index->mask >= 0x7fffffff)
+	return 1;
+      index->mask = index->mask * 2 + 1;
+      index->slots = grub_zalloc ((index->mask + 1) * sizeof (*old));
+      if (!index->slots)
+	{
+	  index->slots = old;
+	  index->mask = oldmask;
+	  return 1;
+	}
+      /* Reinsert in table order, which keeps the entries with the same
+	 hash in directory order.  */
+      for (j = 0; j <= oldmask; j++)
+	if (old[j].offset)
+	  {
+	    for (i = old[j].hash & index->mask; index->slots[i].offset;
+		 i = (i + 1) & index->mask);
+	    index->slots[i] = old[j];
+	  }
+      grub_free (old);
+    }
+
+  for (i = hash & index->mask; index->slots[i].offset;
+       i = (i + 1) & index->mask);
+  index->slots[i].hash = hash;
+  index->slots[i].offset = ctx->entry + 1;
+  return 0;
+}
+
+static struct dir_index *
+dir_index_build (grub_fshelp_node_t dir)
+{
+  struct dir_index_ctx ctx;
+  struct dir_index *index;
+  grub_disk_t disk = dir->data->disk;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return NULL;
+  index->dev_id = disk->dev->id;
+  index->disk_id = disk->id;
+  index->part_start = grub_partition_get_start (disk->partition);
+  index->modified = dir->data->voldesc.modified;
+  index->rockridge = dir->data->rockridge;
+  index->joliet = dir->data->joliet;
+  index->first_sector = dir->dirents[0].first_sector;
+  index->size = get_node_size (dir);
+  index->mask = 63;
+  index->slots = grub_zalloc ((index->mask + 1) * sizeof (index->slots[0]));
+
+  ctx.index = index;
+  ctx.count = 0;
+  if (!index->slots
+      || iterate_dir_range (dir, 0, index->size, dir_index_add, &ctx,
+			    &ctx.entry)
+      || grub_errno)
+    {
+      dir_index_free (index);
+      return NULL;
+    }
+
+  return index;
+}
+
+/* Find the index of DIR, moving it to the front, or build it.  */
+static struct dir_index *
+dir_index_get (grub_fshelp_node_t dir)
+{
+  struct dir_index **prev, *index;
+  int n = 0;
+
+  /* Entries beyond 4GiB can't be indexed.  */
+  if (get_node_size (dir) > GRUB_UINT_MAX)
+    return NULL;
+
+  for (prev = &dir_indexes; *prev; prev = &(*prev)->next, n++)
+    if (dir_index_is (*prev, dir))
+      {
+	index = *prev;
+	*prev = index->next;
+	index->next = dir_indexes;
+	dir_indexes = index;
+	return index;
+      }
+
+  index = dir_index_build (dir);
+  if (!index)
+    return NULL;
+
+  /* Forget the least recently used directory.  */
+  if (n >= DIR_INDEX_MAX)
+    {
+      for (prev = &dir_indexes; (*prev)->next; prev = &(*prev)->next);
+      dir_index_free (*prev);
+      *prev = NULL;
+    }
+
+  index->next = dir_indexes;
+  dir_indexes = index;
+  return index;
+}
+
+/* Context for grub_iso9660_lookup.  */
+struct grub_iso9660_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_iso9660_lookup.  */
+static int
+grub_iso9660_lookup_iter (const char *filename,
+			  enum grub_fshelp_filetype filetype,
+			  grub_fshelp_node_t node, void *data)
+{
+  struct grub_iso9660_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN
+      || ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+	  ? grub_strcasecmp (ctx->name, filename)
+	  : grub_strcmp (ctx->name, filename)))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+static grub_err_t
+grub_iso9660_lookup (grub_fshelp_node_t dir, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_iso9660_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  struct dir_index *index;
+  grub_uint32_t hash, i;
+
+  index = dir_index_get (dir);
+  if (!index)
+    {
+      /* Without an index, scan the directory.  */
+      grub_errno = GRUB_ERR_NONE;
+      grub_iso9660_iterate_dir (dir, grub_iso9660_lookup_iter, &ctx);
+      return grub_errno;
+    }
+
+  hash = dir_index_hash (name);
+  for (i = hash & index->mask; index->slots[i].offset;
+       i = (i + 1) & index->mask)
+    {
+      grub_off_t offset = index->slots[i].offset - 1;
+
+      if (index->slots[i].hash != hash)
+	continue;
+      if (iterate_dir_range (dir, offset, offset + 1,
+			     grub_iso9660_lookup_iter, &ctx, NULL))
+	break;
+      if (grub_errno)
+	break;
+    }
+
+  return grub_errno;
+}
+
+
 /* Context for grub_iso9660_dir.  */
 struct grub_iso9660_dir_ctx
 {
@@ -884,11 +1167,11 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_lookup (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR))
     goto fail;
 
   /* List the files in the directory.  */
@@ -927,11 +1210,11 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_lookup (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG))
     goto fail;
 
   data->node = foundnode;
@@ -1115,6 +1398,8 @@ static struct grub_fs grub_iso9660_fs =
 
 GRUB_MOD_INIT(iso9660)
 {
+  /* "CD001" in the first volume descriptor.  */
+  GRUB_FS_SIGNATURE (32769, "4344303031");
   grub_fs_register (&grub_iso9660_fs);
   my_mod = mod;
 }
@@ -1122,4 +1407,12 @@ GRUB_MOD_INIT(iso9660)
 GRUB_MOD_FINI(iso9660)
 {
   grub_fs_unregister (&grub_iso9660_fs);
+
+  while (dir_indexes)
+    {
+      struct dir_index *next = dir_indexes->next;
+
+      dir_index_free (dir_indexes);
+      dir_indexes = next;
+    }
 }
@@ -945,6 +945,8 @@ static struct grub_fs grub_jfs_fs =
 
 GRUB_MOD_INIT(jfs)
 {
+  /* "JFS1" at GRUB_JFS_SBLOCK.  */
+  GRUB_FS_SIGNATURE (32768, "4a465331");
   grub_fs_register (&grub_jfs_fs);
   my_mod = mod;
 }
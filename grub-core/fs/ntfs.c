@@ -108,6 +108,9 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->cache_runs = 0;
+  at->runs = NULL;
+  at->n_runs = 0;
 }
 
 static void
@@ -116,6 +119,9 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->n_runs = 0;
 }
 
 static grub_uint8_t *
@@ -362,6 +368,98 @@ grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
+/* Decode the whole run list of the attribute of CTX, whose first record is
+   PA, into its run cache.  Adjacent runs that continue each other on disk
+   are merged.  */
+static grub_err_t
+cache_run_list (struct grub_ntfs_rlst *ctx, grub_uint8_t *pa)
+{
+  struct grub_ntfs_attr *at = ctx->attr;
+  grub_disk_addr_t total;
+  grub_size_t allocated = 0;
+
+  total = u64at (pa, 0x28) >> (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
+
+  while (ctx->next_vcn < total)
+    {
+      struct grub_ntfs_run *r;
+      grub_disk_addr_t lcn;
+
+      if (grub_ntfs_read_run_list (ctx))
+	goto fail;
+      lcn = (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : ctx->curr_lcn;
+
+      r = at->n_runs ? &at->runs[at->n_runs - 1] : NULL;
+      if (r && r->next_vcn == ctx->curr_vcn
+	  && (r->lcn ? lcn == r->lcn + r->next_vcn - r->vcn : lcn == 0))
+	{
+	  r->next_vcn = ctx->next_vcn;
+	  continue;
+	}
+
+      if (at->n_runs == allocated)
+	{
+	  allocated = allocated ? allocated * 2 : 16;
+	  if (allocated > GRUB_SIZE_MAX / sizeof (*r))
+	    {
+	      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+	      goto fail;
+	    }
+	  r = grub_realloc (at->runs, allocated * sizeof (*r));
+	  if (!r)
+	    goto fail;
+	  at->runs = r;
+	}
+      r = &at->runs[at->n_runs++];
+      r->vcn = ctx->curr_vcn;
+      r->next_vcn = ctx->next_vcn;
+      r->lcn = lcn;
+    }
+
+  if (!at->n_runs)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+      goto fail;
+    }
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->n_runs = 0;
+  return grub_errno;
+}
+
+static grub_disk_addr_t
+grub_ntfs_read_cached_run (grub_fshelp_node_t node, grub_disk_addr_t block,
+			   grub_disk_addr_t *run)
+{
+  struct grub_ntfs_attr *at = (struct grub_ntfs_attr *) node;
+  grub_size_t lo = 0, hi = at->n_runs;
+  struct grub_ntfs_run *r;
+
+  if (block >= at->runs[at->n_runs - 1].next_vcn)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+      return -1;
+    }
+
+  /* Find the last run starting at or before BLOCK.  */
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (at->runs[mid].vcn <= block)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  r = &at->runs[lo];
+
+  *run = r->next_vcn - block;
+  return r->lcn ? r->lcn + block - r->vcn : 0;
+}
+
 static grub_err_t
 read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 	   grub_disk_addr_t ofs, grub_size_t len, int cached,
@@ -405,6 +503,22 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 		      "ntfscomp");
     }
 
+  if (cached && at->cache_runs && !(at->flags & GRUB_NTFS_AF_GPOS))
+    {
+      if (!at->runs && ctx->next_vcn == 0 && cache_run_list (ctx, pa))
+	return grub_errno;
+
+      if (at->runs)
+	{
+	  grub_fshelp_read_file_runs (ctx->comp.disk, (grub_fshelp_node_t) at,
+				      read_hook, read_hook_data, ofs, len,
+				      (char *) dest,
+				      grub_ntfs_read_cached_run, ofs + len,
+				      ctx->comp.log_spc, 0);
+	  return grub_errno;
+	}
+    }
+
   ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
   while (ctx->next_vcn <= ctx->target_vcn)
     {
@@ -1069,6 +1183,8 @@ grub_ntfs_open (grub_file_t file, const char *name)
 	}
     }
 
+  data->cmft.attr.cache_runs = 1;
+
   file->size = data->cmft.size;
   file->data = data;
   file->offset = 0;
@@ -1227,6 +1343,8 @@ static struct grub_fs grub_ntfs_fs =
 
 GRUB_MOD_INIT (ntfs)
 {
+  /* "NTFS" OEM name.  */
+  GRUB_FS_SIGNATURE (3, "4e544653");
   grub_fs_register (&grub_ntfs_fs);
   my_mod = mod;
 }
@@ -67,86 +67,133 @@ decomp_get16 (struct grub_ntfs_comp *cc, grub_uint16_t * res)
   return 0;
 }
 
-/* Decompress a block (4096 bytes) */
+/* Get the next N bytes of the stream in *RES, pointing into the cluster
+   buffer when they are all in there.  */
 static grub_err_t
-decomp_block (struct grub_ntfs_comp *cc, grub_uint8_t *dest)
+decomp_getn (struct grub_ntfs_comp *cc, grub_size_t n,
+	     const grub_uint8_t **res)
 {
-  grub_uint16_t flg, cnt;
+  grub_size_t csize = 1U << (cc->log_spc + GRUB_NTFS_BLK_SHR);
+  grub_size_t done = 0;
 
-  if (decomp_get16 (cc, &flg))
+  if (cc->cbuf_ofs >= csize && decomp_nextvcn (cc))
     return grub_errno;
-  cnt = (flg & 0xFFF) + 1;
 
-  if (dest)
+  if (cc->cbuf_ofs + n <= csize)
     {
-      if (flg & 0x8000)
+      *res = &cc->cbuf[cc->cbuf_ofs];
+      cc->cbuf_ofs += n;
+      return 0;
+    }
+
+  while (done < n)
+    {
+      grub_size_t m = csize - cc->cbuf_ofs;
+
+      if (m > n - done)
+	m = n - done;
+      grub_memcpy (cc->chunk + done, &cc->cbuf[cc->cbuf_ofs], m);
+      done += m;
+      cc->cbuf_ofs += m;
+      if (done < n && decomp_nextvcn (cc))
+	return grub_errno;
+    }
+  *res = cc->chunk;
+  return 0;
+}
+
+/* Decompress the N bytes of an LZNT1 chunk at SRC into DEST.  */
+static grub_err_t
+decomp_chunk (const grub_uint8_t *src, grub_size_t n, grub_uint8_t *dest)
+{
+  const grub_uint8_t *end = src + n;
+  grub_uint32_t copied = 0;
+
+  while (src < end)
+    {
+      unsigned tag = *src++;
+      int bits = 8;
+
+      while (bits && src < end)
 	{
-	  grub_uint8_t tag;
-	  grub_uint32_t bits, copied;
+	  grub_uint32_t len, delta, code, lmask, dshift, i;
 
-	  bits = copied = tag = 0;
-	  while (cnt > 0)
+	  if (!(tag & 1))
 	    {
-	      if (copied > GRUB_NTFS_COM_LEN)
+	      /* Copy the literals up to the next back reference at once.  */
+	      int lits = 1;
+
+	      while (lits < bits && !(tag & (1 << lits)))
+		lits++;
+	      if (lits > end - src)
+		lits = end - src;
+	      if (copied + lits > GRUB_NTFS_COM_LEN)
 		return grub_error (GRUB_ERR_BAD_FS,
 				   "compression block too large");
+	      grub_memcpy (dest + copied, src, lits);
+	      copied += lits;
+	      src += lits;
+	      tag >>= lits;
+	      bits -= lits;
+	      continue;
+	    }
 
-	      if (!bits)
-		{
-		  if (decomp_getch (cc, &tag))
-		    return grub_errno;
+	  if (end - src < 2)
+	    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
+	  code = src[0] | (src[1] << 8);
+	  src += 2;
 
-		  bits = 8;
-		  cnt--;
-		  if (cnt <= 0)
-		    break;
-		}
-	      if (tag & 1)
-		{
-		  grub_uint32_t i, len, delta, code, lmask, dshift;
-		  grub_uint16_t word = 0;
+	  if (!copied)
+	    return grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
 
-		  if (decomp_get16 (cc, &word))
-		    return grub_errno;
+	  for (i = copied - 1, lmask = 0xFFF, dshift = 12; i >= 0x10;
+	       i >>= 1)
+	    {
+	      lmask >>= 1;
+	      dshift--;
+	    }
 
-		  code = word;
-		  cnt -= 2;
-
-		  if (!copied)
-		    {
-		      grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
-		      return 0;
-		    }
-
-		  for (i = copied - 1, lmask = 0xFFF, dshift = 12; i >= 0x10;
-		       i >>= 1)
-		    {
-		      lmask >>= 1;
-		      dshift--;
-		    }
-
-		  delta = code >> dshift;
-		  len = (code & lmask) + 3;
-
-		  for (i = 0; i < len; i++)
-		    {
-		      dest[copied] = dest[copied - delta - 1];
-		      copied++;
-		    }
-		}
-	      else
-		{
-		  grub_uint8_t ch = 0;
+	  delta = (code >> dshift) + 1;
+	  len = (code & lmask) + 3;
+	  if (delta > copied || copied + len > GRUB_NTFS_COM_LEN)
+	    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
 
-		  if (decomp_getch (cc, &ch))
-		    return grub_errno;
-		  dest[copied++] = ch;
-		  cnt--;
-		}
-	      tag >>= 1;
-	      bits--;
-	    }
-	  return 0;
+	  if (delta >= len)
+	    grub_memcpy (dest + copied, dest + copied - delta, len);
+	  else
+	    /* The match overlaps what it produces.  */
+	    for (i = 0; i < len; i++)
+	      dest[copied + i] = dest[copied + i - delta];
+	  copied += len;
+	  tag >>= 1;
+	  bits--;
+	}
+    }
+
+  /* A short chunk ends the data of the unit, the rest is zeros.  */
+  grub_memset (dest + copied, 0, GRUB_NTFS_COM_LEN - copied);
+  return 0;
+}
+
+/* Decompress a block (4096 bytes) */
+static grub_err_t
+decomp_block (struct grub_ntfs_comp *cc, grub_uint8_t *dest)
+{
+  grub_uint16_t flg = 0, cnt;
+
+  if (decomp_get16 (cc, &flg))
+    return grub_errno;
+  cnt = (flg & 0xFFF) + 1;
+
+  if (dest)
+    {
+      if (flg & 0x8000)
+	{
+	  const grub_uint8_t *src = NULL;
+
+	  if (decomp_getn (cc, cnt, &src))
+	    return grub_errno;
+	  return decomp_chunk (src, cnt, dest);
 	}
       else
 	{
@@ -352,6 +399,12 @@ ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
   ctx->comp.cbuf = grub_malloc (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
   if (!ctx->comp.cbuf)
     return 0;
+  ctx->comp.chunk = grub_malloc (GRUB_NTFS_COM_LEN);
+  if (!ctx->comp.chunk)
+    {
+      grub_free (ctx->comp.cbuf);
+      return grub_errno;
+    }
 
   ret = 0;
 
@@ -429,6 +482,7 @@ quit:
   //ctx->comp.disk->read_hook = 0;
   if (ctx->comp.cbuf)
     grub_free (ctx->comp.cbuf);
+  grub_free (ctx->comp.chunk);
   return ret;
 }
 
@@ -1417,6 +1417,8 @@ static struct grub_fs grub_reiserfs_fs =
 
 GRUB_MOD_INIT(reiserfs)
 {
+  /* REISERFS_MAGIC_STRING in the superblock.  */
+  GRUB_FS_SIGNATURE (65588, "526549734572");
   grub_fs_register (&grub_reiserfs_fs);
   my_mod = mod;
 }
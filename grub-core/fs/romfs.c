@@ -475,6 +475,8 @@ static struct grub_fs grub_romfs_fs =
 
 GRUB_MOD_INIT(romfs)
 {
+  /* GRUB_ROMFS_MAGIC.  */
+  GRUB_FS_SIGNATURE (0, "2d726f6d3166732d");
   grub_fs_register (&grub_romfs_fs);
 }
 
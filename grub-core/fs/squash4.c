@@ -25,8 +25,11 @@
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
+#include <grub/partition.h>
 #include <grub/deflate.h>
-#include <minilzo.h>
+#include <grub/zstd.h>
+#include <grub/lz4.h>
+#include <grub/lzo1x.h>
 
 #include "xz.h"
 #include "xz_stream.h"
@@ -183,6 +186,8 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
@@ -216,6 +221,172 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompressed metadata chunks, fragment blocks and partly read data
+   blocks.  Small files share fragment blocks and every operation mounts
+   the image again, so the cache is kept at module level, most recently
+   used first.  */
+struct squash_cache_entry
+{
+  struct squash_cache_entry *next;
+
+  /* Which image this is from.  */
+  unsigned long dev_id, disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t creation_time;
+  grub_uint64_t total_size;
+
+  /* Where the compressed block is.  */
+  grub_uint64_t start;
+
+  grub_size_t size;
+  char *buf;
+};
+
+#define SQUASH_CACHE_MAX (4 << 20)
+
+static struct squash_cache_entry *squash_cache;
+static grub_size_t squash_cache_size;
+
+static void
+squash_cache_free (struct squash_cache_entry *entry)
+{
+  squash_cache_size -= entry->size;
+  grub_free (entry->buf);
+  grub_free (entry);
+}
+
+static int
+squash_cache_is (const struct squash_cache_entry *entry,
+		 struct grub_squash_data *data, grub_uint64_t start)
+{
+  return (entry->start == start
+	  && entry->dev_id == data->disk->dev->id
+	  && entry->disk_id == data->disk->id
+	  && entry->part_start == grub_partition_get_start (data->disk->partition)
+	  && entry->creation_time == data->sb.creation_time
+	  && entry->total_size == data->sb.total_size);
+}
+
+static struct squash_cache_entry *
+squash_cache_find (struct grub_squash_data *data, grub_uint64_t start)
+{
+  struct squash_cache_entry **prev, *entry;
+
+  for (prev = &squash_cache; *prev; prev = &(*prev)->next)
+    if (squash_cache_is (*prev, data, start))
+      {
+	entry = *prev;
+	*prev = entry->next;
+	entry->next = squash_cache;
+	squash_cache = entry;
+	return entry;
+      }
+  return NULL;
+}
+
+/* Put SIZE bytes in BUF, which the cache takes over, in the cache as the
+   contents of the block at START.  */
+static struct squash_cache_entry *
+squash_cache_insert (struct grub_squash_data *data, grub_uint64_t start,
+		     char *buf, grub_size_t size)
+{
+  struct squash_cache_entry *entry, **prev;
+
+  entry = grub_malloc (sizeof (*entry));
+  if (!entry)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  entry->dev_id = data->disk->dev->id;
+  entry->disk_id = data->disk->id;
+  entry->part_start = grub_partition_get_start (data->disk->partition);
+  entry->creation_time = data->sb.creation_time;
+  entry->total_size = data->sb.total_size;
+  entry->start = start;
+  entry->size = size;
+  entry->buf = buf;
+
+  squash_cache_size += size;
+  entry->next = squash_cache;
+  squash_cache = entry;
+
+  /* Forget the least recently used blocks, but keep the new one.  */
+  while (squash_cache_size > SQUASH_CACHE_MAX && squash_cache->next)
+    {
+      for (prev = &squash_cache; (*prev)->next; prev = &(*prev)->next);
+      squash_cache_free (*prev);
+      *prev = NULL;
+    }
+
+  return entry;
+}
+
+/* Copy LEN bytes from OFF on of the block whose CSIZE compressed bytes are
+   at START, and which gives at most USIZE bytes, to OUTBUF.  Return how
+   many bytes were copied, which is less than LEN if the block ends
+   earlier.  */
+static grub_ssize_t
+read_block_cached (struct grub_squash_data *data, grub_uint64_t start,
+		   grub_size_t csize, grub_size_t usize, grub_off_t off,
+		   char *outbuf, grub_size_t len)
+{
+  struct squash_cache_entry *entry;
+  char *tmp, *ubuf;
+  grub_ssize_t got;
+
+  entry = squash_cache_find (data, start);
+  if (!entry)
+    {
+      tmp = grub_malloc (csize);
+      if (!tmp)
+	return -1;
+      if (grub_disk_read (data->disk, start >> GRUB_DISK_SECTOR_BITS,
+			  start & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp))
+	{
+	  grub_free (tmp);
+	  return -1;
+	}
+
+      ubuf = grub_malloc (usize);
+      if (!ubuf)
+	{
+	  /* Decompress just the part needed.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  got = data->decompress (tmp, csize, off, outbuf, len, data);
+	  grub_free (tmp);
+	  return got;
+	}
+
+      got = data->decompress (tmp, csize, 0, ubuf, usize, data);
+      grub_free (tmp);
+      if (got < 0)
+	{
+	  grub_free (ubuf);
+	  return -1;
+	}
+
+      entry = squash_cache_insert (data, start, ubuf, got);
+      if (!entry)
+	{
+	  if (off >= (grub_size_t) got)
+	    len = 0;
+	  else if (len > got - off)
+	    len = got - off;
+	  grub_memcpy (outbuf, ubuf + off, len);
+	  grub_free (ubuf);
+	  return len;
+	}
+    }
+
+  if (off >= entry->size)
+    return 0;
+  if (len > entry->size - off)
+    len = entry->size - off;
+  grub_memcpy (outbuf, entry->buf + off, len);
+  return len;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +425,11 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  if (read_block_cached (data, chunk_start + 2, bsize,
+				 SQUASH_CHUNK_SIZE, offset, buf, csize) < 0)
+	    return grub_errno;
 	}
       len -= csize;
       offset += csize;
@@ -297,7 +450,8 @@ static grub_ssize_t
 lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 		char *outbuf, grub_size_t len, struct grub_squash_data *data)
 {
-  lzo_uint usize = data->blksz;
+  grub_size_t usize = data->blksz;
+  grub_ssize_t r;
   grub_uint8_t *udata;
 
   if (usize < 8192)
@@ -307,13 +461,45 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   if (!udata)
     return -1;
 
-  if (lzo1x_decompress_safe ((grub_uint8_t *) inbuf,
-			     insize, udata, &usize, NULL) != LZO_E_OK)
+  r = grub_lzo1x_decompress (inbuf, insize, udata, usize);
+  if (r < 0 || (grub_size_t) r < off)
     {
       grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
       grub_free (udata);
       return -1;
     }
+  usize = r;
+  if (len > usize - off)
+    len = usize - off;
+  grub_memcpy (outbuf, udata + off, len);
+  grub_free (udata);
+  return len;
+}
+
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  grub_uint8_t *udata;
+  grub_ssize_t ret;
+
+  if (usize < 8192)
+    usize = 8192;
+
+  udata = grub_malloc (usize);
+  if (!udata)
+    return -1;
+
+  ret = grub_lz4_decompress_block (inbuf, insize, udata, usize, 0);
+  if (ret < 0 || (grub_size_t) ret < off)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      grub_free (udata);
+      return -1;
+    }
+  if (len > ret - off)
+    len = ret - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
@@ -377,6 +563,16 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t outsize,
+		 struct grub_squash_data *data __attribute__ ((unused)))
+{
+  return grub_zstd_decompress (inbuf, insize, off, outbuf, outsize);
+}
+
+static struct grub_fs grub_squash_fs;
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -385,6 +581,13 @@ squash_mount (grub_disk_t disk)
   struct grub_squash_data *data;
   grub_uint64_t frag;
 
+  data = grub_fs_mount_cache_get (&grub_squash_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   err = grub_disk_read (disk, 0, 0, sizeof (sb), &sb);
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a squash4");
@@ -439,6 +642,12 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -626,14 +835,24 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 }
 
 static void
-squash_unmount (struct grub_squash_data *data)
+squash_free (void *ptr)
 {
+  struct grub_squash_data *data = ptr;
+
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
+  grub_free (data);
+}
+
+/* Give DATA back to the mount cache, without the file it had open.  */
+static void
+squash_unmount (struct grub_squash_data *data)
+{
   grub_free (data->ino.cumulated_block_sizes);
   grub_free (data->ino.block_sizes);
-  grub_free (data);
+  grub_memset (&data->ino, 0, sizeof (data->ino));
+  grub_fs_mount_cache_put (&grub_squash_fs, data->disk, data, squash_free);
 }
 
 
@@ -676,7 +895,10 @@ grub_squash_dir (grub_device_t device, const char *path,
 
   err = make_root_node (data, &root);
   if (err)
-    return err;
+    {
+      squash_unmount (data);
+      return err;
+    }
 
   grub_fshelp_find_file (path, &root, &fdiro, grub_squash_iterate_dir,
 			 grub_squash_read_symlink, GRUB_FSHELP_DIR);
@@ -702,7 +924,10 @@ grub_squash_open (struct grub_file *file, const char *name)
 
   err = make_root_node (data, &root);
   if (err)
-    return err;
+    {
+      squash_unmount (data);
+      return err;
+    }
 
   grub_fshelp_find_file (name, &root, &fdiro, grub_squash_iterate_dir,
 			 grub_squash_read_symlink, GRUB_FSHELP_REG);
@@ -824,7 +1049,24 @@ direct_read (struct grub_squash_data *data,
       if (curread > len)
 	curread = len;
       if (!(ino->block_sizes[i]
-	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
+	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED))
+	  && curread != data->blksz)
+	{
+	  /* Part of the block, likely to be read again for the rest.  */
+	  grub_size_t csize;
+	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
+	  if (read_block_cached (data, ino->cumulated_block_sizes[i] + a,
+				 csize, data->blksz, boff, buf, curread)
+	      != (grub_ssize_t) curread)
+	    {
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	      return -1;
+	    }
+	  err = GRUB_ERR_NONE;
+	}
+      else if (!(ino->block_sizes[i]
+		 & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
 	  char *block;
 	  grub_size_t csize;
@@ -909,32 +1151,16 @@ grub_squash_read_data (struct grub_squash_data *data,
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
-	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
+      if (read_block_cached (data, a, grub_le_to_cpu32 (frag.size),
+			     data->blksz, b, buf, len)
 	  != (grub_ssize_t) len)
 	{
-	  grub_free (block);
 	  if (!grub_errno)
 	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
     }
   else
     {
@@ -992,11 +1218,21 @@ static struct grub_fs grub_squash_fs =
 
 GRUB_MOD_INIT(squash4)
 {
+  /* SQUASH_MAGIC.  */
+  GRUB_FS_SIGNATURE (0, "68737173");
   grub_fs_register (&grub_squash_fs);
 }
 
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+
+  while (squash_cache)
+    {
+      struct squash_cache_entry *next = squash_cache->next;
+
+      squash_cache_free (squash_cache);
+      squash_cache = next;
+    }
 }
 
@@ -355,10 +355,21 @@ struct grub_udf_data
   int npd, npm, lbshift;
 };
 
+/* A decoded allocation descriptor.  */
+struct grub_udf_extent
+{
+  /* Offset in the file of the end of the extent.  */
+  grub_uint64_t end;
+  /* First block on disk, 0 for extents that aren't recorded.  */
+  grub_disk_addr_t start;
+};
+
 struct grub_fshelp_node
 {
   struct grub_udf_data *data;
   int part_ref;
+  struct grub_udf_extent *extents;
+  grub_size_t nextents;
   union
   {
     struct grub_udf_file_entry fe;
@@ -420,16 +431,26 @@ grub_udf_read_icb (struct grub_udf_data *data,
 
   node->part_ref = icb->block.part_ref;
   node->data = data;
+  node->extents = NULL;
+  node->nextents = 0;
   return 0;
 }
 
-static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Call HOOK with the partition reference, the position and the length
+   field of every allocation descriptor of NODE, following allocation
+   extent chains, until it returns non-zero.  */
+static grub_err_t
+grub_udf_iterate_ads (grub_fshelp_node_t node,
+		      int (*hook) (grub_uint16_t part_ref,
+				   grub_uint32_t block_num,
+				   grub_uint32_t length, void *hook_data),
+		      void *hook_data)
 {
   char *buf = NULL;
   char *ptr;
   grub_ssize_t len;
-  grub_disk_addr_t filebytes;
+  grub_size_t adsize;
+  int is_short;
 
   switch (U16 (node->block.fe.tag.tag_ident))
     {
@@ -444,124 +465,215 @@ grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       break;
 
     default:
-      grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
-      return 0;
+      return grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
     }
 
-  if ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
-      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
+  is_short = ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+	      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT);
+  adsize = is_short ? sizeof (struct grub_udf_short_ad)
+    : sizeof (struct grub_udf_long_ad);
+
+  while (len >= (grub_ssize_t) adsize)
     {
-      struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+      grub_uint32_t length, block_num;
+      grub_uint16_t part_ref;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_short_ad))
+      if (is_short)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
-	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							node->part_ref,
-							ad->position);
-	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
+	  struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
 
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
-
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_short_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
-	    }
-
-	  if (filebytes < adlen)
-	    {
-	      grub_uint32_t ad_pos = ad->position;
-	      grub_free (buf);
-	      return ((U32 (ad_pos) & GRUB_UDF_EXT_MASK) ? 0 :
-		      (grub_udf_get_block (node->data, node->part_ref, ad_pos)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-					+ node->data->lbshift))));
-	    }
+	  length = U32 (ad->length);
+	  block_num = ad->position;
+	  part_ref = node->part_ref;
+	}
+      else
+	{
+	  struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_short_ad);
+	  length = U32 (ad->length);
+	  block_num = ad->block.block_num;
+	  part_ref = ad->block.part_ref;
 	}
-    }
-  else
-    {
-      struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_long_ad))
+      if ((length >> 30) == 3)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
+	  struct grub_udf_aed *extension;
+	  grub_uint32_t adlen = length & 0x3fffffff;
+	  grub_disk_addr_t sec = grub_udf_get_block (node->data, part_ref,
+						     block_num);
+
+	  if (grub_errno)
+	    goto fail;
+	  if (!buf)
 	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							ad->block.part_ref,
-							ad->block.block_num);
+	      buf = grub_malloc (U32 (node->data->lvd.bsize));
 	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
-
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
-
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_long_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
+		return grub_errno;
+	    }
+	  if (adlen > U32 (node->data->lvd.bsize))
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid aed length");
+	      goto fail;
 	    }
-	      
-	  if (filebytes < adlen)
+	  if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
+			      0, adlen, buf))
+	    goto fail;
+
+	  extension = (struct grub_udf_aed *) buf;
+	  if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
 	    {
-	      grub_uint32_t ad_block_num = ad->block.block_num;
-	      grub_uint32_t ad_part_ref = ad->block.part_ref;
-	      grub_free (buf);
-	      return ((U32 (ad_block_num) & GRUB_UDF_EXT_MASK) ?  0 :
-		      (grub_udf_get_block (node->data, ad_part_ref,
-					   ad_block_num)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-				        + node->data->lbshift))));
+	      grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
+	      goto fail;
 	    }
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_long_ad);
+	  len = U32 (extension->ae_len);
+	  ptr = buf + sizeof (struct grub_udf_aed);
+	  continue;
 	}
+
+      if (hook (part_ref, block_num, length, hook_data))
+	break;
+
+      ptr += adsize;
+      len -= adsize;
     }
 
 fail:
   grub_free (buf);
 
-  return 0;
+  return grub_errno;
+}
+
+/* Context for grub_udf_read_block.  */
+struct grub_udf_find_block_ctx
+{
+  grub_fshelp_node_t node;
+  grub_disk_addr_t filebytes;
+  grub_disk_addr_t block;
+};
+
+/* Helper for grub_udf_read_block.  */
+static int
+grub_udf_find_block (grub_uint16_t part_ref, grub_uint32_t block_num,
+		     grub_uint32_t length, void *data)
+{
+  struct grub_udf_find_block_ctx *ctx = data;
+  grub_uint32_t adlen = length & 0x3fffffff;
+
+  if (ctx->filebytes >= adlen)
+    {
+      ctx->filebytes -= adlen;
+      return 0;
+    }
+
+  if (!(U32 (block_num) & GRUB_UDF_EXT_MASK))
+    ctx->block = (grub_udf_get_block (ctx->node->data, part_ref, block_num)
+		  + (ctx->filebytes >> (GRUB_DISK_SECTOR_BITS
+					+ ctx->node->data->lbshift)));
+  return 1;
+}
+
+/* Context for grub_udf_load_extents.  */
+struct grub_udf_load_extents_ctx
+{
+  grub_fshelp_node_t node;
+  grub_size_t alloc;
+  grub_uint64_t end;
+};
+
+/* Helper for grub_udf_load_extents.  */
+static int
+grub_udf_add_extent (grub_uint16_t part_ref, grub_uint32_t block_num,
+		     grub_uint32_t length, void *data)
+{
+  struct grub_udf_load_extents_ctx *ctx = data;
+  grub_fshelp_node_t node = ctx->node;
+  struct grub_udf_extent *e;
+
+  if (node->nextents == ctx->alloc)
+    {
+      ctx->alloc = ctx->alloc ? 2 * ctx->alloc : 16;
+      e = grub_realloc (node->extents, ctx->alloc * sizeof (*e));
+      if (!e)
+	return 1;
+      node->extents = e;
+    }
+
+  ctx->end += length & 0x3fffffff;
+  e = &node->extents[node->nextents++];
+  e->end = ctx->end;
+  e->start = 0;
+  if (!(U32 (block_num) & GRUB_UDF_EXT_MASK))
+    e->start = grub_udf_get_block (node->data, part_ref, block_num);
+
+  return grub_errno != GRUB_ERR_NONE;
+}
+
+/* Decode the allocation descriptors of the opened file NODE once, so that
+   reading a block doesn't walk them, and read the allocation extent
+   chain from disk, again.  Without the table grub_udf_read_block falls
+   back to walking them.  */
+static void
+grub_udf_load_extents (grub_fshelp_node_t node)
+{
+  struct grub_udf_load_extents_ctx ctx = {
+    .node = node,
+    .alloc = 0,
+    .end = 0
+  };
+  grub_uint16_t type;
+
+  type = U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK;
+  if (type != GRUB_UDF_ICBTAG_FLAG_AD_SHORT
+      && type != GRUB_UDF_ICBTAG_FLAG_AD_LONG)
+    return;
+
+  if (grub_udf_iterate_ads (node, grub_udf_add_extent, &ctx))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (node->extents);
+      node->extents = NULL;
+      node->nextents = 0;
+    }
+}
+
+static grub_disk_addr_t
+grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_udf_find_block_ctx ctx = {
+    .node = node,
+    .filebytes = fileblock * U32 (node->data->lvd.bsize),
+    .block = 0
+  };
+
+  if (node->extents)
+    {
+      grub_size_t lo = 0, hi = node->nextents;
+      struct grub_udf_extent *e;
+
+      /* First extent ending after the block.  */
+      while (lo < hi)
+	{
+	  grub_size_t mid = lo + (hi - lo) / 2;
+
+	  if (node->extents[mid].end <= ctx.filebytes)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      if (lo == node->nextents)
+	return 0;
+
+      e = &node->extents[lo];
+      if (!e->start)
+	return 0;
+      ctx.filebytes -= lo ? e[-1].end : 0;
+      return e->start + (ctx.filebytes >> (GRUB_DISK_SECTOR_BITS
+					   + node->data->lbshift));
+    }
+
+  grub_udf_iterate_ads (node, grub_udf_find_block, &ctx);
+  return ctx.block;
 }
 
 static grub_ssize_t
@@ -1147,6 +1259,8 @@ grub_udf_open (struct grub_file *file, const char *name)
 			     GRUB_FSHELP_REG))
     goto fail;
 
+  grub_udf_load_extents (foundnode);
+
   file->data = foundnode;
   file->offset = 0;
   file->size = U64 (foundnode->block.fe.file_size);
@@ -1180,6 +1294,7 @@ grub_udf_close (grub_file_t file)
     {
       struct grub_fshelp_node *node = (struct grub_fshelp_node *) file->data;
 
+      grub_free (node->extents);
       grub_free (node->data);
       grub_free (node);
     }
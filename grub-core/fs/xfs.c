@@ -218,6 +218,14 @@ struct grub_xfs_data
   grub_uint32_t agsize;
   unsigned int hasftype:1;
   unsigned int hascrc:1;
+
+  /* Set once DIROPEN is the opened file, whose bmap btree leaf last used
+     is then kept in LEAF.  */
+  int cache_leaf;
+  struct grub_xfs_btree_node *leaf;
+  struct grub_xfs_extent *leaf_exts;
+  int leaf_nrec;
+
   struct grub_fshelp_node diropen;
 };
 
@@ -500,13 +508,62 @@ get_fsb (const void *keys, int idx)
   return grub_be_to_cpu64 (grub_get_unaligned64 (p));
 }
 
+/* Look FILEBLOCK up in the NREC extents EXTS.  Return 0 if they don't tell,
+   for blocks before the first extent or after the last one.  Otherwise
+   store in *FSB the filesystem block, 0 for a hole, and in *RUN how many
+   blocks are alike from there on.  */
+static int
+grub_xfs_lookup_extent (struct grub_xfs_extent *exts, int nrec,
+			grub_uint64_t fileblock, grub_uint64_t *fsb,
+			grub_disk_addr_t *run)
+{
+  int lo = 0, hi = nrec;
+  grub_uint64_t offset, size;
+
+  /* Find the last extent starting at or before FILEBLOCK.  */
+  while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+
+      if (GRUB_XFS_EXTENT_OFFSET (exts, mid) <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0)
+    return 0;
+
+  offset = GRUB_XFS_EXTENT_OFFSET (exts, lo - 1);
+  size = GRUB_XFS_EXTENT_SIZE (exts, lo - 1);
+  if (fileblock < offset + size)
+    {
+      *fsb = GRUB_XFS_EXTENT_BLOCK (exts, lo - 1) + fileblock - offset;
+      *run = offset + size - fileblock;
+      return 1;
+    }
+
+  /* Sparse up to the next extent.  */
+  if (lo == nrec)
+    return 0;
+  *fsb = 0;
+  *run = GRUB_XFS_EXTENT_OFFSET (exts, lo) - fileblock;
+  return 1;
+}
+
+/* Map FILEBLOCK and return in RUN how many blocks after it follow on disk,
+   or are sparse as well.  */
 static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *run)
 {
+  struct grub_xfs_data *data = node->data;
   struct grub_xfs_btree_node *leaf = 0;
-  int ex, nrec;
+  int nrec;
   struct grub_xfs_extent *exts;
   grub_uint64_t ret = 0;
+  int cache = data->cache_leaf && node == &data->diropen;
+
+  *run = 1;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
@@ -514,7 +571,12 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       const char *keys;
       int recoffset;
 
-      leaf = grub_malloc (node->data->bsize);
+      if (cache && data->leaf
+	  && grub_xfs_lookup_extent (data->leaf_exts, data->leaf_nrec,
+				     fileblock, &ret, run))
+	return GRUB_XFS_FSB_TO_BLOCK (data, ret);
+
+      leaf = grub_malloc (data->bsize);
       if (leaf == 0)
         return 0;
 
@@ -524,7 +586,7 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       if (node->inode.fork_offset)
 	recoffset = (node->inode.fork_offset - 1) / 2;
       else
-	recoffset = (grub_xfs_inode_size(node->data)
+	recoffset = (grub_xfs_inode_size(data)
 		     - ((char *) keys - (char *) &node->inode))
 				/ (2 * sizeof (grub_uint64_t));
       do
@@ -544,14 +606,17 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
               return 0;
             }
 
-          if (grub_disk_read (node->data->disk,
-                              GRUB_XFS_FSB_TO_BLOCK (node->data, get_fsb (keys, i - 1 + recoffset)) << (node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
-                              0, node->data->bsize, leaf))
-            return 0;
+          if (grub_disk_read (data->disk,
+                              GRUB_XFS_FSB_TO_BLOCK (data, get_fsb (keys, i - 1 + recoffset)) << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+                              0, data->bsize, leaf))
+            {
+              grub_free (leaf);
+              return 0;
+            }
 
-	  if ((!node->data->hascrc &&
+	  if ((!data->hascrc &&
 	       grub_strncmp ((char *) leaf->magic, "BMAP", 4)) ||
-	      (node->data->hascrc &&
+	      (data->hascrc &&
 	       grub_strncmp ((char *) leaf->magic, "BMA3", 4)))
             {
               grub_free (leaf);
@@ -560,9 +625,9 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
             }
 
           nrec = grub_be_to_cpu16 (leaf->numrecs);
-          keys = grub_xfs_btree_keys(node->data, leaf);
-	  recoffset = ((node->data->bsize - ((char *) keys
-					     - (char *) leaf))
+          keys = grub_xfs_btree_keys(data, leaf);
+	  recoffset = ((data->bsize - ((char *) keys
+				       - (char *) leaf))
 		       / (2 * sizeof (grub_uint64_t)));
 	}
       while (leaf->level);
@@ -581,27 +646,26 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       return 0;
     }
 
-  /* Iterate over each extent to figure out which extent has
-     the block we are looking for.  */
-  for (ex = 0; ex < nrec; ex++)
+  if (! grub_xfs_lookup_extent (exts, nrec, fileblock, &ret, run))
     {
-      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, ex);
-      grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
-      grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, ex);
-
-      /* Sparse block.  */
-      if (fileblock < offset)
-        break;
-      else if (fileblock < offset + size)
-        {
-          ret = (fileblock - offset + start);
-          break;
-        }
+      /* Sparse block, up to the first extent if it is before that.  */
+      ret = 0;
+      if (nrec && fileblock < GRUB_XFS_EXTENT_OFFSET (exts, 0))
+	*run = GRUB_XFS_EXTENT_OFFSET (exts, 0) - fileblock;
     }
 
-  grub_free (leaf);
+  /* Keep the leaf for the next blocks of the open file.  */
+  if (leaf && cache)
+    {
+      grub_free (data->leaf);
+      data->leaf = leaf;
+      data->leaf_exts = exts;
+      data->leaf_nrec = nrec;
+    }
+  else
+    grub_free (leaf);
 
-  return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
+  return GRUB_XFS_FSB_TO_BLOCK (data, ret);
 }
 
 
@@ -612,12 +676,13 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_runs (node->data->disk, node,
+				     read_hook, read_hook_data,
+				     pos, len, buf, grub_xfs_read_block,
+				     grub_be_to_cpu64 (node->inode.size)
+				     + header_size,
+				     node->data->sblock.log2_bsize
+				     - GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -1027,6 +1092,8 @@ grub_xfs_open (struct grub_file *file, const char *name)
       grub_free (fdiro);
     }
 
+  data->cache_leaf = 1;
+
   file->size = grub_be_to_cpu64 (data->diropen.inode.size);
   file->data = data;
   file->offset = 0;
@@ -1060,7 +1127,10 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
-  grub_free (file->data);
+  struct grub_xfs_data *data = file->data;
+
+  grub_free (data->leaf);
+  grub_free (data);
 
   grub_dl_unref (my_mod);
 
@@ -1140,6 +1210,8 @@ static struct grub_fs grub_xfs_fs =
 
 GRUB_MOD_INIT(xfs)
 {
+  /* "XFSB".  */
+  GRUB_FS_SIGNATURE (0, "58465342");
   grub_fs_register (&grub_xfs_fs);
   my_mod = mod;
 }
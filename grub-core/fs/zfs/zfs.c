@@ -53,6 +53,7 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <grub/crypto.h>
 #include <grub/i18n.h>
 
@@ -159,7 +160,19 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
-extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
+static grub_err_t
+lz4_decompress (void *s_start, void *d_start, grub_size_t s_len,
+		grub_size_t d_len)
+{
+  const grub_uint8_t *src = s_start;
+  grub_uint32_t bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (src));
+
+  /* The compressed size is stored in front of the block.  */
+  if (s_len < 4 || bufsiz > s_len - 4
+      || grub_lz4_decompress_block (src + 4, bufsiz, d_start, d_len, 0) < 0)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+  return GRUB_ERR_NONE;
+}
 
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
@@ -206,6 +219,10 @@ struct grub_zfs_device_desc
   /* Valid only for RAIDZ.  */
   unsigned nparity;
 
+  /* Valid only for mirrors: the child tried first, which is the last one
+     a read succeeded on.  */
+  unsigned preferred;
+
   /* Valid only for leaf devices.  */
   grub_device_t dev;
   grub_disk_addr_t vdev_phys_sector;
@@ -1449,6 +1466,64 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
     }      
 }
 
+/* Map the RAIDZ column with counter *C and S sectors left of a block at
+   OFFSET, LEN bytes of which are left, to its child *DEVN and the offset
+   *CHILD_OFFSET there, and return its size.  */
+static grub_size_t
+raidz_column (const struct grub_zfs_device_desc *desc, grub_uint64_t offset,
+	      unsigned *c, grub_uint32_t s, grub_size_t len,
+	      grub_uint64_t *devn, grub_uint64_t *child_offset)
+{
+  grub_uint64_t high;
+  grub_uint32_t bsize;
+  grub_size_t csize;
+
+  bsize = s / (desc->n_children - desc->nparity);
+
+  if (desc->nparity == 1
+      && ((offset >> (desc->ashift + 20 - desc->max_children_ashift))
+	  & 1) == *c)
+    (*c)++;
+
+  high = grub_divmod64 ((offset >> desc->ashift) + *c,
+			desc->n_children, devn);
+  csize = bsize << desc->ashift;
+  if (csize > len)
+    csize = len;
+
+  grub_dprintf ("zfs", "RAIDZ mapping 0x%" PRIxGRUB_UINT64_T
+		"+%u (%" PRIxGRUB_SIZE ", %" PRIxGRUB_UINT32_T
+		") -> (0x%" PRIxGRUB_UINT64_T ", 0x%"
+		PRIxGRUB_UINT64_T ")\n",
+		offset >> desc->ashift, *c, len, bsize, high,
+		*devn);
+  *child_offset = (high << desc->ashift)
+    | (offset & ((1 << desc->ashift) - 1));
+  return csize;
+}
+
+/* Ask for LEN bytes at OFFSET of DESC to be read in the background, where
+   the disk can do that.  */
+static void
+prefetch_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
+		 grub_size_t len)
+{
+  switch (desc->type)
+    {
+    case DEVICE_LEAF:
+      if (desc->dev && desc->dev->disk)
+	grub_disk_prefetch (desc->dev->disk, DVA_OFFSET_TO_PHYS_SECTOR (offset),
+			    0, len);
+      break;
+    case DEVICE_MIRROR:
+      if (desc->preferred < desc->n_children)
+	prefetch_device (offset, &desc->children[desc->preferred], len);
+      break;
+    case DEVICE_RAIDZ:
+      break;
+    }
+}
+
 static grub_err_t
 read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	     grub_size_t len, void *buf)
@@ -1471,16 +1546,24 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
     case DEVICE_MIRROR:
       {
 	grub_err_t err = GRUB_ERR_NONE;
-	unsigned i;
+	unsigned i, child;
 	if (desc->n_children <= 0)
 	  return grub_error (GRUB_ERR_BAD_FS,
 			     "non-positive number of mirror children");
+	if (desc->preferred >= desc->n_children)
+	  desc->preferred = 0;
+	/* Start with the child that worked last time, so that a missing or
+	   failing disk costs one failed read rather than one per block.  */
 	for (i = 0; i < desc->n_children; i++)
 	  {
-	    err = read_device (offset, &desc->children[i],
+	    child = (desc->preferred + i) % desc->n_children;
+	    err = read_device (offset, &desc->children[child],
 			       len, buf);
 	    if (!err)
-	      break;
+	      {
+		desc->preferred = child;
+		break;
+	      }
 	    grub_errno = GRUB_ERR_NONE;
 	  }
 	grub_errno = err;
@@ -1525,33 +1608,38 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	else
 	  idx = ((len + (1 << desc->ashift) - 1) >> desc->ashift) - 1;
 	orig_idx = idx;
+
+	/* Each column is one contiguous read on its child.  When there are
+	   several, get them all going before waiting for the first.  */
+	if (orig_idx > 0)
+	  {
+	    unsigned pc = c;
+	    grub_uint32_t ps = s;
+	    grub_size_t plen = len;
+
+	    while (plen > 0)
+	      {
+		grub_size_t csize;
+		grub_uint64_t child_offset;
+
+		csize = raidz_column (desc, offset, &pc, ps, plen, &devn,
+				      &child_offset);
+		prefetch_device (child_offset, &desc->children[devn], csize);
+		pc++;
+		ps--;
+		plen -= csize;
+	      }
+	  }
+
 	while (len > 0)
 	  {
 	    grub_size_t csize;
-	    grub_uint32_t bsize;
+	    grub_uint64_t child_offset;
 	    grub_err_t err;
-	    bsize = s / (desc->n_children - desc->nparity);
-
-	    if (desc->nparity == 1
-		&& ((offset >> (desc->ashift + 20 - desc->max_children_ashift))
-		    & 1) == c)
-	      c++;
-
-	    high = grub_divmod64 ((offset >> desc->ashift) + c,
-				  desc->n_children, &devn);
-	    csize = bsize << desc->ashift;
-	    if (csize > len)
-	      csize = len;
-
-	    grub_dprintf ("zfs", "RAIDZ mapping 0x%" PRIxGRUB_UINT64_T
-			  "+%u (%" PRIxGRUB_SIZE ", %" PRIxGRUB_UINT32_T
-			  ") -> (0x%" PRIxGRUB_UINT64_T ", 0x%"
-			  PRIxGRUB_UINT64_T ")\n",
-			  offset >> desc->ashift, c, len, bsize, high,
-			  devn);
-	    err = read_device ((high << desc->ashift)
-			       | (offset & ((1 << desc->ashift) - 1)),
-			       &desc->children[devn],
+
+	    csize = raidz_column (desc, offset, &c, s, len, &devn,
+				  &child_offset);
+	    err = read_device (child_offset, &desc->children[devn],
 			       csize, buf);
 	    if (err && failed_devices < desc->nparity)
 	      {
@@ -1838,6 +1926,173 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Cache of verified and decompressed metadata blocks.
+ *
+ * Every operation mounts the pool anew, so the cache is global and keyed
+ * by the pool GUID and the whole block pointer: blocks never change once
+ * written, and a reused DVA comes with another birth txg and checksum.
+ * Indirect blocks, dnodes, ZAPs and the other metadata get re-read for
+ * every lookup and every data block of a file; file contents are left to
+ * the file block buffer of the mount and to the disk cache.  Like the disk
+ * cache, it is set-associative with the least recently used way replaced,
+ * and it is bounded in bytes as well.
+ */
+#define ZFS_CACHE_WAYS		4
+#define ZFS_CACHE_SETS		64
+#define ZFS_CACHE_MAX_BYTES	(4 << 20)
+/* Bigger blocks would flush too much of the rest.  */
+#define ZFS_CACHE_MAX_BLOCK	(ZFS_CACHE_MAX_BYTES / 8)
+
+struct zfs_cache_entry
+{
+  grub_uint64_t guid;
+  blkptr_t bp;
+  void *buf;
+  grub_size_t size;
+  unsigned long age;
+};
+
+static struct zfs_cache_entry zfs_cache[ZFS_CACHE_SETS][ZFS_CACHE_WAYS];
+static grub_size_t zfs_cache_bytes;
+static unsigned long zfs_cache_clock;
+
+static int
+zfs_cache_wanted (const blkptr_t *bp, grub_zfs_endian_t endian)
+{
+  grub_uint64_t prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
+
+  /* Embedded blocks cost no I/O, and decrypted data should not outlive
+     the mount that has the key.  */
+  if (BP_IS_EMBEDDED (bp) || ((prop >> 60) & 3))
+    return 0;
+  return ((prop >> 56) & 0x1f) > 0
+    || ((prop >> 48) & 0xff) != DMU_OT_PLAIN_FILE_CONTENTS;
+}
+
+static struct zfs_cache_entry *
+zfs_cache_get_set (grub_uint64_t guid, const blkptr_t *bp)
+{
+  grub_uint64_t h;
+
+  h = guid ^ bp->blk_dva[0].dva_word[1] ^ bp->blk_birth
+    ^ bp->blk_cksum.zc_word[0];
+  h ^= h >> 32;
+  h ^= h >> 16;
+  return zfs_cache[h % ZFS_CACHE_SETS];
+}
+
+/* Bump the cache clock, restarting the ages of all entries if it wraps.  */
+static unsigned long
+zfs_cache_tick (void)
+{
+  unsigned i, way;
+
+  if (++zfs_cache_clock)
+    return zfs_cache_clock;
+
+  for (i = 0; i < ZFS_CACHE_SETS; i++)
+    for (way = 0; way < ZFS_CACHE_WAYS; way++)
+      zfs_cache[i][way].age = 0;
+  return ++zfs_cache_clock;
+}
+
+static void
+zfs_cache_drop (struct zfs_cache_entry *e)
+{
+  zfs_cache_bytes -= e->size;
+  grub_free (e->buf);
+  e->buf = NULL;
+}
+
+/* Return a copy of the cached block BP in *BUF, or 0 if it isn't cached.  */
+static int
+zfs_cache_fetch (grub_uint64_t guid, const blkptr_t *bp, void **buf,
+		 grub_size_t *size)
+{
+  struct zfs_cache_entry *set = zfs_cache_get_set (guid, bp);
+  unsigned way;
+
+  for (way = 0; way < ZFS_CACHE_WAYS; way++)
+    if (set[way].buf && set[way].guid == guid
+	&& grub_memcmp (&set[way].bp, bp, sizeof (*bp)) == 0)
+      {
+	*buf = grub_malloc (set[way].size);
+	if (! *buf)
+	  return 0;
+	grub_memcpy (*buf, set[way].buf, set[way].size);
+	if (size)
+	  *size = set[way].size;
+	set[way].age = zfs_cache_tick ();
+	return 1;
+      }
+
+  return 0;
+}
+
+static void
+zfs_cache_store (grub_uint64_t guid, const blkptr_t *bp, const void *buf,
+		 grub_size_t size)
+{
+  struct zfs_cache_entry *set, *e = NULL;
+  unsigned i, way;
+
+  if (size > ZFS_CACHE_MAX_BLOCK)
+    return;
+
+  /* Take an empty way or else the least recently used one.  */
+  set = zfs_cache_get_set (guid, bp);
+  for (way = 0; way < ZFS_CACHE_WAYS; way++)
+    {
+      if (! set[way].buf)
+	{
+	  e = set + way;
+	  break;
+	}
+      if (! e || set[way].age < e->age)
+	e = set + way;
+    }
+  if (e->buf)
+    zfs_cache_drop (e);
+
+  /* Then make room from the least recently used entries of any set.  */
+  while (zfs_cache_bytes + size > ZFS_CACHE_MAX_BYTES)
+    {
+      struct zfs_cache_entry *oldest = NULL;
+
+      for (i = 0; i < ZFS_CACHE_SETS; i++)
+	for (way = 0; way < ZFS_CACHE_WAYS; way++)
+	  if (zfs_cache[i][way].buf
+	      && (! oldest || zfs_cache[i][way].age < oldest->age))
+	    oldest = &zfs_cache[i][way];
+      zfs_cache_drop (oldest);
+    }
+
+  e->buf = grub_malloc (size);
+  if (! e->buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (e->buf, buf, size);
+  e->guid = guid;
+  e->bp = *bp;
+  e->size = size;
+  e->age = zfs_cache_tick ();
+  zfs_cache_bytes += size;
+}
+
+static void
+zfs_cache_invalidate_all (void)
+{
+  unsigned i, way;
+
+  for (i = 0; i < ZFS_CACHE_SETS; i++)
+    for (way = 0; way < ZFS_CACHE_WAYS; way++)
+      if (zfs_cache[i][way].buf)
+	zfs_cache_drop (&zfs_cache[i][way]);
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1852,9 +2107,14 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   grub_err_t err;
   zio_cksum_t zc = bp->blk_cksum;
   grub_uint32_t checksum;
+  int cache;
 
   *buf = NULL;
 
+  cache = zfs_cache_wanted (bp, endian);
+  if (cache && zfs_cache_fetch (data->guid, bp, buf, size))
+    return GRUB_ERR_NONE;
+
   checksum = (grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 40) & 0xff;
   comp = (grub_zfs_to_cpu64((bp)->blk_prop, endian)>>32) & 0x7f;
   encrypted = ((grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 60) & 3);
@@ -1992,6 +2252,9 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	}
     }
 
+  if (cache)
+    zfs_cache_store (data->guid, bp, *buf, lsize);
+
   return GRUB_ERR_NONE;
 }
 
@@ -4375,4 +4638,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zfs_cache_invalidate_all ();
 }
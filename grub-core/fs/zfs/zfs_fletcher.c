@@ -37,6 +37,12 @@
 #include <grub/zfs/dmu_objset.h>
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
+#if defined (GRUB_MACHINE_EFI) && (defined (__i386__) || defined (__x86_64__))
+#include <grub/i386/cpuid.h>
+#define FLETCHER_4_SIMD	1
+#elif defined (GRUB_MACHINE_EFI) && defined (__aarch64__)
+#define FLETCHER_4_SIMD	1
+#endif
 
 void
 fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
@@ -60,17 +66,200 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+/* Fletcher-4 is one long chain of dependent additions.  Handing word I
+   to the I mod N'th of N interleaved streams runs N chains side by side,
+   and the sums over the whole buffer are linear combinations of the ones
+   of the streams.  */
+
+#ifdef FLETCHER_4_SIMD
+
+/* -1 until checked.  */
+static int fletcher_4_simd = -1;
+
+#ifdef __aarch64__
+
+/* UEFI has the FP and Advanced SIMD units enabled.  */
+static int
+fletcher_4_simd_supported (void)
+{
+  return 1;
+}
+
+/* Run 2 streams over the NBLOCKS 16-byte blocks at IP, storing their A, B,
+   C and D sums in that order to OUT.  GRUB is compiled for the general
+   registers only, so only V0 to V3 and V16 to V18, which no calling
+   convention preserves, are used, and they are cleared.  */
+static void
+fletcher_4_simd_blocks (const grub_uint32_t *ip, grub_size_t nblocks,
+			grub_uint64_t *out)
+{
+  asm volatile (".arch armv8-a+simd\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n"
+		"1:\n\t"
+		"ld1 {v16.4s}, [%[ip]], #16\n\t"
+		"uxtl v17.2d, v16.2s\n\t"
+		"uxtl2 v18.2d, v16.4s\n\t"
+		"add v0.2d, v0.2d, v17.2d\n\t"
+		"add v1.2d, v1.2d, v0.2d\n\t"
+		"add v2.2d, v2.2d, v1.2d\n\t"
+		"add v3.2d, v3.2d, v2.2d\n\t"
+		"add v0.2d, v0.2d, v18.2d\n\t"
+		"add v1.2d, v1.2d, v0.2d\n\t"
+		"add v2.2d, v2.2d, v1.2d\n\t"
+		"add v3.2d, v3.2d, v2.2d\n\t"
+		"subs %[n], %[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"st1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%[out]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v16.16b, #0\n\t"
+		"movi v17.16b, #0\n\t"
+		"movi v18.16b, #0\n"
+		: [ip] "+r" (ip), [n] "+r" (nblocks)
+		: [out] "r" (out)
+		: "cc", "memory");
+}
+
+#else
+
+#define CPUID_EDX_SSE2		(1 << 26)
+#define CR0_EM			(1 << 2)
+#define CR0_TS			(1 << 3)
+#define CR4_OSFXSR		(1 << 9)
+
+/* GRUB never enables SSE itself: only use it when the firmware has.  */
+static int
+fletcher_4_simd_supported (void)
+{
+  grub_uint32_t a, b, c, d;
+  unsigned long cr0, cr4;
+
+  if (! grub_cpu_is_cpuid_supported ())
+    return 0;
+
+  grub_cpuid (0, a, b, c, d);
+  if (a < 1)
+    return 0;
+  grub_cpuid (1, a, b, c, d);
+  if (! (d & CPUID_EDX_SSE2))
+    return 0;
+
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+  return (cr4 & CR4_OSFXSR) && ! (cr0 & (CR0_EM | CR0_TS));
+}
+
+/* Run 2 streams over the NBLOCKS 16-byte blocks at IP, storing their A, B,
+   C and D sums in that order to OUT.  GRUB is compiled without SSE, so
+   only XMM0 to XMM5, which no calling convention preserves, are used, and
+   they are cleared.  */
+static void
+fletcher_4_simd_blocks (const grub_uint32_t *ip, grub_size_t nblocks,
+			grub_uint64_t *out)
+{
+  asm volatile ("pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n"
+		"1:\n\t"
+		"movdqu (%[ip]), %%xmm4\n\t"
+		"add $16, %[ip]\n\t"
+		/* Zero-extend words 0 and 1, and 2 and 3.  */
+		"pshufd $0xfa, %%xmm4, %%xmm5\n\t"
+		"pshufd $0x50, %%xmm4, %%xmm4\n\t"
+		"psrlq $32, %%xmm4\n\t"
+		"psrlq $32, %%xmm5\n\t"
+		"paddq %%xmm4, %%xmm0\n\t"
+		"paddq %%xmm0, %%xmm1\n\t"
+		"paddq %%xmm1, %%xmm2\n\t"
+		"paddq %%xmm2, %%xmm3\n\t"
+		"paddq %%xmm5, %%xmm0\n\t"
+		"paddq %%xmm0, %%xmm1\n\t"
+		"paddq %%xmm1, %%xmm2\n\t"
+		"paddq %%xmm2, %%xmm3\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu %%xmm0, (%[out])\n\t"
+		"movdqu %%xmm1, 16(%[out])\n\t"
+		"movdqu %%xmm2, 32(%[out])\n\t"
+		"movdqu %%xmm3, 48(%[out])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n"
+		: [ip] "+r" (ip), [n] "+r" (nblocks)
+		: [out] "r" (out)
+		: "cc", "memory");
+}
+
+#endif
+
+#endif
+
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
+  const grub_uint32_t *ipfast = ip + ((ipend - ip) & ~3);
   grub_uint64_t a, b, c, d;
-  
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+
+#ifdef FLETCHER_4_SIMD
+  if (fletcher_4_simd < 0)
+    fletcher_4_simd = fletcher_4_simd_supported ();
+  /* The data needs no swapping on these little-endian CPUs.  */
+  if (fletcher_4_simd && endian == GRUB_ZFS_LITTLE_ENDIAN && ip < ipfast)
     {
-      a += grub_zfs_to_cpu32 (ip[0], endian);;
+      grub_uint64_t s[8];
+
+      fletcher_4_simd_blocks (ip, (ipfast - ip) / 4, s);
+      a = s[0] + s[1];
+      b = 2 * (s[2] + s[3]) - s[1];
+      c = 4 * (s[4] + s[5]) - s[2] - 3 * s[3];
+      d = 8 * (s[6] + s[7]) - 4 * s[4] - 8 * s[5] + s[3];
+      ip = ipfast;
+    }
+  else
+#endif
+  if (ip < ipfast)
+    {
+      grub_uint64_t sa[4] = { 0 }, sb[4] = { 0 }, sc[4] = { 0 }, sd[4] = { 0 };
+      int i;
+
+      for (; ip < ipfast; ip += 4)
+	for (i = 0; i < 4; i++)
+	  {
+	    sa[i] += grub_zfs_to_cpu32 (ip[i], endian);
+	    sb[i] += sa[i];
+	    sc[i] += sb[i];
+	    sd[i] += sc[i];
+	  }
+
+      a = sa[0] + sa[1] + sa[2] + sa[3];
+      b = 4 * (sb[0] + sb[1] + sb[2] + sb[3])
+	- (sa[1] + 2 * sa[2] + 3 * sa[3]);
+      c = 16 * (sc[0] + sc[1] + sc[2] + sc[3])
+	- (6 * sb[0] + 10 * sb[1] + 14 * sb[2] + 18 * sb[3])
+	+ (sa[2] + 3 * sa[3]);
+      d = 64 * (sd[0] + sd[1] + sd[2] + sd[3])
+	- (48 * sc[0] + 64 * sc[1] + 80 * sc[2] + 96 * sc[3])
+	+ (4 * sb[0] + 10 * sb[1] + 20 * sb[2] + 34 * sb[3])
+	- sa[3];
+    }
+  else
+    a = b = c = d = 0;
+
+  for (; ip < ipend; ip++) 
+    {
+      a += grub_zfs_to_cpu32 (ip[0], endian);
       b += a;
       c += b;
       d += c;
@@ -81,4 +270,3 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
   zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
 }
-
@@ -95,6 +95,36 @@ grub_zfs_add_key (grub_uint8_t *key_in,
   return GRUB_ERR_NONE;
 }
 
+/* Counter blocks encrypted per call, enough for ciphers that work on
+   several blocks at once to keep their pipelines full.  */
+#define CTR_BATCH	16
+
+/* Increment the counter in the last L bytes of the block CTR.  */
+static void
+ctr_inc (grub_uint8_t *ctr, unsigned l)
+{
+  unsigned j;
+
+  for (j = 0; j < l; j++)
+    if (++ctr[15 - j] != 0)
+      break;
+}
+
+/* Encrypt the next N counter blocks from CTR into KS with one call.  */
+static gcry_err_code_t
+ctr_keystream (grub_crypto_cipher_handle_t cipher, grub_uint8_t *ks,
+	       grub_uint8_t *ctr, unsigned l, grub_size_t n)
+{
+  grub_size_t k;
+
+  for (k = 0; k < n; k++)
+    {
+      grub_memcpy (ks + 16 * k, ctr, 16);
+      ctr_inc (ctr, l);
+    }
+  return grub_crypto_ecb_encrypt (cipher, ks, ks, 16 * n);
+}
+
 static gcry_err_code_t
 grub_ccm_decrypt (grub_crypto_cipher_handle_t cipher,
 		  grub_uint8_t *out, const grub_uint8_t *in,
@@ -103,9 +133,10 @@ grub_ccm_decrypt (grub_crypto_cipher_handle_t cipher,
 		  unsigned l, unsigned m)
 {
   grub_uint8_t iv[16];
-  grub_uint8_t mul[16];
+  grub_uint8_t ks[16 * CTR_BATCH];
   grub_uint32_t mac[4];
-  unsigned i, j;
+  grub_size_t off, chunk, i;
+  unsigned j;
   gcry_err_code_t err;
 
   grub_memcpy (iv + 1, nonce, 15 - l);
@@ -118,64 +149,127 @@ grub_ccm_decrypt (grub_crypto_cipher_handle_t cipher,
     return err;
 
   iv[0] = l - 1;
+  for (j = 0; j < l; j++)
+    iv[15 - j] = 0;
+  iv[15] = 1;
 
-  for (i = 0; i < (psize + 15) / 16; i++)
+  /* The key stream is computed a batch at a time, but CBC-MAC can only
+     go block by block.  */
+  for (off = 0; off < psize; off += chunk)
     {
-      grub_size_t csize;
-      csize = 16;
-      if (csize > psize - 16 * i)
-	csize = psize - 16 * i;
-      for (j = 0; j < l; j++)
-	iv[15 - j] = (i + 1) >> (8 * j);
-      err = grub_crypto_ecb_encrypt (cipher, mul, iv, 16);
-      if (err)
-	return err;
-      grub_crypto_xor (out + 16 * i, in + 16 * i, mul, csize);
-      grub_crypto_xor (mac, mac, out + 16 * i, csize);
-      err = grub_crypto_ecb_encrypt (cipher, mac, mac, 16);
+      chunk = psize - off;
+      if (chunk > sizeof (ks))
+	chunk = sizeof (ks);
+      err = ctr_keystream (cipher, ks, iv, l, (chunk + 15) / 16);
       if (err)
 	return err;
+      grub_crypto_xor (out + off, in + off, ks, chunk);
+      for (i = 0; i < chunk; i += 16)
+	{
+	  grub_crypto_xor (mac, mac, out + off + i,
+			   chunk - i < 16 ? chunk - i : 16);
+	  err = grub_crypto_ecb_encrypt (cipher, mac, mac, 16);
+	  if (err)
+	    return err;
+	}
     }
   for (j = 0; j < l; j++)
     iv[15 - j] = 0;
-  err = grub_crypto_ecb_encrypt (cipher, mul, iv, 16);
+  err = grub_crypto_ecb_encrypt (cipher, ks, iv, 16);
   if (err)
     return err;
   if (mac_out)
-    grub_crypto_xor (mac_out, mac, mul, m);
+    grub_crypto_xor (mac_out, mac, ks, m);
   return GPG_ERR_NO_ERROR;
 }
 
+/* Multiplication by H in GF(2^128) as GHASH defines it, with Shoup's
+   table of the products of H and all 4-bit values: 32 lookups per block
+   instead of 128 shifts.  The elements are kept as two big-endian
+   halves.  */
+struct gcm_table
+{
+  grub_uint8_t h[16];
+  grub_uint64_t hi[16];
+  grub_uint64_t lo[16];
+};
+
+/* The reduction of the 4 bits shifted out on the right.  */
+static const grub_uint16_t gcm_last4[16] =
+  {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+  };
+
+/* H is the same for every block of a dataset: keep the table of the
+   last one.  */
+static struct gcm_table gcm_table;
+
 static void
-grub_gcm_mul_x (grub_uint8_t *a)
+grub_gcm_init (const grub_uint8_t *h)
 {
-  int i;
-  int c = 0, d = 0;
-  for (i = 0; i < 16; i++)
+  struct gcm_table *t = &gcm_table;
+  grub_uint64_t vh, vl;
+  unsigned i, j;
+
+  if (grub_memcmp (t->h, h, 16) == 0 && (t->hi[8] | t->lo[8]))
+    return;
+
+  grub_memcpy (t->h, h, 16);
+  vh = grub_be_to_cpu64 (grub_get_unaligned64 (h));
+  vl = grub_be_to_cpu64 (grub_get_unaligned64 (h + 8));
+
+  /* Entry 8 is H itself, 4, 2 and 1 are H times x, x^2 and x^3.  */
+  t->hi[0] = t->lo[0] = 0;
+  t->hi[8] = vh;
+  t->lo[8] = vl;
+  for (i = 4; i > 0; i >>= 1)
     {
-      c = a[i] & 0x1;
-      a[i] = (a[i] >> 1) | (d << 7);
-      d = c;
+      grub_uint64_t red = (vl & 1) ? 0xe100000000000000ULL : 0;
+
+      vl = (vh << 63) | (vl >> 1);
+      vh = (vh >> 1) ^ red;
+      t->hi[i] = vh;
+      t->lo[i] = vl;
     }
-  if (d)
-    a[0] ^= 0xe1;
+  for (i = 2; i <= 8; i <<= 1)
+    for (j = 1; j < i; j++)
+      {
+	t->hi[i + j] = t->hi[i] ^ t->hi[j];
+	t->lo[i + j] = t->lo[i] ^ t->lo[j];
+      }
 }
 
+/* A = A * H.  */
 static void
-grub_gcm_mul (grub_uint8_t *a, const grub_uint8_t *b)
+grub_gcm_mul (grub_uint8_t *a)
 {
-  grub_uint8_t res[16], bs[16];
+  const struct gcm_table *t = &gcm_table;
+  grub_uint64_t zh = 0, zl = 0;
   int i;
-  grub_memcpy (bs, b, 16);
-  grub_memset (res, 0, 16);
-  for (i = 0; i < 128; i++)
+
+  for (i = 15; i >= 0; i--)
     {
-      if ((a[i / 8] << (i % 8)) & 0x80)
-	grub_crypto_xor (res, res, bs, 16);
-      grub_gcm_mul_x (bs);
+      unsigned nib[2] = { a[i] & 0xf, a[i] >> 4 };
+      unsigned k;
+
+      for (k = 0; k < 2; k++)
+	{
+	  unsigned rem;
+
+	  if (i != 15 || k != 0)
+	    {
+	      rem = zl & 0xf;
+	      zl = (zh << 60) | (zl >> 4);
+	      zh = (zh >> 4) ^ ((grub_uint64_t) gcm_last4[rem] << 48);
+	    }
+	  zh ^= t->hi[nib[k]];
+	  zl ^= t->lo[nib[k]];
+	}
     }
- 
-  grub_memcpy (a, res, 16);
+
+  grub_set_unaligned64 (a, grub_cpu_to_be64 (zh));
+  grub_set_unaligned64 (a + 8, grub_cpu_to_be64 (zl));
 }
 
 static gcry_err_code_t
@@ -186,9 +280,10 @@ grub_gcm_decrypt (grub_crypto_cipher_handle_t cipher,
 		  unsigned nonce_len, unsigned m)
 {
   grub_uint8_t iv[16];
-  grub_uint8_t mul[16];
+  grub_uint8_t ks[16 * CTR_BATCH];
   grub_uint8_t mac[16], h[16], mac_xor[16];
-  unsigned i, j;
+  grub_size_t off, chunk, i;
+  unsigned j;
   gcry_err_code_t err;
 
   grub_memset (mac, 0, sizeof (mac));
@@ -196,6 +291,7 @@ grub_gcm_decrypt (grub_crypto_cipher_handle_t cipher,
   err = grub_crypto_ecb_encrypt (cipher, h, mac, 16);
   if (err)
     return err;
+  grub_gcm_init (h);
 
   if (nonce_len == 12)
     {
@@ -209,37 +305,36 @@ grub_gcm_decrypt (grub_crypto_cipher_handle_t cipher,
     {
       grub_memset (iv, 0, sizeof (iv));
       grub_memcpy (iv, nonce, nonce_len);
-      grub_gcm_mul (iv, h);
+      grub_gcm_mul (iv);
       iv[15] ^= nonce_len * 8;
-      grub_gcm_mul (iv, h);
+      grub_gcm_mul (iv);
     }
 
   err = grub_crypto_ecb_encrypt (cipher, mac_xor, iv, 16);
   if (err)
     return err;
+  ctr_inc (iv, 4);
 
-  for (i = 0; i < (psize + 15) / 16; i++)
+  for (off = 0; off < psize; off += chunk)
     {
-      grub_size_t csize;
-      csize = 16;
-      if (csize > psize - 16 * i)
-	csize = psize - 16 * i;
-      for (j = 0; j < 4; j++)
-	{
-	  iv[15 - j]++;
-	  if (iv[15 - j] != 0)
-	    break;
-	}
-      grub_crypto_xor (mac, mac, in + 16 * i, csize);
-      grub_gcm_mul (mac, h);
-      err = grub_crypto_ecb_encrypt (cipher, mul, iv, 16);
+      chunk = psize - off;
+      if (chunk > sizeof (ks))
+	chunk = sizeof (ks);
+      err = ctr_keystream (cipher, ks, iv, 4, (chunk + 15) / 16);
       if (err)
 	return err;
-      grub_crypto_xor (out + 16 * i, in + 16 * i, mul, csize);
+      /* The MAC is of the ciphertext, which OUT may overwrite.  */
+      for (i = 0; i < chunk; i += 16)
+	{
+	  grub_crypto_xor (mac, mac, in + off + i,
+			   chunk - i < 16 ? chunk - i : 16);
+	  grub_gcm_mul (mac);
+	}
+      grub_crypto_xor (out + off, in + off, ks, chunk);
     }
   for (j = 0; j < 8; j++)
     mac[15 - j] ^= ((((grub_uint64_t) psize) * 8) >> (8 * j));
-  grub_gcm_mul (mac, h);
+  grub_gcm_mul (mac);
 
   if (mac_out)
     grub_crypto_xor (mac_out, mac, mac_xor, m);
@@ -36,12 +36,6 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 static const char *(*grub_gettext_original) (const char *s);
 
-struct grub_gettext_msg
-{
-  char *name;
-  char *translated;
-};
-
 struct header
 {
   grub_uint32_t magic;
@@ -49,6 +43,8 @@ struct header
   grub_uint32_t number_of_strings;
   grub_uint32_t offset_original;
   grub_uint32_t offset_translation;
+  grub_uint32_t hash_size;
+  grub_uint32_t offset_hash;
 };
 
 struct string_descriptor 
@@ -59,116 +55,137 @@ struct string_descriptor
 
 struct grub_gettext_context
 {
-  grub_file_t fd_mo;
-  grub_off_t grub_gettext_offset_original;
-  grub_off_t grub_gettext_offset_translation;
+  /* The whole .mo file.  */
+  char *mo;
+  grub_size_t mo_size;
+  grub_size_t grub_gettext_offset_original;
+  grub_size_t grub_gettext_offset_translation;
   grub_size_t grub_gettext_max;
   int grub_gettext_max_log;
-  struct grub_gettext_msg *grub_gettext_msg_list;
+  /* The hash table, or NULL if the file doesn't have a usable one.  */
+  const grub_uint32_t *grub_gettext_hash;
+  grub_uint32_t grub_gettext_hash_size;
+  /* Translations handed out so far, indexed by string number.  */
+  char **grub_gettext_translated;
 };
 
 static struct grub_gettext_context main_context, secondary_context;
 
 #define MO_MAGIC_NUMBER 		0x950412de
 
-static grub_err_t
-grub_gettext_pread (grub_file_t file, void *buf, grub_size_t len,
-		    grub_off_t offset)
-{
-  if (len == 0)
-    return GRUB_ERR_NONE;
-  if (grub_file_seek (file, offset) == (grub_off_t) - 1)
-    return grub_errno;
-  if (grub_file_read (file, buf, len) != (grub_ssize_t) len)
-    {
-      if (!grub_errno)
-	grub_error (GRUB_ERR_READ_ERROR, N_("premature end of file"));
-      return grub_errno;
-    }
-  return GRUB_ERR_NONE;
-}
-
-static char *
+/* Return string POSITION of the table at OFF, or NULL if the file is
+   corrupted.  */
+static const char *
 grub_gettext_getstr_from_position (struct grub_gettext_context *ctx,
-				   grub_off_t off,
-				   grub_size_t position)
+				   grub_size_t off, grub_size_t position,
+				   grub_size_t *len)
 {
-  grub_off_t internal_position;
-  grub_size_t length;
-  grub_off_t offset;
-  char *translation;
-  struct string_descriptor desc;
-  grub_err_t err;
+  const struct string_descriptor *desc;
+  grub_size_t length, offset;
 
-  internal_position = (off + position * sizeof (desc));
+  desc = (const struct string_descriptor *) (ctx->mo + off) + position;
+  length = grub_le_to_cpu32 (desc->length);
+  offset = grub_le_to_cpu32 (desc->offset);
 
-  err = grub_gettext_pread (ctx->fd_mo, (char *) &desc,
-			    sizeof (desc), internal_position);
-  if (err)
+  if (offset >= ctx->mo_size || length >= ctx->mo_size - offset
+      || ctx->mo[offset + length] != '\0')
     return NULL;
-  length = grub_cpu_to_le32 (desc.length);
-  offset = grub_cpu_to_le32 (desc.offset);
-
-  translation = grub_malloc (length + 1);
-  if (!translation)
-    return NULL;
-
-  err = grub_gettext_pread (ctx->fd_mo, translation, length, offset);
-  if (err)
-    {
-      grub_free (translation);
-      return NULL;
-    }
-  translation[length] = '\0';
-
-  return translation;
+  if (len)
+    *len = length;
+  return ctx->mo + offset;
 }
 
 static const char *
 grub_gettext_gettranslation_from_position (struct grub_gettext_context *ctx,
 					   grub_size_t position)
 {
-  if (!ctx->grub_gettext_msg_list[position].translated)
-    ctx->grub_gettext_msg_list[position].translated
-      = grub_gettext_getstr_from_position (ctx,
+  const char *str;
+
+  if (ctx->grub_gettext_translated[position])
+    return ctx->grub_gettext_translated[position];
+
+  str = grub_gettext_getstr_from_position (ctx,
 					   ctx->grub_gettext_offset_translation,
-					   position);
-  return ctx->grub_gettext_msg_list[position].translated;
+					   position, 0);
+  if (str)
+    ctx->grub_gettext_translated[position] = grub_strdup (str);
+  return ctx->grub_gettext_translated[position];
 }
 
 static const char *
 grub_gettext_getstring_from_position (struct grub_gettext_context *ctx,
 				      grub_size_t position)
 {
-  if (!ctx->grub_gettext_msg_list[position].name)
-    ctx->grub_gettext_msg_list[position].name
-      = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_original,
-					   position);
-  return ctx->grub_gettext_msg_list[position].name;
+  return grub_gettext_getstr_from_position (ctx,
+					    ctx->grub_gettext_offset_original,
+					    position, 0);
 }
 
-static const char *
-grub_gettext_translate_real (struct grub_gettext_context *ctx,
-			     const char *orig)
+/* The hash function msgfmt builds the table with (hashpjw).  */
+static grub_uint32_t
+grub_gettext_hash_string (const char *str)
 {
-  grub_size_t current = 0;
-  int i;
-  const char *current_string;
-  static int depth = 0;
+  grub_uint32_t hval = 0, g;
 
-  if (!ctx->grub_gettext_msg_list || !ctx->fd_mo)
-    return NULL;
+  while (*str)
+    {
+      hval <<= 4;
+      hval += (grub_uint8_t) *str++;
+      g = hval & 0xf0000000;
+      if (g)
+	{
+	  hval ^= g >> 24;
+	  hval ^= g;
+	}
+    }
+  return hval;
+}
 
-  /* Shouldn't happen. Just a precaution if our own code
-     calls gettext somehow.  */
-  if (depth > 2)
-    return NULL;
-  depth++;
+/* Find ORIG through the hash table and return its position, or -1.  */
+static grub_ssize_t
+grub_gettext_find_hashed (struct grub_gettext_context *ctx, const char *orig)
+{
+  grub_uint32_t hval = grub_gettext_hash_string (orig);
+  grub_uint32_t size = ctx->grub_gettext_hash_size;
+  grub_uint32_t idx = hval % size;
+  grub_uint32_t incr = 1 + hval % (size - 2);
+  grub_size_t len = grub_strlen (orig);
+  grub_uint32_t tries;
+
+  for (tries = 0; tries < size; tries++)
+    {
+      grub_uint32_t nstr = grub_le_to_cpu32 (ctx->grub_gettext_hash[idx]);
+      const char *str;
+      grub_size_t slen;
+
+      if (nstr == 0)
+	return -1;
+      nstr--;
+      if (nstr < ctx->grub_gettext_max)
+	{
+	  str = grub_gettext_getstr_from_position
+	    (ctx, ctx->grub_gettext_offset_original, nstr, &slen);
+	  /* Entries with plural forms are MSGID, NUL, MSGID_PLURAL.  */
+	  if (str && slen >= len && grub_strcmp (str, orig) == 0)
+	    return nstr;
+	}
 
-  /* Make sure we can use grub_gettext_translate for error messages.  Push
-     active error message to error stack and reset error message.  */
-  grub_error_push ();
+      if (idx >= size - incr)
+	idx -= size - incr;
+      else
+	idx += incr;
+    }
+  return -1;
+}
+
+/* Find ORIG by bisection of the sorted original strings and return its
+   position, or -1.  */
+static grub_ssize_t
+grub_gettext_find_sorted (struct grub_gettext_context *ctx, const char *orig)
+{
+  grub_size_t current = 0;
+  const char *current_string;
+  int i;
 
   for (i = ctx->grub_gettext_max_log; i >= 0; i--)
     {
@@ -180,68 +197,51 @@ grub_gettext_translate_real (struct grub_gettext_context *ctx,
 	continue;
 
       current_string = grub_gettext_getstring_from_position (ctx, test);
-
       if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+	return -1;
 
       /* Search by bisection.  */
       cmp = grub_strcmp (current_string, orig);
       if (cmp <= 0)
 	current = test;
       if (cmp == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
-	}
+	return current;
     }
 
   if (current == 0 && ctx->grub_gettext_max != 0)
     {
       current_string = grub_gettext_getstring_from_position (ctx, 0);
+      if (current_string && grub_strcmp (current_string, orig) == 0)
+	return 0;
+    }
 
-      if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+  return -1;
+}
 
-      if (grub_strcmp (current_string, orig) == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
-	}
-    }
+static const char *
+grub_gettext_translate_real (struct grub_gettext_context *ctx,
+			     const char *orig)
+{
+  grub_ssize_t position;
+  const char *ret;
+
+  if (!ctx->mo)
+    return NULL;
+
+  if (ctx->grub_gettext_hash)
+    position = grub_gettext_find_hashed (ctx, orig);
+  else
+    position = grub_gettext_find_sorted (ctx, orig);
+  if (position < 0)
+    return NULL;
 
+  /* Make sure we can use grub_gettext_translate for error messages.  Push
+     active error message to error stack and reset error message.  */
+  grub_error_push ();
+  ret = grub_gettext_gettranslation_from_position (ctx, position);
+  grub_errno = GRUB_ERR_NONE;
   grub_error_pop ();
-  depth--;
-  return NULL;
+  return ret;
 }
 
 static const char *
@@ -263,74 +263,137 @@ grub_gettext_translate (const char *orig)
 static void
 grub_gettext_delete_list (struct grub_gettext_context *ctx)
 {
-  struct grub_gettext_msg *l = ctx->grub_gettext_msg_list;
-  grub_size_t i;
-
-  if (!l)
-    return;
-  ctx->grub_gettext_msg_list = 0;
-  for (i = 0; i < ctx->grub_gettext_max; i++)
-    grub_free (l[i].name);
-  /* Don't delete the translated message because could be in use.  */
-  grub_free (l);
-  if (ctx->fd_mo)
-    grub_file_close (ctx->fd_mo);
-  ctx->fd_mo = 0;
+  /* Don't delete the translated messages because they could be in use.  */
+  grub_free (ctx->grub_gettext_translated);
+  grub_free (ctx->mo);
   grub_memset (ctx, 0, sizeof (*ctx));
 }
 
+/* Read all of FILE into memory.  */
+static char *
+grub_mofile_read (grub_file_t file, grub_size_t *size)
+{
+  grub_off_t file_size = grub_file_size (file);
+  grub_size_t allocated = 64 << 10, used = 0;
+  grub_ssize_t got;
+  char *buf = NULL, *n;
+
+  /* One byte more than needed spares growing the buffer just to see the
+     end of file.  */
+  if (file_size != GRUB_FILE_SIZE_UNKNOWN && file_size < (16 << 20))
+    allocated = file_size + 1;
+
+  while (1)
+    {
+      if (used == allocated || !buf)
+	{
+	  if (buf)
+	    allocated *= 2;
+	  n = grub_realloc (buf, allocated);
+	  if (!n)
+	    {
+	      grub_free (buf);
+	      return NULL;
+	    }
+	  buf = n;
+	}
+      got = grub_file_read (file, buf + used, allocated - used);
+      if (got < 0)
+	{
+	  grub_free (buf);
+	  return NULL;
+	}
+      if (got == 0)
+	break;
+      used += got;
+    }
+
+  *size = used;
+  return buf;
+}
+
 /* This is similar to grub_file_open. */
 static grub_err_t
 grub_mofile_open (struct grub_gettext_context *ctx,
 		  const char *filename)
 {
   struct header head;
-  grub_err_t err;
   grub_file_t fd;
-
-  /* Using fd_mo and not another variable because
-     it's needed for grub_gettext_get_info.  */
+  char *mo;
+  grub_size_t size, max, hash_size, hash_offset;
 
   fd = grub_file_open (filename);
 
   if (!fd)
     return grub_errno;
 
-  err = grub_gettext_pread (fd, &head, sizeof (head), 0);
-  if (err)
+  mo = grub_mofile_read (fd, &size);
+  grub_file_close (fd);
+  if (!mo)
+    return grub_errno;
+
+  if (size < sizeof (head))
     {
-      grub_file_close (fd);
-      return err;
+      grub_free (mo);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: premature end of file: %s", filename);
     }
+  grub_memcpy (&head, mo, sizeof (head));
 
   if (head.magic != grub_cpu_to_le32_compile_time (MO_MAGIC_NUMBER))
     {
-      grub_file_close (fd);
+      grub_free (mo);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo magic in file: %s", filename);
     }
 
   if (head.version != 0)
     {
-      grub_file_close (fd);
+      grub_free (mo);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo version in file: %s", filename);
     }
 
   ctx->grub_gettext_offset_original = grub_le_to_cpu32 (head.offset_original);
   ctx->grub_gettext_offset_translation = grub_le_to_cpu32 (head.offset_translation);
-  ctx->grub_gettext_max = grub_le_to_cpu32 (head.number_of_strings);
+  max = grub_le_to_cpu32 (head.number_of_strings);
+  if (ctx->grub_gettext_offset_original > size
+      || ctx->grub_gettext_offset_translation > size
+      || (ctx->grub_gettext_offset_original | ctx->grub_gettext_offset_translation) % 4
+      || max > (size - ctx->grub_gettext_offset_original)
+	       / sizeof (struct string_descriptor)
+      || max > (size - ctx->grub_gettext_offset_translation)
+	       / sizeof (struct string_descriptor))
+    {
+      grub_free (mo);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: invalid string tables in file: %s", filename);
+    }
+  ctx->grub_gettext_max = max;
   for (ctx->grub_gettext_max_log = 0; ctx->grub_gettext_max >> ctx->grub_gettext_max_log;
        ctx->grub_gettext_max_log++);
 
-  ctx->grub_gettext_msg_list = grub_zalloc (ctx->grub_gettext_max
-					    * sizeof (ctx->grub_gettext_msg_list[0]));
-  if (!ctx->grub_gettext_msg_list)
+  /* The hash table is optional; ignore it rather than reject the file if
+     it doesn't look right.  */
+  hash_size = grub_le_to_cpu32 (head.hash_size);
+  hash_offset = grub_le_to_cpu32 (head.offset_hash);
+  if (hash_size > 2 && hash_offset % 4 == 0 && hash_offset <= size
+      && hash_size <= (size - hash_offset) / sizeof (grub_uint32_t))
+    {
+      ctx->grub_gettext_hash = (const grub_uint32_t *) (mo + hash_offset);
+      ctx->grub_gettext_hash_size = hash_size;
+    }
+
+  ctx->grub_gettext_translated = grub_zalloc (ctx->grub_gettext_max
+					      * sizeof (ctx->grub_gettext_translated[0]));
+  if (!ctx->grub_gettext_translated && ctx->grub_gettext_max)
     {
-      grub_file_close (fd);
+      grub_free (mo);
+      grub_memset (ctx, 0, sizeof (*ctx));
       return grub_errno;
     }
-  ctx->fd_mo = fd;
+  ctx->mo = mo;
+  ctx->mo_size = size;
   if (grub_gettext != grub_gettext_translate)
     {
       grub_gettext_original = grub_gettext;
@@ -339,8 +402,6 @@ grub_mofile_open (struct grub_gettext_context *ctx,
   return 0;
 }
 
-/* Returning grub_file_t would be more natural, but grub_mofile_open assigns
-   to fd_mo anyway ...  */
 static grub_err_t
 grub_mofile_open_lang (struct grub_gettext_context *ctx,
 		       const char *part1, const char *part2, const char *locale)
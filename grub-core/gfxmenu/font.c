@@ -31,6 +31,92 @@
 #include <grub/fontformat.h>
 #include <grub/gfxmenu_view.h>
 
+/* The visual order of the strings drawn last.  A menu draws the same
+   entry titles and labels on every redraw, and strings aren't wrapped, so
+   their layout doesn't depend on the font or on where they are drawn.  */
+#define LAYOUT_CACHE_SIZE	32
+
+struct layout
+{
+  char *str;
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t visual_len;
+  unsigned long last_use;
+};
+
+static struct layout layouts[LAYOUT_CACHE_SIZE];
+static unsigned long layout_clock;
+
+static void
+layout_free (struct layout *l)
+{
+  struct grub_unicode_glyph *ptr;
+
+  for (ptr = l->visual; ptr < l->visual + l->visual_len; ptr++)
+    grub_unicode_destroy_glyph (ptr);
+  grub_free (l->visual);
+  grub_free (l->str);
+  grub_memset (l, 0, sizeof (*l));
+}
+
+void
+grub_gfxmenu_free_layout_cache (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (layouts); i++)
+    layout_free (&layouts[i]);
+}
+
+/* Return the layout of STR, laying it out if it isn't known yet.  */
+static struct layout *
+get_layout (const char *str)
+{
+  struct layout *l, *victim = &layouts[0];
+  grub_uint32_t *logical;
+  grub_ssize_t logical_len;
+  unsigned i;
+
+  layout_clock++;
+  for (i = 0; i < ARRAY_SIZE (layouts); i++)
+    {
+      l = &layouts[i];
+      if (l->str && grub_strcmp (l->str, str) == 0)
+	{
+	  l->last_use = layout_clock;
+	  return l;
+	}
+      if (victim->str && (!l->str || l->last_use < victim->last_use))
+	victim = l;
+    }
+
+  layout_free (victim);
+  victim->str = grub_strdup (str);
+  if (!victim->str)
+    return NULL;
+
+  logical_len = grub_utf8_to_ucs4_alloc (str, &logical, 0);
+  if (logical_len < 0)
+    {
+      layout_free (victim);
+      return NULL;
+    }
+
+  victim->visual_len = grub_bidi_logical_to_visual (logical, logical_len,
+						    &victim->visual,
+						    0, 0, 0, 0, 0, 0, 0);
+  grub_free (logical);
+  if (victim->visual_len < 0)
+    {
+      victim->visual = NULL;
+      victim->visual_len = 0;
+      layout_free (victim);
+      return NULL;
+    }
+  victim->last_use = layout_clock;
+  return victim;
+}
+
 /* Draw a UTF-8 string of text on the current video render target.
    The x coordinate specifies the starting x position for the first character,
    while the y coordinate specifies the baseline position.
@@ -42,43 +128,28 @@ grub_font_draw_string (const char *str, grub_font_t font,
                        int left_x, int baseline_y)
 {
   int x;
-  grub_uint32_t *logical;
-  grub_ssize_t logical_len, visual_len;
-  struct grub_unicode_glyph *visual, *ptr;
+  struct layout *layout;
+  struct grub_unicode_glyph *ptr;
   grub_err_t err;
 
-  logical_len = grub_utf8_to_ucs4_alloc (str, &logical, 0);
-  if (logical_len < 0)
-    return grub_errno;
-
-  visual_len = grub_bidi_logical_to_visual (logical, logical_len, &visual,
-					    0, 0, 0, 0, 0, 0, 0);
-  grub_free (logical);
-  if (visual_len < 0)
+  layout = get_layout (str);
+  if (!layout)
     return grub_errno;
 
-  err = GRUB_ERR_NONE;
-  for (ptr = visual, x = left_x; ptr < visual + visual_len; ptr++)
+  for (ptr = layout->visual, x = left_x;
+       ptr < layout->visual + layout->visual_len; ptr++)
     {
       struct grub_font_glyph *glyph;
       glyph = grub_font_construct_glyph (font, ptr);
       if (!glyph)
-	{
-	  err = grub_errno;
-	  goto out;
-	}
+	return grub_errno;
       err = grub_font_draw_glyph (glyph, color, x, baseline_y);
       if (err)
-	goto out;
+	return err;
       x += glyph->device_width;
     }
 
-out:
-  for (ptr = visual; ptr < visual + visual_len; ptr++)
-    grub_unicode_destroy_glyph (ptr);
-  grub_free (visual);
-
-  return err;
+  return GRUB_ERR_NONE;
 }
 
 /* Get the width in pixels of the specified UTF-8 string, when rendered in
@@ -21,6 +21,7 @@
 #include <grub/misc.h>
 #include <grub/mm.h>
 #include <grub/err.h>
+#include <grub/file.h>
 #include <grub/dl.h>
 #include <grub/command.h>
 #include <grub/video.h>
@@ -141,10 +142,15 @@ GRUB_MOD_INIT (gfxmenu)
       }
 
   grub_gfxmenu_try_hook = grub_gfxmenu_try;
+  grub_file_progress_notify_hook = grub_gfxmenu_print_progress;
 }
 
 GRUB_MOD_FINI (gfxmenu)
 {
   grub_gfxmenu_view_destroy (cached_view);
+  grub_gfxmenu_free_background_cache ();
+  grub_gfxmenu_free_theme_cache ();
+  grub_gfxmenu_free_layout_cache ();
   grub_gfxmenu_try_hook = NULL;
+  grub_file_progress_notify_hook = NULL;
 }
@@ -32,6 +32,8 @@ struct grub_gui_image
   grub_video_rect_t bounds;
   char *id;
   char *theme_dir;
+  /* The image file, until it is loaded on first use.  */
+  char *path;
   struct grub_video_bitmap *raw_bitmap;
   struct grub_video_bitmap *bitmap;
 };
@@ -49,6 +51,9 @@ image_destroy (void *vself)
   if (self->raw_bitmap)
     grub_video_bitmap_destroy (self->raw_bitmap);
 
+  grub_free (self->path);
+  grub_free (self->theme_dir);
+  grub_free (self->id);
   grub_free (self);
 }
 
@@ -65,16 +70,40 @@ image_is_instance (void *vself __attribute__((unused)), const char *type)
   return grub_strcmp (type, "component") == 0;
 }
 
+static grub_err_t rescale_image (grub_gui_image_t self);
+
+/* Load the image file set with the "file" property.  A file that can't be
+   loaded leaves the component empty.  */
+static void
+load_image (grub_gui_image_t self)
+{
+  if (! self->path)
+    return;
+
+  if (grub_video_bitmap_load (&self->raw_bitmap, self->path) != GRUB_ERR_NONE)
+    {
+      grub_dprintf ("gfxmenu", "couldn't load %s: %s\n",
+		    self->path, grub_errmsg);
+      self->raw_bitmap = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+  grub_free (self->path);
+  self->path = 0;
+}
+
 static void
 image_paint (void *vself, const grub_video_rect_t *region)
 {
   grub_gui_image_t self = vself;
   grub_video_rect_t vpsave;
 
-  if (! self->bitmap)
-    return;
   if (!grub_video_have_common_points (region, &self->bounds))
     return;
+  load_image (self);
+  rescale_image (self);
+  grub_errno = GRUB_ERR_NONE;
+  if (! self->bitmap)
+    return;
 
   grub_gui_set_viewport (&self->bounds, &vpsave);
   grub_video_blit_bitmap (self->bitmap, GRUB_VIDEO_BLIT_BLEND,
@@ -159,7 +188,9 @@ image_set_bounds (void *vself, const grub_video_rect_t *bounds)
 {
   grub_gui_image_t self = vself;
   self->bounds = *bounds;
-  rescale_image (self);
+  /* Scaled on the next paint, once the image is loaded.  */
+  if (self->raw_bitmap)
+    rescale_image (self);
 }
 
 static void
@@ -175,6 +206,7 @@ image_get_minimal_size (void *vself, unsigned *width, unsigned *height)
 {
   grub_gui_image_t self = vself;
 
+  load_image (self);
   if (self->raw_bitmap)
     {
       *width = grub_video_bitmap_get_width (self->raw_bitmap);
@@ -187,22 +219,6 @@ image_get_minimal_size (void *vself, unsigned *width, unsigned *height)
     }
 }
 
-static grub_err_t
-load_image (grub_gui_image_t self, const char *path)
-{
-  struct grub_video_bitmap *bitmap;
-  if (grub_video_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
-    return grub_errno;
-
-  if (self->bitmap && (self->bitmap != self->raw_bitmap))
-    grub_video_bitmap_destroy (self->bitmap);
-  if (self->raw_bitmap)
-    grub_video_bitmap_destroy (self->raw_bitmap);
-
-  self->raw_bitmap = bitmap;
-  return rescale_image (self);
-}
-
 static grub_err_t
 image_set_property (void *vself, const char *name, const char *value)
 {
@@ -215,7 +231,6 @@ image_set_property (void *vself, const char *name, const char *value)
   else if (grub_strcmp (name, "file") == 0)
     {
       char *absvalue;
-      grub_err_t err;
 
       /* Resolve to an absolute path.  */
       if (! self->theme_dir)
@@ -224,10 +239,15 @@ image_set_property (void *vself, const char *name, const char *value)
       if (! absvalue)
 	return grub_errno;
 
-      err = load_image (self, absvalue);
-      grub_free (absvalue);
-
-      return err;
+      /* Drop any image loaded for an earlier value.  */
+      if (self->bitmap && (self->bitmap != self->raw_bitmap))
+	grub_video_bitmap_destroy (self->bitmap);
+      if (self->raw_bitmap)
+	grub_video_bitmap_destroy (self->raw_bitmap);
+      self->bitmap = 0;
+      self->raw_bitmap = 0;
+      grub_free (self->path);
+      self->path = absvalue;
     }
   else if (grub_strcmp (name, "id") == 0)
     {
@@ -82,6 +82,16 @@ struct grub_gui_list_impl
   grub_gfxmenu_icon_manager_t icon_manager;
 
   grub_gfxmenu_view_t view;
+
+  /* What the last paint drew, so that a selection change can repaint only
+     the two rows involved.  Row Y is at painted_row.y + Y * painted_stride
+     in screen coordinates.  */
+  int painted_selected;
+  int painted_first_shown;
+  grub_video_rect_t painted_row;
+  int painted_stride;
+  grub_video_rect_t damage[2];
+  int damage_count;
 };
 
 typedef struct grub_gui_list_impl *list_impl_t;
@@ -224,10 +234,8 @@ list_is_instance (void *vself __attribute__((unused)), const char *type)
 }
 
 static struct grub_video_bitmap *
-get_item_icon (list_impl_t self, int item_index)
+get_item_icon (list_impl_t self, grub_menu_entry_t entry)
 {
-  grub_menu_entry_t entry;
-  entry = grub_menu_get_entry (self->view->menu, item_index);
   if (! entry)
     return 0;
 
@@ -349,6 +357,7 @@ draw_menu (list_impl_t self, int num_shown_items)
   int item_top = 0;
   int menu_index;
   int visible_index;
+  grub_menu_entry_t entry;
   struct grub_video_rect oviewport;
 
   grub_video_get_viewport (&oviewport.x, &oviewport.y,
@@ -389,9 +398,22 @@ draw_menu (list_impl_t self, int num_shown_items)
   int item_icon_top_offset = item_toppad + tmp_icon_top_offset;
   int sel_icon_top_offset = sel_toppad + tmp_icon_top_offset;
 
+  grub_video_get_viewport (&self->painted_row.x, &self->painted_row.y,
+			   &self->painted_row.width, &self->painted_row.height);
+  self->painted_row.width = cwidth;
+  self->painted_row.height = max_toppad + text_box_height
+    + grub_max (itembox->get_bottom_pad (itembox),
+		selbox->get_bottom_pad (selbox));
+  self->painted_stride = text_box_height + item_vspace;
+  self->painted_first_shown = self->first_shown_index;
+  self->painted_selected = self->view->selected;
+
+  /* Look the first row up, then follow the list.  */
+  entry = grub_menu_get_entry (self->view->menu, self->first_shown_index);
   for (visible_index = 0, menu_index = self->first_shown_index;
-       visible_index < num_shown_items && menu_index < self->view->menu->size;
-       visible_index++, menu_index++)
+       visible_index < num_shown_items && menu_index < self->view->menu->size
+	 && entry;
+       visible_index++, menu_index++, entry = entry->next)
     {
       int is_selected = (menu_index == self->view->selected);
       struct grub_video_bitmap *icon;
@@ -423,15 +445,14 @@ draw_menu (list_impl_t self, int num_shown_items)
           viewport_width = item_viewport_width;
         }
 
-      icon = get_item_icon (self, menu_index);
+      icon = get_item_icon (self, entry);
       if (icon != 0)
         grub_video_blit_bitmap (icon, GRUB_VIDEO_BLIT_BLEND,
                                 max_leftpad,
                                 item_top + icon_top_offset,
                                 0, 0, self->icon_width, self->icon_height);
 
-      const char *item_title =
-        grub_menu_get_entry (self->view->menu, menu_index)->title;
+      const char *item_title = entry->title;
 
       sviewport.y = item_top + top_pad;
       sviewport.width = viewport_width;
@@ -573,6 +594,7 @@ list_set_bounds (void *vself, const grub_video_rect_t *bounds)
 {
   list_impl_t self = vself;
   self->bounds = *bounds;
+  self->painted_selected = -1;
 }
 
 static void
@@ -860,6 +882,48 @@ list_refresh_info (void *vself,
   list_impl_t self = vself;
   if (view->nested)
     self->first_shown_index = 0;
+  self->painted_selected = -1;
+}
+
+static int
+list_compute_selection_damage (list_impl_t self)
+{
+  int rows[2];
+  int i;
+
+  if (! self->visible || self->painted_selected < 0 || self->view->selected < 0)
+    return -1;
+
+  /* Scrolling moves every row.  */
+  make_selected_item_visible (self);
+  if (self->first_shown_index != self->painted_first_shown)
+    return -1;
+
+  if (self->painted_selected == self->view->selected)
+    return 0;
+
+  rows[0] = self->painted_selected;
+  rows[1] = self->view->selected;
+  for (i = 0; i < 2; i++)
+    {
+      self->damage[i] = self->painted_row;
+      self->damage[i].y += ((rows[i] - self->painted_first_shown)
+			    * self->painted_stride);
+    }
+  return 2;
+}
+
+static int
+list_get_selection_damage (void *vself, grub_video_rect_t *rects, int again)
+{
+  list_impl_t self = vself;
+
+  if (!again)
+    self->damage_count = list_compute_selection_damage (self);
+  if (self->damage_count > 0)
+    grub_memcpy (rects, self->damage,
+		 self->damage_count * sizeof (self->damage[0]));
+  return self->damage_count;
 }
 
 static struct grub_gui_component_ops list_comp_ops =
@@ -879,7 +943,8 @@ static struct grub_gui_component_ops list_comp_ops =
 static struct grub_gui_list_ops list_ops =
 {
   .set_view_info = list_set_view_info,
-  .refresh_list = list_refresh_info
+  .refresh_list = list_refresh_info,
+  .get_selection_damage = list_get_selection_damage
 };
 
 grub_gui_component_t
@@ -929,6 +994,7 @@ grub_gui_list_new (void)
   self->scrollbar_bottom_pad = 0;
 
   self->first_shown_index = 0;
+  self->painted_selected = -1;
 
   self->need_to_recreate_boxes = 0;
   self->theme_dir = 0;
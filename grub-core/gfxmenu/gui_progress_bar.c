@@ -65,6 +65,7 @@ progress_bar_destroy (void *vself)
   grub_free (self->template);
   grub_free (self->id);
   grub_gfxmenu_timeout_unregister ((grub_gui_component_t) self);
+  grub_gfxmenu_progress_unregister ((grub_gui_component_t) self);
   grub_free (self);
 }
 
@@ -397,6 +398,7 @@ progress_bar_set_property (void *vself, const char *name, const char *value)
   else if (grub_strcmp (name, "id") == 0)
     {
       grub_gfxmenu_timeout_unregister ((grub_gui_component_t) self);
+      grub_gfxmenu_progress_unregister ((grub_gui_component_t) self);
       grub_free (self->id);
       if (value)
         self->id = grub_strdup (value);
@@ -406,6 +408,14 @@ progress_bar_set_property (void *vself, const char *name, const char *value)
 	  == 0)
 	grub_gfxmenu_timeout_register ((grub_gui_component_t) self,
 				       progress_bar_set_state);
+      /* Hidden until a file is loaded.  */
+      if (self->id && grub_strcmp (self->id,
+				   GRUB_GFXMENU_PROGRESS_COMPONENT_ID) == 0)
+	{
+	  self->visible = 0;
+	  grub_gfxmenu_progress_register ((grub_gui_component_t) self,
+					  progress_bar_set_state);
+	}
     }
   return grub_errno;
 }
@@ -31,9 +31,13 @@
 /* Currently hard coded to '.png' extension.  */
 static const char icon_extension[] = ".png";
 
+/* Number of hash chains in the icon cache.  */
+#define ICON_CACHE_SIZE 64
+
 typedef struct icon_entry
 {
   char *class_name;
+  /* 0 when no icon was found for the class.  */
   struct grub_video_bitmap *bitmap;
   struct icon_entry *next;
 } *icon_entry_t;
@@ -44,29 +48,34 @@ struct grub_gfxmenu_icon_manager
   int icon_width;
   int icon_height;
 
-  /* Icon cache: linked list w/ dummy head node.  */
-  struct icon_entry cache;
+  /* Value of "icondir" when the cache was filled.  */
+  char *icondir;
+
+  /* Icon cache: a hash table of class names.  Classes without an icon are
+     kept too, so that they aren't searched for again on every repaint.  */
+  icon_entry_t cache[ICON_CACHE_SIZE];
 };
 
+static unsigned
+hash_class (const char *class_name)
+{
+  unsigned h = 0;
+
+  while (*class_name)
+    h = h * 31 + (grub_uint8_t) *class_name++;
+  return h % ICON_CACHE_SIZE;
+}
+
 
 /* Create a new icon manager and return a point to it.  */
 grub_gfxmenu_icon_manager_t
 grub_gfxmenu_icon_manager_new (void)
 {
   grub_gfxmenu_icon_manager_t mgr;
-  mgr = grub_malloc (sizeof (*mgr));
+  mgr = grub_zalloc (sizeof (*mgr));
   if (! mgr)
     return 0;
 
-  mgr->theme_path = 0;
-  mgr->icon_width = 0;
-  mgr->icon_height = 0;
-
-  /* Initialize the dummy head node.  */
-  mgr->cache.class_name = 0;
-  mgr->cache.bitmap = 0;
-  mgr->cache.next = 0;
-
   return mgr;
 }
 
@@ -80,6 +89,7 @@ grub_gfxmenu_icon_manager_destroy (grub_gfxmenu_icon_manager_t mgr)
 {
   grub_gfxmenu_icon_manager_clear_cache (mgr);
   grub_free (mgr->theme_path);
+  grub_free (mgr->icondir);
   grub_free (mgr);
 }
 
@@ -89,14 +99,19 @@ grub_gfxmenu_icon_manager_clear_cache (grub_gfxmenu_icon_manager_t mgr)
 {
   icon_entry_t cur;
   icon_entry_t next;
-  for (cur = mgr->cache.next; cur; cur = next)
+  unsigned i;
+
+  for (i = 0; i < ICON_CACHE_SIZE; i++)
     {
-      next = cur->next;
-      grub_free (cur->class_name);
-      grub_video_bitmap_destroy (cur->bitmap);
-      grub_free (cur);
+      for (cur = mgr->cache[i]; cur; cur = next)
+	{
+	  next = cur->next;
+	  grub_free (cur->class_name);
+	  grub_video_bitmap_destroy (cur->bitmap);
+	  grub_free (cur);
+	}
+      mgr->cache[i] = 0;
     }
-  mgr->cache.next = 0;
 }
 
 /* Set the theme path.  If the theme path is changed, the icon cache
@@ -181,7 +196,8 @@ get_icon_by_class (grub_gfxmenu_icon_manager_t mgr, const char *class_name)
 {
   /* First check the icon cache.  */
   icon_entry_t entry;
-  for (entry = mgr->cache.next; entry; entry = entry->next)
+  unsigned h = hash_class (class_name);
+  for (entry = mgr->cache[h]; entry; entry = entry->next)
     {
       if (grub_strcmp (entry->class_name, class_name) == 0)
         return entry->bitmap;
@@ -213,23 +229,25 @@ get_icon_by_class (grub_gfxmenu_icon_manager_t mgr, const char *class_name)
 	icon = try_loading_icon (mgr, icondir, class_name);
     }
 
-  /* No icon was found.  */
-  /* This should probably be noted in the cache, so that a search is not
-     performed each time an icon for CLASS_NAME is requested.  */
-  if (! icon)
-    return 0;
-
-  /* Insert a new cache entry for this icon.  */
+  /* Insert a new cache entry for this icon, or for its absence.  */
   entry = grub_malloc (sizeof (*entry));
   if (! entry)
     {
       grub_video_bitmap_destroy (icon);
+      grub_errno = GRUB_ERR_NONE;
       return 0;
     }
   entry->class_name = grub_strdup (class_name);
+  if (! entry->class_name)
+    {
+      grub_free (entry);
+      grub_video_bitmap_destroy (icon);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
   entry->bitmap = icon;
-  entry->next = mgr->cache.next;
-  mgr->cache.next = entry;   /* Link it into the cache.  */
+  entry->next = mgr->cache[h];
+  mgr->cache[h] = entry;   /* Link it into the cache.  */
   return entry->bitmap;
 }
 
@@ -248,6 +266,18 @@ grub_gfxmenu_icon_manager_get_icon (grub_gfxmenu_icon_manager_t mgr,
 {
   struct grub_menu_entry_class *c;
   struct grub_video_bitmap *icon;
+  const char *icondir;
+
+  /* Misses are cached, so start over when they may have become hits.  */
+  icondir = grub_env_get ("icondir");
+  if ((icondir == 0) != (mgr->icondir == 0)
+      || (icondir && grub_strcmp (icondir, mgr->icondir) != 0))
+    {
+      grub_gfxmenu_icon_manager_clear_cache (mgr);
+      grub_free (mgr->icondir);
+      mgr->icondir = icondir ? grub_strdup (icondir) : 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
 
   /* Try each class in succession.  */
   icon = 0;
@@ -19,6 +19,7 @@
 
 #include <grub/types.h>
 #include <grub/file.h>
+#include <grub/disk.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
 #include <grub/err.h>
@@ -164,19 +165,14 @@ theme_set_string (grub_gfxmenu_view_t view,
     grub_video_parse_color (value, &view->message_bg_color);
   else if (! grub_strcmp ("desktop-image", name))
     {
-      struct grub_video_bitmap *raw_bitmap;
+      /* The image is loaded when the view is first drawn, and not at all
+         when a scaled copy is cached.  */
       char *path;
       path = grub_resolve_relative_path (theme_dir, value);
       if (! path)
         return grub_errno;
-      if (grub_video_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
-        {
-          grub_free (path);
-          return grub_errno;
-        }
-      grub_free(path);
-      grub_video_bitmap_destroy (view->raw_desktop_image);
-      view->raw_desktop_image = raw_bitmap;
+      grub_free (view->desktop_image_path);
+      view->desktop_image_path = path;
     }
   else if (! grub_strcmp ("desktop-image-scale-method", name))
     {
@@ -732,43 +728,83 @@ done:
   return grub_errno;
 }
 
-/* Set properties on the view based on settings from the specified
-   theme file.  */
-grub_err_t
-grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
+/* The text of the last theme file read.  A view is made for every video
+   mode and theme change, and each of them parses the theme again; this
+   spares reading the file each time.  Dropped when the disk cache is
+   invalidated, like the other caches built on top of it.  */
+static char *theme_cache_path;
+static char *theme_cache_buf;
+static int theme_cache_len;
+static unsigned long theme_cache_generation;
+
+void
+grub_gfxmenu_free_theme_cache (void)
+{
+  grub_free (theme_cache_path);
+  grub_free (theme_cache_buf);
+  theme_cache_path = 0;
+  theme_cache_buf = 0;
+  theme_cache_len = 0;
+}
+
+static grub_err_t
+read_theme_file (const char *theme_path)
 {
   grub_file_t file;
-  struct parsebuf p;
+  char *buf;
+  char *path;
+  int len;
 
-  p.view = view;
-  p.theme_dir = grub_get_dirname (theme_path);
+  if (theme_cache_buf && theme_cache_generation == grub_disk_cache_generation
+      && grub_strcmp (theme_cache_path, theme_path) == 0)
+    return GRUB_ERR_NONE;
+
+  grub_gfxmenu_free_theme_cache ();
 
   file = grub_file_open (theme_path);
   if (! file)
+    return grub_errno;
+
+  len = grub_file_size (file);
+  buf = grub_malloc (len);
+  path = grub_strdup (theme_path);
+  if (! buf || ! path || grub_file_read (file, buf, len) != len)
     {
-      grub_free (p.theme_dir);
+      grub_free (buf);
+      grub_free (path);
+      grub_file_close (file);
       return grub_errno;
     }
+  grub_file_close (file);
+
+  theme_cache_path = path;
+  theme_cache_buf = buf;
+  theme_cache_len = len;
+  theme_cache_generation = grub_disk_cache_generation;
+  return GRUB_ERR_NONE;
+}
 
-  p.len = grub_file_size (file);
-  p.buf = grub_malloc (p.len);
+/* Set properties on the view based on settings from the specified
+   theme file.  */
+grub_err_t
+grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
+{
+  struct parsebuf p;
+
+  if (read_theme_file (theme_path) != GRUB_ERR_NONE)
+    return grub_errno;
+
+  p.view = view;
+  p.theme_dir = grub_get_dirname (theme_path);
+  if (! p.theme_dir)
+    return grub_errno;
+
+  p.buf = theme_cache_buf;
+  p.len = theme_cache_len;
   p.pos = 0;
   p.line_num = 1;
   p.col_num = 1;
   p.filename = theme_path;
-  if (! p.buf)
-    {
-      grub_file_close (file);
-      grub_free (p.theme_dir);
-      return grub_errno;
-    }
-  if (grub_file_read (file, p.buf, p.len) != p.len)
-    {
-      grub_free (p.buf);
-      grub_file_close (file);
-      grub_free (p.theme_dir);
-      return grub_errno;
-    }
 
   if (view->canvas)
     view->canvas->component.ops->destroy (view->canvas);
@@ -821,8 +857,6 @@ fail:
     }
 
 cleanup:
-  grub_free (p.buf);
-  grub_file_close (file);
   grub_free (p.theme_dir);
   return grub_errno;
 }
@@ -93,8 +93,8 @@ grub_gfxmenu_view_new (const char *theme_path,
   view->title_color = default_fg_color;
   view->message_color = default_bg_color;
   view->message_bg_color = default_fg_color;
-  view->raw_desktop_image = 0;
   view->scaled_desktop_image = 0;
+  view->desktop_image_path = 0;
   view->desktop_image_scale_method = GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH;
   view->desktop_image_h_align = GRUB_VIDEO_BITMAP_H_ALIGN_CENTER;
   view->desktop_image_v_align = GRUB_VIDEO_BITMAP_V_ALIGN_CENTER;
@@ -134,8 +134,16 @@ grub_gfxmenu_view_destroy (grub_gfxmenu_view_t view)
       grub_gfxmenu_timeout_notifications = grub_gfxmenu_timeout_notifications->next;
       grub_free (p);
     }
-  grub_video_bitmap_destroy (view->raw_desktop_image);
-  grub_video_bitmap_destroy (view->scaled_desktop_image);
+  while (grub_gfxmenu_progress_notifications)
+    {
+      struct grub_gfxmenu_timeout_notify *p;
+      p = grub_gfxmenu_progress_notifications;
+      grub_gfxmenu_progress_notifications = grub_gfxmenu_progress_notifications->next;
+      grub_free (p);
+    }
+  if (term_view == view)
+    term_view = NULL;
+  grub_free (view->desktop_image_path);
   if (view->terminal_box)
     view->terminal_box->destroy (view->terminal_box);
   grub_free (view->terminal_font_name);
@@ -194,22 +202,28 @@ struct progress_value_data
 };
 
 struct grub_gfxmenu_timeout_notify *grub_gfxmenu_timeout_notifications;
+struct grub_gfxmenu_timeout_notify *grub_gfxmenu_progress_notifications;
+
+/* Percentage last shown by the progress components, -1 when hidden.  */
+static int progress_percent = -1;
 
 static void
-update_timeouts (int visible, int start, int value, int end)
+update_notifications (struct grub_gfxmenu_timeout_notify *list,
+		      int visible, int start, int value, int end)
 {
   struct grub_gfxmenu_timeout_notify *cur;
 
-  for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+  for (cur = list; cur; cur = cur->next)
     cur->set_state (cur->self, visible, start, value, end);
 }
 
 static void
-redraw_timeouts (struct grub_gfxmenu_view *view)
+redraw_notifications (struct grub_gfxmenu_view *view,
+		      struct grub_gfxmenu_timeout_notify *list)
 {
   struct grub_gfxmenu_timeout_notify *cur;
 
-  for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+  for (cur = list; cur; cur = cur->next)
     {
       grub_video_rect_t bounds;
       cur->self->ops->get_bounds (cur->self, &bounds);
@@ -226,11 +240,12 @@ grub_gfxmenu_print_timeout (int timeout, void *data)
   if (view->first_timeout == -1)
     view->first_timeout = timeout;
 
-  update_timeouts (1, -view->first_timeout, -timeout, 0);
-  redraw_timeouts (view);
+  update_notifications (grub_gfxmenu_timeout_notifications,
+			1, -view->first_timeout, -timeout, 0);
+  redraw_notifications (view, grub_gfxmenu_timeout_notifications);
   grub_video_swap_buffers ();
   if (view->double_repaint)
-    redraw_timeouts (view);
+    redraw_notifications (view, grub_gfxmenu_timeout_notifications);
 }
 
 void 
@@ -238,11 +253,11 @@ grub_gfxmenu_clear_timeout (void *data)
 {
   struct grub_gfxmenu_view *view = data;
 
-  update_timeouts (0, 1, 0, 0);
-  redraw_timeouts (view);
+  update_notifications (grub_gfxmenu_timeout_notifications, 0, 1, 0, 0);
+  redraw_notifications (view, grub_gfxmenu_timeout_notifications);
   grub_video_swap_buffers ();
   if (view->double_repaint)
-    redraw_timeouts (view);
+    redraw_notifications (view, grub_gfxmenu_timeout_notifications);
 }
 
 static void
@@ -358,6 +373,8 @@ grub_gfxmenu_view_draw (grub_gfxmenu_view_t view)
 
   refresh_menu_components (view);
   update_menu_components (view);
+  update_notifications (grub_gfxmenu_progress_notifications, 0, 0, 0, 100);
+  progress_percent = -1;
 
   grub_video_set_area_status (GRUB_VIDEO_AREA_DISABLED);
   grub_gfxmenu_view_redraw (view, &view->screen);
@@ -370,34 +387,59 @@ grub_gfxmenu_view_draw (grub_gfxmenu_view_t view)
 
 }
 
+struct redraw_menu_data
+{
+  grub_gfxmenu_view_t view;
+  int pass;
+};
+
 static void
 redraw_menu_visit (grub_gui_component_t component,
                    void *userdata)
 {
-  grub_gfxmenu_view_t view;
-  view = userdata;
+  struct redraw_menu_data *data = userdata;
+  grub_gfxmenu_view_t view = data->view;
+
   if (component->ops->is_instance (component, "list"))
     {
+      grub_gui_list_t list = (grub_gui_list_t) component;
       grub_video_rect_t bounds;
-
-      component->ops->get_bounds (component, &bounds);
-      grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
-      grub_gfxmenu_view_redraw (view, &bounds);
+      grub_video_rect_t rects[2];
+      int i, n;
+
+      /* Only the rows that lost or gained the selection need painting,
+	 unless the list scrolled.  */
+      n = list->ops->get_selection_damage (list, rects, data->pass != 0);
+      if (n < 0)
+	{
+	  component->ops->get_bounds (component, &bounds);
+	  grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+	  grub_gfxmenu_view_redraw (view, &bounds);
+	  return;
+	}
+      for (i = 0; i < n; i++)
+	{
+	  grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+	  grub_gfxmenu_view_redraw (view, &rects[i]);
+	}
     }
 }
 
 void
 grub_gfxmenu_redraw_menu (grub_gfxmenu_view_t view)
 {
+  struct redraw_menu_data data = { view, 0 };
+
   update_menu_components (view);
 
   grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
-                                redraw_menu_visit, view);
+                                redraw_menu_visit, &data);
   grub_video_swap_buffers ();
   if (view->double_repaint)
     {
+      data.pass = 1;
       grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
-				    redraw_menu_visit, view);
+				    redraw_menu_visit, &data);
     }
 }
 
@@ -415,6 +457,8 @@ grub_gfxmenu_draw_terminal_box (void)
 {
   grub_gfxmenu_box_t term_box;
 
+  if (!term_view)
+    return;
   term_box = term_view->terminal_box;
   if (!term_box)
     return;
@@ -429,6 +473,35 @@ grub_gfxmenu_draw_terminal_box (void)
 		  term_view->terminal_rect.y - term_box->get_top_pad (term_box));
 }
 
+/* Show how much of FILE has been read on the progress components, as long
+   as the theme is still on screen around the terminal.  Only the
+   components are redrawn, and only when the percentage changes.  */
+void
+grub_gfxmenu_print_progress (grub_file_t file)
+{
+  grub_gfxmenu_view_t view = term_view;
+  int percent;
+
+  if (!view || !grub_gfxmenu_progress_notifications
+      || grub_gfxterm_decorator_hook != grub_gfxmenu_draw_terminal_box)
+    return;
+
+  if (file->size == 0 || file->progress_offset >= file->size)
+    percent = 100;
+  else
+    percent = grub_divmod64 (100 * file->progress_offset, file->size, 0);
+  if (percent == progress_percent)
+    return;
+  progress_percent = percent;
+
+  update_notifications (grub_gfxmenu_progress_notifications,
+			1, 0, percent, 100);
+  redraw_notifications (view, grub_gfxmenu_progress_notifications);
+  grub_video_swap_buffers ();
+  if (view->double_repaint)
+    redraw_notifications (view, grub_gfxmenu_progress_notifications);
+}
+
 static void
 get_min_terminal (grub_font_t terminal_font,
                   unsigned int border_width,
@@ -550,31 +623,157 @@ init_terminal (grub_gfxmenu_view_t view)
   grub_gfxterm_decorator_hook = grub_gfxmenu_draw_terminal_box;
 }
 
+/* Backgrounds already scaled for earlier views.  The view is rebuilt on
+   every theme or video mode change, and scaling a full-screen image is by
+   far the slowest part of that, so switching back and forth between
+   themes or modes reuses them.  Only init_background of the one live view
+   adds entries, and only while that view holds no scaled image, so
+   evicting an entry never pulls one from under a view.  */
+#define BACKGROUND_CACHE_SIZE 4
+
+static struct background_cache_entry
+{
+  char *path;
+  int width;
+  int height;
+  grub_video_bitmap_selection_method_t method;
+  grub_video_bitmap_h_align_t h_align;
+  grub_video_bitmap_v_align_t v_align;
+  struct grub_video_bitmap *bitmap;
+  unsigned long last_used;
+} background_cache[BACKGROUND_CACHE_SIZE];
+
+static unsigned long background_cache_clock;
+
+static void
+free_background_cache_entry (struct background_cache_entry *entry)
+{
+  grub_free (entry->path);
+  grub_video_bitmap_destroy (entry->bitmap);
+  grub_memset (entry, 0, sizeof (*entry));
+}
+
+void
+grub_gfxmenu_free_background_cache (void)
+{
+  unsigned i;
+
+  for (i = 0; i < BACKGROUND_CACHE_SIZE; i++)
+    if (background_cache[i].bitmap)
+      free_background_cache_entry (&background_cache[i]);
+}
+
+static struct background_cache_entry *
+find_background (grub_gfxmenu_view_t view)
+{
+  unsigned i;
+
+  for (i = 0; i < BACKGROUND_CACHE_SIZE; i++)
+    {
+      struct background_cache_entry *entry = &background_cache[i];
+
+      if (entry->bitmap && entry->path
+	  && entry->width == view->screen.width
+	  && entry->height == view->screen.height
+	  && entry->method == view->desktop_image_scale_method
+	  && entry->h_align == view->desktop_image_h_align
+	  && entry->v_align == view->desktop_image_v_align
+	  && grub_strcmp (entry->path, view->desktop_image_path) == 0)
+	return entry;
+    }
+  return 0;
+}
+
+static void
+add_background (grub_gfxmenu_view_t view, struct grub_video_bitmap *bitmap)
+{
+  struct background_cache_entry *entry = &background_cache[0];
+  unsigned i;
+
+  /* Take a free slot, or else the least recently used.  */
+  for (i = 0; i < BACKGROUND_CACHE_SIZE; i++)
+    {
+      if (! background_cache[i].bitmap)
+	{
+	  entry = &background_cache[i];
+	  break;
+	}
+      if (background_cache[i].last_used < entry->last_used)
+	entry = &background_cache[i];
+    }
+  if (entry->bitmap)
+    free_background_cache_entry (entry);
+
+  entry->path = grub_strdup (view->desktop_image_path);
+  if (! entry->path)
+    {
+      /* Not cached, but the view still needs it.  It is reclaimed when a
+	 later view takes the slot.  */
+      grub_errno = GRUB_ERR_NONE;
+    }
+  entry->width = view->screen.width;
+  entry->height = view->screen.height;
+  entry->method = view->desktop_image_scale_method;
+  entry->h_align = view->desktop_image_h_align;
+  entry->v_align = view->desktop_image_v_align;
+  entry->bitmap = bitmap;
+  entry->last_used = ++background_cache_clock;
+}
+
 static void
 init_background (grub_gfxmenu_view_t view)
 {
+  struct background_cache_entry *entry;
+  struct grub_video_bitmap *raw_bitmap;
+
   if (view->scaled_desktop_image)
     return;
 
+  if (! view->desktop_image_path)
+    return;
+
+  entry = find_background (view);
+  if (entry)
+    {
+      entry->last_used = ++background_cache_clock;
+      view->scaled_desktop_image = entry->bitmap;
+      return;
+    }
+
+  /* Only the scaled image is kept.  An image that can't be loaded is
+     not tried again for this view, the desktop color shows instead.  */
+  if (grub_video_bitmap_load (&raw_bitmap, view->desktop_image_path)
+      != GRUB_ERR_NONE)
+    {
+      grub_dprintf ("gfxmenu", "couldn't load %s: %s\n",
+		    view->desktop_image_path, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (view->desktop_image_path);
+      view->desktop_image_path = 0;
+      return;
+    }
+
   struct grub_video_bitmap *scaled_bitmap;
   if (view->desktop_image_scale_method ==
       GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH)
     grub_video_bitmap_create_scaled (&scaled_bitmap,
                                      view->screen.width,
                                      view->screen.height,
-                                     view->raw_desktop_image,
+                                     raw_bitmap,
                                      GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST);
   else
     grub_video_bitmap_scale_proportional (&scaled_bitmap,
                                           view->screen.width,
                                           view->screen.height,
-                                          view->raw_desktop_image,
+                                          raw_bitmap,
                                           GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST,
                                           view->desktop_image_scale_method,
                                           view->desktop_image_v_align,
                                           view->desktop_image_h_align);
+  grub_video_bitmap_destroy (raw_bitmap);
   if (! scaled_bitmap)
     return;
+  add_background (view, scaled_bitmap);
   view->scaled_desktop_image = scaled_bitmap;
 
 }
@@ -34,9 +34,14 @@ struct grub_bufio
 {
   grub_file_t file;
   grub_size_t block_size;
+  /* The buffer is doubled up to this size while the file is read
+     sequentially.  */
+  grub_size_t max_size;
   grub_size_t buffer_len;
   grub_off_t buffer_at;
-  char buffer[0];
+  /* How far read-ahead of the underlying file was requested.  */
+  grub_off_t prefetch_end;
+  char *buffer;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
@@ -61,15 +66,26 @@ grub_bufio_open (grub_file_t io, int size)
     size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
             io->size);
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
       return 0;
     }
 
+  bufio->buffer = grub_malloc (size ? : 1);
+  if (! bufio->buffer)
+    {
+      grub_free (bufio);
+      grub_free (file);
+      return 0;
+    }
+
   bufio->file = io;
   bufio->block_size = size;
+  bufio->max_size = GRUB_BUFIO_MAX_SIZE;
+  if (bufio->max_size > io->size)
+    bufio->max_size = io->size;
 
   file->device = io->device;
   file->size = io->size;
@@ -99,6 +115,29 @@ grub_buffile_open (const char *name, int size)
   return file;
 }
 
+/* Double the buffer, dropping its contents.  Sizes that aren't a power of
+   two stay as they are, the alignment of the reads relies on it.  */
+static void
+grow_buffer (grub_bufio_t bufio)
+{
+  grub_size_t size = bufio->block_size * 2;
+  char *buffer;
+
+  if (size > bufio->max_size || (bufio->block_size & (bufio->block_size - 1)))
+    return;
+
+  buffer = grub_malloc (size);
+  if (! buffer)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_free (bufio->buffer);
+  bufio->buffer = buffer;
+  bufio->block_size = size;
+  bufio->buffer_len = 0;
+}
+
 static grub_ssize_t
 grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 {
@@ -106,6 +145,7 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_off_t next_buf;
   grub_bufio_t bufio = file->data;
   grub_ssize_t really_read;
+  int sequential;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
@@ -131,8 +171,26 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
   if (len == 0)
     return res;
 
+  /* Reads of a whole buffer or more go straight to the caller's memory,
+     copying them through the buffer gains nothing.  */
+  if (len >= bufio->block_size)
+    {
+      grub_file_seek (bufio->file, file->offset + res);
+      really_read = grub_file_read (bufio->file, buf, len);
+      if (really_read < 0)
+	return -1;
+      if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+	file->size = bufio->file->size;
+      return res + really_read;
+    }
+
+  sequential = (bufio->buffer_len
+		&& file->offset + res == bufio->buffer_at + bufio->buffer_len);
+
   /* Need to read some more.  */
   next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
+  if (next_buf < file->offset + res)
+    next_buf = file->offset + res;
   /* Now read between file->offset + res and bufio->buffer_at.  */
   if (file->offset + res < next_buf)
     {
@@ -162,6 +220,9 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 	}
     }
 
+  if (sequential)
+    grow_buffer (bufio);
+
   /* Read into buffer.  */
   grub_file_seek (bufio->file, next_buf);
   really_read = grub_file_read (bufio->file, bufio->buffer,
@@ -174,20 +235,34 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
+  /* Have the next buffer fetched while the caller works on this one.  */
+  if (sequential)
+    grub_file_prefetch_ahead (bufio->file, &bufio->prefetch_end,
+			      2 * bufio->block_size);
+
   if (len > bufio->buffer_len)
     len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
+  grub_memcpy (buf, bufio->buffer, len);
   res += len;
 
   return res;
 }
 
+static void
+grub_bufio_prefetch (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  grub_bufio_t bufio = file->data;
+
+  grub_file_prefetch (bufio->file, offset, len);
+}
+
 static grub_err_t
 grub_bufio_close (grub_file_t file)
 {
   grub_bufio_t bufio = file->data;
 
   grub_file_close (bufio->file);
+  grub_free (bufio->buffer);
   grub_free (bufio);
 
   file->device = 0;
@@ -201,6 +276,7 @@ static struct grub_fs grub_bufio_fs =
     .dir = 0,
     .open = 0,
     .read = grub_bufio_read,
+    .prefetch = grub_bufio_prefetch,
     .close = grub_bufio_close,
     .label = 0,
     .next = 0
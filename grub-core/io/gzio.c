@@ -57,6 +57,28 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* How much compressed data to ask the device for ahead of inflating.  */
+#define PREFETCHSIZ  0x20000
+
+/* The initial distance between checkpoints in the uncompressed data, and
+   how many are kept before dropping every other one and doubling it.  */
+#define CHECKPOINT_SPAN  0x100000
+#define MAX_CHECKPOINTS  256
+
+/* What is needed to resume inflating at the start of a block.  */
+struct gzio_checkpoint
+{
+  /* The offset of the block in the uncompressed data.  */
+  grub_off_t offset;
+  /* The offset of the first input byte not in the bit buffer.  */
+  grub_off_t in_offset;
+  /* The bit buffer.  */
+  unsigned long bb;
+  unsigned bk;
+  /* The slide, holding the WSIZE bytes before the block.  */
+  grub_uint8_t slide[WSIZE];
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -82,6 +104,13 @@ struct grub_gzio
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
   int inbuf_d;
+  /* The offset of inbuf in the underlying file.  */
+  grub_off_t inbuf_off;
+  /* The end of the bytes in inbuf get_byte may hand out without asking the
+     file, zero until inbuf is first filled after a seek.  */
+  int inbuf_end;
+  /* The end of the prefetched compressed data.  */
+  grub_off_t prefetch_end;
   /* The bit buffer.  */
   unsigned long bb;
   /* The bits in the bit buffer.  */
@@ -98,8 +127,20 @@ struct grub_gzio
   int bl;
   /* The lookup bits for the distance code table.  */
   int bd;
+  /* The tables of the fixed Huffman codes, built on the first fixed block
+     and kept until the end.  */
+  struct huft *fixed_tl;
+  struct huft *fixed_td;
+  int fixed_bl;
+  int fixed_bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* The checkpoints recorded so far, in increasing order of offset, and
+     the distance kept between them.  No checkpoints are recorded while
+     checkpoint_span is zero.  */
+  struct gzio_checkpoint **checkpoints;
+  unsigned ncheckpoints;
+  grub_off_t checkpoint_span;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -213,15 +254,20 @@ test_gzip_header (grub_file_t file)
 
   gzio->data_offset = grub_file_tell (gzio->file);
 
+  /* A stream of unknown length, such as a compressed HTTP transfer without
+     Content-Length, is only known to end when it does.  */
+  if (grub_file_size (gzio->file) == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = GRUB_FILE_SIZE_UNKNOWN;
   /* FIXME: don't do this on not easily seekable files.  */
-  {
-    grub_file_seek (gzio->file, grub_file_size (gzio->file) - 4);
-    if (grub_file_read (gzio->file, &orig_len, 4) != 4)
-      return 0;
-    /* FIXME: this does not handle files whose original size is over 4GB.
-       But how can we know the real original size?  */
-    file->size = grub_le_to_cpu32 (orig_len);
-  }
+  else
+    {
+      grub_file_seek (gzio->file, grub_file_size (gzio->file) - 4);
+      if (grub_file_read (gzio->file, &orig_len, 4) != 4)
+	return 0;
+      /* FIXME: this does not handle files whose original size is over 4GB.
+	 But how can we know the real original size?  */
+      file->size = grub_le_to_cpu32 (orig_len);
+    }
 
   initialize_tables (gzio);
 
@@ -366,8 +412,12 @@ static ush mask_bits[] =
 #define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte(gzio))<<k;k+=8;}} while (0)
 #define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
 
+/* Top the bit buffer up so that a whole literal or length/distance pair
+   can be decoded without going back for input.  */
+#define FILLBITS() fill_bits (gzio, &b, &k)
+
 static int
-get_byte (grub_gzio_t gzio)
+get_byte_slow (grub_gzio_t gzio)
 {
   if (gzio->mem_input)
     {
@@ -381,12 +431,94 @@ get_byte (grub_gzio_t gzio)
 		     || gzio->inbuf_d == INBUFSIZ))
     {
       gzio->inbuf_d = 0;
+      gzio->inbuf_off = grub_file_tell (gzio->file);
       grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+      grub_file_prefetch_ahead (gzio->file, &gzio->prefetch_end, PREFETCHSIZ);
+      gzio->inbuf_end = INBUFSIZ;
     }
 
   return gzio->inbuf[gzio->inbuf_d++];
 }
 
+static inline int
+get_byte (grub_gzio_t gzio)
+{
+  if (gzio->inbuf_d < gzio->inbuf_end)
+    return gzio->inbuf[gzio->inbuf_d++];
+  return get_byte_slow (gzio);
+}
+
+/* With a 64-bit bit buffer and 8 bytes at hand, load them at once and
+   consume the whole bytes that fit.  The bits above K then hold the start
+   of the next byte, which is or-ed in again at the same place later.
+   Reading past the end of the stream is harmless: those bits are never
+   used.  */
+static inline void
+fill_bits (grub_gzio_t gzio, ulg *b, unsigned *k)
+{
+  if (sizeof (ulg) == 8 && *k <= 56)
+    {
+      const grub_uint8_t *p = NULL;
+      unsigned n;
+
+      if (gzio->mem_input)
+	{
+	  if (gzio->mem_input_size - gzio->mem_input_off >= 8)
+	    p = gzio->mem_input + gzio->mem_input_off;
+	}
+      else if (gzio->inbuf_d + 8 <= gzio->inbuf_end)
+	p = gzio->inbuf + gzio->inbuf_d;
+
+      if (p)
+	{
+	  n = (63 - *k) >> 3;
+	  *b |= (ulg) grub_le_to_cpu64 (grub_get_unaligned64 (p)) << *k;
+	  *k += n << 3;
+	  if (gzio->mem_input)
+	    gzio->mem_input_off += n;
+	  else
+	    gzio->inbuf_d += n;
+	  return;
+	}
+    }
+
+  while (*k <= sizeof (ulg) * 8 - 8)
+    {
+      *b |= ((ulg) get_byte (gzio)) << *k;
+      *k += 8;
+    }
+}
+
+/* Copy up to LEN bytes of input to BUF as get_byte would return them,
+   and return how many were copied.  */
+static grub_size_t
+get_bytes (grub_gzio_t gzio, grub_uint8_t *buf, grub_size_t len)
+{
+  grub_size_t avail;
+
+  if (gzio->mem_input)
+    {
+      avail = gzio->mem_input_size - gzio->mem_input_off;
+      if (avail > len)
+	avail = len;
+      grub_memcpy (buf, gzio->mem_input + gzio->mem_input_off, avail);
+      gzio->mem_input_off += avail;
+      return avail;
+    }
+
+  if (gzio->inbuf_d >= gzio->inbuf_end)
+    {
+      *buf = get_byte_slow (gzio);
+      return 1;
+    }
+  avail = gzio->inbuf_end - gzio->inbuf_d;
+  if (avail > len)
+    avail = len;
+  grub_memcpy (buf, gzio->inbuf + gzio->inbuf_d, avail);
+  gzio->inbuf_d += avail;
+  return avail;
+}
+
 static void
 gzio_seek (grub_gzio_t gzio, grub_off_t off)
 {
@@ -399,13 +531,17 @@ gzio_seek (grub_gzio_t gzio, grub_off_t off)
 	gzio->mem_input_off = off;
     }
   else
-    grub_file_seek (gzio->file, off);
+    {
+      grub_file_seek (gzio->file, off);
+      gzio->inbuf_end = 0;
+    }
 }
 
 /* more function prototypes */
 static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
 		       struct huft **, int *);
 static int huft_free (struct huft *);
+static void free_tables (grub_gzio_t);
 static int inflate_codes_in_window (grub_gzio_t);
 
 
@@ -640,8 +776,8 @@ inflate_codes_in_window (grub_gzio_t gzio)
   unsigned w;			/* current window position */
   struct huft *t;		/* pointer to table entry */
   unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   d = gzio->inflate_d;
@@ -657,6 +793,7 @@ inflate_codes_in_window (grub_gzio_t gzio)
     {
       if (! gzio->code_state)
 	{
+	  FILLBITS ();
 	  NEEDBITS ((unsigned) gzio->bl);
 	  if ((e = (t = gzio->tl + ((unsigned) b & ml))->e) > 16)
 	    do
@@ -735,10 +872,21 @@ inflate_codes_in_window (grub_gzio_t gzio)
 		  d += e;
 		}
 	      else
-		/* purposefully use the overlap for extra copies here!! */
+		/* The source overlaps what is being written, so the copy
+		   repeats the last w - d bytes.  Copy them in chunks that
+		   double each time, as each chunk repeats the pattern.  */
 		{
-		  while (e--)
-		    gzio->slide[w++] = gzio->slide[d++];
+		  unsigned c, s = d;
+
+		  d += e;
+		  for (c = w - s; e; c = w - s)
+		    {
+		      if (c > e)
+			c = e;
+		      grub_memcpy (gzio->slide + w, gzio->slide + s, c);
+		      w += c;
+		      e -= c;
+		    }
 		}
 
 	      if (w == WSIZE)
@@ -807,6 +955,9 @@ init_fixed_block (grub_gzio_t gzio)
   int i;			/* temporary variable */
   unsigned l[288];		/* length list for huft_build */
 
+  if (gzio->fixed_tl)
+    goto done;
+
   /* set up literal table */
   for (i = 0; i < 144; i++)
     l[i] = 8;
@@ -816,29 +967,38 @@ init_fixed_block (grub_gzio_t gzio)
     l[i] = 7;
   for (; i < 288; i++)		/* make a complete, but wrong code set */
     l[i] = 8;
-  gzio->bl = 7;
-  if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  gzio->fixed_bl = 7;
+  if (huft_build (l, 288, 257, cplens, cplext, &gzio->fixed_tl,
+		  &gzio->fixed_bl) != 0)
     {
       if (grub_errno == GRUB_ERR_NONE)
 	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		    "failed in building a Huffman code table");
+      gzio->fixed_tl = 0;
       return;
     }
 
   /* set up distance table */
   for (i = 0; i < 30; i++)	/* make an incomplete code set */
     l[i] = 5;
-  gzio->bd = 5;
-  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->td, &gzio->bd) > 1)
+  gzio->fixed_bd = 5;
+  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->fixed_td,
+		  &gzio->fixed_bd) > 1)
     {
       if (grub_errno == GRUB_ERR_NONE)
 	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		    "failed in building a Huffman code table");
-      huft_free (gzio->tl);
-      gzio->tl = 0;
+      huft_free (gzio->fixed_tl);
+      gzio->fixed_tl = 0;
       return;
     }
 
+ done:
+  gzio->tl = gzio->fixed_tl;
+  gzio->td = gzio->fixed_td;
+  gzio->bl = gzio->fixed_bl;
+  gzio->bd = gzio->fixed_bd;
+
   /* indicate we're now working on a block */
   gzio->code_state = 0;
   gzio->block_len++;
@@ -1031,11 +1191,77 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/* The offset of the next input byte get_byte returns.  */
+static grub_off_t
+input_offset (grub_gzio_t gzio)
+{
+  if (gzio->mem_input)
+    return gzio->mem_input_off;
+  if (! gzio->inbuf_end)
+    return grub_file_tell (gzio->file);
+  return gzio->inbuf_off + gzio->inbuf_d;
+}
+
+/* Record a checkpoint for the block starting at OFFSET, unless the last
+   one is less than checkpoint_span before it.  Failing to allocate it only
+   stops recording.  */
+static void
+add_checkpoint (grub_gzio_t gzio, grub_off_t offset)
+{
+  struct gzio_checkpoint *c;
+  grub_off_t last = 0;
+  unsigned i;
+
+  if (! gzio->checkpoint_span)
+    return;
+
+  if (gzio->ncheckpoints)
+    last = gzio->checkpoints[gzio->ncheckpoints - 1]->offset;
+  if (offset < last + gzio->checkpoint_span)
+    return;
+
+  if (gzio->ncheckpoints == MAX_CHECKPOINTS)
+    {
+      for (i = 0; i < MAX_CHECKPOINTS / 2; i++)
+	{
+	  grub_free (gzio->checkpoints[2 * i]);
+	  gzio->checkpoints[i] = gzio->checkpoints[2 * i + 1];
+	}
+      gzio->ncheckpoints = MAX_CHECKPOINTS / 2;
+      gzio->checkpoint_span *= 2;
+      if (offset < last + gzio->checkpoint_span)
+	return;
+    }
+
+  if (! gzio->checkpoints)
+    gzio->checkpoints = grub_malloc (MAX_CHECKPOINTS
+				     * sizeof (gzio->checkpoints[0]));
+  c = gzio->checkpoints ? grub_malloc (sizeof (*c)) : NULL;
+  if (! c)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      gzio->checkpoint_span = 0;
+      return;
+    }
+
+  c->offset = offset;
+  c->in_offset = input_offset (gzio);
+  c->bb = gzio->bb;
+  c->bk = gzio->bk;
+  grub_memcpy (c->slide, gzio->slide, WSIZE);
+  gzio->checkpoints[gzio->ncheckpoints++] = c;
+}
+
+/* Inflate until the end of the slide, which holds the byte at offset X in
+   slide[X % WSIZE], so that it always holds the WSIZE bytes before
+   saved_offset.  */
 static void
 inflate_window (grub_gzio_t gzio)
 {
+  unsigned start;
+
   /* initialize window */
-  gzio->wp = 0;
+  start = gzio->wp = gzio->saved_offset & (WSIZE - 1);
 
   /*
    *  Main decompression loop.
@@ -1048,6 +1274,7 @@ inflate_window (grub_gzio_t gzio)
 	  if (gzio->last_block)
 	    break;
 
+	  add_checkpoint (gzio, gzio->saved_offset + gzio->wp - start);
 	  get_new_block (gzio);
 	}
 
@@ -1069,11 +1296,29 @@ inflate_window (grub_gzio_t gzio)
 	   *  This is basically a glorified pass-through
 	   */
 
-	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	  /* Whole bytes may still be waiting in the bit buffer.  */
+	  while (gzio->block_len && w < WSIZE && gzio->bk >= 8)
 	    {
-	      gzio->slide[w++] = get_byte (gzio);
+	      gzio->slide[w++] = gzio->bb & 0xff;
+	      gzio->bb >>= 8;
+	      gzio->bk -= 8;
 	      gzio->block_len--;
 	    }
+	  /* Drop the copies of the bytes about to be read directly.  */
+	  gzio->bb &= ((ulg) 1 << gzio->bk) - 1;
+
+	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	    {
+	      grub_size_t len = gzio->block_len;
+	      if (len > (grub_size_t) (WSIZE - w))
+		len = WSIZE - w;
+	      len = get_bytes (gzio, gzio->slide + w, len);
+	      w += len;
+	      gzio->block_len -= len;
+	      if (!len)
+		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			    "premature end of compressed");
+	    }
 
 	  gzio->wp = w;
 
@@ -1085,15 +1330,10 @@ inflate_window (grub_gzio_t gzio)
        */
 
       if (inflate_codes_in_window (gzio))
-	{
-	  huft_free (gzio->tl);
-	  huft_free (gzio->td);
-	  gzio->tl = 0;
-	  gzio->td = 0;
-	}
+	free_tables (gzio);
     }
 
-  gzio->saved_offset += gzio->wp;
+  gzio->saved_offset += gzio->wp - start;
 
   /* XXX do CRC calculation here! */
 }
@@ -1114,12 +1354,75 @@ initialize_tables (grub_gzio_t gzio)
   gzio->block_len = 0;
 
   /* Reset memory allocation stuff.  */
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  free_tables (gzio);
+}
+
+/* Free the tables of the current block, unless they are the fixed ones.  */
+static void
+free_tables (grub_gzio_t gzio)
+{
+  if (gzio->tl != gzio->fixed_tl)
+    huft_free (gzio->tl);
+  if (gzio->td != gzio->fixed_td)
+    huft_free (gzio->td);
   gzio->tl = NULL;
   gzio->td = NULL;
 }
 
+static void
+free_all_tables (grub_gzio_t gzio)
+{
+  unsigned i;
+
+  free_tables (gzio);
+  huft_free (gzio->fixed_tl);
+  huft_free (gzio->fixed_td);
+  gzio->fixed_tl = NULL;
+  gzio->fixed_td = NULL;
+
+  for (i = 0; i < gzio->ncheckpoints; i++)
+    grub_free (gzio->checkpoints[i]);
+  grub_free (gzio->checkpoints);
+  gzio->checkpoints = NULL;
+  gzio->ncheckpoints = 0;
+}
+
+/* Return the last checkpoint not beyond OFFSET, or NULL.  */
+static struct gzio_checkpoint *
+find_checkpoint (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->ncheckpoints;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (gzio->checkpoints[mid]->offset <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo ? gzio->checkpoints[lo - 1] : NULL;
+}
+
+/* Continue inflating at checkpoint C.  */
+static void
+resume_at_checkpoint (grub_gzio_t gzio, struct gzio_checkpoint *c)
+{
+  free_tables (gzio);
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+  gzio->bb = c->bb;
+  gzio->bk = c->bk;
+  grub_memcpy (gzio->slide, c->slide, WSIZE);
+  gzio->saved_offset = c->offset;
+
+  gzio_seek (gzio, c->in_offset);
+  /* Have get_byte read from the new offset.  */
+  gzio->inbuf_d = INBUFSIZ;
+  gzio->prefetch_end = 0;
+}
+
 
 /* Open a new decompressing object on the top of IO. If TRANSPARENT is true,
    even if IO does not contain data compressed by gzip, return a valid file
@@ -1147,6 +1450,7 @@ grub_gzio_open (grub_file_t io, const char *name __attribute__ ((unused)))
   file->data = gzio;
   file->fs = &grub_gzio_fs;
   file->not_easily_seekable = 1;
+  gzio->checkpoint_span = CHECKPOINT_SPAN;
 
   if (! test_gzip_header (file))
     {
@@ -1218,9 +1522,16 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
-
-  /* Do we reset decompression to the beginning of the file?  */
-  if (gzio->saved_offset > offset + WSIZE)
+  struct gzio_checkpoint *c;
+
+  /* Going back beyond the slide, or forward past a checkpoint, resume at
+     the last checkpoint before OFFSET.  Without one, reset decompression
+     to the beginning of the file.  */
+  c = find_checkpoint (gzio, offset);
+  if (c && (c->offset > gzio->saved_offset
+	    || gzio->saved_offset > offset + WSIZE))
+    resume_at_checkpoint (gzio, c);
+  else if (gzio->saved_offset > offset + WSIZE)
     initialize_tables (gzio);
 
   /*
@@ -1236,14 +1547,13 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 
       while (offset >= gzio->saved_offset)
 	{
+	  grub_off_t before = gzio->saved_offset;
+
 	  inflate_window (gzio);
-	  if (gzio->wp == 0)
+	  if (gzio->saved_offset == before)
 	    goto out;
 	}
 
-      if (gzio->wp == 0)
-	goto out;
-
       srcaddr = (char *) ((offset & (WSIZE - 1)) + gzio->slide);
       size = gzio->saved_offset - offset;
       if (size > len)
@@ -1270,7 +1580,10 @@ grub_gzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_ssize_t ret;
   ret = grub_gzio_read_real (file->data, file->offset, buf, len);
 
-  if (!grub_errno && ret != (grub_ssize_t) len)
+  if (!grub_errno && ret != (grub_ssize_t) len
+      && file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = file->offset + ret;
+  else if (!grub_errno && ret != (grub_ssize_t) len)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "premature end of compressed");
       ret = -1;
@@ -1278,6 +1591,19 @@ grub_gzio_read (grub_file_t file, char *buf, grub_size_t len)
   return ret;
 }
 
+/* Where the compressed data for OFFSET lies isn't known, but reads go
+   forward, so have what follows the input read so far fetched.  */
+static void
+grub_gzio_prefetch (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  grub_gzio_t gzio = file->data;
+
+  if (offset < file->offset)
+    return;
+  grub_file_prefetch_ahead (gzio->file, &gzio->prefetch_end,
+			    len > PREFETCHSIZ ? len : PREFETCHSIZ);
+}
+
 /* Release everything, including the underlying file object.  */
 static grub_err_t
 grub_gzio_close (grub_file_t file)
@@ -1285,8 +1611,7 @@ grub_gzio_close (grub_file_t file)
   grub_gzio_t gzio = file->data;
 
   grub_file_close (gzio->file);
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  free_all_tables (gzio);
   grub_free (gzio);
 
   /* No need to close the same device twice.  */
@@ -1317,6 +1642,7 @@ grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
     }
 
   ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
+  free_all_tables (gzio);
   grub_free (gzio);
 
   /* FIXME: Check Adler.  */
@@ -1340,6 +1666,7 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   initialize_tables (gzio);
 
   ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
+  free_all_tables (gzio);
   grub_free (gzio);
 
   return ret;
@@ -1347,12 +1674,60 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 
 
 
+struct grub_zlib_stream
+{
+  struct grub_gzio gzio;
+  grub_off_t offset;
+};
+
+struct grub_zlib_stream *
+grub_zlib_stream_open (const void *inbuf, grub_size_t insize)
+{
+  struct grub_zlib_stream *stream;
+
+  stream = grub_zalloc (sizeof (*stream));
+  if (! stream)
+    return NULL;
+  stream->gzio.mem_input = (grub_uint8_t *) inbuf;
+  stream->gzio.mem_input_size = insize;
+
+  if (!test_zlib_header (&stream->gzio))
+    {
+      grub_free (stream);
+      return NULL;
+    }
+  return stream;
+}
+
+grub_ssize_t
+grub_zlib_stream_read (struct grub_zlib_stream *stream, void *buf,
+		       grub_size_t len)
+{
+  grub_ssize_t ret;
+
+  ret = grub_gzio_read_real (&stream->gzio, stream->offset, buf, len);
+  if (ret > 0)
+    stream->offset += ret;
+  return ret;
+}
+
+void
+grub_zlib_stream_close (struct grub_zlib_stream *stream)
+{
+  if (! stream)
+    return;
+  free_all_tables (&stream->gzio);
+  grub_free (stream);
+}
+
+
 static struct grub_fs grub_gzio_fs =
   {
     .name = "gzio",
     .dir = 0,
     .open = 0,
     .read = grub_gzio_read,
+    .prefetch = grub_gzio_prefetch,
     .close = grub_gzio_close,
     .label = 0,
     .next = 0
@@ -0,0 +1,539 @@
+/* lz4io.c - decompression support for lz4 */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Both the LZ4 frame format and the legacy one that Linux uses for its
+   images are handled.  The optional xxHash checksums are skipped.  */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MAGIC		0x184d2204
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_SKIPPABLE_MAGIC	0x184d2a50
+#define LZ4_SKIPPABLE_MASK	0xfffffff0
+
+#define LZ4_FLG_VERSION		0xc0
+#define LZ4_FLG_VERSION_1	0x40
+#define LZ4_FLG_BLOCK_INDEP	0x20
+#define LZ4_FLG_BLOCK_CHECKSUM	0x10
+#define LZ4_FLG_CONTENT_SIZE	0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_RESERVED	0x02
+#define LZ4_FLG_DICT_ID		0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000
+
+/* How far back matches of linked blocks reach.  */
+#define LZ4_HISTORY		0x10000
+#define LZ4_LEGACY_BLOCK	(8 << 20)
+#define LZ4_COMPRESS_BOUND(n)	((n) + (n) / 255 + 16)
+
+#define LZ4PREFETCHSIZ		0x20000
+
+struct grub_lz4io
+{
+  grub_file_t file;
+  grub_off_t prefetch_end;
+  grub_off_t in_off;
+  grub_uint8_t *inbuf;
+  grub_size_t inbuf_size;
+
+  /* The frame being decoded.  */
+  int in_frame;
+  int nframes;
+  int eof;
+  int legacy;
+  int linked;
+  int block_checksum;
+  int content_checksum;
+  int has_content_size;
+  grub_uint64_t content_size;
+  grub_uint64_t frame_pos;
+  grub_size_t block_max;
+
+  /* The output, preceded by the history that linked blocks refer to.
+     WIN[0] is at offset WIN_OFF of the uncompressed data.  */
+  grub_uint8_t *win;
+  grub_size_t win_alloc;
+  grub_size_t win_pos;
+  grub_off_t win_off;
+};
+
+typedef struct grub_lz4io *grub_lz4io_t;
+static struct grub_fs grub_lz4io_fs;
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		     N_("lz4 data corrupted or unsupported"));
+}
+
+/* Read up to LEN bytes of compressed data and return how many there were
+   or -1.  */
+static grub_ssize_t
+fetch_some (grub_lz4io_t lz4io, void *buf, grub_size_t len)
+{
+  grub_ssize_t r;
+
+  if (grub_file_tell (lz4io->file) != lz4io->in_off)
+    grub_file_seek (lz4io->file, lz4io->in_off);
+  r = grub_file_read (lz4io->file, buf, len);
+  if (r < 0)
+    return -1;
+  grub_file_prefetch_ahead (lz4io->file, &lz4io->prefetch_end,
+			    LZ4PREFETCHSIZ);
+  lz4io->in_off += r;
+  return r;
+}
+
+/* Read exactly LEN bytes of compressed data.  */
+static grub_err_t
+fetch (grub_lz4io_t lz4io, void *buf, grub_size_t len)
+{
+  grub_ssize_t r = fetch_some (lz4io, buf, len);
+
+  if (r < 0)
+    return grub_errno;
+  if ((grub_size_t) r != len)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of compressed"));
+  return GRUB_ERR_NONE;
+}
+
+static int
+is_magic (grub_uint32_t magic)
+{
+  return magic == LZ4_MAGIC || magic == LZ4_LEGACY_MAGIC
+    || (magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC;
+}
+
+/* Parse the header of the next frame, skipping the skippable ones, or set
+   EOF when the last one is over.  With WINDOW unset, only look at what the
+   header says.  */
+static grub_err_t
+start_frame (grub_lz4io_t lz4io, int window)
+{
+  grub_uint8_t hdr[11];
+  grub_uint32_t magic;
+  grub_size_t need, inbuf_need;
+
+  while (1)
+    {
+      grub_ssize_t r = fetch_some (lz4io, hdr, 4);
+
+      if (r < 0)
+	return grub_errno;
+      if (r == 0 && lz4io->nframes)
+	{
+	  lz4io->eof = 1;
+	  return GRUB_ERR_NONE;
+	}
+      if (r != 4)
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   N_("premature end of compressed"));
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+      if ((magic & LZ4_SKIPPABLE_MASK) != LZ4_SKIPPABLE_MAGIC)
+	break;
+      if (fetch (lz4io, hdr, 4))
+	return grub_errno;
+      lz4io->in_off += grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+      lz4io->nframes++;
+    }
+
+  if (magic == LZ4_LEGACY_MAGIC)
+    {
+      lz4io->legacy = 1;
+      lz4io->linked = 0;
+      lz4io->block_checksum = 0;
+      lz4io->content_checksum = 0;
+      lz4io->has_content_size = 0;
+      lz4io->block_max = LZ4_LEGACY_BLOCK;
+    }
+  else if (magic == LZ4_MAGIC)
+    {
+      unsigned flg, bd;
+
+      if (fetch (lz4io, hdr, 2))
+	return grub_errno;
+      flg = hdr[0];
+      bd = hdr[1];
+      if ((flg & (LZ4_FLG_VERSION | LZ4_FLG_RESERVED)) != LZ4_FLG_VERSION_1
+	  || (bd & 0x8f) || ((bd >> 4) & 7) < 4)
+	return corrupted ();
+      if (flg & LZ4_FLG_DICT_ID)
+	return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			   "lz4 dictionaries not supported");
+
+      lz4io->legacy = 0;
+      lz4io->linked = !(flg & LZ4_FLG_BLOCK_INDEP);
+      lz4io->block_checksum = !!(flg & LZ4_FLG_BLOCK_CHECKSUM);
+      lz4io->content_checksum = !!(flg & LZ4_FLG_CONTENT_CHECKSUM);
+      lz4io->has_content_size = !!(flg & LZ4_FLG_CONTENT_SIZE);
+      lz4io->block_max = 1 << (8 + 2 * ((bd >> 4) & 7));
+
+      /* The content size if any, and the header checksum.  */
+      if (fetch (lz4io, hdr, lz4io->has_content_size ? 9 : 1))
+	return grub_errno;
+      if (lz4io->has_content_size)
+	lz4io->content_size = grub_le_to_cpu64 (grub_get_unaligned64 (hdr));
+    }
+  else
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("not an lz4 frame"));
+
+  lz4io->in_frame = 1;
+  lz4io->nframes++;
+  if (!window)
+    return GRUB_ERR_NONE;
+
+  lz4io->frame_pos = 0;
+  lz4io->win_off += lz4io->win_pos;
+  lz4io->win_pos = 0;
+
+  /* Linked blocks need the history and a block, and as much again not to
+     slide the window after each of them.  */
+  need = lz4io->block_max;
+  if (lz4io->linked)
+    need = 2 * lz4io->block_max + LZ4_HISTORY;
+  if (lz4io->has_content_size && lz4io->content_size < need)
+    need = lz4io->content_size;
+  if (need == 0)
+    need = 1;
+  if (need > lz4io->win_alloc)
+    {
+      grub_free (lz4io->win);
+      lz4io->win = grub_malloc (need);
+      if (!lz4io->win)
+	{
+	  lz4io->win_alloc = 0;
+	  return grub_errno;
+	}
+      lz4io->win_alloc = need;
+    }
+
+  inbuf_need = lz4io->block_max;
+  if (lz4io->legacy)
+    inbuf_need = LZ4_COMPRESS_BOUND (LZ4_LEGACY_BLOCK);
+  if (inbuf_need > lz4io->inbuf_size)
+    {
+      grub_free (lz4io->inbuf);
+      lz4io->inbuf = grub_malloc (inbuf_need);
+      if (!lz4io->inbuf)
+	{
+	  lz4io->inbuf_size = 0;
+	  return grub_errno;
+	}
+      lz4io->inbuf_size = inbuf_need;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+decode_block (grub_lz4io_t lz4io)
+{
+  grub_uint8_t hdr[4];
+  grub_uint32_t size;
+  grub_size_t room;
+  grub_uint8_t *dest;
+  grub_ssize_t r;
+
+  r = fetch_some (lz4io, hdr, 4);
+  if (r < 0)
+    return grub_errno;
+  /* Legacy frames just stop.  */
+  if (r == 0 && lz4io->legacy)
+    {
+      lz4io->in_frame = 0;
+      return GRUB_ERR_NONE;
+    }
+  if (r != 4)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of compressed"));
+  size = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+
+  if (lz4io->legacy && is_magic (size))
+    {
+      lz4io->in_off -= 4;
+      lz4io->in_frame = 0;
+      return GRUB_ERR_NONE;
+    }
+  if (!lz4io->legacy && size == 0)
+    {
+      lz4io->in_frame = 0;
+      if (lz4io->content_checksum)
+	lz4io->in_off += 4;
+      if (lz4io->has_content_size
+	  && lz4io->frame_pos != lz4io->content_size)
+	return corrupted ();
+      return GRUB_ERR_NONE;
+    }
+
+  if (lz4io->win_alloc - lz4io->win_pos < lz4io->block_max)
+    {
+      grub_size_t keep = 0;
+
+      if (lz4io->linked)
+	keep = lz4io->win_pos < LZ4_HISTORY ? lz4io->win_pos : LZ4_HISTORY;
+      grub_memmove (lz4io->win, lz4io->win + lz4io->win_pos - keep, keep);
+      lz4io->win_off += lz4io->win_pos - keep;
+      lz4io->win_pos = keep;
+    }
+  dest = lz4io->win + lz4io->win_pos;
+  room = lz4io->win_alloc - lz4io->win_pos;
+  if (room > lz4io->block_max)
+    room = lz4io->block_max;
+
+  if (!lz4io->legacy && (size & LZ4_BLOCK_UNCOMPRESSED))
+    {
+      size &= ~LZ4_BLOCK_UNCOMPRESSED;
+      if (size > room)
+	return corrupted ();
+      if (fetch (lz4io, dest, size))
+	return grub_errno;
+      r = size;
+    }
+  else
+    {
+      if (size > lz4io->inbuf_size)
+	return corrupted ();
+      if (fetch (lz4io, lz4io->inbuf, size))
+	return grub_errno;
+      r = grub_lz4_decompress_block (lz4io->inbuf, size, dest, room,
+				     lz4io->linked ? lz4io->win_pos : 0);
+      if (r < 0)
+	return corrupted ();
+    }
+
+  lz4io->win_pos += r;
+  lz4io->frame_pos += r;
+  if (lz4io->block_checksum)
+    lz4io->in_off += 4;
+  return GRUB_ERR_NONE;
+}
+
+static void
+lz4io_restart (grub_lz4io_t lz4io)
+{
+  lz4io->in_off = 0;
+  lz4io->in_frame = 0;
+  lz4io->nframes = 0;
+  lz4io->eof = 0;
+  lz4io->win_pos = 0;
+  lz4io->win_off = 0;
+}
+
+static void
+lz4io_free (grub_lz4io_t lz4io)
+{
+  grub_free (lz4io->inbuf);
+  grub_free (lz4io->win);
+  grub_free (lz4io);
+}
+
+/* Decode up to LEN bytes from OFFSET and return how many there were or
+   -1.  */
+static grub_ssize_t
+lz4io_read (grub_lz4io_t lz4io, grub_off_t offset, grub_uint8_t *buf,
+	    grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+
+  if (offset < lz4io->win_off)
+    lz4io_restart (lz4io);
+
+  while (len > 0)
+    {
+      grub_off_t end = lz4io->win_off + lz4io->win_pos;
+
+      if (offset < end)
+	{
+	  grub_size_t n = end - offset;
+
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, lz4io->win + (offset - lz4io->win_off), n);
+	  buf += n;
+	  len -= n;
+	  offset += n;
+	  ret += n;
+	  continue;
+	}
+
+      if (lz4io->eof)
+	break;
+
+      if (lz4io->in_frame ? decode_block (lz4io) : start_frame (lz4io, 1))
+	return -1;
+    }
+
+  return ret;
+}
+
+/* Add up the content sizes of the frames, going from block header to block
+   header to find where the next one starts.  Return -1 when one of them
+   doesn't say.  */
+static grub_off_t
+lz4io_content_size (grub_lz4io_t lz4io)
+{
+  grub_off_t total = 0;
+
+  while (1)
+    {
+      grub_uint8_t hdr[4];
+      grub_uint32_t size;
+
+      if (start_frame (lz4io, 0))
+	return -1;
+      if (lz4io->eof)
+	return total;
+      if (!lz4io->has_content_size)
+	return -1;
+      total += lz4io->content_size;
+      while (1)
+	{
+	  if (fetch (lz4io, hdr, 4))
+	    return -1;
+	  size = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+	  if (size == 0)
+	    break;
+	  lz4io->in_off += (size & ~LZ4_BLOCK_UNCOMPRESSED)
+	    + (lz4io->block_checksum ? 4 : 0);
+	}
+      lz4io->in_frame = 0;
+      if (lz4io->content_checksum)
+	lz4io->in_off += 4;
+    }
+}
+
+static grub_file_t
+grub_lz4io_open (grub_file_t io,
+		 const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_lz4io_t lz4io;
+  grub_uint8_t magic[4];
+  grub_off_t size;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, magic, sizeof (magic)) != sizeof (magic)
+      || !is_magic (grub_le_to_cpu32 (grub_get_unaligned32 (magic))))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  lz4io = grub_zalloc (sizeof (*lz4io));
+  if (!lz4io)
+    {
+      grub_free (file);
+      return 0;
+    }
+  lz4io->file = io;
+
+  file->device = io->device;
+  file->data = lz4io;
+  file->fs = &grub_lz4io_fs;
+  file->not_easily_seekable = 1;
+
+  /* The legacy format and streamed compression don't record the size, so
+     decode everything once to find it then.  */
+  size = lz4io_content_size (lz4io);
+  lz4io_restart (lz4io);
+  if (size == (grub_off_t) -1)
+    {
+      grub_uint8_t *scratch;
+      grub_ssize_t n = -1;
+
+      grub_errno = GRUB_ERR_NONE;
+      size = 0;
+      scratch = grub_malloc (LZ4_HISTORY);
+      if (scratch)
+	do
+	  {
+	    n = lz4io_read (lz4io, size, scratch, LZ4_HISTORY);
+	    size += n;
+	  }
+	while (n == LZ4_HISTORY);
+      grub_free (scratch);
+      if (n < 0)
+	{
+	  lz4io_free (lz4io);
+	  grub_free (file);
+	  return 0;
+	}
+    }
+  file->size = size;
+
+  return file;
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  return lz4io_read (file->data, file->offset, (grub_uint8_t *) buf, len);
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+
+  grub_file_close (lz4io->file);
+  lz4io_free (lz4io);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs = {
+  .name = "lz4io",
+  .dir = 0,
+  .open = 0,
+  .read = grub_lz4io_read,
+  .close = grub_lz4io_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lz4io)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZ4IO, grub_lz4io_open);
+}
+
+GRUB_MOD_FINI (lz4io)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZ4IO);
+}
@@ -23,7 +23,7 @@
 #include <grub/fs.h>
 #include <grub/dl.h>
 #include <grub/crypto.h>
-#include <minilzo.h>
+#include <grub/lzo1x.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -31,6 +31,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define LZOP_MAGIC_SIZE 9
 #define LZOP_CHECK_SIZE 4
 #define LZOP_NEW_LIB 0x0940
+/* Newest LZO library version whose output is known to decompress.  */
+#define LZOP_MAX_LIB 0x2050
 
 /* Header flags - copied from conf.h of LZOP source code.  */
 #define F_ADLER32_D	0x00000001L
@@ -69,6 +71,15 @@ struct grub_lzopio
   grub_off_t saved_off;		/* Rounded down to block boundary.  */
   grub_off_t start_block_off;
   struct block_header block;
+  /* Uncompressed offset and offset in the file of every block header,
+     so that seeks go straight to the right block.  */
+  struct
+  {
+    grub_off_t uoff;
+    grub_off_t off;
+  } *index;
+  grub_size_t index_size;
+  grub_size_t index_alloc;
 };
 
 typedef struct grub_lzopio *grub_lzopio_t;
@@ -190,8 +201,6 @@ read_block_data (struct grub_lzopio *lzopio)
 static int
 uncompress_block (struct grub_lzopio *lzopio)
 {
-  lzo_uint usize = lzopio->block.usize;
-
   if (read_block_data (lzopio) < 0)
     return -1;
 
@@ -207,9 +216,9 @@ uncompress_block (struct grub_lzopio *lzopio)
       if (!lzopio->block.udata)
 	return -1;
 
-      if (lzo1x_decompress_safe (lzopio->block.cdata, lzopio->block.csize,
-				 lzopio->block.udata, &usize, NULL)
-	  != LZO_E_OK)
+      if (grub_lzo1x_decompress (lzopio->block.cdata, lzopio->block.csize,
+				 lzopio->block.udata, lzopio->block.usize)
+	  != (grub_ssize_t) lzopio->block.usize)
 	return -1;
 
       if (lzopio->ucheck_fun)
@@ -253,11 +262,42 @@ jump_block (struct grub_lzopio *lzopio)
   return read_block_header (lzopio);
 }
 
+/* Remember that the block whose header is at OFF starts at UOFF.  Without
+   memory the index is dropped and seeks walk the blocks instead.  */
+static int
+index_block (struct grub_lzopio *lzopio, grub_off_t uoff, grub_off_t off)
+{
+  if (lzopio->index_size == lzopio->index_alloc)
+    {
+      grub_size_t alloc = lzopio->index_alloc ? 2 * lzopio->index_alloc : 64;
+      void *n;
+
+      n = grub_realloc (lzopio->index, alloc * sizeof (lzopio->index[0]));
+      if (!n)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_free (lzopio->index);
+	  lzopio->index = NULL;
+	  lzopio->index_size = lzopio->index_alloc = 0;
+	  return -1;
+	}
+      lzopio->index = n;
+      lzopio->index_alloc = alloc;
+    }
+
+  lzopio->index[lzopio->index_size].uoff = uoff;
+  lzopio->index[lzopio->index_size].off = off;
+  lzopio->index_size++;
+  return 0;
+}
+
 static int
 calculate_uncompressed_size (grub_file_t file)
 {
   grub_lzopio_t lzopio = file->data;
   grub_off_t usize_total = 0;
+  grub_off_t off = grub_file_tell (lzopio->file);
+  int indexing = 1;
 
   if (read_block_header (lzopio) < 0)
     return -1;
@@ -265,7 +305,10 @@ calculate_uncompressed_size (grub_file_t file)
   /* FIXME: Don't do this for not easily seekable files.  */
   while (lzopio->block.usize != 0)
     {
+      if (indexing && index_block (lzopio, usize_total, off) < 0)
+	indexing = 0;
       usize_total += lzopio->block.usize;
+      off = grub_file_tell (lzopio->file) + lzopio->block.csize;
 
       if (jump_block (lzopio) < 0)
 	return -1;
@@ -311,8 +354,8 @@ test_header (grub_file_t file)
   if (grub_be_to_cpu16(header.lib_version) < LZOP_NEW_LIB)
     return 0;
 
-  /* Too new version, should upgrade minilzo?  */
-  if (grub_be_to_cpu16 (header.lib_version_ext) > MINILZO_VERSION)
+  /* Too new version, should upgrade lzo1x.c?  */
+  if (grub_be_to_cpu16 (header.lib_version_ext) > LZOP_MAX_LIB)
     return 0;
 
   flags = grub_be_to_cpu32 (header.flags);
@@ -455,6 +498,40 @@ grub_lzopio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_ssize_t ret = 0;
   grub_off_t off;
 
+  /* Seek outside of the current block: go to the block holding the data
+     through the index.  */
+  if (lzopio->index_size
+      && grub_file_tell (file) < file->size
+      && (lzopio->saved_off > grub_file_tell (file)
+	  || lzopio->saved_off + lzopio->block.usize <= grub_file_tell (file)))
+    {
+      grub_size_t lo = 0, hi = lzopio->index_size;
+
+      /* Last block starting at or before the position.  */
+      while (hi - lo > 1)
+	{
+	  grub_size_t mid = lo + (hi - lo) / 2;
+
+	  if (lzopio->index[mid].uoff <= grub_file_tell (file))
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+
+      /* Reading on into the next block costs nothing more than before.  */
+      if (lzopio->index[lo].uoff != lzopio->saved_off + lzopio->block.usize)
+	{
+	  if (grub_file_seek (lzopio->file, lzopio->index[lo].off)
+	      == (grub_off_t) -1)
+	    goto CORRUPTED;
+
+	  lzopio->block.usize = 0;
+	  lzopio->saved_off = lzopio->index[lo].uoff;
+	  if (read_block_header (lzopio) < 0)
+	    goto CORRUPTED;
+	}
+    }
+
   /* Backward seek before last read block.  */
   if (lzopio->saved_off > grub_file_tell (file))
     {
@@ -519,6 +596,7 @@ grub_lzopio_close (grub_file_t file)
   grub_file_close (lzopio->file);
   grub_free (lzopio->block.cdata);
   grub_free (lzopio->block.udata);
+  grub_free (lzopio->index);
   grub_free (lzopio);
 
   /* Device must not be closed twice.  */
@@ -36,6 +36,13 @@ grub_offset_read (grub_file_t file, char *buf, grub_size_t len)
   return grub_file_read (data->parent, buf, len);
 }
 
+static void
+grub_offset_prefetch (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  struct grub_offset_file *data = file->data;
+  grub_file_prefetch (data->parent, data->off + offset, len);
+}
+
 static grub_err_t
 grub_offset_close (grub_file_t file)
 {
@@ -55,6 +62,7 @@ static struct grub_fs grub_offset_fs = {
   .dir = 0,
   .open = 0,
   .read = grub_offset_read,
+  .prefetch = grub_offset_prefetch,
   .close = grub_offset_close,
   .label = 0,
   .next = 0
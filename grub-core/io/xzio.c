@@ -23,6 +23,7 @@
 #include <grub/file.h>
 #include <grub/fs.h>
 #include <grub/dl.h>
+#include <grub/mp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -30,8 +31,30 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #include "xz_stream.h"
 
 #define XZBUFSIZ 0x2000
+#define XZPREFETCHSIZ 0x20000
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
+#define XZ_MAX_BLOCKS 0x100000
+/* Memory the blocks being decoded in parallel may take together.  */
+#define XZ_MP_MEMORY (64 << 20)
+#define XZ_FILTER_LZMA2 0x21
+
+/* Where a block starts, compressed and uncompressed.  */
+struct grub_xzio_block
+{
+  grub_off_t offset;
+  grub_off_t uoffset;
+};
+
+/* A decoder working on one whole block in parallel mode.  */
+struct grub_xzio_slot
+{
+  struct xz_dec *dec;
+  struct xz_buf buf;
+  grub_uint8_t *in;
+  grub_uint8_t *out;
+  enum xz_ret ret;
+};
 
 struct grub_xzio
 {
@@ -41,6 +64,21 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  grub_off_t prefetch_end;
+  /* The blocks out of the index, to start decoding at any of them.  */
+  struct grub_xzio_block *blocks;
+  grub_size_t nblocks;
+  grub_off_t index_offset;
+  /* Where to stop feeding the decoder, if anywhere.  */
+  grub_off_t in_end;
+  grub_uint8_t stream_header[STREAM_HEADER_SIZE];
+  /* Parallel mode: blocks FIRST_SLOT_BLOCK up to FIRST_SLOT_BLOCK
+     + NSLOTS_USED are decoded in SLOTS.  */
+  int mp_tried;
+  struct grub_xzio_slot *slots;
+  grub_size_t nslots;
+  grub_size_t nslots_used;
+  grub_size_t first_slot_block;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -99,6 +137,7 @@ test_header (grub_file_t file)
 
   if (xzio->buf.in_size != STREAM_HEADER_SIZE)
     return 0;
+  grub_memcpy (xzio->stream_header, xzio->inbuf, STREAM_HEADER_SIZE);
 
   ret = xz_dec_run (xzio->dec, &xzio->buf);
 
@@ -122,7 +161,10 @@ test_footer (grub_file_t file)
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
   grub_uint64_t uncompressed_size;
+  grub_uint64_t unpadded_size;
   grub_uint64_t records;
+  grub_off_t offset = STREAM_HEADER_SIZE;
+  grub_size_t i = 0;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -139,8 +181,8 @@ test_footer (grub_file_t file)
   backsize = (grub_le_to_cpu32 (backsize) + 1) * 4;
 
   /* Set file to the beginning of stream index.  */
-  grub_file_seek (xzio->file,
-		  xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize);
+  xzio->index_offset = xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize;
+  grub_file_seek (xzio->file, xzio->index_offset);
 
   /* Test index marker.  */
   if (grub_file_read (xzio->file, &imarker, sizeof (imarker))
@@ -150,30 +192,388 @@ test_footer (grub_file_t file)
   if (read_vli (xzio->file, &records) <= 0)
     goto ERROR;
 
-  for (; records != 0; records--)
+  if (records <= XZ_MAX_BLOCKS)
+    xzio->blocks = grub_malloc (records * sizeof (xzio->blocks[0]));
+  grub_errno = GRUB_ERR_NONE;
+
+  for (; records != 0; records--, i++)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      if (read_vli (xzio->file, &unpadded_size) <= 0)
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      if (xzio->blocks)
+	{
+	  xzio->blocks[i].offset = offset;
+	  xzio->blocks[i].uoffset = uncompressed_size_total;
+	}
+      offset += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
 
+  /* Only with a single stream do the blocks end where the index starts, and
+     only then can they be found from the index.  */
+  if (xzio->blocks && offset == xzio->index_offset)
+    xzio->nblocks = i;
+  else
+    {
+      grub_free (xzio->blocks);
+      xzio->blocks = 0;
+    }
+
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
 
 ERROR:
+  grub_free (xzio->blocks);
+  xzio->blocks = 0;
   return 0;
 }
 
+/* Return the index of the block holding OFFSET, the last one past the
+   end.  */
+static grub_size_t
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->nblocks;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (xzio->blocks[mid].uoffset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Have the decoder start over at block I, which is possible because the
+   blocks don't depend on each other.  It only has to see the stream header
+   again.  Stop feeding it before the index as it would find that the blocks
+   it skipped are missing.  */
+static grub_err_t
+jump_to_block (grub_xzio_t xzio, grub_size_t i)
+{
+  enum xz_ret ret;
+
+  xz_dec_reset (xzio->dec);
+  xzio->buf.in_pos = 0;
+  xzio->buf.out_pos = 0;
+  xzio->buf.out_size = XZBUFSIZ;
+  grub_file_seek (xzio->file, 0);
+  xzio->buf.in_size = grub_file_read (xzio->file, xzio->inbuf,
+				      STREAM_HEADER_SIZE);
+  if (xzio->buf.in_size != STREAM_HEADER_SIZE)
+    goto fail;
+  ret = xz_dec_run (xzio->dec, &xzio->buf);
+  if (ret != XZ_OK || xzio->buf.in_pos != STREAM_HEADER_SIZE)
+    goto fail;
+
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  xzio->buf.out_pos = 0;
+  grub_file_seek (xzio->file, xzio->blocks[i].offset);
+  xzio->prefetch_end = 0;
+  xzio->saved_offset = xzio->blocks[i].uoffset;
+  xzio->in_end = xzio->index_offset;
+  return GRUB_ERR_NONE;
+
+ fail:
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		N_("xz file corrupted or unsupported block options"));
+  return grub_errno;
+}
+
+static grub_off_t
+block_size (grub_xzio_t xzio, grub_file_t file, grub_size_t i)
+{
+  if (i + 1 < xzio->nblocks)
+    return xzio->blocks[i + 1].uoffset - xzio->blocks[i].uoffset;
+  return file->size - xzio->blocks[i].uoffset;
+}
+
+static grub_off_t
+block_compressed_size (grub_xzio_t xzio, grub_size_t i)
+{
+  if (i + 1 < xzio->nblocks)
+    return xzio->blocks[i + 1].offset - xzio->blocks[i].offset;
+  return xzio->index_offset - xzio->blocks[i].offset;
+}
+
+/* Return the LZMA2 dictionary size the block header HDR of SIZE bytes asks
+   for, 0 if it can't be found.  */
+static grub_uint32_t
+block_dict_size (const grub_uint8_t *hdr, grub_size_t size)
+{
+  grub_size_t pos = 2, n;
+  grub_uint64_t id = 0, props_size = 0;
+  unsigned i, nfilters;
+  grub_uint8_t props;
+
+  if (size < 2)
+    return 0;
+  nfilters = (hdr[1] & 3) + 1;
+  for (i = 0; i < 2; i++)
+    if (hdr[1] & (0x40 << i))
+      {
+	grub_uint64_t dummy;
+
+	n = decode_vli (hdr + pos, size - pos, &dummy);
+	if (!n)
+	  return 0;
+	pos += n;
+      }
+  /* The LZMA2 filter comes last.  */
+  for (i = 0; i < nfilters; i++)
+    {
+      n = decode_vli (hdr + pos, size - pos, &id);
+      if (!n)
+	return 0;
+      pos += n;
+      n = decode_vli (hdr + pos, size - pos, &props_size);
+      if (!n || props_size > size - pos - n)
+	return 0;
+      pos += n + props_size;
+    }
+  if (id != XZ_FILTER_LZMA2 || props_size != 1)
+    return 0;
+  props = hdr[pos - 1];
+  if (props > 39)
+    return 0;
+  return (2 | (props & 1)) << ((props >> 1) + 11);
+}
+
+static void
+free_slots (grub_xzio_t xzio)
+{
+  grub_size_t i;
+
+  if (!xzio->slots)
+    return;
+  for (i = 0; i < xzio->nslots; i++)
+    {
+      xz_dec_end (xzio->slots[i].dec);
+      grub_free (xzio->slots[i].in);
+      grub_free (xzio->slots[i].out);
+    }
+  grub_free (xzio->slots);
+  xzio->slots = 0;
+  xzio->nslots = 0;
+  xzio->nslots_used = 0;
+}
+
+/* Have the decoder of SLOT see the stream header, after which it decodes
+   any block it is given as the blocks don't depend on each other.  */
+static int
+slot_reset (grub_xzio_t xzio, struct grub_xzio_slot *slot)
+{
+  xz_dec_reset (slot->dec);
+  slot->buf.in = xzio->stream_header;
+  slot->buf.in_pos = 0;
+  slot->buf.in_size = STREAM_HEADER_SIZE;
+  slot->buf.out = 0;
+  slot->buf.out_pos = 0;
+  slot->buf.out_size = 0;
+  return (xz_dec_run (slot->dec, &slot->buf) == XZ_OK
+	  && slot->buf.in_pos == STREAM_HEADER_SIZE);
+}
+
+/* Decode several blocks at once on all processors, when the file has a
+   few of them and they are small enough to be held in memory.  */
+static void
+try_parallel (grub_xzio_t xzio, grub_file_t file)
+{
+  grub_off_t max_size = 0, max_csize = 0;
+  grub_uint8_t hdr[1024];
+  grub_uint32_t dict;
+  grub_size_t i, nslots, per_slot;
+
+  xzio->mp_tried = 1;
+  if (xzio->nblocks < 2 || grub_mp_nproc () < 2)
+    return;
+
+  for (i = 0; i < xzio->nblocks; i++)
+    {
+      if (block_size (xzio, file, i) > max_size)
+	max_size = block_size (xzio, file, i);
+      if (block_compressed_size (xzio, i) > max_csize)
+	max_csize = block_compressed_size (xzio, i);
+    }
+
+  /* Every decoder grows its dictionary to what the blocks ask for.  The
+     serial decoder continues where the header left it, if used.  */
+  grub_file_seek (xzio->file, xzio->blocks[0].offset);
+  if (grub_file_read (xzio->file, hdr, sizeof (hdr)) <= 0)
+    grub_memset (hdr, 0, sizeof (hdr));
+  grub_errno = GRUB_ERR_NONE;
+  grub_file_seek (xzio->file, xzio->blocks[0].offset);
+  dict = block_dict_size (hdr, (hdr[0] + 1) * 4);
+  if (!dict)
+    return;
+
+  per_slot = max_size + max_csize + dict;
+  if (max_size > XZ_MP_MEMORY / 2 || per_slot > XZ_MP_MEMORY / 2)
+    return;
+  nslots = XZ_MP_MEMORY / per_slot;
+  if (nslots > grub_mp_nproc ())
+    nslots = grub_mp_nproc ();
+  if (nslots > xzio->nblocks)
+    nslots = xzio->nblocks;
+
+  xzio->slots = grub_zalloc (nslots * sizeof (xzio->slots[0]));
+  if (!xzio->slots)
+    goto fail;
+  xzio->nslots = nslots;
+  for (i = 0; i < nslots; i++)
+    {
+      struct grub_xzio_slot *slot = &xzio->slots[i];
+
+      slot->dec = xz_dec_init (1 << 16);
+      slot->in = grub_malloc (max_csize);
+      slot->out = grub_malloc (max_size);
+      if (!slot->dec || !slot->in || !slot->out || !slot_reset (xzio, slot))
+	goto fail;
+    }
+  grub_dprintf ("xzio", "decoding %" PRIuGRUB_SIZE " blocks at once\n",
+		nslots);
+  return;
+
+ fail:
+  free_slots (xzio);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+decode_block_task (void *data, unsigned int index)
+{
+  struct grub_xzio_slot *slot = (struct grub_xzio_slot *) data + index;
+
+  /* All the input is there, the decoder only stops for output space and
+     fails once it can't make progress.  */
+  do
+    slot->ret = xz_dec_run (slot->dec, &slot->buf);
+  while (slot->ret == XZ_OK && slot->buf.in_pos < slot->buf.in_size);
+}
+
+/* Decode the blocks starting with FIRST into the slots.  Reading and the
+   block headers, which may have the decoder allocate its dictionary, are
+   done here, the rest of every block on its own processor.  */
+static grub_err_t
+decode_blocks (grub_xzio_t xzio, grub_file_t file, grub_size_t first)
+{
+  grub_size_t i, n = xzio->nslots;
+
+  if (n > xzio->nblocks - first)
+    n = xzio->nblocks - first;
+  xzio->nslots_used = 0;
+
+  grub_file_seek (xzio->file, xzio->blocks[first].offset);
+  for (i = 0; i < n; i++)
+    {
+      struct grub_xzio_slot *slot = &xzio->slots[i];
+      grub_size_t csize = block_compressed_size (xzio, first + i);
+      grub_size_t hsize;
+
+      if (grub_file_read (xzio->file, slot->in, csize) != (grub_ssize_t) csize)
+	goto fail;
+      hsize = (slot->in[0] + 1) * 4;
+      if (slot->in[0] == 0 || hsize > csize)
+	goto fail;
+
+      slot->buf.in = slot->in;
+      slot->buf.in_pos = 0;
+      slot->buf.in_size = hsize;
+      slot->buf.out = slot->out;
+      slot->buf.out_pos = 0;
+      slot->buf.out_size = block_size (xzio, file, first + i);
+      if (xz_dec_run (slot->dec, &slot->buf) != XZ_OK
+	  || slot->buf.in_pos != hsize)
+	goto fail;
+      slot->buf.in_size = csize;
+    }
+  grub_file_prefetch_ahead (xzio->file, &xzio->prefetch_end, XZPREFETCHSIZ);
+
+  grub_mp_run (decode_block_task, xzio->slots, n);
+
+  for (i = 0; i < n; i++)
+    {
+      struct grub_xzio_slot *slot = &xzio->slots[i];
+
+      if (slot->ret != XZ_OK || slot->buf.in_pos != slot->buf.in_size
+	  || slot->buf.out_pos != slot->buf.out_size)
+	goto fail;
+    }
+  xzio->first_slot_block = first;
+  xzio->nslots_used = n;
+  return GRUB_ERR_NONE;
+
+ fail:
+  /* The decoders may be in the middle of a block.  */
+  for (i = 0; i < xzio->nslots; i++)
+    slot_reset (xzio, &xzio->slots[i]);
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		N_("xz file corrupted or unsupported block options"));
+  return grub_errno;
+}
+
+static grub_ssize_t
+read_parallel (grub_xzio_t xzio, grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+
+  while (len > 0 && file->offset + ret < file->size)
+    {
+      grub_off_t pos = file->offset + ret;
+      grub_size_t b = find_block (xzio, pos);
+      grub_size_t n;
+      grub_off_t off;
+
+      if (b < xzio->first_slot_block
+	  || b >= xzio->first_slot_block + xzio->nslots_used)
+	{
+	  if (decode_blocks (xzio, file, b))
+	    return -1;
+	}
+
+      off = pos - xzio->blocks[b].uoffset;
+      n = block_size (xzio, file, b) - off;
+      if (n > len)
+	n = len;
+      grub_memcpy (buf, xzio->slots[b - xzio->first_slot_block].out + off, n);
+      buf += n;
+      len -= n;
+      ret += n;
+    }
+
+  return ret;
+}
+
 static grub_file_t
 grub_xzio_open (grub_file_t io,
 		const char *name __attribute__ ((unused)))
 {
   grub_file_t file;
   grub_xzio_t xzio;
+  grub_uint8_t magic[HEADER_MAGIC_SIZE];
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  /* Don't allocate the decoder for files that aren't xz.  The magic
+     normally comes from the head read at open time.  */
+  if (grub_file_read (io, magic, sizeof (magic)) != sizeof (magic)
+      || grub_memcmp (magic, HEADER_MAGIC, HEADER_MAGIC_SIZE) != 0)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (!file)
@@ -235,8 +635,25 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_xzio_t xzio = file->data;
   grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
+  if (!xzio->mp_tried)
+    try_parallel (xzio, file);
+  if (xzio->slots)
+    return read_parallel (xzio, file, buf, len);
+
+  /* Going back, or past the block being decoded, start over at the block
+     holding the offset if the index says where it is.  */
+  if (xzio->nblocks)
+    {
+      grub_size_t target = find_block (xzio, file->offset);
+
+      if ((file->offset < xzio->saved_offset
+	   || target > find_block (xzio, xzio->saved_offset))
+	  && jump_to_block (xzio, target))
+	return -1;
+    }
+
+  /* Otherwise seeking backward needs to reset decoder and start from
+     beginning of file.  */
   if (file->offset < xzio->saved_offset)
     {
       xz_dec_reset (xzio->dec);
@@ -244,6 +661,7 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
       xzio->buf.out_pos = 0;
       xzio->buf.in_pos = 0;
       xzio->buf.in_size = 0;
+      xzio->in_end = 0;
       grub_file_seek (xzio->file, 0);
     }
 
@@ -257,9 +675,24 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
       /* Feed input.  */
       if (xzio->buf.in_pos == xzio->buf.in_size)
 	{
-	  readret = grub_file_read (xzio->file, xzio->inbuf, XZBUFSIZ);
+	  grub_size_t want = XZBUFSIZ;
+
+	  if (xzio->in_end)
+	    {
+	      grub_off_t pos = grub_file_tell (xzio->file);
+
+	      want = 0;
+	      if (pos < xzio->in_end)
+		want = xzio->in_end - pos;
+	      if (want > XZBUFSIZ)
+		want = XZBUFSIZ;
+	    }
+	  readret = grub_file_read (xzio->file, xzio->inbuf, want);
 	  if (readret < 0)
 	    return -1;
+	  /* Let the device fetch what follows while this is decoded.  */
+	  grub_file_prefetch_ahead (xzio->file, &xzio->prefetch_end,
+				    XZPREFETCHSIZ);
 	  xzio->buf.in_size = readret;
 	  xzio->buf.in_pos = 0;
 	}
@@ -306,6 +739,19 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   return ret;
 }
 
+/* Where the compressed data for OFFSET lies isn't known, but reads go
+   forward, so have what follows the input read so far fetched.  */
+static void
+grub_xzio_prefetch (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  grub_xzio_t xzio = file->data;
+
+  if (offset < file->offset)
+    return;
+  grub_file_prefetch_ahead (xzio->file, &xzio->prefetch_end,
+			    len > XZPREFETCHSIZ ? len : XZPREFETCHSIZ);
+}
+
 /* Release everything, including the underlying file object.  */
 static grub_err_t
 grub_xzio_close (grub_file_t file)
@@ -313,8 +759,10 @@ grub_xzio_close (grub_file_t file)
   grub_xzio_t xzio = file->data;
 
   xz_dec_end (xzio->dec);
+  free_slots (xzio);
 
   grub_file_close (xzio->file);
+  grub_free (xzio->blocks);
   grub_free (xzio);
 
   /* Device must not be closed twice.  */
@@ -328,6 +776,7 @@ static struct grub_fs grub_xzio_fs = {
   .dir = 0,
   .open = 0,
   .read = grub_xzio_read,
+  .prefetch = grub_xzio_prefetch,
   .close = grub_xzio_close,
   .label = 0,
   .next = 0
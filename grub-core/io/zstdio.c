@@ -0,0 +1,1398 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A decoder for the Zstandard format as described in RFC 8478.  It handles
+   everything the reference compressor produces except dictionaries, and
+   trusts the data instead of verifying the optional content checksum.  */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_MAGIC		0xfd2fb528
+#define ZSTD_SKIPPABLE_MAGIC	0x184d2a50
+#define ZSTD_SKIPPABLE_MASK	0xfffffff0
+
+/* No block regenerates more than this.  */
+#define ZSTD_BLOCK_MAX		(1 << 17)
+/* The reference decoder refuses bigger windows unless told otherwise.  */
+#define ZSTD_WINDOW_LOG_MAX	27
+
+#define ZSTD_PREFETCHSIZ	0x20000
+
+#define HUF_LOG_MAX		11
+#define FSE_LOG_MAX		9
+#define FSE_WEIGHTS_LOG_MAX	6
+
+#define LL_MAX			35
+#define ML_MAX			52
+#define OF_MAX			31
+
+enum
+  {
+    BLOCK_RAW,
+    BLOCK_RLE,
+    BLOCK_COMPRESSED,
+    BLOCK_RESERVED
+  };
+
+enum
+  {
+    LITERALS_RAW,
+    LITERALS_RLE,
+    LITERALS_COMPRESSED,
+    LITERALS_TREELESS
+  };
+
+enum
+  {
+    MODE_PREDEFINED,
+    MODE_RLE,
+    MODE_FSE,
+    MODE_REPEAT
+  };
+
+struct fse_entry
+{
+  grub_uint16_t base;
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+};
+
+struct fse_table
+{
+  struct fse_entry entries[1 << FSE_LOG_MAX];
+  unsigned log;
+  int valid;
+};
+
+struct huf_entry
+{
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+};
+
+struct grub_zstd
+{
+  /* Where the compressed data comes from: either a file...  */
+  grub_file_t file;
+  grub_off_t prefetch_end;
+  /* ... or a buffer.  */
+  const grub_uint8_t *mem_input;
+  grub_size_t mem_input_size;
+  grub_off_t in_off;
+  grub_uint8_t *inbuf;
+
+  /* The frame being decoded.  */
+  int in_frame;
+  int nframes;
+  int eof;
+  int has_checksum;
+  int has_content_size;
+  grub_uint64_t content_size;
+  grub_uint64_t window_size;
+  grub_size_t block_max;
+  grub_uint64_t frame_pos;
+  grub_uint32_t rep[3];
+
+  /* The entropy tables, which later blocks of the frame may reuse.  */
+  struct huf_entry huf[1 << HUF_LOG_MAX];
+  unsigned huf_log;
+  int huf_valid;
+  struct fse_table ll, of, ml;
+  struct fse_table weights;
+
+  const grub_uint8_t *lit;
+  grub_size_t lit_size;
+  grub_uint8_t *litbuf;
+
+  /* The output, preceded by as much history as matches may refer to.
+     WIN[0] is at offset WIN_OFF of the uncompressed data.  */
+  grub_uint8_t *win;
+  grub_size_t win_alloc;
+  grub_size_t win_pos;
+  grub_off_t win_off;
+};
+
+typedef struct grub_zstd *grub_zstd_t;
+static struct grub_fs grub_zstdio_fs;
+
+static const grub_int16_t ll_default[LL_MAX + 1] =
+  {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+  };
+
+static const grub_int16_t ml_default[ML_MAX + 1] =
+  {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+  };
+
+static const grub_int16_t of_default[OF_MAX - 2] =
+  {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+  };
+
+static const grub_uint32_t ll_base[LL_MAX + 1] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+  };
+
+static const grub_uint8_t ll_bits[LL_MAX + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+  };
+
+static const grub_uint32_t ml_base[ML_MAX + 1] =
+  {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+  };
+
+static const grub_uint8_t ml_bits[ML_MAX + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+  };
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		     N_("zstd data corrupted or unsupported"));
+}
+
+static inline unsigned
+highbit (grub_uint32_t v)
+{
+  return 31 - __builtin_clz (v);
+}
+
+/* Entropy coded streams are read backwards, starting from the most
+   significant bit of their last byte after the highest one, which only
+   marks where they start.  */
+struct bitrd
+{
+  const grub_uint8_t *start;
+  const grub_uint8_t *ptr;
+  grub_uint64_t bits;
+  unsigned consumed;
+};
+
+enum
+  {
+    BITRD_MORE,
+    BITRD_END,
+    BITRD_OVERFLOW
+  };
+
+static grub_err_t
+bit_init (struct bitrd *b, const grub_uint8_t *src, grub_size_t size)
+{
+  grub_size_t i;
+
+  if (size == 0 || src[size - 1] == 0)
+    return corrupted ();
+
+  b->start = src;
+  b->consumed = 8 - highbit (src[size - 1]);
+  if (size >= 8)
+    {
+      b->ptr = src + size - 8;
+      b->bits = grub_le_to_cpu64 (grub_get_unaligned64 (b->ptr));
+    }
+  else
+    {
+      b->ptr = src;
+      b->bits = 0;
+      for (i = 0; i < size; i++)
+	b->bits |= (grub_uint64_t) src[i] << (8 * i);
+      b->consumed += (8 - size) * 8;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Past the start of the stream this yields zeros, which callers catch by
+   looking at what bit_reload returns.  */
+static inline grub_uint32_t
+bit_peek (const struct bitrd *b, unsigned n)
+{
+  if (b->consumed >= 64)
+    return 0;
+  return (b->bits << b->consumed) >> (64 - n);
+}
+
+static inline grub_uint32_t
+bit_read (struct bitrd *b, unsigned n)
+{
+  grub_uint32_t v;
+
+  if (n == 0)
+    return 0;
+  v = bit_peek (b, n);
+  b->consumed += n;
+  return v;
+}
+
+static inline int
+bit_reload (struct bitrd *b)
+{
+  grub_size_t n;
+
+  if (b->consumed > 64)
+    return BITRD_OVERFLOW;
+
+  if (b->ptr >= b->start + 8)
+    {
+      b->ptr -= b->consumed >> 3;
+      b->consumed &= 7;
+    }
+  else if (b->ptr == b->start)
+    return BITRD_END;
+  else
+    {
+      n = b->consumed >> 3;
+      if (n > (grub_size_t) (b->ptr - b->start))
+	n = b->ptr - b->start;
+      b->ptr -= n;
+      b->consumed -= n * 8;
+    }
+  b->bits = grub_le_to_cpu64 (grub_get_unaligned64 (b->ptr));
+  return BITRD_MORE;
+}
+
+static int
+bit_finished (struct bitrd *b)
+{
+  bit_reload (b);
+  return b->ptr == b->start && b->consumed == 64;
+}
+
+static grub_uint32_t
+fwd_peek (const grub_uint8_t *src, grub_size_t size, grub_size_t pos,
+	  unsigned n)
+{
+  grub_uint32_t v = 0;
+  unsigned i;
+
+  for (i = 0; i < 4 && pos / 8 + i < size; i++)
+    v |= (grub_uint32_t) src[pos / 8 + i] << (8 * i);
+  return (v >> (pos % 8)) & ((1 << n) - 1);
+}
+
+/* Read the normalized probabilities of an FSE table description.  Return
+   the number of bytes they took or -1.  */
+static grub_ssize_t
+fse_read_counts (const grub_uint8_t *src, grub_size_t size,
+		 grub_int16_t *norm, unsigned *nsym, unsigned maxsym,
+		 unsigned *log, unsigned maxlog)
+{
+  grub_size_t pos = 0;
+  int remaining, threshold;
+  unsigned nbits, sym = 0;
+
+  *log = fwd_peek (src, size, pos, 4) + 5;
+  pos += 4;
+  if (*log > maxlog)
+    goto fail;
+
+  remaining = (1 << *log) + 1;
+  threshold = 1 << *log;
+  nbits = *log + 1;
+  while (remaining > 1)
+    {
+      int max = 2 * threshold - 1 - remaining;
+      int count;
+      grub_uint32_t v;
+
+      if (sym > maxsym)
+	goto fail;
+
+      v = fwd_peek (src, size, pos, nbits);
+      if ((int) (v & (threshold - 1)) < max)
+	{
+	  count = v & (threshold - 1);
+	  pos += nbits - 1;
+	}
+      else
+	{
+	  count = v;
+	  if (count >= threshold)
+	    count -= max;
+	  pos += nbits;
+	}
+      count--;
+      norm[sym++] = count;
+      remaining -= count < 0 ? -count : count;
+
+      if (count == 0)
+	{
+	  grub_uint32_t repeat, i;
+
+	  /* Runs of symbols that don't occur are coded as repeat counts.  */
+	  do
+	    {
+	      repeat = fwd_peek (src, size, pos, 2);
+	      pos += 2;
+	      if (sym + repeat > maxsym + 1)
+		goto fail;
+	      for (i = 0; i < repeat; i++)
+		norm[sym++] = 0;
+	    }
+	  while (repeat == 3);
+	}
+
+      while (remaining < threshold)
+	{
+	  nbits--;
+	  threshold >>= 1;
+	}
+    }
+
+  if (remaining != 1 || (pos + 7) / 8 > size)
+    goto fail;
+
+  *nsym = sym;
+  return (pos + 7) / 8;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+static grub_err_t
+fse_build (struct fse_table *t, const grub_int16_t *norm, unsigned nsym,
+	   unsigned log)
+{
+  grub_uint16_t next[256];
+  unsigned size = 1 << log;
+  unsigned high = size - 1;
+  unsigned step = (size >> 1) + (size >> 3) + 3;
+  unsigned pos = 0;
+  unsigned s, u;
+  int i;
+
+  for (s = 0; s < nsym; s++)
+    if (norm[s] == -1)
+      {
+	t->entries[high--].symbol = s;
+	next[s] = 1;
+      }
+    else
+      next[s] = norm[s];
+
+  for (s = 0; s < nsym; s++)
+    for (i = 0; i < norm[s]; i++)
+      {
+	t->entries[pos].symbol = s;
+	do
+	  pos = (pos + step) & (size - 1);
+	while (pos > high);
+      }
+  if (pos != 0)
+    return corrupted ();
+
+  for (u = 0; u < size; u++)
+    {
+      grub_uint32_t x = next[t->entries[u].symbol]++;
+
+      t->entries[u].nbits = log - highbit (x);
+      t->entries[u].base = (x << t->entries[u].nbits) - size;
+    }
+
+  t->log = log;
+  t->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+fse_build_rle (struct fse_table *t, grub_uint8_t symbol)
+{
+  t->entries[0].symbol = symbol;
+  t->entries[0].nbits = 0;
+  t->entries[0].base = 0;
+  t->log = 0;
+  t->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static inline unsigned
+fse_decode (const struct fse_table *t, grub_uint32_t *state,
+	    struct bitrd *b)
+{
+  const struct fse_entry *e = &t->entries[*state];
+
+  *state = e->base + bit_read (b, e->nbits);
+  return e->symbol;
+}
+
+/* Read a Huffman tree description and return the number of bytes it took
+   or -1.  */
+static grub_ssize_t
+huf_read_table (grub_zstd_t z, const grub_uint8_t *src, grub_size_t size)
+{
+  grub_uint8_t weights[256];
+  unsigned nweights = 0;
+  grub_size_t hsize;
+  grub_uint32_t total = 0, rest;
+  unsigned w, s, maxbits, pos;
+
+  if (size < 1)
+    goto fail;
+
+  if (src[0] >= 128)
+    {
+      nweights = src[0] - 127;
+      hsize = 1 + (nweights + 1) / 2;
+      if (hsize > size)
+	goto fail;
+      for (s = 0; s < nweights; s++)
+	weights[s] = (s & 1) ? (src[1 + s / 2] & 0xf) : (src[1 + s / 2] >> 4);
+    }
+  else
+    {
+      grub_int16_t norm[256];
+      unsigned nsym, log;
+      grub_ssize_t n;
+      struct bitrd b;
+      grub_uint32_t s1, s2;
+      struct fse_table *t = &z->weights;
+
+      hsize = 1 + src[0];
+      if (hsize > size)
+	goto fail;
+      n = fse_read_counts (src + 1, src[0], norm, &nsym, 255, &log,
+			   FSE_WEIGHTS_LOG_MAX);
+      if (n < 0)
+	return -1;
+      if (fse_build (t, norm, nsym, log)
+	  || bit_init (&b, src + 1 + n, src[0] - n))
+	return -1;
+
+      /* Two states take turns, and the last symbol comes from the one that
+	 didn't run out of bits.  */
+      s1 = bit_read (&b, log);
+      s2 = bit_read (&b, log);
+      while (1)
+	{
+	  if (nweights > 253)
+	    goto fail;
+	  weights[nweights++] = fse_decode (t, &s1, &b);
+	  if (bit_reload (&b) == BITRD_OVERFLOW)
+	    {
+	      weights[nweights++] = t->entries[s2].symbol;
+	      break;
+	    }
+	  weights[nweights++] = fse_decode (t, &s2, &b);
+	  if (bit_reload (&b) == BITRD_OVERFLOW)
+	    {
+	      weights[nweights++] = t->entries[s1].symbol;
+	      break;
+	    }
+	}
+    }
+
+  for (s = 0; s < nweights; s++)
+    {
+      if (weights[s] > HUF_LOG_MAX)
+	goto fail;
+      if (weights[s])
+	total += 1 << (weights[s] - 1);
+    }
+  if (total == 0)
+    goto fail;
+
+  /* The weight of the last symbol is implied by the others summing up to a
+     power of two.  */
+  maxbits = highbit (total) + 1;
+  rest = (1 << maxbits) - total;
+  if (maxbits > HUF_LOG_MAX || (rest & (rest - 1)) || nweights > 255)
+    goto fail;
+  weights[nweights++] = highbit (rest) + 1;
+
+  pos = 0;
+  for (w = 1; w <= maxbits; w++)
+    for (s = 0; s < nweights; s++)
+      if (weights[s] == w)
+	{
+	  unsigned i;
+
+	  for (i = 0; i < (1U << (w - 1)); i++)
+	    {
+	      z->huf[pos + i].symbol = s;
+	      z->huf[pos + i].nbits = maxbits + 1 - w;
+	    }
+	  pos += 1 << (w - 1);
+	}
+
+  z->huf_log = maxbits;
+  z->huf_valid = 1;
+  return hsize;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+static grub_err_t
+huf_decode_stream (grub_zstd_t z, const grub_uint8_t *src, grub_size_t size,
+		   grub_uint8_t *out, grub_size_t n)
+{
+  struct bitrd b;
+  grub_size_t i;
+
+  if (bit_init (&b, src, size))
+    return grub_errno;
+
+  for (i = 0; i < n; i++)
+    {
+      const struct huf_entry *e;
+
+      bit_reload (&b);
+      e = &z->huf[bit_peek (&b, z->huf_log)];
+      b.consumed += e->nbits;
+      out[i] = e->symbol;
+    }
+
+  if (!bit_finished (&b))
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the literals section at the start of a compressed block and
+   return its size or -1.  */
+static grub_ssize_t
+decode_literals (grub_zstd_t z, const grub_uint8_t *src, grub_size_t size)
+{
+  unsigned type, format;
+  grub_size_t hsize, regen, csize, total;
+  grub_uint32_t h;
+
+  if (size < 1)
+    goto fail;
+  type = src[0] & 3;
+  format = (src[0] >> 2) & 3;
+
+  if (type == LITERALS_RAW || type == LITERALS_RLE)
+    {
+      switch (format)
+	{
+	case 1:
+	  hsize = 2;
+	  break;
+	case 3:
+	  hsize = 3;
+	  break;
+	default:
+	  hsize = 1;
+	  break;
+	}
+      if (hsize > size)
+	goto fail;
+      regen = src[0] >> (hsize == 1 ? 3 : 4);
+      if (hsize > 1)
+	regen |= src[1] << 4;
+      if (hsize > 2)
+	regen |= src[2] << 12;
+      if (regen > ZSTD_BLOCK_MAX)
+	goto fail;
+
+      if (type == LITERALS_RAW)
+	{
+	  if (hsize + regen > size)
+	    goto fail;
+	  z->lit = src + hsize;
+	  z->lit_size = regen;
+	  return hsize + regen;
+	}
+      if (hsize + 1 > size)
+	goto fail;
+      grub_memset (z->litbuf, src[hsize], regen);
+      z->lit = z->litbuf;
+      z->lit_size = regen;
+      return hsize + 1;
+    }
+
+  hsize = format < 2 ? 3 : format + 2;
+  if (hsize > size)
+    goto fail;
+  h = src[0] | (src[1] << 8) | ((grub_uint32_t) src[2] << 16);
+  if (hsize > 3)
+    h |= (grub_uint32_t) src[3] << 24;
+  switch (format)
+    {
+    case 0:
+    case 1:
+      regen = (h >> 4) & 0x3ff;
+      csize = (h >> 14) & 0x3ff;
+      break;
+    case 2:
+      regen = (h >> 4) & 0x3fff;
+      csize = h >> 18;
+      break;
+    default:
+      regen = (h >> 4) & 0x3ffff;
+      csize = (h >> 22) | ((grub_size_t) src[4] << 10);
+      break;
+    }
+  if (regen > ZSTD_BLOCK_MAX || hsize + csize > size)
+    goto fail;
+  total = hsize + csize;
+  src += hsize;
+
+  if (type == LITERALS_COMPRESSED)
+    {
+      grub_ssize_t n = huf_read_table (z, src, csize);
+
+      if (n < 0)
+	return -1;
+      src += n;
+      csize -= n;
+    }
+  else if (!z->huf_valid)
+    goto fail;
+
+  if (format == 0)
+    {
+      if (huf_decode_stream (z, src, csize, z->litbuf, regen))
+	return -1;
+    }
+  else
+    {
+      grub_size_t sizes[4], seg = (regen + 3) / 4;
+      grub_size_t out = 0;
+      unsigned i;
+
+      if (csize < 6 || 3 * seg > regen)
+	goto fail;
+      sizes[0] = src[0] | (src[1] << 8);
+      sizes[1] = src[2] | (src[3] << 8);
+      sizes[2] = src[4] | (src[5] << 8);
+      if (sizes[0] + sizes[1] + sizes[2] > csize - 6)
+	goto fail;
+      sizes[3] = csize - 6 - sizes[0] - sizes[1] - sizes[2];
+      src += 6;
+      for (i = 0; i < 4; i++)
+	{
+	  if (huf_decode_stream (z, src, sizes[i], z->litbuf + out,
+				 i < 3 ? seg : regen - 3 * seg))
+	    return -1;
+	  src += sizes[i];
+	  out += seg;
+	}
+    }
+
+  z->lit = z->litbuf;
+  z->lit_size = regen;
+  return total;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+static grub_ssize_t
+read_seq_table (struct fse_table *t, unsigned mode, const grub_uint8_t *src,
+		grub_size_t size, const grub_int16_t *def, unsigned ndef,
+		unsigned deflog, unsigned maxsym, unsigned maxlog)
+{
+  grub_int16_t norm[ML_MAX + 1];
+  unsigned nsym, log;
+  grub_ssize_t n;
+
+  switch (mode)
+    {
+    case MODE_PREDEFINED:
+      if (fse_build (t, def, ndef, deflog))
+	return -1;
+      return 0;
+    case MODE_RLE:
+      if (size < 1 || src[0] > maxsym)
+	break;
+      fse_build_rle (t, src[0]);
+      return 1;
+    case MODE_FSE:
+      n = fse_read_counts (src, size, norm, &nsym, maxsym, &log, maxlog);
+      if (n < 0 || fse_build (t, norm, nsym, log))
+	return -1;
+      return n;
+    default:
+      if (!t->valid)
+	break;
+      return 0;
+    }
+
+  corrupted ();
+  return -1;
+}
+
+static grub_err_t
+decode_sequences (grub_zstd_t z, const grub_uint8_t *src, grub_size_t size,
+		  grub_uint8_t *out, grub_uint8_t *limit)
+{
+  const grub_uint8_t *lit = z->lit, *lit_end = z->lit + z->lit_size;
+  grub_uint8_t *block_start = out;
+  grub_uint32_t nseq, i;
+  grub_ssize_t n;
+  unsigned modes;
+  struct bitrd b;
+  grub_uint32_t ll_state, of_state, ml_state;
+
+  if (size < 1)
+    return corrupted ();
+  if (src[0] < 128)
+    {
+      nseq = src[0];
+      src++;
+      size--;
+    }
+  else if (src[0] < 255)
+    {
+      if (size < 2)
+	return corrupted ();
+      nseq = ((src[0] - 128) << 8) + src[1];
+      src += 2;
+      size -= 2;
+    }
+  else
+    {
+      if (size < 3)
+	return corrupted ();
+      nseq = src[1] + (src[2] << 8) + 0x7f00;
+      src += 3;
+      size -= 3;
+    }
+
+  if (nseq)
+    {
+      if (size < 1 || (src[0] & 3))
+	return corrupted ();
+      modes = src[0];
+      src++;
+      size--;
+
+      n = read_seq_table (&z->ll, modes >> 6, src, size, ll_default,
+			  ARRAY_SIZE (ll_default), 6, LL_MAX, FSE_LOG_MAX);
+      if (n < 0)
+	return grub_errno;
+      src += n;
+      size -= n;
+      n = read_seq_table (&z->of, (modes >> 4) & 3, src, size, of_default,
+			  ARRAY_SIZE (of_default), 5, OF_MAX, FSE_LOG_MAX - 1);
+      if (n < 0)
+	return grub_errno;
+      src += n;
+      size -= n;
+      n = read_seq_table (&z->ml, (modes >> 2) & 3, src, size, ml_default,
+			  ARRAY_SIZE (ml_default), 6, ML_MAX, FSE_LOG_MAX);
+      if (n < 0)
+	return grub_errno;
+      src += n;
+      size -= n;
+
+      if (bit_init (&b, src, size))
+	return grub_errno;
+      ll_state = bit_read (&b, z->ll.log);
+      of_state = bit_read (&b, z->of.log);
+      ml_state = bit_read (&b, z->ml.log);
+      bit_reload (&b);
+    }
+
+  for (i = 0; i < nseq; i++)
+    {
+      unsigned llc = z->ll.entries[ll_state].symbol;
+      unsigned mlc = z->ml.entries[ml_state].symbol;
+      unsigned ofc = z->of.entries[of_state].symbol;
+      grub_uint32_t offset, ll, ml;
+      const grub_uint8_t *match;
+
+      if (ofc > OF_MAX)
+	return corrupted ();
+      offset = (1U << ofc) + bit_read (&b, ofc);
+      bit_reload (&b);
+      ml = ml_base[mlc] + bit_read (&b, ml_bits[mlc]);
+      ll = ll_base[llc] + bit_read (&b, ll_bits[llc]);
+      bit_reload (&b);
+
+      if (offset > 3)
+	{
+	  offset -= 3;
+	  z->rep[2] = z->rep[1];
+	  z->rep[1] = z->rep[0];
+	  z->rep[0] = offset;
+	}
+      else
+	{
+	  unsigned idx = offset - 1 + (ll == 0);
+
+	  if (idx == 0)
+	    offset = z->rep[0];
+	  else
+	    {
+	      offset = idx == 3 ? z->rep[0] - 1 : z->rep[idx];
+	      if (idx != 1)
+		z->rep[2] = z->rep[1];
+	      z->rep[1] = z->rep[0];
+	      z->rep[0] = offset;
+	    }
+	}
+
+      if (ll > (grub_size_t) (lit_end - lit)
+	  || ll + ml > (grub_size_t) (limit - out))
+	return corrupted ();
+      grub_memcpy (out, lit, ll);
+      out += ll;
+      lit += ll;
+
+      if (offset == 0 || offset > (grub_size_t) (out - z->win))
+	return corrupted ();
+      match = out - offset;
+      /* Each copy of an overlapping match doubles what may be copied at
+	 once.  */
+      while (ml > offset)
+	{
+	  grub_memcpy (out, match, offset);
+	  out += offset;
+	  ml -= offset;
+	  offset *= 2;
+	}
+      grub_memcpy (out, match, ml);
+      out += ml;
+
+      if (i + 1 < nseq)
+	{
+	  fse_decode (&z->ll, &ll_state, &b);
+	  fse_decode (&z->ml, &ml_state, &b);
+	  fse_decode (&z->of, &of_state, &b);
+	  bit_reload (&b);
+	}
+    }
+
+  if (nseq && !bit_finished (&b))
+    return corrupted ();
+
+  if ((grub_size_t) (lit_end - lit) > (grub_size_t) (limit - out))
+    return corrupted ();
+  grub_memcpy (out, lit, lit_end - lit);
+  out += lit_end - lit;
+
+  z->win_pos += out - block_start;
+  z->frame_pos += out - block_start;
+  return GRUB_ERR_NONE;
+}
+
+/* Read up to LEN bytes of compressed data and return how many there were
+   or -1.  */
+static grub_ssize_t
+fetch_some (grub_zstd_t z, void *buf, grub_size_t len)
+{
+  grub_ssize_t r;
+
+  if (z->mem_input)
+    {
+      r = 0;
+      if (z->in_off < z->mem_input_size)
+	r = z->mem_input_size - z->in_off;
+      if ((grub_size_t) r > len)
+	r = len;
+      grub_memcpy (buf, z->mem_input + z->in_off, r);
+    }
+  else
+    {
+      if (grub_file_tell (z->file) != z->in_off)
+	grub_file_seek (z->file, z->in_off);
+      r = grub_file_read (z->file, buf, len);
+      if (r < 0)
+	return -1;
+      grub_file_prefetch_ahead (z->file, &z->prefetch_end, ZSTD_PREFETCHSIZ);
+    }
+
+  z->in_off += r;
+  return r;
+}
+
+/* Read exactly LEN bytes of compressed data.  */
+static grub_err_t
+fetch (grub_zstd_t z, void *buf, grub_size_t len)
+{
+  grub_ssize_t r = fetch_some (z, buf, len);
+
+  if (r < 0)
+    return grub_errno;
+  if ((grub_size_t) r != len)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of compressed"));
+  return GRUB_ERR_NONE;
+}
+
+/* Parse the header of the next frame, skipping the skippable ones, or set
+   EOF when the last one is over.  With WINDOW unset, only look at what the
+   header says.  */
+static grub_err_t
+start_frame (grub_zstd_t z, int window)
+{
+  static const grub_uint8_t did_sizes[4] = { 0, 1, 2, 4 };
+  static const grub_uint8_t fcs_sizes[4] = { 1, 2, 4, 8 };
+  grub_uint8_t hdr[14];
+  grub_uint32_t magic;
+  unsigned fhd, single, did_size, fcs_size, i;
+  grub_size_t hsize, need;
+
+  while (1)
+    {
+      grub_ssize_t r = fetch_some (z, hdr, 4);
+
+      if (r < 0)
+	return grub_errno;
+      if (r == 0 && z->nframes)
+	{
+	  z->eof = 1;
+	  return GRUB_ERR_NONE;
+	}
+      if (r != 4)
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   N_("premature end of compressed"));
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+      if ((magic & ZSTD_SKIPPABLE_MASK) != ZSTD_SKIPPABLE_MAGIC)
+	break;
+      if (fetch (z, hdr, 4))
+	return grub_errno;
+      z->in_off += grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+      z->nframes++;
+    }
+  if (magic != ZSTD_MAGIC)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("not a zstd frame"));
+
+  if (fetch (z, hdr, 1))
+    return grub_errno;
+  fhd = hdr[0];
+  single = (fhd >> 5) & 1;
+  did_size = did_sizes[fhd & 3];
+  fcs_size = (fhd >> 6) ? fcs_sizes[fhd >> 6] : single;
+  hsize = !single + did_size + fcs_size;
+  if (fhd & 0x08)
+    return corrupted ();
+  if (fetch (z, hdr, hsize))
+    return grub_errno;
+
+  for (i = 0; i < did_size; i++)
+    if (hdr[!single + i])
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "zstd dictionaries not supported");
+
+  z->has_content_size = fcs_size != 0;
+  z->content_size = 0;
+  for (i = 0; i < fcs_size; i++)
+    z->content_size |= (grub_uint64_t) hdr[!single + did_size + i] << (8 * i);
+  if (fcs_size == 2)
+    z->content_size += 256;
+
+  if (single)
+    z->window_size = z->content_size;
+  else
+    {
+      unsigned log = 10 + (hdr[0] >> 3);
+
+      z->window_size = (1ULL << log) + ((1ULL << log) / 8) * (hdr[0] & 7);
+    }
+  if (z->window_size > (1ULL << ZSTD_WINDOW_LOG_MAX))
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "zstd window too large");
+
+  z->has_checksum = (fhd >> 2) & 1;
+  z->in_frame = 1;
+  z->nframes++;
+  if (!window)
+    return GRUB_ERR_NONE;
+
+  z->block_max = z->window_size < ZSTD_BLOCK_MAX ? z->window_size
+    : ZSTD_BLOCK_MAX;
+  z->frame_pos = 0;
+  z->rep[0] = 1;
+  z->rep[1] = 4;
+  z->rep[2] = 8;
+  z->huf_valid = 0;
+  z->ll.valid = z->of.valid = z->ml.valid = 0;
+
+  /* Matches don't reach into the previous frames, and all of their output
+     was consumed before asking for more.  */
+  z->win_off += z->win_pos;
+  z->win_pos = 0;
+
+  /* Room for the window and a block, and for as much again to slide it
+     only once per window.  */
+  need = 2 * z->window_size + z->block_max;
+  if (z->has_content_size && z->content_size + z->block_max < need)
+    need = z->content_size + z->block_max;
+  if (need == 0)
+    need = 1;
+  if (need > z->win_alloc)
+    {
+      grub_free (z->win);
+      z->win = grub_malloc (need);
+      if (!z->win)
+	{
+	  z->win_alloc = 0;
+	  return grub_errno;
+	}
+      z->win_alloc = need;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+end_frame (grub_zstd_t z)
+{
+  z->in_frame = 0;
+  if (z->has_checksum)
+    z->in_off += 4;
+  if (z->has_content_size && z->frame_pos != z->content_size)
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+decode_block (grub_zstd_t z)
+{
+  grub_uint8_t hdr[3];
+  grub_uint32_t h, size;
+  unsigned type;
+
+  if (fetch (z, hdr, 3))
+    return grub_errno;
+  h = hdr[0] | (hdr[1] << 8) | ((grub_uint32_t) hdr[2] << 16);
+  type = (h >> 1) & 3;
+  size = h >> 3;
+  if (type == BLOCK_RESERVED || size > z->block_max)
+    return corrupted ();
+
+  if (z->win_alloc - z->win_pos < z->block_max)
+    {
+      grub_size_t keep = z->win_pos < z->window_size ? z->win_pos
+	: z->window_size;
+
+      grub_memmove (z->win, z->win + z->win_pos - keep, keep);
+      z->win_off += z->win_pos - keep;
+      z->win_pos = keep;
+    }
+
+  switch (type)
+    {
+    case BLOCK_RAW:
+      if (fetch (z, z->win + z->win_pos, size))
+	return grub_errno;
+      z->win_pos += size;
+      z->frame_pos += size;
+      break;
+
+    case BLOCK_RLE:
+      if (fetch (z, hdr, 1))
+	return grub_errno;
+      grub_memset (z->win + z->win_pos, hdr[0], size);
+      z->win_pos += size;
+      z->frame_pos += size;
+      break;
+
+    default:
+      {
+	grub_ssize_t n;
+
+	if (fetch (z, z->inbuf, size))
+	  return grub_errno;
+	n = decode_literals (z, z->inbuf, size);
+	if (n < 0)
+	  return grub_errno;
+	if (decode_sequences (z, z->inbuf + n, size - n, z->win + z->win_pos,
+			      z->win + z->win_pos + z->block_max))
+	  return grub_errno;
+      }
+      break;
+    }
+
+  if (z->has_content_size && z->frame_pos > z->content_size)
+    return corrupted ();
+  if (h & 1)
+    return end_frame (z);
+  return GRUB_ERR_NONE;
+}
+
+static grub_zstd_t
+zstd_new (void)
+{
+  grub_zstd_t z;
+
+  z = grub_zalloc (sizeof (*z));
+  if (!z)
+    return 0;
+  z->inbuf = grub_malloc (ZSTD_BLOCK_MAX);
+  z->litbuf = grub_malloc (ZSTD_BLOCK_MAX);
+  if (!z->inbuf || !z->litbuf)
+    {
+      grub_free (z->inbuf);
+      grub_free (z->litbuf);
+      grub_free (z);
+      return 0;
+    }
+  return z;
+}
+
+static void
+zstd_free (grub_zstd_t z)
+{
+  grub_free (z->inbuf);
+  grub_free (z->litbuf);
+  grub_free (z->win);
+  grub_free (z);
+}
+
+static void
+zstd_restart (grub_zstd_t z)
+{
+  z->in_off = 0;
+  z->in_frame = 0;
+  z->nframes = 0;
+  z->eof = 0;
+  z->win_pos = 0;
+  z->win_off = 0;
+}
+
+/* Decode up to LEN bytes from OFFSET and return how many there were or
+   -1.  */
+static grub_ssize_t
+zstd_read (grub_zstd_t z, grub_off_t offset, grub_uint8_t *buf,
+	   grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+
+  if (offset < z->win_off)
+    zstd_restart (z);
+
+  while (len > 0)
+    {
+      grub_off_t end = z->win_off + z->win_pos;
+
+      if (offset < end)
+	{
+	  grub_size_t n = end - offset;
+
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, z->win + (offset - z->win_off), n);
+	  buf += n;
+	  len -= n;
+	  offset += n;
+	  ret += n;
+	  continue;
+	}
+
+      if (z->eof)
+	break;
+
+      if (z->in_frame ? decode_block (z) : start_frame (z, 1))
+	return -1;
+    }
+
+  return ret;
+}
+
+/* Add up the content sizes of the frames, going from block header to block
+   header to find where the next one starts.  Return -1 when one of them
+   doesn't say.  */
+static grub_off_t
+zstd_content_size (grub_zstd_t z)
+{
+  grub_off_t total = 0;
+
+  while (1)
+    {
+      grub_uint8_t hdr[3];
+      grub_uint32_t h;
+
+      if (start_frame (z, 0))
+	return -1;
+      if (z->eof)
+	return total;
+      if (!z->has_content_size)
+	return -1;
+      total += z->content_size;
+      do
+	{
+	  if (fetch (z, hdr, 3))
+	    return -1;
+	  h = hdr[0] | (hdr[1] << 8) | ((grub_uint32_t) hdr[2] << 16);
+	  z->in_off += ((h >> 1) & 3) == BLOCK_RLE ? 1 : h >> 3;
+	}
+      while (!(h & 1));
+      z->in_frame = 0;
+      if (z->has_checksum)
+	z->in_off += 4;
+    }
+}
+
+grub_ssize_t
+grub_zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		      char *outbuf, grub_size_t outsize)
+{
+  grub_zstd_t z;
+  grub_ssize_t ret;
+
+  z = zstd_new ();
+  if (!z)
+    return -1;
+  z->mem_input = (grub_uint8_t *) inbuf;
+  z->mem_input_size = insize;
+
+  ret = zstd_read (z, off, (grub_uint8_t *) outbuf, outsize);
+  zstd_free (z);
+  return ret;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_zstd_t z;
+  grub_uint8_t magic[4];
+  grub_uint32_t m;
+  grub_off_t size;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, magic, sizeof (magic)) != sizeof (magic))
+    goto not_zstd;
+  m = grub_le_to_cpu32 (grub_get_unaligned32 (magic));
+  if (m != ZSTD_MAGIC
+      && (m & ZSTD_SKIPPABLE_MASK) != ZSTD_SKIPPABLE_MAGIC)
+    goto not_zstd;
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  z = zstd_new ();
+  if (!z)
+    {
+      grub_free (file);
+      return 0;
+    }
+  z->file = io;
+
+  file->device = io->device;
+  file->data = z;
+  file->fs = &grub_zstdio_fs;
+  file->not_easily_seekable = 1;
+
+  /* Streamed compression doesn't record the size, so decode everything
+     once to find it then.  */
+  size = zstd_content_size (z);
+  zstd_restart (z);
+  if (size == (grub_off_t) -1)
+    {
+      grub_uint8_t *scratch;
+      grub_ssize_t n = -1;
+
+      grub_errno = GRUB_ERR_NONE;
+      size = 0;
+      scratch = grub_malloc (ZSTD_BLOCK_MAX);
+      if (scratch)
+	do
+	  {
+	    n = zstd_read (z, size, scratch, ZSTD_BLOCK_MAX);
+	    size += n;
+	  }
+	while (n == ZSTD_BLOCK_MAX);
+      grub_free (scratch);
+      if (n < 0)
+	{
+	  zstd_free (z);
+	  grub_free (file);
+	  return 0;
+	}
+    }
+  file->size = size;
+
+  return file;
+
+ not_zstd:
+  grub_errno = GRUB_ERR_NONE;
+  grub_file_seek (io, 0);
+  return io;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  return zstd_read (file->data, file->offset, (grub_uint8_t *) buf, len);
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstd_t z = file->data;
+
+  grub_file_close (z->file);
+  zstd_free (z);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_zstdio_read,
+  .close = grub_zstdio_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
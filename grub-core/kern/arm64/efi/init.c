@@ -25,29 +25,56 @@
 #include <grub/efi/efi.h>
 #include <grub/loader.h>
 
+static grub_uint64_t timer_frequency;
 static grub_uint64_t timer_frequency_in_khz;
 
+static inline grub_uint64_t
+read_cntvct (void)
+{
+  grub_uint64_t tmr;
+
+  /* Keep the counter read from being hoisted above earlier instructions.  */
+  asm volatile("isb; mrs %0,   cntvct_el0" : "=r" (tmr) : : "memory");
+  return tmr;
+}
+
 static grub_uint64_t
 grub_efi_get_time_ms (void)
 {
-  grub_uint64_t tmr;
-  asm volatile("mrs %0,   cntvct_el0" : "=r" (tmr));
+  return read_cntvct () / timer_frequency_in_khz;
+}
+
+/* Split the conversion so that the multiplication can't overflow.  */
+static grub_uint64_t
+grub_efi_get_time_us (void)
+{
+  grub_uint64_t tmr = read_cntvct ();
+
+  return (tmr / timer_frequency) * 1000000
+    + (tmr % timer_frequency) * 1000000 / timer_frequency;
+}
 
-  return tmr / timer_frequency_in_khz;
+static grub_uint64_t
+grub_efi_get_time_ns (void)
+{
+  grub_uint64_t tmr = read_cntvct ();
+
+  return (tmr / timer_frequency) * 1000000000
+    + (tmr % timer_frequency) * 1000000000 / timer_frequency;
 }
 
 
 void
 grub_machine_init (void)
 {
-  grub_uint64_t timer_frequency;
-
   grub_efi_init ();
 
   asm volatile("mrs %0,   cntfrq_el0" : "=r" (timer_frequency));
   timer_frequency_in_khz = timer_frequency / 1000;
 
   grub_install_get_time_ms (grub_efi_get_time_ms);
+  grub_install_get_time_us (grub_efi_get_time_us);
+  grub_install_get_time_ns (grub_efi_get_time_ns);
 }
 
 void
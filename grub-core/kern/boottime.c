@@ -0,0 +1,143 @@
+/* boottime.c - per-phase boot profiler.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/boottime.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#endif
+
+struct grub_boot_phase_stats grub_boot_phases[GRUB_BOOT_PHASE_COUNT];
+struct grub_boot_span grub_boot_spans[GRUB_BOOT_SPANS];
+unsigned grub_boot_nspans;
+unsigned grub_boot_spans_dropped;
+
+/* How deep each phase is nested, and how many phases are open.  */
+static unsigned phase_nesting[GRUB_BOOT_PHASE_COUNT];
+static unsigned open_phases;
+
+grub_uint64_t
+grub_boot_phase_begin (enum grub_boot_phase phase)
+{
+  phase_nesting[phase]++;
+  open_phases++;
+  return grub_get_time_us ();
+}
+
+void
+grub_boot_phase_end (enum grub_boot_phase phase, grub_uint64_t start,
+		     const char *label)
+{
+  grub_uint64_t duration = grub_get_time_us () - start;
+
+  open_phases--;
+  if (--phase_nesting[phase] == 0)
+    {
+      struct grub_boot_phase_stats *st = &grub_boot_phases[phase];
+
+      st->count++;
+      st->total += duration;
+      if (st->max < duration)
+	st->max = duration;
+    }
+
+  if (label)
+    {
+      struct grub_boot_span *span;
+      grub_size_t len;
+
+      if (grub_boot_nspans == GRUB_BOOT_SPANS)
+	{
+	  grub_boot_spans_dropped++;
+	  return;
+	}
+
+      span = &grub_boot_spans[grub_boot_nspans++];
+      span->start = start;
+      span->duration = (duration > 0xffffffff) ? 0xffffffff : duration;
+      span->phase = phase;
+      span->depth = (open_phases > 0xff) ? 0xff : open_phases;
+
+      /* Keep the tail of long labels; it is the telling part of a path.  */
+      len = grub_strlen (label);
+      if (len >= sizeof (span->label))
+	label += len - (sizeof (span->label) - 1);
+      grub_strncpy (span->label, label, sizeof (span->label) - 1);
+      span->label[sizeof (span->label) - 1] = 0;
+    }
+}
+
+#ifdef GRUB_MACHINE_EFI
+
+/* 01759d8c-a3cd-4f57-ad12-ad5dfb08560a */
+static const grub_efi_guid_t boot_phases_guid =
+  { 0x01759d8c, 0xa3cd, 0x4f57,
+    { 0xad, 0x12, 0xad, 0x5d, 0xfb, 0x08, 0x56, 0x0a } };
+
+void
+grub_boot_phases_export (void)
+{
+  struct grub_boot_phases_header *hdr;
+  grub_size_t size;
+  char *p;
+
+  if (grub_efi_is_finished)
+    return;
+
+  size = sizeof (*hdr) + sizeof (grub_boot_phases)
+    + grub_boot_nspans * sizeof (grub_boot_spans[0]);
+  hdr = grub_malloc (size);
+  if (!hdr)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  hdr->version = GRUB_BOOT_PHASES_VERSION;
+  hdr->nphases = GRUB_BOOT_PHASE_COUNT;
+  hdr->nspans = grub_boot_nspans;
+  hdr->dropped = grub_boot_spans_dropped;
+  hdr->now = grub_get_time_us ();
+  p = (char *) (hdr + 1);
+  grub_memcpy (p, grub_boot_phases, sizeof (grub_boot_phases));
+  p += sizeof (grub_boot_phases);
+  grub_memcpy (p, grub_boot_spans,
+	       grub_boot_nspans * sizeof (grub_boot_spans[0]));
+
+  /* Volatile: this is rewritten on every boot and must not wear the
+     flash.  */
+  if (grub_efi_set_variable_with_attributes ("GrubBootPhases",
+					     &boot_phases_guid, hdr, size,
+					     GRUB_EFI_VARIABLE_BOOTSERVICE_ACCESS
+					     | GRUB_EFI_VARIABLE_RUNTIME_ACCESS))
+    grub_errno = GRUB_ERR_NONE;
+  grub_free (hdr);
+}
+
+#else
+
+void
+grub_boot_phases_export (void)
+{
+}
+
+#endif
@@ -68,25 +68,60 @@ grub_core_cmd_unset (struct grub_command *cmd __attribute__ ((unused)),
   return 0;
 }
 
-/* insmod MODULE */
+/* insmod MODULE... */
 static grub_err_t
 grub_core_cmd_insmod (struct grub_command *cmd __attribute__ ((unused)),
 		      int argc, char *argv[])
 {
   grub_dl_t mod;
+  char **names;
+  int i, num = 0;
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
 
-  if (argv[0][0] == '/' || argv[0][0] == '(' || argv[0][0] == '+')
-    mod = grub_dl_load_file (argv[0]);
-  else
-    mod = grub_dl_load (argv[0]);
+  if (argc == 1)
+    {
+      if (argv[0][0] == '/' || argv[0][0] == '(' || argv[0][0] == '+')
+	mod = grub_dl_load_file (argv[0]);
+      else
+	mod = grub_dl_load (argv[0]);
 
-  if (mod)
-    grub_dl_ref (mod);
+      if (mod)
+	grub_dl_ref (mod);
 
-  return 0;
+      return 0;
+    }
+
+  /* Load explicit files one by one and batch the module names.  */
+  names = grub_malloc (argc * sizeof (names[0]));
+  if (! names)
+    return grub_errno;
+
+  for (i = 0; i < argc; i++)
+    if (argv[i][0] == '/' || argv[i][0] == '(' || argv[i][0] == '+')
+      {
+	mod = grub_dl_load_file (argv[i]);
+	if (! mod)
+	  goto out;
+	grub_dl_ref (mod);
+      }
+    else
+      names[num++] = argv[i];
+
+  if (num && grub_dl_load_list (num, names))
+    goto out;
+
+  for (i = 0; i < num; i++)
+    {
+      mod = grub_dl_get (names[i]);
+      if (mod)
+	grub_dl_ref (mod);
+    }
+
+ out:
+  grub_free (names);
+  return grub_errno;
 }
 
 static int
@@ -185,5 +220,5 @@ grub_register_core_commands (void)
   grub_register_command ("ls", grub_core_cmd_ls,
 			 N_("[ARG]"), N_("List devices or files."));
   grub_register_command ("insmod", grub_core_cmd_insmod,
-			 N_("MODULE"), N_("Insert a module."));
+			 N_("MODULE..."), N_("Insert a module."));
 }
@@ -189,3 +189,73 @@ grub_device_iterate (grub_device_iterate_hook_t hook, void *hook_data)
   /* Only disk devices are supported at the moment.  */
   return grub_disk_dev_iterate (iterate_disk, &ctx);
 }
+
+/* How much of the start and of the end of every disk and partition
+   grub_device_prefetch_all asks for.  Partition tables, filesystem
+   superblocks, LVM labels and RAID superblocks all live there.  */
+#define GRUB_DEVICE_PREFETCH_HEAD	(68 << 10)
+#define GRUB_DEVICE_PREFETCH_TAIL	(128 << 10)
+
+/* Helper for grub_device_prefetch_all.  */
+static void
+prefetch_ends (grub_disk_t disk, grub_disk_addr_t start, grub_uint64_t len)
+{
+  grub_uint64_t head = GRUB_DEVICE_PREFETCH_HEAD >> GRUB_DISK_SECTOR_BITS;
+  grub_uint64_t tail = GRUB_DEVICE_PREFETCH_TAIL >> GRUB_DISK_SECTOR_BITS;
+
+  if (len < head)
+    head = len;
+  grub_disk_prefetch (disk, start, 0, head << GRUB_DISK_SECTOR_BITS);
+  if (len != GRUB_DISK_SIZE_UNKNOWN && len > head + tail)
+    grub_disk_prefetch (disk, start + len - tail, 0,
+			tail << GRUB_DISK_SECTOR_BITS);
+}
+
+/* Helper for grub_device_prefetch_all.  */
+static int
+prefetch_partition (grub_disk_t disk, const grub_partition_t partition,
+		    void *data __attribute__ ((unused)))
+{
+  prefetch_ends (disk, grub_partition_get_start (partition),
+		 grub_partition_get_len (partition));
+  return 0;
+}
+
+/* Helper for grub_device_prefetch_all.  */
+static int
+prefetch_disk (const char *name, void *data)
+{
+  int partitions = *(int *) data;
+  grub_disk_t disk;
+
+  disk = grub_disk_open (name);
+  if (disk)
+    {
+      if (! disk->dev->prefetch)
+	;
+      else if (partitions)
+	grub_partition_iterate (disk, prefetch_partition, NULL);
+      else
+	prefetch_ends (disk, 0, grub_disk_get_size (disk));
+      grub_disk_close (disk);
+    }
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Hint both ends of every disk, and then of every partition, to the disk
+   drivers able to have several reads in flight.  A scan probing the
+   devices one after the other then mostly waits for reads that were all
+   issued at the same time.  Disk drivers without prefetch are skipped, so
+   this costs nothing when there are none.  */
+void
+grub_device_prefetch_all (void)
+{
+  grub_disk_dev_t p;
+  int partitions;
+
+  for (partitions = 0; partitions < 2; partitions++)
+    for (p = grub_disk_dev_list; p; p = p->next)
+      if (p->prefetch && p->iterate)
+	(p->iterate) (prefetch_disk, &partitions, GRUB_DISK_PULL_NONE);
+}
@@ -24,15 +24,28 @@
 #include <grub/misc.h>
 #include <grub/time.h>
 #include <grub/file.h>
+#include <grub/fs.h>
 #include <grub/i18n.h>
+#include <grub/boottime.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
+/* Once this many bytes have been read sequentially through one disk, the
+   rest of the run bypasses the cache.  */
+#define GRUB_DISK_STREAM_THRESHOLD	(1 << 20)
+
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
 struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
 
+/* Incremented on every cache access, used to find the LRU way of a set.  */
+static unsigned long grub_disk_cache_clock;
+
+/* Incremented whenever the cache is invalidated, so that caches built on
+   top of it know to drop what they hold too.  */
+unsigned long grub_disk_cache_generation;
+
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
@@ -48,6 +61,76 @@ grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
 }
 #endif
 
+struct grub_disk_stats *grub_disk_stats_list;
+
+/* Find or make the counters of the disk named NAME.  Counting is simply
+   skipped if there is no memory for them.  */
+static struct grub_disk_stats *
+grub_disk_stats_get (const char *name)
+{
+  struct grub_disk_stats *st;
+
+  for (st = grub_disk_stats_list; st; st = st->next)
+    if (grub_strcmp (st->name, name) == 0)
+      return st;
+
+  st = grub_zalloc (sizeof (*st));
+  if (st)
+    st->name = grub_strdup (name);
+  if (! st || ! st->name)
+    {
+      grub_free (st);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  st->next = grub_disk_stats_list;
+  grub_disk_stats_list = st;
+  return st;
+}
+
+/* Histogram bucket of V: the smallest I such that V <= 2^I.  */
+static unsigned
+grub_disk_stats_bucket (grub_uint64_t v)
+{
+  unsigned i = 0;
+
+  while (i < GRUB_DISK_STATS_BUCKETS - 1 && (1ULL << i) < v)
+    i++;
+  return i;
+}
+
+/* Read SIZE sectors of the device at SECTOR through the driver.  */
+static grub_err_t
+grub_disk_dev_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  struct grub_disk_stats *st = disk->stats;
+  grub_uint64_t start, t, bytes;
+  grub_err_t err;
+
+  if (! st)
+    return (disk->dev->read) (disk, sector, size, buf);
+
+  start = grub_get_time_us ();
+  err = (disk->dev->read) (disk, sector, size, buf);
+  t = grub_get_time_us () - start;
+
+  bytes = (grub_uint64_t) size << disk->log_sector_size;
+  st->dev_reads++;
+  st->dev_bytes += bytes;
+  st->dev_time += t;
+  if (st->dev_max_time < t)
+    st->dev_max_time = t;
+  if (err)
+    st->dev_errors++;
+  st->dev_size_hist[grub_disk_stats_bucket ((bytes + GRUB_DISK_SECTOR_SIZE - 1)
+					    >> GRUB_DISK_SECTOR_BITS)]++;
+  st->dev_time_hist[grub_disk_stats_bucket (t)]++;
+
+  return err;
+}
+
 grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    grub_disk_addr_t sector,
 				    grub_off_t offset,
@@ -60,6 +143,9 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
+  grub_disk_cache_generation++;
+  grub_fs_mount_cache_flush (NULL);
+
   for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
@@ -72,29 +158,43 @@ grub_disk_cache_invalidate_all (void)
     }
 }
 
+/* Bump the cache clock, restarting the ages of all entries if it wraps.  */
+static unsigned long
+grub_disk_cache_tick (void)
+{
+  unsigned i;
+
+  if (++grub_disk_cache_clock)
+    return grub_disk_cache_clock;
+
+  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+    grub_disk_cache_table[i].age = 0;
+  return ++grub_disk_cache_clock;
+}
+
 static char *
-grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
-		       grub_disk_addr_t sector)
+grub_disk_cache_fetch (grub_disk_t disk, grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (disk->dev->id, disk->id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->age = grub_disk_cache_tick ();
 #if DISK_CACHE_STATS
       grub_disk_cache_hits++;
 #endif
+      if (disk->stats)
+	disk->stats->cache_hits++;
       return cache->data;
     }
 
 #if DISK_CACHE_STATS
   grub_disk_cache_misses++;
 #endif
+  if (disk->stats)
+    disk->stats->cache_misses++;
 
   return 0;
 }
@@ -104,45 +204,75 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
+/* Store DATA in the cache.  Units coming from long sequential reads are
+   inserted as the least recently used way of their set, so that streaming
+   through a big file replaces other streamed units rather than hot
+   metadata.  They are promoted like any other entry once they get hit.  */
 static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
-		       grub_disk_addr_t sector, const char *data)
+		       grub_disk_addr_t sector, unsigned bits,
+		       const char *data, int sequential)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (! cache)
+    {
+      struct grub_disk_cache *set;
+      unsigned way;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+      /* Take an empty way or else the least recently used unlocked one.  */
+      set = grub_disk_cache_get_set (dev_id, disk_id, sector);
+      for (way = 0; way < GRUB_DISK_CACHE_WAYS; way++)
+	{
+	  if (set[way].lock)
+	    continue;
+	  if (! set[way].data)
+	    {
+	      cache = set + way;
+	      break;
+	    }
+	  if (! cache || set[way].age < cache->age)
+	    cache = set + way;
+	}
+
+      /* Every way is in use.  Just don't cache it.  */
+      if (! cache)
+	return GRUB_ERR_NONE;
+    }
+
+  if (cache->data && cache->bits != bits)
+    {
+      cache->lock = 1;
+      grub_free (cache->data);
+      cache->data = 0;
+      cache->lock = 0;
+    }
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
   if (! cache->data)
-    return grub_errno;
+    {
+      cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << bits);
+      if (! cache->data)
+	return grub_errno;
+      cache->bits = bits;
+    }
 
-  grub_memcpy (cache->data, data,
-	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  grub_memcpy (cache->data, data, GRUB_DISK_SECTOR_SIZE << bits);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->age = sequential ? 0 : grub_disk_cache_tick ();
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -184,6 +314,53 @@ find_part_sep (const char *name)
   return NULL;
 }
 
+/* Pick the size of the cache units for DISK if its driver didn't.  */
+static unsigned
+grub_disk_choose_cache_bits (grub_disk_t disk)
+{
+  unsigned sector_bits = disk->log_sector_size - GRUB_DISK_SECTOR_BITS;
+  unsigned bits = GRUB_DISK_CACHE_BITS;
+  unsigned max_bits;
+  unsigned long agglomerate;
+
+  /* Keep at least 16 native sectors per unit, so that disks with 4K
+     sectors still get some read-ahead out of a miss.  */
+  if (sector_bits + 4 > bits)
+    bits = sector_bits + 4;
+
+  /* Devices which can't transfer more than a default unit at once, like
+     BIOS and PIO ones, are slow enough that smaller units are a win.  */
+  if (disk->max_agglomerate <= 1)
+    bits--;
+
+  /* Don't make units bigger than a single transfer.  */
+  for (agglomerate = disk->max_agglomerate, max_bits = GRUB_DISK_CACHE_BITS;
+       agglomerate > 1 && max_bits < GRUB_DISK_CACHE_MAX_BITS;
+       agglomerate >>= 1)
+    max_bits++;
+  if (bits > max_bits)
+    bits = max_bits;
+
+  if (bits < GRUB_DISK_CACHE_MIN_BITS)
+    bits = GRUB_DISK_CACHE_MIN_BITS;
+  if (bits < sector_bits)
+    bits = sector_bits;
+  return bits;
+}
+
+/* Return the maximum number of cache units of DISK read at once.  */
+static inline grub_size_t
+grub_disk_max_agglomerate (grub_disk_t disk)
+{
+  grub_size_t ret;
+
+  if (disk->cache_bits <= GRUB_DISK_CACHE_BITS)
+    return ((grub_size_t) disk->max_agglomerate
+	    << (GRUB_DISK_CACHE_BITS - disk->cache_bits));
+  ret = disk->max_agglomerate >> (disk->cache_bits - GRUB_DISK_CACHE_BITS);
+  return ret ? : 1;
+}
+
 grub_disk_t
 grub_disk_open (const char *name)
 {
@@ -247,6 +424,10 @@ grub_disk_open (const char *name)
     }
 
   disk->dev = dev;
+  disk->stats = grub_disk_stats_get (disk->name);
+
+  if (! disk->cache_bits)
+    disk->cache_bits = grub_disk_choose_cache_bits (disk);
 
   if (p)
     {
@@ -319,9 +500,10 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
 {
   char *data;
   char *tmp_buf;
+  unsigned bits = disk->cache_bits;
 
   /* Fetch the cache.  */
-  data = grub_disk_cache_fetch (disk->dev->id, disk->id, sector);
+  data = grub_disk_cache_fetch (disk, sector);
   if (data)
     {
       /* Just copy it!  */
@@ -331,26 +513,25 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     }
 
   /* Allocate a temporary buffer.  */
-  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << bits);
   if (! tmp_buf)
     return grub_errno;
 
   /* Otherwise read data from the disk actually.  */
   if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
-      || sector + GRUB_DISK_CACHE_SIZE
+      || sector + (1ULL << bits)
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
-      err = (disk->dev->read) (disk, transform_sector (disk, sector),
-			       1U << (GRUB_DISK_CACHE_BITS
-				      + GRUB_DISK_SECTOR_BITS
-				      - disk->log_sector_size), tmp_buf);
+      err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				1U << (bits + GRUB_DISK_SECTOR_BITS
+				       - disk->log_sector_size), tmp_buf);
       if (!err)
 	{
 	  /* Copy it and store it in the disk cache.  */
 	  grub_memcpy (buf, tmp_buf + offset, size);
 	  grub_disk_cache_store (disk->dev->id, disk->id,
-				 sector, tmp_buf);
+				 sector, bits, tmp_buf, 0);
 	  grub_free (tmp_buf);
 	  return GRUB_ERR_NONE;
 	}
@@ -377,8 +558,8 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     if (!tmp_buf)
       return grub_errno;
     
-    if ((disk->dev->read) (disk, transform_sector (disk, aligned_sector),
-			   num, tmp_buf))
+    if (grub_disk_dev_read (disk, transform_sector (disk, aligned_sector),
+			    num, tmp_buf))
       {
 	grub_error_push ();
 	grub_dprintf ("disk", "%s read failed\n", disk->name);
@@ -408,11 +589,84 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
-/* Read data from the disk.  */
-grub_err_t
-grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		grub_off_t offset, grub_size_t size, void *buf)
+/* Read from a disk which isn't cached.  SECTOR and OFFSET are already
+   adjusted.  Whole native sectors go straight into BUF, partial ones at
+   either end through a bounce buffer.  */
+static grub_err_t
+grub_disk_read_nocache (grub_disk_t disk, grub_disk_addr_t sector,
+			grub_off_t offset, grub_size_t size, void *buf)
 {
+  unsigned sector_size = 1U << disk->log_sector_size;
+  grub_disk_addr_t mask = (1ULL << (disk->log_sector_size
+				    - GRUB_DISK_SECTOR_BITS)) - 1;
+  grub_size_t max_len = (grub_disk_max_agglomerate (disk)
+			 << (disk->cache_bits + GRUB_DISK_SECTOR_BITS));
+  char *tmp_buf = NULL;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (disk->read_hook)
+    (disk->read_hook) (sector, offset, size, disk->read_hook_data);
+
+  if (disk->mem)
+    {
+      grub_memcpy (buf, disk->mem + (sector << GRUB_DISK_SECTOR_BITS)
+		   + offset, size);
+      return GRUB_ERR_NONE;
+    }
+
+  offset += (sector & mask) << GRUB_DISK_SECTOR_BITS;
+  sector &= ~mask;
+
+  while (size)
+    {
+      grub_size_t len;
+
+      if (offset == 0 && size >= sector_size)
+	{
+	  len = size & ~((grub_size_t) sector_size - 1);
+	  /* Real disks can't take reads of any size.  */
+	  if (len > max_len && max_len >= sector_size)
+	    len = max_len;
+	  err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				    len >> disk->log_sector_size, buf);
+	}
+      else
+	{
+	  if (! tmp_buf)
+	    tmp_buf = grub_malloc (sector_size);
+	  if (! tmp_buf)
+	    return grub_errno;
+	  len = sector_size - offset;
+	  if (len > size)
+	    len = size;
+	  err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				    1, tmp_buf);
+	  if (! err)
+	    grub_memcpy (buf, tmp_buf + offset, len);
+	}
+      if (err)
+	break;
+
+      sector += (offset + len) >> GRUB_DISK_SECTOR_BITS;
+      offset = 0;
+      buf = (char *) buf + len;
+      size -= len;
+    }
+
+  grub_free (tmp_buf);
+  return err;
+}
+
+static grub_err_t
+grub_disk_read_real (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_uint64_t start;
+  int streaming;
+  unsigned bits = disk->cache_bits;
+  grub_size_t unit_size = GRUB_DISK_SECTOR_SIZE << bits;
+  grub_size_t max_agglomerate = grub_disk_max_agglomerate (disk);
+
   /* First of all, check if the region is within the disk.  */
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     {
@@ -423,18 +677,31 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  if (disk->nocache || disk->mem)
+    return grub_disk_read_nocache (disk, sector, offset, size, buf);
+
+  /* Detect long sequential runs, for example loading a big initrd.  Their
+     data is typically read only once, so copying it into the cache would
+     just waste time and heap.  */
+  start = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+  if (start == disk->stream_next)
+    disk->stream_length += size;
+  else
+    disk->stream_length = size;
+  disk->stream_next = start + size;
+  streaming = (disk->stream_length >= GRUB_DISK_STREAM_THRESHOLD);
+
   /* First read until first cache boundary.   */
-  if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
+  if (offset || (sector & ((1ULL << bits) - 1)))
     {
       grub_disk_addr_t start_sector;
       grub_size_t pos;
       grub_err_t err;
       grub_size_t len;
 
-      start_sector = sector & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+      start_sector = sector & ~((1ULL << bits) - 1);
       pos = (sector - start_sector) << GRUB_DISK_SECTOR_BITS;
-      len = ((GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
-	     - pos - offset);
+      len = unit_size - pos - offset;
       if (len > size)
 	len = size;
       err = grub_disk_read_small (disk, start_sector,
@@ -449,74 +716,76 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
     }
 
   /* Until SIZE is zero...  */
-  while (size >= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS))
+  while (size >= unit_size)
     {
       char *data = NULL;
       grub_disk_addr_t agglomerate;
       grub_err_t err;
 
-      /* agglomerate read until we find a first cached entry.  */
-      for (agglomerate = 0; agglomerate
-	     < (size >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS))
-	     && agglomerate < disk->max_agglomerate;
-	   agglomerate++)
+      if (streaming)
 	{
-	  data = grub_disk_cache_fetch (disk->dev->id, disk->id,
-					sector + (agglomerate
-						  << GRUB_DISK_CACHE_BITS));
-	  if (data)
-	    break;
+	  /* Read straight into the caller's buffer.  */
+	  agglomerate = size >> (GRUB_DISK_SECTOR_BITS + bits);
+	  if (agglomerate > max_agglomerate)
+	    agglomerate = max_agglomerate;
 	}
+      else
+	/* agglomerate read until we find a first cached entry.  */
+	for (agglomerate = 0; agglomerate
+	       < (size >> (GRUB_DISK_SECTOR_BITS + bits))
+	       && agglomerate < max_agglomerate;
+	     agglomerate++)
+	  {
+	    data = grub_disk_cache_fetch (disk, sector + (agglomerate << bits));
+	    if (data)
+	      break;
+	  }
 
       if (data)
 	{
 	  grub_memcpy ((char *) buf
-		       + (agglomerate << (GRUB_DISK_CACHE_BITS
-					  + GRUB_DISK_SECTOR_BITS)),
-		       data, GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
+		       + (agglomerate << (bits + GRUB_DISK_SECTOR_BITS)),
+		       data, unit_size);
 	  grub_disk_cache_unlock (disk->dev->id, disk->id,
-				  sector + (agglomerate
-					    << GRUB_DISK_CACHE_BITS));
+				  sector + (agglomerate << bits));
 	}
 
       if (agglomerate)
 	{
 	  grub_disk_addr_t i;
 
-	  err = (disk->dev->read) (disk, transform_sector (disk, sector),
-				   agglomerate << (GRUB_DISK_CACHE_BITS
-						   + GRUB_DISK_SECTOR_BITS
-						   - disk->log_sector_size),
-				   buf);
+	  err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				    agglomerate << (bits + GRUB_DISK_SECTOR_BITS
+						    - disk->log_sector_size),
+				    buf);
 	  if (err)
 	    return err;
 	  
-	  for (i = 0; i < agglomerate; i ++)
+	  for (i = 0; ! streaming && i < agglomerate; i ++)
 	    grub_disk_cache_store (disk->dev->id, disk->id,
-				   sector + (i << GRUB_DISK_CACHE_BITS),
+				   sector + (i << bits), bits,
 				   (char *) buf
-				   + (i << (GRUB_DISK_CACHE_BITS
-					    + GRUB_DISK_SECTOR_BITS)));
+				   + (i << (bits + GRUB_DISK_SECTOR_BITS)), 1);
 
 
 	  if (disk->read_hook)
-	    (disk->read_hook) (sector, 0, agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS),
+	    (disk->read_hook) (sector, 0, agglomerate << (bits + GRUB_DISK_SECTOR_BITS),
 			       disk->read_hook_data);
 
-	  sector += agglomerate << GRUB_DISK_CACHE_BITS;
-	  size -= agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+	  sector += agglomerate << bits;
+	  size -= agglomerate << (bits + GRUB_DISK_SECTOR_BITS);
 	  buf = (char *) buf 
-	    + (agglomerate << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+	    + (agglomerate << (bits + GRUB_DISK_SECTOR_BITS));
 	}
 
       if (data)
 	{
 	  if (disk->read_hook)
-	    (disk->read_hook) (sector, 0, (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS),
+	    (disk->read_hook) (sector, 0, unit_size,
 			       disk->read_hook_data);
-	  sector += GRUB_DISK_CACHE_SIZE;
-	  buf = (char *) buf + (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
-	  size -= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
+	  sector += 1ULL << bits;
+	  buf = (char *) buf + unit_size;
+	  size -= unit_size;
 	}
     }
 
@@ -532,6 +801,87 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read data from the disk.  */
+grub_err_t
+grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_uint64_t start;
+  grub_err_t err;
+
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_DISK_READ);
+  err = grub_disk_read_real (disk, sector, offset, size, buf);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_DISK_READ, start, NULL);
+
+  if (disk->stats)
+    {
+      disk->stats->reads++;
+      disk->stats->bytes += size;
+      disk->stats->time += grub_get_time_us () - start;
+      if (err)
+	disk->stats->errors++;
+    }
+
+  return err;
+}
+
+/* Return the address of SIZE bytes at SECTOR and OFFSET of a disk in
+   memory, so that they can be used without being copied.  Return NULL
+   without setting an error if DISK isn't in memory, or with one if the
+   range is outside of it.  */
+const void *
+grub_disk_map (grub_disk_t disk, grub_disk_addr_t sector,
+	       grub_off_t offset, grub_size_t size)
+{
+  if (! disk->mem)
+    return NULL;
+
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    return NULL;
+
+  if (disk->read_hook)
+    (disk->read_hook) (sector, offset, size, disk->read_hook_data);
+
+  return disk->mem + (sector << GRUB_DISK_SECTOR_BITS) + offset;
+}
+
+/* Hint that SIZE bytes at SECTOR and OFFSET will be read soon.  Units
+   already in the cache are skipped.  Errors are ignored.  */
+void
+grub_disk_prefetch (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_off_t offset, grub_size_t size)
+{
+  grub_disk_addr_t end;
+  grub_disk_addr_t unit_mask = (1ULL << disk->cache_bits) - 1;
+
+  if (! disk->dev->prefetch || size == 0)
+    return;
+
+  grub_error_push ();
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    goto out;
+
+  end = (sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+		   >> GRUB_DISK_SECTOR_BITS) + unit_mask) & ~unit_mask;
+  sector &= ~unit_mask;
+
+  while (sector < end
+	 && grub_disk_cache_lookup (disk->dev->id, disk->id, sector))
+    sector += unit_mask + 1;
+  while (end > sector
+	 && grub_disk_cache_lookup (disk->dev->id, disk->id,
+				    end - unit_mask - 1))
+    end -= unit_mask + 1;
+
+  if (sector < end)
+    (disk->dev->prefetch) (disk, transform_sector (disk, sector),
+			   transform_sector (disk, end - sector));
+
+ out:
+  grub_errno = GRUB_ERR_NONE;
+  grub_error_pop ();
+}
+
 grub_uint64_t
 grub_disk_get_size (grub_disk_t disk)
 {
@@ -60,6 +60,33 @@ grub_disk_cache_get_index (unsigned long dev_id, unsigned long disk_id,
 			   grub_disk_addr_t sector)
 {
   return ((dev_id * 524287UL + disk_id * 2606459UL
-	   + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
-	  % GRUB_DISK_CACHE_NUM);
+	   + ((unsigned) (sector >> GRUB_DISK_CACHE_MIN_BITS)))
+	  % GRUB_DISK_CACHE_SETS);
+}
+
+/* Return the first way of the set SECTOR maps to.  */
+static inline struct grub_disk_cache *
+grub_disk_cache_get_set (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector)
+{
+  return grub_disk_cache_table
+    + grub_disk_cache_get_index (dev_id, disk_id, sector)
+    * GRUB_DISK_CACHE_WAYS;
+}
+
+/* Return the cache entry holding SECTOR or NULL if it isn't cached.  */
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *cache;
+  unsigned way;
+
+  cache = grub_disk_cache_get_set (dev_id, disk_id, sector);
+  for (way = 0; way < GRUB_DISK_CACHE_WAYS; way++, cache++)
+    if (cache->data && cache->dev_id == dev_id && cache->disk_id == disk_id
+	&& cache->sector == sector)
+      return cache;
+
+  return 0;
 }
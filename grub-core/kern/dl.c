@@ -32,6 +32,8 @@
 #include <grub/env.h>
 #include <grub/cache.h>
 #include <grub/i18n.h>
+#include <grub/modpack.h>
+#include <grub/boottime.h>
 
 /* Platforms where modules are in a readonly area of memory.  */
 #if defined(GRUB_MACHINE_QEMU)
@@ -77,19 +79,22 @@ struct grub_symbol
 {
   struct grub_symbol *next;
   const char *name;
+  unsigned hash;	/* Full hash of NAME, checked before comparing.  */
   void *addr;
   int isfunc;
   grub_dl_t mod;	/* The module to which this symbol belongs.  */
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The size of the symbol table.  The kernel alone exports several hundred
+   symbols, so keep the chains short when many modules are loaded.  */
+#define GRUB_SYMTAB_SIZE	2039
 
 /* The symbol table (using an open-hash).  */
 static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
 
-/* Simple hash function.  */
+/* Simple hash function.  The full value is kept in every symbol so that
+   lookups only compare names whose hashes already match.  */
 static unsigned
 grub_symbol_hash (const char *s)
 {
@@ -98,7 +103,7 @@ grub_symbol_hash (const char *s)
   while (*s)
     key = key * 65599 + *s++;
 
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
+  return key + (key >> 5);
 }
 
 /* Resolve the symbol name NAME and return the address.
@@ -107,9 +112,10 @@ static grub_symbol_t
 grub_dl_resolve_symbol (const char *name)
 {
   grub_symbol_t sym;
+  unsigned hash = grub_symbol_hash (name);
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
+  for (sym = grub_symtab[hash % GRUB_SYMTAB_SIZE]; sym; sym = sym->next)
+    if (sym->hash == hash && grub_strcmp (sym->name, name) == 0)
       return sym;
 
   return 0;
@@ -142,8 +148,9 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
   sym->addr = addr;
   sym->mod = mod;
   sym->isfunc = isfunc;
+  sym->hash = grub_symbol_hash (name);
 
-  k = grub_symbol_hash (name);
+  k = sym->hash % GRUB_SYMTAB_SIZE;
   sym->next = grub_symtab[k];
   grub_symtab[k] = sym;
 
@@ -655,6 +662,10 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
       return 0;
     }
 
+#ifdef GRUB_MACHINE_EMU
+  grub_dl_osdep_loaded (mod, e, size);
+#endif
+
   return mod;
 }
 
@@ -662,29 +673,116 @@ grub_dl_t
 grub_dl_load_core (void *addr, grub_size_t size)
 {
   grub_dl_t mod;
+  grub_uint64_t start;
 
   grub_boot_time ("Parsing module");
 
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_MODULE_LOAD);
   mod = grub_dl_load_core_noinit (addr, size);
 
   if (!mod)
-    return NULL;
+    {
+      grub_boot_phase_end (GRUB_BOOT_PHASE_MODULE_LOAD, start, NULL);
+      return NULL;
+    }
 
   grub_boot_time ("Initing module %s", mod->name);
   grub_dl_init (mod);
   grub_boot_time ("Module %s inited", mod->name);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_MODULE_LOAD, start, mod->name);
 
   return mod;
 }
 
-/* Load a module from the file FILENAME.  */
-grub_dl_t
-grub_dl_load_file (const char *filename)
+/* An embedded module which is not loaded until something asks for it by
+   name, either directly or as a dependency.  Until then it takes no time
+   to relocate or initialize and registers nothing.  */
+struct grub_dl_deferred
+{
+  struct grub_dl_deferred *next;
+  char *name;
+  void *core;
+  grub_size_t size;
+};
+
+static struct grub_dl_deferred *grub_dl_deferred;
+
+/* Keep a copy of the module at ADDR for loading on first use.  The copy
+   is needed because the space of embedded modules may be reclaimed.  */
+grub_err_t
+grub_dl_defer_core (void *addr, grub_size_t size)
+{
+  struct grub_dl_deferred *d;
+  Elf_Ehdr *e = addr;
+  Elf_Shdr *s;
+
+  if (grub_dl_check_header (e, size))
+    return grub_errno;
+  if (size < e->e_shoff + (grub_uint32_t) e->e_shentsize * e->e_shnum)
+    return grub_error (GRUB_ERR_BAD_OS, "ELF sections outside core");
+
+  s = grub_dl_find_section (e, ".modname");
+  if (! s)
+    return grub_error (GRUB_ERR_BAD_MODULE, "no module name found");
+
+  d = grub_zalloc (sizeof (*d));
+  if (! d)
+    return grub_errno;
+  d->name = grub_strdup ((char *) e + s->sh_offset);
+  d->core = grub_malloc (size);
+  if (! d->name || ! d->core)
+    {
+      grub_free (d->name);
+      grub_free (d->core);
+      grub_free (d);
+      return grub_errno;
+    }
+  grub_memcpy (d->core, addr, size);
+  d->size = size;
+
+  grub_dprintf ("modules", "deferring module %s\n", d->name);
+  d->next = grub_dl_deferred;
+  grub_dl_deferred = d;
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_dl_deferred **
+grub_dl_deferred_find (const char *name)
+{
+  struct grub_dl_deferred **p;
+
+  for (p = &grub_dl_deferred; *p; p = &(*p)->next)
+    if (grub_strcmp ((*p)->name, name) == 0)
+      return p;
+  return 0;
+}
+
+/* Hand the deferred image of NAME over to the caller, who frees it.  */
+static void *
+grub_dl_deferred_take (const char *name, grub_size_t *size)
+{
+  struct grub_dl_deferred **p, *d;
+  void *core;
+
+  p = grub_dl_deferred_find (name);
+  if (! p)
+    return 0;
+
+  d = *p;
+  *p = d->next;
+  core = d->core;
+  *size = d->size;
+  grub_free (d->name);
+  grub_free (d);
+  return core;
+}
+
+/* Read the whole file FILENAME into memory.  Return NULL on error.  */
+static void *
+grub_dl_read_file (const char *filename, grub_size_t *size)
 {
   grub_file_t file = NULL;
-  grub_ssize_t size;
   void *core = 0;
-  grub_dl_t mod = 0;
 
   grub_boot_time ("Loading module %s", filename);
 
@@ -692,15 +790,15 @@ grub_dl_load_file (const char *filename)
   if (! file)
     return 0;
 
-  size = grub_file_size (file);
-  core = grub_malloc (size);
+  *size = grub_file_size (file);
+  core = grub_malloc (*size);
   if (! core)
     {
       grub_file_close (file);
       return 0;
     }
 
-  if (grub_file_read (file, core, size) != (int) size)
+  if (grub_file_read (file, core, *size) != (grub_ssize_t) *size)
     {
       grub_file_close (file);
       grub_free (core);
@@ -712,6 +810,21 @@ grub_dl_load_file (const char *filename)
      opens of the same device.  */
   grub_file_close (file);
 
+  return core;
+}
+
+/* Load a module from the file FILENAME.  */
+grub_dl_t
+grub_dl_load_file (const char *filename)
+{
+  grub_size_t size;
+  void *core;
+  grub_dl_t mod;
+
+  core = grub_dl_read_file (filename, &size);
+  if (! core)
+    return 0;
+
   mod = grub_dl_load_core (core, size);
   grub_free (core);
   if (! mod)
@@ -721,13 +834,150 @@ grub_dl_load_file (const char *filename)
   return mod;
 }
 
+/* Return the name of the platform file NAME followed by SUFFIX under
+   $prefix.  */
+static char *
+grub_dl_module_filename (const char *name, const char *suffix)
+{
+  const char *grub_dl_dir = grub_env_get ("prefix");
+
+  if (! grub_dl_dir) {
+    grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"), "prefix");
+    return 0;
+  }
+
+  return grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/%s%s",
+			 grub_dl_dir, name, suffix);
+}
+
+/* The table of contents of the module pack under $prefix, if any.  */
+static struct
+{
+  /* The pack the table was looked up for, even when it does not exist.  */
+  char *filename;
+  void *toc;
+  grub_uint32_t count;
+  struct grub_modpack_entry *entries;
+  const char *strings;
+} grub_dl_pack;
+
+/* Read the table of contents of the module pack under the current $prefix
+   unless it is known already.  Return nonzero if the pack is usable.  */
+static int
+grub_dl_pack_load (void)
+{
+  struct grub_modpack_header hdr;
+  grub_file_t file;
+  char *filename;
+  grub_uint32_t count, toc_size, strings_size, i;
+  grub_off_t size;
+
+  filename = grub_dl_module_filename (GRUB_MODPACK_FILENAME, "");
+  if (! filename)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  if (grub_dl_pack.filename
+      && grub_strcmp (grub_dl_pack.filename, filename) == 0)
+    {
+      grub_free (filename);
+      return grub_dl_pack.toc != 0;
+    }
+
+  grub_free (grub_dl_pack.filename);
+  grub_free (grub_dl_pack.toc);
+  grub_dl_pack.filename = filename;
+  grub_dl_pack.toc = 0;
+
+  file = grub_file_open (filename);
+  if (! file)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  if (grub_file_read (file, &hdr, sizeof (hdr)) != sizeof (hdr)
+      || grub_memcmp (hdr.magic, GRUB_MODPACK_MAGIC, sizeof (hdr.magic)) != 0)
+    goto fail;
+
+  count = grub_le_to_cpu32 (hdr.count);
+  toc_size = grub_le_to_cpu32 (hdr.toc_size);
+  size = grub_file_size (file);
+  if (count == 0 || count > toc_size / sizeof (struct grub_modpack_entry)
+      || (size != GRUB_FILE_SIZE_UNKNOWN && toc_size > size))
+    goto fail;
+
+  grub_dl_pack.toc = grub_malloc (toc_size);
+  if (! grub_dl_pack.toc)
+    goto fail;
+  if (grub_file_read (file, grub_dl_pack.toc, toc_size) != (grub_ssize_t) toc_size)
+    goto fail;
+
+  grub_dl_pack.count = count;
+  grub_dl_pack.entries = grub_dl_pack.toc;
+  grub_dl_pack.strings = (char *) (grub_dl_pack.entries + count);
+  strings_size = toc_size - count * sizeof (struct grub_modpack_entry);
+  if (strings_size == 0 || grub_dl_pack.strings[strings_size - 1] != '\0')
+    goto fail;
+
+  for (i = 0; i < count; i++)
+    {
+      struct grub_modpack_entry *e = &grub_dl_pack.entries[i];
+
+      if (grub_le_to_cpu32 (e->name) >= strings_size
+	  || grub_le_to_cpu32 (e->deps) >= strings_size
+	  || (size != GRUB_FILE_SIZE_UNKNOWN
+	      && (grub_off_t) grub_le_to_cpu32 (e->offset)
+	      + grub_le_to_cpu32 (e->size) > size))
+	goto fail;
+    }
+
+  grub_file_close (file);
+  grub_dprintf ("modules", "using module pack %s with %u modules\n",
+		filename, count);
+  return 1;
+
+ fail:
+  grub_dprintf ("modules", "ignoring module pack %s\n", filename);
+  grub_file_close (file);
+  grub_free (grub_dl_pack.toc);
+  grub_dl_pack.toc = 0;
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Find the module NAME in the module pack.  */
+static struct grub_modpack_entry *
+grub_dl_pack_find (const char *name)
+{
+  grub_uint32_t lo = 0, hi = grub_dl_pack.count;
+
+  while (lo < hi)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+      struct grub_modpack_entry *e = &grub_dl_pack.entries[mid];
+      int cmp = grub_strcmp (grub_dl_pack.strings + grub_le_to_cpu32 (e->name),
+			     name);
+
+      if (cmp == 0)
+	return e;
+      if (cmp < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return 0;
+}
+
 /* Load a module using a symbolic name.  */
 grub_dl_t
 grub_dl_load (const char *name)
 {
   char *filename;
   grub_dl_t mod;
-  const char *grub_dl_dir = grub_env_get ("prefix");
 
   mod = grub_dl_get (name);
   if (mod)
@@ -736,13 +986,17 @@ grub_dl_load (const char *name)
   if (grub_no_modules)
     return 0;
 
-  if (! grub_dl_dir) {
-    grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"), "prefix");
-    return 0;
-  }
+  /* Pull the module and all of its dependencies out of the embedded
+     images or the pack at once.  */
+  if (grub_dl_deferred_find (name)
+      || (grub_dl_pack_load () && grub_dl_pack_find (name)))
+    {
+      if (grub_dl_load_list (1, (char **) &name))
+	return 0;
+      return grub_dl_get (name);
+    }
 
-  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/%s.mod",
-			     grub_dl_dir, name);
+  filename = grub_dl_module_filename (name, ".mod");
   if (! filename)
     return 0;
 
@@ -758,6 +1012,244 @@ grub_dl_load (const char *name)
   return mod;
 }
 
+/* A module image read by grub_dl_load_list but not linked yet.  */
+struct grub_dl_image
+{
+  struct grub_dl_image *next;
+  char *name;
+  void *core;
+  grub_size_t size;
+  /* The entry of this module in the module pack, if it is there.  */
+  struct grub_modpack_entry *packed;
+  int linked;
+};
+
+static struct grub_dl_image *
+grub_dl_image_find (struct grub_dl_image *list, const char *name)
+{
+  for (; list; list = list->next)
+    if (grub_strcmp (list->name, name) == 0)
+      return list;
+  return 0;
+}
+
+/* Queue the module NAME at *TAIL unless it is loaded or queued already.  */
+static grub_err_t
+grub_dl_image_queue (struct grub_dl_image *list,
+		     struct grub_dl_image ***tail, const char *name)
+{
+  struct grub_dl_image *img;
+
+  if (grub_dl_get (name) || grub_dl_image_find (list, name))
+    return GRUB_ERR_NONE;
+
+  img = grub_zalloc (sizeof (*img));
+  if (! img)
+    return grub_errno;
+  img->name = grub_strdup (name);
+  if (! img->name)
+    {
+      grub_free (img);
+      return grub_errno;
+    }
+
+  /* Embedded images need no reading at all.  */
+  img->core = grub_dl_deferred_take (name, &img->size);
+
+  **tail = img;
+  *tail = &img->next;
+  return GRUB_ERR_NONE;
+}
+
+/* Read every queued image found in the module pack in a single pass over
+   the pack, queueing dependencies from its table of contents first.  */
+static grub_err_t
+grub_dl_image_read_packed (struct grub_dl_image *list,
+			   struct grub_dl_image ***tail)
+{
+  struct grub_dl_image *img;
+  grub_file_t file;
+
+  /* Queueing dependencies appends to the list, so this walks the whole
+     closure.  */
+  for (img = list; img; img = img->next)
+    {
+      const char *dep;
+
+      img->packed = grub_dl_pack_find (img->name);
+      if (! img->packed)
+	continue;
+
+      for (dep = grub_dl_pack.strings + grub_le_to_cpu32 (img->packed->deps);
+	   *dep; dep += grub_strlen (dep) + 1)
+	if (grub_dl_image_queue (list, tail, dep))
+	  return grub_errno;
+    }
+
+  file = grub_file_open (grub_dl_pack.filename);
+  if (! file)
+    return grub_errno;
+
+  /* Read in the order of the pack, so that the file is never seeked
+     backwards.  */
+  while (1)
+    {
+      struct grub_dl_image *first = 0;
+      grub_uint32_t offset;
+
+      for (img = list; img; img = img->next)
+	if (img->packed && ! img->core
+	    && (! first || grub_le_to_cpu32 (img->packed->offset)
+		< grub_le_to_cpu32 (first->packed->offset)))
+	  first = img;
+      if (! first)
+	break;
+
+      offset = grub_le_to_cpu32 (first->packed->offset);
+      first->size = grub_le_to_cpu32 (first->packed->size);
+      grub_boot_time ("Loading module %s from pack", first->name);
+
+      first->core = grub_malloc (first->size);
+      if (! first->core)
+	break;
+
+      grub_file_seek (file, offset);
+      if (grub_file_read (file, first->core, first->size)
+	  != (grub_ssize_t) first->size)
+	{
+	  if (! grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("premature end of file %s"), grub_dl_pack.filename);
+	  break;
+	}
+    }
+
+  grub_file_close (file);
+  return grub_errno;
+}
+
+/* Link IMG after every queued module it depends on.  */
+static grub_err_t
+grub_dl_image_link (struct grub_dl_image *list, struct grub_dl_image *img)
+{
+  Elf_Shdr *s;
+  grub_dl_t mod;
+
+  if (img->linked)
+    return GRUB_ERR_NONE;
+  img->linked = 1;
+
+  s = grub_dl_find_section (img->core, ".moddeps");
+  if (s)
+    {
+      const char *name = (char *) img->core + s->sh_offset;
+      const char *max = name + s->sh_size;
+
+      for (; name < max && *name; name += grub_strlen (name) + 1)
+	{
+	  struct grub_dl_image *dep = grub_dl_image_find (list, name);
+
+	  if (dep && grub_dl_image_link (list, dep))
+	    return grub_errno;
+	}
+    }
+
+  mod = grub_dl_load_core (img->core, img->size);
+  if (! mod)
+    return grub_errno;
+
+  mod->ref_count--;
+
+  if (grub_strcmp (mod->name, img->name) != 0)
+    return grub_error (GRUB_ERR_BAD_MODULE, "mismatched names");
+
+  return GRUB_ERR_NONE;
+}
+
+/* Load the NUM modules NAMES together with everything they depend on.
+   All the missing images are read first, back to back, and only then
+   linked in dependency order, so that I/O is not interleaved with
+   relocation and module initialization.  */
+grub_err_t
+grub_dl_load_list (int num, char **names)
+{
+  struct grub_dl_image *list = 0, **tail = &list, *img, *next;
+  grub_err_t err = GRUB_ERR_NONE;
+  int i;
+
+  if (grub_no_modules)
+    return GRUB_ERR_NONE;
+
+  for (i = 0; i < num; i++)
+    if (grub_dl_image_queue (list, &tail, names[i]))
+      goto fail;
+
+  if (list && grub_dl_pack_load ()
+      && grub_dl_image_read_packed (list, &tail))
+    goto fail;
+
+  /* Queueing dependencies appends to the list, so this walks the whole
+     dependency closure.  Anything missing from the pack is read from its
+     own file.  */
+  for (img = list; img; img = img->next)
+    {
+      Elf_Ehdr *e;
+      Elf_Shdr *s;
+
+      if (! img->core)
+	{
+	  char *filename;
+
+	  filename = grub_dl_module_filename (img->name, ".mod");
+	  if (! filename)
+	    goto fail;
+	  img->core = grub_dl_read_file (filename, &img->size);
+	  grub_free (filename);
+	  if (! img->core)
+	    goto fail;
+	}
+
+      e = img->core;
+      if (grub_dl_check_header (e, img->size))
+	goto fail;
+      if (img->size < e->e_shoff + (grub_uint32_t) e->e_shentsize * e->e_shnum)
+	{
+	  grub_error (GRUB_ERR_BAD_OS, "ELF sections outside core");
+	  goto fail;
+	}
+
+      s = grub_dl_find_section (e, ".moddeps");
+      if (s)
+	{
+	  const char *name = (char *) e + s->sh_offset;
+	  const char *max = name + s->sh_size;
+
+	  for (; name < max && *name; name += grub_strlen (name) + 1)
+	    if (grub_dl_image_queue (list, &tail, name))
+	      goto fail;
+	}
+    }
+
+  for (img = list; img; img = img->next)
+    if (grub_dl_image_link (list, img))
+      goto fail;
+
+  goto done;
+
+ fail:
+  err = grub_errno;
+ done:
+  for (img = list; img; img = next)
+    {
+      next = img->next;
+      grub_free (img->core);
+      grub_free (img->name);
+      grub_free (img);
+    }
+
+  return err;
+}
+
 /* Unload the module MOD.  */
 int
 grub_dl_unload (grub_dl_t mod)
@@ -783,6 +1275,7 @@ grub_dl_unload (grub_dl_t mod)
     }
 
 #ifdef GRUB_MACHINE_EMU
+  grub_dl_osdep_unloaded (mod);
   grub_dl_osdep_dl_free (mod->base);
 #else
   grub_free (mod->base);
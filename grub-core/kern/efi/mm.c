@@ -30,6 +30,9 @@
 #define NEXT_MEMORY_DESCRIPTOR(desc, size)	\
   ((grub_efi_memory_descriptor_t *) ((char *) (desc) + (size)))
 
+#define MEMORY_DESCRIPTOR_AT(map, i, size)	\
+  ((grub_efi_memory_descriptor_t *) ((char *) (map) + (i) * (size)))
+
 #define BYTES_TO_PAGES(bytes)	(((bytes) + 0xfff) >> 12)
 #define BYTES_TO_PAGES_DOWN(bytes)	((bytes) >> 12)
 #define PAGES_TO_BYTES(pages)	((pages) << 12)
@@ -42,6 +45,15 @@
 #define MIN_HEAP_SIZE	0x100000
 #define MAX_HEAP_SIZE	(1600 * 0x100000)
 
+/* The heap starts with a sixteenth of the conventional memory, within
+   MIN_HEAP_SIZE and INITIAL_HEAP_SIZE, and is grown on demand by at least
+   HEAP_GROW_SIZE at a time up to MAX_HEAP_SIZE.  */
+#define INITIAL_HEAP_SIZE	(64 * 0x100000)
+#define HEAP_GROW_SIZE	(4 * 0x100000)
+
+/* Pages taken from the firmware for the heap so far.  */
+static grub_efi_uint64_t heap_pages;
+
 static void *finish_mmap_buf = 0;
 static grub_efi_uintn_t finish_mmap_size = 0;
 static grub_efi_uintn_t finish_key = 0;
@@ -123,9 +135,6 @@ find_card (grub_pci_device_t dev, grub_pci_id_t pciid,
   if ((pciid & 0xffff) != GRUB_PCI_VENDOR_BROADCOM)
     return 0;
 
-  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
-  if (grub_pci_read (addr) >> 24 != GRUB_PCI_CLASS_NETWORK)
-    return 0;
   cap = grub_pci_find_capability (dev, GRUB_PCI_CAP_POWER_MANAGEMENT);
   if (!cap)
     return 0;
@@ -140,7 +149,8 @@ find_card (grub_pci_device_t dev, grub_pci_id_t pciid,
 static void
 stop_broadcom (void)
 {
-  grub_pci_iterate (find_card, NULL);
+  grub_pci_iterate_class (GRUB_PCI_CLASS_NETWORK << 16, 0xff0000,
+			  find_card, NULL);
 }
 
 #endif
@@ -153,6 +163,7 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 {
   grub_efi_boot_services_t *b;
   grub_efi_status_t status;
+  grub_efi_uintn_t alloc_size;
 
 #if defined (__i386__) || defined (__x86_64__)
   const grub_uint16_t apple[] = { 'A', 'p', 'p', 'l', 'e' };
@@ -162,24 +173,39 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 			   apple, sizeof (apple)) == 0);
 #endif
 
+  /* Keep the buffer across retries and only grow it when the firmware
+     reports a larger map.  Some slack is left so that the descriptors
+     added by our own allocation do not force another round trip.  */
+  finish_mmap_buf = 0;
+  alloc_size = 0;
   while (1)
     {
-      if (grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf, &finish_key,
-				   &finish_desc_size, &finish_desc_version) < 0)
-	return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+      int ret;
 
-      if (outbuf && *outbuf_size < finish_mmap_size)
-	return grub_error (GRUB_ERR_IO, "memory map buffer is too small");
+      finish_mmap_size = alloc_size;
+      ret = grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf,
+				     &finish_key, &finish_desc_size,
+				     &finish_desc_version);
+      if (ret < 0)
+	{
+	  grub_free (finish_mmap_buf);
+	  return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+	}
 
-      finish_mmap_buf = grub_malloc (finish_mmap_size);
-      if (!finish_mmap_buf)
-	return grub_errno;
+      if (outbuf && *outbuf_size < finish_mmap_size)
+	{
+	  grub_free (finish_mmap_buf);
+	  return grub_error (GRUB_ERR_IO, "memory map buffer is too small");
+	}
 
-      if (grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf, &finish_key,
-				   &finish_desc_size, &finish_desc_version) <= 0)
+      if (ret == 0)
 	{
 	  grub_free (finish_mmap_buf);
-	  return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+	  alloc_size = finish_mmap_size + 8 * finish_desc_size;
+	  finish_mmap_buf = grub_malloc (alloc_size);
+	  if (!finish_mmap_buf)
+	    return grub_errno;
+	  continue;
 	}
 
       b = grub_efi_system_table->boot_services;
@@ -194,7 +220,6 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 	  return grub_error (GRUB_ERR_IO, "couldn't terminate EFI services");
 	}
 
-      grub_free (finish_mmap_buf);
       grub_printf ("Trying to terminate EFI services again\n");
     }
   grub_efi_is_finished = 1;
@@ -276,37 +301,63 @@ grub_efi_get_memory_map (grub_efi_uintn_t *memory_map_size,
     return -1;
 }
 
-/* Sort the memory map in place.  */
+/* Helper for sort_memory_map.  Sift the descriptor at ROOT down the
+   min-heap of N descriptors (by number of pages).  */
+static void
+sift_memory_map (grub_efi_memory_descriptor_t *memory_map,
+		 grub_efi_uintn_t desc_size,
+		 grub_efi_uintn_t root, grub_efi_uintn_t n)
+{
+  while (2 * root + 1 < n)
+    {
+      grub_efi_uintn_t child = 2 * root + 1;
+      grub_efi_memory_descriptor_t *r, *c;
+      grub_efi_memory_descriptor_t tmp;
+
+      if (child + 1 < n
+	  && MEMORY_DESCRIPTOR_AT (memory_map, child + 1, desc_size)->num_pages
+	  < MEMORY_DESCRIPTOR_AT (memory_map, child, desc_size)->num_pages)
+	child++;
+
+      r = MEMORY_DESCRIPTOR_AT (memory_map, root, desc_size);
+      c = MEMORY_DESCRIPTOR_AT (memory_map, child, desc_size);
+      if (r->num_pages <= c->num_pages)
+	return;
+
+      tmp = *r;
+      *r = *c;
+      *c = tmp;
+      root = child;
+    }
+}
+
+/* Sort the memory map in place, largest regions first.  This runs before
+   the heap exists and firmware maps may have thousands of entries, so use
+   a heapsort rather than a quadratic sort.  */
 static void
 sort_memory_map (grub_efi_memory_descriptor_t *memory_map,
 		 grub_efi_uintn_t desc_size,
 		 grub_efi_memory_descriptor_t *memory_map_end)
 {
-  grub_efi_memory_descriptor_t *d1;
-  grub_efi_memory_descriptor_t *d2;
+  grub_efi_uintn_t n, i;
 
-  for (d1 = memory_map;
-       d1 < memory_map_end;
-       d1 = NEXT_MEMORY_DESCRIPTOR (d1, desc_size))
-    {
-      grub_efi_memory_descriptor_t *max_desc = d1;
+  n = ((char *) memory_map_end - (char *) memory_map) / desc_size;
+  if (n < 2)
+    return;
 
-      for (d2 = NEXT_MEMORY_DESCRIPTOR (d1, desc_size);
-	   d2 < memory_map_end;
-	   d2 = NEXT_MEMORY_DESCRIPTOR (d2, desc_size))
-	{
-	  if (max_desc->num_pages < d2->num_pages)
-	    max_desc = d2;
-	}
+  for (i = n / 2; i > 0; i--)
+    sift_memory_map (memory_map, desc_size, i - 1, n);
 
-      if (max_desc != d1)
-	{
-	  grub_efi_memory_descriptor_t tmp;
-
-	  tmp = *d1;
-	  *d1 = *max_desc;
-	  *max_desc = tmp;
-	}
+  for (i = n - 1; i > 0; i--)
+    {
+      grub_efi_memory_descriptor_t *last;
+      grub_efi_memory_descriptor_t tmp;
+
+      last = MEMORY_DESCRIPTOR_AT (memory_map, i, desc_size);
+      tmp = *memory_map;
+      *memory_map = *last;
+      *last = tmp;
+      sift_memory_map (memory_map, desc_size, 0, i);
     }
 }
 
@@ -377,17 +428,19 @@ get_total_pages (grub_efi_memory_descriptor_t *memory_map,
   return total;
 }
 
-/* Add memory regions.  */
-static void
+/* Add memory regions.  Regions are taken in order until REQUIRED_PAGES
+   are covered; falling short is only an error if nothing could be added.  */
+static grub_err_t
 add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 		    grub_efi_uintn_t desc_size,
 		    grub_efi_memory_descriptor_t *memory_map_end,
 		    grub_efi_uint64_t required_pages)
 {
   grub_efi_memory_descriptor_t *desc;
+  grub_efi_uint64_t added = 0;
 
   for (desc = memory_map;
-       desc < memory_map_end;
+       desc < memory_map_end && required_pages > 0;
        desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
     {
       grub_efi_uint64_t pages;
@@ -404,60 +457,43 @@ add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 
       addr = grub_efi_allocate_pages (start, pages);
       if (! addr)
-	grub_fatal ("cannot allocate conventional memory %p with %u pages",
-		    (void *) ((grub_addr_t) start),
-		    (unsigned) pages);
+	continue;
 
       grub_mm_init_region (addr, PAGES_TO_BYTES (pages));
 
+      heap_pages += pages;
+      added += pages;
       required_pages -= pages;
-      if (required_pages == 0)
-	break;
     }
 
-  if (required_pages > 0)
-    grub_fatal ("too little memory");
-}
+  if (added == 0)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "too little memory");
 
-#if 0
-/* Print the memory map.  */
-static void
-print_memory_map (grub_efi_memory_descriptor_t *memory_map,
-		  grub_efi_uintn_t desc_size,
-		  grub_efi_memory_descriptor_t *memory_map_end)
-{
-  grub_efi_memory_descriptor_t *desc;
-  int i;
-
-  for (desc = memory_map, i = 0;
-       desc < memory_map_end;
-       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size), i++)
-    {
-      grub_printf ("MD: t=%x, p=%llx, v=%llx, n=%llx, a=%llx\n",
-		   desc->type, desc->physical_start, desc->virtual_start,
-		   desc->num_pages, desc->attribute);
-    }
+  return GRUB_ERR_NONE;
 }
-#endif
 
-void
-grub_efi_mm_init (void)
+/* Take REQUIRED_PAGES of conventional memory from the firmware for the
+   heap, or the initial heap if REQUIRED_PAGES is 0.  This runs when the
+   heap is empty or exhausted, so it must not use grub_malloc.  */
+static grub_err_t
+add_heap (grub_efi_uint64_t required_pages)
 {
   grub_efi_memory_descriptor_t *memory_map;
   grub_efi_memory_descriptor_t *memory_map_end;
   grub_efi_memory_descriptor_t *filtered_memory_map;
   grub_efi_memory_descriptor_t *filtered_memory_map_end;
   grub_efi_uintn_t map_size;
+  grub_efi_uintn_t map_pages;
   grub_efi_uintn_t desc_size;
   grub_efi_uint64_t total_pages;
-  grub_efi_uint64_t required_pages;
+  grub_err_t err;
   int mm_status;
 
   /* Prepare a memory region to store two memory maps.  */
-  memory_map = grub_efi_allocate_pages (0,
-					2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+  map_pages = 2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE);
+  memory_map = grub_efi_allocate_pages (0, map_pages);
   if (! memory_map)
-    grub_fatal ("cannot allocate memory");
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "cannot allocate memory");
 
   /* Obtain descriptors for available memory.  */
   map_size = MEMORY_MAP_SIZE;
@@ -467,22 +503,25 @@ grub_efi_mm_init (void)
   if (mm_status == 0)
     {
       grub_efi_free_pages
-	((grub_efi_physical_address_t) ((grub_addr_t) memory_map),
-	 2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+	((grub_efi_physical_address_t) ((grub_addr_t) memory_map), map_pages);
 
       /* Freeing/allocating operations may increase memory map size.  */
       map_size += desc_size * 32;
 
-      memory_map = grub_efi_allocate_pages (0, 2 * BYTES_TO_PAGES (map_size));
+      map_pages = 2 * BYTES_TO_PAGES (map_size);
+      memory_map = grub_efi_allocate_pages (0, map_pages);
       if (! memory_map)
-	grub_fatal ("cannot allocate memory");
+	return grub_error (GRUB_ERR_OUT_OF_MEMORY, "cannot allocate memory");
 
       mm_status = grub_efi_get_memory_map (&map_size, memory_map, 0,
 					   &desc_size, 0);
     }
 
-  if (mm_status < 0)
-    grub_fatal ("cannot get memory map");
+  if (mm_status <= 0)
+    {
+      grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+      return grub_error (GRUB_ERR_IO, "cannot get memory map");
+    }
 
   memory_map_end = NEXT_MEMORY_DESCRIPTOR (memory_map, map_size);
 
@@ -491,37 +530,81 @@ grub_efi_mm_init (void)
   filtered_memory_map_end = filter_memory_map (memory_map, filtered_memory_map,
 					       desc_size, memory_map_end);
 
-  /* By default, request a quarter of the available memory.  */
-  total_pages = get_total_pages (filtered_memory_map, desc_size,
-				 filtered_memory_map_end);
-  required_pages = (total_pages >> 2);
-  if (required_pages < BYTES_TO_PAGES (MIN_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MIN_HEAP_SIZE);
-  else if (required_pages > BYTES_TO_PAGES (MAX_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MAX_HEAP_SIZE);
+  if (required_pages == 0)
+    {
+      /* Holding a large share of memory up front only takes it away from
+	 the loaders, and the heap can grow later, so start modestly.  */
+      total_pages = get_total_pages (filtered_memory_map, desc_size,
+				     filtered_memory_map_end);
+      required_pages = (total_pages >> 4);
+      if (required_pages < BYTES_TO_PAGES (MIN_HEAP_SIZE))
+	required_pages = BYTES_TO_PAGES (MIN_HEAP_SIZE);
+      else if (required_pages > BYTES_TO_PAGES (INITIAL_HEAP_SIZE))
+	required_pages = BYTES_TO_PAGES (INITIAL_HEAP_SIZE);
+    }
 
   /* Sort the filtered descriptors, so that GRUB can allocate pages
      from smaller regions.  */
   sort_memory_map (filtered_memory_map, desc_size, filtered_memory_map_end);
 
   /* Allocate memory regions for GRUB's memory management.  */
-  add_memory_regions (filtered_memory_map, desc_size,
-		      filtered_memory_map_end, required_pages);
+  err = add_memory_regions (filtered_memory_map, desc_size,
+			    filtered_memory_map_end, required_pages);
 
-#if 0
-  /* For debug.  */
-  map_size = MEMORY_MAP_SIZE;
+  /* Release the memory maps.  */
+  grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+
+  return err;
+}
+
+/* Called by the allocator when the heap is exhausted.  */
+static grub_err_t
+grow_heap (grub_size_t size)
+{
+  grub_efi_uint64_t pages;
 
-  if (grub_efi_get_memory_map (&map_size, memory_map, 0, &desc_size, 0) < 0)
-    grub_fatal ("cannot get memory map");
+  if (grub_efi_is_finished)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "boot services are gone");
+
+  /* Leave room for the region and block headers.  */
+  pages = BYTES_TO_PAGES ((grub_efi_uint64_t) size + 0x1000);
+  if (pages < BYTES_TO_PAGES (HEAP_GROW_SIZE))
+    pages = BYTES_TO_PAGES (HEAP_GROW_SIZE);
+
+  if (heap_pages >= BYTES_TO_PAGES (MAX_HEAP_SIZE))
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "heap limit reached");
+  if (pages > BYTES_TO_PAGES (MAX_HEAP_SIZE) - heap_pages)
+    pages = BYTES_TO_PAGES (MAX_HEAP_SIZE) - heap_pages;
 
-  grub_printf ("printing memory map\n");
-  print_memory_map (memory_map, desc_size,
-		    NEXT_MEMORY_DESCRIPTOR (memory_map, map_size));
-  grub_fatal ("Debug. ");
+  return add_heap (pages);
+}
+
+#if 0
+/* Print the memory map.  */
+static void
+print_memory_map (grub_efi_memory_descriptor_t *memory_map,
+		  grub_efi_uintn_t desc_size,
+		  grub_efi_memory_descriptor_t *memory_map_end)
+{
+  grub_efi_memory_descriptor_t *desc;
+  int i;
+
+  for (desc = memory_map, i = 0;
+       desc < memory_map_end;
+       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size), i++)
+    {
+      grub_printf ("MD: t=%x, p=%llx, v=%llx, n=%llx, a=%llx\n",
+		   desc->type, desc->physical_start, desc->virtual_start,
+		   desc->num_pages, desc->attribute);
+    }
+}
 #endif
 
-  /* Release the memory maps.  */
-  grub_efi_free_pages ((grub_addr_t) memory_map,
-		       2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+void
+grub_efi_mm_init (void)
+{
+  if (add_heap (0) != GRUB_ERR_NONE)
+    grub_fatal ("%s", grub_errmsg);
+
+  grub_mm_add_region_fn = grow_heap;
 }
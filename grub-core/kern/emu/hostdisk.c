@@ -43,6 +43,10 @@
 #include <errno.h>
 #include <limits.h>
 
+#if GRUB_UTIL_FD_STAT_IS_FUNCTIONAL
+# include <sys/mman.h>
+#endif
+
 #ifdef __linux__
 # include <sys/ioctl.h>         /* ioctl */
 # include <sys/mount.h>
@@ -141,6 +145,8 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
   data->fd = GRUB_UTIL_FD_INVALID;
   data->is_disk = 0;
   data->device_map = map[drive].device_map;
+  data->map = NULL;
+  data->map_size = 0;
 
   /* Get the size.  */
   {
@@ -156,6 +162,9 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
 						 &disk->log_sector_size);
     disk->total_sectors >>= disk->log_sector_size;
     disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+    /* Memory is plentiful on the host and every miss is a system call,
+       so use the biggest cache units.  */
+    disk->cache_bits = GRUB_DISK_CACHE_MAX_BITS;
 
 #if GRUB_UTIL_FD_STAT_IS_FUNCTIONAL
     {
@@ -166,6 +175,22 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
       if (fstat (fd, &st) >= 0 && S_ISBLK (st.st_mode))
 # endif
 	data->is_disk = 1;
+      /* Image files are mapped, so that reads are served from the page
+	 cache without system calls or the disk cache.  Writes still go
+	 through the descriptor, and the shared mapping sees them.  Hosts
+	 with too little address space simply read.  */
+      else if (S_ISREG (st.st_mode) && st.st_size > 0
+	       && (grub_uint64_t) st.st_size == (grub_size_t) st.st_size)
+	{
+	  void *addr = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	  if (addr != MAP_FAILED)
+	    {
+	      data->map = addr;
+	      data->map_size = st.st_size;
+	      disk->mem = addr;
+	    }
+	}
     }
 #endif
 
@@ -220,8 +245,9 @@ grub_hostdisk_os_dev_to_grub_drive (const char *os_disk, int add)
 
 #ifndef __linux__
 grub_util_fd_t
-grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags,
-			  grub_disk_addr_t *max)
+grub_util_fd_open_device (const grub_disk_t disk,
+			  grub_disk_addr_t *sector __attribute__ ((unused)),
+			  int flags, grub_disk_addr_t *max)
 {
   grub_util_fd_t fd;
   struct grub_util_hostdisk_data *data = disk->data;
@@ -264,15 +290,6 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
       return GRUB_UTIL_FD_INVALID;
     }
 
-  if (grub_util_fd_seek (fd, sector << disk->log_sector_size))
-    {
-      grub_util_fd_close (fd);
-      grub_error (GRUB_ERR_BAD_DEVICE, N_("cannot seek `%s': %s"),
-		  map[disk->id].device, grub_util_fd_strerror ());
-
-      return GRUB_UTIL_FD_INVALID;
-    }
-
   return fd;
 }
 #endif
@@ -286,7 +303,10 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
     {
       grub_util_fd_t fd;
       grub_disk_addr_t max = ~0ULL;
-      fd = grub_util_fd_open_device (disk, sector, GRUB_UTIL_FD_O_RDONLY, &max);
+      grub_disk_addr_t fd_sector = sector;
+
+      fd = grub_util_fd_open_device (disk, &fd_sector, GRUB_UTIL_FD_O_RDONLY,
+				     &max);
       if (!GRUB_UTIL_FD_IS_VALID (fd))
 	return grub_errno;
 
@@ -302,7 +322,8 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
       if (max > size)
 	max = size;
 
-      if (grub_util_fd_read (fd, buf, max << disk->log_sector_size)
+      if (grub_util_fd_pread (fd, buf, max << disk->log_sector_size,
+			      fd_sector << disk->log_sector_size)
 	  != (ssize_t) (max << disk->log_sector_size))
 	return grub_error (GRUB_ERR_READ_ERROR, N_("cannot read `%s': %s"),
 			   map[disk->id].device, grub_util_fd_strerror ());
@@ -313,6 +334,23 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+static grub_err_t
+grub_util_biosdisk_prefetch (grub_disk_t disk, grub_disk_addr_t sector,
+			     grub_size_t size)
+{
+  grub_util_fd_t fd;
+  grub_disk_addr_t max = ~0ULL;
+
+  fd = grub_util_fd_open_device (disk, &sector, GRUB_UTIL_FD_O_RDONLY, &max);
+  if (!GRUB_UTIL_FD_IS_VALID (fd))
+    return grub_errno;
+  if (max > size)
+    max = size;
+  grub_util_fd_advise (fd, sector << disk->log_sector_size,
+		       max << disk->log_sector_size);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 			  grub_size_t size, const char *buf)
@@ -321,10 +359,17 @@ grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
     {
       grub_util_fd_t fd;
       grub_disk_addr_t max = ~0ULL;
-      fd = grub_util_fd_open_device (disk, sector, GRUB_UTIL_FD_O_WRONLY, &max);
+      grub_disk_addr_t fd_sector = sector;
+
+      fd = grub_util_fd_open_device (disk, &fd_sector, GRUB_UTIL_FD_O_WRONLY,
+				     &max);
       if (!GRUB_UTIL_FD_IS_VALID (fd))
 	return grub_errno;
 
+      if (grub_util_fd_seek (fd, fd_sector << disk->log_sector_size))
+	return grub_error (GRUB_ERR_BAD_DEVICE, N_("cannot seek `%s': %s"),
+			   map[disk->id].device, grub_util_fd_strerror ());
+
 #ifdef __linux__
       if (sector == 0)
 	/* Work around a bug in Linux ez remapping.  Linux remaps all
@@ -343,6 +388,7 @@ grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 			   map[disk->id].device, grub_util_fd_strerror ());
       size -= max;
       buf += (max << disk->log_sector_size);
+      sector += max;
     }
   return GRUB_ERR_NONE;
 }
@@ -356,8 +402,9 @@ grub_util_biosdisk_flush (struct grub_disk *disk)
     return GRUB_ERR_NONE;
   if (!GRUB_UTIL_FD_IS_VALID (data->fd))
     {
-      grub_disk_addr_t max;
-      data->fd = grub_util_fd_open_device (disk, 0, GRUB_UTIL_FD_O_RDONLY, &max);
+      grub_disk_addr_t max, sector = 0;
+      data->fd = grub_util_fd_open_device (disk, &sector, GRUB_UTIL_FD_O_RDONLY,
+					   &max);
       if (!GRUB_UTIL_FD_IS_VALID (data->fd))
 	return grub_errno;
     }
@@ -381,6 +428,10 @@ grub_util_biosdisk_close (struct grub_disk *disk)
 	grub_util_biosdisk_flush (disk);
       grub_util_fd_close (data->fd);
     }
+#if GRUB_UTIL_FD_STAT_IS_FUNCTIONAL
+  if (data->map)
+    munmap (data->map, data->map_size);
+#endif
   free (data);
 }
 
@@ -393,6 +444,7 @@ static struct grub_disk_dev grub_util_biosdisk_dev =
     .close = grub_util_biosdisk_close,
     .read = grub_util_biosdisk_read,
     .write = grub_util_biosdisk_write,
+    .prefetch = grub_util_biosdisk_prefetch,
     .next = 0
   };
 
@@ -58,6 +58,7 @@ static jmp_buf main_env;
 static char *root_dev = NULL, *dir = NULL;
 
 grub_addr_t grub_modbase = 0;
+int grub_emu_perf_map;
 
 void
 grub_reboot (void)
@@ -93,6 +94,7 @@ grub_machine_fini (int flags)
 
 
 #define OPT_MEMDISK 257
+#define OPT_PERF_MAP 258
 
 static struct argp_option options[] = {
   {"root",      'r', N_("DEVICE_NAME"), 0, N_("Set root device."), 2},
@@ -106,6 +108,8 @@ static struct argp_option options[] = {
    N_("use GRUB files in the directory DIR [default=%s]"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {"hold",     'H', N_("SECS"),      OPTION_ARG_OPTIONAL, N_("wait until a debugger will attach"), 0},
+  {"perf-map",  OPT_PERF_MAP, 0,      0,
+   N_("list the functions of loaded modules in /tmp/perf-PID.map for perf"), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -163,6 +167,9 @@ argp_parser (int key, char *arg, struct argp_state *state)
     case 'v':
       verbosity++;
       break;
+    case OPT_PERF_MAP:
+      grub_emu_perf_map = 1;
+      break;
 
     case ARGP_KEY_ARG:
       {
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <grub/mm.h>
 #include <grub/err.h>
@@ -153,6 +154,30 @@ grub_get_time_ms (void)
   return (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
 
+grub_uint64_t
+grub_get_time_us (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, 0);
+
+  return ((grub_uint64_t) tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+#ifdef CLOCK_REALTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+  return ((grub_uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+#else
+  return grub_get_time_us () * 1000;
+#endif
+}
+
 size_t
 grub_util_get_image_size (const char *path)
 {
@@ -28,38 +28,254 @@ static struct grub_env_context initial_context;
 /* The current context.  */
 struct grub_env_context *grub_current_context = &initial_context;
 
+/* Variable names are interned: all variables of the same name, in any
+   context, share one refcounted copy of it, and the name of a variable
+   is found by comparing pointers.  */
+struct grub_env_name
+{
+  struct grub_env_name *next;
+  unsigned int hash;
+  unsigned int refcnt;
+  char str[0];
+};
+
+#define ENV_NAME(s) ((struct grub_env_name *) \
+		     ((s) - __builtin_offsetof (struct grub_env_name, str)))
+
+static struct grub_env_name **names;
+static unsigned int names_size;
+static unsigned int names_count;
+
 /* Return the hash representation of the string S.  */
 static unsigned int
 grub_env_hashval (const char *s)
 {
-  unsigned int i = 0;
+  unsigned int i = 2166136261U;
 
-  /* XXX: This can be done much more efficiently.  */
+  /* FNV-1a, which spreads well enough into the low bits.  */
   while (*s)
-    i += 5 * *(s++);
+    i = (i ^ (grub_uint8_t) *(s++)) * 16777619;
+
+  return i;
+}
+
+static struct grub_env_name *
+grub_env_name_find (const char *s)
+{
+  struct grub_env_name *n;
+  unsigned int hash;
+
+  if (! names)
+    return 0;
+
+  hash = grub_env_hashval (s);
+  for (n = names[hash & (names_size - 1)]; n; n = n->next)
+    if (n->hash == hash && grub_strcmp (n->str, s) == 0)
+      return n;
+
+  return 0;
+}
+
+static void
+grub_env_names_grow (void)
+{
+  struct grub_env_name **new_names, *n, *next;
+  unsigned int new_size = names_size ? names_size * 2 : HASHSZ;
+  unsigned int i;
+
+  new_names = grub_zalloc (new_size * sizeof (new_names[0]));
+  if (! new_names)
+    {
+      /* A full table only gets slower.  */
+      if (names)
+	grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < names_size; i++)
+    for (n = names[i]; n; n = next)
+      {
+	next = n->next;
+	n->next = new_names[n->hash & (new_size - 1)];
+	new_names[n->hash & (new_size - 1)] = n;
+      }
+
+  grub_free (names);
+  names = new_names;
+  names_size = new_size;
+}
+
+/* Return the interned copy of S, taking a reference to it.  */
+static char *
+grub_env_name_get (const char *s)
+{
+  struct grub_env_name *n;
+  grub_size_t len;
+
+  n = grub_env_name_find (s);
+  if (n)
+    {
+      n->refcnt++;
+      return n->str;
+    }
+
+  if (names_count >= names_size)
+    {
+      grub_env_names_grow ();
+      if (! names)
+	return 0;
+    }
+
+  len = grub_strlen (s);
+  n = grub_malloc (sizeof (*n) + len + 1);
+  if (! n)
+    return 0;
+
+  grub_memcpy (n->str, s, len + 1);
+  n->hash = grub_env_hashval (s);
+  n->refcnt = 1;
+  n->next = names[n->hash & (names_size - 1)];
+  names[n->hash & (names_size - 1)] = n;
+  names_count++;
+
+  return n->str;
+}
+
+static void
+grub_env_name_put (char *s)
+{
+  struct grub_env_name *n = ENV_NAME (s), **p;
+
+  if (--n->refcnt)
+    return;
+
+  for (p = &names[n->hash & (names_size - 1)]; *p != n; p = &(*p)->next)
+    ;
+  *p = n->next;
+  names_count--;
+  grub_free (n);
+}
 
-  return i % HASHSZ;
+static void
+grub_env_free_var (struct grub_env_var *var)
+{
+  grub_env_name_put (var->name);
+  grub_free (var->value);
+  grub_free (var);
 }
 
+/* Look for the interned NAME in CONTEXT itself.  */
 static struct grub_env_var *
-grub_env_find (const char *name)
+grub_env_find_in (struct grub_env_context *context, char *name)
 {
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
 
-  /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
-    if (grub_strcmp (var->name, name) == 0)
+  if (! context->vars)
+    return 0;
+
+  for (var = context->vars[ENV_NAME (name)->hash & (context->size - 1)];
+       var; var = var->next)
+    if (var->name == name)
       return var;
 
   return 0;
 }
 
+/* Look for the interned NAME in the contexts CONTEXT inherits from.  */
+static struct grub_env_var *
+grub_env_find_inherited (struct grub_env_context *context, char *name)
+{
+  struct grub_env_context *c, *child = context;
+  struct grub_env_var *var;
+
+  for (c = context->prev; c; child = c, c = c->prev)
+    {
+      var = grub_env_find_in (c, name);
+      if (! var)
+	continue;
+
+      /* Whatever was passed on to CHILD is exported from there on.  */
+      if (! var->value || ! (var->global || child->export_all))
+	return 0;
+      return var;
+    }
+
+  return 0;
+}
+
+/* Find the variable NAME as the current context sees it.  *INHERITED is
+   set if it belongs to a previous context and must not be changed; a
+   variable unset in the current context is returned with a NULL
+   value.  */
+static struct grub_env_var *
+grub_env_find (const char *name, int *inherited)
+{
+  struct grub_env_name *n;
+  struct grub_env_var *var;
+
+  *inherited = 0;
+
+  n = grub_env_name_find (name);
+  if (! n)
+    return 0;
+
+  var = grub_env_find_in (grub_current_context, n->str);
+  if (var)
+    return var;
+
+  var = grub_env_find_inherited (grub_current_context, n->str);
+  if (var)
+    *inherited = 1;
+  return var;
+}
+
 static void
+grub_env_grow (struct grub_env_context *context)
+{
+  struct grub_env_var **vars, *var, *next;
+  unsigned int size = context->size ? context->size * 2 : HASHSZ;
+  unsigned int i, idx;
+
+  vars = grub_zalloc (size * sizeof (vars[0]));
+  if (! vars)
+    {
+      /* A full table only gets slower.  */
+      if (context->vars)
+	grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < context->size; i++)
+    for (var = context->vars[i]; var; var = next)
+      {
+	next = var->next;
+	idx = ENV_NAME (var->name)->hash & (size - 1);
+	var->prevp = &vars[idx];
+	var->next = vars[idx];
+	if (var->next)
+	  var->next->prevp = &(var->next);
+	vars[idx] = var;
+      }
+
+  grub_free (context->vars);
+  context->vars = vars;
+  context->size = size;
+}
+
+static grub_err_t
 grub_env_insert (struct grub_env_context *context,
 		 struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  int idx;
+
+  if (context->count >= context->size)
+    {
+      grub_env_grow (context);
+      if (! context->vars)
+	return grub_errno;
+    }
+
+  idx = ENV_NAME (var->name)->hash & (context->size - 1);
 
   /* Insert the variable into the hashtable.  */
   var->prevp = &context->vars[idx];
@@ -67,24 +283,90 @@ grub_env_insert (struct grub_env_context *context,
   if (var->next)
     var->next->prevp = &(var->next);
   context->vars[idx] = var;
+  context->count++;
+
+  return GRUB_ERR_NONE;
 }
 
 static void
-grub_env_remove (struct grub_env_var *var)
+grub_env_remove (struct grub_env_context *context, struct grub_env_var *var)
 {
   /* Remove the entry from the variable table.  */
   *var->prevp = var->next;
   if (var->next)
     var->next->prevp = var->prevp;
+  context->count--;
+}
+
+/* Create a variable NAME with VAL and no hooks in the current context.  */
+static struct grub_env_var *
+grub_env_new (const char *name, const char *val)
+{
+  struct grub_env_var *var;
+
+  var = grub_zalloc (sizeof (*var));
+  if (! var)
+    return 0;
+
+  var->name = grub_env_name_get (name);
+  if (! var->name)
+    {
+      grub_free (var);
+      return 0;
+    }
+
+  if (val)
+    {
+      var->value = grub_strdup (val);
+      if (! var->value)
+	{
+	  grub_env_free_var (var);
+	  return 0;
+	}
+    }
+
+  if (grub_env_insert (grub_current_context, var))
+    {
+      grub_env_free_var (var);
+      return 0;
+    }
+
+  return var;
+}
+
+/* Give the current context its own copy of the inherited VAR, to be
+   changed.  */
+static struct grub_env_var *
+grub_env_copy (struct grub_env_var *var)
+{
+  struct grub_env_var *copy;
+
+  copy = grub_env_new (var->name, var->value);
+  if (! copy)
+    return 0;
+
+  copy->read_hook = var->read_hook;
+  copy->write_hook = var->write_hook;
+  copy->global = 1;
+
+  return copy;
 }
 
 grub_err_t
 grub_env_set (const char *name, const char *val)
 {
   struct grub_env_var *var;
+  int inherited;
 
   /* If the variable does already exist, just update the variable.  */
-  var = grub_env_find (name);
+  var = grub_env_find (name, &inherited);
+  if (var && inherited)
+    {
+      var = grub_env_copy (var);
+      if (! var)
+	return grub_errno;
+    }
+
   if (var)
     {
       char *old = var->value;
@@ -105,37 +387,20 @@ grub_env_set (const char *name, const char *val)
     }
 
   /* The variable does not exist, so create a new one.  */
-  var = grub_zalloc (sizeof (*var));
-  if (! var)
+  if (! grub_env_new (name, val))
     return grub_errno;
 
-  var->name = grub_strdup (name);
-  if (! var->name)
-    goto fail;
-
-  var->value = grub_strdup (val);
-  if (! var->value)
-    goto fail;
-
-  grub_env_insert (grub_current_context, var);
-
   return GRUB_ERR_NONE;
-
- fail:
-  grub_free (var->name);
-  grub_free (var->value);
-  grub_free (var);
-
-  return grub_errno;
 }
 
 const char *
 grub_env_get (const char *name)
 {
   struct grub_env_var *var;
+  int inherited;
 
-  var = grub_env_find (name);
-  if (! var)
+  var = grub_env_find (name, &inherited);
+  if (! var || ! var->value)
     return 0;
 
   if (var->read_hook)
@@ -148,9 +413,10 @@ void
 grub_env_unset (const char *name)
 {
   struct grub_env_var *var;
+  int inherited;
 
-  var = grub_env_find (name);
-  if (! var)
+  var = grub_env_find (name, &inherited);
+  if (! var || ! var->value)
     return;
 
   if (var->read_hook || var->write_hook)
@@ -159,39 +425,114 @@ grub_env_unset (const char *name)
       return;
     }
 
-  grub_env_remove (var);
+  /* Hide the variable of a previous context.  */
+  if (inherited)
+    {
+      grub_env_new (name, 0);
+      return;
+    }
 
-  grub_free (var->name);
-  grub_free (var->value);
-  grub_free (var);
+  if (grub_env_find_inherited (grub_current_context, var->name))
+    {
+      grub_free (var->value);
+      var->value = 0;
+      var->global = 0;
+      return;
+    }
+
+  grub_env_remove (grub_current_context, var);
+  grub_env_free_var (var);
 }
 
-struct grub_env_var *
-grub_env_update_get_sorted (void)
+/* Free all variables of CONTEXT.  */
+void
+grub_env_free_context (struct grub_env_context *context)
 {
-  struct grub_env_var *sorted_list = 0;
-  int i;
+  unsigned int i;
 
-  /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < context->size; i++)
     {
-      struct grub_env_var *var;
+      struct grub_env_var *p, *q;
 
-      for (var = grub_current_context->vars[i]; var; var = var->next)
+      for (p = context->vars[i]; p; p = q)
 	{
-	  struct grub_env_var *p, **q;
-
-	  for (q = &sorted_list, p = *q; p; q = &((*q)->sorted_next), p = *q)
-	    {
-	      if (grub_strcmp (p->name, var->name) > 0)
-		break;
-	    }
-
-	  var->sorted_next = *q;
-	  *q = var;
+	  q = p->next;
+	  grub_env_free_var (p);
 	}
     }
 
+  grub_free (context->vars);
+  context->vars = 0;
+  context->size = 0;
+  context->count = 0;
+}
+
+/* Merge the sorted lists A and B.  */
+static struct grub_env_var *
+grub_env_merge_sorted (struct grub_env_var *a, struct grub_env_var *b)
+{
+  struct grub_env_var *head, **tail = &head;
+
+  while (a && b)
+    if (grub_strcmp (a->name, b->name) <= 0)
+      {
+	*tail = a;
+	tail = &a->sorted_next;
+	a = a->sorted_next;
+      }
+    else
+      {
+	*tail = b;
+	tail = &b->sorted_next;
+	b = b->sorted_next;
+      }
+  *tail = a ? a : b;
+
+  return head;
+}
+
+struct grub_env_var *
+grub_env_update_get_sorted (void)
+{
+  /* Bottom-up merge sort: runs[i] is a sorted list of 2^i entries.  */
+  struct grub_env_var *runs[sizeof (grub_size_t) * 8];
+  struct grub_env_var *sorted_list = 0;
+  struct grub_env_context *context;
+  unsigned int i, n;
+
+  grub_memset (runs, 0, sizeof (runs));
+
+  /* Add the variables visible in the current context.  */
+  for (context = grub_current_context; context; context = context->prev)
+    for (i = 0; i < context->size; i++)
+      {
+	struct grub_env_var *var, *run;
+
+	for (var = context->vars[i]; var; var = var->next)
+	  {
+	    if (! var->value)
+	      continue;
+	    if (context != grub_current_context
+		&& (grub_env_find_in (grub_current_context, var->name)
+		    || (grub_env_find_inherited (grub_current_context,
+						 var->name) != var)))
+	      continue;
+
+	    var->sorted_next = 0;
+	    run = var;
+	    for (n = 0; runs[n]; n++)
+	      {
+		run = grub_env_merge_sorted (runs[n], run);
+		runs[n] = 0;
+	      }
+	    runs[n] = run;
+	  }
+      }
+
+  for (n = 0; n < ARRAY_SIZE (runs); n++)
+    if (runs[n])
+      sorted_list = grub_env_merge_sorted (runs[n], sorted_list);
+
   return sorted_list;
 }
 
@@ -200,14 +541,22 @@ grub_register_variable_hook (const char *name,
 			     grub_env_read_hook_t read_hook,
 			     grub_env_write_hook_t write_hook)
 {
-  struct grub_env_var *var = grub_env_find (name);
+  int inherited;
+  struct grub_env_var *var = grub_env_find (name, &inherited);
 
-  if (! var)
+  if (var && inherited)
+    {
+      var = grub_env_copy (var);
+      if (! var)
+	return grub_errno;
+    }
+
+  if (! var || ! var->value)
     {
       if (grub_env_set (name, "") != GRUB_ERR_NONE)
 	return grub_errno;
 
-      var = grub_env_find (name);
+      var = grub_env_find (name, &inherited);
       /* XXX Insert an assertion?  */
     }
 
@@ -221,18 +570,22 @@ grub_err_t
 grub_env_export (const char *name)
 {
   struct grub_env_var *var;
+  int inherited;
 
-  var = grub_env_find (name);
-  if (! var)
+  var = grub_env_find (name, &inherited);
+  if (! var || ! var->value)
     {
       grub_err_t err;
       
       err = grub_env_set (name, "");
       if (err)
 	return err;
-      var = grub_env_find (name);
+      var = grub_env_find (name, &inherited);
     }    
-  var->global = 1;
+
+  /* Inherited variables are exported already.  */
+  if (! inherited)
+    var->global = 1;
 
   return GRUB_ERR_NONE;
 }
@@ -25,11 +25,13 @@
 #include <grub/fs.h>
 #include <grub/device.h>
 #include <grub/i18n.h>
+#include <grub/boottime.h>
 
 void (*EXPORT_VAR (grub_grubnet_fini)) (void);
 
 grub_file_filter_t grub_file_filters_all[GRUB_FILE_FILTER_MAX];
 grub_file_filter_t grub_file_filters_enabled[GRUB_FILE_FILTER_MAX];
+int grub_file_verify_deferred;
 
 /* Get the device part of the filename NAME. It is enclosed by parentheses.  */
 char *
@@ -58,8 +60,22 @@ grub_file_get_device_name (const char *name)
   return 0;
 }
 
-grub_file_t
-grub_file_open (const char *name)
+/* Read the first bytes of FILE once, for the filters to check their magic
+   in.  A failure is left for whoever reads the file next to report.  */
+static void
+read_head (grub_file_t file)
+{
+  grub_ssize_t len;
+
+  len = grub_file_read (file, file->head, sizeof (file->head));
+  if (len > 0)
+    file->head_len = len;
+  grub_errno = GRUB_ERR_NONE;
+  file->offset = 0;
+}
+
+static grub_file_t
+grub_file_open_real (const char *name)
 {
   grub_device_t device = 0;
   grub_file_t file = 0, last_file = 0;
@@ -89,6 +105,10 @@ grub_file_open (const char *name)
 
   file->device = device;
 
+  if (file_name[0] == '/' && grub_file_pinned_open
+      && grub_file_pinned_open (file, name))
+    goto opened;
+
   /* In case of relative pathnames and non-Unix systems (like Windows)
    * name of host files may not start with `/'. Blocklists for host files
    * are meaningless as well (for a start, host disk does not allow any direct
@@ -111,9 +131,18 @@ grub_file_open (const char *name)
   if ((file->fs->open) (file, file_name) != GRUB_ERR_NONE)
     goto fail;
 
+ opened:
   file->name = grub_strdup (name);
   grub_errno = GRUB_ERR_NONE;
 
+  for (filter = GRUB_FILE_FILTER_COMPRESSION_FIRST;
+       filter <= GRUB_FILE_FILTER_COMPRESSION_LAST; filter++)
+    if (grub_file_filters_enabled[filter])
+      {
+	read_head (file);
+	break;
+      }
+
   for (filter = 0; file && filter < ARRAY_SIZE (grub_file_filters_enabled);
        filter++)
     if (grub_file_filters_enabled[filter])
@@ -126,6 +155,7 @@ grub_file_open (const char *name)
     
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
+  grub_file_verify_deferred = 0;
 
   return file;
 
@@ -139,11 +169,28 @@ grub_file_open (const char *name)
 
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
+  grub_file_verify_deferred = 0;
 
   return 0;
 }
 
+grub_file_t
+grub_file_open (const char *name)
+{
+  grub_uint64_t start;
+  grub_file_t file;
+
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_FILE_OPEN);
+  file = grub_file_open_real (name);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_FILE_OPEN, start, NULL);
+
+  return file;
+}
+
 grub_disk_read_hook_t grub_file_progress_hook;
+void (*grub_file_progress_notify_hook) (grub_file_t file);
+
+int (*grub_file_pinned_open) (grub_file_t file, const char *name);
 
 grub_ssize_t
 grub_file_read (grub_file_t file, void *buf, grub_size_t len)
@@ -171,6 +218,23 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
 
   if (len == 0)
     return 0;
+
+  /* Callers with a read hook want to see the sectors, so they always go to
+     the device.  */
+  if (file->offset < file->head_len && !file->read_hook)
+    {
+      grub_size_t n = file->head_len - file->offset;
+
+      if (n > len)
+	n = len;
+      grub_memcpy (buf, file->head + file->offset, n);
+      file->offset += n;
+      if (n == len)
+	return n;
+      res = grub_file_read (file, (char *) buf + n, len - n);
+      return res < 0 ? res : res + (grub_ssize_t) n;
+    }
+
   read_hook = file->read_hook;
   read_hook_data = file->read_hook_data;
   if (!file->read_hook)
@@ -188,6 +252,24 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
   return res;
 }
 
+/* Hint that LEN bytes at OFFSET of FILE will be read soon, so that devices
+   able to do so can overlap fetching them with whatever the caller does
+   meanwhile.  This never fails and doesn't move the file offset.  */
+void
+grub_file_prefetch (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  if (! file->fs->prefetch || offset >= file->size)
+    return;
+
+  if (len > file->size - offset)
+    len = file->size - offset;
+
+  grub_error_push ();
+  (file->fs->prefetch) (file, offset, len);
+  grub_errno = GRUB_ERR_NONE;
+  grub_error_pop ();
+}
+
 grub_err_t
 grub_file_close (grub_file_t file)
 {
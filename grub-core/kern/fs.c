@@ -19,6 +19,7 @@
 
 #include <grub/disk.h>
 #include <grub/net.h>
+#include <grub/partition.h>
 #include <grub/fs.h>
 #include <grub/file.h>
 #include <grub/err.h>
@@ -32,6 +33,93 @@ grub_fs_t grub_fs_list = 0;
 
 grub_fs_autoload_hook_t grub_fs_autoload_hook = 0;
 
+/* Number of mounts kept by grub_fs_mount_cache_put.  */
+#define GRUB_FS_MOUNT_CACHE_NUM	4
+
+struct grub_fs_mount_cache
+{
+  grub_fs_t fs;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  unsigned long age;
+  /* NULL if the entry is unused.  */
+  void *data;
+  void (*free_data) (void *data);
+};
+
+static struct grub_fs_mount_cache grub_fs_mount_cache[GRUB_FS_MOUNT_CACHE_NUM];
+static unsigned long grub_fs_mount_cache_clock;
+
+void *
+grub_fs_mount_cache_get (grub_fs_t fs, grub_disk_t disk)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_NUM; i++)
+    {
+      struct grub_fs_mount_cache *m = &grub_fs_mount_cache[i];
+      void *data;
+
+      if (m->data && m->fs == fs && m->dev_id == disk->dev->id
+	  && m->disk_id == disk->id && m->part_start == part_start)
+	{
+	  data = m->data;
+	  m->data = NULL;
+	  return data;
+	}
+    }
+  return NULL;
+}
+
+void
+grub_fs_mount_cache_put (grub_fs_t fs, grub_disk_t disk, void *data,
+			 void (*free_data) (void *data))
+{
+  struct grub_fs_mount_cache *m = &grub_fs_mount_cache[0];
+  unsigned i;
+
+  /* Take a free entry, or else the one put least recently.  */
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_NUM; i++)
+    {
+      if (!grub_fs_mount_cache[i].data)
+	{
+	  m = &grub_fs_mount_cache[i];
+	  break;
+	}
+      if (grub_fs_mount_cache[i].age < m->age)
+	m = &grub_fs_mount_cache[i];
+    }
+  if (m->data)
+    m->free_data (m->data);
+
+  m->fs = fs;
+  m->dev_id = disk->dev->id;
+  m->disk_id = disk->id;
+  m->part_start = grub_partition_get_start (disk->partition);
+  m->age = ++grub_fs_mount_cache_clock;
+  m->data = data;
+  m->free_data = free_data;
+}
+
+void
+grub_fs_mount_cache_flush (grub_fs_t fs)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_NUM; i++)
+    {
+      struct grub_fs_mount_cache *m = &grub_fs_mount_cache[i];
+
+      if (m->data && (!fs || m->fs == fs))
+	{
+	  m->free_data (m->data);
+	  m->data = NULL;
+	}
+    }
+}
+
 /* Helper for grub_fs_probe.  */
 static int
 probe_dummy_iter (const char *filename __attribute__ ((unused)),
@@ -41,6 +129,35 @@ probe_dummy_iter (const char *filename __attribute__ ((unused)),
   return 1;
 }
 
+/* Most filesystems have their superblock in the first 64 KiB, btrfs and
+   reiserfs have theirs right after.  */
+#define GRUB_FS_PROBE_PREFETCH_SIZE	(68 << 10)
+
+/* Read the start of DISK into the disk cache in one go, rather than
+   letting every filesystem driver fetch its own few sectors of it.  */
+static void
+probe_prefetch (grub_disk_t disk)
+{
+  grub_size_t size = GRUB_FS_PROBE_PREFETCH_SIZE;
+  grub_uint64_t total = grub_disk_get_size (disk);
+  void *buf;
+
+  if (total != GRUB_DISK_SIZE_UNKNOWN
+      && total < (size >> GRUB_DISK_SECTOR_BITS))
+    size = total << GRUB_DISK_SECTOR_BITS;
+  if (size == 0)
+    return;
+
+  buf = grub_malloc (size);
+  if (buf)
+    {
+      grub_disk_read (disk, 0, 0, size, buf);
+      grub_free (buf);
+    }
+  /* The drivers report any real problem themselves.  */
+  grub_errno = GRUB_ERR_NONE;
+}
+
 grub_fs_t
 grub_fs_probe (grub_device_t device)
 {
@@ -51,6 +168,8 @@ grub_fs_probe (grub_device_t device)
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
 
+      probe_prefetch (device->disk);
+
       for (p = grub_fs_list; p; p = p->next)
 	{
 	  grub_dprintf ("fs", "Detecting %s...\n", p->name);
@@ -90,7 +209,7 @@ grub_fs_probe (grub_device_t device)
 	{
 	  count++;
 
-	  while (grub_fs_autoload_hook ())
+	  while (grub_fs_autoload_hook (device))
 	    {
 	      p = grub_fs_list;
 
@@ -240,12 +359,45 @@ grub_fs_blocklist_read (grub_file_t file, char *buf, grub_size_t len)
   return ret;
 }
 
+static void
+grub_fs_blocklist_prefetch (grub_file_t file, grub_off_t offset,
+			    grub_size_t len)
+{
+  struct grub_fs_block *p;
+  grub_disk_addr_t sector;
+
+  sector = (offset >> GRUB_DISK_SECTOR_BITS);
+  offset &= (GRUB_DISK_SECTOR_SIZE - 1);
+  for (p = file->data; p->length && len > 0; p++)
+    {
+      if (sector < p->length)
+	{
+	  grub_size_t size;
+
+	  size = len;
+	  if (((size + offset + GRUB_DISK_SECTOR_SIZE - 1)
+	       >> GRUB_DISK_SECTOR_BITS) > p->length - sector)
+	    size = ((p->length - sector) << GRUB_DISK_SECTOR_BITS) - offset;
+
+	  grub_disk_prefetch (file->device->disk, p->offset + sector, offset,
+			      size);
+
+	  len -= size;
+	  sector = 0;
+	  offset = 0;
+	}
+      else
+	sector -= p->length;
+    }
+}
+
 struct grub_fs grub_fs_blocklist =
   {
     .name = "blocklist",
     .dir = 0,
     .open = grub_fs_blocklist_open,
     .read = grub_fs_blocklist_read,
+    .prefetch = grub_fs_blocklist_prefetch,
     .close = 0,
     .next = 0
   };
@@ -33,16 +33,124 @@ static grub_uint64_t tsc_boot_time;
    in 32-bit.  */
 grub_uint32_t grub_tsc_rate;
 
+#ifndef GRUB_MACHINE_XEN
+/* RDTSCP waits for the preceding instructions like the CPUID in
+   grub_get_tsc does, but CPUID traps to the hypervisor in virtual machines
+   and costs microseconds there.  */
+static int have_rdtscp;
+#endif
+
+static grub_uint64_t
+read_tsc (void)
+{
+#ifndef GRUB_MACHINE_XEN
+  if (have_rdtscp)
+    {
+      grub_uint32_t lo, hi, aux;
+
+      __asm__ __volatile__ ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+      return (((grub_uint64_t) hi) << 32) | lo;
+    }
+#endif
+  return grub_get_tsc ();
+}
+
 static grub_uint64_t
 grub_tsc_get_time_ms (void)
 {
-  grub_uint64_t a = grub_get_tsc () - tsc_boot_time;
+  grub_uint64_t a = read_tsc () - tsc_boot_time;
   grub_uint64_t ah = a >> 32;
   grub_uint64_t al = a & 0xffffffff;
 
   return ((al * grub_tsc_rate) >> 32) + ah * grub_tsc_rate;
 }
 
+static grub_uint64_t
+grub_tsc_get_time_us (void)
+{
+  grub_uint64_t a = read_tsc () - tsc_boot_time;
+  grub_uint64_t ah = a >> 32;
+  grub_uint64_t al = a & 0xffffffff;
+  /* AL * rate is 2^32 times the time in ms; scale by 1000 in two halves
+     so that nothing overflows.  */
+  grub_uint64_t t = al * grub_tsc_rate;
+
+  return (t >> 32) * 1000 + (((t & 0xffffffff) * 1000) >> 32)
+    + ah * grub_tsc_rate * 1000;
+}
+
+static grub_uint64_t
+grub_tsc_get_time_ns (void)
+{
+  grub_uint64_t a = read_tsc () - tsc_boot_time;
+  grub_uint64_t ah = a >> 32;
+  grub_uint64_t al = a & 0xffffffff;
+  grub_uint64_t t = al * grub_tsc_rate;
+
+  return (t >> 32) * 1000000 + (((t & 0xffffffff) * 1000000) >> 32)
+    + ah * grub_tsc_rate * 1000000;
+}
+
+#ifndef GRUB_MACHINE_XEN
+/* Take the TSC frequency from CPUID when the processor or the hypervisor
+   reports it, which saves waiting on the PIT or the PM timer.  */
+static int
+calibrate_tsc_from_cpuid (void)
+{
+  grub_uint32_t max, a, b, c, d;
+  grub_uint64_t hz = 0;
+
+  grub_cpuid (1, a, b, c, d);
+  /* Hypervisors report the TSC frequency in kHz in leaf 0x40000010.  */
+  if (c & (1U << 31))
+    {
+      grub_cpuid (0x40000000, max, b, c, d);
+      if (max >= 0x40000010 && max < 0x40010000)
+	{
+	  grub_cpuid (0x40000010, a, b, c, d);
+	  hz = a * 1000ULL;
+	}
+    }
+
+  /* Intel processors report the crystal clock and the TSC/crystal ratio
+     in leaf 0x15, some leave the crystal clock out and only report the
+     nominal frequency, which the TSC runs at, in leaf 0x16.  */
+  grub_cpuid (0, max, b, c, d);
+  if (!hz && b == 0x756e6547 && d == 0x49656e69 && c == 0x6c65746e)
+    {
+      if (max >= 0x15)
+	{
+	  grub_cpuid (0x15, a, b, c, d);
+	  if (a && b && c)
+	    hz = grub_divmod64 ((grub_uint64_t) c * b, a, 0);
+	}
+      if (!hz && max >= 0x16)
+	{
+	  grub_cpuid (0x16, a, b, c, d);
+	  hz = (a & 0xffff) * 1000000ULL;
+	}
+    }
+
+  if (hz < 1000000 || hz > 100000000000ULL)
+    return 0;
+
+  grub_tsc_rate = grub_divmod64 (1000ULL << 32, hz, 0);
+  return 1;
+}
+
+static void
+check_rdtscp (void)
+{
+  grub_uint32_t max, a, b, c, d;
+
+  grub_cpuid (0x80000000, max, b, c, d);
+  if (max < 0x80000001 || max > 0x8000ffff)
+    return;
+  grub_cpuid (0x80000001, a, b, c, d);
+  have_rdtscp = (d & (1 << 27)) != 0;
+}
+#endif
+
 static int
 calibrate_tsc_hardcode (void)
 {
@@ -63,16 +171,21 @@ grub_tsc_init (void)
       return;
     }
 
-  tsc_boot_time = grub_get_tsc ();
+#ifndef GRUB_MACHINE_XEN
+  check_rdtscp ();
+#endif
+  tsc_boot_time = read_tsc ();
 
 #ifdef GRUB_MACHINE_XEN
   (void) (grub_tsc_calibrate_from_xen () || calibrate_tsc_hardcode());
 #elif defined (GRUB_MACHINE_EFI)
-  (void) (grub_tsc_calibrate_from_pit () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_efi() || calibrate_tsc_hardcode());
+  (void) (calibrate_tsc_from_cpuid () || grub_tsc_calibrate_from_pit () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_efi() || calibrate_tsc_hardcode());
 #elif defined (GRUB_MACHINE_COREBOOT)
-  (void) (grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
+  (void) (calibrate_tsc_from_cpuid () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #else
-  (void) (grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
+  (void) (calibrate_tsc_from_cpuid () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #endif
   grub_install_get_time_ms (grub_tsc_get_time_ms);
+  grub_install_get_time_us (grub_tsc_get_time_us);
+  grub_install_get_time_ns (grub_tsc_get_time_ns);
 }
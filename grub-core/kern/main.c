@@ -53,6 +53,19 @@ static void
 grub_load_modules (void)
 {
   struct grub_module_header *header;
+
+  /* Deferred modules go first so that the others can pull them in as
+     dependencies.  */
+  FOR_MODULES (header)
+  {
+    if (header->type != OBJ_TYPE_DEFERRED_ELF)
+      continue;
+
+    if (grub_dl_defer_core ((char *) header + sizeof (struct grub_module_header),
+			    (header->size - sizeof (struct grub_module_header))))
+      grub_print_error ();
+  }
+
   FOR_MODULES (header)
   {
     /* Not an ELF module, skip.  */
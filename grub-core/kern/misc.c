@@ -74,23 +74,106 @@ grub_gettext_dummy (const char *s)
 
 const char* (*grub_gettext) (const char *s) = grub_gettext_dummy;
 
+/* clang detects that we're implementing here a memset so it decides to
+   optimise and calls memset resulting in infinite recursion. With volatile
+   we make it not optimise in this way.  */
+#ifdef __clang__
+#define VOLATILE_CLANG volatile
+#else
+#define VOLATILE_CLANG
+#endif
+
+/* The string functions below work a word at a time when both pointers
+   have the same alignment within a word.  Words are read and written
+   through a may_alias type, since the buffers hold objects of any type.  */
+typedef unsigned long __attribute__ ((__may_alias__)) word_t;
+#define WORD_SIZE	sizeof (word_t)
+#define WORD_MASK	(WORD_SIZE - 1)
+#define SAME_ALIGNMENT(a, b) \
+  ((((grub_addr_t) (a) ^ (grub_addr_t) (b)) & WORD_MASK) == 0)
+/* Non-zero if a word has a zero byte.  */
+#define WORD_ONES	((unsigned long) -1 / 0xff)
+#define WORD_HAS_ZERO(w) (((w) - WORD_ONES) & ~(w) & (WORD_ONES << 7))
+
+#if defined (__i386__) || defined (__x86_64__)
+/* The string instructions are the fastest way to copy without SSE, and
+   they don't care about alignment.  */
+static inline void
+copy_forward (char *d, const char *s, grub_size_t n)
+{
+  grub_size_t words = n / sizeof (grub_addr_t);
+
+  n &= sizeof (grub_addr_t) - 1;
+#ifdef __x86_64__
+  asm volatile ("rep movsq" : "+D" (d), "+S" (s), "+c" (words) : : "memory");
+#else
+  asm volatile ("rep movsl" : "+D" (d), "+S" (s), "+c" (words) : : "memory");
+#endif
+  asm volatile ("rep movsb" : "+D" (d), "+S" (s), "+c" (n) : : "memory");
+}
+#else
+static inline void
+copy_forward (char *d, const char *s, grub_size_t n)
+{
+  if (n >= 2 * WORD_SIZE && SAME_ALIGNMENT (d, s))
+    {
+      while ((grub_addr_t) d & WORD_MASK)
+	{
+	  *(VOLATILE_CLANG char *) d++ = *s++;
+	  n--;
+	}
+      while (n >= WORD_SIZE)
+	{
+	  *(VOLATILE_CLANG word_t *) d = *(const word_t *) s;
+	  d += WORD_SIZE;
+	  s += WORD_SIZE;
+	  n -= WORD_SIZE;
+	}
+    }
+  while (n--)
+    *(VOLATILE_CLANG char *) d++ = *s++;
+}
+#endif
+
+/* D and S point to the end of the areas.  */
+static inline void
+copy_backward (char *d, const char *s, grub_size_t n)
+{
+  if (n >= 2 * WORD_SIZE && SAME_ALIGNMENT (d, s))
+    {
+      while ((grub_addr_t) d & WORD_MASK)
+	{
+	  *(VOLATILE_CLANG char *) --d = *--s;
+	  n--;
+	}
+      while (n >= WORD_SIZE)
+	{
+	  d -= WORD_SIZE;
+	  s -= WORD_SIZE;
+	  n -= WORD_SIZE;
+	  *(VOLATILE_CLANG word_t *) d = *(const word_t *) s;
+	}
+    }
+  while (n--)
+    *(VOLATILE_CLANG char *) --d = *--s;
+}
+
 void *
 grub_memmove (void *dest, const void *src, grub_size_t n)
 {
   char *d = (char *) dest;
   const char *s = (const char *) src;
 
-  if (d < s)
-    while (n--)
-      *d++ = *s++;
-  else
-    {
-      d += n;
-      s += n;
+  if (d == s || n == 0)
+    return dest;
 
-      while (n--)
-	*--d = *--s;
-    }
+  /* Copying forward is fine when the destination is below the source,
+     even when they overlap.  */
+  if ((grub_addr_t) d < (grub_addr_t) s
+      || (grub_addr_t) d - (grub_addr_t) s >= n)
+    copy_forward (d, s, n);
+  else
+    copy_backward (d + n, s + n, n);
 
   return dest;
 }
@@ -223,6 +306,26 @@ grub_memcmp (const void *s1, const void *s2, grub_size_t n)
   const grub_uint8_t *t1 = s1;
   const grub_uint8_t *t2 = s2;
 
+  if (n >= 2 * WORD_SIZE && SAME_ALIGNMENT (t1, t2))
+    {
+      while ((grub_addr_t) t1 & WORD_MASK)
+	{
+	  if (*t1 != *t2)
+	    return (int) *t1 - (int) *t2;
+	  t1++;
+	  t2++;
+	  n--;
+	}
+      /* The bytes of the first differing word are compared below.  */
+      while (n >= WORD_SIZE
+	     && *(const word_t *) t1 == *(const word_t *) t2)
+	{
+	  t1 += WORD_SIZE;
+	  t2 += WORD_SIZE;
+	  n -= WORD_SIZE;
+	}
+    }
+
   while (n--)
     {
       if (*t1 != *t2)
@@ -238,6 +341,28 @@ grub_memcmp (const void *s1, const void *s2, grub_size_t n)
 int
 grub_strcmp (const char *s1, const char *s2)
 {
+  if (SAME_ALIGNMENT (s1, s2))
+    {
+      while ((grub_addr_t) s1 & WORD_MASK)
+	{
+	  if (!*s1 || *s1 != *s2)
+	    goto out;
+	  s1++;
+	  s2++;
+	}
+      /* An aligned word never crosses a page boundary, so reading past the
+	 terminator is harmless.  */
+      while (1)
+	{
+	  word_t w = *(const word_t *) s1;
+
+	  if (w != *(const word_t *) s2 || WORD_HAS_ZERO (w))
+	    break;
+	  s1 += WORD_SIZE;
+	  s2 += WORD_SIZE;
+	}
+    }
+
   while (*s1 && *s2)
     {
       if (*s1 != *s2)
@@ -247,6 +372,7 @@ grub_strcmp (const char *s1, const char *s2)
       s2++;
     }
 
+ out:
   return (int) (grub_uint8_t) *s1 - (int) (grub_uint8_t) *s2;
 }
 
@@ -457,15 +583,6 @@ grub_strndup (const char *s, grub_size_t n)
   return p;
 }
 
-/* clang detects that we're implementing here a memset so it decides to
-   optimise and calls memset resulting in infinite recursion. With volatile
-   we make it not optimise in this way.  */
-#ifdef __clang__
-#define VOLATILE_CLANG volatile
-#else
-#define VOLATILE_CLANG
-#endif
-
 void *
 grub_memset (void *s, int c, grub_size_t len)
 {
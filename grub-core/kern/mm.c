@@ -53,6 +53,13 @@
   a typical optimization against defragmentation, and makes the
   implementation a bit easier.
 
+  Small blocks are not given back to their region right away. Instead
+  they are kept in bins, one LIFO list per block size in cells, and
+  handed out again in constant time by the next allocation of the same
+  size. From the region's point of view a binned block is still
+  allocated. The bins are flushed back into the regions when an
+  allocation fails, so that the memory gets a chance to be coalesced.
+
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
@@ -79,6 +86,52 @@
 
 
 grub_mm_region_t grub_mm_base;
+grub_mm_add_region_func_t grub_mm_add_region_fn;
+
+/* Free blocks of a few cells, indexed by their size in cells.  */
+static grub_mm_header_t grub_mm_bins[GRUB_MM_BIN_MAX + 1];
+
+/* Allocation counters, see grub_mm_get_stats.  */
+static struct grub_mm_stats grub_mm_stats;
+
+static unsigned
+stats_class (grub_size_t cells)
+{
+  unsigned c = 0;
+
+  while (cells >>= 1)
+    c++;
+  if (c >= GRUB_MM_STATS_CLASSES)
+    c = GRUB_MM_STATS_CLASSES - 1;
+  return c;
+}
+
+static void
+stats_alloc (grub_mm_header_t p)
+{
+  unsigned c = stats_class (p->size);
+
+  grub_mm_stats.allocs++;
+  grub_mm_stats.in_use_blocks++;
+  grub_mm_stats.in_use += p->size << GRUB_MM_ALIGN_LOG2;
+  if (grub_mm_stats.in_use > grub_mm_stats.peak)
+    grub_mm_stats.peak = grub_mm_stats.in_use;
+  grub_mm_stats.classes[c].allocs++;
+  grub_mm_stats.classes[c].blocks++;
+  grub_mm_stats.classes[c].bytes += p->size << GRUB_MM_ALIGN_LOG2;
+}
+
+static void
+stats_free (grub_mm_header_t p)
+{
+  unsigned c = stats_class (p->size);
+
+  grub_mm_stats.frees++;
+  grub_mm_stats.in_use_blocks--;
+  grub_mm_stats.in_use -= p->size << GRUB_MM_ALIGN_LOG2;
+  grub_mm_stats.classes[c].blocks--;
+  grub_mm_stats.classes[c].bytes -= p->size << GRUB_MM_ALIGN_LOG2;
+}
 
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
@@ -98,13 +151,16 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
     grub_fatal ("out of range pointer %p", ptr);
 
   *p = (grub_mm_header_t) ptr - 1;
-  if ((*p)->magic == GRUB_MM_FREE_MAGIC)
+  if ((*p)->magic == GRUB_MM_FREE_MAGIC
+      || (*p)->magic == GRUB_MM_BINNED_MAGIC)
     grub_fatal ("double free at %p", *p);
   if ((*p)->magic != GRUB_MM_ALLOC_MAGIC)
     grub_fatal ("alloc magic is broken at %p: %lx", *p,
 		(unsigned long) (*p)->magic);
 }
 
+static void grub_mm_release (grub_mm_header_t p, grub_mm_region_t r);
+
 /* Initialize a region starting from ADDR and whose size is SIZE,
    to use it as free space.  */
 void
@@ -141,7 +197,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    r->size += h->size << GRUB_MM_ALIGN_LOG2;
 	    r->pre_size &= (GRUB_MM_ALIGN - 1);
 	    *p = r;
-	    grub_free (h + 1);
+	    grub_mm_release (h, r);
 	  }
 	*p = r;
 	return;
@@ -338,6 +394,18 @@ grub_memalign (grub_size_t align, grub_size_t size)
   if (align == 0)
     align = 1;
 
+  if (align == 1 && n <= GRUB_MM_BIN_MAX && grub_mm_bins[n])
+    {
+      grub_mm_header_t p = grub_mm_bins[n];
+
+      if (p->magic != GRUB_MM_BINNED_MAGIC)
+	grub_fatal ("bin magic is broken at %p: 0x%x", p, p->magic);
+      grub_mm_bins[n] = p->next;
+      p->magic = GRUB_MM_ALLOC_MAGIC;
+      stats_alloc (p);
+      return p + 1;
+    }
+
  again:
 
   for (r = grub_mm_base; r; r = r->next)
@@ -346,20 +414,34 @@ grub_memalign (grub_size_t align, grub_size_t size)
 
       p = grub_real_malloc (&(r->first), n, align);
       if (p)
-	return p;
+	{
+	  stats_alloc ((grub_mm_header_t) p - 1);
+	  return p;
+	}
     }
 
   /* If failed, increase free memory somehow.  */
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
+      /* Give binned blocks back and invalidate disk caches.  */
+      grub_mm_flush_bins ();
       grub_disk_cache_invalidate_all ();
       count++;
       goto again;
 
-#if 0
     case 1:
+      /* Ask the platform for more memory, enough for the block with its
+	 alignment slack.  */
+      count++;
+      if (grub_mm_add_region_fn
+	  && grub_mm_add_region_fn ((n + align) << GRUB_MM_ALIGN_LOG2)
+	     == GRUB_ERR_NONE)
+	goto again;
+      /* FALLTHROUGH */
+
+#if 0
+    case 2:
       /* Unload unneeded modules.  */
       grub_dl_unload_unneeded ();
       count++;
@@ -395,18 +477,10 @@ grub_zalloc (grub_size_t size)
   return ret;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+/* Return the allocated block P to the free ring of its region R.  */
+static void
+grub_mm_release (grub_mm_header_t p, grub_mm_region_t r)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
-
-  if (! ptr)
-    return;
-
-  get_header_from_pointer (ptr, &p, &r);
-
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
@@ -465,6 +539,97 @@ grub_free (void *ptr)
     }
 }
 
+/* Give all binned blocks back to their regions.  */
+void
+grub_mm_flush_bins (void)
+{
+  grub_size_t n;
+
+  for (n = 0; n <= GRUB_MM_BIN_MAX; n++)
+    while (grub_mm_bins[n])
+      {
+	grub_mm_header_t p;
+	grub_mm_region_t r;
+
+	p = grub_mm_bins[n];
+	if (p->magic != GRUB_MM_BINNED_MAGIC)
+	  grub_fatal ("bin magic is broken at %p: 0x%x", p, p->magic);
+	grub_mm_bins[n] = p->next;
+	p->magic = GRUB_MM_ALLOC_MAGIC;
+	get_header_from_pointer (p + 1, &p, &r);
+	grub_mm_release (p, r);
+      }
+}
+
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
+  if (! ptr)
+    return;
+
+  get_header_from_pointer (ptr, &p, &r);
+  stats_free (p);
+
+  if (p->size <= GRUB_MM_BIN_MAX)
+    {
+      p->magic = GRUB_MM_BINNED_MAGIC;
+      p->next = grub_mm_bins[p->size];
+      grub_mm_bins[p->size] = p;
+      return;
+    }
+
+  grub_mm_release (p, r);
+}
+
+/* Fill STATS with the allocation counters and the current layout of
+   the free space.  */
+void
+grub_mm_get_stats (struct grub_mm_stats *stats)
+{
+  grub_mm_region_t r;
+  grub_size_t n;
+  unsigned c;
+
+  *stats = grub_mm_stats;
+  for (c = 0; c < GRUB_MM_STATS_CLASSES; c++)
+    stats->classes[c].min_size = (grub_size_t) 1 << (c + GRUB_MM_ALIGN_LOG2);
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p;
+
+      stats->regions++;
+      stats->total += r->size;
+
+      p = r->first;
+      if (p->magic == GRUB_MM_ALLOC_MAGIC)
+	continue;
+      do
+	{
+	  if (p->magic != GRUB_MM_FREE_MAGIC)
+	    grub_fatal ("free magic is broken at %p: 0x%x", p, p->magic);
+	  stats->free_blocks++;
+	  stats->free += p->size << GRUB_MM_ALIGN_LOG2;
+	  if ((p->size << GRUB_MM_ALIGN_LOG2) > stats->largest_free)
+	    stats->largest_free = p->size << GRUB_MM_ALIGN_LOG2;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  for (n = 0; n <= GRUB_MM_BIN_MAX; n++)
+    {
+      grub_mm_header_t p;
+
+      for (p = grub_mm_bins[n]; p; p = p->next)
+	stats->binned += n << GRUB_MM_ALIGN_LOG2;
+    }
+}
+
 /* Reallocate SIZE bytes and return the pointer. The contents will be
    the same as that of PTR.  */
 void *
@@ -554,6 +719,9 @@ grub_mm_dump (unsigned lineno)
 	    case GRUB_MM_ALLOC_MAGIC:
 	      grub_printf ("A:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
 	      break;
+	    case GRUB_MM_BINNED_MAGIC:
+	      grub_printf ("B:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
+	      break;
 	    }
 	}
     }
@@ -59,6 +59,162 @@ grub_partition_check_containment (const grub_disk_t disk,
   return 1;
 }
 
+/* Parsed partition tables.  Every probe of a partition and every pass of
+   grub_partition_iterate would otherwise parse all the tables on the disk
+   again, which "search" does for each disk.  Entries are only valid for the
+   grub_disk_cache_generation they were made with, like the disk cache.  */
+#define PART_CACHE_SIZE 32
+
+struct part_cache_entry
+{
+  const struct grub_partition_map *partmap;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  /* Where the table was looked for: the parent partition.  */
+  grub_disk_addr_t start;
+  grub_uint64_t len;
+  /* GRUB_ERR_NONE or GRUB_ERR_BAD_PART_TABLE and its message.  */
+  grub_err_t err;
+  char *errmsg;
+  struct grub_partition *parts;
+  int nparts;
+};
+
+static struct part_cache_entry part_cache[PART_CACHE_SIZE];
+static unsigned part_cache_next;
+static unsigned long part_cache_generation;
+
+static void
+part_cache_free (struct part_cache_entry *e)
+{
+  grub_free (e->parts);
+  grub_free (e->errmsg);
+  grub_memset (e, 0, sizeof (*e));
+}
+
+static struct part_cache_entry *
+part_cache_find (const struct grub_partition_map *partmap, grub_disk_t disk)
+{
+  grub_disk_addr_t start = grub_partition_get_start (disk->partition);
+  grub_uint64_t len = disk->partition ? disk->partition->len : 0;
+  unsigned i;
+
+  if (part_cache_generation != grub_disk_cache_generation)
+    {
+      for (i = 0; i < PART_CACHE_SIZE; i++)
+	part_cache_free (&part_cache[i]);
+      part_cache_generation = grub_disk_cache_generation;
+      return NULL;
+    }
+
+  for (i = 0; i < PART_CACHE_SIZE; i++)
+    if (part_cache[i].partmap == partmap
+	&& part_cache[i].dev_id == disk->dev->id
+	&& part_cache[i].disk_id == disk->id
+	&& part_cache[i].start == start && part_cache[i].len == len)
+      return &part_cache[i];
+  return NULL;
+}
+
+/* Context for partmap_iterate.  */
+struct part_cache_collect_ctx
+{
+  struct grub_partition *parts;
+  int nparts;
+  int alloc;
+};
+
+/* Helper for partmap_iterate.  */
+static int
+part_cache_collect (grub_disk_t disk __attribute__ ((unused)),
+		    const grub_partition_t partition, void *data)
+{
+  struct part_cache_collect_ctx *ctx = data;
+
+  if (ctx->nparts == ctx->alloc)
+    {
+      struct grub_partition *n;
+
+      ctx->alloc = ctx->alloc ? 2 * ctx->alloc : 8;
+      n = grub_realloc (ctx->parts, ctx->alloc * sizeof (ctx->parts[0]));
+      if (!n)
+	return 1;
+      ctx->parts = n;
+    }
+  ctx->parts[ctx->nparts++] = *partition;
+  return 0;
+}
+
+/* Call PARTMAP->iterate (DISK, HOOK, HOOK_DATA), answering from the cache
+   when the table was parsed before.  */
+static grub_err_t
+partmap_iterate (const struct grub_partition_map *partmap, grub_disk_t disk,
+		 grub_partition_iterate_hook_t hook, void *hook_data)
+{
+  struct part_cache_collect_ctx ctx = { 0 };
+  struct part_cache_entry *e;
+  struct grub_partition *parts;
+  char errmsg[GRUB_MAX_ERRMSG] = "";
+  grub_err_t err;
+  int nparts, i;
+
+  e = part_cache_find (partmap, disk);
+  if (!e)
+    {
+      err = partmap->iterate (disk, part_cache_collect, &ctx);
+      /* Read errors may be gone next time, and a partial list is no use.  */
+      if (err != GRUB_ERR_NONE && err != GRUB_ERR_BAD_PART_TABLE)
+	{
+	  grub_free (ctx.parts);
+	  grub_errno = GRUB_ERR_NONE;
+	  return partmap->iterate (disk, hook, hook_data);
+	}
+
+      e = &part_cache[part_cache_next];
+      part_cache_next = (part_cache_next + 1) % PART_CACHE_SIZE;
+      part_cache_free (e);
+      e->partmap = partmap;
+      e->dev_id = disk->dev->id;
+      e->disk_id = disk->id;
+      e->start = grub_partition_get_start (disk->partition);
+      e->len = disk->partition ? disk->partition->len : 0;
+      e->err = err;
+      e->parts = ctx.parts;
+      e->nparts = ctx.nparts;
+      if (err)
+	{
+	  e->errmsg = grub_strdup (grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
+  /* The hook may open other disks and parse other tables, so E can't be
+     relied on while it runs.  */
+  nparts = e->nparts;
+  parts = grub_malloc (nparts * sizeof (parts[0]) + 1);
+  if (!parts)
+    return grub_errno;
+  grub_memcpy (parts, e->parts, nparts * sizeof (parts[0]));
+  err = e->err;
+  if (err)
+    grub_strncpy (errmsg, e->errmsg ? : "", sizeof (errmsg) - 1);
+
+  for (i = 0; i < nparts; i++)
+    {
+      parts[i].parent = disk->partition;
+      if (hook (disk, &parts[i], hook_data))
+	{
+	  grub_free (parts);
+	  return grub_errno;
+	}
+    }
+  grub_free (parts);
+
+  if (err)
+    return grub_error (err, "%s", errmsg);
+  return GRUB_ERR_NONE;
+}
+
 /* Context for grub_partition_map_probe.  */
 struct grub_partition_map_probe_ctx
 {
@@ -95,7 +251,7 @@ grub_partition_map_probe (const grub_partition_map_t partmap,
     .p = 0
   };
 
-  partmap->iterate (disk, probe_iter, &ctx);
+  partmap_iterate (partmap, disk, probe_iter, &ctx);
   if (grub_errno)
     goto fail;
 
@@ -205,7 +361,7 @@ part_iterate (grub_disk_t dsk, const grub_partition_t partition, void *data)
       FOR_PARTITION_MAPS(partmap)
       {
 	grub_err_t err;
-	err = partmap->iterate (dsk, part_iterate, ctx);
+	err = partmap_iterate (partmap, dsk, part_iterate, ctx);
 	if (err)
 	  grub_errno = GRUB_ERR_NONE;
 	if (ctx->ret)
@@ -230,7 +386,7 @@ grub_partition_iterate (struct grub_disk *disk,
   FOR_PARTITION_MAPS(partmap)
   {
     grub_err_t err;
-    err = partmap->iterate (disk, part_iterate, &ctx);
+    err = partmap_iterate (partmap, disk, part_iterate, &ctx);
     if (err)
       grub_errno = GRUB_ERR_NONE;
     if (ctx.ret)
@@ -23,6 +23,8 @@ typedef grub_uint64_t (*get_time_ms_func_t) (void);
 
 /* Function pointer to the implementation in use.  */
 static get_time_ms_func_t get_time_ms_func;
+static get_time_ms_func_t get_time_us_func;
+static get_time_ms_func_t get_time_ns_func;
 
 grub_uint64_t
 grub_get_time_ms (void)
@@ -30,8 +32,38 @@ grub_get_time_ms (void)
   return get_time_ms_func ();
 }
 
+grub_uint64_t
+grub_get_time_us (void)
+{
+  if (get_time_us_func)
+    return get_time_us_func ();
+  if (get_time_ms_func)
+    return get_time_ms_func () * 1000;
+  return 0;
+}
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+  if (get_time_ns_func)
+    return get_time_ns_func ();
+  return grub_get_time_us () * 1000;
+}
+
 void
 grub_install_get_time_ms (get_time_ms_func_t func)
 {
   get_time_ms_func = func;
 }
+
+void
+grub_install_get_time_us (get_time_ms_func_t func)
+{
+  get_time_us_func = func;
+}
+
+void
+grub_install_get_time_ns (get_time_ms_func_t func)
+{
+  get_time_ns_func = func;
+}
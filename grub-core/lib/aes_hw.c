@@ -0,0 +1,242 @@
+/* aes_hw.c - AES using the instructions of the CPU.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/crypto.h>
+#include <grub/aes_hw.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+struct aes_hw_context
+{
+  /* The round keys.  */
+  grub_uint8_t rk[15][16];
+  /* The round keys of the equivalent inverse cipher: the same in reverse
+     order, with InvMixColumns applied to all but the first and the
+     last.  */
+  grub_uint8_t drk[15][16];
+  unsigned rounds;
+};
+
+static grub_uint8_t sbox[256];
+
+static grub_uint8_t
+xtime (grub_uint8_t x)
+{
+  return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static grub_uint8_t
+rotl8 (grub_uint8_t x, int n)
+{
+  return (grub_uint8_t) ((x << n) | (x >> (8 - n)));
+}
+
+/* Fill the S-box, going through all elements as powers of 3 and getting
+   their inverses from the matching powers of 3^-1.  */
+static void
+init_sbox (void)
+{
+  grub_uint8_t p = 1, q = 1;
+
+  do
+    {
+      p ^= xtime (p);
+      q ^= q << 1;
+      q ^= q << 2;
+      q ^= q << 4;
+      if (q & 0x80)
+	q ^= 0x09;
+      sbox[p] = 0x63 ^ q ^ rotl8 (q, 1) ^ rotl8 (q, 2) ^ rotl8 (q, 3)
+	^ rotl8 (q, 4);
+    }
+  while (p != 1);
+  sbox[0] = 0x63;
+}
+
+static grub_uint8_t
+gmul (grub_uint8_t a, grub_uint8_t b)
+{
+  grub_uint8_t r = 0;
+
+  for (; b; b >>= 1, a = xtime (a))
+    if (b & 1)
+      r ^= a;
+  return r;
+}
+
+static void
+inv_mix_columns (grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned i;
+
+  for (i = 0; i < 16; i += 4)
+    {
+      const grub_uint8_t *a = in + i;
+
+      out[i] = gmul (a[0], 14) ^ gmul (a[1], 11) ^ gmul (a[2], 13)
+	^ gmul (a[3], 9);
+      out[i + 1] = gmul (a[0], 9) ^ gmul (a[1], 14) ^ gmul (a[2], 11)
+	^ gmul (a[3], 13);
+      out[i + 2] = gmul (a[0], 13) ^ gmul (a[1], 9) ^ gmul (a[2], 14)
+	^ gmul (a[3], 11);
+      out[i + 3] = gmul (a[0], 11) ^ gmul (a[1], 13) ^ gmul (a[2], 9)
+	^ gmul (a[3], 14);
+    }
+}
+
+static gcry_err_code_t
+aes_hw_setkey (void *c, const unsigned char *key, unsigned keylen)
+{
+  struct aes_hw_context *ctx = c;
+  grub_uint8_t *w = ctx->rk[0];
+  grub_uint8_t t[4], t0, rcon = 1;
+  unsigned nk = keylen / 4, i, j;
+
+  if (keylen != 16 && keylen != 24 && keylen != 32)
+    return GPG_ERR_INV_KEYLEN;
+
+  ctx->rounds = nk + 6;
+  grub_memcpy (w, key, keylen);
+  for (i = nk; i < 4 * (ctx->rounds + 1); i++)
+    {
+      grub_memcpy (t, w + 4 * (i - 1), 4);
+      if (i % nk == 0)
+	{
+	  t0 = t[0];
+	  t[0] = sbox[t[1]] ^ rcon;
+	  t[1] = sbox[t[2]];
+	  t[2] = sbox[t[3]];
+	  t[3] = sbox[t0];
+	  rcon = xtime (rcon);
+	}
+      else if (nk == 8 && i % nk == 4)
+	for (j = 0; j < 4; j++)
+	  t[j] = sbox[t[j]];
+      for (j = 0; j < 4; j++)
+	w[4 * i + j] = w[4 * (i - nk) + j] ^ t[j];
+    }
+
+  grub_memcpy (ctx->drk[0], ctx->rk[ctx->rounds], 16);
+  for (i = 1; i < ctx->rounds; i++)
+    inv_mix_columns (ctx->drk[i], ctx->rk[ctx->rounds - i]);
+  grub_memcpy (ctx->drk[ctx->rounds], ctx->rk[0], 16);
+
+  return GPG_ERR_NO_ERROR;
+}
+
+static void
+aes_hw_encrypt (void *c, unsigned char *outbuf, const unsigned char *inbuf)
+{
+  struct aes_hw_context *ctx = c;
+
+  grub_aes_hw_encrypt (ctx->rk[0], ctx->rounds, outbuf, inbuf);
+}
+
+static void
+aes_hw_decrypt (void *c, unsigned char *outbuf, const unsigned char *inbuf)
+{
+  struct aes_hw_context *ctx = c;
+
+  grub_aes_hw_decrypt (ctx->drk[0], ctx->rounds, outbuf, inbuf);
+}
+
+static void
+aes_hw_encrypt_blocks (void *c, unsigned char *outbuf,
+		       const unsigned char *inbuf, grub_size_t n)
+{
+  struct aes_hw_context *ctx = c;
+
+  for (; n >= 4; n -= 4, outbuf += 64, inbuf += 64)
+    grub_aes_hw_encrypt4 (ctx->rk[0], ctx->rounds, outbuf, inbuf);
+  for (; n; n--, outbuf += 16, inbuf += 16)
+    grub_aes_hw_encrypt (ctx->rk[0], ctx->rounds, outbuf, inbuf);
+}
+
+static void
+aes_hw_decrypt_blocks (void *c, unsigned char *outbuf,
+		       const unsigned char *inbuf, grub_size_t n)
+{
+  struct aes_hw_context *ctx = c;
+
+  for (; n >= 4; n -= 4, outbuf += 64, inbuf += 64)
+    grub_aes_hw_decrypt4 (ctx->drk[0], ctx->rounds, outbuf, inbuf);
+  for (; n; n--, outbuf += 16, inbuf += 16)
+    grub_aes_hw_decrypt (ctx->drk[0], ctx->rounds, outbuf, inbuf);
+}
+
+/* The portable implementation, whose names and OIDs are shared.  Using
+   them also makes this module depend on gcry_rijndael, so that it is always
+   registered after it and found first.  _gcry_cipher_spec_aes is declared
+   in grub/crypto.h.  */
+extern gcry_cipher_spec_t _gcry_cipher_spec_aes192;
+extern gcry_cipher_spec_t _gcry_cipher_spec_aes256;
+
+#define AES_HW_SPEC(n, bits)					\
+  {								\
+    .name = n,							\
+    .blocksize = 16,						\
+    .keylen = bits,						\
+    .contextsize = sizeof (struct aes_hw_context),		\
+    .setkey = aes_hw_setkey,					\
+    .encrypt = aes_hw_encrypt,					\
+    .decrypt = aes_hw_decrypt,					\
+    .encrypt_blocks = aes_hw_encrypt_blocks,			\
+    .decrypt_blocks = aes_hw_decrypt_blocks			\
+  }
+
+static gcry_cipher_spec_t aes_hw_specs[] =
+  {
+    AES_HW_SPEC ("AES", 128),
+    AES_HW_SPEC ("AES192", 192),
+    AES_HW_SPEC ("AES256", 256)
+  };
+
+GRUB_MOD_INIT(aes_hw)
+{
+  const gcry_cipher_spec_t *soft[ARRAY_SIZE (aes_hw_specs)] =
+    {
+      &_gcry_cipher_spec_aes,
+      &_gcry_cipher_spec_aes192,
+      &_gcry_cipher_spec_aes256
+    };
+  unsigned i;
+
+  /* Without the instructions, leave AES to gcry_rijndael.  */
+  if (! grub_aes_hw_supported ())
+    return;
+
+  init_sbox ();
+  for (i = 0; i < ARRAY_SIZE (aes_hw_specs); i++)
+    {
+      aes_hw_specs[i].aliases = soft[i]->aliases;
+      aes_hw_specs[i].oids = soft[i]->oids;
+      grub_cipher_register (&aes_hw_specs[i]);
+    }
+}
+
+GRUB_MOD_FINI(aes_hw)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (aes_hw_specs); i++)
+    grub_cipher_unregister (&aes_hw_specs[i]);
+}
@@ -0,0 +1,169 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/aes_hw.h>
+
+int
+grub_aes_hw_supported (void)
+{
+  grub_uint64_t isar0;
+
+  /* The AES field of ID_AA64ISAR0_EL1.  */
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  return ((isar0 >> 4) & 0xf) != 0;
+}
+
+/* GRUB is compiled for the general registers only, so the compiler keeps
+   nothing in the SIMD registers, nor accepts them as clobbers.  Only V0 to
+   V5, which no calling convention preserves, are used, and they are cleared
+   so that no key material is left behind.  */
+
+void
+grub_aes_hw_encrypt (const grub_uint8_t *rk, unsigned rounds,
+		     grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile (".arch armv8-a+crypto\n\t"
+		"ld1 {v0.16b}, [%[in]]\n"
+		"1:\n\t"
+		"ld1 {v1.16b}, [%[rk]], #16\n\t"
+		"aese v0.16b, v1.16b\n\t"
+		"aesmc v0.16b, v0.16b\n\t"
+		"subs %w[n], %w[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"ld1 {v1.16b, v2.16b}, [%[rk]]\n\t"
+		"aese v0.16b, v1.16b\n\t"
+		"eor v0.16b, v0.16b, v2.16b\n\t"
+		"st1 {v0.16b}, [%[out]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_decrypt (const grub_uint8_t *rk, unsigned rounds,
+		     grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile (".arch armv8-a+crypto\n\t"
+		"ld1 {v0.16b}, [%[in]]\n"
+		"1:\n\t"
+		"ld1 {v1.16b}, [%[rk]], #16\n\t"
+		"aesd v0.16b, v1.16b\n\t"
+		"aesimc v0.16b, v0.16b\n\t"
+		"subs %w[n], %w[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"ld1 {v1.16b, v2.16b}, [%[rk]]\n\t"
+		"aesd v0.16b, v1.16b\n\t"
+		"eor v0.16b, v0.16b, v2.16b\n\t"
+		"st1 {v0.16b}, [%[out]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_encrypt4 (const grub_uint8_t *rk, unsigned rounds,
+		      grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile (".arch armv8-a+crypto\n\t"
+		"ld1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[in]]\n"
+		"1:\n\t"
+		"ld1 {v4.16b}, [%[rk]], #16\n\t"
+		"aese v0.16b, v4.16b\n\t"
+		"aesmc v0.16b, v0.16b\n\t"
+		"aese v1.16b, v4.16b\n\t"
+		"aesmc v1.16b, v1.16b\n\t"
+		"aese v2.16b, v4.16b\n\t"
+		"aesmc v2.16b, v2.16b\n\t"
+		"aese v3.16b, v4.16b\n\t"
+		"aesmc v3.16b, v3.16b\n\t"
+		"subs %w[n], %w[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"ld1 {v4.16b, v5.16b}, [%[rk]]\n\t"
+		"aese v0.16b, v4.16b\n\t"
+		"aese v1.16b, v4.16b\n\t"
+		"aese v2.16b, v4.16b\n\t"
+		"aese v3.16b, v4.16b\n\t"
+		"eor v0.16b, v0.16b, v5.16b\n\t"
+		"eor v1.16b, v1.16b, v5.16b\n\t"
+		"eor v2.16b, v2.16b, v5.16b\n\t"
+		"eor v3.16b, v3.16b, v5.16b\n\t"
+		"st1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[out]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v4.16b, #0\n\t"
+		"movi v5.16b, #0\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_decrypt4 (const grub_uint8_t *rk, unsigned rounds,
+		      grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile (".arch armv8-a+crypto\n\t"
+		"ld1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[in]]\n"
+		"1:\n\t"
+		"ld1 {v4.16b}, [%[rk]], #16\n\t"
+		"aesd v0.16b, v4.16b\n\t"
+		"aesimc v0.16b, v0.16b\n\t"
+		"aesd v1.16b, v4.16b\n\t"
+		"aesimc v1.16b, v1.16b\n\t"
+		"aesd v2.16b, v4.16b\n\t"
+		"aesimc v2.16b, v2.16b\n\t"
+		"aesd v3.16b, v4.16b\n\t"
+		"aesimc v3.16b, v3.16b\n\t"
+		"subs %w[n], %w[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"ld1 {v4.16b, v5.16b}, [%[rk]]\n\t"
+		"aesd v0.16b, v4.16b\n\t"
+		"aesd v1.16b, v4.16b\n\t"
+		"aesd v2.16b, v4.16b\n\t"
+		"aesd v3.16b, v4.16b\n\t"
+		"eor v0.16b, v0.16b, v5.16b\n\t"
+		"eor v1.16b, v1.16b, v5.16b\n\t"
+		"eor v2.16b, v2.16b, v5.16b\n\t"
+		"eor v3.16b, v3.16b, v5.16b\n\t"
+		"st1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[out]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v4.16b, #0\n\t"
+		"movi v5.16b, #0\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
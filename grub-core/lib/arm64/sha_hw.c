@@ -0,0 +1,240 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/sha_hw.h>
+
+int
+grub_sha_hw_supported (void)
+{
+  grub_uint64_t isar0;
+
+  /* The SHA2 field of ID_AA64ISAR0_EL1: 1 for SHA-256, 2 for SHA-512 as
+     well.  */
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  switch ((isar0 >> 12) & 0xf)
+    {
+    case 0:
+      return 0;
+    case 1:
+      return GRUB_SHA_HW_SHA256;
+    default:
+      return GRUB_SHA_HW_SHA256 | GRUB_SHA_HW_SHA512;
+    }
+}
+
+/* The state is kept as ABCD in V0 and EFGH in V1, the message words in V3
+   to V6.  Each step does 4 rounds with the words in M, then turns them into
+   the ones for 16 rounds later.  */
+
+#define ROUNDS(m)							\
+  "ld1 {v7.4s}, [%[kp]], #16\n\t"					\
+  "add v7.4s, v7.4s, v" #m ".4s\n\t"					\
+  "mov v2.16b, v0.16b\n\t"						\
+  "sha256h q0, q1, v7.4s\n\t"						\
+  "sha256h2 q1, q2, v7.4s\n\t"
+
+#define ROUNDS_SCHED(m, n1, n2, n3)					\
+  ROUNDS (m)								\
+  "sha256su0 v" #m ".4s, v" #n1 ".4s\n\t"				\
+  "sha256su1 v" #m ".4s, v" #n2 ".4s, v" #n3 ".4s\n\t"
+
+/* GRUB is compiled for the general registers only, so the compiler keeps
+   nothing in the SIMD registers, nor accepts them as clobbers.  Only V0 to
+   V7 and V16 and V17, which no calling convention preserves, are used, and
+   they are cleared.  */
+void
+grub_sha256_hw_blocks (grub_uint32_t *state, const grub_uint8_t *data,
+		       grub_size_t nblocks)
+{
+  const grub_uint32_t *kp;
+
+  if (!nblocks)
+    return;
+
+  asm volatile (".arch armv8-a+crypto\n\t"
+		"ld1 {v0.4s, v1.4s}, [%[state]]\n"
+		"1:\n\t"
+		"mov %[kp], %[k]\n\t"
+		"mov v16.16b, v0.16b\n\t"
+		"mov v17.16b, v1.16b\n\t"
+		"ld1 {v3.16b, v4.16b, v5.16b, v6.16b}, [%[data]], #64\n\t"
+		"rev32 v3.16b, v3.16b\n\t"
+		"rev32 v4.16b, v4.16b\n\t"
+		"rev32 v5.16b, v5.16b\n\t"
+		"rev32 v6.16b, v6.16b\n\t"
+		ROUNDS_SCHED (3, 4, 5, 6)
+		ROUNDS_SCHED (4, 5, 6, 3)
+		ROUNDS_SCHED (5, 6, 3, 4)
+		ROUNDS_SCHED (6, 3, 4, 5)
+		ROUNDS_SCHED (3, 4, 5, 6)
+		ROUNDS_SCHED (4, 5, 6, 3)
+		ROUNDS_SCHED (5, 6, 3, 4)
+		ROUNDS_SCHED (6, 3, 4, 5)
+		ROUNDS_SCHED (3, 4, 5, 6)
+		ROUNDS_SCHED (4, 5, 6, 3)
+		ROUNDS_SCHED (5, 6, 3, 4)
+		ROUNDS_SCHED (6, 3, 4, 5)
+		ROUNDS (3)
+		ROUNDS (4)
+		ROUNDS (5)
+		ROUNDS (6)
+		"add v0.4s, v0.4s, v16.4s\n\t"
+		"add v1.4s, v1.4s, v17.4s\n\t"
+		"subs %[n], %[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"st1 {v0.4s, v1.4s}, [%[state]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v4.16b, #0\n\t"
+		"movi v5.16b, #0\n\t"
+		"movi v6.16b, #0\n\t"
+		"movi v7.16b, #0\n\t"
+		"movi v16.16b, #0\n\t"
+		"movi v17.16b, #0\n"
+		: [data] "+r" (data), [n] "+r" (nblocks), [kp] "=&r" (kp)
+		: [state] "r" (state), [k] "r" (grub_sha256_hw_k)
+		: "cc", "memory");
+}
+
+/* The state is kept as AB, CD, EF and GH in 4 of V0 to V4 and the message
+   words in V20 to V27.  Each step does 2 rounds with the words in W, after
+   which GH holds the new AB, AB the new CD, FREE the new EF and EF the new
+   GH, and CD is free.  */
+
+#define ROUNDS512(ab, cd, ef, gh, free, w)				\
+  "ld1 {v5.2d}, [%[kp]], #16\n\t"					\
+  "add v5.2d, v5.2d, v" #w ".2d\n\t"					\
+  "ext v6.16b, v" #ef ".16b, v" #gh ".16b, #8\n\t"			\
+  "ext v5.16b, v5.16b, v5.16b, #8\n\t"					\
+  "ext v7.16b, v" #cd ".16b, v" #ef ".16b, #8\n\t"			\
+  "add v" #gh ".2d, v" #gh ".2d, v5.2d\n\t"				\
+  "sha512h q" #gh ", q6, v7.2d\n\t"					\
+  "add v" #free ".2d, v" #cd ".2d, v" #gh ".2d\n\t"			\
+  "sha512h2 q" #gh ", q" #cd ", v" #ab ".2d\n\t"
+
+/* And turn W into the words for 16 rounds later, from the ones in W1, W4,
+   W5 and W7 which follow it.  */
+#define ROUNDS512_SCHED(ab, cd, ef, gh, free, w, w1, w4, w5, w7)	\
+  ROUNDS512 (ab, cd, ef, gh, free, w)					\
+  "sha512su0 v" #w ".2d, v" #w1 ".2d\n\t"				\
+  "ext v5.16b, v" #w4 ".16b, v" #w5 ".16b, #8\n\t"			\
+  "sha512su1 v" #w ".2d, v" #w7 ".2d, v5.2d\n\t"
+
+/* Only V0 to V7 and V16 to V27, which no calling convention preserves, are
+   used, and they are cleared.  */
+void
+grub_sha512_hw_blocks (grub_uint64_t *state, const grub_uint8_t *data,
+		       grub_size_t nblocks)
+{
+  const grub_uint64_t *kp;
+
+  if (!nblocks)
+    return;
+
+  asm volatile (".arch armv8.2-a+sha3\n\t"
+		"ld1 {v16.2d, v17.2d, v18.2d, v19.2d}, [%[state]]\n"
+		"1:\n\t"
+		"mov %[kp], %[k]\n\t"
+		"mov v0.16b, v16.16b\n\t"
+		"mov v1.16b, v17.16b\n\t"
+		"mov v2.16b, v18.16b\n\t"
+		"mov v3.16b, v19.16b\n\t"
+		"ld1 {v20.16b, v21.16b, v22.16b, v23.16b}, [%[data]], #64\n\t"
+		"ld1 {v24.16b, v25.16b, v26.16b, v27.16b}, [%[data]], #64\n\t"
+		"rev64 v20.16b, v20.16b\n\t"
+		"rev64 v21.16b, v21.16b\n\t"
+		"rev64 v22.16b, v22.16b\n\t"
+		"rev64 v23.16b, v23.16b\n\t"
+		"rev64 v24.16b, v24.16b\n\t"
+		"rev64 v25.16b, v25.16b\n\t"
+		"rev64 v26.16b, v26.16b\n\t"
+		"rev64 v27.16b, v27.16b\n\t"
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 20, 21, 24, 25, 27)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 21, 22, 25, 26, 20)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 22, 23, 26, 27, 21)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 23, 24, 27, 20, 22)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 24, 25, 20, 21, 23)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 25, 26, 21, 22, 24)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 26, 27, 22, 23, 25)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 27, 20, 23, 24, 26)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 20, 21, 24, 25, 27)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 21, 22, 25, 26, 20)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 22, 23, 26, 27, 21)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 23, 24, 27, 20, 22)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 24, 25, 20, 21, 23)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 25, 26, 21, 22, 24)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 26, 27, 22, 23, 25)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 27, 20, 23, 24, 26)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 20, 21, 24, 25, 27)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 21, 22, 25, 26, 20)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 22, 23, 26, 27, 21)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 23, 24, 27, 20, 22)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 24, 25, 20, 21, 23)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 25, 26, 21, 22, 24)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 26, 27, 22, 23, 25)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 27, 20, 23, 24, 26)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 20, 21, 24, 25, 27)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 21, 22, 25, 26, 20)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 22, 23, 26, 27, 21)
+		ROUNDS512_SCHED (2, 3, 1, 4, 0, 23, 24, 27, 20, 22)
+		ROUNDS512_SCHED (4, 2, 0, 1, 3, 24, 25, 20, 21, 23)
+		ROUNDS512_SCHED (1, 4, 3, 0, 2, 25, 26, 21, 22, 24)
+		ROUNDS512_SCHED (0, 1, 2, 3, 4, 26, 27, 22, 23, 25)
+		ROUNDS512_SCHED (3, 0, 4, 2, 1, 27, 20, 23, 24, 26)
+		ROUNDS512 (2, 3, 1, 4, 0, 20)
+		ROUNDS512 (4, 2, 0, 1, 3, 21)
+		ROUNDS512 (1, 4, 3, 0, 2, 22)
+		ROUNDS512 (0, 1, 2, 3, 4, 23)
+		ROUNDS512 (3, 0, 4, 2, 1, 24)
+		ROUNDS512 (2, 3, 1, 4, 0, 25)
+		ROUNDS512 (4, 2, 0, 1, 3, 26)
+		ROUNDS512 (1, 4, 3, 0, 2, 27)
+		"add v16.2d, v16.2d, v0.2d\n\t"
+		"add v17.2d, v17.2d, v1.2d\n\t"
+		"add v18.2d, v18.2d, v2.2d\n\t"
+		"add v19.2d, v19.2d, v3.2d\n\t"
+		"subs %[n], %[n], #1\n\t"
+		"b.ne 1b\n\t"
+		"st1 {v16.2d, v17.2d, v18.2d, v19.2d}, [%[state]]\n\t"
+		"movi v0.16b, #0\n\t"
+		"movi v1.16b, #0\n\t"
+		"movi v2.16b, #0\n\t"
+		"movi v3.16b, #0\n\t"
+		"movi v4.16b, #0\n\t"
+		"movi v5.16b, #0\n\t"
+		"movi v6.16b, #0\n\t"
+		"movi v7.16b, #0\n\t"
+		"movi v16.16b, #0\n\t"
+		"movi v17.16b, #0\n\t"
+		"movi v18.16b, #0\n\t"
+		"movi v19.16b, #0\n\t"
+		"movi v20.16b, #0\n\t"
+		"movi v21.16b, #0\n\t"
+		"movi v22.16b, #0\n\t"
+		"movi v23.16b, #0\n\t"
+		"movi v24.16b, #0\n\t"
+		"movi v25.16b, #0\n\t"
+		"movi v26.16b, #0\n\t"
+		"movi v27.16b, #0\n"
+		: [data] "+r" (data), [n] "+r" (nblocks), [kp] "=&r" (kp)
+		: [state] "r" (state), [k] "r" (grub_sha512_hw_k)
+		: "cc", "memory");
+}
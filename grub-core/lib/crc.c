@@ -18,11 +18,25 @@
  */
 
 #include <grub/types.h>
+#include <grub/dl.h>
 #include <grub/lib/crc.h>
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL)
+#include <grub/i386/cpuid.h>
+#define CRC32C_HW	1
+#elif defined (__aarch64__) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU)
+#define CRC32C_HW	1
+#endif
 
-static grub_uint32_t crc32c_table [256];
+GRUB_MOD_LICENSE ("GPLv3+");
 
-/* Helper for init_crc32c_table.  */
+/* Slicing by 8: crc32c_table[k][i] is the CRC of byte I followed by K zero
+   bytes, so that 8 bytes can be processed with one lookup each.  */
+static grub_uint32_t crc32c_table [8][256];
+/* The same for the IEEE 802.3 polynomial.  */
+static grub_uint32_t crc32_table [8][256];
+
+/* Helper for init_crc32_table.  */
 static grub_uint32_t
 reflect (grub_uint32_t ref, int len)
 {
@@ -40,37 +54,155 @@ reflect (grub_uint32_t ref, int len)
 }
 
 static void
-init_crc32c_table (void)
+init_crc32_table (grub_uint32_t table[8][256], grub_uint32_t polynomial)
 {
-  grub_uint32_t polynomial = 0x1edc6f41;
   int i, j;
 
   for(i = 0; i < 256; i++)
     {
-      crc32c_table[i] = reflect(i, 8) << 24;
+      table[0][i] = reflect(i, 8) << 24;
       for (j = 0; j < 8; j++)
-        crc32c_table[i] = (crc32c_table[i] << 1) ^
-            (crc32c_table[i] & (1 << 31) ? polynomial : 0);
-      crc32c_table[i] = reflect(crc32c_table[i], 32);
+        table[0][i] = (table[0][i] << 1) ^
+            (table[0][i] & (1U << 31) ? polynomial : 0);
+      table[0][i] = reflect(table[0][i], 32);
     }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      table[j][i] = (table[j - 1][i] >> 8)
+	^ table[0][table[j - 1][i] & 0xff];
+}
+
+static grub_uint32_t
+crc32_update (grub_uint32_t table[8][256], grub_uint32_t crc,
+	      const grub_uint8_t *data, int size)
+{
+  for (; size >= 8; size -= 8, data += 8)
+    {
+      crc ^= grub_le_to_cpu32 (grub_get_unaligned32 (data));
+      crc = table[7][crc & 0xff]
+	^ table[6][(crc >> 8) & 0xff]
+	^ table[5][(crc >> 16) & 0xff]
+	^ table[4][crc >> 24]
+	^ table[3][data[4]]
+	^ table[2][data[5]]
+	^ table[1][data[6]]
+	^ table[0][data[7]];
+    }
+
+  for (; size > 0; size--, data++)
+    crc = (crc >> 8) ^ table[0][(crc & 0xFF) ^ *data];
+
+  return crc;
+}
+
+#ifdef CRC32C_HW
+
+/* SSE4.2 and the ARMv8 CRC32 extension compute CRC-32C in the general
+   registers.  -1 until checked.  */
+static int crc32c_hw = -1;
+
+static int
+crc32c_hw_supported (void)
+{
+#ifdef __aarch64__
+  grub_uint64_t isar0;
+
+  /* The CRC32 field of ID_AA64ISAR0_EL1.  */
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  return ((isar0 >> 16) & 0xf) != 0;
+#else
+  grub_uint32_t a, b, c, d;
+
+  if (! grub_cpu_is_cpuid_supported ())
+    return 0;
+  grub_cpuid (0, a, b, c, d);
+  if (a < 1)
+    return 0;
+  grub_cpuid (1, a, b, c, d);
+  /* SSE4.2.  */
+  return (c & (1 << 20)) != 0;
+#endif
 }
 
+static grub_uint32_t
+crc32c_hw_update (grub_uint32_t crc, const grub_uint8_t *data, int size)
+{
+#ifdef __aarch64__
+  for (; size >= 8; size -= 8, data += 8)
+    asm (".arch armv8-a+crc\n\t"
+	 "crc32cx %w0, %w0, %1"
+	 : "+r" (crc) : "r" (grub_get_unaligned64 (data)));
+  for (; size > 0; size--, data++)
+    asm (".arch armv8-a+crc\n\t"
+	 "crc32cb %w0, %w0, %w1"
+	 : "+r" (crc) : "r" ((grub_uint32_t) *data));
+#else
+#ifdef __x86_64__
+  for (; size >= 8; size -= 8, data += 8)
+    {
+      grub_uint64_t c = crc;
+
+      asm ("crc32q %1, %0" : "+r" (c) : "rm" (grub_get_unaligned64 (data)));
+      crc = c;
+    }
+#endif
+  for (; size >= 4; size -= 4, data += 4)
+    asm ("crc32l %1, %0" : "+r" (crc) : "rm" (grub_get_unaligned32 (data)));
+  for (; size > 0; size--, data++)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+#endif
+  return crc;
+}
+
+#endif
+
 grub_uint32_t
 grub_getcrc32c (grub_uint32_t crc, const void *buf, int size)
 {
-  int i;
   const grub_uint8_t *data = buf;
 
-  if (! crc32c_table[1])
-    init_crc32c_table ();
+#ifdef CRC32C_HW
+  if (crc32c_hw < 0)
+    crc32c_hw = crc32c_hw_supported ();
+  if (crc32c_hw)
+    return crc32c_hw_update (crc ^ 0xffffffff, data, size) ^ 0xffffffff;
+#endif
+
+  if (! crc32c_table[0][1])
+    init_crc32_table (crc32c_table, 0x1edc6f41);
+
+  return crc32_update (crc32c_table, crc ^ 0xffffffff, data, size)
+    ^ 0xffffffff;
+}
 
-  crc^= 0xffffffff;
+grub_uint32_t
+grub_getcrc32 (grub_uint32_t crc, const void *buf, int size)
+{
+  const grub_uint8_t *data = buf;
 
-  for (i = 0; i < size; i++)
+#if defined (CRC32C_HW) && defined (__aarch64__)
+  /* The ARMv8 CRC32 extension has the IEEE polynomial too.  */
+  if (crc32c_hw < 0)
+    crc32c_hw = crc32c_hw_supported ();
+  if (crc32c_hw)
     {
-      crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
-      data++;
+      crc ^= 0xffffffff;
+      for (; size >= 8; size -= 8, data += 8)
+	asm (".arch armv8-a+crc\n\t"
+	     "crc32x %w0, %w0, %1"
+	     : "+r" (crc) : "r" (grub_get_unaligned64 (data)));
+      for (; size > 0; size--, data++)
+	asm (".arch armv8-a+crc\n\t"
+	     "crc32b %w0, %w0, %w1"
+	     : "+r" (crc) : "r" ((grub_uint32_t) *data));
+      return crc ^ 0xffffffff;
     }
+#endif
+
+  if (! crc32_table[0][1])
+    init_crc32_table (crc32_table, 0x04c11db7);
 
-  return crc ^ 0xffffffff;
+  return crc32_update (crc32_table, crc ^ 0xffffffff, data, size)
+    ^ 0xffffffff;
 }
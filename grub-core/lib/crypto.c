@@ -212,6 +212,11 @@ grub_crypto_ecb_decrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->decrypt_blocks)
+    {
+      cipher->cipher->decrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
@@ -232,6 +237,11 @@ grub_crypto_ecb_encrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->encrypt_blocks)
+    {
+      cipher->cipher->encrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
@@ -31,18 +31,14 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #include "../kern/disk_common.c"
 
 static void
-grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
-			    grub_disk_addr_t sector)
+grub_disk_cache_invalidate (grub_disk_t disk, grub_disk_addr_t sector)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
-  sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  sector &= ~((1ULL << disk->cache_bits) - 1);
+  cache = grub_disk_cache_lookup (disk->dev->id, disk->id, sector);
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector && cache->data)
+  if (cache)
     {
       cache->lock = 1;
       grub_free (cache->data);
@@ -63,6 +59,10 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     return -1;
 
+  /* Whatever was parsed from the disk, partition tables included, may be
+     stale now.  */
+  grub_disk_cache_generation++;
+
   aligned_sector = (sector & ~((1ULL << (disk->log_sector_size
 					 - GRUB_DISK_SECTOR_BITS)) - 1));
   real_offset = offset + ((sector - aligned_sector) << GRUB_DISK_SECTOR_BITS);
@@ -99,7 +99,7 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
 	  grub_memcpy (tmp_buf + real_offset, buf, len);
 
-	  grub_disk_cache_invalidate (disk->dev->id, disk->id, sector);
+	  grub_disk_cache_invalidate (disk, sector);
 
 	  if ((disk->dev->write) (disk, transform_sector (disk, sector),
 				  1, tmp_buf) != GRUB_ERR_NONE)
@@ -136,7 +136,7 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
 	  while (n--)
 	    {
-	      grub_disk_cache_invalidate (disk->dev->id, disk->id, sector);
+	      grub_disk_cache_invalidate (disk, sector);
 	      sector += (1U << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS));
 	    }
 
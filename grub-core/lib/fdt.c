@@ -229,6 +229,38 @@ static int rearrange_blocks (void *fdt, unsigned int clearance)
   return 0;
 }
 
+/* Check whether the blocks are in the canonical order with room for the
+   structure block to grow by STRUCT_GROW bytes and for the strings block
+   to grow by STRINGS_GROW bytes, so that nothing needs to be moved.  */
+static int has_room (void *fdt, unsigned int struct_grow,
+                     unsigned int strings_grow)
+{
+  int mem_rsvmap_size = get_mem_rsvmap_size (fdt);
+
+  return (mem_rsvmap_size >= 0
+          && (grub_fdt_get_off_mem_rsvmap (fdt) + mem_rsvmap_size
+              <= grub_fdt_get_off_dt_struct (fdt))
+          && ((grub_uint64_t) grub_fdt_get_off_dt_struct (fdt)
+              + grub_fdt_get_size_dt_struct (fdt) + struct_grow
+              <= grub_fdt_get_off_dt_strings (fdt))
+          && ((grub_uint64_t) grub_fdt_get_off_dt_strings (fdt)
+              + grub_fdt_get_size_dt_strings (fdt) + strings_grow
+              <= grub_fdt_get_totalsize (fdt)));
+}
+
+/* Make room for the structure block to grow by STRUCT_GROW bytes and for
+   the strings block to grow by STRINGS_GROW bytes, moving the blocks only
+   if there isn't already room where they are. */
+static int make_room (void *fdt, unsigned int struct_grow,
+                      unsigned int strings_grow)
+{
+  if (has_room (fdt, struct_grow, strings_grow))
+    return 0;
+  if (struct_grow + strings_grow > get_free_space (fdt))
+    return -1;
+  return rearrange_blocks (fdt, struct_grow);
+}
+
 static grub_uint32_t *find_prop (void *fdt, unsigned int nodeoffset,
 				 const char *name)
 {
@@ -348,13 +380,13 @@ int grub_fdt_add_subnode (void *fdt, unsigned int parentoffset,
 {
   unsigned int entry_size = node_entry_size(name);
 
-  if ((parentoffset & 0x3) || (get_free_space (fdt) < entry_size))
+  if (parentoffset & 0x3)
     return -1;
 
-  /* The new node entry will increase the size of the structure block: rearrange
-     blocks such that there is sufficient free space between the structure and
-     the strings block, then add the new node entry. */
-  if (rearrange_blocks (fdt, entry_size) < 0)
+  /* The new node entry will increase the size of the structure block: make
+     sure there is sufficient free space between the structure and the
+     strings block, then add the new node entry. */
+  if (make_room (fdt, entry_size, 0) < 0)
     return -1;
   return add_subnode (fdt, parentoffset, name);
 }
@@ -393,15 +425,8 @@ int grub_fdt_set_prop (void *fdt, unsigned int nodeoffset, const char *name,
         }
     }
   if (!prop || !prop_name_present) {
-    unsigned int needed_space = 0;
-
-    if (!prop)
-      needed_space = prop_entry_size(len);
-    if (!prop_name_present)
-      needed_space += grub_strlen (name) + 1;
-    if (needed_space > get_free_space (fdt))
-      return -1;
-    if (rearrange_blocks (fdt, !prop ? prop_entry_size(len) : 0) < 0)
+    if (make_room (fdt, !prop ? prop_entry_size(len) : 0,
+                   !prop_name_present ? grub_strlen (name) + 1 : 0) < 0)
       return -1;
   }
   if (!prop_name_present) {
@@ -435,6 +460,30 @@ int grub_fdt_set_prop (void *fdt, unsigned int nodeoffset, const char *name,
   return 0;
 }
 
+/* Set the N properties in PROPS on a node, moving the blocks of the FDT at
+   most once for all of them. */
+int grub_fdt_set_props (void *fdt, unsigned int nodeoffset,
+			const struct grub_fdt_prop *props, unsigned int n)
+{
+  unsigned int struct_grow = 0, strings_grow = 0;
+  unsigned int i;
+
+  /* Reserve for the worst case, in which every property is new.  */
+  for (i = 0; i < n; i++)
+    {
+      struct_grow += prop_entry_size (props[i].len);
+      strings_grow += grub_strlen (props[i].name) + 1;
+    }
+  if (make_room (fdt, struct_grow, strings_grow) < 0)
+    return -1;
+
+  for (i = 0; i < n; i++)
+    if (grub_fdt_set_prop (fdt, nodeoffset, props[i].name, props[i].val,
+			   props[i].len) < 0)
+      return -1;
+  return 0;
+}
+
 int
 grub_fdt_create_empty_tree (void *fdt, unsigned int size)
 {
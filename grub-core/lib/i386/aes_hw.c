@@ -0,0 +1,191 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/aes_hw.h>
+#include <grub/i386/cpuid.h>
+
+#define CPUID_EDX_SSE2	(1 << 26)
+#define CPUID_ECX_AES	(1 << 25)
+#define CR0_EM		(1 << 2)
+#define CR0_TS		(1 << 3)
+#define CR4_OSFXSR	(1 << 9)
+
+/* The instructions need SSE, which GRUB never enables itself: only use
+   them when the firmware has.  */
+int
+grub_aes_hw_supported (void)
+{
+  grub_uint32_t a, b, c, d;
+  unsigned long cr0, cr4;
+
+  if (! grub_cpu_is_cpuid_supported ())
+    return 0;
+
+  grub_cpuid (0, a, b, c, d);
+  if (a < 1)
+    return 0;
+  grub_cpuid (1, a, b, c, d);
+  if (! (c & CPUID_ECX_AES) || ! (d & CPUID_EDX_SSE2))
+    return 0;
+
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+  return (cr4 & CR4_OSFXSR) && ! (cr0 & (CR0_EM | CR0_TS));
+}
+
+/* GRUB is compiled without SSE, so the compiler keeps nothing in the XMM
+   registers, nor accepts them as clobbers.  Only XMM0 to XMM4, which no
+   calling convention preserves, are used, and they are cleared so that no
+   key material is left behind.  */
+
+void
+grub_aes_hw_encrypt (const grub_uint8_t *rk, unsigned rounds,
+		     grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile ("movdqu (%[in]), %%xmm0\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n"
+		"1:\n\t"
+		"add $16, %[rk]\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"aesenc %%xmm1, %%xmm0\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu 16(%[rk]), %%xmm1\n\t"
+		"aesenclast %%xmm1, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[out])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_decrypt (const grub_uint8_t *rk, unsigned rounds,
+		     grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile ("movdqu (%[in]), %%xmm0\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n"
+		"1:\n\t"
+		"add $16, %[rk]\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"aesdec %%xmm1, %%xmm0\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu 16(%[rk]), %%xmm1\n\t"
+		"aesdeclast %%xmm1, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[out])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_encrypt4 (const grub_uint8_t *rk, unsigned rounds,
+		      grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile ("movdqu (%[in]), %%xmm0\n\t"
+		"movdqu 16(%[in]), %%xmm2\n\t"
+		"movdqu 32(%[in]), %%xmm3\n\t"
+		"movdqu 48(%[in]), %%xmm4\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm2\n\t"
+		"pxor %%xmm1, %%xmm3\n\t"
+		"pxor %%xmm1, %%xmm4\n"
+		"1:\n\t"
+		"add $16, %[rk]\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"aesenc %%xmm1, %%xmm0\n\t"
+		"aesenc %%xmm1, %%xmm2\n\t"
+		"aesenc %%xmm1, %%xmm3\n\t"
+		"aesenc %%xmm1, %%xmm4\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu 16(%[rk]), %%xmm1\n\t"
+		"aesenclast %%xmm1, %%xmm0\n\t"
+		"aesenclast %%xmm1, %%xmm2\n\t"
+		"aesenclast %%xmm1, %%xmm3\n\t"
+		"aesenclast %%xmm1, %%xmm4\n\t"
+		"movdqu %%xmm0, (%[out])\n\t"
+		"movdqu %%xmm2, 16(%[out])\n\t"
+		"movdqu %%xmm3, 32(%[out])\n\t"
+		"movdqu %%xmm4, 48(%[out])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
+
+void
+grub_aes_hw_decrypt4 (const grub_uint8_t *rk, unsigned rounds,
+		      grub_uint8_t *out, const grub_uint8_t *in)
+{
+  unsigned n = rounds - 1;
+
+  asm volatile ("movdqu (%[in]), %%xmm0\n\t"
+		"movdqu 16(%[in]), %%xmm2\n\t"
+		"movdqu 32(%[in]), %%xmm3\n\t"
+		"movdqu 48(%[in]), %%xmm4\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm2\n\t"
+		"pxor %%xmm1, %%xmm3\n\t"
+		"pxor %%xmm1, %%xmm4\n"
+		"1:\n\t"
+		"add $16, %[rk]\n\t"
+		"movdqu (%[rk]), %%xmm1\n\t"
+		"aesdec %%xmm1, %%xmm0\n\t"
+		"aesdec %%xmm1, %%xmm2\n\t"
+		"aesdec %%xmm1, %%xmm3\n\t"
+		"aesdec %%xmm1, %%xmm4\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu 16(%[rk]), %%xmm1\n\t"
+		"aesdeclast %%xmm1, %%xmm0\n\t"
+		"aesdeclast %%xmm1, %%xmm2\n\t"
+		"aesdeclast %%xmm1, %%xmm3\n\t"
+		"aesdeclast %%xmm1, %%xmm4\n\t"
+		"movdqu %%xmm0, (%[out])\n\t"
+		"movdqu %%xmm2, 16(%[out])\n\t"
+		"movdqu %%xmm3, 32(%[out])\n\t"
+		"movdqu %%xmm4, 48(%[out])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [in] "r" (in), [out] "r" (out)
+		: "cc", "memory");
+}
@@ -0,0 +1,189 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/sha_hw.h>
+#include <grub/i386/cpuid.h>
+
+#define CPUID_ECX_SSSE3		(1 << 9)
+#define CPUID_ECX_SSE41		(1 << 19)
+#define CPUID_EBX_7_SHA		(1 << 29)
+#define CR0_EM			(1 << 2)
+#define CR0_TS			(1 << 3)
+#define CR4_OSFXSR		(1 << 9)
+
+/* grub_cpuid leaves ECX alone, which leaf 7 takes as the subleaf.  */
+static grub_uint32_t
+cpuid_7_ebx (void)
+{
+  grub_uint32_t a = 7, b, c = 0, d;
+
+#ifdef __PIC__
+  asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1"
+		: "+a" (a), "=r" (b), "+c" (c), "=d" (d));
+#else
+  asm volatile ("cpuid"
+		: "+a" (a), "=b" (b), "+c" (c), "=d" (d));
+#endif
+  return b;
+}
+
+/* The instructions need SSE, which GRUB never enables itself: only use
+   them when the firmware has.  */
+int
+grub_sha_hw_supported (void)
+{
+  grub_uint32_t a, b, c, d;
+  unsigned long cr0, cr4;
+
+  if (! grub_cpu_is_cpuid_supported ())
+    return 0;
+
+  grub_cpuid (0, a, b, c, d);
+  if (a < 7)
+    return 0;
+  grub_cpuid (1, a, b, c, d);
+  if (! (c & CPUID_ECX_SSSE3) || ! (c & CPUID_ECX_SSE41))
+    return 0;
+  if (! (cpuid_7_ebx () & CPUID_EBX_7_SHA))
+    return 0;
+
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+  if (! (cr4 & CR4_OSFXSR) || (cr0 & (CR0_EM | CR0_TS)))
+    return 0;
+  return GRUB_SHA_HW_SHA256;
+}
+
+/* The state is kept as ABEF in XMM1 and CDGH in XMM2, the message words in
+   XMM3 to XMM6, and SHA256RNDS2 takes its two message and constant words
+   from XMM0.  Each step does 4 rounds with the words in M, updating the
+   ones in N for 4 rounds later while at it.  */
+
+#define ROUNDS_HEAD(i, m)						\
+  "movdqu " #i "*16(%[k]), %%xmm0\n\t"					\
+  "paddd %%xmm" #m ", %%xmm0\n\t"					\
+  "sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n\t"
+
+#define ROUNDS_TAIL							\
+  "pshufd $0x0e, %%xmm0, %%xmm0\n\t"					\
+  "sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n\t"
+
+/* Add W[t - 7] and sigma1 (W[t - 2]) to W[t - 16] + sigma0 (W[t - 15]).  */
+#define MSG2(m, p, n)							\
+  "movdqa %%xmm" #m ", %%xmm7\n\t"					\
+  "palignr $4, %%xmm" #p ", %%xmm7\n\t"					\
+  "paddd %%xmm7, %%xmm" #n "\n\t"					\
+  "sha256msg2 %%xmm" #m ", %%xmm" #n "\n\t"
+
+/* Turn W[t - 16] into W[t - 16] + sigma0 (W[t - 15]).  */
+#define MSG1(m, p)							\
+  "sha256msg1 %%xmm" #m ", %%xmm" #p "\n\t"
+
+#define ROUNDS(i, m)		ROUNDS_HEAD (i, m) ROUNDS_TAIL
+#define ROUNDS1(i, m, p)	ROUNDS (i, m) MSG1 (m, p)
+#define ROUNDS12(i, m, p, n)	ROUNDS_HEAD (i, m) MSG2 (m, p, n) \
+				ROUNDS_TAIL MSG1 (m, p)
+#define ROUNDS2(i, m, p, n)	ROUNDS_HEAD (i, m) MSG2 (m, p, n) ROUNDS_TAIL
+
+/* GRUB is compiled without SSE, so the compiler keeps nothing in the XMM
+   registers, nor accepts them as clobbers.  XMM6 and XMM7 are preserved by
+   the EFI calling convention and so saved in SAVE with the state at the
+   start of the block, and the others are cleared.  */
+void
+grub_sha256_hw_blocks (grub_uint32_t *state, const grub_uint8_t *data,
+		       grub_size_t nblocks)
+{
+  static const grub_uint8_t bswap[16] =
+    { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+  grub_uint8_t save[80];
+
+  if (!nblocks)
+    return;
+
+  grub_memcpy (save + 64, bswap, sizeof (bswap));
+
+  asm volatile ("movdqu %%xmm6, (%[save])\n\t"
+		"movdqu %%xmm7, 16(%[save])\n\t"
+		/* From ABCD and EFGH to ABEF and CDGH.  */
+		"movdqu (%[state]), %%xmm1\n\t"
+		"movdqu 16(%[state]), %%xmm2\n\t"
+		"pshufd $0xb1, %%xmm1, %%xmm1\n\t"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm7\n\t"
+		"palignr $8, %%xmm2, %%xmm1\n\t"
+		"pblendw $0xf0, %%xmm7, %%xmm2\n"
+		"1:\n\t"
+		"movdqu %%xmm1, 32(%[save])\n\t"
+		"movdqu %%xmm2, 48(%[save])\n\t"
+		"movdqu 64(%[save]), %%xmm7\n\t"
+		"movdqu (%[data]), %%xmm3\n\t"
+		"movdqu 16(%[data]), %%xmm4\n\t"
+		"movdqu 32(%[data]), %%xmm5\n\t"
+		"movdqu 48(%[data]), %%xmm6\n\t"
+		"pshufb %%xmm7, %%xmm3\n\t"
+		"pshufb %%xmm7, %%xmm4\n\t"
+		"pshufb %%xmm7, %%xmm5\n\t"
+		"pshufb %%xmm7, %%xmm6\n\t"
+		ROUNDS (0, 3)
+		ROUNDS1 (1, 4, 3)
+		ROUNDS1 (2, 5, 4)
+		ROUNDS12 (3, 6, 5, 3)
+		ROUNDS12 (4, 3, 6, 4)
+		ROUNDS12 (5, 4, 3, 5)
+		ROUNDS12 (6, 5, 4, 6)
+		ROUNDS12 (7, 6, 5, 3)
+		ROUNDS12 (8, 3, 6, 4)
+		ROUNDS12 (9, 4, 3, 5)
+		ROUNDS12 (10, 5, 4, 6)
+		ROUNDS12 (11, 6, 5, 3)
+		ROUNDS12 (12, 3, 6, 4)
+		ROUNDS2 (13, 4, 3, 5)
+		ROUNDS2 (14, 5, 4, 6)
+		ROUNDS (15, 6)
+		"movdqu 32(%[save]), %%xmm7\n\t"
+		"paddd %%xmm7, %%xmm1\n\t"
+		"movdqu 48(%[save]), %%xmm7\n\t"
+		"paddd %%xmm7, %%xmm2\n\t"
+		"add $64, %[data]\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		/* Back to ABCD and EFGH.  */
+		"pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm7\n\t"
+		"pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+		"palignr $8, %%xmm7, %%xmm2\n\t"
+		"movdqu %%xmm1, (%[state])\n\t"
+		"movdqu %%xmm2, 16(%[state])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		"movdqu (%[save]), %%xmm6\n\t"
+		"movdqu 16(%[save]), %%xmm7\n"
+		: [data] "+r" (data), [n] "+r" (nblocks)
+		: [state] "r" (state), [k] "r" (grub_sha256_hw_k),
+		  [save] "r" (save)
+		: "cc", "memory");
+
+  grub_memset (save + 32, 0, 32);
+}
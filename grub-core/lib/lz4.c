@@ -36,9 +36,11 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/types.h>
+#include <grub/lz4.h>
 
 static int LZ4_uncompress_unknownOutputSize(const char *source, char *dest,
-					    int isize, int maxOutputSize);
+					    int isize, int maxOutputSize,
+					    int prefix);
 
 /*
  * CPU Feature Detection
@@ -132,31 +134,23 @@ typedef struct _U64_S {
 #define	LZ4_WILDCOPY(s, d, e) do { LZ4_COPYPACKET(s, d) } while (d < e);
 
 /* Decompression functions */
-grub_err_t
-lz4_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len);
-
-grub_err_t
-lz4_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len)
+grub_ssize_t
+grub_lz4_decompress_block(const void *src, grub_size_t srcsize, void *dest,
+			   grub_size_t destsize, grub_size_t prefix)
 {
-	const BYTE *src = s_start;
-	U32 bufsiz = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) |
-	    src[3];
-
-	/* invalid compressed buffer size encoded at start */
-	if (bufsiz + 4 > s_len)
-		return grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed.");
+	int ret;
 
-	/*
-	 * Returns 0 on success (decompression function returned non-negative)
-	 * and appropriate error on failure (decompression function returned negative).
-	 */
-	return (LZ4_uncompress_unknownOutputSize((char*)s_start + 4, d_start, bufsiz,
-	    d_len) < 0)?grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed."):0;
+	if (srcsize > GRUB_INT_MAX || destsize > GRUB_INT_MAX
+	    || prefix > GRUB_INT_MAX)
+		return -1;
+	ret = LZ4_uncompress_unknownOutputSize(src, dest, srcsize, destsize,
+	    prefix);
+	return ret < 0 ? -1 : ret;
 }
 
 static int
 LZ4_uncompress_unknownOutputSize(const char *source,
-    char *dest, int isize, int maxOutputSize)
+    char *dest, int isize, int maxOutputSize, int prefix)
 {
 	/* Local Variables */
 	const BYTE * ip = (const BYTE *) source;
@@ -217,7 +211,7 @@ LZ4_uncompress_unknownOutputSize(const char *source,
 		/* get offset */
 		LZ4_READ_LITTLEENDIAN_16(ref, cpy, ip);
 		ip += 2;
-		if (ref < (BYTE * const) dest)
+		if (ref < (BYTE * const) dest - prefix)
 			/*
 			 * Error: offset creates reference outside of
 			 * destination buffer.
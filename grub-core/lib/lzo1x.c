@@ -0,0 +1,216 @@
+/* lzo1x.c - LZO1X decompressor.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/lzo1x.h>
+
+/* Decompressor for the LZO1X format written by lzop and btrfs, checking
+   every access like lzo1x_decompress_safe.  Unlike the reference one it
+   copies runs 8 bytes at a time whenever there is room to overshoot their
+   end, which is most of the time.  */
+
+#if defined (__i386__) || defined (__x86_64__) || defined (__aarch64__)
+#define LZO_WIDE_COPY	1
+#endif
+
+#define M2_MAX_OFFSET	0x0800
+#define M3_MAX_OFFSET	0x4000
+
+static inline void
+copy_bytes (grub_uint8_t *d, const grub_uint8_t *s, grub_size_t n)
+{
+  while (n--)
+    *d++ = *s++;
+}
+
+#ifdef LZO_WIDE_COPY
+/* Copy N bytes from S to D, 8 at a time, writing and reading up to 7 bytes
+   past their end.  D must not be less than 8 bytes after S.  */
+static inline void
+copy_wide (grub_uint8_t *d, const grub_uint8_t *s, grub_size_t n)
+{
+  grub_uint8_t *end = d + n;
+
+  do
+    {
+      grub_set_unaligned64 (d, grub_get_unaligned64 (s));
+      d += 8;
+      s += 8;
+    }
+  while (d < end);
+}
+#endif
+
+/* Read the length of a run encoded as BASE followed by zero bytes each
+   adding 255 and a final non-zero byte.  */
+static inline int
+read_length (const grub_uint8_t **ipp, const grub_uint8_t *ip_end,
+	     grub_size_t base, grub_size_t limit, grub_size_t *len)
+{
+  const grub_uint8_t *ip = *ipp;
+  grub_size_t t = base;
+
+  while (ip < ip_end && *ip == 0)
+    {
+      t += 255;
+      ip++;
+      if (t > limit)
+	return -1;
+    }
+  if (ip == ip_end)
+    return -1;
+  *len = t + *ip++;
+  *ipp = ip;
+  return 0;
+}
+
+grub_ssize_t
+grub_lzo1x_decompress (const void *src, grub_size_t srcsize, void *dest,
+		       grub_size_t destsize)
+{
+  const grub_uint8_t *ip = src;
+  const grub_uint8_t *const ip_end = ip + srcsize;
+  grub_uint8_t *const out = dest;
+  grub_uint8_t *op = out;
+  grub_uint8_t *const op_end = out + destsize;
+  grub_size_t t, len, dist;
+  /* What the instructions below 16 mean: a literal run after a match
+     without literals (0), a 2-byte match after 1 to 3 literals, or a
+     3-byte match after a literal run (4).  */
+  unsigned state = 0;
+
+  if (srcsize == 0)
+    return -1;
+
+  /* A first byte over 17 starts with literals.  */
+  if (*ip > 17)
+    {
+      t = *ip++ - 17;
+      if (t > (grub_size_t) (ip_end - ip) || t > (grub_size_t) (op_end - op))
+	return -1;
+      copy_bytes (op, ip, t);
+      op += t;
+      ip += t;
+      state = (t < 4) ? t : 4;
+    }
+
+  while (1)
+    {
+      if (ip == ip_end)
+	return -1;
+      t = *ip++;
+
+      if (t < 16 && state == 0)
+	{
+	  /* Literal run.  */
+	  if (t == 0 && read_length (&ip, ip_end, 15, destsize, &t) < 0)
+	    return -1;
+	  t += 3;
+	  if (t > (grub_size_t) (ip_end - ip)
+	      || t > (grub_size_t) (op_end - op))
+	    return -1;
+#ifdef LZO_WIDE_COPY
+	  if ((grub_size_t) (ip_end - ip) >= t + 8
+	      && (grub_size_t) (op_end - op) >= t + 8)
+	    copy_wide (op, ip, t);
+	  else
+#endif
+	    copy_bytes (op, ip, t);
+	  op += t;
+	  ip += t;
+	  state = 4;
+	  continue;
+	}
+
+      if (t < 16)
+	{
+	  if (ip == ip_end)
+	    return -1;
+	  dist = 1 + (t >> 2) + (*ip++ << 2);
+	  if (state == 4)
+	    {
+	      dist += M2_MAX_OFFSET;
+	      len = 3;
+	    }
+	  else
+	    len = 2;
+	}
+      else if (t >= 64)
+	{
+	  if (ip == ip_end)
+	    return -1;
+	  dist = 1 + ((t >> 2) & 7) + (*ip++ << 3);
+	  len = (t >> 5) + 1;
+	}
+      else if (t >= 32)
+	{
+	  len = t & 31;
+	  if (len == 0 && read_length (&ip, ip_end, 31, destsize, &len) < 0)
+	    return -1;
+	  len += 2;
+	  if (ip_end - ip < 2)
+	    return -1;
+	  dist = 1 + (grub_le_to_cpu16 (grub_get_unaligned16 (ip)) >> 2);
+	  ip += 2;
+	}
+      else
+	{
+	  len = t & 7;
+	  if (len == 0 && read_length (&ip, ip_end, 7, destsize, &len) < 0)
+	    return -1;
+	  len += 2;
+	  if (ip_end - ip < 2)
+	    return -1;
+	  dist = ((t & 8) << 11) + (grub_le_to_cpu16 (grub_get_unaligned16 (ip))
+				    >> 2);
+	  ip += 2;
+	  /* End of stream marker.  */
+	  if (dist == 0)
+	    break;
+	  dist += M3_MAX_OFFSET;
+	}
+
+      if (dist > (grub_size_t) (op - out) || len > (grub_size_t) (op_end - op))
+	return -1;
+#ifdef LZO_WIDE_COPY
+      if (dist >= 8 && (grub_size_t) (op_end - op) >= len + 8)
+	copy_wide (op, op - dist, len);
+      else
+#endif
+	copy_bytes (op, op - dist, len);
+      op += len;
+
+      /* Up to 3 literals follow a match.  */
+      state = ip[-2] & 3;
+      if (state)
+	{
+	  if (state > (grub_size_t) (ip_end - ip)
+	      || state > (grub_size_t) (op_end - op))
+	    return -1;
+	  copy_bytes (op, ip, state);
+	  op += state;
+	  ip += state;
+	}
+    }
+
+  if (ip != ip_end)
+    return -1;
+
+  return op - out;
+}
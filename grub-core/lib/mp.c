@@ -0,0 +1,273 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mp.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+
+#if defined (GRUB_MACHINE_EFI) && (defined (__i386__) || defined (__x86_64__))
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/loader.h>
+#include <grub/time.h>
+#define GRUB_MP_EFI 1
+#endif
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#ifdef GRUB_MP_EFI
+
+/* The application processors are started once with the firmware's MP
+   services and then spin waiting for jobs, so that running a job costs
+   no firmware call.  They return to the firmware after being idle for
+   this many spins, when the module is unloaded and before booting.  */
+#define GRUB_MP_IDLE_SPINS	(1 << 22)
+
+/* The procedure is called by the firmware with its calling convention.  */
+#if defined (__x86_64__) && !defined (__MINGW64__) && !defined (__CYGWIN__)
+#define GRUB_MP_EFIAPI __attribute__ ((ms_abi))
+#else
+#define GRUB_MP_EFIAPI
+#endif
+
+static grub_efi_guid_t mp_services_guid = GRUB_EFI_MP_SERVICES_PROTOCOL_GUID;
+static grub_efi_mp_services_t *mp_services;
+static grub_efi_event_t ap_event;
+static unsigned int nproc;
+static int aps_started;
+static struct grub_preboot *preboot_hnd;
+
+static struct
+{
+  grub_mp_task_t task;
+  void *data;
+  unsigned int count;
+  /* Next task index to hand out and number of finished tasks.  */
+  volatile unsigned int next;
+  volatile unsigned int done;
+  /* A new job is published by bumping the generation, then setting
+     active.  */
+  volatile unsigned int generation;
+  volatile int active;
+  /* Number of APs looking at the job: it may only be replaced when 0.  */
+  volatile unsigned int busy;
+  /* Number of APs in ap_worker.  */
+  volatile unsigned int running;
+  volatile int quit;
+} job;
+
+static inline void
+cpu_relax (void)
+{
+  asm volatile ("pause" : : : "memory");
+}
+
+static void
+run_tasks (void)
+{
+  unsigned int i;
+
+  while ((i = __sync_fetch_and_add (&job.next, 1)) < job.count)
+    {
+      job.task (job.data, i);
+      __sync_fetch_and_add (&job.done, 1);
+    }
+}
+
+static void GRUB_MP_EFIAPI
+ap_worker (void *arg __attribute__ ((unused)))
+{
+  unsigned int seen = job.generation - 1;
+  unsigned long idle = 0;
+
+  __sync_fetch_and_add (&job.running, 1);
+  while (!job.quit && idle < GRUB_MP_IDLE_SPINS)
+    {
+      unsigned int gen = job.generation;
+
+      if (gen == seen || !job.active)
+	{
+	  idle++;
+	  cpu_relax ();
+	  continue;
+	}
+
+      __sync_fetch_and_add (&job.busy, 1);
+      if (job.active && job.generation == gen)
+	run_tasks ();
+      __sync_fetch_and_sub (&job.busy, 1);
+      seen = gen;
+      idle = 0;
+    }
+  __sync_fetch_and_sub (&job.running, 1);
+}
+
+static void
+start_aps (void)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_status_t status;
+
+  if (job.running)
+    return;
+  /* The previous run may still be on its way back to the firmware.  */
+  if (aps_started)
+    {
+      if (efi_call_1 (b->check_event, ap_event) != GRUB_EFI_SUCCESS)
+	return;
+      aps_started = 0;
+    }
+
+  job.quit = 0;
+  status = efi_call_7 (mp_services->startup_all_aps, mp_services,
+		       (grub_efi_ap_procedure_t) ap_worker, 0, ap_event,
+		       0, 0, 0);
+  if (status == GRUB_EFI_SUCCESS)
+    aps_started = 1;
+  else
+    grub_dprintf ("mp", "couldn't start APs: %lx\n", (unsigned long) status);
+}
+
+static void
+stop_aps (void)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_uint64_t limit;
+
+  if (!aps_started)
+    return;
+
+  job.quit = 1;
+  limit = grub_get_time_ms () + 1000;
+  while (efi_call_1 (b->check_event, ap_event) != GRUB_EFI_SUCCESS)
+    if (grub_get_time_ms () > limit)
+      {
+	grub_dprintf ("mp", "APs didn't stop\n");
+	break;
+      }
+  aps_started = 0;
+}
+
+static grub_err_t
+grub_mp_preboot (int noreturn __attribute__ ((unused)))
+{
+  stop_aps ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_mp_restore (void)
+{
+  return GRUB_ERR_NONE;
+}
+
+unsigned int
+grub_mp_nproc (void)
+{
+  grub_efi_boot_services_t *b;
+  grub_efi_uintn_t total, enabled;
+
+  if (nproc)
+    return nproc;
+
+  nproc = 1;
+  mp_services = grub_efi_locate_protocol (&mp_services_guid, 0);
+  if (!mp_services)
+    return nproc;
+  if (efi_call_3 (mp_services->get_number_of_processors, mp_services,
+		  &total, &enabled) != GRUB_EFI_SUCCESS || enabled < 2)
+    return nproc;
+
+  b = grub_efi_system_table->boot_services;
+  if (efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK, 0, 0,
+		  &ap_event) != GRUB_EFI_SUCCESS)
+    return nproc;
+
+  nproc = enabled;
+  grub_dprintf ("mp", "%u processors\n", nproc);
+  return nproc;
+}
+
+void
+grub_mp_run (grub_mp_task_t task, void *data, unsigned int count)
+{
+  unsigned int i;
+
+  if (count < 2 || grub_mp_nproc () < 2)
+    {
+      for (i = 0; i < count; i++)
+	task (data, i);
+      return;
+    }
+
+  start_aps ();
+
+  job.task = task;
+  job.data = data;
+  job.count = count;
+  job.next = 0;
+  job.done = 0;
+  __sync_synchronize ();
+  job.generation++;
+  __sync_synchronize ();
+  job.active = 1;
+
+  /* The BSP takes its share, the APs pick up the rest if running.  */
+  run_tasks ();
+  while (job.done != count)
+    cpu_relax ();
+
+  job.active = 0;
+  __sync_synchronize ();
+  while (job.busy)
+    cpu_relax ();
+}
+
+GRUB_MOD_INIT(mp)
+{
+  preboot_hnd = grub_loader_register_preboot_hook (grub_mp_preboot,
+						   grub_mp_restore,
+						   GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+}
+
+GRUB_MOD_FINI(mp)
+{
+  stop_aps ();
+  grub_loader_unregister_preboot_hook (preboot_hnd);
+  if (ap_event)
+    efi_call_1 (grub_efi_system_table->boot_services->close_event, ap_event);
+}
+
+#else
+
+unsigned int
+grub_mp_nproc (void)
+{
+  return 1;
+}
+
+void
+grub_mp_run (grub_mp_task_t task, void *data, unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; i++)
+    task (data, i);
+}
+
+#endif
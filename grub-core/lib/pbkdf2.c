@@ -32,6 +32,24 @@ GRUB_MOD_LICENSE ("GPLv2+");
    must have room for at least DKLEN octets.  The output buffer will
    be filled with the derived data.  */
 
+/* Compute HMAC (K, DATA) into OUT, with ICTX and OCTX the states of MD
+   after hashing K xor ipad and K xor opad, and CTX room for another.  */
+static void
+hmac_prf (const struct gcry_md_spec *md, const void *ictx, const void *octx,
+	  void *ctx, const grub_uint8_t *data, grub_size_t len,
+	  grub_uint8_t *out)
+{
+  grub_memcpy (ctx, ictx, md->contextsize);
+  md->write (ctx, data, len);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), md->mdlen);
+
+  grub_memcpy (ctx, octx, md->contextsize);
+  md->write (ctx, out, md->mdlen);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), md->mdlen);
+}
+
 gcry_err_code_t
 grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    const grub_uint8_t *P, grub_size_t Plen,
@@ -47,13 +65,18 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   unsigned int r;
   unsigned int i;
   unsigned int k;
-  gcry_err_code_t rc;
+  grub_uint8_t *mem, *ictx, *octx, *ctx, *pad;
   grub_uint8_t *tmp;
   grub_size_t tmplen = Slen + 4;
+  grub_size_t csize = ALIGN_UP (md->contextsize, 16);
+  grub_size_t memlen = 3 * csize + md->blocksize + tmplen;
 
   if (md->mdlen > GRUB_CRYPTO_MAX_MDLEN || md->mdlen == 0)
     return GPG_ERR_INV_ARG;
 
+  if (md->mdlen > md->blocksize)
+    return GPG_ERR_INV_ARG;
+
   if (c == 0)
     return GPG_ERR_INV_ARG;
 
@@ -66,12 +89,35 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   l = ((dkLen - 1) / hLen) + 1;
   r = dkLen - (l - 1) * hLen;
 
-  tmp = grub_malloc (tmplen);
-  if (tmp == NULL)
+  mem = grub_malloc (memlen);
+  if (mem == NULL)
     return GPG_ERR_OUT_OF_MEMORY;
+  ictx = mem;
+  octx = ictx + csize;
+  ctx = octx + csize;
+  pad = ctx + csize;
+  tmp = pad + md->blocksize;
 
   grub_memcpy (tmp, S, Slen);
 
+  /* The key of the HMAC is always the password, so hash the padded keys
+     only once and start every iteration from copies of the states.  */
+  grub_memset (pad, 0, md->blocksize);
+  if (Plen > md->blocksize)
+    grub_crypto_hash (md, pad, P, Plen);
+  else
+    grub_memcpy (pad, P, Plen);
+
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36;
+  md->init (ictx);
+  md->write (ictx, pad, md->blocksize);
+
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36 ^ 0x5c;
+  md->init (octx);
+  md->write (octx, pad, md->blocksize);
+
   for (i = 1; i - 1 < l; i++)
     {
       grub_memset (T, 0, hLen);
@@ -85,16 +131,10 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 	      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
 	      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
 
-	      rc = grub_crypto_hmac_buffer (md, P, Plen, tmp, tmplen, U);
+	      hmac_prf (md, ictx, octx, ctx, tmp, tmplen, U);
 	    }
 	  else
-	    rc = grub_crypto_hmac_buffer (md, P, Plen, U, hLen, U);
-
-	  if (rc != GPG_ERR_NO_ERROR)
-	    {
-	      grub_free (tmp);
-	      return rc;
-	    }
+	    hmac_prf (md, ictx, octx, ctx, U, hLen, U);
 
 	  for (k = 0; k < hLen; k++)
 	    T[k] ^= U[k];
@@ -103,7 +143,8 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
       grub_memcpy (DK + (i - 1) * hLen, T, i == l ? r : hLen);
     }
 
-  grub_free (tmp);
+  grub_memset (mem, 0, memlen);
+  grub_free (mem);
 
   return GPG_ERR_NO_ERROR;
 }
@@ -29,6 +29,31 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define UPDATE_INTERVAL 800
 
+/* The read hook runs for every block read, and reading the clock can be
+   expensive (BIOS or firmware calls), so the hook only counts bytes until
+   check_bytes have been read.  check_bytes follows the load speed so that
+   the clock is looked at about every CHECK_INTERVAL ms.  */
+#define CHECK_INTERVAL 100
+#define CHECK_BYTES_MIN 4096
+#define CHECK_BYTES_MAX (64 << 20)
+
+static grub_size_t check_bytes = 65536;
+static grub_size_t bytes_since_check;
+static grub_uint64_t last_check_time;
+
+static void
+update_check_bytes (grub_uint64_t now)
+{
+  grub_uint64_t elapsed = now - last_check_time;
+
+  if (elapsed < CHECK_INTERVAL / 2 && check_bytes < CHECK_BYTES_MAX)
+    check_bytes <<= 1;
+  else if (elapsed > CHECK_INTERVAL * 2 && check_bytes > CHECK_BYTES_MIN)
+    check_bytes >>= 1;
+  last_check_time = now;
+  bytes_since_check = 0;
+}
+
 static void
 grub_file_progress_hook_real (grub_disk_addr_t sector __attribute__ ((unused)),
                               unsigned offset __attribute__ ((unused)),
@@ -40,17 +65,26 @@ grub_file_progress_hook_real (grub_disk_addr_t sector __attribute__ ((unused)),
   grub_file_t file = data;
   const char *e;
   file->progress_offset += length;
+  bytes_since_check += length;
 
   if (call_depth)
     return;
 
+  if (bytes_since_check < check_bytes && file->progress_offset != file->size)
+    return;
+
+  now = grub_get_time_ms ();
+  update_check_bytes (now);
+
   e = grub_env_get ("enable_progress_indicator");
   if (e && e[0] == '0') {
     return;
   }
 
   call_depth = 1;
-  now = grub_get_time_ms ();
+
+  if (grub_file_progress_notify_hook)
+    grub_file_progress_notify_hook (file);
 
   if (((now - last_progress_update_time > UPDATE_INTERVAL) &&
        (file->progress_offset - file->offset > 0)) ||
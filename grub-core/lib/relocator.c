@@ -27,6 +27,13 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* A range of addresses taken by the targets of chunks.  */
+struct grub_relocator_range
+{
+  grub_phys_addr_t start;
+  grub_phys_addr_t end;
+};
+
 struct grub_relocator
 {
   struct grub_relocator_chunk *chunks;
@@ -34,6 +41,11 @@ struct grub_relocator
   grub_phys_addr_t highestaddr;
   grub_phys_addr_t highestnonpostaddr;
   grub_size_t relocators_size;
+  /* The targets of CHUNKS, sorted, with adjacent ones merged, so that
+     checking a new chunk against them doesn't need to visit every chunk.  */
+  struct grub_relocator_range *taken;
+  unsigned ntaken;
+  unsigned alloc_taken;
 };
 
 struct grub_relocator_subchunk
@@ -116,6 +128,88 @@ grub_relocator_new (void)
   return ret;
 }
 
+/* Return the index of the first taken range ending after ADDR.  */
+static unsigned
+taken_find (struct grub_relocator *rel, grub_phys_addr_t addr)
+{
+  unsigned lo = 0, hi = rel->ntaken;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+      if (rel->taken[mid].end <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Return the taken range overlapping SIZE bytes at START, if any.  */
+static struct grub_relocator_range *
+taken_overlap (struct grub_relocator *rel, grub_phys_addr_t start,
+	       grub_size_t size)
+{
+  unsigned i = taken_find (rel, start);
+
+  if (i < rel->ntaken && rel->taken[i].start < start + size)
+    return &rel->taken[i];
+  return NULL;
+}
+
+/* Make room for the range of one more chunk, before allocating it, so that
+   recording it can't fail.  */
+static grub_err_t
+taken_reserve (struct grub_relocator *rel)
+{
+  struct grub_relocator_range *n;
+  unsigned alloc;
+
+  if (rel->ntaken < rel->alloc_taken)
+    return GRUB_ERR_NONE;
+  alloc = rel->alloc_taken ? 2 * rel->alloc_taken : 8;
+  n = grub_realloc (rel->taken, alloc * sizeof (rel->taken[0]));
+  if (!n)
+    return grub_errno;
+  rel->taken = n;
+  rel->alloc_taken = alloc;
+  return GRUB_ERR_NONE;
+}
+
+/* Record SIZE bytes at START as taken.  They must not overlap any taken
+   range.  */
+static void
+taken_add (struct grub_relocator *rel, grub_phys_addr_t start,
+	   grub_size_t size)
+{
+  grub_phys_addr_t end = start + size;
+  unsigned i = taken_find (rel, start);
+  int prev = (i > 0 && rel->taken[i - 1].end == start);
+  int next = (i < rel->ntaken && rel->taken[i].start == end);
+
+  if (size == 0)
+    return;
+  if (prev && next)
+    {
+      rel->taken[i - 1].end = rel->taken[i].end;
+      grub_memmove (&rel->taken[i], &rel->taken[i + 1],
+		    (rel->ntaken - i - 1) * sizeof (rel->taken[0]));
+      rel->ntaken--;
+    }
+  else if (prev)
+    rel->taken[i - 1].end = end;
+  else if (next)
+    rel->taken[i].start = start;
+  else
+    {
+      grub_memmove (&rel->taken[i + 1], &rel->taken[i],
+		    (rel->ntaken - i) * sizeof (rel->taken[0]));
+      rel->taken[i].start = start;
+      rel->taken[i].end = end;
+      rel->ntaken++;
+    }
+}
+
 #define DIGITSORT_BITS 8
 #define DIGITSORT_MASK ((1 << DIGITSORT_BITS) - 1)
 #define BITS_IN_BYTE 8
@@ -439,6 +533,9 @@ malloc_in_range (struct grub_relocator *rel,
   if (end < start + size)
     return 0;
 
+  /* Let blocks sitting in the allocator bins be part of the free space.  */
+  grub_mm_flush_bins ();
+
   /* We have to avoid any allocations when filling scanline events. 
      Hence 2-stages.
    */
@@ -458,11 +555,7 @@ malloc_in_range (struct grub_relocator *rel,
     }
 
   if (collisioncheck && rel)
-    {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
-	maxevents += 2;
-    }
+    maxevents += 2 * rel->ntaken;
 
 #if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
   {
@@ -510,14 +603,14 @@ malloc_in_range (struct grub_relocator *rel,
 
   if (collisioncheck && rel)
     {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
+      unsigned i;
+      for (i = 0; i < rel->ntaken; i++)
 	{
 	  events[N].type = COLLISION_START;
-	  events[N].pos = chunk->target;
+	  events[N].pos = rel->taken[i].start;
 	  N++;
 	  events[N].type = COLLISION_END;
-	  events[N].pos = chunk->target + chunk->size;
+	  events[N].pos = rel->taken[i].end;
 	  N++;
 	}
     }
@@ -1236,10 +1329,11 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 
   adjust_limits (rel, &min_addr, &max_addr, target, target);
 
-  for (chunk = rel->chunks; chunk; chunk = chunk->next)
-    if ((chunk->target <= target && target < chunk->target + chunk->size)
-	|| (target <= chunk->target && chunk->target < target + size))
-      return grub_error (GRUB_ERR_BUG, "overlap detected");
+  if (taken_overlap (rel, target, size))
+    return grub_error (GRUB_ERR_BUG, "overlap detected");
+
+  if (taken_reserve (rel))
+    return grub_errno;
 
   chunk = grub_malloc (sizeof (struct grub_relocator_chunk));
   if (!chunk)
@@ -1316,6 +1410,7 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
   chunk->size = size;
   chunk->next = rel->chunks;
   rel->chunks = chunk;
+  taken_add (rel, target, size);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
 
@@ -1396,6 +1491,9 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 
   grub_dprintf ("relocator", "chunks = %p\n", rel->chunks);
 
+  if (taken_reserve (rel))
+    return grub_errno;
+
   ctx.chunk = grub_malloc (sizeof (struct grub_relocator_chunk));
   if (!ctx.chunk)
     return grub_errno;
@@ -1412,6 +1510,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
       ctx.chunk->size = size;
       ctx.chunk->next = rel->chunks;
       rel->chunks = ctx.chunk;
+      taken_add (rel, ctx.chunk->target, size);
       ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
       *out = ctx.chunk;
       return GRUB_ERR_NONE;
@@ -1456,22 +1555,21 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   }
   while (1)
     {
-      struct grub_relocator_chunk *chunk2;
-      for (chunk2 = rel->chunks; chunk2; chunk2 = chunk2->next)
-	if ((chunk2->target <= ctx.chunk->target
-	     && ctx.chunk->target < chunk2->target + chunk2->size)
-	    || (ctx.chunk->target <= chunk2->target && chunk2->target
-		< ctx.chunk->target + size))
-	  {
-	    if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
-	      ctx.chunk->target = ALIGN_DOWN (chunk2->target, align);
-	    else
-	      ctx.chunk->target = ALIGN_UP (chunk2->target + chunk2->size,
-					    align);
-	    break;
-	  }
-      if (!chunk2)
+      struct grub_relocator_range *r;
+
+      r = taken_overlap (rel, ctx.chunk->target, size);
+      if (!r)
 	break;
+      if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
+	{
+	  if (r->start < size
+	      || ALIGN_DOWN (r->start - size, align) < min_addr)
+	    return grub_error (GRUB_ERR_BAD_OS,
+			       "couldn't find suitable memory target");
+	  ctx.chunk->target = ALIGN_DOWN (r->start - size, align);
+	}
+      else
+	ctx.chunk->target = ALIGN_UP (r->end, align);
     }
 
   grub_dprintf ("relocator", "relocators_size=%ld\n",
@@ -1488,6 +1586,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   ctx.chunk->size = size;
   ctx.chunk->next = rel->chunks;
   rel->chunks = ctx.chunk;
+  taken_add (rel, ctx.chunk->target, size);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
   ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
@@ -1515,6 +1614,7 @@ grub_relocator_unload (struct grub_relocator *rel)
       grub_free (chunk->subchunks);
       grub_free (chunk);
     }
+  grub_free (rel->taken);
   grub_free (rel);
 }
 
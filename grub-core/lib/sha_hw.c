@@ -0,0 +1,399 @@
+/* sha_hw.c - SHA-2 using the instructions of the CPU.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/crypto.h>
+#include <grub/sha_hw.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+struct sha256_hw_context
+{
+  grub_uint32_t h[8];
+  /* Bytes hashed so far, the partial block of which is in BUF.  */
+  grub_uint64_t count;
+  /* Holds the digest once finalized.  */
+  grub_uint8_t buf[64];
+};
+
+const grub_uint32_t grub_sha256_hw_k[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+static void
+sha224_hw_init (void *c)
+{
+  static const grub_uint32_t iv[8] =
+    {
+      0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+      0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+    };
+  struct sha256_hw_context *ctx = c;
+
+  grub_memcpy (ctx->h, iv, sizeof (iv));
+  ctx->count = 0;
+}
+
+static void
+sha256_hw_init (void *c)
+{
+  static const grub_uint32_t iv[8] =
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+  struct sha256_hw_context *ctx = c;
+
+  grub_memcpy (ctx->h, iv, sizeof (iv));
+  ctx->count = 0;
+}
+
+static void
+sha256_hw_write (void *c, const void *buf, grub_size_t len)
+{
+  struct sha256_hw_context *ctx = c;
+  const grub_uint8_t *in = buf;
+  unsigned used = ctx->count & 63;
+
+  ctx->count += len;
+
+  if (used)
+    {
+      unsigned n = 64 - used;
+
+      if (n > len)
+	n = len;
+      grub_memcpy (ctx->buf + used, in, n);
+      in += n;
+      len -= n;
+      if (used + n < 64)
+	return;
+      grub_sha256_hw_blocks (ctx->h, ctx->buf, 1);
+    }
+
+  if (len >= 64)
+    {
+      grub_sha256_hw_blocks (ctx->h, in, len / 64);
+      in += len & ~(grub_size_t) 63;
+      len &= 63;
+    }
+
+  grub_memcpy (ctx->buf, in, len);
+}
+
+static void
+sha256_hw_final (void *c)
+{
+  struct sha256_hw_context *ctx = c;
+  unsigned used = ctx->count & 63;
+  grub_uint64_t bits = grub_cpu_to_be64 (ctx->count << 3);
+  unsigned i;
+
+  ctx->buf[used++] = 0x80;
+  if (used > 56)
+    {
+      grub_memset (ctx->buf + used, 0, 64 - used);
+      grub_sha256_hw_blocks (ctx->h, ctx->buf, 1);
+      used = 0;
+    }
+  grub_memset (ctx->buf + used, 0, 56 - used);
+  grub_memcpy (ctx->buf + 56, &bits, sizeof (bits));
+  grub_sha256_hw_blocks (ctx->h, ctx->buf, 1);
+
+  for (i = 0; i < 8; i++)
+    {
+      grub_uint32_t w = grub_cpu_to_be32 (ctx->h[i]);
+
+      grub_memcpy (ctx->buf + 4 * i, &w, sizeof (w));
+    }
+}
+
+static grub_uint8_t *
+sha256_hw_read (void *c)
+{
+  struct sha256_hw_context *ctx = c;
+
+  return ctx->buf;
+}
+
+#ifdef GRUB_SHA_HW_HAVE_SHA512
+
+struct sha512_hw_context
+{
+  grub_uint64_t h[8];
+  /* Bytes hashed so far, the partial block of which is in BUF.  */
+  grub_uint64_t count;
+  /* Holds the digest once finalized.  */
+  grub_uint8_t buf[128];
+};
+
+const grub_uint64_t grub_sha512_hw_k[80] =
+  {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+    0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+    0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+    0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+    0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+    0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+    0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+    0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+    0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+    0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+    0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+  };
+
+static void
+sha384_hw_init (void *c)
+{
+  static const grub_uint64_t iv[8] =
+    {
+      0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+      0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+      0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+      0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL
+    };
+  struct sha512_hw_context *ctx = c;
+
+  grub_memcpy (ctx->h, iv, sizeof (iv));
+  ctx->count = 0;
+}
+
+static void
+sha512_hw_init (void *c)
+{
+  static const grub_uint64_t iv[8] =
+    {
+      0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+      0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+      0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+      0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+    };
+  struct sha512_hw_context *ctx = c;
+
+  grub_memcpy (ctx->h, iv, sizeof (iv));
+  ctx->count = 0;
+}
+
+static void
+sha512_hw_write (void *c, const void *buf, grub_size_t len)
+{
+  struct sha512_hw_context *ctx = c;
+  const grub_uint8_t *in = buf;
+  unsigned used = ctx->count & 127;
+
+  ctx->count += len;
+
+  if (used)
+    {
+      unsigned n = 128 - used;
+
+      if (n > len)
+	n = len;
+      grub_memcpy (ctx->buf + used, in, n);
+      in += n;
+      len -= n;
+      if (used + n < 128)
+	return;
+      grub_sha512_hw_blocks (ctx->h, ctx->buf, 1);
+    }
+
+  if (len >= 128)
+    {
+      grub_sha512_hw_blocks (ctx->h, in, len / 128);
+      in += len & ~(grub_size_t) 127;
+      len &= 127;
+    }
+
+  grub_memcpy (ctx->buf, in, len);
+}
+
+static void
+sha512_hw_final (void *c)
+{
+  struct sha512_hw_context *ctx = c;
+  unsigned used = ctx->count & 127;
+  grub_uint64_t bits = grub_cpu_to_be64 (ctx->count << 3);
+  grub_uint64_t high = grub_cpu_to_be64 (ctx->count >> 61);
+  unsigned i;
+
+  ctx->buf[used++] = 0x80;
+  if (used > 112)
+    {
+      grub_memset (ctx->buf + used, 0, 128 - used);
+      grub_sha512_hw_blocks (ctx->h, ctx->buf, 1);
+      used = 0;
+    }
+  grub_memset (ctx->buf + used, 0, 112 - used);
+  grub_memcpy (ctx->buf + 112, &high, sizeof (high));
+  grub_memcpy (ctx->buf + 120, &bits, sizeof (bits));
+  grub_sha512_hw_blocks (ctx->h, ctx->buf, 1);
+
+  for (i = 0; i < 8; i++)
+    {
+      grub_uint64_t w = grub_cpu_to_be64 (ctx->h[i]);
+
+      grub_memcpy (ctx->buf + 8 * i, &w, sizeof (w));
+    }
+}
+
+static grub_uint8_t *
+sha512_hw_read (void *c)
+{
+  struct sha512_hw_context *ctx = c;
+
+  return ctx->buf;
+}
+
+#endif
+
+/* The portable implementations, whose ASN.1 prefixes and OIDs are shared.
+   Using them also makes this module depend on gcry_sha256 and gcry_sha512,
+   so that it is always registered after them and found first.  */
+extern gcry_md_spec_t _gcry_digest_spec_sha224;
+#ifdef GRUB_SHA_HW_HAVE_SHA512
+extern gcry_md_spec_t _gcry_digest_spec_sha384;
+#endif
+
+static gcry_md_spec_t sha_hw_specs[] =
+  {
+    {
+      .name = "SHA224",
+      .mdlen = 28,
+      .init = sha224_hw_init,
+      .write = sha256_hw_write,
+      .final = sha256_hw_final,
+      .read = sha256_hw_read,
+      .contextsize = sizeof (struct sha256_hw_context),
+      .blocksize = 64
+    },
+    {
+      .name = "SHA256",
+      .mdlen = 32,
+      .init = sha256_hw_init,
+      .write = sha256_hw_write,
+      .final = sha256_hw_final,
+      .read = sha256_hw_read,
+      .contextsize = sizeof (struct sha256_hw_context),
+      .blocksize = 64
+    },
+#ifdef GRUB_SHA_HW_HAVE_SHA512
+    {
+      .name = "SHA384",
+      .mdlen = 48,
+      .init = sha384_hw_init,
+      .write = sha512_hw_write,
+      .final = sha512_hw_final,
+      .read = sha512_hw_read,
+      .contextsize = sizeof (struct sha512_hw_context),
+      .blocksize = 128
+    },
+    {
+      .name = "SHA512",
+      .mdlen = 64,
+      .init = sha512_hw_init,
+      .write = sha512_hw_write,
+      .final = sha512_hw_final,
+      .read = sha512_hw_read,
+      .contextsize = sizeof (struct sha512_hw_context),
+      .blocksize = 128
+    }
+#endif
+  };
+
+GRUB_MOD_INIT(sha_hw)
+{
+  const gcry_md_spec_t *soft[ARRAY_SIZE (sha_hw_specs)] =
+    {
+      &_gcry_digest_spec_sha224,
+      &_gcry_digest_spec_sha256,
+#ifdef GRUB_SHA_HW_HAVE_SHA512
+      &_gcry_digest_spec_sha384,
+      &_gcry_digest_spec_sha512
+#endif
+    };
+  int supported = grub_sha_hw_supported ();
+  unsigned i;
+
+  /* Leave the digests without instructions to the portable code.  */
+  for (i = 0; i < ARRAY_SIZE (sha_hw_specs); i++)
+    {
+      if (! (supported & (sha_hw_specs[i].blocksize == 64
+			  ? GRUB_SHA_HW_SHA256 : GRUB_SHA_HW_SHA512)))
+	continue;
+      sha_hw_specs[i].asnoid = soft[i]->asnoid;
+      sha_hw_specs[i].asnlen = soft[i]->asnlen;
+      sha_hw_specs[i].oids = soft[i]->oids;
+      grub_md_register (&sha_hw_specs[i]);
+    }
+}
+
+GRUB_MOD_FINI(sha_hw)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (sha_hw_specs); i++)
+    grub_md_unregister (&sha_hw_specs[i]);
+}
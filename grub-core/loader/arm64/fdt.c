@@ -56,7 +56,8 @@ grub_fdt_load (grub_size_t additional_size)
 
   if (raw_fdt)
     {
-      grub_memmove (fdt, raw_fdt, size);
+      /* Only the tree itself is there to copy.  */
+      grub_memmove (fdt, raw_fdt, grub_fdt_get_totalsize (raw_fdt));
       grub_fdt_set_totalsize (fdt, size);
     }
   else
@@ -86,15 +86,18 @@ finalize_params_linux (void)
   /* Set initrd info */
   if (initrd_start && initrd_end > initrd_start)
     {
+      grub_uint64_t start = grub_cpu_to_be64 (initrd_start);
+      grub_uint64_t end = grub_cpu_to_be64 (initrd_end);
+      struct grub_fdt_prop props[] =
+	{
+	  { "linux,initrd-start", &start, sizeof (start) },
+	  { "linux,initrd-end", &end, sizeof (end) }
+	};
+
       grub_dprintf ("linux", "Initrd @ 0x%012lx-0x%012lx\n",
 		    initrd_start, initrd_end);
 
-      retval = grub_fdt_set_prop64 (fdt, node, "linux,initrd-start",
-				    initrd_start);
-      if (retval)
-	goto failure;
-      retval = grub_fdt_set_prop64 (fdt, node, "linux,initrd-end",
-				    initrd_end);
+      retval = grub_fdt_set_props (fdt, node, props, ARRAY_SIZE (props));
       if (retval)
 	goto failure;
     }
@@ -351,4 +354,5 @@ GRUB_MOD_FINI (linux)
 {
   grub_unregister_command (cmd_linux);
   grub_unregister_command (cmd_initrd);
+  grub_initrd_cache_free ();
 }
@@ -57,7 +57,8 @@ grub_chainloader_unload (void)
 
   b = grub_efi_system_table->boot_services;
   efi_call_1 (b->unload_image, image_handle);
-  efi_call_2 (b->free_pages, address, pages);
+  if (address)
+    efi_call_2 (b->free_pages, address, pages);
 
   grub_free (file_path);
   grub_free (cmdline);
@@ -187,6 +188,73 @@ make_file_path (grub_efi_device_path_t *dp, const char *filename)
   return file_path;
 }
 
+/* Let the firmware load FILE itself when it sits on a filesystem the
+   firmware can read, which saves reading the whole image into memory
+   first.  This is only done when GRUB has nothing to do with the contents:
+   no signature to verify, no decompression and no fat binary to pick an
+   architecture from.  Return the handle of the image, or 0 to use the
+   buffer.  */
+static grub_efi_handle_t
+load_image_from_device (grub_file_t file, const char *filename)
+{
+  grub_efi_guid_t sfs_guid = GRUB_EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_handle_t handle, image = 0;
+  grub_efi_device_path_t *dp, *fp;
+  grub_efi_status_t status;
+
+  if (grub_file_filters_all[GRUB_FILE_FILTER_PUBKEY]
+      || ! file->fs->dir || ! file->device->disk)
+    return 0;
+
+  handle = grub_efidisk_get_device_handle (file->device->disk);
+  if (! handle
+      || ! grub_efi_open_protocol (handle, &sfs_guid,
+				   GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL))
+    return 0;
+
+#if defined (__i386__) || defined (__x86_64__)
+  {
+    grub_uint32_t magic;
+
+    if (grub_file_read (file, &magic, sizeof (magic)) != sizeof (magic))
+      {
+	grub_errno = GRUB_ERR_NONE;
+	grub_file_seek (file, 0);
+	return 0;
+      }
+    grub_file_seek (file, 0);
+    if (magic == grub_cpu_to_le32_compile_time (GRUB_MACHO_FAT_EFI_MAGIC))
+      return 0;
+  }
+#endif
+
+  dp = grub_efi_get_device_path (handle);
+  if (! dp)
+    return 0;
+  fp = make_file_path (dp, filename);
+  if (! fp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  status = efi_call_6 (b->load_image, 0, grub_efi_image_handle, fp,
+		       0, 0, &image);
+  grub_free (fp);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      grub_dprintf ("chain", "firmware couldn't load %s: %lx\n", filename,
+		    (unsigned long) status);
+      /* A refused image may still have been loaded.  */
+      if (image)
+	efi_call_1 (b->unload_image, image);
+      return 0;
+    }
+
+  return image;
+}
+
 static grub_err_t
 grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 		      int argc, char *argv[])
@@ -201,6 +269,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
   char *filename;
   void *boot_image = 0;
   grub_efi_handle_t dev_handle = 0;
+  grub_size_t io_align;
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
@@ -260,6 +329,19 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
   grub_printf ("file path: ");
   grub_efi_print_device_path (file_path);
 
+  image_handle = load_image_from_device (file, filename);
+  if (image_handle)
+    {
+      /* The firmware has set the device handle and file path itself.  */
+      loaded_image = grub_efi_get_loaded_image (image_handle);
+      if (! loaded_image)
+	{
+	  grub_error (GRUB_ERR_BAD_OS, "no loaded image available");
+	  goto fail;
+	}
+      goto loaded;
+    }
+
   size = grub_file_size (file);
   if (!size)
     {
@@ -267,7 +349,14 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 		  filename);
       goto fail;
     }
-  pages = (((grub_efi_uintn_t) size + ((1 << 12) - 1)) >> 12);
+  /* Pages are aligned well enough for most media.  For the rest, leave
+     room to align the image, so that it is read without a bounce buffer.  */
+  io_align = file->device->disk
+    ? grub_efidisk_get_io_align (file->device->disk) : 1;
+  if (io_align < (1 << 12))
+    io_align = 1 << 12;
+  pages = (((grub_efi_uintn_t) size + io_align - (1 << 12)
+	    + ((1 << 12) - 1)) >> 12);
 
   status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ANY_PAGES,
 			      GRUB_EFI_LOADER_CODE,
@@ -280,7 +369,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
-  boot_image = (void *) ((grub_addr_t) address);
+  boot_image = (void *) ALIGN_UP ((grub_addr_t) address, io_align);
   if (grub_file_read (file, boot_image, size) != size)
     {
       if (grub_errno == GRUB_ERR_NONE)
@@ -350,6 +439,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
     }
   loaded_image->device_handle = dev_handle;
 
+ loaded:
   if (argc > 1)
     {
       int i, len;
@@ -395,6 +485,9 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 
   grub_free (file_path);
 
+  if (image_handle)
+    efi_call_1 (b->unload_image, image_handle);
+
   if (address)
     efi_call_2 (b->free_pages, address, pages);
 
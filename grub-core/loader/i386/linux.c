@@ -35,6 +35,7 @@
 #include <grub/i18n.h>
 #include <grub/lib/cmdline.h>
 #include <grub/linux.h>
+#include <grub/boottime.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -68,6 +69,8 @@ static void *prot_mode_mem;
 static grub_addr_t prot_mode_target;
 static void *initrd_mem;
 static grub_addr_t initrd_mem_target;
+/* The initrd given with --defer, read into INITRD_MEM at boot.  */
+static struct grub_linux_initrd_context initrd_deferred;
 static grub_size_t prot_init_space;
 static struct grub_relocator *relocator = NULL;
 static void *efi_mmap_buf;
@@ -112,37 +115,24 @@ find_efi_mmap_size (void)
   if (mmap_size != 0)
     return mmap_size;
 
-  mmap_size = (1 << 12);
-  while (1)
-    {
-      int ret;
-      grub_efi_memory_descriptor_t *mmap;
-      grub_efi_uintn_t desc_size;
-      grub_efi_uintn_t cur_mmap_size = mmap_size;
+  /* A query with an empty buffer already tells the required size, so
+     there is no need to probe with growing buffers.  */
+  {
+    int ret;
+    grub_efi_uintn_t desc_size;
 
-      mmap = grub_malloc (cur_mmap_size);
-      if (! mmap)
+    ret = grub_efi_get_memory_map (&mmap_size, NULL, 0, &desc_size, 0);
+    if (ret < 0)
+      {
+	mmap_size = 0;
+	grub_error (GRUB_ERR_IO, "cannot get memory map");
 	return 0;
-
-      ret = grub_efi_get_memory_map (&cur_mmap_size, mmap, 0, &desc_size, 0);
-      grub_free (mmap);
-
-      if (ret < 0)
-	{
-	  grub_error (GRUB_ERR_IO, "cannot get memory map");
-	  return 0;
-	}
-      else if (ret > 0)
-	break;
-
-      if (mmap_size < cur_mmap_size)
-	mmap_size = cur_mmap_size;
-      mmap_size += (1 << 12);
-    }
+      }
+  }
 
   /* Increase the size a bit for safety, because GRUB allocates more on
      later, and EFI itself may allocate more.  */
-  mmap_size += (3 << 12);
+  mmap_size += (4 << 12);
 
   mmap_size = page_align (mmap_size);
   return mmap_size;
@@ -182,6 +172,7 @@ find_mmap_size (void)
 static void
 free_pages (void)
 {
+  grub_initrd_close (&initrd_deferred);
   grub_relocator_unload (relocator);
   relocator = NULL;
   prot_mode_mem = initrd_mem = 0;
@@ -439,6 +430,28 @@ grub_linux_boot_mmap_fill (grub_uint64_t addr, grub_uint64_t size,
   return 0;
 }
 
+/* Read the initrd given with --defer.  This runs as a preboot hook, before
+   the disk drivers are stopped.  */
+static grub_err_t
+grub_linux_load_deferred (int flags __attribute__ ((unused)))
+{
+  grub_err_t err;
+
+  if (! initrd_deferred.components)
+    return GRUB_ERR_NONE;
+
+  grub_dprintf ("linux", "Reading the deferred initrd\n");
+  err = grub_initrd_load (&initrd_deferred, NULL, initrd_mem);
+  grub_initrd_close (&initrd_deferred);
+  return err;
+}
+
+static grub_err_t
+grub_linux_load_deferred_rest (void)
+{
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_linux_boot (void)
 {
@@ -668,14 +681,14 @@ grub_linux_unload (void)
 {
   grub_dl_unref (my_mod);
   loaded = 0;
+  grub_initrd_close (&initrd_deferred);
   grub_free (linux_cmdline);
   linux_cmdline = 0;
   return GRUB_ERR_NONE;
 }
 
 static grub_err_t
-grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
-		int argc, char *argv[])
+grub_cmd_linux_real (int argc, char *argv[])
 {
   grub_file_t file = 0;
   struct linux_kernel_header lh;
@@ -695,6 +708,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
+  grub_file_filter_defer_verification ();
   file = grub_file_open (argv[0]);
   if (! file)
     goto fail;
@@ -759,6 +773,10 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   real_size = setup_sects << GRUB_DISK_SECTOR_BITS;
   prot_file_size = grub_file_size (file) - real_size - GRUB_DISK_SECTOR_SIZE;
 
+  /* Have the kernel fetched while memory for it is found.  */
+  grub_file_prefetch (file, real_size + GRUB_DISK_SECTOR_SIZE,
+		      prot_file_size);
+
   if (grub_le_to_cpu16 (lh.version) >= 0x205
       && lh.kernel_alignment != 0
       && ((lh.kernel_alignment - 1) & lh.kernel_alignment) == 0)
@@ -1016,7 +1034,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
 			      - (sizeof (LINUX_IMAGE) - 1));
 
   len = prot_file_size;
-  if (grub_file_read (file, prot_mode_mem, len) != len && !grub_errno)
+  if (grub_linux_file_read (file, prot_mode_mem, len) != len && !grub_errno)
     grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
 		argv[0]);
 
@@ -1041,15 +1059,39 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   return grub_errno;
 }
 
+static grub_err_t
+grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
+		int argc, char *argv[])
+{
+  grub_uint64_t start;
+  grub_err_t err;
+
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_LOADER);
+  err = grub_cmd_linux_real (argc, argv);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_LOADER, start, "linux");
+
+  return err;
+}
+
 static grub_err_t
 grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 		 int argc, char *argv[])
 {
-  grub_size_t size = 0, aligned_size = 0;
+  grub_size_t size = 0, aligned_size = 0, align;
   grub_addr_t addr_min, addr_max;
   grub_addr_t addr;
   grub_err_t err;
   struct grub_linux_initrd_context initrd_ctx = { 0, 0, 0 };
+  int defer = 0;
+  void *mem;
+  grub_addr_t mem_target;
+
+  if (argc > 0 && grub_strcmp (argv[0], "--defer") == 0)
+    {
+      defer = 1;
+      argc--;
+      argv++;
+    }
 
   if (argc == 0)
     {
@@ -1068,6 +1110,10 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 
   size = grub_get_initrd_size (&initrd_ctx);
   aligned_size = ALIGN_UP (size, 4096);
+  /* Media may need more than page alignment to be read into directly.  */
+  align = grub_get_initrd_io_align (&initrd_ctx);
+  if (align < 0x1000)
+    align = 0x1000;
 
   /* Get the highest address available for the initrd.  */
   if (grub_le_to_cpu16 (linux_params.version) >= 0x0203)
@@ -1094,8 +1140,8 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 
   addr_min = (grub_addr_t) prot_mode_target + prot_init_space;
 
-  /* Put the initrd as high as possible, 4KiB aligned.  */
-  addr = (addr_max - aligned_size) & ~0xFFF;
+  /* Put the initrd as high as possible, at least 4KiB aligned.  */
+  addr = (addr_max - aligned_size) & ~(align - 1);
 
   if (addr < addr_min)
     {
@@ -1107,18 +1153,31 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
     grub_relocator_chunk_t ch;
     err = grub_relocator_alloc_chunk_align (relocator, &ch,
 					    addr_min, addr, aligned_size,
-					    0x1000,
+					    align,
 					    GRUB_RELOCATOR_PREFERENCE_HIGH,
 					    1);
     if (err)
       return err;
-    initrd_mem = get_virtual_current_address (ch);
-    initrd_mem_target = get_physical_target_address (ch);
+    mem = get_virtual_current_address (ch);
+    mem_target = get_physical_target_address (ch);
   }
 
-  if (grub_initrd_load (&initrd_ctx, argv, initrd_mem))
+  if (! defer && grub_initrd_load (&initrd_ctx, argv, mem))
     goto fail;
 
+  /* The new initrd replaces the one still waiting for the boot only now
+     that it is set up: after a failure the earlier one stays usable.  */
+  grub_initrd_close (&initrd_deferred);
+  if (defer)
+    {
+      /* Only the sizes were needed so far.  Keep the files open, so that
+	 nothing is read unless this entry is really booted.  */
+      initrd_deferred = initrd_ctx;
+      initrd_ctx.components = 0;
+    }
+  initrd_mem = mem;
+  initrd_mem_target = mem_target;
+
   grub_dprintf ("linux", "Initrd, addr=0x%x, size=0x%x\n",
 		(unsigned) addr, (unsigned) size);
 
@@ -1133,13 +1192,19 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 }
 
 static grub_command_t cmd_linux, cmd_initrd;
+static struct grub_preboot *deferred_hnd;
 
 GRUB_MOD_INIT(linux)
 {
   cmd_linux = grub_register_command ("linux", grub_cmd_linux,
 				     0, N_("Load Linux."));
   cmd_initrd = grub_register_command ("initrd", grub_cmd_initrd,
-				      0, N_("Load initrd."));
+				      N_("[--defer] FILE..."),
+				      N_("Load initrd."));
+  deferred_hnd
+    = grub_loader_register_preboot_hook (grub_linux_load_deferred,
+					 grub_linux_load_deferred_rest,
+					 GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
   my_mod = mod;
 }
 
@@ -1147,4 +1212,6 @@ GRUB_MOD_FINI(linux)
 {
   grub_unregister_command (cmd_linux);
   grub_unregister_command (cmd_initrd);
+  grub_loader_unregister_preboot_hook (deferred_hnd);
+  grub_initrd_cache_free ();
 }
@@ -485,4 +485,5 @@ GRUB_MOD_FINI(linux16)
 {
   grub_unregister_command (cmd_linux);
   grub_unregister_command (cmd_initrd);
+  grub_initrd_cache_free ();
 }
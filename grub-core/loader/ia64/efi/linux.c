@@ -640,4 +640,5 @@ GRUB_MOD_FINI(linux)
   grub_unregister_command (cmd_linux);
   grub_unregister_command (cmd_initrd);
   grub_unregister_command (cmd_fpswa);
+  grub_initrd_cache_free ();
 }
@@ -3,7 +3,13 @@
 #include <grub/linux.h>
 #include <grub/misc.h>
 #include <grub/file.h>
+#include <grub/partition.h>
 #include <grub/mm.h>
+#include <grub/boottime.h>
+
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/disk.h>
+#endif
 
 struct newc_head
 {
@@ -30,6 +36,31 @@ struct grub_linux_initrd_component
   grub_off_t size;
 };
 
+/* Images are read in pieces this big, with the next few of them being
+   fetched meanwhile, and the start of every initrd component is asked for
+   before the first one is read.  */
+#define GRUB_LINUX_READ_CHUNK		(1 << 20)
+#define GRUB_LINUX_READ_AHEAD		(4 << 20)
+#define GRUB_LINUX_INITRD_HEAD		(1 << 20)
+
+/* Small components, typically a microcode update, are kept after they are
+   first read, so that booting again, for example a fallback entry with the
+   same early initrd, just copies them.  */
+#define GRUB_LINUX_INITRD_CACHE_FILE	(4 << 20)
+#define GRUB_LINUX_INITRD_CACHE_TOTAL	(8 << 20)
+
+struct initrd_cached
+{
+  struct initrd_cached *next;
+  /* The disk name and the path, and the size the file had.  */
+  char *key;
+  grub_off_t size;
+  grub_uint8_t *data;
+};
+
+static struct initrd_cached *initrd_cache;
+static grub_size_t initrd_cache_size;
+
 struct dir
 {
   char *name;
@@ -199,6 +230,7 @@ grub_initrd_init (int argc, char *argv[],
 	  newc = 0;
 	}
       grub_file_filter_disable_compression ();
+      grub_file_filter_defer_verification ();
       initrd_ctx->components[i].file = grub_file_open (fname);
       if (!initrd_ctx->components[i].file)
 	{
@@ -229,6 +261,143 @@ grub_get_initrd_size (struct grub_linux_initrd_context *initrd_ctx)
   return initrd_ctx->size;
 }
 
+/* Return how the memory the initrd is loaded into should be aligned for
+   its files to be read without a bounce buffer.  */
+grub_size_t
+grub_get_initrd_io_align (struct grub_linux_initrd_context *initrd_ctx
+			  __attribute__ ((unused)))
+{
+  grub_size_t align = 1;
+#ifdef GRUB_MACHINE_EFI
+  int i;
+
+  for (i = 0; i < initrd_ctx->nfiles; i++)
+    {
+      grub_file_t file = initrd_ctx->components[i].file;
+      grub_size_t a;
+
+      if (! file->device || ! file->device->disk)
+	continue;
+      a = grub_efidisk_get_io_align (file->device->disk);
+      if (a > align)
+	align = a;
+    }
+#endif
+  return align;
+}
+
+/* Return the cache key of FILE, or NULL if it shouldn't be cached.  Only
+   files from disks are, as the name doesn't pin down a network file.  */
+static char *
+initrd_cache_key (grub_file_t file)
+{
+  const char *path = file->name;
+  char *partname, *key;
+
+  if (! path || ! file->device || ! file->device->disk)
+    return NULL;
+  if (path[0] == '(')
+    {
+      path = grub_strchr (path, ')');
+      if (! path)
+	return NULL;
+      path++;
+    }
+  /* The disk name leaves the partition out, and the same path on two
+     partitions is two different files.  */
+  partname = grub_partition_get_name (file->device->disk->partition);
+  if (! partname)
+    return NULL;
+  key = grub_xasprintf ("(%s%s%s)%s", file->device->disk->name,
+			partname[0] ? "," : "", partname, path);
+  grub_free (partname);
+  return key;
+}
+
+static struct initrd_cached *
+initrd_cache_find (const char *key, grub_off_t size)
+{
+  struct initrd_cached *c;
+
+  for (c = initrd_cache; c; c = c->next)
+    if (c->size == size && grub_strcmp (c->key, key) == 0)
+      return c;
+  return NULL;
+}
+
+/* Remember the SIZE bytes at DATA as the contents of KEY, taking KEY over.  */
+static void
+initrd_cache_add (char *key, const grub_uint8_t *data, grub_off_t size)
+{
+  struct initrd_cached *c;
+
+  if (size > GRUB_LINUX_INITRD_CACHE_FILE
+      || initrd_cache_size + size > GRUB_LINUX_INITRD_CACHE_TOTAL)
+    goto fail;
+  c = grub_malloc (sizeof (*c));
+  if (! c)
+    goto fail;
+  c->data = grub_malloc (size);
+  if (! c->data)
+    {
+      grub_free (c);
+      goto fail;
+    }
+  grub_memcpy (c->data, data, size);
+  c->key = key;
+  c->size = size;
+  c->next = initrd_cache;
+  initrd_cache = c;
+  initrd_cache_size += size;
+  return;
+
+ fail:
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (key);
+}
+
+void
+grub_initrd_cache_free (void)
+{
+  struct initrd_cached *c, *next;
+
+  for (c = initrd_cache; c; c = next)
+    {
+      next = c->next;
+      grub_free (c->key);
+      grub_free (c->data);
+      grub_free (c);
+    }
+  initrd_cache = NULL;
+  initrd_cache_size = 0;
+}
+
+/* Like grub_file_read, but keep the device busy with what follows while
+   a piece is copied or decompressed.  */
+grub_ssize_t
+grub_linux_file_read (grub_file_t file, void *buf, grub_size_t len)
+{
+  grub_off_t prefetch_end = 0;
+  grub_size_t done = 0;
+
+  while (done < len)
+    {
+      grub_size_t n = len - done;
+      grub_ssize_t r;
+
+      if (n > GRUB_LINUX_READ_CHUNK)
+	n = GRUB_LINUX_READ_CHUNK;
+      grub_file_prefetch_ahead (file, &prefetch_end, GRUB_LINUX_READ_AHEAD);
+      r = grub_file_read (file, (char *) buf + done, n);
+      if (r < 0)
+	return r;
+      done += r;
+      if ((grub_size_t) r < n)
+	break;
+    }
+  return done;
+}
+
 void
 grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
 {
@@ -244,15 +413,31 @@ grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
   initrd_ctx->components = 0;
 }
 
-grub_err_t
-grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
-		  char *argv[], void *target)
+static grub_err_t
+grub_initrd_load_real (struct grub_linux_initrd_context *initrd_ctx,
+		       char *argv[], void *target)
 {
   grub_uint8_t *ptr = target;
   int i;
   int newc = 0;
   struct dir *root = 0;
   grub_ssize_t cursize = 0;
+  struct initrd_cached *cached;
+  char *key;
+
+  /* Have all the components on their way, like a microcode update next to
+     the main initrd, instead of waiting for each in turn.  */
+  for (i = 0; i < initrd_ctx->nfiles; i++)
+    {
+      grub_file_t file = initrd_ctx->components[i].file;
+
+      key = NULL;
+      if (initrd_ctx->components[i].size <= GRUB_LINUX_INITRD_CACHE_FILE)
+	key = initrd_cache_key (file);
+      if (! key || ! initrd_cache_find (key, initrd_ctx->components[i].size))
+	grub_file_prefetch (file, 0, GRUB_LINUX_INITRD_HEAD);
+      grub_free (key);
+    }
 
   for (i = 0; i < initrd_ctx->nfiles; i++)
     {
@@ -279,12 +464,27 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	}
 
       cursize = initrd_ctx->components[i].size;
-      if (grub_file_read (initrd_ctx->components[i].file, ptr, cursize)
-	  != cursize)
+      key = NULL;
+      if (cursize <= GRUB_LINUX_INITRD_CACHE_FILE)
+	key = initrd_cache_key (initrd_ctx->components[i].file);
+      cached = key ? initrd_cache_find (key, cursize) : NULL;
+      if (cached)
+	{
+	  grub_memcpy (ptr, cached->data, cursize);
+	  grub_free (key);
+	}
+      else if (grub_linux_file_read (initrd_ctx->components[i].file, ptr,
+				     cursize) == cursize)
+	{
+	  if (key)
+	    initrd_cache_add (key, ptr, cursize);
+	}
+      else
 	{
+	  grub_free (key);
 	  if (!grub_errno)
 	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-			argv[i]);
+			argv ? argv[i] : initrd_ctx->components[i].file->name);
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
@@ -300,3 +500,17 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
   root = 0;
   return GRUB_ERR_NONE;
 }
+
+grub_err_t
+grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
+		  char *argv[], void *target)
+{
+  grub_uint64_t start;
+  grub_err_t err;
+
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_LOADER);
+  err = grub_initrd_load_real (initrd_ctx, argv, target);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_LOADER, start, "initrd");
+
+  return err;
+}
@@ -62,6 +62,26 @@ static int accepts_ega_text;
 static int console_required;
 static grub_dl_t my_mod;
 
+/* A module given with --defer, read into its chunk at boot.  */
+struct deferred_module
+{
+  struct deferred_module *next;
+  grub_file_t file;
+  void *dest;
+  grub_size_t size;
+};
+
+static struct deferred_module *deferred_modules;
+static struct deferred_module **deferred_modules_tail = &deferred_modules;
+static struct grub_preboot *deferred_hnd;
+
+/* Modules are read in pieces this big, with the next few of them being
+   fetched meanwhile, and the start of every deferred module is asked for
+   before the first one is read.  */
+#define MODULE_READ_CHUNK	(1 << 20)
+#define MODULE_READ_AHEAD	(4 << 20)
+#define MODULE_HEAD		(1 << 20)
+
 
 /* Helper for grub_get_multiboot_mmap_count.  */
 static int
@@ -160,6 +180,77 @@ normal_boot (struct grub_relocator *rel, struct grub_relocator32_state state)
 }
 #endif
 
+static void
+free_deferred_modules (void)
+{
+  struct deferred_module *m, *next;
+
+  for (m = deferred_modules; m; m = next)
+    {
+      next = m->next;
+      grub_file_close (m->file);
+      grub_free (m);
+    }
+  deferred_modules = NULL;
+  deferred_modules_tail = &deferred_modules;
+}
+
+/* Read SIZE bytes of FILE into DEST, keeping the device busy with what
+   follows while a piece is copied or decompressed.  */
+static grub_err_t
+read_module (grub_file_t file, void *dest, grub_size_t size)
+{
+  grub_off_t prefetch_end = 0;
+  grub_size_t done = 0;
+
+  while (done < size)
+    {
+      grub_size_t n = size - done;
+      grub_ssize_t r;
+
+      if (n > MODULE_READ_CHUNK)
+	n = MODULE_READ_CHUNK;
+      grub_file_prefetch_ahead (file, &prefetch_end, MODULE_READ_AHEAD);
+      r = grub_file_read (file, (char *) dest + done, n);
+      if (r < 0)
+	return grub_errno;
+      if ((grub_size_t) r != n)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("premature end of file %s"), file->name);
+	  return grub_errno;
+	}
+      done += r;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Read the modules given with --defer.  This runs as a preboot hook,
+   before the disk drivers are stopped.  All of them are asked for first,
+   so that small ones are read together.  */
+static grub_err_t
+load_deferred_modules (int flags __attribute__ ((unused)))
+{
+  struct deferred_module *m;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  for (m = deferred_modules; m; m = m->next)
+    grub_file_prefetch (m->file, 0, MODULE_HEAD);
+
+  for (m = deferred_modules; m && !err; m = m->next)
+    err = read_module (m->file, m->dest, m->size);
+
+  free_deferred_modules ();
+  return err;
+}
+
+static grub_err_t
+load_deferred_modules_rest (void)
+{
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_multiboot_boot (void)
 {
@@ -187,6 +278,7 @@ grub_multiboot_unload (void)
 {
   grub_multiboot_free_mbi ();
 
+  free_deferred_modules ();
   grub_relocator_unload (grub_multiboot_relocator);
   grub_multiboot_relocator = NULL;
 
@@ -315,6 +407,7 @@ grub_cmd_multiboot (grub_command_t cmd __attribute__ ((unused)),
   /* Skip filename.  */
   grub_multiboot_init_mbi (argc - 1, argv + 1);
 
+  free_deferred_modules ();
   grub_relocator_unload (grub_multiboot_relocator);
   grub_multiboot_relocator = grub_relocator_new ();
 
@@ -353,16 +446,22 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   grub_addr_t target;
   grub_err_t err;
   int nounzip = 0;
+  int defer = 0;
   grub_uint64_t lowest_addr = 0;
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
 
-  if (grub_strcmp (argv[0], "--nounzip") == 0)
+  while (argc > 0)
     {
+      if (grub_strcmp (argv[0], "--nounzip") == 0)
+	nounzip = 1;
+      else if (grub_strcmp (argv[0], "--defer") == 0)
+	defer = 1;
+      else
+	break;
       argv++;
       argc--;
-      nounzip = 1;
     }
 
   if (argc == 0)
@@ -414,17 +513,32 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
       return err;
     }
 
-  if (size && grub_file_read (file, module, size) != size)
+  if (size && defer)
     {
-      grub_file_close (file);
-      if (!grub_errno)
-	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-		    argv[0]);
-      return grub_errno;
+      struct deferred_module *m;
+
+      /* Only the size was needed so far.  Keep the file open, so that
+	 nothing is read unless this entry is really booted.  */
+      m = grub_malloc (sizeof (*m));
+      if (!m)
+	{
+	  grub_file_close (file);
+	  return grub_errno;
+	}
+      m->next = NULL;
+      m->file = file;
+      m->dest = module;
+      m->size = size;
+      *deferred_modules_tail = m;
+      deferred_modules_tail = &m->next;
+      return GRUB_ERR_NONE;
     }
 
+  if (size)
+    err = read_module (file, module, size);
+
   grub_file_close (file);
-  return GRUB_ERR_NONE;
+  return err;
 }
 
 static grub_command_t cmd_multiboot, cmd_module;
@@ -446,6 +560,10 @@ GRUB_MOD_INIT(multiboot)
 			   0, N_("Load a multiboot module."));
 #endif
 
+  deferred_hnd
+    = grub_loader_register_preboot_hook (load_deferred_modules,
+					 load_deferred_modules_rest,
+					 GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
   my_mod = mod;
 }
 
@@ -453,4 +571,5 @@ GRUB_MOD_FINI(multiboot)
 {
   grub_unregister_command (cmd_multiboot);
   grub_unregister_command (cmd_module);
+  grub_loader_unregister_preboot_hook (deferred_hnd);
 }
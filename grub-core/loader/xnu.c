@@ -625,20 +625,21 @@ get_name_ptr (char *name)
   return p2 + 1;
 }
 
-/* Load .kext. */
+/* Load .kext whose Info.plist INFOPLISTNAME was read already into
+   INFOPLIST, if not NULL.  */
 static grub_err_t
-grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile,
-		      const char *filename)
+grub_xnu_load_driver_plist (char *infoplistname, const char *infoplist,
+			    grub_size_t infoplistsize, grub_file_t binaryfile,
+			    const char *filename)
 {
   grub_macho_t macho;
   grub_err_t err;
-  grub_file_t infoplist;
   struct grub_xnu_extheader *exthead;
   int neededspace = sizeof (*exthead);
   grub_uint8_t *buf;
   void *buf0;
   grub_addr_t buf_target;
-  grub_size_t infoplistsize = 0, machosize = 0;
+  grub_size_t machosize = 0;
   char *name, *nameend;
   int namelen;
 
@@ -673,18 +674,8 @@ grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile,
   else
     macho = 0;
 
-  if (infoplistname)
-    infoplist = grub_file_open (infoplistname);
-  else
-    infoplist = 0;
-  grub_errno = GRUB_ERR_NONE;
   if (infoplist)
-    {
-      infoplistsize = grub_file_size (infoplist);
-      neededspace += infoplistsize + 1;
-    }
-  else
-    infoplistsize = 0;
+    neededspace += infoplistsize + 1;
 
   /* Allocate the space. */
   err = grub_xnu_align_heap (GRUB_XNU_PAGESIZE);
@@ -720,20 +711,10 @@ grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile,
     {
       exthead->infoplistaddr = buf_target + (buf - (grub_uint8_t *) buf0);
       exthead->infoplistsize = infoplistsize + 1;
-      if (grub_file_read (infoplist, buf, infoplistsize)
-	  != (grub_ssize_t) (infoplistsize))
-	{
-	  grub_file_close (infoplist);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
-			infoplistname);
-	  return grub_errno;
-	}
-      grub_file_close (infoplist);
+      grub_memcpy (buf, infoplist, infoplistsize);
       buf[infoplistsize] = 0;
       buf += infoplistsize + 1;
     }
-  grub_errno = GRUB_ERR_NONE;
 
   exthead->nameaddr = (buf - (grub_uint8_t *) buf0) + buf_target;
   exthead->namesize = namelen + 1;
@@ -750,6 +731,66 @@ fail:
   return err;
 }
 
+/* Read the whole file NAME into *BUF.  */
+static grub_err_t
+grub_xnu_read_plist (const char *name, char **buf, grub_size_t *size)
+{
+  grub_file_t file;
+
+  *buf = 0;
+  file = grub_file_open (name);
+  if (! file)
+    return grub_errno;
+
+  *size = grub_file_size (file);
+  *buf = grub_malloc (*size + 1);
+  if (! *buf)
+    {
+      grub_file_close (file);
+      return grub_errno;
+    }
+  if (grub_file_read (file, *buf, *size) != (grub_ssize_t) (*size))
+    {
+      grub_file_close (file);
+      grub_free (*buf);
+      *buf = 0;
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), name);
+      return grub_errno;
+    }
+  grub_file_close (file);
+  (*buf)[*size] = 0;
+  return GRUB_ERR_NONE;
+}
+
+/* Load .kext. */
+static grub_err_t
+grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile,
+		      const char *filename)
+{
+  char *infoplist = 0;
+  grub_size_t infoplistsize = 0;
+  grub_err_t err;
+
+  if (infoplistname
+      && grub_xnu_read_plist (infoplistname, &infoplist, &infoplistsize))
+    {
+      if (grub_errno != GRUB_ERR_BAD_OS)
+	grub_errno = GRUB_ERR_NONE;
+      else
+	{
+	  if (binaryfile)
+	    grub_file_close (binaryfile);
+	  return grub_errno;
+	}
+    }
+
+  err = grub_xnu_load_driver_plist (infoplistname, infoplist, infoplistsize,
+				    binaryfile, filename);
+  grub_free (infoplist);
+  return err;
+}
+
 /* Load mkext. */
 static grub_err_t
 grub_cmd_xnu_mkext (grub_command_t cmd __attribute__ ((unused)),
@@ -909,42 +950,22 @@ grub_cmd_xnu_ramdisk (grub_command_t cmd __attribute__ ((unused)),
 }
 
 /* Returns true if the kext should be loaded according to plist
-   and osbundlereq. Also fill BINNAME. */
+   and osbundlereq. Also fill BINNAME.  The plist, read in BUF, is left
+   as it was.  */
 static int
-grub_xnu_check_os_bundle_required (char *plistname,
+grub_xnu_check_os_bundle_required (char *plistname, char *buf,
+				   grub_size_t size,
 				   const char *osbundlereq,
 				   char **binname)
 {
-  grub_file_t file;
-  char *buf = 0, *tagstart = 0, *ptr1 = 0, *keyptr = 0;
+  char *tagstart = 0, *ptr1 = 0, *keyptr = 0;
   char *stringptr = 0, *ptr2 = 0;
-  grub_size_t size;
   int depth = 0;
   int ret;
   int osbundlekeyfound = 0, binnamekeyfound = 0;
   if (binname)
     *binname = 0;
 
-  file = grub_file_open (plistname);
-  if (! file)
-    return 0;
-
-  size = grub_file_size (file);
-  buf = grub_malloc (size);
-  if (! buf)
-    {
-      grub_file_close (file);
-      return 0;
-    }
-  if (grub_file_read (file, buf, size) != (grub_ssize_t) (size))
-    {
-      grub_file_close (file);
-      if (!grub_errno)
-	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), plistname);
-      return 0;
-    }
-  grub_file_close (file);
-
   /* Set the return value for the case when no OSBundleRequired tag is found. */
   if (osbundlereq)
     ret = grub_strword (osbundlereq, "all") || grub_strword (osbundlereq, "-");
@@ -966,10 +987,16 @@ grub_xnu_check_os_bundle_required (char *plistname,
 	  binnamekeyfound = 1;
 	if (stringptr && osbundlekeyfound && osbundlereq && depth == 4)
 	  {
-	    for (ptr2 = stringptr; *ptr2; ptr2++)
-	      *ptr2 = grub_tolower (*ptr2);
-	    ret = grub_strword (osbundlereq, stringptr)
-	      || grub_strword (osbundlereq, "all");
+	    char *lower = grub_strdup (stringptr);
+
+	    if (lower)
+	      {
+		for (ptr2 = lower; *ptr2; ptr2++)
+		  *ptr2 = grub_tolower (*ptr2);
+		ret = grub_strword (osbundlereq, lower)
+		  || grub_strword (osbundlereq, "all");
+		grub_free (lower);
+	      }
 	  }
 	if (stringptr && binnamekeyfound && binname && depth == 4)
 	  {
@@ -985,7 +1012,6 @@ grub_xnu_check_os_bundle_required (char *plistname,
       case '>':
 	if (! tagstart)
 	  {
-	    grub_free (buf);
 	    grub_error (GRUB_ERR_BAD_OS, "can't parse %s", plistname);
 	    return 0;
 	  }
@@ -1013,11 +1039,46 @@ grub_xnu_check_os_bundle_required (char *plistname,
 	  depth++;
 	break;
       }
-  grub_free (buf);
 
   return ret;
 }
 
+/* While kexts are being loaded, the filesystem of the last device
+   they came from, which saves probing it for every directory.  */
+static char *kext_fs_device;
+static grub_fs_t kext_fs;
+static int kext_nesting;
+
+static grub_fs_t
+grub_xnu_kext_fs (const char *device_name, grub_device_t dev)
+{
+  if (! device_name)
+    return grub_fs_probe (dev);
+  if (kext_fs_device && grub_strcmp (kext_fs_device, device_name) == 0)
+    return kext_fs;
+
+  grub_free (kext_fs_device);
+  kext_fs = grub_fs_probe (dev);
+  kext_fs_device = kext_fs ? grub_strdup (device_name) : 0;
+  return kext_fs;
+}
+
+static void
+grub_xnu_kext_begin (void)
+{
+  kext_nesting++;
+}
+
+static void
+grub_xnu_kext_end (void)
+{
+  if (--kext_nesting)
+    return;
+  grub_free (kext_fs_device);
+  kext_fs_device = 0;
+  kext_fs = 0;
+}
+
 /* Context for grub_xnu_scan_dir_for_kexts.  */
 struct grub_xnu_scan_dir_for_kexts_ctx
 {
@@ -1081,11 +1142,12 @@ grub_xnu_scan_dir_for_kexts (char *dirname, const char *osbundlerequired,
   if (! grub_xnu_heap_size)
     return grub_error (GRUB_ERR_BAD_OS, N_("you need to load the kernel first"));
 
+  grub_xnu_kext_begin ();
   device_name = grub_file_get_device_name (dirname);
   dev = grub_device_open (device_name);
   if (dev)
     {
-      fs = grub_fs_probe (dev);
+      fs = grub_xnu_kext_fs (device_name, dev);
       path = grub_strchr (dirname, ')');
       if (! path)
 	path = dirname;
@@ -1097,6 +1159,7 @@ grub_xnu_scan_dir_for_kexts (char *dirname, const char *osbundlerequired,
       grub_device_close (dev);
     }
   grub_free (device_name);
+  grub_xnu_kext_end ();
 
   return GRUB_ERR_NONE;
 }
@@ -1166,10 +1229,13 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
   const char *path;
   char *binsuffix;
   grub_file_t binfile;
+  char *plist = 0;
+  grub_size_t plistsize = 0;
 
   ctx.newdirname = grub_malloc (grub_strlen (dirname) + 20);
   if (! ctx.newdirname)
     return grub_errno;
+  grub_xnu_kext_begin ();
   grub_strcpy (ctx.newdirname, dirname);
   ctx.newdirname[grub_strlen (dirname)] = '/';
   ctx.newdirname[grub_strlen (dirname) + 1] = 0;
@@ -1177,7 +1243,7 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
   dev = grub_device_open (device_name);
   if (dev)
     {
-      fs = grub_fs_probe (dev);
+      fs = grub_xnu_kext_fs (device_name, dev);
       path = grub_strchr (dirname, ')');
       if (! path)
 	path = dirname;
@@ -1194,8 +1260,12 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
       if (fs)
 	(fs->dir) (dev, path, grub_xnu_load_kext_from_dir_load, &ctx);
 
-      if (ctx.plistname && grub_xnu_check_os_bundle_required
-	  (ctx.plistname, osbundlerequired, &binsuffix))
+      /* The plist is read once, both to decide and to be passed on.  */
+      if (ctx.plistname
+	  && grub_xnu_read_plist (ctx.plistname, &plist, &plistsize) == 0
+	  && grub_xnu_check_os_bundle_required (ctx.plistname, plist,
+						plistsize, osbundlerequired,
+						&binsuffix))
 	{
 	  if (binsuffix)
 	    {
@@ -1215,21 +1285,25 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
 		grub_errno = GRUB_ERR_NONE;
 
 	      /* Load the extension. */
-	      grub_xnu_load_driver (ctx.plistname, binfile,
-				    binname);
+	      grub_xnu_load_driver_plist (ctx.plistname, plist, plistsize,
+					  binfile, binname);
 	      grub_free (binname);
 	      grub_free (binsuffix);
 	    }
 	  else
 	    {
 	      grub_dprintf ("xnu", "%s:0\n", ctx.plistname);
-	      grub_xnu_load_driver (ctx.plistname, 0, 0);
+	      grub_xnu_load_driver_plist (ctx.plistname, plist, plistsize,
+					  0, 0);
 	    }
 	}
+      grub_free (plist);
       grub_free (ctx.plistname);
       grub_device_close (dev);
     }
   grub_free (device_name);
+  grub_free (ctx.newdirname);
+  grub_xnu_kext_end ();
 
   return GRUB_ERR_NONE;
 }
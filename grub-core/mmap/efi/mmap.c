@@ -28,34 +28,48 @@
 #define NEXT_MEMORY_DESCRIPTOR(desc, size)      \
   ((grub_efi_memory_descriptor_t *) ((char *) (desc) + (size)))
 
+/* Size of the last memory map we got, plus some slack.  Starting from it
+   lets the usual iteration get away with a single GetMemoryMap call
+   instead of probing the size first.  */
+static grub_efi_uintn_t mmap_size_hint;
+
 grub_err_t
 grub_efi_mmap_iterate (grub_memory_hook_t hook, void *hook_data,
 		       int avoid_efi_boot_services)
 {
-  grub_efi_uintn_t mmap_size = 0;
+  grub_efi_uintn_t mmap_size = mmap_size_hint;
   grub_efi_memory_descriptor_t *map_buf = 0;
   grub_efi_uintn_t map_key = 0;
   grub_efi_uintn_t desc_size = 0;
   grub_efi_uint32_t desc_version = 0;
   grub_efi_memory_descriptor_t *desc;
 
-  if (grub_efi_get_memory_map (&mmap_size, map_buf,
-			       &map_key, &desc_size,
-			       &desc_version) < 0)
-    return grub_errno;
+  while (1)
+    {
+      int ret;
+
+      if (mmap_size)
+	{
+	  map_buf = grub_malloc (mmap_size);
+	  if (! map_buf)
+	    return grub_errno;
+	}
 
-  map_buf = grub_malloc (mmap_size);
-  if (! map_buf)
-    return grub_errno;
+      ret = grub_efi_get_memory_map (&mmap_size, map_buf,
+				     &map_key, &desc_size,
+				     &desc_version);
+      if (ret > 0)
+	break;
 
-  if (grub_efi_get_memory_map (&mmap_size, map_buf,
-			       &map_key, &desc_size,
-			       &desc_version) <= 0)
-    {
       grub_free (map_buf);
-      return grub_errno;
+      map_buf = 0;
+      if (ret < 0)
+	return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+      mmap_size += 8 * desc_size;
     }
 
+  mmap_size_hint = mmap_size + 8 * desc_size;
+
   for (desc = map_buf;
        desc < NEXT_MEMORY_DESCRIPTOR (map_buf, mmap_size);
        desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
@@ -132,6 +146,7 @@ grub_efi_mmap_iterate (grub_memory_hook_t hook, void *hook_data,
 	}
     }
 
+  grub_free (map_buf);
   return GRUB_ERR_NONE;
 }
 
@@ -99,6 +99,15 @@ fill_hook (grub_uint64_t addr, grub_uint64_t size, grub_memory_type_t type,
   return 0;
 }
 
+/* Helper for grub_mmap_iterate.  Whether event A sorts strictly before
+   event B.  */
+static inline int
+scan_before (const struct grub_mmap_scan *a, const struct grub_mmap_scan *b)
+{
+  return a->pos < b->pos
+    || (a->pos == b->pos && a->type == 0 && b->type == 1);
+}
+
 struct mm_list
 {
   struct mm_list *next;
@@ -113,9 +122,7 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
      It uses scanline (sweeping) algorithm.
   */
   struct grub_mmap_iterate_ctx ctx;
-  int i, done;
-
-  struct grub_mmap_scan t;
+  int i;
 
   /* Previous scanline event. */
   grub_uint64_t lastaddr;
@@ -175,25 +182,47 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
 
   grub_machine_mmap_iterate (fill_hook, &ctx);
 
-  /* Primitive bubble sort. It has complexity O(n^2) but since we're
-     unlikely to have more than 100 chunks it's probably one of the
-     fastest for one purpose. */
-  done = 1;
-  while (done)
-    {
-      done = 0;
-      for (i = 0; i < 2 * mmap_num - 1; i++)
-	if (ctx.scanline_events[i + 1].pos < ctx.scanline_events[i].pos
-	    || (ctx.scanline_events[i + 1].pos == ctx.scanline_events[i].pos
-		&& ctx.scanline_events[i + 1].type == 0
-		&& ctx.scanline_events[i].type == 1))
+  /* Stable bottom-up merge sort.  Firmware maps can have thousands of
+     entries, so a quadratic sort shows up at boot time.  Events at the
+     same address keep their registration order, with starts first.  */
+  {
+    struct grub_mmap_scan *tmp;
+    int width;
+
+    tmp = grub_malloc (sizeof (tmp[0]) * 2 * mmap_num);
+    if (!tmp)
+      {
+	grub_free (ctx.scanline_events);
+	grub_free (present);
+	return grub_errno;
+      }
+
+    for (width = 1; width < 2 * mmap_num; width *= 2)
+      {
+	struct grub_mmap_scan *t;
+
+	for (i = 0; i < 2 * mmap_num; i += 2 * width)
 	  {
-	    t = ctx.scanline_events[i + 1];
-	    ctx.scanline_events[i + 1] = ctx.scanline_events[i];
-	    ctx.scanline_events[i] = t;
-	    done = 1;
+	    int l = i, m, r, e, k = i;
+
+	    m = (i + width < 2 * mmap_num) ? i + width : 2 * mmap_num;
+	    e = (i + 2 * width < 2 * mmap_num) ? i + 2 * width : 2 * mmap_num;
+	    r = m;
+	    while (l < m || r < e)
+	      if (r < e
+		  && (l == m || scan_before (&ctx.scanline_events[r],
+					     &ctx.scanline_events[l])))
+		tmp[k++] = ctx.scanline_events[r++];
+	      else
+		tmp[k++] = ctx.scanline_events[l++];
 	  }
-    }
+
+	t = ctx.scanline_events;
+	ctx.scanline_events = tmp;
+	tmp = t;
+      }
+    grub_free (tmp);
+  }
 
   lastaddr = ctx.scanline_events[0].pos;
   lasttype = ctx.scanline_events[0].memtype;
@@ -52,32 +52,28 @@ struct arppkt {
 static int have_pending;
 static grub_uint32_t pending_req;
 
-grub_err_t
-grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
-			   const grub_net_network_level_address_t *proto_addr)
+/* Build a request for PROTO_ADDR in NB, which is backed by DATA.  */
+static grub_err_t
+build_request (struct grub_net_network_level_interface *inf,
+	       const grub_net_network_level_address_t *proto_addr,
+	       struct grub_net_buff *nb, grub_uint8_t *data, grub_size_t size)
 {
-  struct grub_net_buff nb;
   struct arppkt *arp_packet;
-  grub_net_link_level_address_t target_mac_addr;
   grub_err_t err;
-  int i;
-  grub_uint8_t *nbd;
-  grub_uint8_t arp_data[128];
 
   if (proto_addr->type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
     return grub_error (GRUB_ERR_BUG, "unsupported address family");
 
-  /* Build a request packet.  */
-  nb.head = arp_data;
-  nb.end = arp_data + sizeof (arp_data);
-  grub_netbuff_clear (&nb);
-  grub_netbuff_reserve (&nb, 128);
+  nb->head = data;
+  nb->end = data + size;
+  grub_netbuff_clear (nb);
+  grub_netbuff_reserve (nb, size);
 
-  err = grub_netbuff_push (&nb, sizeof (*arp_packet));
+  err = grub_netbuff_push (nb, sizeof (*arp_packet));
   if (err)
     return err;
 
-  arp_packet = (struct arppkt *) nb.data;
+  arp_packet = (struct arppkt *) nb->data;
   arp_packet->hrd = grub_cpu_to_be16_compile_time (GRUB_NET_ARPHRD_ETHERNET);
   arp_packet->hln = 6;
   arp_packet->pro = grub_cpu_to_be16_compile_time (GRUB_NET_ETHERTYPE_IP);
@@ -88,6 +84,41 @@ grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
   arp_packet->sender_ip = inf->address.ipv4;
   grub_memset (arp_packet->recv_mac, 0, 6);
   arp_packet->recv_ip = proto_addr->ipv4;
+  return GRUB_ERR_NONE;
+}
+
+/* Broadcast one request, leaving the reply to grub_net_arp_receive.  */
+grub_err_t
+grub_net_arp_send_request_nowait (struct grub_net_network_level_interface *inf,
+				  const grub_net_network_level_address_t *proto_addr)
+{
+  struct grub_net_buff nb;
+  grub_net_link_level_address_t target_mac_addr;
+  grub_uint8_t arp_data[128];
+  grub_err_t err;
+
+  err = build_request (inf, proto_addr, &nb, arp_data, sizeof (arp_data));
+  if (err)
+    return err;
+  grub_memset (&target_mac_addr.mac, 0xff, 6);
+  return send_ethernet_packet (inf, &nb, target_mac_addr,
+			       GRUB_NET_ETHERTYPE_ARP);
+}
+
+grub_err_t
+grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
+			   const grub_net_network_level_address_t *proto_addr)
+{
+  struct grub_net_buff nb;
+  grub_net_link_level_address_t target_mac_addr;
+  grub_err_t err;
+  int i;
+  grub_uint8_t *nbd;
+  grub_uint8_t arp_data[128];
+
+  err = build_request (inf, proto_addr, &nb, arp_data, sizeof (arp_data));
+  if (err)
+    return err;
   /* Target protocol address */
   grub_memset (&target_mac_addr.mac, 0xff, 6);
 
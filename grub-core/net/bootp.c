@@ -25,8 +25,33 @@
 #include <grub/net/udp.h>
 #include <grub/datetime.h>
 
+/* Peers whose link-layer address is asked for as soon as the interface is
+   configured: the server, the router and the DNS servers.  */
+#define DHCP_PREFETCH_MAX 8
+
+/* Set once a lease installs a default route, so that net_bootp doesn't
+   keep waiting for the cards that aren't answered.  */
+static int dhcp_default_route;
+
+struct dhcp_prefetch
+{
+  grub_net_network_level_address_t addr[DHCP_PREFETCH_MAX];
+  int n;
+};
+
 static void
-parse_dhcp_vendor (const char *name, const void *vend, int limit, int *mask)
+dhcp_prefetch_add (struct dhcp_prefetch *prefetch, grub_uint32_t ipv4)
+{
+  if (prefetch->n == DHCP_PREFETCH_MAX)
+    return;
+  prefetch->addr[prefetch->n].type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  prefetch->addr[prefetch->n].ipv4 = ipv4;
+  prefetch->n++;
+}
+
+static void
+parse_dhcp_vendor (const char *name, const void *vend, int limit, int *mask,
+		   struct dhcp_prefetch *prefetch)
 {
   const grub_uint8_t *ptr, *ptr0;
 
@@ -84,6 +109,8 @@ parse_dhcp_vendor (const char *name, const void *vend, int limit, int *mask)
 	      if (rname)
 		grub_net_add_route_gw (rname, target, gw, NULL);
 	      grub_free (rname);
+	      dhcp_prefetch_add (prefetch, gw.ipv4);
+	      dhcp_default_route = 1;
 	    }
 	  break;
 	case GRUB_NET_BOOTP_DNS:
@@ -96,6 +123,7 @@ parse_dhcp_vendor (const char *name, const void *vend, int limit, int *mask)
 		s.ipv4 = grub_get_unaligned32 (ptr);
 		s.option = DNS_OPTION_PREFER_IPV4;
 		grub_net_add_dns_server (&s);
+		dhcp_prefetch_add (prefetch, s.ipv4);
 		ptr += 4;
 	      }
 	  }
@@ -143,6 +171,8 @@ grub_net_configure_by_dhcp_ack (const char *name,
   struct grub_net_network_level_interface *inter;
   int mask = -1;
   char server_ip[sizeof ("xxx.xxx.xxx.xxx")];
+  struct dhcp_prefetch prefetch;
+  int i;
 
   addr.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
   addr.ipv4 = bp->your_ip;
@@ -254,9 +284,17 @@ grub_net_configure_by_dhcp_ack (const char *name,
 	    **path = 0;
 	}
     }
+  prefetch.n = 0;
+  if (bp->server_ip)
+    dhcp_prefetch_add (&prefetch, bp->server_ip);
   if (size > OFFSET_OF (vendor, bp))
-    parse_dhcp_vendor (name, &bp->vendor, size - OFFSET_OF (vendor, bp), &mask);
+    parse_dhcp_vendor (name, &bp->vendor, size - OFFSET_OF (vendor, bp), &mask,
+		       &prefetch);
   grub_net_add_ipv4_local (inter, mask);
+
+  /* So that the first request to any of them doesn't wait for ARP.  */
+  for (i = 0; i < prefetch.n; i++)
+    grub_net_link_layer_prefetch (&prefetch.addr[i]);
   
   inter->dhcp_ack = grub_malloc (size);
   if (inter->dhcp_ack)
@@ -487,6 +525,9 @@ grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
     grub_net_network_level_interfaces->prev = & ifaces[ncards - 1].next;
   grub_net_network_level_interfaces = &ifaces[0];
   ifaces[0].prev = &grub_net_network_level_interfaces;
+  /* Every card is asked in each round and takes the first lease it gets.
+     Once one of them provides a default route the boot can go on.  */
+  dhcp_default_route = 0;
   for (interval = 200; interval < 10000; interval *= 2)
     {
       int done = 0;
@@ -562,7 +603,9 @@ grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
 	}
       if (!done)
 	break;
-      grub_net_poll_cards (interval, 0);
+      grub_net_poll_cards (interval, &dhcp_default_route);
+      if (dhcp_default_route)
+	break;
     }
 
   err = GRUB_ERR_NONE;
@@ -571,6 +614,12 @@ grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
       grub_free (ifaces[j].name);
       if (!ifaces[j].prev)
 	continue;
+      if (dhcp_default_route)
+	{
+	  grub_dprintf ("net", "giving up on %s\n", ifaces[j].card->name);
+	  grub_net_network_level_interface_unregister (&ifaces[j]);
+	  continue;
+	}
       grub_error_push ();
       grub_net_network_level_interface_unregister (&ifaces[j]);
       err = grub_error (GRUB_ERR_FILE_NOT_FOUND,
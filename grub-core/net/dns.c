@@ -23,6 +23,7 @@
 #include <grub/err.h>
 #include <grub/time.h>
 
+/* An entry without addresses records that the name doesn't exist.  */
 struct dns_cache_element
 {
   char *name;
@@ -33,6 +34,8 @@ struct dns_cache_element
 
 #define DNS_CACHE_SIZE 1021
 #define DNS_HASH_BASE 423
+/* Upper bound on how long a name error is believed, in seconds.  */
+#define DNS_NEGATIVE_TTL_MAX 300
 
 typedef enum grub_dns_qtype_id
   {
@@ -97,7 +100,8 @@ enum
 
 enum
   {
-    ERRCODE_MASK = 0x0f
+    ERRCODE_MASK = 0x0f,
+    ERRCODE_NXDOMAIN = 3
   };
 
 enum
@@ -222,9 +226,89 @@ enum
   {
     DNS_CLASS_A = 1,
     DNS_CLASS_CNAME = 5,
+    DNS_CLASS_SOA = 6,
     DNS_CLASS_AAAA = 28
   };
 
+static void
+dns_cache_set (const char *name, grub_size_t naddresses,
+	       const struct grub_net_network_level_address *addresses,
+	       grub_uint32_t ttl)
+{
+  int h = hash (name);
+
+  grub_free (dns_cache[h].name);
+  dns_cache[h].name = 0;
+  grub_free (dns_cache[h].addresses);
+  dns_cache[h].addresses = 0;
+  dns_cache[h].naddresses = 0;
+
+  dns_cache[h].name = grub_strdup (name);
+  if (naddresses)
+    dns_cache[h].addresses = grub_malloc (naddresses
+					  * sizeof (dns_cache[h].addresses[0]));
+  if (!dns_cache[h].name || (naddresses && !dns_cache[h].addresses))
+    {
+      grub_free (dns_cache[h].name);
+      dns_cache[h].name = 0;
+      grub_free (dns_cache[h].addresses);
+      dns_cache[h].addresses = 0;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (dns_cache[h].addresses, addresses,
+	       naddresses * sizeof (dns_cache[h].addresses[0]));
+  dns_cache[h].naddresses = naddresses;
+  dns_cache[h].limit_time = grub_get_time_ms () + 1000 * (grub_uint64_t) ttl;
+}
+
+static const grub_uint8_t *
+skip_name (const grub_uint8_t *ptr, const grub_uint8_t *tail)
+{
+  while (ptr < tail && !((*ptr & 0xc0) || *ptr == 0))
+    ptr += *ptr + 1;
+  if (ptr < tail && (*ptr & 0xc0))
+    ptr++;
+  return ptr + 1;
+}
+
+/* How long a name error may be cached: the lower of the TTL and the
+   minimum field of the SOA record in the authority section (RFC 2308).
+   0 when there is no such record.  */
+static grub_uint32_t
+negative_ttl (const struct dns_header *head, const grub_uint8_t *tail)
+{
+  const grub_uint8_t *ptr = (const grub_uint8_t *) (head + 1);
+  int i;
+
+  for (i = 0; i < grub_be_to_cpu16 (head->qdcount); i++)
+    ptr = skip_name (ptr, tail) + 4;
+  for (i = 0; i < grub_be_to_cpu16 (head->ancount)
+	 + grub_be_to_cpu16 (head->nscount); i++)
+    {
+      grub_uint16_t type, length;
+      grub_uint32_t ttl, minimum;
+
+      ptr = skip_name (ptr, tail);
+      if (ptr + 10 > tail)
+	return 0;
+      type = (ptr[0] << 8) | ptr[1];
+      ttl = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 4));
+      length = (ptr[8] << 8) | ptr[9];
+      ptr += 10;
+      if (ptr + length > tail)
+	return 0;
+      if (i >= grub_be_to_cpu16 (head->ancount) && type == DNS_CLASS_SOA
+	  && length >= 20)
+	{
+	  minimum = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + length - 4));
+	  return ttl < minimum ? ttl : minimum;
+	}
+      ptr += length;
+    }
+  return 0;
+}
+
 static grub_err_t 
 recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	   struct grub_net_buff *nb,
@@ -268,6 +352,21 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
   if (head->ra_z_r_code & ERRCODE_MASK)
     {
       data->dns_err = 1;
+      /* The name doesn't exist whatever the type asked for, so there is
+	 no point in waiting for other answers.  */
+      if ((head->ra_z_r_code & ERRCODE_MASK) == ERRCODE_NXDOMAIN)
+	{
+	  grub_uint32_t ttl = negative_ttl (head, nb->tail);
+
+	  if (ttl > DNS_NEGATIVE_TTL_MAX)
+	    ttl = DNS_NEGATIVE_TTL_MAX;
+	  if (ttl && data->cache)
+	    {
+	      grub_dprintf ("dns", "caching name error for %d seconds\n", ttl);
+	      dns_cache_set (data->oname, 0, 0, ttl);
+	    }
+	  data->stop = 1;
+	}
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     }
@@ -397,28 +496,9 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
     }
   if (ttl_all && *data->naddresses && data->cache)
     {
-      int h;
       grub_dprintf ("dns", "caching for %d seconds\n", ttl_all);
-      h = hash (data->oname);
-      grub_free (dns_cache[h].name);
-      dns_cache[h].name = 0;
-      grub_free (dns_cache[h].addresses);
-      dns_cache[h].addresses = 0;
-      dns_cache[h].name = grub_strdup (data->oname);
-      dns_cache[h].naddresses = *data->naddresses;
-      dns_cache[h].addresses = grub_malloc (*data->naddresses
-					    * sizeof (dns_cache[h].addresses[0]));
-      dns_cache[h].limit_time = grub_get_time_ms () + 1000 * ttl_all;
-      if (!dns_cache[h].addresses || !dns_cache[h].name)
-	{
-	  grub_free (dns_cache[h].name);
-	  dns_cache[h].name = 0;
-	  grub_free (dns_cache[h].addresses);
-	  dns_cache[h].addresses = 0;
-	}
-      grub_memcpy (dns_cache[h].addresses, *data->addresses,
-		   *data->naddresses
-		   * sizeof (dns_cache[h].addresses[0]));
+      dns_cache_set (data->oname, *data->naddresses, *data->addresses,
+		     ttl_all);
     }
   grub_netbuff_free (nb);
   grub_free (redirect_save);
@@ -467,6 +547,9 @@ grub_net_dns_lookup (const char *name,
 	  && grub_get_time_ms () < dns_cache[h].limit_time)
 	{
 	  grub_dprintf ("dns", "retrieved from cache\n");
+	  if (!dns_cache[h].naddresses)
+	    return grub_error (GRUB_ERR_NET_NO_DOMAIN,
+			       N_("no DNS record found"));
 	  *addresses = grub_malloc (dns_cache[h].naddresses
 				    * sizeof ((*addresses)[0]));
 	  if (!*addresses)
@@ -699,6 +782,26 @@ grub_cmd_list_dns (struct grub_command *cmd __attribute__ ((unused)),
       grub_net_addr_to_str (&dns_servers[i], buf);
       grub_printf ("%s (%s)\n", buf, strtype);
     }
+
+  for (i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+      grub_uint64_t now = grub_get_time_ms ();
+      grub_size_t j;
+
+      if (!dns_cache[i].name || now >= dns_cache[i].limit_time)
+	continue;
+      grub_printf ("%s:", dns_cache[i].name);
+      for (j = 0; j < dns_cache[i].naddresses; j++)
+	{
+	  char buf[GRUB_NET_MAX_STR_ADDR_LEN];
+	  grub_net_addr_to_str (&dns_cache[i].addresses[j], buf);
+	  grub_printf (" %s", buf);
+	}
+      if (!dns_cache[i].naddresses)
+	grub_printf (" %s", _("not found"));
+      grub_printf (" (%" PRIuGRUB_UINT64_T "s)\n",
+		   (dns_cache[i].limit_time - now) / 1000);
+    }
   return GRUB_ERR_NONE;
 }
 
@@ -765,7 +868,7 @@ grub_dns_init (void)
 				   N_("DNSSERVER"),
 				   N_("Remove a DNS server"));
   cmd_list = grub_register_command ("net_ls_dns", grub_cmd_list_dns,
-				   NULL, N_("List DNS servers"));
+				   NULL, N_("List DNS servers and cached names"));
 }
 
 void
@@ -30,6 +30,39 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static grub_efi_guid_t net_io_guid = GRUB_EFI_SIMPLE_NETWORK_GUID;
 static grub_efi_guid_t pxe_io_guid = GRUB_EFI_PXE_GUID;
 
+/* Frames which may be in the hands of the firmware at once, so that a burst
+   of them, such as ACKs, isn't held up by the transmit latency of each.  */
+#define EFINET_TX_RING	8
+
+/* Take back the transmit buffers the firmware is done with, which it hands
+   back oldest first.  */
+static grub_err_t
+reap_tx (struct grub_net_card *dev)
+{
+  grub_efi_simple_network_t *net = dev->efi_net;
+  grub_efi_status_t st;
+  void *txbuf;
+
+  while (dev->tx_pending)
+    {
+      txbuf = NULL;
+      st = efi_call_3 (net->get_status, net, 0, &txbuf);
+      if (st != GRUB_EFI_SUCCESS)
+	return grub_error (GRUB_ERR_IO, N_("couldn't send network packet"));
+      /*
+	 Some buggy firmware could return an arbitrary address instead of the
+	 txbuf address we trasmitted, so just check that txbuf is non NULL
+	 for success.  This is ok because we open the SNP protocol in
+	 exclusive mode so we know we're the only ones transmitting on this
+	 box, and buffers are recycled in the order they were transmitted.
+       */
+      if (!txbuf)
+	break;
+      dev->tx_pending--;
+    }
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 send_card_buffer (struct grub_net_card *dev,
 		  struct grub_net_buff *pack)
@@ -37,58 +70,49 @@ send_card_buffer (struct grub_net_card *dev,
   grub_efi_status_t st;
   grub_efi_simple_network_t *net = dev->efi_net;
   grub_uint64_t limit_time = grub_get_time_ms () + 4000;
+  grub_size_t len;
   void *txbuf;
+  grub_err_t err;
 
-  if (dev->txbusy)
-    while (1)
-      {
-	txbuf = NULL;
-	st = efi_call_3 (net->get_status, net, 0, &txbuf);
-	if (st != GRUB_EFI_SUCCESS)
-	  return grub_error (GRUB_ERR_IO,
-			     N_("couldn't send network packet"));
-	/*
-	   Some buggy firmware could return an arbitrary address instead of the
-	   txbuf address we trasmitted, so just check that txbuf is non NULL
-	   for success.  This is ok because we open the SNP protocol in
-	   exclusive mode so we know we're the only ones transmitting on this
-	   box and since we only transmit one packet at a time we know our
-	   transmit was successfull.
-	 */
-	if (txbuf)
-	  {
-	    dev->txbusy = 0;
-	    break;
-	  }
-	if (limit_time < grub_get_time_ms ())
+  while (1)
+    {
+      err = reap_tx (dev);
+      if (err)
+	return err;
+      if (dev->tx_pending < EFINET_TX_RING)
+	break;
+      if (limit_time < grub_get_time_ms ())
+	{
+	  /* The firmware isn't going to hand them back.  */
+	  dev->tx_pending = 0;
 	  return grub_error (GRUB_ERR_TIMEOUT,
 			     N_("couldn't send network packet"));
-      }
+	}
+    }
 
-  dev->last_pkt_size = (pack->tail - pack->data);
-  if (dev->last_pkt_size > dev->mtu)
-    dev->last_pkt_size = dev->mtu;
+  len = (pack->tail - pack->data);
+  if (len > dev->mtu)
+    len = dev->mtu;
 
-  grub_memcpy (dev->txbuf, pack->data, dev->last_pkt_size);
+  txbuf = (char *) dev->txbuf + dev->tx_next * dev->txbufsize;
+  grub_memcpy (txbuf, pack->data, len);
 
-  st = efi_call_7 (net->transmit, net, 0, dev->last_pkt_size,
-		   dev->txbuf, NULL, NULL, NULL);
+  st = efi_call_7 (net->transmit, net, 0, len, txbuf, NULL, NULL, NULL);
   if (st != GRUB_EFI_SUCCESS)
     return grub_error (GRUB_ERR_IO, N_("couldn't send network packet"));
 
+  dev->tx_next = (dev->tx_next + 1) % EFINET_TX_RING;
+  dev->tx_pending++;
+
   /*
-     The card may have sent out the packet immediately - set txbusy
-     to 0 in this case.
+     The card may have sent out the packet immediately - take its buffer
+     back in this case.
      Cases were observed where checking txbuf at the next call
      of send_card_buffer() is too late: 0 is returned in txbuf and
      we run in the GRUB_ERR_TIMEOUT case above.
      Perhaps a timeout in the FW has discarded the recycle buffer.
    */
-  txbuf = NULL;
-  st = efi_call_3 (net->get_status, net, 0, &txbuf);
-  dev->txbusy = !(st == GRUB_EFI_SUCCESS && txbuf);
-
-  return GRUB_ERR_NONE;
+  return reap_tx (dev);
 }
 
 static struct grub_net_buff *
@@ -101,38 +125,41 @@ get_card_packet (struct grub_net_card *dev)
   struct grub_net_buff *nb;
   int i;
 
+  /* Frames are received straight into the netbuff handed to the upper
+     layers, which is kept in RCVBUF until a frame arrives.  */
   for (i = 0; i < 2; i++)
     {
       if (!dev->rcvbuf)
-	dev->rcvbuf = grub_malloc (dev->rcvbufsize);
-      if (!dev->rcvbuf)
-	return NULL;
+	{
+	  nb = grub_netbuff_alloc (dev->rcvbufsize + 2);
+	  if (!nb)
+	    return NULL;
+	  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is
+	     divisible by 4. So that IP header is aligned on 4 bytes. */
+	  if (grub_netbuff_reserve (nb, 2))
+	    {
+	      grub_netbuff_free (nb);
+	      return NULL;
+	    }
+	  dev->rcvbuf = nb;
+	}
+      nb = dev->rcvbuf;
+      bufsize = nb->end - nb->data;
 
       st = efi_call_7 (net->receive, net, NULL, &bufsize,
-		       dev->rcvbuf, NULL, NULL, NULL);
+		       nb->data, NULL, NULL, NULL);
       if (st != GRUB_EFI_BUFFER_TOO_SMALL)
 	break;
       dev->rcvbufsize = 2 * ALIGN_UP (dev->rcvbufsize > bufsize
 				      ? dev->rcvbufsize : bufsize, 64);
-      grub_free (dev->rcvbuf);
+      grub_netbuff_free (nb);
       dev->rcvbuf = 0;
     }
 
   if (st != GRUB_EFI_SUCCESS)
     return NULL;
 
-  nb = grub_netbuff_alloc (bufsize + 2);
-  if (!nb)
-    return NULL;
-
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (nb, 2))
-    {
-      grub_netbuff_free (nb);
-      return NULL;
-    }
-  grub_memcpy (nb->data, dev->rcvbuf, bufsize);
+  dev->rcvbuf = 0;
   err = grub_netbuff_put (nb, bufsize);
   if (err)
     {
@@ -143,6 +170,26 @@ get_card_packet (struct grub_net_card *dev)
   return nb;
 }
 
+/* Drain the receive queue of the card.  */
+static unsigned
+get_card_packets (struct grub_net_card *dev, struct grub_net_buff **bufs,
+		  unsigned max)
+{
+  unsigned n;
+
+  /* Transmit completions are collected here rather than waited for.  */
+  if (reap_tx (dev))
+    grub_errno = GRUB_ERR_NONE;
+
+  for (n = 0; n < max; n++)
+    {
+      bufs[n] = get_card_packet (dev);
+      if (!bufs[n])
+	break;
+    }
+  return n;
+}
+
 static grub_err_t
 open_card (struct grub_net_card *dev)
 {
@@ -205,6 +252,8 @@ open_card (struct grub_net_card *dev)
 static void
 close_card (struct grub_net_card *dev)
 {
+  /* Shutting down drops what is still queued.  */
+  dev->tx_pending = 0;
   efi_call_1 (dev->efi_net->shutdown, dev->efi_net);
   efi_call_1 (dev->efi_net->stop, dev->efi_net);
   efi_call_4 (grub_efi_system_table->boot_services->close_protocol,
@@ -218,7 +267,8 @@ static struct grub_net_card_driver efidriver =
     .open = open_card,
     .close = close_card,
     .send = send_card_buffer,
-    .recv = get_card_packet
+    .recv = get_card_packet,
+    .recv_batch = get_card_packets
   };
 
 grub_efi_handle_t
@@ -297,7 +347,7 @@ grub_efinet_findcards (void)
 
       card->mtu = net->mode->max_packet_size;
       card->txbufsize = ALIGN_UP (card->mtu, 64) + 256;
-      card->txbuf = grub_zalloc (card->txbufsize);
+      card->txbuf = grub_zalloc (card->txbufsize * EFINET_TX_RING);
       if (!card->txbuf)
 	{
 	  grub_print_error ();
@@ -305,7 +355,8 @@ grub_efinet_findcards (void)
 	  grub_free (card);
 	  return;
 	}
-      card->txbusy = 0;
+      card->tx_next = 0;
+      card->tx_pending = 0;
 
       card->rcvbufsize = ALIGN_UP (card->mtu, 64) + 256;
 
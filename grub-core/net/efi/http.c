@@ -0,0 +1,362 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* HTTP transfers through the firmware's EFI_HTTP_PROTOCOL, which runs on
+   the firmware's own TCP/IP stack and thus benefits from whatever offloads
+   the NIC driver has.  The firmware stack sits on top of the SNP instance
+   that efinet opens exclusively, so it is only usable on cards that GRUB
+   hasn't started driving itself.  */
+
+#include <grub/charset.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/efi/http.h>
+#include <grub/i18n.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/net.h>
+#include <grub/time.h>
+
+static grub_efi_guid_t http_sb_guid = GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
+static grub_efi_guid_t http_guid = GRUB_EFI_HTTP_PROTOCOL_GUID;
+
+enum
+  {
+    EFIHTTP_TIMEOUT = 10000,
+    /* Size of one read of the body.  */
+    EFIHTTP_CHUNK = 65536,
+    /* Reads kept queued ahead of the reader.  */
+    EFIHTTP_QUEUE = 8
+  };
+
+struct grub_efihttp
+{
+  grub_efi_service_binding_t *sb;
+  grub_efi_handle_t child;
+  grub_efi_http_t *http;
+  int have_length;
+  grub_uint64_t content_length;
+  grub_uint64_t body_recv;
+  /* Bytes to drop from a server that ignored the range.  */
+  grub_uint64_t skip;
+};
+
+/* Run one request or response transaction to completion.  The token's
+   event has no notification function: it is polled, so that the firmware
+   never calls back into GRUB.  */
+static grub_efi_status_t
+efihttp_transact (struct grub_efihttp *h, int response,
+		  grub_efi_http_message_t *msg)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_http_token_t token;
+  grub_efi_status_t st;
+  grub_uint64_t limit;
+
+  st = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK, NULL, NULL,
+		   &token.event);
+  if (st != GRUB_EFI_SUCCESS)
+    return st;
+  token.status = GRUB_EFI_SUCCESS;
+  token.message = msg;
+
+  if (response)
+    st = efi_call_2 (h->http->response, h->http, &token);
+  else
+    st = efi_call_2 (h->http->request, h->http, &token);
+
+  limit = grub_get_time_ms () + EFIHTTP_TIMEOUT;
+  while (st == GRUB_EFI_SUCCESS)
+    {
+      efi_call_1 (h->http->poll, h->http);
+      if (efi_call_1 (b->check_event, token.event) == GRUB_EFI_SUCCESS)
+	{
+	  st = token.status;
+	  break;
+	}
+      if (grub_get_time_ms () > limit)
+	{
+	  efi_call_2 (h->http->cancel, h->http, &token);
+	  st = GRUB_EFI_TIMEOUT;
+	}
+    }
+
+  efi_call_1 (b->close_event, token.event);
+  return st;
+}
+
+static void
+efihttp_free_headers (grub_efi_http_message_t *msg)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_uintn_t i;
+
+  if (!msg->headers)
+    return;
+  for (i = 0; i < msg->header_count; i++)
+    {
+      if (msg->headers[i].field_name)
+	efi_call_1 (b->free_pool, msg->headers[i].field_name);
+      if (msg->headers[i].field_value)
+	efi_call_1 (b->free_pool, msg->headers[i].field_value);
+    }
+  efi_call_1 (b->free_pool, msg->headers);
+  msg->headers = 0;
+}
+
+void
+grub_efihttp_close (struct grub_efihttp *h)
+{
+  if (!h)
+    return;
+  efi_call_2 (h->sb->destroy_child, h->sb, h->child);
+  grub_free (h);
+}
+
+/* Send the request, returning 0 if the firmware failed at it.  */
+static int
+efihttp_request (struct grub_efihttp *h, const char *server,
+		 const char *filename, grub_off_t offset)
+{
+  grub_efi_http_request_data_t request;
+  grub_efi_http_message_t msg;
+  grub_efi_http_header_t headers[3];
+  char range[sizeof ("bytes=XXXXXXXXXXXXXXXXXXXX-")];
+  grub_efi_char16_t *url16;
+  grub_efi_status_t st;
+  char *url;
+  grub_size_t len;
+
+  url = grub_xasprintf ("http://%s%s", server, filename);
+  if (!url)
+    return 0;
+  len = grub_strlen (url);
+  url16 = grub_malloc ((len + 1) * sizeof (url16[0]));
+  if (!url16)
+    {
+      grub_free (url);
+      return 0;
+    }
+  len = grub_utf8_to_utf16 (url16, len, (grub_uint8_t *) url, len, 0);
+  url16[len] = 0;
+  grub_free (url);
+
+  request.method = GRUB_EFI_HTTP_METHOD_GET;
+  request.url = url16;
+
+  headers[0].field_name = (grub_efi_char8_t *) "Host";
+  headers[0].field_value = (grub_efi_char8_t *) server;
+  headers[1].field_name = (grub_efi_char8_t *) "User-Agent";
+  headers[1].field_value = (grub_efi_char8_t *) PACKAGE_STRING;
+  headers[2].field_name = (grub_efi_char8_t *) "Range";
+  headers[2].field_value = (grub_efi_char8_t *) range;
+  grub_snprintf (range, sizeof (range), "bytes=%" PRIuGRUB_UINT64_T "-",
+		 offset);
+
+  grub_memset (&msg, 0, sizeof (msg));
+  msg.data.request = &request;
+  msg.header_count = offset ? 3 : 2;
+  msg.headers = headers;
+
+  st = efihttp_transact (h, 0, &msg);
+  grub_free (url16);
+  return st == GRUB_EFI_SUCCESS;
+}
+
+grub_err_t
+grub_efihttp_open (grub_file_t file, const char *filename, grub_off_t offset,
+		   struct grub_efihttp **out)
+{
+  const char *server = file->device->net->server;
+  grub_efi_service_binding_t *sb = 0;
+  struct grub_net_card *card;
+  struct grub_efihttp *h;
+  grub_efi_httpv4_access_point_t ap;
+  grub_efi_http_config_data_t config;
+  grub_efi_http_response_data_t response;
+  grub_efi_http_message_t msg;
+  grub_uint64_t total = GRUB_FILE_SIZE_UNKNOWN;
+  grub_efi_uintn_t i;
+
+  *out = 0;
+
+  /* Only IPv4 is configured.  */
+  if (grub_strchr (server, ':'))
+    return GRUB_ERR_NET_NO_CARD;
+
+  FOR_NET_CARDS (card)
+    if (!card->opened && grub_strcmp (card->driver->name, "efinet") == 0)
+      {
+	sb = grub_efi_open_protocol (card->efi_handle, &http_sb_guid,
+				     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (sb)
+	  break;
+      }
+  if (!sb)
+    return GRUB_ERR_NET_NO_CARD;
+
+  h = grub_zalloc (sizeof (*h));
+  if (!h)
+    return grub_errno;
+  h->sb = sb;
+  if (efi_call_2 (sb->create_child, sb, &h->child) != GRUB_EFI_SUCCESS)
+    {
+      grub_free (h);
+      return GRUB_ERR_NET_NO_CARD;
+    }
+
+  h->http = grub_efi_open_protocol (h->child, &http_guid,
+				    GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!h->http)
+    goto no_offload;
+
+  grub_memset (&ap, 0, sizeof (ap));
+  ap.use_default_address = 1;
+  config.http_version = GRUB_EFI_HTTP_VERSION_11;
+  config.timeout_millisec = EFIHTTP_TIMEOUT;
+  config.local_address_is_ipv6 = 0;
+  config.access_point.ipv4_node = &ap;
+  if (efi_call_2 (h->http->configure, h->http, &config) != GRUB_EFI_SUCCESS)
+    goto no_offload;
+
+  if (!efihttp_request (h, server, filename, offset))
+    goto no_offload;
+
+  grub_memset (&msg, 0, sizeof (msg));
+  response.status_code = GRUB_EFI_HTTP_STATUS_UNSUPPORTED_STATUS;
+  msg.data.response = &response;
+  if (efihttp_transact (h, 1, &msg) != GRUB_EFI_SUCCESS)
+    {
+      efihttp_free_headers (&msg);
+      goto no_offload;
+    }
+
+  for (i = 0; i < msg.header_count; i++)
+    {
+      const char *name = (const char *) msg.headers[i].field_name;
+      const char *value = (const char *) msg.headers[i].field_value;
+
+      if (!name || !value)
+	continue;
+      if (grub_strcasecmp (name, "Content-Length") == 0)
+	{
+	  h->content_length = grub_strtoull (value, 0, 10);
+	  h->have_length = 1;
+	}
+      else if (grub_strcasecmp (name, "Content-Range") == 0)
+	{
+	  value = grub_strchr (value, '/');
+	  if (value && value[1] != '*')
+	    total = grub_strtoull (value + 1, 0, 10);
+	}
+    }
+  efihttp_free_headers (&msg);
+  grub_errno = GRUB_ERR_NONE;
+
+  switch (response.status_code)
+    {
+    case GRUB_EFI_HTTP_STATUS_200_OK:
+      h->skip = offset;
+      if (h->have_length)
+	total = h->content_length;
+      break;
+    case GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT:
+      if (total == GRUB_FILE_SIZE_UNKNOWN && h->have_length)
+	total = offset + h->content_length;
+      break;
+    case GRUB_EFI_HTTP_STATUS_404_NOT_FOUND:
+      grub_efihttp_close (h);
+      return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+			 filename);
+    default:
+      grub_efihttp_close (h);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("unsupported HTTP error %d: %s"),
+			 response.status_code, filename);
+    }
+
+  if (offset == 0)
+    file->size = total;
+  grub_dprintf ("http", "%s: using the firmware HTTP protocol\n", filename);
+  *out = h;
+  return GRUB_ERR_NONE;
+
+ no_offload:
+  grub_efihttp_close (h);
+  grub_errno = GRUB_ERR_NONE;
+  return GRUB_ERR_NET_NO_CARD;
+}
+
+grub_err_t
+grub_efihttp_fill (grub_file_t file, struct grub_efihttp *h)
+{
+  grub_net_t net = file->device->net;
+
+  while (!net->eof && net->packs.count < EFIHTTP_QUEUE)
+    {
+      struct grub_net_buff *nb;
+      grub_efi_http_message_t msg;
+      grub_uint64_t skip;
+
+      nb = grub_netbuff_alloc (EFIHTTP_CHUNK);
+      if (!nb)
+	return grub_errno;
+
+      grub_memset (&msg, 0, sizeof (msg));
+      msg.body = nb->data;
+      msg.body_length = EFIHTTP_CHUNK;
+      if (h->have_length && msg.body_length > h->content_length - h->body_recv)
+	msg.body_length = h->content_length - h->body_recv;
+
+      if (efihttp_transact (h, 1, &msg) != GRUB_EFI_SUCCESS)
+	{
+	  grub_netbuff_free (nb);
+	  net->eof = 1;
+	  if (h->have_length)
+	    return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			       N_("couldn't read `%s'"), net->name);
+	  /* Without a length the body ends with the connection.  */
+	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+	    {
+	      struct grub_net_packet *pack;
+
+	      file->size = net->offset;
+	      for (pack = net->packs.first; pack; pack = pack->next)
+		file->size += pack->nb->tail - pack->nb->data;
+	    }
+	  return GRUB_ERR_NONE;
+	}
+
+      grub_netbuff_put (nb, msg.body_length);
+      h->body_recv += msg.body_length;
+      if (h->have_length && h->body_recv >= h->content_length)
+	net->eof = 1;
+
+      skip = h->skip < msg.body_length ? h->skip : msg.body_length;
+      h->skip -= skip;
+      grub_netbuff_pull (nb, skip);
+      if (nb->tail == nb->data)
+	grub_netbuff_free (nb);
+      else if (grub_net_put_packet (&net->packs, nb))
+	{
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+    }
+  return GRUB_ERR_NONE;
+}
@@ -26,14 +26,38 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/http.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 enum
   {
-    HTTP_PORT = 80
+    HTTP_PORT = 80,
+    /* Idle connections kept open for reuse by later requests.  */
+    HTTP_MAX_IDLE = 4,
+    /* Files longer than one segment are fetched as ranges of this size,
+       with up to HTTP_SEGMENTS of them in flight on separate
+       connections.  */
+    HTTP_SEGMENT_SIZE = 4 << 20,
+    HTTP_SEGMENTS = 4
   };
 
+/* A connection to an HTTP server.  It is the hook data of its socket and
+   outlives the file it was opened for when it can be reused.  */
+struct http_conn
+{
+  struct http_conn *next;
+  char *server;
+  grub_net_tcp_socket_t sock;
+  /* The file being transferred, NULL while the connection is idle.  */
+  grub_file_t file;
+  /* The response being received.  */
+  struct http_data *data;
+};
+
+static struct http_conn *idle_conns;
 
 typedef struct http_data
 {
@@ -49,8 +73,93 @@ typedef struct http_data
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  struct http_conn *conn;
+  /* Whether CONN was taken from the idle connections.  */
+  int reused;
+  /* Length of the response body, if the server sent it.  */
+  int have_length;
+  grub_uint64_t content_length;
+  grub_uint64_t body_recv;
+  int no_reuse;
+  /* The server answered with a partial response.  */
+  int partial;
+  /* The body is compressed with gzip (Content-Encoding).  */
+  int gzip;
+  /* Bytes of the body to drop, when the server ignored the range asked
+     for and sends the file from its start.  */
+  grub_uint64_t skip;
+  /* The requested range, RANGE_END being 0 for one up to the end.  */
+  grub_uint64_t range_start;
+  grub_uint64_t range_end;
+  /* A segment being fetched ahead of the one being read keeps its data
+     in PACKS until its turn comes.  */
+  int ahead;
+  grub_net_packets_t packs;
+  struct http_data *next_seg;
+#ifdef GRUB_MACHINE_EFI
+  /* Transfer run by the firmware instead.  */
+  struct grub_efihttp *efi;
+#endif
 } *http_data_t;
 
+static void
+http_conn_free (struct http_conn *conn)
+{
+  if (conn->sock)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+static void
+http_conn_unlink_idle (struct http_conn *conn)
+{
+  struct http_conn **p;
+
+  for (p = &idle_conns; *p; p = &(*p)->next)
+    if (*p == conn)
+      {
+	*p = conn->next;
+	return;
+      }
+}
+
+/* Take an idle connection to SERVER, if there is one.  */
+static struct http_conn *
+http_conn_get_idle (const char *server)
+{
+  struct http_conn *conn;
+
+  for (conn = idle_conns; conn; conn = conn->next)
+    if (grub_strcmp (conn->server, server) == 0)
+      {
+	http_conn_unlink_idle (conn);
+	return conn;
+      }
+  return 0;
+}
+
+/* Keep CONN around for the next request, dropping the oldest idle
+   connection if there are too many.  */
+static void
+http_conn_put_idle (struct http_conn *conn)
+{
+  struct http_conn **p;
+  int n = 1;
+
+  conn->file = 0;
+  conn->next = idle_conns;
+  idle_conns = conn;
+
+  for (p = &idle_conns->next; *p; p = &(*p)->next)
+    if (++n > HTTP_MAX_IDLE)
+      {
+	http_conn_free (*p);
+	*p = 0;
+	break;
+      }
+}
+
 static grub_off_t
 have_ahead (struct grub_file *file)
 {
@@ -79,7 +188,7 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
     {
       data->chunk_rem = grub_strtoul (ptr, 0, 16);
       grub_errno = GRUB_ERR_NONE;
-      if (data->chunk_rem == 0)
+      if (data->chunk_rem == 0 && !data->ahead)
 	{
 	  file->device->net->eof = 1;
 	  file->device->net->stall = 1;
@@ -94,6 +203,8 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       data->headers_recv = 1;
       if (data->chunked)
 	data->in_chunk_len = 2;
+      if (!data->partial && !data->err)
+	data->skip = data->range_start;
       return GRUB_ERR_NONE;
     }
 
@@ -112,13 +223,25 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 	return grub_errno;
       switch (code)
 	{
-	case 200:
 	case 206:
+	  data->partial = 1;
+	  break;
+	case 200:
 	  break;
 	case 404:
 	  data->err = GRUB_ERR_FILE_NOT_FOUND;
 	  data->errmsg = grub_xasprintf (_("file `%s' not found"), data->filename);
 	  return GRUB_ERR_NONE;
+	case 416:
+	  /* An empty file has no first segment to send.  */
+	  if (data->range_start == 0 && data->range_end)
+	    {
+	      file->size = 0;
+	      data->size_recv = 1;
+	      data->range_end = 0;
+	      break;
+	    }
+	  /* Fallthrough.  */
 	default:
 	  data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
 	  /* TRANSLATORS: GRUB HTTP code is pretty young. So even perfectly
@@ -131,51 +254,129 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0 && !data->have_length)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, &ptr, 10);
+      data->content_length = grub_strtoull (ptr, &ptr, 10);
+      data->have_length = 1;
+      if (!data->size_recv)
+	file->size = data->content_length;
       data->size_recv = 1;
       return GRUB_ERR_NONE;
     }
+  /* The size of the whole file, when asked for a range of it.  */
+  if (grub_memcmp (ptr, "Content-Range: bytes ",
+		   sizeof ("Content-Range: bytes ") - 1) == 0 && !data->ahead)
+    {
+      ptr = grub_strchr (ptr, '/');
+      if (ptr && ptr[1] != '*')
+	{
+	  file->size = grub_strtoull (ptr + 1, 0, 10);
+	  data->size_recv = 1;
+	}
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Connection: close",
+		   sizeof ("Connection: close") - 1) == 0)
+    {
+      data->no_reuse = 1;
+      return GRUB_ERR_NONE;
+    }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
 		   sizeof ("Transfer-Encoding: chunked") - 1) == 0)
     {
       data->chunked = 1;
       return GRUB_ERR_NONE;
     }
+  if (grub_strcmp (ptr, "Content-Encoding: gzip") == 0
+      || grub_strcmp (ptr, "Content-Encoding: x-gzip") == 0)
+    {
+      data->gzip = 1;
+      return GRUB_ERR_NONE;
+    }
 
   return GRUB_ERR_NONE;  
 }
 
+/* Drop from NB what DATA is to skip of the body.  Return whether nothing
+   is left of NB.  */
+static int
+http_skip (http_data_t data, struct grub_net_buff *nb)
+{
+  grub_size_t len = nb->tail - nb->data;
+
+  if (!data->skip)
+    return 0;
+  if (len > data->skip)
+    len = data->skip;
+  data->skip -= len;
+  grub_netbuff_pull (nb, len);
+  return nb->tail == nb->data;
+}
+
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
 
+  /* The server dropped an idle connection.  */
+  if (!file)
+    {
+      http_conn_unlink_idle (conn);
+      http_conn_free (conn);
+      return;
+    }
+
+  data = conn->data;
   if (data->sock)
     grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
   data->sock = 0;
+  conn->sock = 0;
   if (data->current_line)
     grub_free (data->current_line);
   data->current_line = 0;
+  /* A failed segment is fetched again when its turn comes.  */
+  if (data->ahead)
+    return;
   file->device->net->eof = 1;
   file->device->net->stall = 1;
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = have_ahead (file);
 }
 
+static void
+http_abort (http_data_t data)
+{
+  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+  data->no_reuse = 1;
+}
+
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
+  grub_net_packets_t *packs;
   grub_err_t err;
 
+  /* Nothing is expected on an idle connection.  */
+  if (!file)
+    {
+      grub_netbuff_free (nb);
+      http_conn_unlink_idle (conn);
+      http_conn_free (conn);
+      return GRUB_ERR_NONE;
+    }
+
+  data = conn->data;
+  packs = data->ahead ? &data->packs : &file->device->net->packs;
   if (!data->sock)
     {
       grub_netbuff_free (nb);
@@ -202,7 +403,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      return grub_errno;
 	    }
 	      
@@ -222,7 +423,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  data->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -239,7 +440,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      if (!data->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  http_abort (data);
 		  return grub_errno;
 		}
 	      data->current_line_len = (char *) nb->tail - ptr;
@@ -250,7 +451,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  err = parse_line (file, data, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_abort (data);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -265,22 +466,30 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	  http_abort (data);
 	  grub_netbuff_free (nb);
 	  return err;
 	}
       if (!(data->chunked && (grub_ssize_t) data->chunk_rem
 	    < nb->tail - nb->data))
 	{
-	  grub_net_put_packet (&file->device->net->packs, nb);
-	  if (file->device->net->packs.count >= 20)
+	  data->body_recv += nb->tail - nb->data;
+	  if (data->chunked)
+	    data->chunk_rem -= nb->tail - nb->data;
+	  if (http_skip (data, nb))
+	    {
+	      grub_netbuff_free (nb);
+	      return GRUB_ERR_NONE;
+	    }
+	  grub_net_put_packet (packs, nb);
+	  /* Segments ahead are bounded by their range, so they are never
+	     stalled.  */
+	  if (!data->ahead && file->device->net->packs.count >= 20)
 	    file->device->net->stall = 1;
 
-	  if (file->device->net->packs.count >= 100)
+	  if (!data->ahead && file->device->net->packs.count
+	      >= grub_net_queue_limit (file->device->net, 100))
 	    grub_net_tcp_stall (data->sock);
-
-	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
 	  return GRUB_ERR_NONE;
 	}
       if (data->chunk_rem)
@@ -291,25 +500,42 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	    return grub_errno;
 	  grub_netbuff_put (nb2, data->chunk_rem);
 	  grub_memcpy (nb2->data, nb->data, data->chunk_rem);
-	  if (file->device->net->packs.count >= 20)
+	  if (!data->ahead && file->device->net->packs.count
+	      >= grub_net_queue_limit (file->device->net, 20))
 	    {
 	      file->device->net->stall = 1;
 	      grub_net_tcp_stall (data->sock);
 	    }
 
-	  grub_net_put_packet (&file->device->net->packs, nb2);
+	  if (http_skip (data, nb2))
+	    grub_netbuff_free (nb2);
+	  else
+	    grub_net_put_packet (packs, nb2);
 	  grub_netbuff_pull (nb, data->chunk_rem);
 	}
       data->in_chunk_len = 1;
     }
 }
 
-static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+/* Whether to ask for a compressed transfer of FILE.  The first request
+   does when compressed data can be decoded, and the later ones for the
+   same file ask for what the first one got, so that ranges of it fit
+   together.  */
+static int
+http_accept_gzip (struct grub_file *file, int initial)
+{
+  if (initial)
+    return grub_file_filters_all[GRUB_FILE_FILTER_GZIO] != 0;
+  return file->device->net->gzip;
+}
+
+/* Build the GET request for the range [OFFSET, END) of FILE, END being 0
+   for the rest of the file.  */
+static struct grub_net_buff *
+http_request (struct grub_file *file, http_data_t data, grub_off_t offset,
+	      grub_off_t end, int initial)
 {
-  http_data_t data = file->data;
   grub_uint8_t *ptr;
-  int i;
   struct grub_net_buff *nb;
   grub_err_t err;
 
@@ -320,10 +546,11 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + grub_strlen (file->device->net->server)
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
 				     "\r\n") - 1
+			   + sizeof ("Accept-Encoding: gzip\r\n") - 1
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
+				     "-XXXXXXXXXXXXXXXXXXXX\r\n\r\n"));
   if (!nb)
-    return grub_errno;
+    return NULL;
 
   grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
   ptr = nb->tail;
@@ -331,7 +558,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "GET ", sizeof ("GET ") - 1);
 
@@ -341,7 +568,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, data->filename, grub_strlen (data->filename));
 
@@ -350,7 +577,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, " HTTP/1.1\r\nHost: ",
 	       sizeof (" HTTP/1.1\r\nHost: ") - 1);
@@ -360,7 +587,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, file->device->net->server,
 	       grub_strlen (file->device->net->server));
@@ -372,11 +599,28 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
 	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
+  if (http_accept_gzip (file, initial))
+    {
+      ptr = nb->tail;
+      grub_netbuff_put (nb, sizeof ("Accept-Encoding: gzip\r\n") - 1);
+      grub_memcpy (ptr, "Accept-Encoding: gzip\r\n",
+		   sizeof ("Accept-Encoding: gzip\r\n") - 1);
+    }
+  if (end)
+    {
+      ptr = nb->tail;
+      grub_snprintf ((char *) ptr,
+		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			     "XXXXXXXXXXXXXXXXXXXX\r\n"),
+		     "Range: bytes=%" PRIuGRUB_UINT64_T "-%" PRIuGRUB_UINT64_T
+		     "\r\n", offset, end - 1);
+      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
+    }
+  else if (!initial)
     {
       ptr = nb->tail;
       grub_snprintf ((char *) ptr,
@@ -390,34 +634,233 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   grub_netbuff_put (nb, 2);
   grub_memcpy (ptr, "\r\n", 2);
 
-  data->sock = grub_net_tcp_open (file->device->net->server,
-				  HTTP_PORT, http_receive,
-				  http_err, http_err,
-				  file);
-  if (!data->sock)
+  return nb;
+}
+
+/* Send the request for DATA's range, on an idle connection unless FRESH
+   is set.  */
+static grub_err_t
+http_send (struct grub_file *file, http_data_t data, int initial, int fresh)
+{
+  struct http_conn *conn;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+
+  nb = http_request (file, data, data->range_start, data->range_end, initial);
+  if (!nb)
+    return grub_errno;
+
+  conn = fresh ? 0 : http_conn_get_idle (file->device->net->server);
+  data->reused = (conn != 0);
+  if (conn)
     {
-      grub_netbuff_free (nb);
-      return grub_errno;
+      grub_dprintf ("http", "reusing connection to %s\n", conn->server);
+      conn->file = file;
+      conn->data = data;
+      grub_net_tcp_unstall (conn->sock);
     }
-
-  //  grub_net_poll_cards (5000);
+  else
+    {
+      conn = grub_zalloc (sizeof (*conn));
+      if (!conn)
+	{
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      conn->server = grub_strdup (file->device->net->server);
+      if (!conn->server)
+	{
+	  grub_free (conn);
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      conn->file = file;
+      conn->data = data;
+      conn->sock = grub_net_tcp_open (file->device->net->server,
+				      HTTP_PORT, http_receive,
+				      http_err, http_err,
+				      conn);
+      if (!conn->sock)
+	{
+	  http_conn_free (conn);
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+    }
+  data->conn = conn;
+  data->sock = conn->sock;
 
   err = grub_net_send_tcp_packet (data->sock, nb, 1);
   if (err)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      data->sock = 0;
+      data->conn = 0;
+      http_conn_free (conn);
       return err;
     }
+  return GRUB_ERR_NONE;
+}
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
+static void
+http_wait_headers (http_data_t data)
+{
+  int i;
+
+  for (i = 0; !data->headers_recv && data->sock && i < 100; i++)
     {
       grub_net_tcp_retransmit ();
       grub_net_poll_cards (300, &data->headers_recv);
     }
+}
+
+static int
+http_complete (http_data_t data)
+{
+  return (data->headers_recv && !data->chunked && data->have_length
+	  && data->body_recv == data->content_length);
+}
+
+/* Detach the connection from the file, keeping it for later requests if
+   the whole response was received.  */
+static void
+http_conn_release (http_data_t data)
+{
+  struct http_conn *conn = data->conn;
+
+  if (!conn)
+    return;
+  data->conn = 0;
+
+  if (data->sock && conn->sock && !data->no_reuse && !data->err
+      && http_complete (data))
+    http_conn_put_idle (conn);
+  else
+    http_conn_free (conn);
+  data->sock = 0;
+}
+
+/* Free DATA together with the segments fetched ahead of it.  */
+static void
+http_data_free (http_data_t data)
+{
+  http_data_t next;
+
+  for (; data; data = next)
+    {
+      next = data->next_seg;
+#ifdef GRUB_MACHINE_EFI
+      grub_efihttp_close (data->efi);
+#endif
+      http_conn_release (data);
+      grub_free (data->current_line);
+      grub_free (data->errmsg);
+      while (data->packs.first)
+	{
+	  grub_netbuff_free (data->packs.first->nb);
+	  grub_net_remove_packet (data->packs.first);
+	}
+      grub_free (data->filename);
+      grub_free (data);
+    }
+}
+
+/* Request the segments following the one being read, keeping
+   HTTP_SEGMENTS of them in flight.  Failing to start one isn't fatal: it
+   is then fetched when its turn comes.  */
+static void
+http_start_ahead (struct grub_file *file)
+{
+  http_data_t data = file->data, seg, *p;
+  grub_off_t next;
+  int n = 1;
+
+  if (!data->range_end || file->size == GRUB_FILE_SIZE_UNKNOWN)
+    return;
+
+  next = data->range_end;
+  for (p = &data->next_seg; *p; p = &(*p)->next_seg)
+    {
+      next = (*p)->range_end;
+      n++;
+    }
+
+  for (; n < HTTP_SEGMENTS && next < file->size; n++)
+    {
+      seg = grub_zalloc (sizeof (*seg));
+      if (!seg)
+	break;
+      seg->filename = grub_strdup (data->filename);
+      if (!seg->filename)
+	{
+	  grub_free (seg);
+	  break;
+	}
+      seg->ahead = 1;
+      seg->size_recv = 1;
+      seg->range_start = next;
+      seg->range_end = next + HTTP_SEGMENT_SIZE;
+      if (seg->range_end > file->size)
+	seg->range_end = file->size;
+      if (http_send (file, seg, 0, 0))
+	{
+	  http_data_free (seg);
+	  break;
+	}
+      grub_dprintf ("http", "fetching %" PRIuGRUB_UINT64_T "-%"
+		    PRIuGRUB_UINT64_T " ahead\n", seg->range_start,
+		    seg->range_end);
+      *p = seg;
+      p = &seg->next_seg;
+      next = seg->range_end;
+    }
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static grub_err_t
+http_establish (struct grub_file *file, grub_off_t offset, int initial)
+{
+  http_data_t data = file->data;
+  grub_err_t err;
+  int retried = 0;
+
+  data->range_start = offset;
+  /* Only a file read from its start is fetched in segments: anything else
+     is likely to be read at random.  */
+  if (initial)
+    data->range_end = HTTP_SEGMENT_SIZE;
+
+ again:
+  err = http_send (file, data, initial, retried);
+  if (err)
+    return err;
+
+  http_wait_headers (data);
+
+  /* The server may have closed an idle connection just as we reused it.
+     Try again once on a fresh one.  */
+  if (!data->headers_recv && data->reused && !data->first_line_recv)
+    {
+      grub_dprintf ("http", "reused connection failed, reconnecting\n");
+      http_conn_free (data->conn);
+      data->sock = 0;
+      data->conn = 0;
+      grub_free (data->current_line);
+      data->current_line = 0;
+      data->current_line_len = 0;
+      file->device->net->eof = 0;
+      file->device->net->stall = 0;
+      if (initial)
+	file->size = GRUB_FILE_SIZE_UNKNOWN;
+      retried = 1;
+      grub_errno = GRUB_ERR_NONE;
+      goto again;
+    }
 
   if (!data->headers_recv)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      http_conn_free (data->conn);
+      data->sock = 0;
+      data->conn = 0;
       if (data->err)
 	{
 	  char *str = data->errmsg;
@@ -428,6 +871,24 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 	}
       return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
     }
+
+  /* The body is decoded above the protocol, so it must be the same
+     encoding of the file all along.  */
+  if (initial)
+    file->device->net->gzip = data->gzip;
+  else if (data->gzip != file->device->net->gzip)
+    {
+      http_conn_free (data->conn);
+      data->sock = 0;
+      data->conn = 0;
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("`%s' changed while being read"), data->filename);
+    }
+
+  /* The server ignored the range and sends the whole file.  */
+  if (!data->partial)
+    data->range_end = 0;
+  http_start_ahead (file);
   return GRUB_ERR_NONE;
 }
 
@@ -437,10 +898,6 @@ http_seek (struct grub_file *file, grub_off_t off)
   struct http_data *old_data, *data;
   grub_err_t err;
   old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
 
   while (file->device->net->packs.first)
     {
@@ -452,6 +909,19 @@ http_seek (struct grub_file *file, grub_off_t off)
   file->device->net->eof = 0;
   file->device->net->offset = off;
 
+#ifdef GRUB_MACHINE_EFI
+  if (old_data->efi)
+    {
+      grub_efihttp_close (old_data->efi);
+      old_data->efi = 0;
+      err = grub_efihttp_open (file, old_data->filename, off, &old_data->efi);
+      if (err == GRUB_ERR_NONE)
+	return grub_efihttp_fill (file, old_data->efi);
+      if (err != GRUB_ERR_NET_NO_CARD)
+	return err;
+    }
+#endif
+
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
@@ -464,20 +934,54 @@ http_seek (struct grub_file *file, grub_off_t off)
       file->data = 0;
       return grub_errno;
     }
-  grub_free (old_data);
+  old_data->filename = 0;
+  http_data_free (old_data);
 
   file->data = data;
   err = http_establish (file, off, 0);
   if (err)
     {
-      grub_free (data->filename);
-      grub_free (data);
+      http_data_free (data);
       file->data = 0;
       return err;
     }
   return GRUB_ERR_NONE;
 }
 
+/* Start reading from the segment fetched after the one just finished.  */
+static grub_err_t
+http_next_segment (struct grub_file *file)
+{
+  http_data_t old_data = file->data, seg = old_data->next_seg;
+
+  http_wait_headers (seg);
+  if (!seg->partial || seg->err || seg->errmsg
+      || seg->gzip != file->device->net->gzip
+      || (!seg->sock && !http_complete (seg)))
+    {
+      grub_dprintf ("http", "segment at %" PRIuGRUB_UINT64_T
+		    " failed, requesting the rest\n", seg->range_start);
+      return http_seek (file, file->device->net->offset);
+    }
+
+  old_data->next_seg = 0;
+  http_data_free (old_data);
+  file->data = seg;
+
+  while (seg->packs.first)
+    {
+      grub_net_put_packet (&file->device->net->packs, seg->packs.first->nb);
+      grub_net_remove_packet (seg->packs.first);
+    }
+  seg->ahead = 0;
+  /* The previous connection may have been closed once it was done.  */
+  file->device->net->eof = 0;
+  file->device->net->stall = 0;
+
+  http_start_ahead (file);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 http_open (struct grub_file *file, const char *filename)
 {
@@ -499,11 +1003,22 @@ http_open (struct grub_file *file, const char *filename)
   file->not_easily_seekable = 0;
   file->data = data;
 
+#ifdef GRUB_MACHINE_EFI
+  err = grub_efihttp_open (file, filename, 0, &data->efi);
+  if (err == GRUB_ERR_NONE)
+    err = grub_efihttp_fill (file, data->efi);
+  if (err != GRUB_ERR_NET_NO_CARD)
+    {
+      if (err)
+	http_data_free (data);
+      return err;
+    }
+#endif
+
   err = http_establish (file, 0, 1);
   if (err)
     {
-      grub_free (data->filename);
-      grub_free (data);
+      http_data_free (data);
       return err;
     }
 
@@ -518,12 +1033,7 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  if (data->current_line)
-    grub_free (data->current_line);
-  grub_free (data->filename);
-  grub_free (data);
+  http_data_free (data);
   return GRUB_ERR_NONE;
 }
 
@@ -532,6 +1042,22 @@ http_packets_pulled (struct grub_file *file)
 {
   http_data_t data = file->data;
 
+#ifdef GRUB_MACHINE_EFI
+  if (data && data->efi)
+    return grub_efihttp_fill (file, data->efi);
+#endif
+
+  if (data && data->next_seg && !file->device->net->packs.first
+      && http_complete (data))
+    {
+      grub_err_t err;
+
+      err = http_next_segment (file);
+      if (err)
+	return err;
+      data = file->data;
+    }
+
   if (file->device->net->packs.count >= 20)
     return 0;
 
@@ -558,5 +1084,13 @@ GRUB_MOD_INIT (http)
 
 GRUB_MOD_FINI (http)
 {
+  struct http_conn *conn, *next;
+
+  for (conn = idle_conns; conn; conn = next)
+    {
+      next = conn->next;
+      http_conn_free (conn);
+    }
+  idle_conns = 0;
   grub_net_app_level_unregister (&grub_http_protocol);
 }
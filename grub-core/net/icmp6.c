@@ -492,7 +492,10 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 		}
 	      }
 	    if (route_inf != NULL)
-	      grub_net_add_route_gw (name, netaddr, *source, route_inf);
+	      {
+		grub_net_add_route_gw (name, netaddr, *source, route_inf);
+		grub_net_ipv6_default_route = 1;
+	      }
 	    grub_free (name);
 	  }
 next:
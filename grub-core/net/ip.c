@@ -92,29 +92,67 @@ struct reassemble
 
 static struct reassemble *reassembles;
 
-grub_uint16_t
-grub_net_ip_chksum (void *ipv, grub_size_t len)
+/* The one's complement sum doesn't depend on the byte order as long as it
+   is the same throughout, so add the data as native 32-bit words and
+   leave it to the result to be stored back in the same order.  */
+static grub_uint64_t
+chksum_add (grub_uint64_t sum, const grub_uint8_t *ptr, grub_size_t len)
 {
-  grub_uint16_t *ip = (grub_uint16_t *) ipv;
-  grub_uint32_t sum = 0;
-
-  for (; len >= 2; len -= 2)
+  for (; len >= 16; len -= 16, ptr += 16)
+    {
+      sum += grub_get_unaligned32 (ptr);
+      sum += grub_get_unaligned32 (ptr + 4);
+      sum += grub_get_unaligned32 (ptr + 8);
+      sum += grub_get_unaligned32 (ptr + 12);
+    }
+  for (; len >= 4; len -= 4, ptr += 4)
+    sum += grub_get_unaligned32 (ptr);
+  if (len >= 2)
     {
-      sum += grub_be_to_cpu16 (grub_get_unaligned16 (ip++));
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      sum += grub_get_unaligned16 (ptr);
+      ptr += 2;
+      len -= 2;
     }
   if (len)
     {
-      sum += *((grub_uint8_t *) ip) << 8;
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      grub_uint8_t last[2] = { *ptr, 0 };
+      sum += grub_get_unaligned16 (last);
     }
+  return sum;
+}
 
-  if (sum >= 0xFFFF)
-    sum -= 0xFFFF;
+static grub_uint16_t
+chksum_fold (grub_uint64_t sum)
+{
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  if (sum == 0xffff)
+    sum = 0;
+  return sum;
+}
 
-  return grub_cpu_to_be16 ((~sum) & 0x0000FFFF);
+grub_uint16_t
+grub_net_ip_chksum (void *ipv, grub_size_t len)
+{
+  return ~chksum_fold (chksum_add (0, ipv, len));
+}
+
+grub_uint16_t
+grub_net_ip_chksum_update32 (grub_uint16_t chksum, grub_uint32_t from,
+			     grub_uint32_t to)
+{
+  grub_uint64_t sum;
+
+  /* RFC 1624: HC' = ~(~HC + ~m + m').  */
+  sum = (grub_uint16_t) ~chksum;
+  sum += ~from & 0xffff;
+  sum += (~from >> 16) & 0xffff;
+  sum += to & 0xffff;
+  sum += to >> 16;
+  return ~chksum_fold (sum);
 }
 
 static int id = 0x2400;
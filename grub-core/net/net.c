@@ -29,6 +29,7 @@
 #include <grub/net/ethernet.h>
 #include <grub/net/arp.h>
 #include <grub/net/ip.h>
+#include <grub/net/tcp.h>
 #include <grub/loader.h>
 #include <grub/bufio.h>
 #include <grub/kernel.h>
@@ -38,6 +39,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 char *grub_net_default_server;
 
 struct grub_net_route *grub_net_routes = NULL;
+int grub_net_ipv6_default_route;
 struct grub_net_network_level_interface *grub_net_network_level_interfaces = NULL;
 struct grub_net_card *grub_net_cards = NULL;
 struct grub_net_network_level_protocol *grub_net_network_level_protocols = NULL;
@@ -47,23 +49,61 @@ struct grub_net_link_layer_entry {
   int avail;
   grub_net_network_level_address_t nl_address;
   grub_net_link_level_address_t ll_address;
+  /* When the entry was last confirmed.  */
+  grub_uint64_t update_time;
 };
 
-#define LINK_LAYER_CACHE_SIZE 256
+/* The neighbour cache of a card is set-associative: an address may only
+   live in the LINK_LAYER_CACHE_WAYS entries of the bucket its hash picks.  */
+#define LINK_LAYER_CACHE_BUCKETS 64
+#define LINK_LAYER_CACHE_WAYS 4
+#define LINK_LAYER_CACHE_SIZE (LINK_LAYER_CACHE_BUCKETS * LINK_LAYER_CACHE_WAYS)
+/* Entries older than this are resolved again, and ones past half of it
+   refreshed in the background when used.  */
+#define LINK_LAYER_ENTRY_LIFETIME (5 * 60 * 1000)
+
+static struct grub_net_link_layer_entry *
+link_layer_bucket (const grub_net_network_level_address_t *proto,
+		   const struct grub_net_card *card)
+{
+  grub_uint64_t v = 0;
+
+  switch (proto->type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      v = proto->ipv4;
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      v = proto->ipv6[0] ^ proto->ipv6[1];
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
+      break;
+    }
+  v ^= v >> 32;
+  v ^= v >> 16;
+  v ^= v >> 8;
+  return &card->link_layer_table[(v % LINK_LAYER_CACHE_BUCKETS)
+				 * LINK_LAYER_CACHE_WAYS];
+}
 
 static struct grub_net_link_layer_entry *
 link_layer_find_entry (const grub_net_network_level_address_t *proto,
 		       const struct grub_net_card *card)
 {
+  struct grub_net_link_layer_entry *bucket;
+  grub_uint64_t now;
   unsigned i;
+
   if (!card->link_layer_table)
     return NULL;
-  for (i = 0; i < LINK_LAYER_CACHE_SIZE; i++)
+  bucket = link_layer_bucket (proto, card);
+  now = grub_get_time_ms ();
+  for (i = 0; i < LINK_LAYER_CACHE_WAYS; i++)
     {
-      if (card->link_layer_table[i].avail == 1 
-	  && grub_net_addr_cmp (&card->link_layer_table[i].nl_address,
-				proto) == 0)
-	return &card->link_layer_table[i];
+      if (bucket[i].avail == 1
+	  && now - bucket[i].update_time < LINK_LAYER_ENTRY_LIFETIME
+	  && grub_net_addr_cmp (&bucket[i].nl_address, proto) == 0)
+	return &bucket[i];
     }
   return NULL;
 }
@@ -74,13 +114,17 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_link_level_address_t *ll,
 				 int override)
 {
-  struct grub_net_link_layer_entry *entry;
+  struct grub_net_link_layer_entry *entry, *bucket;
+  unsigned i;
 
   /* Check if the sender is in the cache table.  */
   entry = link_layer_find_entry (nl, card);
   /* Update sender hardware address.  */
   if (entry && override)
-    grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
+    {
+      grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
+      entry->update_time = grub_get_time_ms ();
+    }
   if (entry)
     return;
 
@@ -88,13 +132,51 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
   if (card->link_layer_table == NULL)
     card->link_layer_table = grub_zalloc (LINK_LAYER_CACHE_SIZE
 					  * sizeof (card->link_layer_table[0]));
-  entry = &(card->link_layer_table[card->new_ll_entry]);
+  if (card->link_layer_table == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  /* Take a free or stale way, else the least recently confirmed one.  */
+  bucket = link_layer_bucket (nl, card);
+  entry = &bucket[0];
+  for (i = 0; i < LINK_LAYER_CACHE_WAYS; i++)
+    {
+      if (!bucket[i].avail
+	  || grub_net_addr_cmp (&bucket[i].nl_address, nl) == 0)
+	{
+	  entry = &bucket[i];
+	  break;
+	}
+      if (bucket[i].update_time < entry->update_time)
+	entry = &bucket[i];
+    }
   entry->avail = 1;
   grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
   grub_memcpy (&entry->nl_address, nl, sizeof (entry->nl_address));
-  card->new_ll_entry++;
-  if (card->new_ll_entry == LINK_LAYER_CACHE_SIZE)
-    card->new_ll_entry = 0;
+  entry->update_time = grub_get_time_ms ();
+}
+
+/* Start resolving the next hop towards ADDR unless it is known already,
+   without waiting for the answer, which the cache records whenever it
+   comes.  */
+void
+grub_net_link_layer_prefetch (const grub_net_network_level_address_t *addr)
+{
+  struct grub_net_network_level_interface *inf;
+  grub_net_network_level_address_t gateway;
+
+  if (grub_net_route_address (*addr, &gateway, &inf))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  if (gateway.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+      || grub_net_link_layer_resolve_check (inf, &gateway))
+    return;
+  if (grub_net_arp_send_request_nowait (inf, &gateway))
+    grub_errno = GRUB_ERR_NONE;
 }
 
 int
@@ -151,6 +233,11 @@ grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
   if (entry)
     {
       *hw_addr = entry->ll_address;
+      if (proto_addr->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+	  && grub_get_time_ms () - entry->update_time
+	  > LINK_LAYER_ENTRY_LIFETIME / 2
+	  && grub_net_arp_send_request_nowait (inf, proto_addr))
+	grub_errno = GRUB_ERR_NONE;
       return GRUB_ERR_NONE;
     }
   switch (proto_addr->type)
@@ -363,6 +450,9 @@ grub_cmd_ipv6_autoconf (struct grub_command *cmd __attribute__ ((unused)),
     j++;
   }
 
+  /* As with DHCP, stop waiting for the other cards as soon as a router
+     advertisement gives us a default route.  */
+  grub_net_ipv6_default_route = 0;
   for (interval = 200; interval < 10000; interval *= 2)
     {
       int done = 1;
@@ -377,13 +467,15 @@ grub_cmd_ipv6_autoconf (struct grub_command *cmd __attribute__ ((unused)),
 	}
       if (done)
 	break;
-      grub_net_poll_cards (interval, 0);
+      grub_net_poll_cards (interval, &grub_net_ipv6_default_route);
+      if (grub_net_ipv6_default_route)
+	break;
     }
 
   err = GRUB_ERR_NONE;
   for (j = 0; j < ncards; j++)
     {
-      if (slaacs[j]->slaac_counter)
+      if (slaacs[j]->slaac_counter || grub_net_ipv6_default_route)
 	continue;
       err = grub_error (GRUB_ERR_FILE_NOT_FOUND,
 			N_("couldn't autoconfigure %s"),
@@ -1403,11 +1495,60 @@ grub_net_fs_dir (grub_device_t device, const char *path __attribute__ ((unused))
   return GRUB_ERR_NONE;
 }
 
+/* Files opened ahead by net_prefetch.  They make progress in every poll
+   of the cards until the first grub_net_fs_open of the same file takes
+   them over.  */
+struct grub_net_prefetch
+{
+  struct grub_net_prefetch *next;
+  grub_file_t file;
+};
+
+static struct grub_net_prefetch *prefetched;
+static int prefetching;
+
+static void
+prefetch_close_all (void)
+{
+  struct grub_net_prefetch *pf, *next;
+
+  for (pf = prefetched; pf; pf = next)
+    {
+      next = pf->next;
+      grub_file_close (pf->file);
+      grub_free (pf);
+    }
+  prefetched = 0;
+}
+
 static grub_err_t
 grub_net_fs_open (struct grub_file *file_out, const char *name)
 {
   grub_err_t err;
   struct grub_file *file, *bufio;
+  struct grub_net_prefetch **pfp;
+
+  for (pfp = &prefetched; *pfp && !prefetching; pfp = &(*pfp)->next)
+    {
+      struct grub_net_prefetch *pf = *pfp;
+      grub_net_t net = pf->file->device->net;
+
+      if (grub_strcmp (net->name, name) != 0
+	  || net->protocol != file_out->device->net->protocol
+	  || grub_strcmp (net->server, file_out->device->net->server) != 0)
+	continue;
+      grub_dprintf ("net", "using the prefetched %s\n", name);
+      *pfp = pf->next;
+      net->prefetch = 0;
+      /* The stream keeps its own device.  */
+      grub_device_close (file_out->device);
+      grub_free (pf->file->name);
+      grub_memcpy (file_out, pf->file, sizeof (*file_out));
+      file_out->name = 0;
+      grub_free (pf->file);
+      grub_free (pf);
+      return GRUB_ERR_NONE;
+    }
 
   file = grub_malloc (sizeof (*file));
   if (!file)
@@ -1435,7 +1576,44 @@ grub_net_fs_open (struct grub_file *file_out, const char *name)
       grub_free (file);
       return err;
     }
+  /* A transfer the server compressed is decoded below everything else,
+     whether the compression filters are enabled for this open or not.  */
+  if (file->device->net->gzip)
+    {
+      grub_file_filter_t gunzip = grub_file_filters_all[GRUB_FILE_FILTER_GZIO];
+      grub_file_t decoded = gunzip ? gunzip (file, name) : 0;
+
+      if (decoded == file)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "`%s' isn't compressed as the server claims", name);
+	  decoded = 0;
+	}
+      if (!decoded)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			"can't decode `%s'", name);
+	  while (file->device->net->packs.first)
+	    {
+	      grub_netbuff_free (file->device->net->packs.first->nb);
+	      grub_net_remove_packet (file->device->net->packs.first);
+	    }
+	  file->device->net->protocol->close (file);
+	  grub_free (file->device->net->name);
+	  grub_free (file);
+	  return grub_errno;
+	}
+      file = decoded;
+    }
+
   bufio = grub_bufio_open (file, 32768);
+  /* The decoder buffers its input anyway.  */
+  if (! bufio && file->device->net->gzip)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      bufio = file;
+    }
   if (! bufio)
     {
       while (file->device->net->packs.first)
@@ -1484,29 +1662,47 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
 	  return;
 	}
       card->opened = 1;
+      /* Room for a frame with its link-level headers and alignment.  */
+      if (grub_netbuff_pool_init (card->mtu + 512, GRUB_NET_POOL_PACKETS))
+	grub_errno = GRUB_ERR_NONE;
     }
   while (received < 100)
     {
-      /* Maybe should be better have a fixed number of packets for each card
-	 and just mark them as used and not used.  */ 
-      struct grub_net_buff *nb;
+      struct grub_net_buff *nbs[GRUB_NET_RECV_BATCH];
+      unsigned n, i;
 
       if (received > 10 && stop_condition && *stop_condition)
 	break;
 
-      nb = card->driver->recv (card);
-      if (!nb)
+      if (card->driver->recv_batch)
+	n = card->driver->recv_batch (card, nbs, ARRAY_SIZE (nbs));
+      else
+	for (n = 0; n < ARRAY_SIZE (nbs); n++)
+	  {
+	    nbs[n] = card->driver->recv (card);
+	    if (!nbs[n])
+	      break;
+	  }
+
+      /* TCP acknowledges the whole batch at once.  */
+      grub_net_tcp_defer_acks (1);
+      for (i = 0; i < n; i++)
 	{
-	  card->last_poll = grub_get_time_ms ();
-	  break;
+	  grub_net_recv_ethernet_packet (nbs[i], card);
+	  if (grub_errno)
+	    {
+	      grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
+			    grub_errmsg);
+	      grub_errno = GRUB_ERR_NONE;
+	    }
 	}
-      received++;
-      grub_net_recv_ethernet_packet (nb, card);
-      if (grub_errno)
+      grub_net_tcp_defer_acks (0);
+      received += n;
+
+      if (n < ARRAY_SIZE (nbs))
 	{
-	  grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
-			grub_errmsg);
-	  grub_errno = GRUB_ERR_NONE;
+	  card->last_poll = grub_get_time_ms ();
+	  break;
 	}
     }
   grub_print_error ();
@@ -1625,14 +1821,14 @@ grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
       if (net->protocol->packets_pulled)
 	net->protocol->packets_pulled (file);
 
-      if (!net->eof)
-	{
-	  try++;
-	  grub_net_poll_cards (GRUB_NET_INTERVAL +
-                               (try * GRUB_NET_INTERVAL_ADDITION), &net->stall);
-        }
-      else
+      /* Take what the protocol just queued before waiting for more.  */
+      if (net->packs.first)
+	continue;
+      if (net->eof)
 	return total;
+      try++;
+      grub_net_poll_cards (GRUB_NET_INTERVAL +
+			   (try * GRUB_NET_INTERVAL_ADDITION), &net->stall);
     }
   grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"), net->name);
   return -1;
@@ -1715,10 +1911,52 @@ static struct grub_fs grub_net_fs =
     .mtime = NULL,
   };
 
+static grub_err_t
+grub_cmd_prefetch (struct grub_command *cmd __attribute__ ((unused)),
+		   int argc, char **args)
+{
+  int i;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  for (i = 0; i < argc; i++)
+    {
+      struct grub_net_prefetch *pf;
+      grub_file_t file;
+
+      /* Whatever opens it later applies its own filters.  */
+      grub_file_filter_disable_all ();
+      prefetching = 1;
+      file = grub_file_open (args[i]);
+      prefetching = 0;
+      if (!file)
+	return grub_errno;
+      if (!file->device || !file->device->net)
+	{
+	  grub_file_close (file);
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			     N_("`%s' is not a network file"), args[i]);
+	}
+      file->device->net->prefetch = 1;
+      pf = grub_malloc (sizeof (*pf));
+      if (!pf)
+	{
+	  grub_file_close (file);
+	  return grub_errno;
+	}
+      pf->file = file;
+      pf->next = prefetched;
+      prefetched = pf;
+    }
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_net_fini_hw (int noreturn __attribute__ ((unused)))
 {
   struct grub_net_card *card;
+  prefetch_close_all ();
   FOR_NET_CARDS (card) 
     if (card->opened)
       {
@@ -1726,6 +1964,7 @@ grub_net_fini_hw (int noreturn __attribute__ ((unused)))
 	  card->driver->close (card);
 	card->opened = 0;
       }
+  grub_netbuff_pool_fini ();
   return GRUB_ERR_NONE;
 }
 
@@ -1739,7 +1978,7 @@ static struct grub_preboot *fini_hnd;
 
 static grub_command_t cmd_addaddr, cmd_deladdr, cmd_addroute, cmd_delroute;
 static grub_command_t cmd_lsroutes, cmd_lscards;
-static grub_command_t cmd_lsaddr, cmd_slaac;
+static grub_command_t cmd_lsaddr, cmd_slaac, cmd_prefetch;
 
 GRUB_MOD_INIT(net)
 {
@@ -1782,6 +2021,10 @@ GRUB_MOD_INIT(net)
 				       "", N_("list network cards"));
   cmd_lsaddr = grub_register_command ("net_ls_addr", grub_cmd_listaddrs,
 				       "", N_("list network addresses"));
+  cmd_prefetch = grub_register_command ("net_prefetch", grub_cmd_prefetch,
+					N_("FILE..."),
+					N_("Start downloading network files in"
+					   " the background."));
   grub_bootp_init ();
   grub_dns_init ();
 
@@ -1807,6 +2050,7 @@ GRUB_MOD_FINI(net)
   grub_unregister_command (cmd_lscards);
   grub_unregister_command (cmd_lsaddr);
   grub_unregister_command (cmd_slaac);
+  grub_unregister_command (cmd_prefetch);
   grub_fs_unregister (&grub_net_fs);
   grub_net_open = NULL;
   grub_net_fini_hw (0);
@@ -21,6 +21,73 @@
 #include <grub/mm.h>
 #include <grub/net/netbuff.h>
 
+/* Buffers big enough for one frame of any opened card come from a pool
+   and go back to it when freed, so that bulk transfers don't cost an
+   allocation and a free per packet.  The most recently freed buffer is
+   reused first, as it is the most likely to still be in the cache.  */
+#define NETBUFF_POOL_MAX 256
+
+static void *netbuff_pool;
+static unsigned netbuff_pool_count;
+static grub_size_t netbuff_pool_len = NETBUFF_ALIGN;
+
+static void *
+netbuff_alloc_data (grub_size_t len)
+{
+#ifdef GRUB_MACHINE_EMU
+  return grub_malloc (len + sizeof (struct grub_net_buff));
+#else
+  return grub_memalign (NETBUFF_ALIGN, len + sizeof (struct grub_net_buff));
+#endif
+}
+
+static void
+netbuff_pool_drain (void)
+{
+  while (netbuff_pool)
+    {
+      void *next = *(void **) netbuff_pool;
+      grub_free (netbuff_pool);
+      netbuff_pool = next;
+    }
+  netbuff_pool_count = 0;
+}
+
+/* Make the pooled buffers at least LEN bytes long and preallocate COUNT
+   of them.  */
+grub_err_t
+grub_netbuff_pool_init (grub_size_t len, unsigned count)
+{
+  len = ALIGN_UP (len, NETBUFF_ALIGN);
+  if (len > netbuff_pool_len)
+    {
+      netbuff_pool_drain ();
+      netbuff_pool_len = len;
+    }
+  if (count > NETBUFF_POOL_MAX)
+    count = NETBUFF_POOL_MAX;
+
+  while (netbuff_pool_count < count)
+    {
+      void *data;
+
+      data = netbuff_alloc_data (netbuff_pool_len);
+      if (!data)
+	return grub_errno;
+      *(void **) data = netbuff_pool;
+      netbuff_pool = data;
+      netbuff_pool_count++;
+    }
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_netbuff_pool_fini (void)
+{
+  netbuff_pool_drain ();
+  netbuff_pool_len = NETBUFF_ALIGN;
+}
+
 grub_err_t
 grub_netbuff_put (struct grub_net_buff *nb, grub_size_t len)
 {
@@ -83,13 +150,20 @@ grub_netbuff_alloc (grub_size_t len)
     len = NETBUFFMINLEN;
 
   len = ALIGN_UP (len, NETBUFF_ALIGN);
-#ifdef GRUB_MACHINE_EMU
-  data = grub_malloc (len + sizeof (*nb));
-#else
-  data = grub_memalign (NETBUFF_ALIGN, len + sizeof (*nb));
-#endif
-  if (!data)
-    return NULL;
+  if (len <= netbuff_pool_len)
+    len = netbuff_pool_len;
+  if (len == netbuff_pool_len && netbuff_pool)
+    {
+      data = netbuff_pool;
+      netbuff_pool = *(void **) data;
+      netbuff_pool_count--;
+    }
+  else
+    {
+      data = netbuff_alloc_data (len);
+      if (!data)
+	return NULL;
+    }
   nb = (struct grub_net_buff *) ((grub_properly_aligned_t *) data
 				 + len / sizeof (grub_properly_aligned_t));
   nb->head = nb->data = nb->tail = data;
@@ -122,6 +196,14 @@ grub_netbuff_free (struct grub_net_buff *nb)
 {
   if (!nb)
     return;
+  if ((grub_size_t) (nb->end - nb->head) == netbuff_pool_len
+      && netbuff_pool_count < NETBUFF_POOL_MAX)
+    {
+      *(void **) nb->head = netbuff_pool;
+      netbuff_pool = nb->head;
+      netbuff_pool_count++;
+      return;
+    }
   grub_free (nb->head);
 }
 
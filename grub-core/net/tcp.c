@@ -28,6 +28,16 @@
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* The receive window starts small and doubles every time a whole window
+   is consumed without the reader stalling, up to TCP_MAX_WINDOW.  Windows
+   above 64K need window scaling (RFC 7323) to be negotiated.  */
+#define TCP_INITIAL_WINDOW 16384
+#define TCP_MAX_WINDOW (4 << 20)
+#define TCP_WINDOW_SCALE 7
+/* SACK blocks (RFC 2018) carried in an ACK, which is as many as fit in
+   the option space without timestamps.  */
+#define TCP_SACK_BLOCKS 4
+
 struct unacked
 {
   struct unacked *next;
@@ -47,6 +57,22 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_END = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_MSS = 2,
+    TCP_OPT_WINDOW_SCALE = 3,
+    TCP_OPT_SACK_PERMITTED = 4,
+    TCP_OPT_SACK = 5
+  };
+
+struct tcp_sack_block
+{
+  grub_uint32_t left;
+  grub_uint32_t right;
+};
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -61,11 +87,23 @@ struct grub_net_tcp_socket
   int they_reseted;
   int i_reseted;
   int i_stall;
+  /* In-order data was received but not acknowledged yet.  */
+  int ack_pending;
   grub_uint32_t my_start_seq;
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  grub_uint32_t my_window;
+  /* Shift of the windows we advertise, nonzero once the peer agreed.  */
+  int my_wscale;
+  /* In-order bytes received since the window was last grown.  */
+  grub_uint32_t window_consumed;
+  int sack_permitted;
+  /* Largest segment the peer takes, 0 if it didn't say.  */
+  grub_uint16_t their_mss;
+  /* Out-of-order data held in PQ, most recently received first.  */
+  struct tcp_sack_block sack[TCP_SACK_BLOCKS];
+  int num_sack;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -130,6 +168,64 @@ static struct grub_net_tcp_listen *tcp_listens;
 #define FOR_TCP_SOCKETS(var) FOR_LIST_ELEMENTS (var, tcp_sockets)
 #define FOR_TCP_LISTENS(var) FOR_LIST_ELEMENTS (var, tcp_listens)
 
+/* The window field to send on SOCK, in network byte order.  */
+static grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  grub_uint32_t window;
+
+  if (sock->i_stall)
+    return 0;
+  window = sock->my_window >> sock->my_wscale;
+  if (window > 0xffff)
+    window = 0xffff;
+  return grub_cpu_to_be16 (window);
+}
+
+/* Record that [LEFT, RIGHT) arrived out of order.  */
+static void
+tcp_sack_add (grub_net_tcp_socket_t sock, grub_uint32_t left,
+	      grub_uint32_t right)
+{
+  int i, j;
+
+  /* Merge every block touching the new one into it.  */
+  for (i = 0, j = 0; i < sock->num_sack; i++)
+    {
+      struct tcp_sack_block *b = &sock->sack[i];
+
+      if ((grub_int32_t) (b->right - left) >= 0
+	  && (grub_int32_t) (right - b->left) >= 0)
+	{
+	  if ((grub_int32_t) (b->left - left) < 0)
+	    left = b->left;
+	  if ((grub_int32_t) (b->right - right) > 0)
+	    right = b->right;
+	}
+      else
+	sock->sack[j++] = *b;
+    }
+
+  if (j == TCP_SACK_BLOCKS)
+    j--;
+  grub_memmove (&sock->sack[1], &sock->sack[0], j * sizeof (sock->sack[0]));
+  sock->sack[0].left = left;
+  sock->sack[0].right = right;
+  sock->num_sack = j + 1;
+}
+
+/* Forget the SACK blocks that in-order data has caught up with.  */
+static void
+tcp_sack_trim (grub_net_tcp_socket_t sock)
+{
+  int i, j;
+
+  for (i = 0, j = 0; i < sock->num_sack; i++)
+    if ((grub_int32_t) (sock->sack[i].left - sock->their_cur_seq) > 0)
+      sock->sack[j++] = sock->sack[i];
+  sock->num_sack = j;
+}
+
 grub_net_tcp_listen_t
 grub_net_tcp_listen (grub_uint16_t port,
 		     const struct grub_net_network_level_interface *inf,
@@ -301,7 +397,13 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   struct tcphdr *tcph_ack;
   grub_err_t err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  int num_sack = (!res && sock->sack_permitted) ? sock->num_sack : 0;
+  grub_size_t optlen = num_sack ? 4 + num_sack * sizeof (sock->sack[0]) : 0;
+  int i;
+
+  sock->ack_pending = 0;
+
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + optlen + 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -313,7 +415,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
       return;
     }
 
-  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack));
+  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack) + optlen);
   if (err)
     {
       grub_netbuff_free (nb_ack);
@@ -330,10 +432,25 @@ ack_real (grub_net_tcp_socket_t sock, int res)
     }
   else
     {
+      grub_uint8_t *opt = (grub_uint8_t *) (tcph_ack + 1);
+
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-      tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->flags = grub_cpu_to_be16 (((5 + optlen / 4) << 12) | TCP_ACK);
+      tcph_ack->window = tcp_window (sock);
+      if (num_sack)
+	{
+	  *opt++ = TCP_OPT_NOP;
+	  *opt++ = TCP_OPT_NOP;
+	  *opt++ = TCP_OPT_SACK;
+	  *opt++ = 2 + num_sack * sizeof (sock->sack[0]);
+	  for (i = 0; i < num_sack; i++)
+	    {
+	      grub_set_unaligned32 (opt, grub_cpu_to_be32 (sock->sack[i].left));
+	      grub_set_unaligned32 (opt + 4,
+				    grub_cpu_to_be32 (sock->sack[i].right));
+	      opt += sizeof (sock->sack[0]);
+	    }
+	}
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -352,6 +469,24 @@ ack (grub_net_tcp_socket_t sock)
   ack_real (sock, 0);
 }
 
+/* While set, acknowledgements of in-order data wait for the end of the
+   batch of received frames.  */
+static int defer_acks;
+
+void
+grub_net_tcp_defer_acks (int defer)
+{
+  grub_net_tcp_socket_t sock;
+
+  defer_acks = defer;
+  if (defer)
+    return;
+
+  FOR_TCP_SOCKETS (sock)
+    if (sock->ack_pending)
+      ack (sock);
+}
+
 static void
 reset (grub_net_tcp_socket_t sock)
 {
@@ -390,11 +525,12 @@ grub_net_tcp_retransmit (void)
 	if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
 	    && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
 	  {
-	    tcph->checksum = 0;
-	    tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
-							     GRUB_NET_IP_TCP,
-							     &sock->inf->address,
-							     &sock->out_nla);
+	    grub_uint32_t ack = grub_cpu_to_be32 (sock->their_cur_seq);
+
+	    /* Acknowledge what came in meanwhile.  */
+	    tcph->checksum = grub_net_ip_chksum_update32 (tcph->checksum,
+							  tcph->ack, ack);
+	    tcph->ack = ack;
 	  }
 
 	err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
@@ -536,7 +672,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   tcph = (void *) nb_ack->data;
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
   tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  tcph->window = tcp_window (sock);
   tcph->urgent = 0;
   sock->established = 1;
   tcp_socket_register (sock);
@@ -604,7 +740,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + 12 + 128);
   if (!nb)
     {
       grub_free (socket);
@@ -619,7 +755,7 @@ grub_net_tcp_open (char *server,
       return NULL;
     }
 
-  err = grub_netbuff_put (nb, sizeof (*tcph));
+  err = grub_netbuff_put (nb, sizeof (*tcph) + 12);
   if (err)
     {
       grub_free (socket);
@@ -637,11 +773,35 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
+  socket->my_window = TCP_INITIAL_WINDOW;
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->flags = grub_cpu_to_be16_compile_time ((8 << 12) | TCP_SYN);
+  tcph->window = tcp_window (socket);
+  {
+    grub_uint8_t *opt = (grub_uint8_t *) (tcph + 1);
+    grub_size_t mss;
+
+    /* Without it the peer may assume 536 bytes, and with jumbo frames the
+       card takes much more than the usual 1460.  */
+    mss = socket->inf->card->mtu - sizeof (*tcph)
+      - (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+	 ? GRUB_NET_OUR_IPV4_HEADER_SIZE : GRUB_NET_OUR_IPV6_HEADER_SIZE);
+    if (mss > 0xffff)
+      mss = 0xffff;
+
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    grub_set_unaligned16 (opt + 2, grub_cpu_to_be16 (mss));
+    opt[4] = TCP_OPT_NOP;
+    opt[5] = TCP_OPT_WINDOW_SCALE;
+    opt[6] = 3;
+    opt[7] = TCP_WINDOW_SCALE;
+    opt[8] = TCP_OPT_NOP;
+    opt[9] = TCP_OPT_NOP;
+    opt[10] = TCP_OPT_SACK_PERMITTED;
+    opt[11] = 2;
+  }
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -706,6 +866,9 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
 	       - sizeof (*tcph));
   else
     fraglen = 1280 - GRUB_NET_OUR_IPV6_HEADER_SIZE;
+  /* The card may do jumbo frames while the peer's path doesn't.  */
+  if (socket->their_mss && fraglen > socket->their_mss)
+    fraglen = socket->their_mss;
 
   while (nb->tail - nb->data > fraglen)
     {
@@ -727,8 +890,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = tcp_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -751,11 +913,38 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = tcp_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
 
+/* Pick up the options the peer agreed to in its SYN.  */
+static void
+parse_syn_options (grub_net_tcp_socket_t sock, struct tcphdr *tcph)
+{
+  grub_uint8_t *opt = (grub_uint8_t *) (tcph + 1);
+  grub_uint8_t *end = (grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+
+  while (opt < end && *opt != TCP_OPT_END)
+    {
+      if (*opt == TCP_OPT_NOP)
+	{
+	  opt++;
+	  continue;
+	}
+      if (opt + 2 > end || opt[1] < 2 || opt + opt[1] > end)
+	break;
+      if (opt[0] == TCP_OPT_WINDOW_SCALE && opt[1] == 3)
+	sock->my_wscale = TCP_WINDOW_SCALE;
+      if (opt[0] == TCP_OPT_SACK_PERMITTED && opt[1] == 2)
+	sock->sack_permitted = 1;
+      if (opt[0] == TCP_OPT_MSS && opt[1] == 4)
+	sock->their_mss = grub_be_to_cpu16 (grub_get_unaligned16 (opt + 2));
+      opt += opt[1];
+    }
+}
+
 grub_err_t
 grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
@@ -763,6 +952,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 {
   struct tcphdr *tcph;
   grub_net_tcp_socket_t sock;
+  struct grub_net_buff *in_order = NULL;
   grub_err_t err;
 
   /* Ignore broadcast.  */
@@ -823,6 +1013,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->established = 1;
+	parse_syn_options (sock, tcph);
       }
 
     if (grub_be_to_cpu16 (tcph->flags) & TCP_RST)
@@ -876,11 +1067,28 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	reset (sock);
       }
 
-    err = grub_priority_queue_push (sock->pq, &nb);
-    if (err)
+    if ((grub_int32_t) (grub_be_to_cpu32 (tcph->seqnr) - sock->their_cur_seq)
+	> 0)
       {
-	grub_netbuff_free (nb);
-	return err;
+	grub_ssize_t len = nb->tail - nb->data
+	  - (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+	if (len > 0)
+	  tcp_sack_add (sock, grub_be_to_cpu32 (tcph->seqnr),
+			grub_be_to_cpu32 (tcph->seqnr) + len);
+      }
+
+    /* Most segments arrive in order.  Those are taken as they are, and
+       only the ones that arrived early go through the queue.  */
+    if (grub_be_to_cpu32 (tcph->seqnr) == sock->their_cur_seq)
+      in_order = nb;
+    else
+      {
+	err = grub_priority_queue_push (sock->pq, &nb);
+	if (err)
+	  {
+	    grub_netbuff_free (nb);
+	    return err;
+	  }
       }
 
     {
@@ -891,7 +1099,11 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	{
 	  nb_top_p = grub_priority_queue_top (sock->pq);
 	  if (!nb_top_p)
-	    return GRUB_ERR_NONE;
+	    {
+	      if (in_order)
+		break;
+	      return GRUB_ERR_NONE;
+	    }
 	  nb_top = *nb_top_p;
 	  tcph = (struct tcphdr *) nb_top->data;
 	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
@@ -899,22 +1111,31 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  grub_netbuff_free (nb_top);
 	  grub_priority_queue_pop (sock->pq);
 	}
-      if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
+      if (!in_order && grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
 	{
 	  ack (sock);
 	  return GRUB_ERR_NONE;
 	}
       while (1)
 	{
-	  nb_top_p = grub_priority_queue_top (sock->pq);
-	  if (!nb_top_p)
-	    break;
-	  nb_top = *nb_top_p;
-	  tcph = (struct tcphdr *) nb_top->data;
-
-	  if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
-	    break;
-	  grub_priority_queue_pop (sock->pq);
+	  if (in_order)
+	    {
+	      nb_top = in_order;
+	      in_order = NULL;
+	      tcph = (struct tcphdr *) nb_top->data;
+	    }
+	  else
+	    {
+	      nb_top_p = grub_priority_queue_top (sock->pq);
+	      if (!nb_top_p)
+		break;
+	      nb_top = *nb_top_p;
+	      tcph = (struct tcphdr *) nb_top->data;
+
+	      if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
+		break;
+	      grub_priority_queue_pop (sock->pq);
+	    }
 
 	  err = grub_netbuff_pull (nb_top, (grub_be_to_cpu16 (tcph->flags)
 					    >> 12) * sizeof (grub_uint32_t));
@@ -925,6 +1146,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    }
 
 	  sock->their_cur_seq += (nb_top->tail - nb_top->data);
+	  sock->window_consumed += (nb_top->tail - nb_top->data);
 	  if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
 	    {
 	      sock->they_closed = 1;
@@ -941,7 +1163,17 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  else
 	    grub_netbuff_free (nb_top);
 	}
-      if (do_ack)
+      tcp_sack_trim (sock);
+      if (sock->window_consumed >= sock->my_window)
+	{
+	  sock->window_consumed = 0;
+	  if (!sock->i_stall && sock->my_window < TCP_MAX_WINDOW
+	      && (sock->my_wscale || sock->my_window < 0x10000))
+	    sock->my_window *= 2;
+	}
+      if (do_ack && defer_acks)
+	sock->ack_pending = 1;
+      else if (do_ack)
 	ack (sock);
       while (sock->packs.first)
 	{
@@ -979,7 +1211,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	sock->my_window = TCP_INITIAL_WINDOW;
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
@@ -25,7 +25,6 @@
 #include <grub/mm.h>
 #include <grub/dl.h>
 #include <grub/file.h>
-#include <grub/priority_queue.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -42,8 +41,21 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    /* Asked for when the card isn't known.  */
+    TFTP_FALLBACK_BLKSIZE = 1024,
+    /* The largest allowed by RFC 2348.  */
+    TFTP_MAX_BLKSIZE = 65464
   };
 
+/* Number of blocks the server may send before waiting for an ACK
+   (RFC 7440).  It has to stay well below the 50 packets that may be
+   queued on the socket before reception is stalled.  */
+#define TFTP_WINDOWSIZE "16"
+
+/* Number of blocks kept when they arrive ahead of the one expected, a
+   power of 2 dividing 65536 and larger than the window.  */
+#define TFTP_REORDER_SIZE 64
+
 enum
   {
     TFTP_CODE_EOF = 1,
@@ -102,11 +114,17 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
   grub_uint64_t ack_sent;
+  /* Whether the current position was acknowledged again after a stale
+     block showed up.  */
+  int stale_acked;
   int have_oack;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
-  grub_priority_queue_t pq;
+  /* Blocks that arrived early, in the slot of their block number.  */
+  struct grub_net_buff *reorder[TFTP_REORDER_SIZE];
+  unsigned nreorder;
 } *tftp_data_t;
 
 static int
@@ -120,17 +138,6 @@ cmp_block (grub_uint16_t a, grub_uint16_t b)
   return 0;
 }
 
-static int
-cmp (const void *a__, const void *b__)
-{
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct tftphdr *a = (struct tftphdr *) a_->data;
-  struct tftphdr *b = (struct tftphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  return -cmp_block (grub_be_to_cpu16 (a->u.data.block), grub_be_to_cpu16 (b->u.data.block));
-}
-
 static grub_err_t
 ack (tftp_data_t data, grub_uint64_t block)
 {
@@ -181,6 +188,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
     {
     case TFTP_OACK:
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->window_size = 1;
       data->have_oack = 1; 
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
@@ -190,10 +198,16 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    data->window_size = grub_strtoul ((char *) ptr
+					      + sizeof ("windowsize\0") - 1,
+					      0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->window_size == 0)
+	data->window_size = 1;
       data->block = 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
@@ -207,32 +221,58 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
-      err = grub_priority_queue_push (data->pq, &nb);
-      if (err)
-	return err;
-
       {
-	struct grub_net_buff **nb_top_p, *nb_top;
-	while (1)
+	struct grub_net_buff *nb_top;
+	grub_uint16_t blk = grub_be_to_cpu16 (tftph->u.data.block);
+	grub_uint16_t ahead = blk - (grub_uint16_t) (data->block + 1);
+
+	if (cmp_block (blk, data->block + 1) < 0)
+	  {
+	    /* A stale block means our last ACK got lost.  With a window,
+	       report the current position once instead of acknowledging
+	       every duplicate, which would make the server rewind again.  */
+	    if (data->window_size == 1)
+	      ack (data, blk);
+	    else if (!data->stale_acked)
+	      {
+		ack (data, data->block);
+		data->stale_acked = 1;
+	      }
+	    grub_netbuff_free (nb);
+	  }
+	/* Blocks too far ahead are sent again later, as are duplicates.  */
+	else if (ahead >= TFTP_REORDER_SIZE
+		 || data->reorder[blk % TFTP_REORDER_SIZE])
+	  grub_netbuff_free (nb);
+	else
 	  {
-	    nb_top_p = grub_priority_queue_top (data->pq);
-	    if (!nb_top_p)
-	      return GRUB_ERR_NONE;
-	    nb_top = *nb_top_p;
-	    tftph = (struct tftphdr *) nb_top->data;
-	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
-	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
-	    grub_netbuff_free (nb_top);
-	    grub_priority_queue_pop (data->pq);
+	    data->reorder[blk % TFTP_REORDER_SIZE] = nb;
+	    data->nreorder++;
 	  }
-	while (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) == 0)
+
+	/* A gap inside the window: acknowledge what we have so that the
+	   server resends from there without waiting for its timeout.  */
+	if (data->window_size > 1
+	    && !data->reorder[(data->block + 1) % TFTP_REORDER_SIZE]
+	    && data->nreorder
+	    && data->ack_sent < data->block
+	    && file->device->net->packs.count
+	    < grub_net_queue_limit (file->device->net, 50))
+	  ack (data, data->block);
+
+	while ((nb_top = data->reorder[(data->block + 1) % TFTP_REORDER_SIZE]))
 	  {
 	    unsigned size;
 
-	    grub_priority_queue_pop (data->pq);
+	    data->reorder[(data->block + 1) % TFTP_REORDER_SIZE] = NULL;
+	    data->nreorder--;
+	    data->stale_acked = 0;
 
-	    if (file->device->net->packs.count < 50)
+	    /* Only the last block of each window is acknowledged.  */
+	    if (data->block + 1 - data->ack_sent < data->window_size)
+	      err = 0;
+	    else if (file->device->net->packs.count
+		     < grub_net_queue_limit (file->device->net, 50))
 	      err = ack (data, data->block + 1);
 	    else
 	      {
@@ -288,16 +328,39 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 }
 
 static void
-destroy_pq (tftp_data_t data)
+free_reorder (tftp_data_t data)
+{
+  unsigned i;
+
+  for (i = 0; i < TFTP_REORDER_SIZE; i++)
+    grub_netbuff_free (data->reorder[i]);
+}
+
+/* Return the largest block which fits unfragmented in a frame of the card
+   ADDR is reached through, which with jumbo frames is several times the
+   usual 1468 bytes.  */
+static grub_size_t
+tftp_block_size (grub_net_network_level_address_t addr)
 {
-  struct grub_net_buff **nb_p;
-  while ((nb_p = grub_priority_queue_top (data->pq)))
+  struct grub_net_network_level_interface *inf;
+  grub_net_network_level_address_t gateway;
+  grub_size_t size, hdrlen;
+
+  if (grub_net_route_address (addr, &gateway, &inf))
     {
-      grub_netbuff_free (*nb_p);
-      grub_priority_queue_pop (data->pq);
+      grub_errno = GRUB_ERR_NONE;
+      return TFTP_FALLBACK_BLKSIZE;
     }
 
-  grub_priority_queue_destroy (data->pq);
+  hdrlen = (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+	    ? GRUB_NET_OUR_IPV4_HEADER_SIZE : GRUB_NET_OUR_IPV6_HEADER_SIZE)
+    + sizeof (struct udphdr) + 4;
+  if (inf->card->mtu < hdrlen + TFTP_DEFAULTSIZE_PACKET)
+    return TFTP_DEFAULTSIZE_PACKET;
+  size = inf->card->mtu - hdrlen;
+  if (size > TFTP_MAX_BLKSIZE)
+    size = TFTP_MAX_BLKSIZE;
+  return size;
 }
 
 static grub_err_t
@@ -314,11 +377,21 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_err_t err;
   grub_uint8_t *nbd;
   grub_net_network_level_address_t addr;
+  char blksize[sizeof ("65464")];
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
 
+  err = grub_net_resolve_address (file->device->net->server, &addr);
+  if (err)
+    {
+      grub_free (data);
+      return err;
+    }
+  grub_snprintf (blksize, sizeof (blksize), "%" PRIuGRUB_SIZE,
+		 tftp_block_size (addr));
+
   nb.head = open_data;
   nb.end = open_data + sizeof (open_data);
   grub_netbuff_clear (&nb);
@@ -349,9 +422,9 @@ tftp_open (struct grub_file *file, const char *filename)
   rrqlen += grub_strlen ("blksize") + 1;
   rrq += grub_strlen ("blksize") + 1;
 
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
+  grub_strcpy (rrq, blksize);
+  rrqlen += grub_strlen (blksize) + 1;
+  rrq += grub_strlen (blksize) + 1;
 
   grub_strcpy (rrq, "tsize");
   rrqlen += grub_strlen ("tsize") + 1;
@@ -360,6 +433,14 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_strcpy (rrq, "0");
   rrqlen += grub_strlen ("0") + 1;
   rrq += grub_strlen ("0") + 1;
+
+  grub_strcpy (rrq, "windowsize");
+  rrqlen += grub_strlen ("windowsize") + 1;
+  rrq += grub_strlen ("windowsize") + 1;
+
+  grub_strcpy (rrq, TFTP_WINDOWSIZE);
+  rrqlen += grub_strlen (TFTP_WINDOWSIZE) + 1;
+  rrq += grub_strlen (TFTP_WINDOWSIZE) + 1;
   hdrlen = sizeof (tftph->opcode) + rrqlen;
 
   err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
@@ -371,28 +452,14 @@ tftp_open (struct grub_file *file, const char *filename)
 
   file->not_easily_seekable = 1;
   file->data = data;
-
-  data->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *), cmp);
-  if (!data->pq)
-    {
-      grub_free (data);
-      return grub_errno;
-    }
-
-  err = grub_net_resolve_address (file->device->net->server, &addr);
-  if (err)
-    {
-      destroy_pq (data);
-      grub_free (data);
-      return err;
-    }
+  data->window_size = 1;
 
   data->sock = grub_net_udp_open (addr,
 				  TFTP_SERVER_PORT, tftp_receive,
 				  file);
   if (!data->sock)
     {
-      destroy_pq (data);
+      free_reorder (data);
       grub_free (data);
       return grub_errno;
     }
@@ -406,7 +473,7 @@ tftp_open (struct grub_file *file, const char *filename)
       if (err)
 	{
 	  grub_net_udp_close (data->sock);
-	  destroy_pq (data);
+	  free_reorder (data);
 	  grub_free (data);
 	  return err;
 	}
@@ -423,7 +490,7 @@ tftp_open (struct grub_file *file, const char *filename)
   if (grub_errno)
     {
       grub_net_udp_close (data->sock);
-      destroy_pq (data);
+      free_reorder (data);
       grub_free (data);
       return grub_errno;
     }
@@ -466,7 +533,7 @@ tftp_close (struct grub_file *file)
 	grub_print_error ();
       grub_net_udp_close (data->sock);
     }
-  destroy_pq (data);
+  free_reorder (data);
   grub_free (data);
   return GRUB_ERR_NONE;
 }
@@ -480,7 +547,9 @@ tftp_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data->ack_sent >= data->block)
+  /* Within a window the ACK is held back until the window is
+     complete.  */
+  if (data->block - data->ack_sent < data->window_size)
     return 0;
   return ack (data, data->block);
 }
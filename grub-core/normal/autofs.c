@@ -22,16 +22,61 @@
 #include <grub/env.h>
 #include <grub/misc.h>
 #include <grub/fs.h>
+#include <grub/disk.h>
 #include <grub/normal.h>
 
 /* This is used to store the names of filesystem modules for auto-loading.  */
 static grub_named_list_t fs_module_list;
 
-/* The auto-loading hook for filesystems.  */
+/* The longest signature kept from fssig.lst.  */
+#define FS_SIGNATURE_MAX	16
+
+/* An on-disk signature of the filesystems of a module, from fssig.lst.  */
+struct fs_signature
+{
+  struct fs_signature *next;
+  char *module;
+  grub_uint64_t offset;
+  grub_size_t size;
+  grub_uint8_t magic[FS_SIGNATURE_MAX];
+};
+
+static struct fs_signature *fs_signature_list;
+
+/* Return 1 if DISK has one of the signatures of MODULE, -1 if it has none
+   of them and 0 if MODULE has no known signature.  */
+static int
+check_fs_signatures (grub_disk_t disk, const char *module)
+{
+  struct fs_signature *sig;
+  grub_uint8_t buf[FS_SIGNATURE_MAX];
+  int ret = 0;
+
+  for (sig = fs_signature_list; sig; sig = sig->next)
+    {
+      if (grub_strcmp (sig->module, module) != 0)
+	continue;
+
+      ret = -1;
+      if (grub_disk_read (disk, sig->offset >> GRUB_DISK_SECTOR_BITS,
+			  sig->offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			  sig->size, buf) == GRUB_ERR_NONE
+	  && grub_memcmp (buf, sig->magic, sig->size) == 0)
+	return 1;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  return ret;
+}
+
+/* The auto-loading hook for filesystems.  Modules whose signature is on
+   DEVICE are tried first, then the ones with no known signature.  Modules
+   whose signatures are all missing are not loaded at all, since they
+   can't recognize DEVICE anyway.  */
 static int
-autoload_fs_module (void)
+autoload_fs_module (grub_device_t device)
 {
-  grub_named_list_t p;
+  grub_named_list_t p, *q, *best;
   int ret = 0;
   grub_file_filter_t grub_file_filters_was[GRUB_FILE_FILTER_MAX];
 
@@ -40,20 +85,51 @@ autoload_fs_module (void)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
-  while ((p = fs_module_list) != NULL)
+  while (1)
     {
-      if (! grub_dl_get (p->name) && grub_dl_load (p->name))
+      int best_rank = 0;
+
+      best = NULL;
+      for (q = &fs_module_list; *q; )
 	{
-	  ret = 1;
-	  break;
+	  int rank;
+
+	  if (grub_dl_get ((*q)->name))
+	    {
+	      p = *q;
+	      *q = p->next;
+	      grub_free (p->name);
+	      grub_free (p);
+	      continue;
+	    }
+
+	  /* 2 if the signature matches, 1 if unknown, 0 if not matching.  */
+	  rank = 1;
+	  if (device && device->disk)
+	    rank += check_fs_signatures (device->disk, (*q)->name);
+	  if (rank > best_rank)
+	    {
+	      best = q;
+	      best_rank = rank;
+	      if (rank == 2)
+		break;
+	    }
+	  q = &(*q)->next;
 	}
 
-      if (grub_errno)
-	grub_print_error ();
+      if (! best)
+	break;
 
-      fs_module_list = p->next;
+      p = *best;
+      *best = p->next;
+      if (grub_dl_load (p->name))
+	ret = 1;
+      else if (grub_errno)
+	grub_print_error ();
       grub_free (p->name);
       grub_free (p);
+      if (ret)
+	break;
     }
 
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_was,
@@ -62,6 +138,87 @@ autoload_fs_module (void)
   return ret;
 }
 
+static int
+hex_value (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  return grub_tolower (c) - 'a' + 10;
+}
+
+/* Read the file fssig.lst, whose lines are "MODULE OFFSET HEX".  */
+static void
+read_fs_signatures (const char *prefix)
+{
+  char *filename;
+  grub_file_t file;
+
+  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
+			     "/fssig.lst", prefix);
+  if (! filename)
+    return;
+
+  file = grub_file_open (filename);
+  grub_free (filename);
+  if (! file)
+    return;
+
+  while (fs_signature_list)
+    {
+      struct fs_signature *tmp = fs_signature_list->next;
+      grub_free (fs_signature_list->module);
+      grub_free (fs_signature_list);
+      fs_signature_list = tmp;
+    }
+
+  while (1)
+    {
+      char *buf, *p, *end;
+      struct fs_signature *sig;
+
+      buf = grub_file_getline (file);
+      if (! buf)
+	break;
+
+      sig = grub_zalloc (sizeof (*sig));
+      if (! sig)
+	{
+	  grub_free (buf);
+	  break;
+	}
+
+      p = grub_strchr (buf, ' ');
+      if (! p)
+	goto next;
+      *p++ = '\0';
+      sig->offset = grub_strtoull (p, &end, 10);
+      if (grub_errno || *end != ' ')
+	goto next;
+      for (p = end + 1; grub_isxdigit (p[0]) && grub_isxdigit (p[1]); p += 2)
+	{
+	  if (sig->size == FS_SIGNATURE_MAX)
+	    break;
+	  sig->magic[sig->size++] = (hex_value (p[0]) << 4) | hex_value (p[1]);
+	}
+      if (sig->size == 0)
+	goto next;
+
+      sig->module = grub_strdup (buf);
+      if (! sig->module)
+	goto next;
+      sig->next = fs_signature_list;
+      fs_signature_list = sig;
+      sig = NULL;
+
+    next:
+      grub_free (sig);
+      grub_free (buf);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_file_close (file);
+}
+
 /* Read the file fs.lst for auto-loading.  */
 void
 read_fs_list (const char *prefix)
@@ -142,9 +299,11 @@ read_fs_list (const char *prefix)
 		}
 
 	      grub_file_close (file);
-	      grub_fs_autoload_hook = tmp_autoload_hook;
 	    }
 
+	  read_fs_signatures (prefix);
+	  grub_fs_autoload_hook = tmp_autoload_hook;
+
 	  grub_free (filename);
 	}
     }
@@ -846,6 +846,24 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
   if (!visual)
     return -1;
 
+  /* ASCII, which is most of what is shown, has neither combining
+     characters nor right-to-left ones: every character is a glyph of its
+     own at level 0.  */
+  for (i = 0; i < logical_len && logical[i] < 0x80; i++);
+  if (i == logical_len)
+    {
+      grub_memset (visual, 0, sizeof (visual[0]) * logical_len);
+      for (i = 0; i < logical_len; i++)
+	{
+	  visual[i].base = logical[i];
+	  visual[i].estimated_width = 1;
+	  visual[i].orig_pos = i;
+	  visual[i].bidi_type = get_bidi_type (logical[i]);
+	}
+      visual_len = logical_len;
+      goto wrap;
+    }
+
   for (i = 0; i < logical_len; i++)
     {
       type = get_bidi_type (logical[i]);
@@ -1134,6 +1152,7 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
 	visual[i].bidi_level = 0;
     }
 
+ wrap:
   {
     grub_ssize_t ret;
     ret = bidi_line_wrap (visual_out, visual, visual_len,
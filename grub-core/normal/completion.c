@@ -27,6 +27,8 @@
 #include <grub/parser.h>
 #include <grub/extcmd.h>
 #include <grub/charset.h>
+#include <grub/time.h>
+#include <grub/disk.h>
 
 /* The current word.  */
 static const char *current_word;
@@ -45,6 +47,98 @@ static void (*print_func) (const char *, grub_completion_type_t, int);
 
 /* The state the command line is in.  */
 static grub_parser_state_t cmdline_state;
+
+/* The devices and the last directory found are kept for a few seconds:
+   otherwise every press of Tab opens every disk again, or mounts the
+   filesystem and reads the directory again, which takes long on machines
+   with many disks.  The lookup cache of fshelp can't list a directory:
+   it only knows the names that were looked up, not all the names there
+   are, so the entries of the last directory are kept here, and dropped
+   with it whenever the disk cache is invalidated.  */
+#define COMPLETION_CACHE_MS	5000
+
+struct cached_name
+{
+  struct cached_name *next;
+  char *name;
+  int dir;
+};
+
+struct cached_dev
+{
+  struct cached_dev *next;
+  char *name;
+  int partitions_listed;
+  struct cached_name *partitions;
+};
+
+static struct cached_dev *cached_devs;
+static int cached_devs_listed;
+static grub_uint64_t cached_devs_time;
+
+static char *cached_dir_device;
+static char *cached_dir;
+static struct cached_name *cached_dir_entries;
+static grub_uint64_t cached_dir_time;
+/* The value of grub_disk_cache_generation the entries were listed with.  */
+static unsigned long cached_dir_generation;
+
+static void
+free_names (struct cached_name *n)
+{
+  struct cached_name *next;
+
+  for (; n; n = next)
+    {
+      next = n->next;
+      grub_free (n->name);
+      grub_free (n);
+    }
+}
+
+/* Add NAME to the end of the list whose last next pointer is *TAIL.  */
+static int
+append_name (struct cached_name ***tail, const char *name, int dir)
+{
+  struct cached_name *n;
+
+  n = grub_malloc (sizeof (*n));
+  if (!n)
+    return 1;
+  n->name = grub_strdup (name);
+  if (!n->name)
+    {
+      grub_free (n);
+      return 1;
+    }
+  n->dir = dir;
+  n->next = 0;
+  **tail = n;
+  *tail = &n->next;
+  return 0;
+}
+
+static void
+free_devs (void)
+{
+  struct cached_dev *d, *next;
+
+  for (d = cached_devs; d; d = next)
+    {
+      next = d->next;
+      free_names (d->partitions);
+      grub_free (d->name);
+      grub_free (d);
+    }
+  cached_devs = 0;
+  cached_devs_listed = 0;
+}
+
+static int
+cache_fresh (grub_uint64_t when)
+{
+  return grub_get_time_ms () - when < COMPLETION_CACHE_MS;
+}
 
 
 /* Add a string to the list of possible completions. COMPLETION is the
@@ -99,9 +193,9 @@ add_completion (const char *completion, const char *extra,
 }
 
 static int
-iterate_partition (grub_disk_t disk, const grub_partition_t p,
-		   void *data __attribute__ ((unused)))
+iterate_partition (grub_disk_t disk, const grub_partition_t p, void *data)
 {
+  struct cached_name ***tail = data;
   const char *disk_name = disk->name;
   char *name;
   int ret;
@@ -117,16 +211,47 @@ iterate_partition (grub_disk_t disk, const grub_partition_t p,
   if (! name)
     return 1;
 
-  ret = add_completion (name, ")", GRUB_COMPLETION_TYPE_PARTITION);
+  ret = append_name (tail, name, 0);
   grub_free (name);
   return ret;
 }
 
+/* Complete the partitions of DEV, listing them if that wasn't done yet.  */
 static int
-iterate_dir (const char *filename, const struct grub_dirhook_info *info,
-	     void *data __attribute__ ((unused)))
+complete_partitions (struct cached_dev *d)
 {
-  if (! info->dir)
+  struct cached_name *n;
+
+  if (!d->partitions_listed)
+    {
+      struct cached_name **tail = &d->partitions;
+      grub_device_t dev;
+
+      dev = grub_device_open (d->name);
+      if (!dev)
+	return 1;
+      if (dev->disk
+	  && grub_partition_iterate (dev->disk, iterate_partition, &tail))
+	{
+	  grub_device_close (dev);
+	  free_names (d->partitions);
+	  d->partitions = 0;
+	  return 1;
+	}
+      grub_device_close (dev);
+      d->partitions_listed = 1;
+    }
+
+  for (n = d->partitions; n; n = n->next)
+    if (add_completion (n->name, ")", GRUB_COMPLETION_TYPE_PARTITION))
+      return 1;
+  return 0;
+}
+
+static int
+add_file (const char *filename, int dir)
+{
+  if (! dir)
     {
       const char *prefix;
       if (cmdline_state == GRUB_PARSER_STATE_DQUOTE)
@@ -156,82 +281,121 @@ iterate_dir (const char *filename, const struct grub_dirhook_info *info,
 }
 
 static int
-iterate_dev (const char *devname, void *data __attribute__ ((unused)))
+iterate_dir (const char *filename, const struct grub_dirhook_info *info,
+	     void *data)
 {
+  struct cached_name ***tail = data;
+
+  return append_name (tail, filename, info->dir);
+}
+
+static int
+iterate_dev (const char *devname, void *data)
+{
+  struct cached_dev ***tail = data;
+  struct cached_dev *d;
   grub_device_t dev;
 
-  /* Complete the partition part.  */
+  /* Only list the devices that can be opened.  */
   dev = grub_device_open (devname);
-
   if (!dev)
     {
       grub_errno = GRUB_ERR_NONE;
       return 0;
     }
+  grub_device_close (dev);
+  grub_errno = GRUB_ERR_NONE;
 
-  if (grub_strcmp (devname, current_word) == 0)
-    {
-      if (add_completion (devname, ")", GRUB_COMPLETION_TYPE_PARTITION))
-	{
-	  grub_device_close (dev);
-	  return 1;
-	}
-
-      if (dev->disk)
-	if (grub_partition_iterate (dev->disk, iterate_partition, NULL))
-	  {
-	    grub_device_close (dev);
-	    return 1;
-	  }
-    }
-  else if (add_completion (devname, "", GRUB_COMPLETION_TYPE_DEVICE))
+  d = grub_zalloc (sizeof (*d));
+  if (!d)
+    return 1;
+  d->name = grub_strdup (devname);
+  if (!d->name)
     {
-      grub_device_close (dev);
+      grub_free (d);
       return 1;
     }
-
-  grub_device_close (dev);
-  grub_errno = GRUB_ERR_NONE;
+  **tail = d;
+  *tail = &d->next;
   return 0;
 }
 
+/* Return the devices, listing them again if the list is old.  */
+static struct cached_dev *
+get_devs (void)
+{
+  struct cached_dev **tail;
+
+  if (cached_devs_listed && cache_fresh (cached_devs_time))
+    return cached_devs;
+
+  free_devs ();
+  tail = &cached_devs;
+  if (grub_disk_dev_iterate (iterate_dev, &tail))
+    {
+      free_devs ();
+      return 0;
+    }
+  cached_devs_listed = 1;
+  cached_devs_time = grub_get_time_ms ();
+  return cached_devs;
+}
+
 /* Complete a device.  */
 static int
 complete_device (void)
 {
   /* Check if this is a device or a partition.  */
   char *p = grub_strchr (++current_word, ',');
-  grub_device_t dev;
+  struct cached_dev *d;
+
+  d = get_devs ();
+  if (grub_errno)
+    return 1;
 
   if (! p)
     {
       /* Complete the disk part.  */
-      if (grub_disk_dev_iterate (iterate_dev, NULL))
-	return 1;
+      for (; d; d = d->next)
+	{
+	  if (grub_strcmp (d->name, current_word) == 0)
+	    {
+	      if (add_completion (d->name, ")",
+				  GRUB_COMPLETION_TYPE_PARTITION)
+		  || complete_partitions (d))
+		return 1;
+	    }
+	  else if (add_completion (d->name, "", GRUB_COMPLETION_TYPE_DEVICE))
+	    return 1;
+	}
+      grub_errno = GRUB_ERR_NONE;
     }
   else
     {
+      struct cached_dev tmp;
+      int ret;
+
       /* Complete the partition part.  */
       *p = '\0';
-      dev = grub_device_open (current_word);
-      *p = ',';
-      grub_errno = GRUB_ERR_NONE;
-
-      if (dev)
+      for (; d; d = d->next)
+	if (grub_strcmp (d->name, current_word) == 0)
+	  break;
+      if (d)
 	{
-	  if (dev->disk)
-	    {
-	      if (grub_partition_iterate (dev->disk, iterate_partition, NULL))
-		{
-		  grub_device_close (dev);
-		  return 1;
-		}
-	    }
-
-	  grub_device_close (dev);
+	  *p = ',';
+	  ret = complete_partitions (d);
+	  grub_errno = GRUB_ERR_NONE;
+	  return ret;
 	}
-      else
-	return 1;
+
+      /* Not a listed device: look at it just this once.  */
+      grub_memset (&tmp, 0, sizeof (tmp));
+      tmp.name = (char *) current_word;
+      ret = complete_partitions (&tmp);
+      *p = ',';
+      free_names (tmp.partitions);
+      grub_errno = GRUB_ERR_NONE;
+      return ret;
     }
 
   return 0;
@@ -245,33 +409,20 @@ complete_file (void)
   char *dir;
   char *last_dir;
   grub_fs_t fs;
-  grub_device_t dev;
+  grub_device_t dev = 0;
   int ret = 0;
 
   device = grub_file_get_device_name (current_word);
   if (grub_errno != GRUB_ERR_NONE)
     return 1;
 
-  dev = grub_device_open (device);
-  if (! dev)
-    {
-      ret = 1;
-      goto fail;
-    }
-
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    {
-      ret = 1;
-      goto fail;
-    }
-
   dir = grub_strchr (current_word + (device ? 2 + grub_strlen (device) : 0),
 		     '/');
   last_dir = grub_strrchr (current_word, '/');
   if (dir)
     {
       char *dirfile;
+      struct cached_name **tail, *n;
 
       current_word = last_dir + 1;
 
@@ -286,19 +437,78 @@ complete_file (void)
       dirfile = grub_strrchr (dir, '/');
       dirfile[1] = '\0';
 
-      /* Iterate the directory.  */
-      (fs->dir) (dev, dir, iterate_dir, NULL);
+      if (! cached_dir || grub_strcmp (cached_dir, dir) != 0
+	  || (device == NULL) != (cached_dir_device == NULL)
+	  || (device && grub_strcmp (cached_dir_device, device) != 0)
+	  || ! cache_fresh (cached_dir_time)
+	  || cached_dir_generation != grub_disk_cache_generation)
+	{
+	  grub_free (cached_dir);
+	  grub_free (cached_dir_device);
+	  free_names (cached_dir_entries);
+	  cached_dir = 0;
+	  cached_dir_device = 0;
+	  cached_dir_entries = 0;
+
+	  dev = grub_device_open (device);
+	  if (! dev)
+	    {
+	      grub_free (dir);
+	      ret = 1;
+	      goto fail;
+	    }
+
+	  fs = grub_fs_probe (dev);
+	  if (! fs)
+	    {
+	      grub_free (dir);
+	      ret = 1;
+	      goto fail;
+	    }
+
+	  /* Iterate the directory.  */
+	  tail = &cached_dir_entries;
+	  (fs->dir) (dev, dir, iterate_dir, &tail);
 
+	  if (grub_errno)
+	    {
+	      free_names (cached_dir_entries);
+	      cached_dir_entries = 0;
+	      grub_free (dir);
+	      ret = 1;
+	      goto fail;
+	    }
+
+	  cached_dir = dir;
+	  dir = 0;
+	  cached_dir_device = device ? grub_strdup (device) : 0;
+	  if (device && ! cached_dir_device)
+	    {
+	      grub_free (cached_dir);
+	      cached_dir = 0;
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	  cached_dir_time = grub_get_time_ms ();
+	  cached_dir_generation = grub_disk_cache_generation;
+	}
       grub_free (dir);
 
-      if (grub_errno)
+      for (n = cached_dir_entries; n; n = n->next)
+	if (add_file (n->name, n->dir))
+	  {
+	    ret = 1;
+	    goto fail;
+	  }
+    }
+  else
+    {
+      dev = grub_device_open (device);
+      if (! dev || ! grub_fs_probe (dev))
 	{
 	  ret = 1;
 	  goto fail;
 	}
-    }
-  else
-    {
+
       current_word += grub_strlen (current_word);
       match = grub_strdup ("/");
       if (! match)
@@ -128,6 +128,7 @@ read_command_list (const char *prefix)
 		  else
 		    last = ptr;
 		}
+	      grub_command_generation++;
 
 	      for (;; grub_free (buf))
 		{
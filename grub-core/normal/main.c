@@ -33,6 +33,7 @@
 #include <grub/charset.h>
 #include <grub/script_sh.h>
 #include <grub/bufio.h>
+#include <grub/boottime.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -74,6 +75,7 @@ grub_normal_free_menu (grub_menu_t menu)
       entry = next_entry;
     }
 
+  grub_free (menu->index);
   grub_free (menu);
   grub_env_unset_menu ();
 }
@@ -261,6 +263,7 @@ grub_normal_execute (const char *config, int nested, int batch)
 {
   grub_menu_t menu = 0;
   const char *prefix;
+  grub_uint64_t start;
 
   if (! nested)
     {
@@ -273,7 +276,9 @@ grub_normal_execute (const char *config, int nested, int batch)
 
   if (config)
     {
+      start = grub_boot_phase_begin (GRUB_BOOT_PHASE_SCRIPT);
       menu = read_config_file (config);
+      grub_boot_phase_end (GRUB_BOOT_PHASE_SCRIPT, start, config);
 
       /* Ignore any error.  */
       grub_errno = GRUB_ERR_NONE;
@@ -558,6 +563,7 @@ GRUB_MOD_FINI(normal)
   grub_context_fini ();
   grub_script_fini ();
   grub_menu_fini ();
+  grub_menu_preload_discard ();
   grub_normal_auth_fini ();
 
   grub_xputs = grub_xputs_saved;
@@ -32,6 +32,8 @@
 #include <grub/script_sh.h>
 #include <grub/gfxterm.h>
 #include <grub/dl.h>
+#include <grub/boottime.h>
+#include <grub/boot_hint.h>
 
 /* Time to delay after displaying an error message about a default/fallback
    entry failing to boot.  */
@@ -79,6 +81,28 @@ grub_menu_entry_t
 grub_menu_get_entry (grub_menu_t menu, int no)
 {
   grub_menu_entry_t e;
+  int i;
+
+  /* Menus are looked up by index on every key press and repaint, walking
+     the list each time makes long menus slow to scroll.  */
+  if (menu->index_size != menu->size)
+    {
+      grub_free (menu->index);
+      menu->index_size = 0;
+      menu->index = grub_malloc (menu->size * sizeof (menu->index[0]));
+      if (menu->index)
+	{
+	  for (e = menu->entry_list, i = 0; e && i < menu->size;
+	       e = e->next, i++)
+	    menu->index[i] = e;
+	  if (i == menu->size)
+	    menu->index_size = menu->size;
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (no >= 0 && no < menu->index_size)
+    return menu->index[no];
 
   for (e = menu->entry_list; e && no > 0; e = e->next, no--)
     ;
@@ -201,6 +225,47 @@ get_and_remove_first_entry_number (const char *name)
   return entry;
 }
 
+/* Save the boot hints found while running the entry which is about to
+   boot, see <grub/boot_hint.h>.  save_env leaves grubenv alone when they
+   are all the same as last time.  */
+static void
+save_boot_hints (void)
+{
+  const char *enabled = grub_env_get ("boot_hints");
+  struct grub_env_var *var;
+  char **names;
+  int n = 0;
+
+  if (! enabled || grub_strcmp (enabled, "1") != 0)
+    return;
+
+  FOR_SORTED_ENV (var)
+    if (grub_strncmp (var->name, GRUB_BOOT_HINT_PREFIX,
+		      sizeof (GRUB_BOOT_HINT_PREFIX) - 1) == 0)
+      n++;
+  if (n == 0)
+    return;
+
+  names = grub_malloc (n * sizeof (names[0]));
+  if (! names)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  n = 0;
+  FOR_SORTED_ENV (var)
+    if (grub_strncmp (var->name, GRUB_BOOT_HINT_PREFIX,
+		      sizeof (GRUB_BOOT_HINT_PREFIX) - 1) == 0)
+      names[n++] = var->name;
+
+  if (grub_command_execute ("save_env", n, names) != GRUB_ERR_NONE)
+    {
+      grub_dprintf ("menu", "couldn't save boot hints: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+  grub_free (names);
+}
+
 /* Run a menu entry.  */
 static void
 grub_menu_execute_entry(grub_menu_entry_t entry, int auto_boot)
@@ -209,6 +274,7 @@ grub_menu_execute_entry(grub_menu_entry_t entry, int auto_boot)
   int errs_before;
   grub_menu_t menu = NULL;
   char *optr, *buf, *oldchosen = NULL, *olddefault = NULL;
+  grub_uint64_t start;
   const char *ptr, *chosen, *def;
   grub_size_t sz = 0;
 
@@ -295,7 +361,9 @@ grub_menu_execute_entry(grub_menu_entry_t entry, int auto_boot)
   else
     grub_env_unset ("default");
 
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_SCRIPT);
   grub_script_execute_new_scope (entry->sourcecode, entry->argc, entry->args);
+  grub_boot_phase_end (GRUB_BOOT_PHASE_SCRIPT, start, entry->title);
 
   if (errs_before != grub_err_printed_errors)
     grub_wait_after_message ();
@@ -303,8 +371,11 @@ grub_menu_execute_entry(grub_menu_entry_t entry, int auto_boot)
   errs_before = grub_err_printed_errors;
 
   if (grub_errno == GRUB_ERR_NONE && grub_loader_is_loaded ())
-    /* Implicit execution of boot, only if something is loaded.  */
-    grub_command_execute ("boot", 0, 0);
+    {
+      save_boot_hints ();
+      /* Implicit execution of boot, only if something is loaded.  */
+      grub_command_execute ("boot", 0, 0);
+    }
 
   if (errs_before != grub_err_printed_errors)
     grub_wait_after_message ();
@@ -402,6 +473,9 @@ menu_init (int entry, grub_menu_t menu, int nested)
 {
   struct grub_term_output *term;
   int gfxmenu = 0;
+  grub_uint64_t start;
+
+  start = grub_boot_phase_begin (GRUB_BOOT_PHASE_MENU);
 
   FOR_ACTIVE_TERM_OUTPUTS(term)
     if (term->fullscreen)
@@ -448,6 +522,8 @@ menu_init (int entry, grub_menu_t menu, int nested)
     grub_print_error ();
     grub_errno = GRUB_ERR_NONE;
   }
+
+  grub_boot_phase_end (GRUB_BOOT_PHASE_MENU, start, "menu");
 }
 
 static void
@@ -598,6 +674,9 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 
   timeout_style = get_timeout_style ();
 
+  if (timeout > 0)
+    grub_menu_preload_start (grub_menu_get_entry (menu, default_entry));
+
   if (timeout_style == TIMEOUT_STYLE_COUNTDOWN
       || timeout_style == TIMEOUT_STYLE_HIDDEN)
     {
@@ -640,6 +719,9 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 	  if (timeout == 0)
 	    /* We will fall through to auto-booting the default entry.  */
 	    break;
+
+	  if (timeout > 0)
+	    grub_menu_preload_step ();
 	}
 
       grub_env_unset ("timeout");
@@ -698,6 +780,9 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 
       c = grub_getkey_noblock ();
 
+      if (c == GRUB_TERM_NO_KEY && timeout > 0)
+	grub_menu_preload_step ();
+
       if (c != GRUB_TERM_NO_KEY)
 	{
 	  if (timeout >= 0)
@@ -773,11 +858,13 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 
 	    case 'c':
 	      menu_fini ();
+	      grub_menu_preload_discard ();
 	      grub_cmdline_run (1, 0);
 	      goto refresh;
 
 	    case 'e':
 	      menu_fini ();
+	      grub_menu_preload_discard ();
 		{
 		  grub_menu_entry_t e = grub_menu_get_entry (menu, current_entry);
 		  if (e)
@@ -863,9 +950,13 @@ show_menu (grub_menu_t menu, int nested, int autobooted)
 
       boot_entry = run_menu (menu, nested, &auto_boot);
       if (boot_entry < 0)
-	break;
+	{
+	  grub_menu_preload_discard ();
+	  break;
+	}
 
       e = grub_menu_get_entry (menu, boot_entry);
+      grub_menu_preload_chosen (e);
       if (! e)
 	continue; /* Menu is empty.  */
 
@@ -876,6 +967,7 @@ show_menu (grub_menu_t menu, int nested, int autobooted)
 					 &execution_callback, 0);
       else
 	grub_menu_execute_entry (e, 0);
+      grub_menu_preload_discard ();
       if (autobooted)
 	break;
     }
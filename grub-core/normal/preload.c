@@ -0,0 +1,485 @@
+/* preload.c - Read the default entry's files during the menu countdown.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/normal.h>
+#include <grub/menu.h>
+#include <grub/file.h>
+#include <grub/env.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+
+/* When "menu_preload" is 1, the kernel and initrds named by the default
+   entry are read into memory while the menu counts down, a chunk per turn
+   of the menu loop so that keys are still noticed.  When the entry boots,
+   the file filter below serves opens of the same files from the copies.
+   Only literal paths are followed: the entry isn't run, so paths made of
+   variables, other than a "set root" in the entry, can't be known.  */
+
+/* Read per turn of the menu loop.  */
+#define PRELOAD_CHUNK		(1 << 20)
+#define PRELOAD_MAX_FILES	8
+/* Don't keep more than this in memory.  */
+#define PRELOAD_MAX_TOTAL	(512 << 20)
+
+struct preload
+{
+  struct preload *next;
+  char *device;
+  char *path;
+  /* Open while being read.  */
+  grub_file_t file;
+  char *buf;
+  grub_off_t size;
+  grub_off_t loaded;
+};
+
+static struct preload *preloads;
+static grub_size_t preload_total;
+static grub_menu_entry_t preload_entry;
+
+/* A file served from a preload.  Bytes past the part read during the
+   countdown come from the file opened by the loader.  */
+struct preload_file
+{
+  grub_file_t parent;
+  char *buf;
+  grub_off_t loaded;
+};
+
+static void
+preload_free (struct preload *p)
+{
+  if (p->file)
+    grub_file_close (p->file);
+  grub_free (p->buf);
+  grub_free (p->device);
+  grub_free (p->path);
+  grub_free (p);
+}
+
+/* Unlink P from the list and free it.  */
+static void
+preload_drop (struct preload *p)
+{
+  struct preload **q;
+
+  for (q = &preloads; *q; q = &(*q)->next)
+    if (*q == p)
+      {
+	*q = p->next;
+	break;
+      }
+  if (p->buf)
+    preload_total -= p->size;
+  preload_free (p);
+  if (! preloads)
+    grub_file_filter_unregister (GRUB_FILE_FILTER_PRELOAD);
+}
+
+void
+grub_menu_preload_discard (void)
+{
+  struct preload *p, *next;
+
+  for (p = preloads; p; p = next)
+    {
+      next = p->next;
+      preload_free (p);
+    }
+  preloads = 0;
+  preload_total = 0;
+  preload_entry = 0;
+  grub_file_filter_unregister (GRUB_FILE_FILTER_PRELOAD);
+}
+
+/* ENTRY is about to be run: the files of any other entry are of no use.  */
+void
+grub_menu_preload_chosen (grub_menu_entry_t entry)
+{
+  if (entry != preload_entry)
+    grub_menu_preload_discard ();
+}
+
+static grub_ssize_t
+preload_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  struct preload_file *data = file->data;
+  grub_disk_read_hook_t read_hook = file->read_hook;
+  grub_size_t n = 0;
+  grub_ssize_t r;
+
+  /* The progress hook is installed by grub_file_read itself.  Other callers
+     with a read hook want to see the sectors.  */
+  if (read_hook == grub_file_progress_hook)
+    read_hook = 0;
+
+  if (file->offset < data->loaded && ! read_hook)
+    {
+      n = data->loaded - file->offset;
+      if (n > len)
+	n = len;
+      grub_memcpy (buf, data->buf + file->offset, n);
+      if (n == len)
+	return n;
+    }
+
+  if (grub_file_seek (data->parent, file->offset + n) == (grub_off_t) -1)
+    return -1;
+  data->parent->read_hook = read_hook;
+  data->parent->read_hook_data = file->read_hook_data;
+  r = grub_file_read (data->parent, buf + n, len - n);
+  data->parent->read_hook = 0;
+  data->parent->read_hook_data = 0;
+  if (r < 0)
+    return r;
+  return n + r;
+}
+
+static grub_err_t
+preload_close (grub_file_t file)
+{
+  struct preload_file *data = file->data;
+
+  grub_file_close (data->parent);
+  grub_free (data->buf);
+  grub_free (data);
+
+  /* No need to close the same device twice.  */
+  file->device = 0;
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_fs preload_fs =
+  {
+    .name = "preload",
+    .dir = 0,
+    .open = 0,
+    .read = preload_read,
+    .close = preload_close,
+    .label = 0,
+    .next = 0
+  };
+
+/* The file filter: hand the copy of NAME, if any, over to its opener.  */
+static grub_file_t
+preload_open (grub_file_t io, const char *name)
+{
+  struct preload *p;
+  struct preload_file *data;
+  grub_file_t file;
+  const char *path, *device;
+  grub_size_t devlen;
+
+  if (name[0] == '(')
+    {
+      path = grub_strchr (name, ')');
+      if (! path)
+	return io;
+      device = name + 1;
+      devlen = path - device;
+      path++;
+    }
+  else
+    {
+      device = grub_env_get ("root");
+      if (! device)
+	return io;
+      devlen = grub_strlen (device);
+      path = name;
+    }
+
+  for (p = preloads; p; p = p->next)
+    if (grub_strncmp (p->device, device, devlen) == 0
+	&& p->device[devlen] == '\0' && grub_strcmp (p->path, path) == 0
+	&& p->size == io->size)
+      break;
+  if (! p)
+    return io;
+
+  file = grub_zalloc (sizeof (*file));
+  data = grub_malloc (sizeof (*data));
+  if (! file || ! data)
+    {
+      grub_free (file);
+      grub_free (data);
+      grub_errno = GRUB_ERR_NONE;
+      return io;
+    }
+
+  grub_dprintf ("preload", "%s: %llu of %llu bytes preloaded\n", name,
+		(unsigned long long) p->loaded, (unsigned long long) p->size);
+
+  data->parent = io;
+  data->buf = p->buf;
+  data->loaded = p->loaded;
+  p->buf = 0;
+  preload_drop (p);
+
+  file->device = io->device;
+  file->fs = &preload_fs;
+  file->size = io->size;
+  file->data = data;
+  file->not_easily_seekable = io->not_easily_seekable;
+
+  return file;
+}
+
+/* Split the next word off *P, handling quotes the way the script lexer
+   does.  Set *DYNAMIC if the word expands a variable.  */
+static char *
+next_word (const char **p, int *dynamic)
+{
+  const char *s = *p;
+  char *word, *w;
+  char quote = 0;
+
+  while (*s == ' ' || *s == '\t')
+    s++;
+  if (! *s || *s == '\n' || *s == ';' || *s == '#')
+    {
+      *p = s;
+      return 0;
+    }
+
+  word = w = grub_malloc (grub_strlen (s) + 1);
+  if (! word)
+    return 0;
+
+  *dynamic = 0;
+  for (; *s && *s != '\n'; s++)
+    {
+      if (quote)
+	{
+	  if (*s == quote)
+	    quote = 0;
+	  else
+	    {
+	      if (*s == '$' && quote == '"')
+		*dynamic = 1;
+	      *w++ = *s;
+	    }
+	  continue;
+	}
+      if (*s == ' ' || *s == '\t' || *s == ';')
+	break;
+      if (*s == '\'' || *s == '"')
+	quote = *s;
+      else if (*s == '\\' && s[1] && s[1] != '\n')
+	*w++ = *++s;
+      else
+	{
+	  if (*s == '$')
+	    *dynamic = 1;
+	  *w++ = *s;
+	}
+    }
+  *w = '\0';
+  *p = s;
+
+  return word;
+}
+
+static void
+preload_add (const char *root, char *word)
+{
+  struct preload *p;
+  char *device, *path;
+  int count = 0;
+
+  if (word[0] == '(')
+    {
+      path = grub_strchr (word, ')');
+      if (! path)
+	return;
+      device = grub_strndup (word + 1, path - word - 1);
+      path++;
+    }
+  else if (root)
+    {
+      device = grub_strdup (root);
+      path = word;
+    }
+  else
+    return;
+  if (! device)
+    return;
+
+  for (p = preloads; p; p = p->next, count++)
+    if (grub_strcmp (p->device, device) == 0
+	&& grub_strcmp (p->path, path) == 0)
+      break;
+  if (p || count >= PRELOAD_MAX_FILES)
+    {
+      grub_free (device);
+      return;
+    }
+
+  p = grub_zalloc (sizeof (*p));
+  if (! p || ! (p->path = grub_strdup (path)))
+    {
+      grub_free (p);
+      grub_free (device);
+      return;
+    }
+  p->device = device;
+  p->size = GRUB_FILE_SIZE_UNKNOWN;
+
+  /* Keep the order of the entry, which is the order of the loads.  */
+  {
+    struct preload **q;
+
+    for (q = &preloads; *q; q = &(*q)->next)
+      ;
+    *q = p;
+  }
+}
+
+void
+grub_menu_preload_start (grub_menu_entry_t entry)
+{
+  const char *val, *line;
+  char *root = 0;
+
+  grub_menu_preload_discard ();
+
+  val = grub_env_get ("menu_preload");
+  if (! val || grub_strcmp (val, "1") != 0 || ! entry || entry->submenu
+      || ! entry->sourcecode)
+    return;
+
+  val = grub_env_get ("root");
+  if (val)
+    root = grub_strdup (val);
+
+  for (line = entry->sourcecode; *line; )
+    {
+      const char *s = line;
+      char *cmd;
+      int dynamic;
+
+      cmd = next_word (&s, &dynamic);
+      if (cmd && ! dynamic && grub_strcmp (cmd, "set") == 0)
+	{
+	  char *arg = next_word (&s, &dynamic);
+
+	  if (arg && grub_strncmp (arg, "root=", 5) == 0)
+	    {
+	      grub_free (root);
+	      root = dynamic ? 0 : grub_strdup (arg + 5);
+	    }
+	  grub_free (arg);
+	}
+      else if (cmd && ! dynamic
+	       && (grub_strncmp (cmd, "linux", 5) == 0
+		   || grub_strncmp (cmd, "initrd", 6) == 0))
+	{
+	  int is_initrd = (cmd[0] == 'i');
+	  char *arg;
+
+	  while ((arg = next_word (&s, &dynamic)))
+	    {
+	      /* Options such as --nounzip change what is read.  */
+	      if (arg[0] == '-')
+		{
+		  grub_free (arg);
+		  break;
+		}
+	      if (! dynamic)
+		preload_add (root, arg);
+	      grub_free (arg);
+	      /* Only the first argument of linux is a file.  */
+	      if (! is_initrd)
+		break;
+	    }
+	}
+      grub_free (cmd);
+
+      line = grub_strchr (line, '\n');
+      if (! line)
+	break;
+      line++;
+    }
+
+  grub_free (root);
+  grub_errno = GRUB_ERR_NONE;
+
+  if (preloads)
+    {
+      preload_entry = entry;
+      grub_file_filter_register (GRUB_FILE_FILTER_PRELOAD, preload_open);
+    }
+}
+
+void
+grub_menu_preload_step (void)
+{
+  struct preload *p;
+  grub_size_t len;
+  grub_ssize_t r;
+
+  for (p = preloads; p && p->loaded == p->size; p = p->next)
+    ;
+  if (! p)
+    return;
+
+  if (! p->file)
+    {
+      char *name;
+
+      name = grub_xasprintf ("(%s)%s", p->device, p->path);
+      if (name)
+	{
+	  /* The copy must be of the bytes on disk.  */
+	  grub_file_filter_disable_all ();
+	  p->file = grub_file_open (name);
+	  grub_free (name);
+	}
+      if (! p->file || p->file->size == GRUB_FILE_SIZE_UNKNOWN
+	  || p->file->size > PRELOAD_MAX_TOTAL - preload_total
+	  || ! (p->buf = grub_malloc (p->file->size + 1)))
+	{
+	  grub_dprintf ("preload", "not preloading (%s)%s\n", p->device,
+			p->path);
+	  grub_errno = GRUB_ERR_NONE;
+	  preload_drop (p);
+	  return;
+	}
+      p->size = p->file->size;
+      preload_total += p->size;
+    }
+
+  len = p->size - p->loaded;
+  if (len > PRELOAD_CHUNK)
+    len = PRELOAD_CHUNK;
+  r = grub_file_read (p->file, p->buf + p->loaded, len);
+  if (r <= 0 && len)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      preload_drop (p);
+      return;
+    }
+  p->loaded += r;
+
+  if (p->loaded == p->size)
+    {
+      grub_file_close (p->file);
+      p->file = 0;
+    }
+}
@@ -413,6 +413,40 @@ read_terminal_list (const char *prefix)
   grub_errno = GRUB_ERR_NONE;
 }
 
+/* Whether C goes to the terminal unchanged whatever its code type,
+   so that runs of such glyphs can be passed to putchars as is.  */
+static inline int
+is_plain_glyph (const struct grub_unicode_glyph *c)
+{
+  return c->base >= 0x20 && c->base < 0x7f && c->ncomb == 0
+    && c->attributes == 0;
+}
+
+void
+grub_print_spaces (struct grub_term_output *term, int number_spaces)
+{
+  struct grub_unicode_glyph spaces[16];
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (spaces); i++)
+    spaces[i] = (struct grub_unicode_glyph)
+      {
+	.base = ' ',
+	.variant = 0,
+	.attributes = 0,
+	.ncomb = 0,
+	.estimated_width = 1
+      };
+
+  while (number_spaces > 0)
+    {
+      i = number_spaces < (int) ARRAY_SIZE (spaces) ? number_spaces
+	: ARRAY_SIZE (spaces);
+      grub_term_putchars (term, spaces, i);
+      number_spaces -= i;
+    }
+}
+
 static void
 putglyph (const struct grub_unicode_glyph *c, struct grub_term_output *term,
 	  int fixed_tab)
@@ -427,26 +461,14 @@ putglyph (const struct grub_unicode_glyph *c, struct grub_term_output *term,
 
   if (c->base == '\t' && fixed_tab)
     {
-      int n;
-
-      n = GRUB_TERM_TAB_WIDTH;
-      c2.base = ' ';
-      while (n--)
-	(term->putchar) (term, &c2);
-
+      grub_print_spaces (term, GRUB_TERM_TAB_WIDTH);
       return;
     }
 
   if (c->base == '\t' && term->getxy)
     {
-      int n;
-
-      n = GRUB_TERM_TAB_WIDTH - ((term->getxy (term).x)
-				 % GRUB_TERM_TAB_WIDTH);
-      c2.base = ' ';
-      while (n--)
-	(term->putchar) (term, &c2);
-
+      grub_print_spaces (term, GRUB_TERM_TAB_WIDTH
+			 - ((term->getxy (term).x) % GRUB_TERM_TAB_WIDTH));
       return;
     }
 
@@ -784,6 +806,19 @@ put_glyphs_terminal (struct grub_unicode_glyph *visual,
   int since_last_nl = 1;
   for (visual_ptr = visual; visual_ptr < visual + visual_len; visual_ptr++)
     {
+      if (is_plain_glyph (visual_ptr))
+	{
+	  struct grub_unicode_glyph *run_end = visual_ptr + 1;
+
+	  while (run_end < visual + visual_len && is_plain_glyph (run_end))
+	    run_end++;
+	  grub_term_putchars (term, visual_ptr, run_end - visual_ptr);
+	  since_last_nl += run_end - visual_ptr;
+	  /* Plain glyphs own no memory; nothing to destroy.  */
+	  visual_ptr = run_end - 1;
+	  continue;
+	}
+
       if (visual_ptr->base == '\n' && fill_right)
 	fill_margin (term, margin_right);
 
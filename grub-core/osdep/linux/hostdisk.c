@@ -346,8 +346,8 @@ grub_hostdisk_flush_initial_buffer (const char *os_dev)
 }
 
 int
-grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags,
-			  grub_disk_addr_t *max)
+grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t *sector,
+			  int flags, grub_disk_addr_t *max)
 {
   grub_util_fd_t fd;
   struct grub_util_hostdisk_data *data = disk->data;
@@ -381,10 +381,10 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
     if (disk->partition
 	&& strncmp (dev, "/dev/", 5) == 0)
       {
-	if (sector >= part_start)
+	if (*sector >= part_start)
 	  is_partition = grub_hostdisk_linux_find_partition (dev, part_start);
 	else
-	  *max = part_start - sector;
+	  *max = part_start - *sector;
       }
 
   reopen:
@@ -434,9 +434,9 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
       {
 	*max = grub_util_get_fd_size (fd, dev, 0);
 	*max >>= disk->log_sector_size;
-	if (sector - part_start >= *max)
+	if (*sector - part_start >= *max)
 	  {
-	    *max = disk->partition->len - (sector - part_start);
+	    *max = disk->partition->len - (*sector - part_start);
 	    if (*max == 0)
 	      *max = ~0ULL;
 	    is_partition = 0;
@@ -444,18 +444,10 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
 	    dev[sizeof(dev) - 1] = '\0';
 	    goto reopen;
 	  }
-	sector -= part_start;
-	*max -= sector;
+	*sector -= part_start;
+	*max -= *sector;
       }
   }
 
-  if (grub_util_fd_seek (fd, sector << disk->log_sector_size))
-    {
-      close (fd);
-      grub_error (GRUB_ERR_BAD_DEVICE, N_("cannot seek `%s': %s"),
-		  grub_util_biosdisk_get_osdev (disk), strerror (errno));
-      return -1;
-    }
-
   return fd;
 }
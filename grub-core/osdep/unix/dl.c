@@ -22,9 +22,12 @@
 #include <grub/dl.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/emu/misc.h>
 #include <sys/mman.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 void *
 grub_osdep_dl_memalign (grub_size_t align, grub_size_t size)
@@ -59,3 +62,182 @@ grub_dl_osdep_dl_free (void *ptr)
   if (ptr)
     free (ptr);
 }
+
+/* Modules are code the host didn't load, so its tools only see anonymous
+   memory.  Each module is announced to GDB with its JIT interface, as a
+   copy of its ELF image with the sections at their load addresses, and
+   with --perf-map its functions are listed in /tmp/perf-PID.map, which
+   perf reads.  The names and layout below are fixed by GDB.  */
+
+enum
+  {
+    JIT_NOACTION,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN
+  };
+
+struct jit_code_entry
+{
+  struct jit_code_entry *next_entry;
+  struct jit_code_entry *prev_entry;
+  const char *symfile_addr;
+  grub_uint64_t symfile_size;
+};
+
+struct jit_descriptor
+{
+  grub_uint32_t version;
+  grub_uint32_t action_flag;
+  struct jit_code_entry *relevant_entry;
+  struct jit_code_entry *first_entry;
+};
+
+void __jit_debug_register_code (void);
+extern struct jit_descriptor __jit_debug_descriptor;
+
+/* GDB puts a breakpoint here.  */
+void __attribute__ ((noinline))
+__jit_debug_register_code (void)
+{
+  asm volatile ("");
+}
+
+struct jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, 0, 0 };
+
+struct dl_jit
+{
+  struct jit_code_entry entry;
+  grub_dl_t mod;
+};
+
+static FILE *perf_map;
+
+static Elf_Addr
+section_addr (grub_dl_t mod, unsigned n)
+{
+  grub_dl_segment_t seg;
+
+  for (seg = mod->segment; seg; seg = seg->next)
+    if (seg->section == n)
+      return (Elf_Addr) seg->addr;
+  return 0;
+}
+
+static void
+perf_map_add (grub_dl_t mod, Elf_Addr addr, Elf_Addr size, const char *name)
+{
+  if (!perf_map)
+    {
+      char path[64];
+
+      snprintf (path, sizeof (path), "/tmp/perf-%d.map", (int) getpid ());
+      perf_map = fopen (path, "a");
+      if (!perf_map)
+	{
+	  grub_emu_perf_map = 0;
+	  return;
+	}
+    }
+  fprintf (perf_map, "%llx %llx %s [%s]\n", (unsigned long long) addr,
+	   (unsigned long long) size, name, mod->name);
+}
+
+void
+grub_dl_osdep_loaded (grub_dl_t mod, const void *ehdr, grub_size_t size)
+{
+  Elf_Ehdr *e;
+  Elf_Shdr *s, *symtab = 0;
+  struct dl_jit *jit;
+  unsigned i;
+
+  jit = calloc (1, sizeof (*jit));
+  e = malloc (size);
+  if (!jit || !e)
+    {
+      free (jit);
+      free (e);
+      return;
+    }
+  memcpy (e, ehdr, size);
+
+  for (i = 0; i < e->e_shnum; i++)
+    {
+      s = (Elf_Shdr *) ((char *) e + e->e_shoff + i * e->e_shentsize);
+      if (s->sh_flags & SHF_ALLOC)
+	s->sh_addr = section_addr (mod, i);
+      else if (s->sh_type == SHT_SYMTAB)
+	symtab = s;
+    }
+
+  /* The loaded symbols hold addresses, while in a relocatable image they
+     are relative to their section.  */
+  if (symtab && mod->symtab)
+    {
+      Elf_Sym *sym = (Elf_Sym *) ((char *) e + symtab->sh_offset);
+      Elf_Sym *loaded = mod->symtab;
+      const char *str;
+
+      s = (Elf_Shdr *) ((char *) e + e->e_shoff
+			+ symtab->sh_link * e->e_shentsize);
+      str = (char *) e + s->sh_offset;
+
+      for (i = 0; i < symtab->sh_size / symtab->sh_entsize; i++)
+	{
+	  sym->st_value = loaded->st_value;
+	  if (sym->st_shndx == SHN_UNDEF)
+	    sym->st_value = 0;
+	  else if (sym->st_shndx < SHN_LORESERVE)
+	    {
+	      if (grub_emu_perf_map && ELF_ST_TYPE (sym->st_info) == STT_FUNC
+		  && sym->st_size)
+		perf_map_add (mod, sym->st_value, sym->st_size,
+			      str + sym->st_name);
+	      sym->st_value -= section_addr (mod, sym->st_shndx);
+	    }
+	  sym = (Elf_Sym *) ((char *) sym + symtab->sh_entsize);
+	  loaded = (Elf_Sym *) ((char *) loaded + mod->symsize);
+	}
+      if (perf_map)
+	fflush (perf_map);
+    }
+
+  jit->mod = mod;
+  jit->entry.symfile_addr = (const char *) e;
+  jit->entry.symfile_size = size;
+  jit->entry.next_entry = __jit_debug_descriptor.first_entry;
+  if (jit->entry.next_entry)
+    jit->entry.next_entry->prev_entry = &jit->entry;
+  __jit_debug_descriptor.first_entry = &jit->entry;
+  __jit_debug_descriptor.relevant_entry = &jit->entry;
+  __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+  __jit_debug_register_code ();
+}
+
+void
+grub_dl_osdep_unloaded (grub_dl_t mod)
+{
+  struct jit_code_entry *entry;
+  struct dl_jit *jit;
+
+  for (entry = __jit_debug_descriptor.first_entry; entry;
+       entry = entry->next_entry)
+    if (((struct dl_jit *) entry)->mod == mod)
+      break;
+  if (!entry)
+    return;
+  jit = (struct dl_jit *) entry;
+
+  if (entry->prev_entry)
+    entry->prev_entry->next_entry = entry->next_entry;
+  else
+    __jit_debug_descriptor.first_entry = entry->next_entry;
+  if (entry->next_entry)
+    entry->next_entry->prev_entry = entry->prev_entry;
+
+  __jit_debug_descriptor.relevant_entry = entry;
+  __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+  __jit_debug_register_code ();
+
+  free ((void *) entry->symfile_addr);
+  free (jit);
+}
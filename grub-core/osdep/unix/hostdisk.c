@@ -116,6 +116,49 @@ grub_util_fd_read (grub_util_fd_t fd, char *buf, size_t len)
   return size;
 }
 
+/* Read LEN bytes at offset OFF of FD in BUF, without moving the file
+   position.  Return like grub_util_fd_read.  */
+ssize_t
+grub_util_fd_pread (grub_util_fd_t fd, char *buf, size_t len,
+		    grub_uint64_t off)
+{
+  ssize_t size = 0;
+
+  while (len)
+    {
+      ssize_t ret = pread (fd, buf, len, (off_t) off);
+
+      if (ret == 0)
+	break;
+
+      if (ret < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          else
+            return ret;
+        }
+
+      len -= ret;
+      buf += ret;
+      off += ret;
+      size += ret;
+    }
+
+  return size;
+}
+
+/* Tell the OS that LEN bytes at offset OFF of FD will be read soon.  */
+void
+grub_util_fd_advise (grub_util_fd_t fd __attribute__ ((unused)),
+		     grub_uint64_t off __attribute__ ((unused)),
+		     grub_uint64_t len __attribute__ ((unused)))
+{
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise (fd, (off_t) off, (off_t) len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 /* Write LEN bytes from BUF to FD. Return less than or equal to zero if an
    error occurs, otherwise return LEN.  */
 ssize_t
@@ -57,3 +57,15 @@ grub_dl_osdep_dl_free (void *ptr)
     return;
   VirtualFree (ptr, 0,  MEM_RELEASE);
 }
+
+void
+grub_dl_osdep_loaded (grub_dl_t mod __attribute__ ((unused)),
+		      const void *ehdr __attribute__ ((unused)),
+		      grub_size_t size __attribute__ ((unused)))
+{
+}
+
+void
+grub_dl_osdep_unloaded (grub_dl_t mod __attribute__ ((unused)))
+{
+}
@@ -259,6 +259,22 @@ grub_util_fd_read (grub_util_fd_t fd, char *buf, size_t len)
   return real_read;
 }
 
+ssize_t
+grub_util_fd_pread (grub_util_fd_t fd, char *buf, size_t len,
+		    grub_uint64_t off)
+{
+  if (grub_util_fd_seek (fd, off))
+    return -1;
+  return grub_util_fd_read (fd, buf, len);
+}
+
+void
+grub_util_fd_advise (grub_util_fd_t fd __attribute__ ((unused)),
+		     grub_uint64_t off __attribute__ ((unused)),
+		     grub_uint64_t len __attribute__ ((unused)))
+{
+}
+
 ssize_t
 grub_util_fd_write (grub_util_fd_t fd, const char *buf, size_t len)
 {
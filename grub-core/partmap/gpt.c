@@ -25,6 +25,7 @@
 #include <grub/msdos_partition.h>
 #include <grub/gpt_partition.h>
 #include <grub/i18n.h>
+#include <grub/lib/crc.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -42,8 +43,67 @@ static const grub_gpt_part_type_t grub_gpt_partition_type_bios_boot = GRUB_GPT_P
 /* 512 << 7 = 65536 byte sectors.  */
 #define MAX_SECTOR_LOG 7
 
+/* The specification asks for at least 16K, nobody uses much more.  */
+#define GPT_MAX_ENTRIES_SIZE (1 << 20)
+
 static struct grub_partition_map grub_gpt_partition_map;
 
+/* Read the GPT header at SECTOR and its entry array into *GPT and *TABLE,
+   checking both against their CRCs if CHECK is set.  */
+static grub_err_t
+gpt_read (grub_disk_t disk, grub_disk_addr_t sector, int sector_log,
+	  struct grub_gpt_header *gpt, char **table, int check)
+{
+  grub_uint8_t buf[GRUB_DISK_SECTOR_SIZE];
+  grub_uint32_t headersize, crc, maxpart, entry_size;
+
+  if (grub_disk_read (disk, sector, 0, sizeof (buf), buf))
+    return grub_errno;
+  grub_memcpy (gpt, buf, sizeof (*gpt));
+
+  if (grub_memcmp (gpt->magic, grub_gpt_magic, sizeof (grub_gpt_magic)) != 0)
+    return grub_error (GRUB_ERR_BAD_PART_TABLE, "no valid GPT header");
+
+  if (check)
+    {
+      headersize = grub_le_to_cpu32 (gpt->headersize);
+      if (headersize < sizeof (*gpt) || headersize > sizeof (buf))
+	return grub_error (GRUB_ERR_BAD_PART_TABLE,
+			   "invalid GPT header size");
+      crc = gpt->crc32;
+      ((struct grub_gpt_header *) buf)->crc32 = 0;
+      if (grub_getcrc32 (0, buf, headersize) != grub_le_to_cpu32 (crc))
+	return grub_error (GRUB_ERR_BAD_PART_TABLE,
+			   "GPT header checksum mismatch");
+    }
+
+  maxpart = grub_le_to_cpu32 (gpt->maxpart);
+  entry_size = grub_le_to_cpu32 (gpt->partentry_size);
+  if (entry_size < sizeof (struct grub_gpt_partentry)
+      || maxpart > GPT_MAX_ENTRIES_SIZE / entry_size)
+    return grub_error (GRUB_ERR_BAD_PART_TABLE, "invalid GPT entry array");
+
+  *table = grub_malloc (maxpart * entry_size + 1);
+  if (!*table)
+    return grub_errno;
+  if (grub_disk_read (disk, grub_le_to_cpu64 (gpt->partitions) << sector_log,
+		      0, maxpart * entry_size, *table))
+    goto fail;
+  if (check && grub_getcrc32 (0, *table, maxpart * entry_size)
+		  != grub_le_to_cpu32 (gpt->partentry_crc32))
+    {
+      grub_error (GRUB_ERR_BAD_PART_TABLE,
+		  "GPT entry array checksum mismatch");
+      goto fail;
+    }
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (*table);
+  *table = 0;
+  return grub_errno;
+}
+
 
 
 grub_err_t
@@ -52,10 +112,12 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 				void *hook_data)
 {
   struct grub_partition part;
-  struct grub_gpt_header gpt;
-  struct grub_gpt_partentry entry;
+  struct grub_gpt_header gpt, primary;
+  struct grub_gpt_partentry *entry;
   struct grub_msdos_partition_mbr mbr;
   grub_uint64_t entries;
+  grub_uint32_t maxpart, entry_size;
+  char *table;
   unsigned int i;
   int last_offset = 0;
   int sector_log = 0;
@@ -89,20 +151,56 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 
   grub_dprintf ("gpt", "Read a valid GPT header\n");
 
-  entries = grub_le_to_cpu64 (gpt.partitions) << sector_log;
-  for (i = 0; i < grub_le_to_cpu32 (gpt.maxpart); i++)
+  /* Use the backup at the end of the disk when the header or the entries
+     of the primary don't match their CRCs.  */
+  if (gpt_read (disk, 1 << sector_log, sector_log, &primary, &table, 1))
     {
-      if (grub_disk_read (disk, entries, last_offset,
-			  sizeof (entry), &entry))
+      grub_disk_addr_t backup;
+
+      if (grub_errno != GRUB_ERR_BAD_PART_TABLE)
 	return grub_errno;
+      grub_dprintf ("gpt", "primary GPT: %s, trying the backup\n",
+		    grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+
+      /* The backup header is on the last sector, which is known better
+	 than from a header that failed its CRC.  */
+      if (grub_disk_get_size (disk) != GRUB_DISK_SIZE_UNKNOWN)
+	backup = ((grub_disk_get_size (disk) >> sector_log) - 1) << sector_log;
+      else
+	backup = grub_le_to_cpu64 (gpt.backup) << sector_log;
+      if (gpt_read (disk, backup, sector_log, &gpt, &table, 1))
+	{
+	  if (grub_errno != GRUB_ERR_BAD_PART_TABLE)
+	    return grub_errno;
+
+	  /* Both are damaged: read the primary as it is, like before the
+	     CRCs were checked.  */
+	  grub_dprintf ("gpt", "backup GPT: %s, using the primary anyway\n",
+			grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  if (gpt_read (disk, 1 << sector_log, sector_log, &gpt, &table, 0))
+	    return grub_errno;
+	}
+    }
+  else
+    gpt = primary;
+
+  entries = grub_le_to_cpu64 (gpt.partitions) << sector_log;
+  maxpart = grub_le_to_cpu32 (gpt.maxpart);
+  entry_size = grub_le_to_cpu32 (gpt.partentry_size);
+
+  for (i = 0; i < maxpart; i++)
+    {
+      entry = (struct grub_gpt_partentry *) (table + i * entry_size);
 
-      if (grub_memcmp (&grub_gpt_partition_type_empty, &entry.type,
+      if (grub_memcmp (&grub_gpt_partition_type_empty, &entry->type,
 		       sizeof (grub_gpt_partition_type_empty)))
 	{
 	  /* Calculate the first block and the size of the partition.  */
-	  part.start = grub_le_to_cpu64 (entry.start) << sector_log;
-	  part.len = (grub_le_to_cpu64 (entry.end)
-		      - grub_le_to_cpu64 (entry.start) + 1)  << sector_log;
+	  part.start = grub_le_to_cpu64 (entry->start) << sector_log;
+	  part.len = (grub_le_to_cpu64 (entry->end)
+		      - grub_le_to_cpu64 (entry->start) + 1)  << sector_log;
 	  part.offset = entries;
 	  part.number = i;
 	  part.index = last_offset;
@@ -114,10 +212,13 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 			(unsigned long long) part.len);
 
 	  if (hook (disk, &part, hook_data))
-	    return grub_errno;
+	    {
+	      grub_free (table);
+	      return grub_errno;
+	    }
 	}
 
-      last_offset += grub_le_to_cpu32 (gpt.partentry_size);
+      last_offset += entry_size;
       if (last_offset == GRUB_DISK_SECTOR_SIZE)
 	{
 	  last_offset = 0;
@@ -125,6 +226,7 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 	}
     }
 
+  grub_free (table);
   return GRUB_ERR_NONE;
 }
 
@@ -613,6 +613,48 @@ append (struct grub_script_argv *result,
   return r;
 }
 
+/* Expand wildcards in the words of WORD and add them to RESULT.  WORD
+   is freed.  */
+static int
+expand_word (struct grub_script_argv *result, struct grub_script_argv *word)
+{
+  unsigned i;
+  int j;
+  int failed = 0;
+
+  if (word->argc && ! word->args[word->argc - 1])
+    word->argc--;
+
+  for (i = 0; ! failed && i < word->argc; i++)
+    {
+      char **expansions = 0;
+      if (grub_wildcard_translator
+	  && grub_wildcard_translator->expand (word->args[i],
+					       &expansions))
+	{
+	  failed = 1;
+	  break;
+	}
+
+      if (! expansions)
+	failed = (grub_script_argv_next (result)
+		  || append (result, word->args[i], -1));
+      else
+	{
+	  for (j = 0; expansions[j]; j++)
+	    {
+	      failed = (failed || grub_script_argv_next (result) ||
+			append (result, expansions[j], 0));
+	      grub_free (expansions[j]);
+	    }
+	  grub_free (expansions);
+	}
+    }
+
+  grub_script_argv_free (word);
+  return failed;
+}
+
 /* Convert arguments in ARGLIST into ARGV form.  */
 static int
 grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
@@ -622,11 +664,22 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
   char **values = 0;
   struct grub_script_arg *arg = 0;
   struct grub_script_argv result = { 0, 0, 0 };
+  struct grub_script_argv word = { 0, 0, 0 };
 
   for (; arglist && arglist->arg; arglist = arglist->next)
     {
-      if (grub_script_argv_next (&result))
-	goto fail;
+      /* Literal words were expanded by the parser already.  */
+      if (arglist->literal)
+	{
+	  if (grub_script_argv_next (&result)
+	      || grub_script_argv_append (&result, arglist->literal,
+					  grub_strlen (arglist->literal)))
+	    goto fail;
+	  continue;
+	}
+
+      if (grub_script_argv_next (&word))
+	goto fail_word;
 
       arg = arglist->arg;
       while (arg)
@@ -643,7 +696,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 		  {
 		    if (!need_cleanup)
 		      {
-			if (i != 0 && grub_script_argv_next (&result))
+			if (i != 0 && grub_script_argv_next (&word))
 			  {
 			    need_cleanup = 1;
 			    goto cleanup;
@@ -681,13 +734,13 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 			      }
 			    *op = '\0';
 
-			    need_cleanup = grub_script_argv_append (&result, p, op - p);
+			    need_cleanup = grub_script_argv_append (&word, p, op - p);
 			    grub_free (p);
 			    /* Fall through to cleanup */
 			  }
 			else
 			  {
-			    need_cleanup = append (&result, values[i], 1);
+			    need_cleanup = append (&word, values[i], 1);
 			    /* Fall through to cleanup */
 			  }
 		      }
@@ -698,7 +751,7 @@ cleanup:
 		grub_free (values);
 
 		if (need_cleanup)
-		  goto fail;
+		  goto fail_word;
 
 		break;
 	      }
@@ -706,97 +759,64 @@ cleanup:
 	    case GRUB_SCRIPT_ARG_TYPE_BLOCK:
 	      {
 		char *p;
-		if (grub_script_argv_append (&result, "{", 1))
-		  goto fail;
+		if (grub_script_argv_append (&word, "{", 1))
+		  goto fail_word;
 		p = wildcard_escape (arg->str);
 		if (!p)
-		  goto fail;
-		if (grub_script_argv_append (&result, p,
+		  goto fail_word;
+		if (grub_script_argv_append (&word, p,
 					     grub_strlen (p)))
 		  {
 		    grub_free (p);
-		    goto fail;
+		    goto fail_word;
 		  }
 		grub_free (p);
-		if (grub_script_argv_append (&result, "}", 1))
-		  goto fail;
+		if (grub_script_argv_append (&word, "}", 1))
+		  goto fail_word;
 	      }
 	      result.script = arg->script;
 	      break;
 
 	    case GRUB_SCRIPT_ARG_TYPE_TEXT:
 	      if (arg->str[0] &&
-		  grub_script_argv_append (&result, arg->str,
+		  grub_script_argv_append (&word, arg->str,
 					   grub_strlen (arg->str)))
-		goto fail;
+		goto fail_word;
 	      break;
 
 	    case GRUB_SCRIPT_ARG_TYPE_GETTEXT:
 	      {
-		if (gettext_append (&result, arg->str))
-		  goto fail;
+		if (gettext_append (&word, arg->str))
+		  goto fail_word;
 	      }
 	      break;
 
 	    case GRUB_SCRIPT_ARG_TYPE_DQSTR:
 	    case GRUB_SCRIPT_ARG_TYPE_SQSTR:
-	      if (append (&result, arg->str, 1))
-		goto fail;
+	      if (append (&word, arg->str, 1))
+		goto fail_word;
 	      break;
 	    }
 	  arg = arg->next;
 	}
+
+      /* Perform wildcard expansion.  */
+      if (expand_word (&result, &word))
+	goto fail;
     }
 
+  /* Keep the argument vector allocated even if it is empty.  */
+  if (! result.args && grub_script_argv_next (&result))
+    goto fail;
+
   if (! result.args[result.argc - 1])
     result.argc--;
 
-  /* Perform wildcard expansion.  */
-
-  int j;
-  int failed = 0;
-  struct grub_script_argv unexpanded = result;
-
-  result.argc = 0;
-  result.args = 0;
-  for (i = 0; unexpanded.args[i]; i++)
-    {
-      char **expansions = 0;
-      if (grub_wildcard_translator
-	  && grub_wildcard_translator->expand (unexpanded.args[i],
-					       &expansions))
-	{
-	  grub_script_argv_free (&unexpanded);
-	  goto fail;
-	}
-
-      if (! expansions)
-	{
-	  grub_script_argv_next (&result);
-	  append (&result, unexpanded.args[i], -1);
-	}
-      else
-	{
-	  for (j = 0; expansions[j]; j++)
-	    {
-	      failed = (failed || grub_script_argv_next (&result) ||
-			append (&result, expansions[j], 0));
-	      grub_free (expansions[j]);
-	    }
-	  grub_free (expansions);
-	  
-	  if (failed)
-	    {
-	      grub_script_argv_free (&unexpanded);
-	      goto fail;
-	    }
-	}
-    }
-  grub_script_argv_free (&unexpanded);
-
   *argv = result;
   return 0;
 
+ fail_word:
+  grub_script_argv_free (&word);
  fail:
 
   grub_script_argv_free (&result);
@@ -899,6 +919,157 @@ grub_script_execute_sourcecode (const char *source)
   return ret;
 }
 
+/* Parsed sources of menu entries and submenus, so that booting an entry
+   or entering a submenu again doesn't parse it again.  */
+#define SOURCE_CACHE_SIZE	32
+
+struct source_cache_entry
+{
+  char *source;
+  grub_uint32_t hash;
+  struct grub_script **scripts;
+  unsigned nscripts;
+  unsigned long last_use;
+  /* Number of executions of SCRIPTS in progress.  */
+  unsigned busy;
+};
+
+static struct source_cache_entry source_cache[SOURCE_CACHE_SIZE];
+static unsigned long source_cache_clock;
+
+static grub_uint32_t
+source_cache_hash (const char *source)
+{
+  grub_uint32_t hash = 5381;
+
+  while (*source)
+    hash = hash * 33 + (grub_uint8_t) *source++;
+  return hash;
+}
+
+static void
+source_cache_free_scripts (struct grub_script **scripts, unsigned nscripts)
+{
+  unsigned i;
+
+  for (i = 0; i < nscripts; i++)
+    grub_script_unref (scripts[i]);
+  grub_free (scripts);
+}
+
+/* Execute SOURCE like grub_script_execute_sourcecode, keeping its parsed
+   form when that doesn't change the behaviour: parsing must succeed and
+   must not define functions, which happens at parse time.  */
+static grub_err_t
+grub_script_execute_sourcecode_cached (const char *source)
+{
+  struct source_cache_entry *victim = 0;
+  grub_uint32_t hash = source_cache_hash (source);
+  unsigned long generation = grub_script_function_generation;
+  struct grub_script **scripts = 0;
+  unsigned nscripts = 0, allocated = 0, i;
+  const char *p = source;
+  grub_err_t ret = 0;
+  int cacheable = 1;
+
+  for (i = 0; i < SOURCE_CACHE_SIZE; i++)
+    if (source_cache[i].source && source_cache[i].hash == hash
+	&& grub_strcmp (source_cache[i].source, source) == 0)
+      {
+	struct source_cache_entry *entry = &source_cache[i];
+	unsigned j;
+
+	entry->last_use = ++source_cache_clock;
+	entry->busy++;
+	for (j = 0; j < entry->nscripts; j++)
+	  ret = grub_script_execute (entry->scripts[j]);
+	entry->busy--;
+	return ret;
+      }
+
+  while (p)
+    {
+      char *line;
+      struct grub_script *parsed_script;
+
+      grub_script_execute_sourcecode_getline (&line, 0, &p);
+      parsed_script = grub_script_parse
+	(line, grub_script_execute_sourcecode_getline, &p);
+      grub_free (line);
+      if (! parsed_script)
+	{
+	  ret = grub_errno;
+	  cacheable = 0;
+	  break;
+	}
+
+      if (cacheable && nscripts == allocated)
+	{
+	  struct grub_script **n;
+
+	  allocated = allocated ? allocated * 2 : 4;
+	  n = grub_realloc (scripts, allocated * sizeof (scripts[0]));
+	  if (!n)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      cacheable = 0;
+	    }
+	  else
+	    scripts = n;
+	}
+
+      ret = grub_script_execute (parsed_script);
+
+      if (cacheable && generation == grub_script_function_generation)
+	scripts[nscripts++] = parsed_script;
+      else
+	{
+	  grub_script_unref (parsed_script);
+	  cacheable = 0;
+	}
+    }
+
+  /* Executing SOURCE may have run other sources meanwhile, so the cache
+     has to be looked at again.  */
+  for (i = 0; cacheable && i < SOURCE_CACHE_SIZE; i++)
+    {
+      if (source_cache[i].source && source_cache[i].hash == hash
+	  && grub_strcmp (source_cache[i].source, source) == 0)
+	cacheable = 0;
+      else if (!source_cache[i].busy
+	       && (!victim || source_cache[i].last_use < victim->last_use))
+	victim = &source_cache[i];
+    }
+
+  if (!cacheable || !victim)
+    {
+      source_cache_free_scripts (scripts, nscripts);
+      return ret;
+    }
+
+  if (victim->source)
+    {
+      source_cache_free_scripts (victim->scripts, victim->nscripts);
+      grub_free (victim->source);
+      victim->source = 0;
+      victim->last_use = 0;
+    }
+
+  victim->source = grub_strdup (source);
+  if (!victim->source)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      source_cache_free_scripts (scripts, nscripts);
+      return ret;
+    }
+  victim->hash = hash;
+  victim->scripts = scripts;
+  victim->nscripts = nscripts;
+  victim->last_use = ++source_cache_clock;
+
+  return ret;
+}
+
 /* Execute a source script in new scope.  */
 grub_err_t
 grub_script_execute_new_scope (const char *source, int argc, char **args)
@@ -914,7 +1085,7 @@ grub_script_execute_new_scope (const char *source, int argc, char **args)
   old_scope = scope;
   scope = &new_scope;
 
-  ret = grub_script_execute_sourcecode (source);
+  ret = grub_script_execute_sourcecode_cached (source);
 
   scope = old_scope;
   return ret;
@@ -930,6 +1101,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   grub_script_function_t func = 0;
   char errnobuf[18];
   char *cmdname;
+  const char *literal;
   int argc;
   char **args;
   int invert;
@@ -943,6 +1115,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   argc = argv.argc - 1;
   args = argv.args + 1;
   cmdname = argv.args[0];
+  literal = cmdline->arglist->literal;
   if (grub_strcmp (cmdname, "!") == 0)
     {
       if (argv.argc < 2 || ! argv.args[1])
@@ -956,14 +1129,46 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
       argc = argv.argc - 2;
       args = argv.args + 2;
       cmdname = argv.args[1];
+      literal = (literal && cmdline->arglist->next
+		 ? cmdline->arglist->next->literal : 0);
     }
-  grubcmd = grub_command_find (cmdname);
-  if (! grubcmd)
+
+  /* A literal name always resolves the same way until a command or a
+     function is added or removed.  */
+  if (literal && cmdline->cached
+      && cmdline->cached_cmd_generation == grub_command_generation
+      && cmdline->cached_func_generation == grub_script_function_generation)
     {
-      grub_errno = GRUB_ERR_NONE;
+      grubcmd = cmdline->cached_cmd;
+      func = cmdline->cached_func;
+
+      /* Raise the error the lookup would have.  */
+      if (! grubcmd && ! func)
+	grub_script_function_find (cmdname);
+    }
+  else
+    {
+      grubcmd = grub_command_find (cmdname);
+      if (! grubcmd)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+
+	  /* It's not a GRUB command, try all functions.  */
+	  func = grub_script_function_find (cmdname);
+	}
 
-      /* It's not a GRUB command, try all functions.  */
-      func = grub_script_function_find (cmdname);
+      if (literal)
+	{
+	  cmdline->cached = 1;
+	  cmdline->cached_cmd = grubcmd;
+	  cmdline->cached_func = func;
+	  cmdline->cached_cmd_generation = grub_command_generation;
+	  cmdline->cached_func_generation = grub_script_function_generation;
+	}
+    }
+
+  if (! grubcmd)
+    {
       if (! func)
 	{
 	  /* As a last resort, try if it is an assignment.  */
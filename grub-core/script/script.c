@@ -27,30 +27,55 @@
    allocations.  The memory is freed in case of an error, or assigned
    to the parsed script when parsing was successful.
 
-   In case of the normal malloc, some additional bytes are allocated
-   for this datastructure.  All reserved memory is stored in a linked
-   list so it can be easily freed.  The original memory can be found
-   from &mem.  */
+   Allocations are carved out of chunks with a bump pointer.  Chunks are
+   kept in a linked list so they can be easily freed all at once.  Each
+   recording started by grub_script_mem_record gets its own list, whose
+   chunks grow geometrically: many small blocks and functions stay cheap
+   while big scripts need only a few heap operations.  */
 struct grub_script_mem
 {
   struct grub_script_mem *next;
-  char mem;
+  /* The size of MEM and how much of it was handed out.  */
+  grub_size_t size;
+  grub_size_t used;
+  grub_uint64_t mem[0];
 };
 
+#define GRUB_SCRIPT_MEM_ALIGN		sizeof (grub_uint64_t)
+#define GRUB_SCRIPT_MEM_MIN_CHUNK	256
+#define GRUB_SCRIPT_MEM_MAX_CHUNK	16384
+
 /* Return malloc'ed memory and keep track of the allocation.  */
 void *
 grub_script_malloc (struct grub_parser_param *state, grub_size_t size)
 {
-  struct grub_script_mem *mem;
-  mem = (struct grub_script_mem *) grub_malloc (size + sizeof (*mem)
-						- sizeof (char));
-  if (!mem)
-    return 0;
+  struct grub_script_mem *mem = state->memused;
+  grub_size_t chunk;
+  void *ret;
+
+  size = ALIGN_UP (size, GRUB_SCRIPT_MEM_ALIGN);
+  if (!mem || mem->size - mem->used < size)
+    {
+      chunk = mem ? mem->size * 2 : GRUB_SCRIPT_MEM_MIN_CHUNK;
+      if (chunk > GRUB_SCRIPT_MEM_MAX_CHUNK)
+	chunk = GRUB_SCRIPT_MEM_MAX_CHUNK;
+      if (chunk < size)
+	chunk = size;
+
+      mem = (struct grub_script_mem *) grub_malloc (sizeof (*mem) + chunk);
+      if (!mem)
+	return 0;
 
-  grub_dprintf ("scripting", "malloc %p\n", mem);
-  mem->next = state->memused;
-  state->memused = mem;
-  return (void *) &mem->mem;
+      grub_dprintf ("scripting", "malloc %p\n", mem);
+      mem->size = chunk;
+      mem->used = 0;
+      mem->next = state->memused;
+      state->memused = mem;
+    }
+
+  ret = (char *) mem->mem + mem->used;
+  mem->used += size;
+  return ret;
 }
 
 /* Free all memory described by MEM.  */
@@ -150,6 +175,85 @@ grub_script_arg_add (struct grub_parser_param *state,
   return arg;
 }
 
+/* Return the value ARG will always expand to, or NULL if that depends
+   on variables, gettext or wildcards.  This mirrors
+   grub_script_arglist_to_argv: quoted parts are wildcard-escaped and
+   appended to the raw text, and the word is then unescaped unless the
+   wildcard translator expands it.  The translator only looks at words
+   starting with '/', '(' or '*' and returns those without any regexp
+   operator as they are.  */
+static char *
+grub_script_arg_literal (struct grub_parser_param *state,
+			 struct grub_script_arg *arg)
+{
+  struct grub_script_arg *a;
+  grub_size_t len = 0;
+  char *buf, *p, *q, *ret;
+  int nonempty = 0, regexop = 0;
+
+  for (a = arg; a; a = a->next)
+    switch (a->type)
+      {
+      case GRUB_SCRIPT_ARG_TYPE_TEXT:
+	len += grub_strlen (a->str);
+	nonempty |= (a->str[0] != 0);
+	break;
+      case GRUB_SCRIPT_ARG_TYPE_DQSTR:
+      case GRUB_SCRIPT_ARG_TYPE_SQSTR:
+	len += 2 * grub_strlen (a->str);
+	nonempty = 1;
+	break;
+      default:
+	return 0;
+      }
+
+  /* An empty word disappears, leave that to the general case.  */
+  if (! nonempty)
+    return 0;
+
+  buf = grub_malloc (len + 1);
+  if (! buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  for (p = buf, a = arg; a; a = a->next)
+    for (q = a->str; *q; q++)
+      {
+	if (a->type != GRUB_SCRIPT_ARG_TYPE_TEXT
+	    && (*q == '*' || *q == '\\' || *q == '?'))
+	  *p++ = '\\';
+	*p++ = *q;
+      }
+  *p = 0;
+
+  for (p = buf; *p; p++)
+    if (grub_strchr ("*.\\|+{}[]?", *p))
+      regexop = 1;
+
+  ret = 0;
+  if (regexop && (buf[0] == '/' || buf[0] == '(' || buf[0] == '*'))
+    goto out;
+
+  /* Unescape in place.  */
+  for (p = q = buf; *q; q++)
+    {
+      if (*q == '\\' && ! *++q)
+	goto out;
+      *p++ = *q;
+    }
+  *p = 0;
+
+  ret = grub_script_malloc (state, p - buf + 1);
+  if (ret)
+    grub_memcpy (ret, buf, p - buf + 1);
+
+ out:
+  grub_free (buf);
+  return ret;
+}
+
 /* Add the argument ARG to the end of the argument list LIST.  If LIST
    is zero, a new list will be created.  */
 struct grub_script_arglist *
@@ -170,6 +274,7 @@ grub_script_add_arglist (struct grub_parser_param *state,
   link->next = 0;
   link->arg = arg;
   link->argcount = 0;
+  link->literal = grub_script_arg_literal (state, arg);
 
   if (!list)
     {
@@ -204,6 +309,7 @@ grub_script_create_cmdline (struct grub_parser_param *state,
   cmd->cmd.exec = grub_script_execute_cmdline;
   cmd->cmd.next = 0;
   cmd->arglist = arglist;
+  cmd->cached = 0;
 
   return (struct grub_script_cmd *) cmd;
 }
@@ -180,12 +180,14 @@ static struct grub_term_output grub_console_term_output =
     .name = "console",
     .init = grub_console_init_output,
     .putchar = grub_terminfo_putchar,
+    .putchars = grub_terminfo_putchars,
     .getxy = grub_terminfo_getxy,
     .getwh = grub_terminfo_getwh,
     .gotoxy = grub_terminfo_gotoxy,
     .cls = grub_terminfo_cls,
     .setcolorstate = grub_terminfo_setcolorstate,
     .setcursor = grub_terminfo_setcursor,
+    .refresh = grub_terminfo_refresh,
     .flags = GRUB_TERM_CODE_TYPE_ASCII,
     .data = &grub_console_terminfo_output,
     .progress_update_divisor = GRUB_PROGRESS_FAST
@@ -97,6 +97,50 @@ grub_console_putchar (struct grub_term_output *term __attribute__ ((unused)),
   efi_call_2 (o->output_string, o, str);
 }
 
+/* Each output_string is a firmware call; send ASCII runs in one.  */
+static void
+grub_console_putchars (struct grub_term_output *term,
+		       const struct grub_unicode_glyph *c, grub_size_t n)
+{
+  grub_efi_char16_t str[64 + 1];
+  grub_efi_simple_text_output_interface_t *o;
+  unsigned len = 0;
+
+  if (grub_efi_is_finished)
+    return;
+
+  o = grub_efi_system_table->con_out;
+
+  for (; n; n--, c++)
+    {
+      if (c->base > 0x7f || c->ncomb)
+	{
+	  if (len)
+	    {
+	      str[len] = 0;
+	      efi_call_2 (o->output_string, o, str);
+	      len = 0;
+	    }
+	  grub_console_putchar (term, c);
+	  continue;
+	}
+
+      str[len++] = c->base;
+      if (len == ARRAY_SIZE (str) - 1)
+	{
+	  str[len] = 0;
+	  efi_call_2 (o->output_string, o, str);
+	  len = 0;
+	}
+    }
+
+  if (len)
+    {
+      str[len] = 0;
+      efi_call_2 (o->output_string, o, str);
+    }
+}
+
 const unsigned efi_codes[] =
   {
     0, GRUB_TERM_KEY_UP, GRUB_TERM_KEY_DOWN, GRUB_TERM_KEY_RIGHT,
@@ -348,6 +392,7 @@ static struct grub_term_output grub_console_term_output =
     .init = grub_efi_console_output_init,
     .fini = grub_efi_console_output_fini,
     .putchar = grub_console_putchar,
+    .putchars = grub_console_putchars,
     .getwh = grub_console_getwh,
     .getxy = grub_console_getxy,
     .gotoxy = grub_console_gotoxy,
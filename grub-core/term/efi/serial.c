@@ -98,6 +98,22 @@ serial_hw_put (struct grub_serial_port *port, const int c)
   efi_call_3 (port->interface->write, port->interface, &bufsize, &c0);
 }
 
+/* Put LEN characters with one firmware call.  */
+static void
+serial_hw_write (struct grub_serial_port *port, const char *buf,
+		 grub_size_t len)
+{
+  grub_efi_uintn_t bufsize = len;
+
+  do_real_config (port);
+
+  if (port->broken)
+    return;
+
+  efi_call_3 (port->interface->write, port->interface, &bufsize,
+	      (void *) buf);
+}
+
 /* Initialize a serial device. PORT is the port number for a serial device.
    SPEED is a DTE-DTE speed which must be one of these: 2400, 4800, 9600,
    19200, 38400, 57600 and 115200. WORD_LEN is the word length to be used
@@ -137,7 +153,8 @@ struct grub_serial_driver grub_efiserial_driver =
   {
     .configure = serial_hw_configure,
     .fetch = serial_hw_fetch,
-    .put = serial_hw_put
+    .put = serial_hw_put,
+    .write = serial_hw_write
   };
 
 void
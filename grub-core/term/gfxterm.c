@@ -820,21 +820,15 @@ scroll_up (void)
   virtual_screen.total_scroll++;
 }
 
+/* Put C into the text buffer with the cursor already erased.  */
 static void
-grub_gfxterm_putchar (struct grub_term_output *term,
-		      const struct grub_unicode_glyph *c)
+put_glyph (struct grub_term_output *term,
+	   const struct grub_unicode_glyph *c)
 {
-  if (!virtual_screen.functional)
-    return;
-
   if (c->base == '\a')
     /* FIXME */
     return;
 
-  /* Erase current cursor, if any.  */
-  if (virtual_screen.cursor_state)
-    draw_cursor (0);
-
   if (c->base == '\b' || c->base == '\n' || c->base == '\r')
     {
       switch (c->base)
@@ -878,6 +872,18 @@ grub_gfxterm_putchar (struct grub_term_output *term,
       p = (virtual_screen.text_buffer +
            virtual_screen.cursor_x +
            virtual_screen.cursor_y * virtual_screen.columns);
+
+      /* Menus and editors rewrite whole screens of mostly unchanged
+	 text.  If the cell already holds this very character in these
+	 colors, the text layer holds its glyph too (it scrolls along
+	 with the buffer), so skip the render and the damage.  */
+      if (char_width == 1 && c->ncomb == 0 && p->code.ncomb == 0
+	  && p->code.base == c->base && p->code.variant == c->variant
+	  && p->code.attributes == c->attributes
+	  && p->fg_color == virtual_screen.fg_color
+	  && p->bg_color == virtual_screen.bg_color)
+	goto advance;
+
       grub_unicode_destroy_glyph (&p->code);
       grub_unicode_set_glyph (&p->code, c);
       grub_errno = GRUB_ERR_NONE;
@@ -901,6 +907,7 @@ grub_gfxterm_putchar (struct grub_term_output *term,
       /* Draw glyph.  */
       write_char ();
 
+    advance:
       /* Make sure we scroll screen when needed and wrap line correctly.  */
       virtual_screen.cursor_x += char_width;
       if (virtual_screen.cursor_x >= virtual_screen.columns)
@@ -913,6 +920,20 @@ grub_gfxterm_putchar (struct grub_term_output *term,
             virtual_screen.cursor_y++;
         }
     }
+}
+
+static void
+grub_gfxterm_putchar (struct grub_term_output *term,
+		      const struct grub_unicode_glyph *c)
+{
+  if (!virtual_screen.functional || c->base == '\a')
+    return;
+
+  /* Erase current cursor, if any.  */
+  if (virtual_screen.cursor_state)
+    draw_cursor (0);
+
+  put_glyph (term, c);
 
   /* Redraw cursor if it should be visible.  */
   /* Note: This will redraw the character as well, which means that the
@@ -921,6 +942,24 @@ grub_gfxterm_putchar (struct grub_term_output *term,
     draw_cursor (1);
 }
 
+/* Like putchar, but the cursor is erased and redrawn only once.  */
+static void
+grub_gfxterm_putchars (struct grub_term_output *term,
+		       const struct grub_unicode_glyph *c, grub_size_t n)
+{
+  if (!virtual_screen.functional)
+    return;
+
+  if (virtual_screen.cursor_state)
+    draw_cursor (0);
+
+  for (; n; n--, c++)
+    put_glyph (term, c);
+
+  if (virtual_screen.cursor_state)
+    draw_cursor (1);
+}
+
 /* Use ASCII characters to determine normal character width.  */
 static unsigned int
 calculate_normal_character_width (grub_font_t font)
@@ -1100,6 +1139,7 @@ static struct grub_term_output grub_video_term =
     .init = grub_gfxterm_term_init,
     .fini = grub_gfxterm_term_fini,
     .putchar = grub_gfxterm_putchar,
+    .putchars = grub_gfxterm_putchars,
     .getcharwidth = grub_gfxterm_getcharwidth,
     .getwh = grub_virtual_screen_getwh,
     .getxy = grub_virtual_screen_getxy,
@@ -60,6 +60,7 @@ static struct grub_term_output grub_cbmemc_term_output =
     .init = grub_terminfo_output_init,
     .fini = 0,
     .putchar = grub_terminfo_putchar,
+    .putchars = grub_terminfo_putchars,
     .getxy = grub_terminfo_getxy,
     .getwh = grub_terminfo_getwh,
     .gotoxy = grub_terminfo_gotoxy,
@@ -82,6 +82,21 @@ serial_hw_put (struct grub_serial_port *port, const int c)
   grub_ieee1275_write (port->handle, &c0, 1, &actual);
 }
 
+/* Put LEN characters with one firmware call.  */
+static void
+serial_hw_write (struct grub_serial_port *port, const char *buf,
+		 grub_size_t len)
+{
+  grub_ssize_t actual;
+
+  do_real_config (port);
+
+  if (port->handle == IEEE1275_IHANDLE_INVALID)
+    return;
+
+  grub_ieee1275_write (port->handle, buf, len, &actual);
+}
+
 /* Initialize a serial device. PORT is the port number for a serial device.
    SPEED is a DTE-DTE speed which must be one of these: 2400, 4800, 9600,
    19200, 38400, 57600 and 115200. WORD_LEN is the word length to be used
@@ -102,7 +117,8 @@ struct grub_serial_driver grub_ofserial_driver =
   {
     .configure = serial_hw_configure,
     .fetch = serial_hw_fetch,
-    .put = serial_hw_put
+    .put = serial_hw_put,
+    .write = serial_hw_write
   };
 
 #define OFSERIAL_HASH_SZ	8
@@ -56,9 +56,9 @@ serial_get_divisor (const struct grub_serial_port *port __attribute__ ((unused))
 
   base_clock = config->base_clock ? (config->base_clock >> 4) : DEFAULT_BASE_CLOCK;
 
-  divisor = (base_clock + (config->speed / 2)) / config->speed;
   if (config->speed == 0)
     return 0;
+  divisor = (base_clock + (config->speed / 2)) / config->speed;
   if (divisor > 0xffff || divisor == 0)
     return 0;
   actual_speed = base_clock / divisor;
@@ -74,6 +74,7 @@ do_real_config (struct grub_serial_port *port)
 {
   int divisor;
   unsigned char status = 0;
+  unsigned char iir;
   grub_uint64_t endtime;
 
   const unsigned char parities[] = {
@@ -103,6 +104,11 @@ do_real_config (struct grub_serial_port *port)
   grub_outb (divisor & 0xFF, port->port + UART_DLL);
   grub_outb (divisor >> 8, port->port + UART_DLH);
 
+  /* A 16750 only accepts the 64-byte FIFO enable while DLAB is set.
+     Other chips ignore the bit, so it's harmless to try.  */
+  grub_outb (UART_ENABLE_FIFO_TRIGGER1 | UART_FCR_FIFO64,
+	     port->port + UART_FCR);
+
   /* Set the line status.  */
   status |= (parities[port->config.parity]
 	     | (port->config.word_len - 5)
@@ -126,6 +132,15 @@ do_real_config (struct grub_serial_port *port)
       grub_outb (UART_ENABLE_DTRRTS | UART_ENABLE_OUT2, port->port + UART_MCR);
     }
 
+  /* Find out how many bytes may be queued after each THRE.  */
+  iir = grub_inb (port->port + UART_IIR);
+  if ((iir & UART_IIR_FIFO_MASK) != UART_IIR_FIFO_ENABLED)
+    port->fifo_size = 1;
+  else if (iir & UART_IIR_FIFO64)
+    port->fifo_size = UART_FIFO_SIZE_16750;
+  else
+    port->fifo_size = UART_FIFO_SIZE_16550A;
+
   /* Drain the input buffer.  */
   endtime = grub_get_time_ms () + 1000;
   while (grub_inb (port->port + UART_LSR) & UART_DATA_READY)
@@ -152,37 +167,70 @@ serial_hw_fetch (struct grub_serial_port *port)
   return -1;
 }
 
-/* Put a character.  */
-static void
-serial_hw_put (struct grub_serial_port *port, const int c)
+/* Wait until the transmitter holding register (and FIFO) is empty.
+   Return 0 if the port seems to be stuck.  */
+static int
+serial_hw_wait_empty (struct grub_serial_port *port)
 {
   grub_uint64_t endtime;
 
-  do_real_config (port);
-
   if (port->broken > 5)
     endtime = grub_get_time_ms ();
   else if (port->broken > 1)
     endtime = grub_get_time_ms () + 50;
   else
     endtime = grub_get_time_ms () + 200;
-  /* Wait until the transmitter holding register is empty.  */
   while ((grub_inb (port->port + UART_LSR) & UART_EMPTY_TRANSMITTER) == 0)
     {
       if (grub_get_time_ms () > endtime)
 	{
 	  port->broken++;
 	  /* There is something wrong. But what can I do?  */
-	  return;
+	  return 0;
 	}
     }
 
   if (port->broken)
     port->broken--;
 
+  return 1;
+}
+
+/* Put a character.  */
+static void
+serial_hw_put (struct grub_serial_port *port, const int c)
+{
+  do_real_config (port);
+
+  if (!serial_hw_wait_empty (port))
+    return;
+
   grub_outb (c, port->port + UART_TX);
 }
 
+/* Put LEN characters, refilling the whole transmit FIFO each time it
+   drains instead of polling LSR before every byte.  */
+static void
+serial_hw_write (struct grub_serial_port *port, const char *buf,
+		 grub_size_t len)
+{
+  do_real_config (port);
+
+  while (len)
+    {
+      grub_size_t n = port->fifo_size;
+
+      if (!serial_hw_wait_empty (port))
+	return;
+
+      if (n > len)
+	n = len;
+      len -= n;
+      while (n--)
+	grub_outb (*buf++, port->port + UART_TX);
+    }
+}
+
 /* Initialize a serial device. PORT is the port number for a serial device.
    SPEED is a DTE-DTE speed which must be one of these: 2400, 4800, 9600,
    19200, 38400, 57600 and 115200. WORD_LEN is the word length to be used
@@ -228,7 +276,8 @@ struct grub_serial_driver grub_ns8250_driver =
   {
     .configure = serial_hw_configure,
     .fetch = serial_hw_fetch,
-    .put = serial_hw_put
+    .put = serial_hw_put,
+    .write = serial_hw_write
   };
 
 static char com_names[GRUB_SERIAL_PORT_NUM][20];
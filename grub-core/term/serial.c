@@ -86,10 +86,33 @@ serial_put (grub_term_output_t term, const int c)
   data->port->driver->put (data->port, c);
 }
 
+static void
+serial_write (grub_term_output_t term, const char *buf, grub_size_t len)
+{
+  struct grub_serial_output_state *data = term->data;
+  struct grub_serial_port *port = data->port;
+
+  if (port->driver->write)
+    port->driver->write (port, buf, len);
+  else
+    while (len--)
+      port->driver->put (port, *buf++);
+}
+
+static struct grub_term_output grub_serial_term_output;
+static struct grub_serial_output_state grub_serial_terminfo_output;
+
 static int
 serial_fetch (grub_term_input_t term)
 {
   struct grub_serial_input_state *data = term->data;
+
+  /* Whoever waits for input has to see the output first.  */
+  if (data->port->term_out)
+    grub_terminfo_refresh (data->port->term_out);
+  if (grub_serial_terminfo_output.port == data->port)
+    grub_terminfo_refresh (&grub_serial_term_output);
+
   return data->port->driver->fetch (data->port);
 }
 
@@ -106,14 +129,13 @@ static const struct grub_serial_output_state grub_serial_terminfo_output_templat
     .tinfo =
     {
       .put = serial_put,
+      .write = serial_write,
       .size = { 80, 24 }
     }
   };
 
 static struct grub_serial_input_state grub_serial_terminfo_input;
 
-static struct grub_serial_output_state grub_serial_terminfo_output;
-
 static int registered = 0;
 
 static struct grub_term_input grub_serial_term_input =
@@ -129,12 +151,14 @@ static struct grub_term_output grub_serial_term_output =
   .name = "serial",
   .init = grub_terminfo_output_init,
   .putchar = grub_terminfo_putchar,
+  .putchars = grub_terminfo_putchars,
   .getwh = grub_terminfo_getwh,
   .getxy = grub_terminfo_getxy,
   .gotoxy = grub_terminfo_gotoxy,
   .cls = grub_terminfo_cls,
   .setcolorstate = grub_terminfo_setcolorstate,
   .setcursor = grub_terminfo_setcursor,
+  .refresh = grub_terminfo_refresh,
   .flags = GRUB_TERM_CODE_TYPE_ASCII,
   .data = &grub_serial_terminfo_output,
   .progress_update_divisor = GRUB_PROGRESS_SLOW
@@ -369,6 +393,8 @@ grub_serial_register (struct grub_serial_port *port)
   out->data = outdata;
   out->name = in->name;
   grub_memcpy (outdata, &grub_serial_terminfo_output, sizeof (*outdata));
+  outdata->tinfo.outlen = 0;
+  outdata->tinfo.screen = 0;
 
   grub_list_push (GRUB_AS_LIST_P (&grub_serial_ports), GRUB_AS_LIST (port));
   ((struct grub_serial_input_state *) in->data)->port = port;
@@ -398,6 +424,11 @@ grub_serial_register (struct grub_serial_port *port)
 void
 grub_serial_unregister (struct grub_serial_port *port)
 {
+  if (port->term_out)
+    grub_terminfo_refresh (port->term_out);
+  if (grub_serial_terminfo_output.port == port)
+    grub_terminfo_refresh (&grub_serial_term_output);
+
   if (port->driver->fini)
     port->driver->fini (port);
   
@@ -118,6 +118,7 @@ static struct grub_term_output grub_spkmodem_term_output =
     .init = grub_spkmodem_init_output,
     .fini = grub_spkmodem_fini_output,
     .putchar = grub_terminfo_putchar,
+    .putchars = grub_terminfo_putchars,
     .getxy = grub_terminfo_getxy,
     .getwh = grub_terminfo_getwh,
     .gotoxy = grub_terminfo_gotoxy,
@@ -75,6 +75,9 @@ grub_terminfo_all_free (struct grub_term_output *term)
   grub_terminfo_free (&data->reverse_video_off);
   grub_terminfo_free (&data->cursor_on);
   grub_terminfo_free (&data->cursor_off);
+  grub_terminfo_free (&data->setcolor);
+  grub_free (data->screen);
+  data->screen = 0;
 }
 
 /* Set current terminfo type.  */
@@ -101,6 +104,7 @@ grub_terminfo_set_current (struct grub_term_output *term,
    *  d. Your idea here.
    */
 
+  grub_terminfo_refresh (term);
   grub_terminfo_all_free (term);
 
   if (grub_strcmp ("vt100", str) == 0)
@@ -220,14 +224,239 @@ grub_terminfo_output_unregister (struct grub_term_output *term)
   return grub_error (GRUB_ERR_BUG, "terminal not found");
 }
 
+static inline void
+put (struct grub_term_output *term, const int c)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  if (!data->write)
+    {
+      data->put (term, c);
+      return;
+    }
+
+  data->outbuf[data->outlen++] = c;
+  if (data->outlen == sizeof (data->outbuf) || c == '\n')
+    {
+      data->write (term, data->outbuf, data->outlen);
+      data->outlen = 0;
+    }
+}
+
 /* Wrapper for grub_putchar to write strings.  */
 static void
 putstr (struct grub_term_output *term, const char *str)
+{
+  while (*str)
+    put (term, *str++);
+}
+
+/* Color keys as stored in the screen model: 0 is the terminal default,
+   1..64 a setcolor foreground/background pair, then the two reverse
+   video states.  */
+#define COLOR_KEY_PAIR(fg, bg)	(1 + (fg) + 8 * (bg))
+#define COLOR_KEY_REVERSE_OFF	65
+#define COLOR_KEY_REVERSE_ON	66
+
+/* Going forward over at most this many known cells is cheaper than
+   a cursor addressing sequence.  */
+#define SCREEN_MAX_REWRITE 4
+
+static inline int
+screen_active (struct grub_terminfo_output_state *data)
+{
+  return (data->screen && data->screen_size.x == data->size.x
+	  && data->screen_size.y == data->size.y);
+}
+
+/* Forget the screen contents, reallocating the model if the size
+   changed.  Without memory we just send everything.  */
+static void
+screen_reset (struct grub_terminfo_output_state *data)
+{
+  if (!data->gotoxy)
+    return;
+
+  if (!screen_active (data))
+    {
+      grub_free (data->screen);
+      data->screen = grub_zalloc ((grub_size_t) data->size.x * data->size.y
+				  * sizeof (data->screen[0]));
+      if (!data->screen)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      data->screen_size = data->size;
+    }
+  else
+    grub_memset (data->screen, 0, (grub_size_t) data->size.x * data->size.y
+		 * sizeof (data->screen[0]));
+  data->hwpos_valid = 0;
+}
+
+/* The terminal scrolled up by one line.  */
+static void
+screen_scroll (struct grub_terminfo_output_state *data)
+{
+  grub_size_t w = data->size.x;
+
+  grub_memmove (data->screen, data->screen + w,
+		(data->size.y - 1) * w * sizeof (data->screen[0]));
+  grub_memset (data->screen + (data->size.y - 1) * w, 0,
+	       w * sizeof (data->screen[0]));
+}
+
+static void
+put_color (struct grub_term_output *term, int key)
 {
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
-  while (*str)
-    data->put (term, *str++);
+
+  if (key == COLOR_KEY_REVERSE_ON)
+    putstr (term, grub_terminfo_tparm (data->reverse_video_on));
+  else if (key == COLOR_KEY_REVERSE_OFF)
+    putstr (term, grub_terminfo_tparm (data->reverse_video_off));
+  else
+    putstr (term, grub_terminfo_tparm (data->setcolor, (key - 1) & 7,
+				       (key - 1) >> 3));
+  data->hwcolor = key;
+}
+
+static void
+screen_sync_color (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  if (data->color && data->color != data->hwcolor)
+    put_color (term, data->color);
+}
+
+/* Bring the terminal's cursor to where the caller thinks it is, in as
+   few bytes as we can.  */
+static void
+screen_sync_pos (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  struct grub_term_coordinate pos = data->pos;
+
+  if (data->hwpos_valid && data->hwpos.y == pos.y)
+    {
+      const grub_uint16_t *row = data->screen + pos.y * data->size.x;
+      unsigned x;
+
+      if (data->hwpos.x == pos.x)
+	return;
+
+      if (pos.x == 0)
+	{
+	  put (term, '\r');
+	  data->hwpos = pos;
+	  return;
+	}
+
+      if (pos.x + 1 == data->hwpos.x && data->hwpos.x < data->size.x)
+	{
+	  put (term, '\b');
+	  data->hwpos = pos;
+	  return;
+	}
+
+      /* Write the cells in between again if we know them and they
+	 are in the current color.  */
+      if (pos.x > data->hwpos.x && data->hwpos.x < data->size.x
+	  && pos.y < data->size.y
+	  && pos.x - data->hwpos.x <= SCREEN_MAX_REWRITE)
+	{
+	  for (x = data->hwpos.x; x < pos.x; x++)
+	    if (row[x] == 0 || (row[x] >> 8) != data->hwcolor)
+	      break;
+	  if (x == pos.x)
+	    {
+	      for (x = data->hwpos.x; x < pos.x; x++)
+		put (term, row[x] & 0xff);
+	      data->hwpos = pos;
+	      return;
+	    }
+	}
+    }
+
+  if (data->hwpos_valid && pos.x == 0 && pos.y == data->hwpos.y + 1
+      && pos.y < data->size.y)
+    {
+      put (term, '\r');
+      put (term, '\n');
+    }
+  else
+    putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
+  data->hwpos = pos;
+  data->hwpos_valid = 1;
+}
+
+/* Draw a printable ASCII character through the screen model.  Returns 0
+   if the character has to take the normal path.  */
+static int
+screen_putchar (struct grub_term_output *term, grub_uint8_t c)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  grub_uint16_t cell, *p;
+
+  if (data->pos.y >= data->size.y)
+    return 0;
+
+  /* Wrap.  Only the bottom line needs the terminal to do something.  */
+  if (data->pos.x >= data->size.x)
+    {
+      if (data->pos.y < data->size.y - 1)
+	{
+	  data->pos.x = 0;
+	  data->pos.y++;
+	}
+      else
+	{
+	  screen_sync_pos (term);
+	  put (term, '\r');
+	  put (term, '\n');
+	  screen_scroll (data);
+	  data->pos.x = 0;
+	  data->hwpos = data->pos;
+	}
+    }
+
+  cell = c | (data->color << 8);
+  p = &data->screen[data->pos.y * data->size.x + data->pos.x];
+  if (*p != cell)
+    {
+      screen_sync_pos (term);
+      screen_sync_color (term);
+      put (term, c);
+      *p = cell;
+      data->hwpos.x++;
+    }
+  data->pos.x++;
+  return 1;
+}
+
+/* Write out the buffered output, if any.  */
+void
+grub_terminfo_refresh (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  /* The cursor may be visible.  */
+  if (screen_active (data))
+    screen_sync_pos (term);
+
+  if (data->outlen)
+    {
+      data->write (term, data->outbuf, data->outlen);
+      data->outlen = 0;
+    }
 }
 
 struct grub_term_coordinate
@@ -252,12 +481,14 @@ grub_terminfo_gotoxy (struct grub_term_output *term,
       return;
     }
 
-  if (data->gotoxy)
+  if (screen_active (data))
+    ;
+  else if (data->gotoxy)
     putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
   else
     {
       if ((pos.y == data->pos.y) && (pos.x == data->pos.x - 1))
-	data->put (term, '\b');
+	put (term, '\b');
     }
 
   data->pos = pos;
@@ -270,7 +501,12 @@ grub_terminfo_cls (struct grub_term_output *term)
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  /* Terminals may clear with the current background.  */
+  if (screen_active (data))
+    screen_sync_color (term);
+
   putstr (term, grub_terminfo_tparm (data->cls));
+  screen_reset (data);
   grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0, 0 });
 }
 
@@ -280,6 +516,7 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
 {
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
+  int key;
 
   if (data->setcolor)
     {
@@ -312,23 +549,26 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
 	  return;
 	}
 
-      putstr (term, grub_terminfo_tparm (data->setcolor, colormap[fg & 7],
-					 colormap[bg & 7]));
-      return;
+      key = COLOR_KEY_PAIR (colormap[fg & 7], colormap[bg & 7]);
     }
+  else
+    switch (state)
+      {
+      case GRUB_TERM_COLOR_STANDARD:
+      case GRUB_TERM_COLOR_NORMAL:
+	key = COLOR_KEY_REVERSE_OFF;
+	break;
+      case GRUB_TERM_COLOR_HIGHLIGHT:
+	key = COLOR_KEY_REVERSE_ON;
+	break;
+      default:
+	return;
+      }
 
-  switch (state)
-    {
-    case GRUB_TERM_COLOR_STANDARD:
-    case GRUB_TERM_COLOR_NORMAL:
-      putstr (term, grub_terminfo_tparm (data->reverse_video_off));
-      break;
-    case GRUB_TERM_COLOR_HIGHLIGHT:
-      putstr (term, grub_terminfo_tparm (data->reverse_video_on));
-      break;
-    default:
-      break;
-    }
+  data->color = key;
+  /* With a screen model the color is sent along with the next text.  */
+  if (!screen_active (data))
+    put_color (term, key);
 }
 
 void
@@ -338,7 +578,11 @@ grub_terminfo_setcursor (struct grub_term_output *term, const int on)
     = (struct grub_terminfo_output_state *) term->data;
 
   if (on)
-    putstr (term, grub_terminfo_tparm (data->cursor_on));
+    {
+      if (screen_active (data))
+	screen_sync_pos (term);
+      putstr (term, grub_terminfo_tparm (data->cursor_on));
+    }
   else
     putstr (term, grub_terminfo_tparm (data->cursor_off));
 }
@@ -350,6 +594,46 @@ grub_terminfo_putchar (struct grub_term_output *term,
 {
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
+  int model = screen_active (data);
+
+  if (model)
+    {
+      if (c->base >= 0x20 && c->base < 0x7f && c->estimated_width == 1
+	  && screen_putchar (term, c->base))
+	return;
+
+      /* Cursor movements are only recorded.  */
+      switch (c->base)
+	{
+	case '\b':
+	case 127:
+	  if (data->pos.x > 0)
+	    data->pos.x--;
+	  return;
+
+	case '\r':
+	  data->pos.x = 0;
+	  return;
+
+	case '\n':
+	  if (data->pos.y < data->size.y - 1)
+	    {
+	      data->pos.y++;
+	      return;
+	    }
+	  /* Scroll.  */
+	  if (!data->hwpos_valid || data->hwpos.y != data->size.y - 1)
+	    putstr (term, grub_terminfo_tparm (data->gotoxy,
+					       data->size.y - 1, 0));
+	  put (term, '\n');
+	  screen_scroll (data);
+	  data->hwpos_valid = 0;
+	  return;
+	}
+
+      screen_sync_pos (term);
+      screen_sync_color (term);
+    }
 
   /* Keep track of the cursor.  */
   switch (c->base)
@@ -378,14 +662,58 @@ grub_terminfo_putchar (struct grub_term_output *term,
 	  data->pos.x = 0;
 	  if (data->pos.y < grub_term_height (term) - 1)
 	    data->pos.y++;
-	  data->put (term, '\r');
-	  data->put (term, '\n');
+	  else if (model)
+	    screen_scroll (data);
+	  put (term, '\r');
+	  put (term, '\n');
+	}
+      if (model && data->pos.y < data->size.y)
+	{
+	  unsigned x;
+
+	  for (x = data->pos.x; x < (unsigned) data->pos.x + c->estimated_width
+		 && x < data->size.x; x++)
+	    data->screen[data->pos.y * data->size.x + x] = 0;
 	}
       data->pos.x += c->estimated_width;
       break;
     }
 
-  data->put (term, c->base);
+  put (term, c->base);
+
+  /* We don't know how far anything else moves the cursor.  */
+  if (model)
+    data->hwpos_valid = 0;
+}
+
+void
+grub_terminfo_putchars (struct grub_term_output *term,
+			const struct grub_unicode_glyph *c, grub_size_t n)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  int width = grub_term_width (term);
+
+  if (screen_active (data))
+    {
+      for (; n; n--, c++)
+	grub_terminfo_putchar (term, c);
+      return;
+    }
+
+  for (; n; n--, c++)
+    {
+      /* Control characters and wrapping take the full path.  */
+      if (c->base < 0x20 || c->base == 127
+	  || (int) data->pos.x + c->estimated_width >= width + 1)
+	{
+	  grub_terminfo_putchar (term, c);
+	  continue;
+	}
+
+      data->pos.x += c->estimated_width;
+      put (term, c->base);
+    }
 }
 
 struct grub_term_coordinate
@@ -762,6 +1090,7 @@ grub_cmd_terminfo (grub_extcmd_context_t ctxt, int argc, char **args)
 	  {
 	    struct grub_terminfo_output_state *data
 	      = (struct grub_terminfo_output_state *) cur->data;
+	    grub_terminfo_refresh (cur);
 	    data->size.x = w;
 	    data->size.y = h;
 	  }
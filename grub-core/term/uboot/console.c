@@ -87,12 +87,14 @@ static struct grub_term_output uboot_console_term_output = {
   .name = "console",
   .init = uboot_console_init_output,
   .putchar = grub_terminfo_putchar,
+  .putchars = grub_terminfo_putchars,
   .getwh = grub_terminfo_getwh,
   .getxy = grub_terminfo_getxy,
   .gotoxy = grub_terminfo_gotoxy,
   .cls = grub_terminfo_cls,
   .setcolorstate = grub_terminfo_setcolorstate,
   .setcursor = uboot_console_setcursor,
+  .refresh = grub_terminfo_refresh,
   .flags = GRUB_TERM_CODE_TYPE_ASCII,
   .data = &uboot_console_terminfo_output,
   .progress_update_divisor = GRUB_PROGRESS_FAST
@@ -79,6 +79,13 @@ put (struct grub_term_output *term __attribute__ ((unused)), const int c)
 }
 
 
+static void
+console_refresh (struct grub_term_output *term)
+{
+  grub_terminfo_refresh (term);
+  refresh (term);
+}
+
 struct grub_terminfo_input_state grub_console_terminfo_input = {
   .readkey = readkey
 };
@@ -99,11 +106,12 @@ static struct grub_term_output grub_console_term_output = {
   .name = "console",
   .init = 0,
   .putchar = grub_terminfo_putchar,
+  .putchars = grub_terminfo_putchars,
   .getxy = grub_terminfo_getxy,
   .getwh = grub_terminfo_getwh,
   .gotoxy = grub_terminfo_gotoxy,
   .cls = grub_terminfo_cls,
-  .refresh = refresh,
+  .refresh = console_refresh,
   .setcolorstate = grub_terminfo_setcolorstate,
   .setcursor = grub_terminfo_setcursor,
   .flags = GRUB_TERM_CODE_TYPE_ASCII,
@@ -0,0 +1,138 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/net.h>
+#include <grub/net/netbuff.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* A protocol that queues its file one segment at a time from
+   packets_pulled, like the ranged segments of http and the pieces of
+   EFI HTTP do, without any card.  */
+
+#define SEGMENT_SIZE	16384
+#define SEGMENTS	8
+#define FILE_SIZE	(SEGMENT_SIZE * SEGMENTS)
+
+static grub_off_t queued;
+
+static grub_uint8_t
+pattern (grub_off_t off)
+{
+  return (grub_uint8_t) ((off * 7) % 251);
+}
+
+static grub_err_t
+queue_segment (grub_file_t file)
+{
+  grub_net_t net = file->device->net;
+  struct grub_net_buff *nb;
+  grub_size_t i;
+
+  if (queued == FILE_SIZE)
+    return GRUB_ERR_NONE;
+
+  nb = grub_netbuff_alloc (SEGMENT_SIZE);
+  if (!nb)
+    return grub_errno;
+  grub_netbuff_put (nb, SEGMENT_SIZE);
+  for (i = 0; i < SEGMENT_SIZE; i++)
+    nb->data[i] = pattern (queued + i);
+  if (grub_net_put_packet (&net->packs, nb))
+    {
+      grub_netbuff_free (nb);
+      return grub_errno;
+    }
+  queued += SEGMENT_SIZE;
+  if (queued == FILE_SIZE)
+    net->eof = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+segments_open (grub_file_t file, const char *filename __attribute__ ((unused)))
+{
+  queued = 0;
+  file->size = FILE_SIZE;
+  return queue_segment (file);
+}
+
+static grub_err_t
+segments_packets_pulled (grub_file_t file)
+{
+  if (file->device->net->packs.first)
+    return GRUB_ERR_NONE;
+  return queue_segment (file);
+}
+
+static grub_err_t
+segments_close (grub_file_t file __attribute__ ((unused)))
+{
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_app_protocol grub_segments_protocol =
+  {
+    .name = "netreadtest",
+    .open = segments_open,
+    .close = segments_close,
+    .packets_pulled = segments_packets_pulled
+  };
+
+/* One read of a file spanning several segments must return all of it.  */
+static void
+net_read_test (void)
+{
+  grub_file_t file;
+  grub_uint8_t *buf;
+  grub_ssize_t got;
+  grub_off_t i;
+
+  buf = grub_malloc (FILE_SIZE);
+  grub_test_assert (buf != NULL, "out of memory");
+  if (!buf)
+    return;
+
+  grub_net_app_level_register (&grub_segments_protocol);
+  file = grub_file_open ("(netreadtest,test)/file");
+  grub_test_assert (file != NULL, "couldn't open the test file");
+  if (file)
+    {
+      got = grub_file_read (file, buf, FILE_SIZE);
+      grub_test_assert (got == FILE_SIZE,
+			"read %" PRIdGRUB_SSIZE " bytes instead of %d",
+			got, FILE_SIZE);
+      for (i = 0; got == FILE_SIZE && i < FILE_SIZE; i++)
+	if (buf[i] != pattern (i))
+	  break;
+      grub_test_assert (got != FILE_SIZE || i == FILE_SIZE,
+			"wrong data at offset %" PRIuGRUB_UINT64_T,
+			(grub_uint64_t) i);
+      grub_file_close (file);
+    }
+  grub_net_app_level_unregister (&grub_segments_protocol);
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (buf);
+}
+
+GRUB_FUNCTIONAL_TEST (net_read_test, net_read_test);
@@ -406,12 +406,55 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   return GRUB_ERR_NONE;
 }
 
+/* Interpolate one destination line between source lines SLINE and
+   SLINE + SSTRIDE.  BYTES_PER_PIXEL is a constant at every call site, so
+   the component loops unroll.  */
+static inline void
+bilinear_line (grub_uint8_t *dptr, const grub_uint8_t *sline, int sstride,
+	       const unsigned *xoff, const grub_uint8_t *xu, unsigned dw,
+	       unsigned v, unsigned edge_x, int bytes_per_pixel)
+{
+  unsigned dx;
+  int comp;
+
+  for (dx = 0; dx < dw; dx++, dptr += bytes_per_pixel)
+    {
+      const grub_uint8_t *sptr = sline + xoff[dx];
+
+      if (dx < edge_x)
+	{
+	  /* Fixed-point .8 numbers representing the fraction of the
+	     distance in the x (u) and y (v) direction within the
+	     box of 4 pixels in the source. */
+	  unsigned u = xu[dx];
+
+	  for (comp = 0; comp < bytes_per_pixel; comp++)
+	    {
+	      unsigned top = sptr[comp] * (256 - u)
+		+ sptr[comp + bytes_per_pixel] * u;
+	      unsigned bottom = sptr[comp + sstride] * (256 - u)
+		+ sptr[comp + sstride + bytes_per_pixel] * u;
+
+	      dptr[comp] = (top * (256 - v) + bottom * v) >> 16;
+	    }
+	}
+      else
+	/* Fall back to nearest neighbor interpolation. */
+	for (comp = 0; comp < bytes_per_pixel; comp++)
+	  dptr[comp] = sptr[comp];
+    }
+}
+
 /* Bilinear interpolation image scaling algorithm.
 
    Copy the bitmap SRC to the bitmap DST, scaling the bitmap to fit the
    dimensions of DST.  This function uses the bilinear interpolation algorithm
    to interpolate the pixels.
 
+   The source column and weight of every destination column are the same on
+   each line, so they are worked out once up front, and each line is then
+   a straight run of multiply-adds.
+
    Supports only direct color modes which have components separated
    into bytes (e.g., RGBA 8:8:8:8 or BGR 8:8:8 true color).
    But because of this simplifying assumption, the implementation is
@@ -433,83 +476,70 @@ scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   int sstride = src->mode_info.pitch;
   /* bytes_per_pixel is the same for both src and dst. */
   int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
-  unsigned dy, syf, sy, ystep, yfrac, yover;
-  unsigned sxf, sx, xstep, xfrac, xover;
-  grub_uint8_t *dptr, *dline_end, *sline;
+  unsigned dy, dx, syf, sy, ystep, yfrac, yover;
+  unsigned sxf, xstep, xfrac, xover;
+  unsigned edge_x;
+  unsigned *xoff;
+  grub_uint8_t *xu;
+  grub_uint8_t *dptr, *sline;
+
+  xoff = grub_malloc (dw * (sizeof (*xoff) + sizeof (*xu)));
+  if (!xoff)
+    return grub_errno;
+  xu = (grub_uint8_t *) (xoff + dw);
 
   xstep = (sw << 8) / dw;
   xover = (sw << 8) % dw;
   ystep = (sh << 8) / dh;
   yover = (sh << 8) % dh;
 
+  /* Columns from EDGE_X on map to the last source column, which has no
+     right-hand neighbour to interpolate with.  */
+  edge_x = dw;
+  for (dx = 0, sxf = 0, xfrac = 0; dx < dw; dx++, sxf += xstep, xfrac += xover)
+    {
+      if (xfrac >= dw)
+	{
+	  xfrac -= dw;
+	  sxf++;
+	}
+      xoff[dx] = (sxf >> 8) * bytes_per_pixel;
+      xu[dx] = sxf & 0xff;
+      if ((sxf >> 8) >= sw - 1 && edge_x == dw)
+	edge_x = dx;
+    }
+
   for (dy = 0, syf = 0, yfrac = 0; dy < dh; dy++, syf += ystep, yfrac += yover)
     {
+      unsigned v, line_edge;
+
       if (yfrac >= dh)
 	{
 	  yfrac -= dh;
 	  syf++;
 	}
       sy = syf >> 8;
+      v = syf & 0xff;
       dptr = ddata + dy * dstride;
-      dline_end = dptr + dw * bytes_per_pixel;
       sline = sdata + sy * sstride;
-      for (sxf = 0, xfrac = 0; dptr < dline_end; sxf += xstep, xfrac += xover, dptr += bytes_per_pixel)
-        {
-          grub_uint8_t *sptr;
-          int comp;
+      /* The last source line has no line below it.  */
+      line_edge = (sy < sh - 1) ? edge_x : 0;
 
-	  if (xfrac >= dw)
-	    {
-	      xfrac -= dw;
-	      sxf++;
-	    }
-
-          /* Get the address of the pixels in src and dst. */
-	  sx = sxf >> 8;
-	  sptr = sline + sx * bytes_per_pixel;
-
-          /* If we have enough space to do so, use bilinear interpolation.
-             Otherwise, fall back to nearest neighbor for this pixel. */
-          if (sx < sw - 1 && sy < sh - 1)
-            {
-              /* Do bilinear interpolation. */
-
-              /* Fixed-point .8 numbers representing the fraction of the
-                 distance in the x (u) and y (v) direction within the
-                 box of 4 pixels in the source. */
-              unsigned u = sxf & 0xff;
-              unsigned v = syf & 0xff;
-
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                {
-                  /* Get the component's values for the
-                     four source corner pixels. */
-                  unsigned f00 = sptr[comp];
-                  unsigned f10 = sptr[comp + bytes_per_pixel];
-                  unsigned f01 = sptr[comp + sstride];
-                  unsigned f11 = sptr[comp + sstride + bytes_per_pixel];
-
-                  /* Count coeffecients. */
-                  unsigned c00 = (256 - u) * (256 - v);
-                  unsigned c10 = u * (256 - v);
-                  unsigned c01 = (256 - u) * v;
-                  unsigned c11 = u * v;
-
-                  /* Interpolate. */
-                  unsigned fxy = c00 * f00 + c01 * f01 + c10 * f10 + c11 * f11;
-                  fxy = fxy >> 16;
-
-                  dptr[comp] = fxy;
-                }
-            }
-          else
-            {
-              /* Fall back to nearest neighbor interpolation. */
-              /* Copy the pixel color value. */
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                dptr[comp] = sptr[comp];
-            }
-        }
+      switch (bytes_per_pixel)
+	{
+	case 4:
+	  bilinear_line (dptr, sline, sstride, xoff, xu, dw, v, line_edge, 4);
+	  break;
+	case 3:
+	  bilinear_line (dptr, sline, sstride, xoff, xu, dw, v, line_edge, 3);
+	  break;
+	default:
+	  bilinear_line (dptr, sline, sstride, xoff, xu, dw, v, line_edge,
+			 bytes_per_pixel);
+	  break;
+	}
     }
+
+  grub_free (xoff);
   return GRUB_ERR_NONE;
 }
@@ -23,6 +23,7 @@
 #include <grub/dl.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/time.h>
 #include <grub/video.h>
 #include <grub/video_fb.h>
 #include <grub/efi/api.h>
@@ -49,9 +50,13 @@ static struct
   struct grub_video_mode_info mode_info;
   struct grub_video_render_target *render_target;
   grub_uint8_t *ptr;
-  grub_uint8_t *offscreen;
+  /* Composing in a video_fb shadow buffer.  */
+  int shadow;
 } framebuffer;
 
+/* Number of lines drawn to time each way of flushing the shadow buffer.  */
+#define GOP_FLUSH_PROBE_LINES 64
+
 static int
 check_protocol_hook (const struct grub_video_mode_info *info __attribute__ ((unused)), void *hook_arg)
 {
@@ -107,8 +112,7 @@ grub_video_gop_fini (void)
       efi_call_2 (gop->set_mode, gop, old_mode);
       restore_needed = 0;
     }
-  grub_free (framebuffer.offscreen);
-  framebuffer.offscreen = 0;
+  framebuffer.shadow = 0;
   return grub_video_fb_fini ();
 }
 
@@ -347,6 +351,74 @@ grub_gop_get_preferred_mode (unsigned int *width, unsigned int *height)
   return GRUB_ERR_NONE;
 }
 
+static void
+grub_video_gop_blt_flush (void *data, int x, int y, int width, int height)
+{
+  efi_call_10 (gop->blt, gop, data, GRUB_EFI_BLT_BUFFER_TO_VIDEO,
+	       x, y, x, y, width, height, framebuffer.mode_info.pitch);
+}
+
+/* Time redrawing the top lines of the screen with the current flush
+   method.  */
+static grub_uint64_t
+grub_video_gop_time_flush (void)
+{
+  grub_uint64_t start;
+  unsigned int lines = grub_min (framebuffer.mode_info.height,
+				 GOP_FLUSH_PROBE_LINES);
+
+  start = grub_get_time_us ();
+  grub_video_fb_fill_rect (0, 0, 0, framebuffer.mode_info.width, lines);
+  grub_video_fb_swap_buffers ();
+  return grub_get_time_us () - start;
+}
+
+/* Compose in RAM and flush to the screen either with plain word stores
+   into the framebuffer or with Blt, whichever is faster here.  On many
+   machines the framebuffer is mapped uncached and Blt wins by far; on
+   others the firmware's Blt is the slow one.  */
+static grub_err_t
+grub_video_gop_setup_shadow (struct grub_efi_gop_mode_info *info)
+{
+  grub_err_t err;
+  int direct;
+
+  /* Writing the framebuffer directly needs its pixels in the shadow's
+     layout.  */
+  direct = gop->mode->fb_base && info->pixel_format == GRUB_EFI_GOT_BGRA8;
+  if (direct)
+    framebuffer.mode_info.pitch
+      = info->pixels_per_scanline * sizeof (struct grub_efi_gop_blt_pixel);
+
+  err = grub_video_fb_setup_shadow (&framebuffer.mode_info,
+				    direct ? framebuffer.ptr : NULL,
+				    direct ? NULL : grub_video_gop_blt_flush);
+  if (err)
+    return err;
+
+  if (direct)
+    {
+      grub_uint64_t direct_time, blt_time;
+
+      direct_time = grub_video_gop_time_flush ();
+      grub_video_fb_set_flush (grub_video_gop_blt_flush);
+      blt_time = grub_video_gop_time_flush ();
+      grub_dprintf ("video", "GOP: flush of %d lines: direct %llu us,"
+		    " Blt %llu us\n", GOP_FLUSH_PROBE_LINES,
+		    (unsigned long long) direct_time,
+		    (unsigned long long) blt_time);
+      /* Without a fine enough timer both read 0: keep Blt.  */
+      if (direct_time < blt_time)
+	grub_video_fb_set_flush (NULL);
+    }
+
+  /* Nothing of the old screen contents is in the shadow.  */
+  grub_video_fb_fill_rect (0, 0, 0, framebuffer.mode_info.width,
+			   framebuffer.mode_info.height);
+  framebuffer.shadow = 1;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_video_gop_setup (unsigned int width, unsigned int height,
 		      unsigned int mode_type,
@@ -360,7 +432,6 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
   int found = 0;
   unsigned long long best_volume = 0;
   unsigned int preferred_width = 0, preferred_height = 0;
-  grub_uint8_t *buffer;
 
   depth = (mode_type & GRUB_VIDEO_MODE_TYPE_DEPTH_MASK)
     >> GRUB_VIDEO_MODE_TYPE_DEPTH_POS;
@@ -475,43 +546,43 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
     }
 
   framebuffer.ptr = (void *) (grub_addr_t) gop->mode->fb_base;
-  framebuffer.offscreen
-    = grub_malloc (framebuffer.mode_info.height
-		   * framebuffer.mode_info.width 
-		   * sizeof (struct grub_efi_gop_blt_pixel));
-
-  buffer = framebuffer.offscreen;
-      
-  if (!buffer)
+  framebuffer.shadow = 0;
+  framebuffer.render_target = NULL;
+
+  err = grub_video_gop_setup_shadow (info);
+  if (err)
     {
       grub_dprintf ("video", "GOP: couldn't allocate shadow\n");
       grub_errno = 0;
       err = grub_video_gop_fill_mode_info (gop->mode->mode, info,
 					   &framebuffer.mode_info);
-      buffer = framebuffer.ptr;
-    }
-    
-  grub_dprintf ("video", "GOP: initialising FB @ %p %dx%dx%d\n",
-		framebuffer.ptr, framebuffer.mode_info.width,
-		framebuffer.mode_info.height, framebuffer.mode_info.bpp);
- 
-  err = grub_video_fb_create_render_target_from_pointer
-    (&framebuffer.render_target, &framebuffer.mode_info, buffer);
 
-  if (err)
-    {
-      grub_dprintf ("video", "GOP: Couldn't create FB target\n");
-      return err;
-    }
- 
-  err = grub_video_fb_set_active_render_target (framebuffer.render_target);
- 
-  if (err)
-    {
-      grub_dprintf ("video", "GOP: Couldn't set FB target\n");
-      return err;
+      grub_dprintf ("video", "GOP: initialising FB @ %p %dx%dx%d\n",
+		    framebuffer.ptr, framebuffer.mode_info.width,
+		    framebuffer.mode_info.height, framebuffer.mode_info.bpp);
+
+      err = grub_video_fb_create_render_target_from_pointer
+	(&framebuffer.render_target, &framebuffer.mode_info, framebuffer.ptr);
+
+      if (err)
+	{
+	  grub_dprintf ("video", "GOP: Couldn't create FB target\n");
+	  return err;
+	}
+
+      err = grub_video_fb_set_active_render_target (framebuffer.render_target);
+
+      if (err)
+	{
+	  grub_dprintf ("video", "GOP: Couldn't set FB target\n");
+	  return err;
+	}
     }
- 
+  else
+    grub_dprintf ("video", "GOP: initialising shadow FB %dx%dx%d\n",
+		  framebuffer.mode_info.width,
+		  framebuffer.mode_info.height, framebuffer.mode_info.bpp);
+
   err = grub_video_fb_set_palette (0, GRUB_VIDEO_FBSTD_NUMCOLORS,
 				   grub_video_fbstd_colors);
 
@@ -526,20 +597,15 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 static grub_err_t
 grub_video_gop_swap_buffers (void)
 {
-  if (framebuffer.offscreen)
-    {
-      efi_call_10 (gop->blt, gop, framebuffer.offscreen,
-		   GRUB_EFI_BLT_BUFFER_TO_VIDEO, 0, 0, 0, 0,
-		   framebuffer.mode_info.width, framebuffer.mode_info.height,
-		   framebuffer.mode_info.width * 4);
-    }
+  if (framebuffer.shadow)
+    return grub_video_fb_swap_buffers ();
   return GRUB_ERR_NONE;
 }
 
 static grub_err_t
 grub_video_gop_set_active_render_target (struct grub_video_render_target *target)
 {
-  if (target == GRUB_VIDEO_RENDER_TARGET_DISPLAY)
+  if (target == GRUB_VIDEO_RENDER_TARGET_DISPLAY && !framebuffer.shadow)
     target = framebuffer.render_target;
 
   return grub_video_fb_set_active_render_target (target);
@@ -562,9 +628,7 @@ grub_video_gop_get_info_and_fini (struct grub_video_mode_info *mode_info,
   *framebuf = (char *) framebuffer.ptr;
 
   grub_video_fb_fini ();
-
-  grub_free (framebuffer.offscreen);
-  framebuffer.offscreen = 0;
+  framebuffer.shadow = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1159,6 +1159,25 @@ alpha_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t alpha)
   return h;
 }
 
+/* Blend all four bytes of FG over BG at once, two channels per
+   multiplication.  Each 16-bit lane holds at most 255 * 255, so nothing
+   carries into its neighbour, and (s + (s >> 8) + 1) >> 8 gives the same
+   result as alpha_dilute for every input.  GRUB is built without SSE or
+   NEON, so this is as wide as the blending loops can get.  */
+static inline grub_uint32_t
+alpha_dilute_32 (grub_uint32_t bg, grub_uint32_t fg, unsigned int alpha)
+{
+  grub_uint32_t rb, ga;
+
+  rb = (fg & 0x00ff00ff) * alpha + (bg & 0x00ff00ff) * (255 ^ alpha);
+  rb = ((rb + ((rb >> 8) & 0x00ff00ff) + 0x00010001) >> 8) & 0x00ff00ff;
+  ga = ((fg >> 8) & 0x00ff00ff) * alpha
+    + ((bg >> 8) & 0x00ff00ff) * (255 ^ alpha);
+  ga = (ga + ((ga >> 8) & 0x00ff00ff) + 0x00010001) & 0xff00ff00;
+
+  return rb | ga;
+}
+
 /* Generic blending blitter.  Works for every supported format.  */
 static void
 grub_video_fbblit_blend (struct grub_video_fbblit_info *dst,
@@ -1245,13 +1264,7 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
       for (i = 0; i < width; i++)
         {
           grub_uint32_t color;
-          unsigned int sr;
-          unsigned int sg;
-          unsigned int sb;
           unsigned int a;
-          unsigned int dr;
-          unsigned int dg;
-          unsigned int db;
 
           color = *srcptr++;
 
@@ -1264,31 +1277,14 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
+          /* Swap red and blue into the destination order.  */
+          color = (color & 0xFF00FF00) | ((color >> 16) & 0xFF)
+            | ((color & 0xFF) << 16);
 
-          if (a == 255)
-            {
-              /* Opaque pixel shortcut.  */
-              dr = sr;
-              dg = sg;
-              db = sb;
-            }
-          else
-            {
-              /* General pixel color blending.  */
-              color = *dstptr;
-
-              dr = (color >> 16) & 0xFF;
-              dr = alpha_dilute (dr, sr, a);
-              dg = (color >> 8) & 0xFF;
-              dg = alpha_dilute (dg, sg, a);
-              db = (color >> 0) & 0xFF;
-              db = alpha_dilute (db, sb, a);
-            }
-
-          color = (a << 24) | (dr << 16) | (dg << 8) | db;
+          if (a != 255)
+            /* General pixel color blending.  */
+            color = (alpha_dilute_32 (*dstptr, color, a) & 0x00FFFFFF)
+              | (a << 24);
 
           *dstptr++ = color;
         }
@@ -1405,13 +1401,7 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
   int j;
   grub_uint32_t *srcptr;
   grub_uint32_t *dstptr;
-  unsigned int sr;
-  unsigned int sg;
-  unsigned int sb;
   unsigned int a;
-  unsigned int dr;
-  unsigned int dg;
-  unsigned int db;
   grub_size_t srcrowskip;
   grub_size_t dstrowskip;
 
@@ -1441,21 +1431,8 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          color = *dstptr;
-
-          dr = (color >> 0) & 0xFF;
-          dg = (color >> 8) & 0xFF;
-          db = (color >> 16) & 0xFF;
-
-          dr = alpha_dilute (dr, sr, a);
-          dg = alpha_dilute (dg, sg, a);
-          db = alpha_dilute (db, sb, a);
-
-          color = (a << 24) | (db << 16) | (dg << 8) | dr;
+          color = (alpha_dilute_32 (*dstptr, color, a) & 0x00FFFFFF)
+            | (a << 24);
 
           *dstptr++ = color;
         }
@@ -31,10 +31,23 @@ GRUB_MOD_LICENSE ("GPLv3+");
 typedef grub_err_t (*grub_video_fb_doublebuf_update_screen_t) (void);
 typedef volatile void *framebuf_t;
 
+/* Damaged areas of the back buffer, as a few rectangles rather than one
+   band of lines, so that two small updates at opposite corners of the
+   screen don't turn into a copy of nearly the whole framebuffer.  When the
+   set is full the new rectangle is merged into whichever existing one
+   grows the least.  */
+#define DIRTY_RECTS 8
+
+struct dirty_rect
+{
+  int x1, y1;
+  int x2, y2;
+};
+
 struct dirty
 {
-  int first_line;
-  int last_line;
+  unsigned int count;
+  struct dirty_rect rects[DIRTY_RECTS];
 };
 
 static struct
@@ -55,6 +68,10 @@ static struct
   grub_video_fb_set_page_t set_page;
   char *offscreen_buffer;
   grub_video_fb_doublebuf_update_screen_t update_screen;
+
+  /* For shadow buffers flushed by the driver; see
+     grub_video_fb_setup_shadow.  */
+  grub_video_fb_flush_t flush;
 } framebuffer;
 
 /* Specify "standard" VGA palette, some video cards may
@@ -351,6 +368,7 @@ grub_video_fb_fini (void)
   framebuffer.palette_size = 0;
   framebuffer.set_page = 0;
   framebuffer.offscreen_buffer = 0;
+  framebuffer.flush = 0;
   return GRUB_ERR_NONE;
 }
 
@@ -829,15 +847,141 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
     }
 }
 
+static long
+dirty_area (int x1, int y1, int x2, int y2)
+{
+  return (long) (x2 - x1) * (y2 - y1);
+}
+
 static void
-dirty (int y, int height)
+dirty_add (struct dirty *d, int x1, int y1, int x2, int y2)
+{
+  unsigned int i;
+
+  if (x1 >= x2 || y1 >= y2)
+    return;
+
+ again:
+  /* Absorb everything the new rectangle overlaps or touches.  */
+  for (i = 0; i < d->count; i++)
+    {
+      struct dirty_rect *r = &d->rects[i];
+
+      if (r->x1 <= x2 && x1 <= r->x2 && r->y1 <= y2 && y1 <= r->y2)
+	{
+	  x1 = grub_min (x1, r->x1);
+	  y1 = grub_min (y1, r->y1);
+	  x2 = grub_max (x2, r->x2);
+	  y2 = grub_max (y2, r->y2);
+	  *r = d->rects[--d->count];
+	  goto again;
+	}
+    }
+
+  if (d->count == DIRTY_RECTS)
+    {
+      unsigned int best = 0;
+      long best_cost = 0;
+
+      for (i = 0; i < d->count; i++)
+	{
+	  struct dirty_rect *r = &d->rects[i];
+	  long cost = dirty_area (grub_min (x1, r->x1), grub_min (y1, r->y1),
+				  grub_max (x2, r->x2), grub_max (y2, r->y2))
+	    - dirty_area (r->x1, r->y1, r->x2, r->y2);
+
+	  if (i == 0 || cost < best_cost)
+	    {
+	      best = i;
+	      best_cost = cost;
+	    }
+	}
+      x1 = grub_min (x1, d->rects[best].x1);
+      y1 = grub_min (y1, d->rects[best].y1);
+      x2 = grub_max (x2, d->rects[best].x2);
+      y2 = grub_max (y2, d->rects[best].y2);
+      d->rects[best] = d->rects[--d->count];
+      /* The union may now touch others.  */
+      goto again;
+    }
+
+  d->rects[d->count].x1 = x1;
+  d->rects[d->count].y1 = y1;
+  d->rects[d->count].x2 = x2;
+  d->rects[d->count].y2 = y2;
+  d->count++;
+}
+
+static void
+dirty (int x, int y, int width, int height)
 {
   if (framebuffer.render_target != framebuffer.back_target)
     return;
-  if (framebuffer.current_dirty.first_line > y)
-    framebuffer.current_dirty.first_line = y;
-  if (framebuffer.current_dirty.last_line < y + height)
-    framebuffer.current_dirty.last_line = y + height;
+  dirty_add (&framebuffer.current_dirty, x, y, x + width, y + height);
+}
+
+/* Copy LEN bytes to video memory a word at a time.  grub_memcpy goes
+   byte by byte, which is at its slowest on uncached framebuffers.  */
+static void
+fb_copy (volatile void *dst, const void *src, grub_size_t len)
+{
+  volatile grub_uint8_t *d = dst;
+  const grub_uint8_t *s = src;
+
+  while (len && ((grub_addr_t) d & (sizeof (grub_addr_t) - 1)))
+    {
+      *d++ = *s++;
+      len--;
+    }
+  if (((grub_addr_t) s & (sizeof (grub_addr_t) - 1)) == 0)
+    for (; len >= sizeof (grub_addr_t);
+	 len -= sizeof (grub_addr_t), d += sizeof (grub_addr_t),
+	   s += sizeof (grub_addr_t))
+      *(volatile grub_addr_t *) d = *(const grub_addr_t *) s;
+  while (len--)
+    *d++ = *s++;
+}
+
+/* Copy the damaged areas of the back buffer to DST, or hand them to the
+   driver's flush function if it has one.  */
+static void
+dirty_copy (const struct dirty *d, framebuf_t dst)
+{
+  struct grub_video_mode_info *mode_info = &framebuffer.back_target->mode_info;
+  unsigned int i;
+
+  for (i = 0; i < d->count; i++)
+    {
+      const struct dirty_rect *r = &d->rects[i];
+      grub_size_t offset, len;
+      int y;
+
+      if (framebuffer.flush)
+	{
+	  framebuffer.flush (framebuffer.back_target->data, r->x1, r->y1,
+			     r->x2 - r->x1, r->y2 - r->y1);
+	  continue;
+	}
+
+      /* Sub-byte pixels or full-width rectangles: copy whole lines in one
+	 go.  */
+      if (mode_info->bpp < 8
+	  || (r->x1 == 0 && r->x2 == (int) mode_info->width))
+	{
+	  fb_copy ((char *) dst + r->y1 * mode_info->pitch,
+		   (char *) framebuffer.back_target->data
+		   + r->y1 * mode_info->pitch,
+		   mode_info->pitch * (r->y2 - r->y1));
+	  continue;
+	}
+
+      offset = r->y1 * mode_info->pitch
+	+ r->x1 * mode_info->bytes_per_pixel;
+      len = (r->x2 - r->x1) * mode_info->bytes_per_pixel;
+      for (y = r->y1; y < r->y2; y++, offset += mode_info->pitch)
+	fb_copy ((char *) dst + offset,
+		 (char *) framebuffer.back_target->data + offset, len);
+    }
 }
 
 grub_err_t
@@ -895,7 +1039,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
   x += area_x;
   y += area_y;
 
-  dirty (y, height);
+  dirty (x, y, width, height);
 
   /* Use fbblit_info to encapsulate rendering.  */
   target.mode_info = &framebuffer.render_target->mode_info;
@@ -1008,7 +1152,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   target.data = framebuffer.render_target->data;
 
   /* Do actual blitting.  */
-  dirty (y, height);
+  dirty (x, y, width, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
 
@@ -1060,7 +1204,9 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
   width = framebuffer.render_target->viewport.width - grub_abs (dx);
   height = framebuffer.render_target->viewport.height - grub_abs (dy);
 
-  dirty (framebuffer.render_target->viewport.y,
+  dirty (framebuffer.render_target->viewport.x,
+	 framebuffer.render_target->viewport.y,
+	 framebuffer.render_target->viewport.width,
 	 framebuffer.render_target->viewport.height);
 
   if (dx < 0)
@@ -1137,6 +1283,31 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
 	    }                                                        \
 	}
 
+      /* When moving upwards, rows spanning the whole pitch are one
+	 contiguous run; move it as a single line.  */
+      if (linedelta == 0 && dy < 0)
+	{
+	  linelen *= height;
+	  height = 1;
+	}
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+      /* Scrolling a console moves nearly the whole screen; on 64-bit
+	 targets use 64-bit words when everything lines up.  */
+      if ((grub_addr_t) grub_video_fb_get_video_ptr (&target, src_x, src_y)
+	  % sizeof (grub_uint64_t) == 0
+	  && (grub_addr_t) grub_video_fb_get_video_ptr (&target, dst_x, dst_y)
+	  % sizeof (grub_uint64_t) == 0
+	  && linelen % sizeof (grub_uint64_t) == 0
+	  && linedelta % sizeof (grub_uint64_t) == 0)
+	{
+	  grub_uint64_t *src, *dst;
+	  linelen /= sizeof (grub_uint64_t);
+	  linedelta /= sizeof (grub_uint64_t);
+	  DO_SCROLL
+	}
+      else
+#endif
       /* If everything is aligned on 32-bit use 32-bit copy.  */
       if ((grub_addr_t) grub_video_fb_get_video_ptr (&target, src_x, src_y)
 	  % sizeof (grub_uint32_t) == 0
@@ -1415,20 +1586,8 @@ grub_video_fb_get_active_render_target (struct grub_video_fbrender_target **targ
 static grub_err_t
 doublebuf_blit_update_screen (void)
 {
-  if (framebuffer.current_dirty.first_line
-      <= framebuffer.current_dirty.last_line)
-    grub_memcpy ((char *) framebuffer.pages[0]
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (framebuffer.current_dirty.last_line
-		    - framebuffer.current_dirty.first_line));
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  dirty_copy (&framebuffer.current_dirty, framebuffer.pages[0]);
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1461,8 +1620,7 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
   framebuffer.pages[0] = framebuf;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
-  framebuffer.current_dirty.first_line = mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1472,26 +1630,21 @@ doublebuf_pageflipping_update_screen (void)
 {
   int new_displayed_page;
   grub_err_t err;
-  int first_line, last_line;
-
-  first_line = framebuffer.current_dirty.first_line;
-  last_line = framebuffer.current_dirty.last_line;
-  if (first_line > framebuffer.previous_dirty.first_line)
-    first_line = framebuffer.previous_dirty.first_line;
-  if (last_line < framebuffer.previous_dirty.last_line)
-    last_line = framebuffer.previous_dirty.last_line;
-
-  if (first_line <= last_line)
-    grub_memcpy ((char *) framebuffer.pages[framebuffer.render_page]
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (last_line - first_line));
+  struct dirty both;
+  unsigned int i;
+
+  /* The page being rendered to missed the previous frame's updates too.  */
+  both = framebuffer.current_dirty;
+  for (i = 0; i < framebuffer.previous_dirty.count; i++)
+    dirty_add (&both,
+	       framebuffer.previous_dirty.rects[i].x1,
+	       framebuffer.previous_dirty.rects[i].y1,
+	       framebuffer.previous_dirty.rects[i].x2,
+	       framebuffer.previous_dirty.rects[i].y2);
+
+  dirty_copy (&both, framebuffer.pages[framebuffer.render_page]);
   framebuffer.previous_dirty = framebuffer.current_dirty;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   /* Swap the page numbers in the framebuffer struct.  */
   new_displayed_page = framebuffer.render_page;
@@ -1544,12 +1697,8 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
   framebuffer.pages[0] = page0_ptr;
   framebuffer.pages[1] = page1_ptr;
 
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-  framebuffer.previous_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.previous_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
+  framebuffer.previous_dirty.count = 0;
 
   /* Set the framebuffer memory data pointer and display the right page.  */
   err = set_page_in (framebuffer.displayed_page);
@@ -1563,6 +1712,39 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
   return GRUB_ERR_NONE;
 }
 
+/* Compose in a shadow buffer in RAM and, on every swap, copy the damaged
+   areas to FRAMEBUF, or pass them to FLUSH instead if it is not NULL.  For
+   drivers whose framebuffer is slow to write or has to be updated through
+   the firmware.  */
+grub_err_t
+grub_video_fb_setup_shadow (struct grub_video_mode_info *mode_info,
+			    volatile void *framebuf,
+			    grub_video_fb_flush_t flush)
+{
+  grub_err_t err;
+
+  err = grub_video_fb_doublebuf_blit_init (&framebuffer.back_target,
+					   *mode_info, (void *) framebuf);
+  if (err)
+    return err;
+
+  mode_info->mode_type |= (GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED
+			   | GRUB_VIDEO_MODE_TYPE_UPDATING_SWAP);
+  framebuffer.flush = flush;
+  framebuffer.set_page = 0;
+  framebuffer.render_target = framebuffer.back_target;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Switch the flush function of a shadow buffer set up with
+   grub_video_fb_setup_shadow.  */
+void
+grub_video_fb_set_flush (grub_video_fb_flush_t flush)
+{
+  framebuffer.flush = flush;
+}
+
 /* Select the best double buffering mode available.  */
 grub_err_t
 grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
@@ -1631,13 +1813,12 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
     return err;
 
   framebuffer.update_screen = 0;
+  framebuffer.flush = 0;
   framebuffer.pages[0] = page0_ptr;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
   framebuffer.set_page = 0;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   mode_info->mode_type &= ~GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
 
@@ -51,6 +51,22 @@ static struct
 static grub_uint32_t initial_vbe_mode;
 static grub_uint16_t *vbe_mode_list;
 
+/* The information blocks of the modes asked about so far.  Each one is a
+   call to the BIOS in real mode, and every mode switch and every listing
+   of the modes walks all of them.  */
+struct mode_info_cache
+{
+  grub_uint16_t mode;
+  struct grub_vbe_mode_info_block info;
+};
+static struct mode_info_cache *mode_infos;
+static grub_size_t mode_infos_count, mode_infos_allocated;
+
+/* Preferred resolution of the display: reading the EDID over DDC is slow.
+   0 while not known yet, -1 if there is none.  */
+static int preferred_known;
+static unsigned int preferred_width, preferred_height;
+
 static void *
 real2pm (grub_vbe_farptr_t ptr)
 {
@@ -565,7 +581,7 @@ grub_video_vbe_get_edid (struct grub_video_edid_info *edid_info)
 }
 
 static grub_err_t
-grub_vbe_get_preferred_mode (unsigned int *width, unsigned int *height)
+grub_vbe_get_preferred_mode_real (unsigned int *width, unsigned int *height)
 {
   grub_vbe_status_t status;
   grub_uint8_t ddc_level;
@@ -604,6 +620,29 @@ grub_vbe_get_preferred_mode (unsigned int *width, unsigned int *height)
   return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "cannot get preferred mode");
 }
 
+static grub_err_t
+grub_vbe_get_preferred_mode (unsigned int *width, unsigned int *height)
+{
+  if (!preferred_known)
+    {
+      if (grub_vbe_get_preferred_mode_real (&preferred_width,
+					    &preferred_height)
+	  == GRUB_ERR_NONE)
+	preferred_known = 1;
+      else
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  preferred_known = -1;
+	}
+    }
+
+  if (preferred_known < 0)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "cannot get preferred mode");
+  *width = preferred_width;
+  *height = preferred_height;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_vbe_set_video_mode (grub_uint32_t vbe_mode,
 			 struct grub_vbe_mode_info_block *vbe_mode_info)
@@ -742,6 +781,15 @@ grub_vbe_get_video_mode_info (grub_uint32_t mode,
   /* If mode is not VESA mode, skip mode info query.  */
   if (mode >= 0x100)
     {
+      grub_size_t i;
+
+      for (i = 0; i < mode_infos_count; i++)
+	if (mode_infos[i].mode == mode)
+	  {
+	    grub_memcpy (mode_info, &mode_infos[i].info, sizeof (*mode_info));
+	    return GRUB_ERR_NONE;
+	  }
+
       /* Try to get mode info from VESA BIOS.  */
       status = grub_vbe_bios_get_mode_info (mode, mi_tmp);
       if (status != GRUB_VBE_STATUS_OK)
@@ -750,6 +798,26 @@ grub_vbe_get_video_mode_info (grub_uint32_t mode,
 
       /* Make copy of mode info block.  */
       grub_memcpy (mode_info, mi_tmp, sizeof (*mode_info));
+
+      if (mode_infos_count == mode_infos_allocated)
+	{
+	  struct mode_info_cache *n;
+	  grub_size_t count = mode_infos_allocated ? 2 * mode_infos_allocated
+	    : 64;
+
+	  n = grub_realloc (mode_infos, count * sizeof (n[0]));
+	  if (!n)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      return GRUB_ERR_NONE;
+	    }
+	  mode_infos = n;
+	  mode_infos_allocated = count;
+	}
+      mode_infos[mode_infos_count].mode = mode;
+      grub_memcpy (&mode_infos[mode_infos_count].info, mi_tmp,
+		   sizeof (*mode_info));
+      mode_infos_count++;
     }
   else
     /* Just clear mode info block if it isn't a VESA mode.  */
@@ -1247,4 +1315,7 @@ GRUB_MOD_INIT(video_i386_pc_vbe)
 GRUB_MOD_FINI(video_i386_pc_vbe)
 {
   grub_video_unregister (&grub_video_vbe_adapter);
+  grub_free (mode_infos);
+  mode_infos = NULL;
+  mode_infos_count = mode_infos_allocated = 0;
 }
@@ -36,6 +36,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 enum
   {
     JPEG_MARKER_SOF0 = 0xc0,
+    JPEG_MARKER_SOF1 = 0xc1,
+    JPEG_MARKER_SOF2 = 0xc2,
     JPEG_MARKER_DHT  = 0xc4,
     JPEG_MARKER_SOI  = 0xd8,
     JPEG_MARKER_EOI  = 0xd9,
@@ -55,8 +57,19 @@ enum
 #define SHIFT_BITS		8
 #define CONST(x)		((int) ((x) * (1L << SHIFT_BITS) + 0.5))
 
+/* Extra fraction bits the AAN IDCT keeps between its two passes.  */
+#define IDCT_PASS1_BITS		2
+#define IDCT_MULTIPLY(v, c)	(((v) * CONST (c)) >> SHIFT_BITS)
+
+/* Color conversion tables are more precise than the IDCT constants.  */
+#define COLOR_SHIFT_BITS	16
+#define COLOR_CONST(x)		((int) ((x) * (1L << COLOR_SHIFT_BITS) + 0.5))
+
 #define JPEG_UNIT_SIZE		8
 
+/* Huffman codes up to this long are decoded with a single table lookup.  */
+#define JPEG_HUFF_LOOKUP_BITS	9
+
 static const grub_uint8_t jpeg_zigzag_order[64] = {
   0, 1, 8, 16, 9, 2, 3, 10,
   17, 24, 32, 25, 18, 11, 4, 5,
@@ -68,11 +81,32 @@ static const grub_uint8_t jpeg_zigzag_order[64] = {
   53, 60, 61, 54, 47, 55, 62, 63
 };
 
+/* Row and column scale factors of the AAN IDCT, folded into the
+   dequantization tables: 16384 * s[i] * s[j], where s[0] = 1 and
+   s[k] = cos (k * PI / 16) * sqrt (2).  Natural order.  */
+static const grub_uint16_t jpeg_aan_scales[64] = {
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+  21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906,
+  19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+   8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,
+   4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+};
+
+/* YCbCr to RGB contributions of each chroma value, set up at init.  */
+static int jpeg_cr_r[256];
+static int jpeg_cb_b[256];
+static int jpeg_cr_g[256];
+static int jpeg_cb_g[256];
+
 #ifdef JPEG_DEBUG
 static grub_command_t cmd;
 #endif
 
 typedef int jpeg_data_unit_t[64];
+typedef grub_uint8_t jpeg_sample_unit_t[64];
 
 struct grub_jpeg_data
 {
@@ -80,40 +114,66 @@ struct grub_jpeg_data
   struct grub_video_bitmap **bitmap;
   grub_uint8_t *bitmap_ptr;
 
+  /* The whole file is read at once and parsed from memory.  */
+  grub_uint8_t *image;
+  grub_size_t image_size;
+  grub_size_t pos;
+
   unsigned image_width;
   unsigned image_height;
 
-  grub_uint8_t *huff_value[4];
-  int huff_offset[4][16];
-  int huff_maxval[4][16];
+  grub_uint8_t *huff_value[8];
+  int huff_offset[8][16];
+  int huff_maxval[8][16];
+  /* (length << 8) | value, indexed by the next JPEG_HUFF_LOOKUP_BITS
+     bits; 0 if the code is longer.  */
+  grub_uint16_t huff_lookup[8][1 << JPEG_HUFF_LOOKUP_BITS];
 
-  grub_uint8_t quan_table[2][64];
+  /* Zigzag order, pre-scaled for the AAN IDCT.  */
+  int quan_table[4][64];
   int comp_index[3][3];
 
-  jpeg_data_unit_t ydu[4];
-  jpeg_data_unit_t crdu;
-  jpeg_data_unit_t cbdu;
+  jpeg_sample_unit_t ydu[4];
+  jpeg_sample_unit_t crdu;
+  jpeg_sample_unit_t cbdu;
 
   unsigned log_vs, log_hs;
+  unsigned mcu_rows, mcu_cols;
   int dri;
-  unsigned r1;
 
   int dc_value[3];
 
   int color_components;
-
-  int bit_mask, bit_save;
+  int progressive;
+
+  /* Parameters of the current scan.  */
+  int scan_components;
+  int scan_comp[3];
+  unsigned ss, se, ah, al;
+  unsigned eobrun;
+
+  /* Quantized coefficients of the whole image in zigzag order.  Only
+     used when scans don't carry complete interleaved MCUs, i.e. for
+     progressive and non-interleaved images.  */
+  grub_int16_t *coefs[3];
+  unsigned coef_stride[3];
+
+  grub_uint32_t bit_buf;
+  int bit_count;
+  /* Marker that ended the entropy coded data, if already read.  */
+  grub_uint8_t marker;
 };
 
 static grub_uint8_t
 grub_jpeg_get_byte (struct grub_jpeg_data *data)
 {
-  grub_uint8_t r;
-
-  r = 0;
-  grub_file_read (data->file, &r, 1);
+  if (data->pos >= data->image_size)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: premature end of file");
+      return 0;
+    }
 
-  return r;
+  return data->image[data->pos++];
 }
 
 static grub_uint16_t
@@ -121,49 +181,85 @@ grub_jpeg_get_word (struct grub_jpeg_data *data)
 {
   grub_uint16_t r;
 
-  r = 0;
-  grub_file_read (data->file, &r, sizeof (grub_uint16_t));
+  r = grub_jpeg_get_byte (data) << 8;
+  r |= grub_jpeg_get_byte (data);
 
-  return grub_be_to_cpu16 (r);
+  return r;
 }
 
-static int
-grub_jpeg_get_bit (struct grub_jpeg_data *data)
+static grub_err_t
+grub_jpeg_get_bytes (struct grub_jpeg_data *data, void *buf, grub_size_t len)
 {
-  int ret;
+  if (data->image_size - data->pos < len)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: premature end of file");
 
-  if (data->bit_mask == 0)
+  grub_memcpy (buf, data->image + data->pos, len);
+  data->pos += len;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Top up the bit buffer to more than 24 bits.  Stuffed zero bytes are
+   dropped; a marker ends the entropy coded data and is remembered,
+   after which zero bits are supplied.  */
+static void
+grub_jpeg_fill_bits (struct grub_jpeg_data *data)
+{
+  while (data->bit_count <= 24)
     {
-      data->bit_save = grub_jpeg_get_byte (data);
-      if (data->bit_save == JPEG_ESC_CHAR)
+      grub_uint32_t b = 0;
+
+      if (!data->marker && data->pos < data->image_size)
 	{
-	  if (grub_jpeg_get_byte (data) != 0)
+	  b = data->image[data->pos++];
+	  if (b == JPEG_ESC_CHAR)
 	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "jpeg: invalid 0xFF in data stream");
-	      return 0;
+	      while (data->pos < data->image_size
+		     && data->image[data->pos] == JPEG_ESC_CHAR)
+		data->pos++;
+
+	      if (data->pos < data->image_size && data->image[data->pos] == 0)
+		data->pos++;
+	      else
+		{
+		  if (data->pos < data->image_size)
+		    data->marker = data->image[data->pos++];
+		  b = 0;
+		}
 	    }
 	}
-      data->bit_mask = 0x80;
+
+      data->bit_buf = (data->bit_buf << 8) | b;
+      data->bit_count += 8;
     }
+}
 
-  ret = ((data->bit_save & data->bit_mask) != 0);
-  data->bit_mask >>= 1;
-  return ret;
+static inline unsigned
+grub_jpeg_get_bits (struct grub_jpeg_data *data, int num)
+{
+  if (data->bit_count < num)
+    grub_jpeg_fill_bits (data);
+
+  data->bit_count -= num;
+  return (data->bit_buf >> data->bit_count) & ((1U << num) - 1);
 }
 
-static int
+static inline int
 grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 {
-  int value, i, msb;
+  int value;
 
   if (num == 0)
     return 0;
 
-  msb = value = grub_jpeg_get_bit (data);
-  for (i = 1; i < num; i++)
-    value = (value << 1) + (grub_jpeg_get_bit (data) != 0);
-  if (!msb)
+  if (num > 16)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid coefficient size");
+      return 0;
+    }
+
+  value = grub_jpeg_get_bits (data, num);
+  if (value < (1 << (num - 1)))
     value += 1 - (1 << num);
 
   return value;
@@ -173,14 +269,24 @@ static int
 grub_jpeg_get_huff_code (struct grub_jpeg_data *data, int id)
 {
   int code;
-  unsigned i;
+  unsigned i, entry;
+
+  if (data->bit_count < 16)
+    grub_jpeg_fill_bits (data);
 
-  code = 0;
-  for (i = 0; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+  entry = data->huff_lookup[id][(data->bit_buf
+				 >> (data->bit_count - JPEG_HUFF_LOOKUP_BITS))
+				& ((1 << JPEG_HUFF_LOOKUP_BITS) - 1)];
+  if (entry)
     {
-      code <<= 1;
-      if (grub_jpeg_get_bit (data))
-	code++;
+      data->bit_count -= entry >> 8;
+      return entry & 0xff;
+    }
+
+  code = grub_jpeg_get_bits (data, JPEG_HUFF_LOOKUP_BITS);
+  for (i = JPEG_HUFF_LOOKUP_BITS; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+    {
+      code = (code << 1) | grub_jpeg_get_bits (data, 1);
       if (code < data->huff_maxval[id][i])
 	return data->huff_value[id][code + data->huff_offset[id][i]];
     }
@@ -192,42 +298,64 @@ static grub_err_t
 grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 {
   int id, ac, n, base, ofs;
-  grub_uint32_t next_marker;
+  grub_size_t next_marker;
   grub_uint8_t count[16];
-  unsigned i;
+  unsigned i, j, k;
 
-  next_marker = data->file->offset;
+  next_marker = data->pos;
   next_marker += grub_jpeg_get_word (data);
 
-  while (data->file->offset + sizeof (count) + 1 <= next_marker)
+  while (data->pos + sizeof (count) + 1 <= next_marker)
     {
       id = grub_jpeg_get_byte (data);
       ac = (id >> 4) & 1;
       id &= 0xF;
-      if (id > 1)
+      if (id > 3)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many huffman tables");
 
-      if (grub_file_read (data->file, &count, sizeof (count)) !=
-	  sizeof (count))
+      if (grub_jpeg_get_bytes (data, &count, sizeof (count)))
 	return grub_errno;
 
       n = 0;
       for (i = 0; i < ARRAY_SIZE (count); i++)
 	n += count[i];
+      if (n > 256)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid huffman table");
 
-      id += ac * 2;
+      /* Progressive images redefine tables between scans.  */
+      id += ac * 4;
+      grub_free (data->huff_value[id]);
+      grub_memset (data->huff_lookup[id], 0, sizeof (data->huff_lookup[id]));
       data->huff_value[id] = grub_malloc (n);
       if (grub_errno)
 	return grub_errno;
 
-      if (grub_file_read (data->file, data->huff_value[id], n) != n)
+      if (grub_jpeg_get_bytes (data, data->huff_value[id], n))
 	return grub_errno;
 
       base = 0;
       ofs = 0;
       for (i = 0; i < ARRAY_SIZE (count); i++)
 	{
+	  if (base + count[i] > (1 << (i + 1)))
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "jpeg: invalid huffman table");
+
+	  /* Codes of this length are base ... base + count[i] - 1.  */
+	  if (i < JPEG_HUFF_LOOKUP_BITS)
+	    for (j = 0; j < count[i]; j++)
+	      {
+		unsigned shift = JPEG_HUFF_LOOKUP_BITS - 1 - i;
+		grub_uint16_t *p = data->huff_lookup[id] + ((base + j) << shift);
+		grub_uint16_t entry = ((i + 1) << 8)
+		  | data->huff_value[id][ofs + j];
+
+		for (k = 0; k < (1U << shift); k++)
+		  p[k] = entry;
+	      }
+
 	  base += count[i];
 	  ofs += count[i];
 
@@ -238,7 +366,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 	}
     }
 
-  if (data->file->offset != next_marker)
+  if (data->pos != next_marker)
     grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in huffman table");
 
   return grub_errno;
@@ -248,31 +376,34 @@ static grub_err_t
 grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
 {
   int id;
-  grub_uint32_t next_marker;
+  unsigned i;
+  grub_size_t next_marker;
+  grub_uint8_t table[64];
 
-  next_marker = data->file->offset;
+  next_marker = data->pos;
   next_marker += grub_jpeg_get_word (data);
 
-  while (data->file->offset + sizeof (data->quan_table[id]) + 1
-	 <= next_marker)
+  while (data->pos + sizeof (table) + 1 <= next_marker)
     {
       id = grub_jpeg_get_byte (data);
       if (id >= 0x10)		/* Upper 4-bit is precision.  */
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: only 8-bit precision is supported");
 
-      if (id > 1)
+      if (id > 3)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many quantization tables");
 
-      if (grub_file_read (data->file, &data->quan_table[id],
-			  sizeof (data->quan_table[id]))
-	  != sizeof (data->quan_table[id]))
+      if (grub_jpeg_get_bytes (data, table, sizeof (table)))
 	return grub_errno;
 
+      for (i = 0; i < ARRAY_SIZE (table); i++)
+	data->quan_table[id][i] =
+	  (table[i] * jpeg_aan_scales[jpeg_zigzag_order[i]]
+	   + (1 << (13 - IDCT_PASS1_BITS))) >> (14 - IDCT_PASS1_BITS);
     }
 
-  if (data->file->offset != next_marker)
+  if (data->pos != next_marker)
     grub_error (GRUB_ERR_BAD_FILE_TYPE,
 		"jpeg: extra byte in quantization table");
 
@@ -283,9 +414,9 @@ static grub_err_t
 grub_jpeg_decode_sof (struct grub_jpeg_data *data)
 {
   int i, cc;
-  grub_uint32_t next_marker;
+  grub_size_t next_marker;
 
-  next_marker = data->file->offset;
+  next_marker = data->pos;
   next_marker += grub_jpeg_get_word (data);
 
   if (grub_jpeg_get_byte (data) != 8)
@@ -328,9 +459,21 @@ grub_jpeg_decode_sof (struct grub_jpeg_data *data)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: sampling method not supported");
       data->comp_index[id][0] = grub_jpeg_get_byte (data);
+      if (data->comp_index[id][0] > 3)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid quantization table");
     }
 
-  if (data->file->offset != next_marker)
+  /* A lone component is never interleaved; its factors don't matter.  */
+  if (cc == 1)
+    data->log_vs = data->log_hs = 0;
+
+  data->mcu_rows = (data->image_height + (8 << data->log_vs) - 1)
+    >> (3 + data->log_vs);
+  data->mcu_cols = (data->image_width + (8 << data->log_hs) - 1)
+    >> (3 + data->log_hs);
+
+  if (data->pos != next_marker)
     grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sof");
 
   return grub_errno;
@@ -348,149 +491,138 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+static inline grub_uint8_t
+grub_jpeg_clamp (int value)
+{
+  if ((unsigned) value > 255)
+    return value < 0 ? 0 : 255;
+  return value;
+}
+
+/* Arai-Agui-Nakajima IDCT.  The input is dequantized with the tables
+   from grub_jpeg_decode_quan_table, which carry the AAN scale factors,
+   leaving 5 multiplications per 1-D pass.  The output is level shifted
+   and clamped.  */
 static void
-grub_jpeg_idct_transform (jpeg_data_unit_t du)
+grub_jpeg_idct_transform (jpeg_data_unit_t du, grub_uint8_t *out)
 {
-  int *pd;
+  int ws[64];
+  int *pd, *pw;
   int i;
   int t0, t1, t2, t3, t4, t5, t6, t7;
-  int v0, v1, v2, v3, v4;
+  int t10, t11, t12, t13;
+  int z5, z10, z11, z12, z13;
 
   pd = du;
-  for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++)
+  pw = ws;
+  for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++, pw++)
     {
       if ((pd[JPEG_UNIT_SIZE * 1] | pd[JPEG_UNIT_SIZE * 2] |
 	   pd[JPEG_UNIT_SIZE * 3] | pd[JPEG_UNIT_SIZE * 4] |
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
 	   pd[JPEG_UNIT_SIZE * 7]) == 0)
 	{
-	  pd[JPEG_UNIT_SIZE * 0] <<= SHIFT_BITS;
-
-	  pd[JPEG_UNIT_SIZE * 1] = pd[JPEG_UNIT_SIZE * 2]
-	    = pd[JPEG_UNIT_SIZE * 3] = pd[JPEG_UNIT_SIZE * 4]
-	    = pd[JPEG_UNIT_SIZE * 5] = pd[JPEG_UNIT_SIZE * 6]
-	    = pd[JPEG_UNIT_SIZE * 7] = pd[JPEG_UNIT_SIZE * 0];
-
+	  pw[JPEG_UNIT_SIZE * 0] = pw[JPEG_UNIT_SIZE * 1]
+	    = pw[JPEG_UNIT_SIZE * 2] = pw[JPEG_UNIT_SIZE * 3]
+	    = pw[JPEG_UNIT_SIZE * 4] = pw[JPEG_UNIT_SIZE * 5]
+	    = pw[JPEG_UNIT_SIZE * 6] = pw[JPEG_UNIT_SIZE * 7]
+	    = pd[JPEG_UNIT_SIZE * 0];
 	  continue;
 	}
 
-      t0 = pd[JPEG_UNIT_SIZE * 0];
-      t1 = pd[JPEG_UNIT_SIZE * 2];
-      t2 = pd[JPEG_UNIT_SIZE * 4];
-      t3 = pd[JPEG_UNIT_SIZE * 6];
-
-      v4 = (t1 + t3) * CONST (0.541196100);
-
-      v0 = ((t0 + t2) << SHIFT_BITS);
-      v1 = ((t0 - t2) << SHIFT_BITS);
-      v2 = v4 - t3 * CONST (1.847759065);
-      v3 = v4 + t1 * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[JPEG_UNIT_SIZE * 7];
-      t5 = pd[JPEG_UNIT_SIZE * 5];
-      t6 = pd[JPEG_UNIT_SIZE * 3];
-      t7 = pd[JPEG_UNIT_SIZE * 1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[JPEG_UNIT_SIZE * 0] = t0 + t7;
-      pd[JPEG_UNIT_SIZE * 7] = t0 - t7;
-      pd[JPEG_UNIT_SIZE * 1] = t1 + t6;
-      pd[JPEG_UNIT_SIZE * 6] = t1 - t6;
-      pd[JPEG_UNIT_SIZE * 2] = t2 + t5;
-      pd[JPEG_UNIT_SIZE * 5] = t2 - t5;
-      pd[JPEG_UNIT_SIZE * 3] = t3 + t4;
-      pd[JPEG_UNIT_SIZE * 4] = t3 - t4;
+      /* Even part.  */
+      t10 = pd[JPEG_UNIT_SIZE * 0] + pd[JPEG_UNIT_SIZE * 4];
+      t11 = pd[JPEG_UNIT_SIZE * 0] - pd[JPEG_UNIT_SIZE * 4];
+      t13 = pd[JPEG_UNIT_SIZE * 2] + pd[JPEG_UNIT_SIZE * 6];
+      t12 = IDCT_MULTIPLY (pd[JPEG_UNIT_SIZE * 2] - pd[JPEG_UNIT_SIZE * 6],
+			   1.414213562) - t13;
+
+      t0 = t10 + t13;
+      t3 = t10 - t13;
+      t1 = t11 + t12;
+      t2 = t11 - t12;
+
+      /* Odd part.  */
+      z13 = pd[JPEG_UNIT_SIZE * 5] + pd[JPEG_UNIT_SIZE * 3];
+      z10 = pd[JPEG_UNIT_SIZE * 5] - pd[JPEG_UNIT_SIZE * 3];
+      z11 = pd[JPEG_UNIT_SIZE * 1] + pd[JPEG_UNIT_SIZE * 7];
+      z12 = pd[JPEG_UNIT_SIZE * 1] - pd[JPEG_UNIT_SIZE * 7];
+
+      t7 = z11 + z13;
+      t11 = IDCT_MULTIPLY (z11 - z13, 1.414213562);
+      z5 = IDCT_MULTIPLY (z10 + z12, 1.847759065);
+      t10 = IDCT_MULTIPLY (z12, 1.082392200) - z5;
+      t12 = z5 - IDCT_MULTIPLY (z10, 2.613125930);
+
+      t6 = t12 - t7;
+      t5 = t11 - t6;
+      t4 = t10 + t5;
+
+      pw[JPEG_UNIT_SIZE * 0] = t0 + t7;
+      pw[JPEG_UNIT_SIZE * 7] = t0 - t7;
+      pw[JPEG_UNIT_SIZE * 1] = t1 + t6;
+      pw[JPEG_UNIT_SIZE * 6] = t1 - t6;
+      pw[JPEG_UNIT_SIZE * 2] = t2 + t5;
+      pw[JPEG_UNIT_SIZE * 5] = t2 - t5;
+      pw[JPEG_UNIT_SIZE * 4] = t3 + t4;
+      pw[JPEG_UNIT_SIZE * 3] = t3 - t4;
     }
 
-  pd = du;
-  for (i = 0; i < JPEG_UNIT_SIZE; i++, pd += JPEG_UNIT_SIZE)
+  pw = ws;
+  for (i = 0; i < JPEG_UNIT_SIZE; i++, pw += JPEG_UNIT_SIZE,
+	 out += JPEG_UNIT_SIZE)
     {
-      if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
+      /* Level shift and rounding for the final descale.  */
+      z5 = pw[0] + (128 << (IDCT_PASS1_BITS + 3))
+	+ (1 << (IDCT_PASS1_BITS + 2));
+
+      if ((pw[1] | pw[2] | pw[3] | pw[4] | pw[5] | pw[6] | pw[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
-	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
+	  grub_memset (out, grub_jpeg_clamp (z5 >> (IDCT_PASS1_BITS + 3)),
+		       JPEG_UNIT_SIZE);
 	  continue;
 	}
 
-      v4 = (pd[2] + pd[6]) * CONST (0.541196100);
-
-      v0 = (pd[0] + pd[4]) << SHIFT_BITS;
-      v1 = (pd[0] - pd[4]) << SHIFT_BITS;
-      v2 = v4 - pd[6] * CONST (1.847759065);
-      v3 = v4 + pd[2] * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[7];
-      t5 = pd[5];
-      t6 = pd[3];
-      t7 = pd[1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
-    }
-
-  for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
-    {
-      du[i] += 128;
-
-      if (du[i] < 0)
-	du[i] = 0;
-      if (du[i] > 255)
-	du[i] = 255;
+      t10 = z5 + pw[4];
+      t11 = z5 - pw[4];
+      t13 = pw[2] + pw[6];
+      t12 = IDCT_MULTIPLY (pw[2] - pw[6], 1.414213562) - t13;
+
+      t0 = t10 + t13;
+      t3 = t10 - t13;
+      t1 = t11 + t12;
+      t2 = t11 - t12;
+
+      z13 = pw[5] + pw[3];
+      z10 = pw[5] - pw[3];
+      z11 = pw[1] + pw[7];
+      z12 = pw[1] - pw[7];
+
+      t7 = z11 + z13;
+      t11 = IDCT_MULTIPLY (z11 - z13, 1.414213562);
+      z5 = IDCT_MULTIPLY (z10 + z12, 1.847759065);
+      t10 = IDCT_MULTIPLY (z12, 1.082392200) - z5;
+      t12 = z5 - IDCT_MULTIPLY (z10, 2.613125930);
+
+      t6 = t12 - t7;
+      t5 = t11 - t6;
+      t4 = t10 + t5;
+
+      out[0] = grub_jpeg_clamp ((t0 + t7) >> (IDCT_PASS1_BITS + 3));
+      out[7] = grub_jpeg_clamp ((t0 - t7) >> (IDCT_PASS1_BITS + 3));
+      out[1] = grub_jpeg_clamp ((t1 + t6) >> (IDCT_PASS1_BITS + 3));
+      out[6] = grub_jpeg_clamp ((t1 - t6) >> (IDCT_PASS1_BITS + 3));
+      out[2] = grub_jpeg_clamp ((t2 + t5) >> (IDCT_PASS1_BITS + 3));
+      out[5] = grub_jpeg_clamp ((t2 - t5) >> (IDCT_PASS1_BITS + 3));
+      out[4] = grub_jpeg_clamp ((t3 + t4) >> (IDCT_PASS1_BITS + 3));
+      out[3] = grub_jpeg_clamp ((t3 - t4) >> (IDCT_PASS1_BITS + 3));
     }
 }
 
 static void
-grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
+grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, grub_uint8_t *out)
 {
+  jpeg_data_unit_t du;
   int h1, h2, qt;
   unsigned pos;
 
@@ -503,7 +635,7 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
   data->dc_value[id] +=
     grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data, h1));
 
-  du[0] = data->dc_value[id] * (int) data->quan_table[qt][0];
+  du[0] = data->dc_value[id] * data->quan_table[qt][0];
   pos = 1;
   while (pos < ARRAY_SIZE (data->quan_table[qt]))
     {
@@ -516,94 +648,355 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
       val = grub_jpeg_get_number (data, num & 0xF);
       num >>= 4;
       pos += num;
-      du[jpeg_zigzag_order[pos]] = val * (int) data->quan_table[qt][pos];
+      if (pos >= ARRAY_SIZE (data->quan_table[qt]))
+	break;
+      du[jpeg_zigzag_order[pos]] = val * data->quan_table[qt][pos];
       pos++;
     }
 
-  grub_jpeg_idct_transform (du);
+  grub_jpeg_idct_transform (du, out);
 }
 
+/* Decode one block of a scan into the coefficient buffer.  Handles
+   sequential scans, which are a DC first scan plus an AC first scan
+   over 1 ... 63 with no shift, as well as all progressive scan types.  */
 static void
+grub_jpeg_decode_coefs (struct grub_jpeg_data *data, int id,
+			grub_int16_t *coef)
+{
+  unsigned k, k0;
+  int rs, r, s;
+
+  k0 = data->ss;
+  if (k0 == 0)
+    {
+      if (data->ah == 0)
+	{
+	  s = grub_jpeg_get_huff_code (data, data->comp_index[id][1]);
+	  data->dc_value[id] += grub_jpeg_get_number (data, s);
+	  coef[0] = data->dc_value[id] * (1 << data->al);
+	}
+      else if (grub_jpeg_get_bits (data, 1))
+	coef[0] |= 1 << data->al;
+      k0 = 1;
+    }
+
+  if (data->se < k0)
+    return;
+
+  if (data->ah == 0)
+    {
+      if (data->eobrun)
+	{
+	  data->eobrun--;
+	  return;
+	}
+
+      for (k = k0; k <= data->se; k++)
+	{
+	  rs = grub_jpeg_get_huff_code (data, data->comp_index[id][2]);
+	  r = rs >> 4;
+	  s = rs & 0xF;
+	  if (s)
+	    {
+	      k += r;
+	      if (k > 63)
+		break;
+	      coef[k] = grub_jpeg_get_number (data, s) * (1 << data->al);
+	    }
+	  else if (r == 15)
+	    k += 15;
+	  else
+	    {
+	      /* End of band for this and the next EOBRUN blocks.  */
+	      data->eobrun = (1 << r) - 1 + grub_jpeg_get_bits (data, r);
+	      break;
+	    }
+	}
+      return;
+    }
+
+  /* Successive approximation refinement: every coefficient already
+     nonzero gets a correction bit, zero runs only count zeroes, and at
+     most one coefficient of magnitude 1 << al is added per symbol.  */
+  {
+    int p1 = 1 << data->al, m1 = -p1;
+
+    k = k0;
+    if (data->eobrun == 0)
+      for (; k <= data->se; k++)
+	{
+	  rs = grub_jpeg_get_huff_code (data, data->comp_index[id][2]);
+	  r = rs >> 4;
+	  s = rs & 0xF;
+	  if (s)
+	    s = grub_jpeg_get_bits (data, 1) ? p1 : m1;
+	  else if (r != 15)
+	    {
+	      data->eobrun = (1 << r) + grub_jpeg_get_bits (data, r);
+	      break;
+	    }
+
+	  do
+	    {
+	      if (coef[k])
+		{
+		  if (grub_jpeg_get_bits (data, 1) && (coef[k] & p1) == 0)
+		    coef[k] += coef[k] >= 0 ? p1 : m1;
+		}
+	      else if (--r < 0)
+		break;
+	      k++;
+	    }
+	  while (k <= data->se);
+
+	  if (s && k <= data->se)
+	    coef[k] = s;
+	}
+
+    if (data->eobrun)
+      {
+	for (; k <= data->se; k++)
+	  if (coef[k] && grub_jpeg_get_bits (data, 1) && (coef[k] & p1) == 0)
+	    coef[k] += coef[k] >= 0 ? p1 : m1;
+	data->eobrun--;
+      }
+  }
+}
+
+/* Dequantize and transform a block from the coefficient buffer.  */
+static void
+grub_jpeg_idct_coefs (struct grub_jpeg_data *data, int id,
+		      const grub_int16_t *coef, grub_uint8_t *out)
+{
+  jpeg_data_unit_t du;
+  const int *qt = data->quan_table[data->comp_index[id][0]];
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (du); i++)
+    du[jpeg_zigzag_order[i]] = coef[i] * qt[i];
+
+  grub_jpeg_idct_transform (du, out);
+}
+
+static inline void
 grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
 {
-  int dd;
+  grub_uint8_t r, g, b;
 
-  cr -= 128;
-  cb -= 128;
+  r = grub_jpeg_clamp (yy + jpeg_cr_r[cr]);
+  g = grub_jpeg_clamp (yy + ((jpeg_cb_g[cb] + jpeg_cr_g[cr])
+			     >> COLOR_SHIFT_BITS));
+  b = grub_jpeg_clamp (yy + jpeg_cb_b[cb]);
 
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
+  rgb[0] = b;
+  rgb[1] = g;
+  rgb[2] = r;
 #else
-  *(rgb++) = dd;
+  rgb[0] = r;
+  rgb[1] = g;
+  rgb[2] = b;
 #endif
+}
 
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+static void
+grub_jpeg_init_color_tables (void)
+{
+  int i;
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
-#else
-  *(rgb++) = dd;
-#endif
+  for (i = 0; i < 256; i++)
+    {
+      int x = i - 128;
+
+      jpeg_cr_r[i] = (COLOR_CONST (1.402) * x
+		      + (1 << (COLOR_SHIFT_BITS - 1))) >> COLOR_SHIFT_BITS;
+      jpeg_cb_b[i] = (COLOR_CONST (1.772) * x
+		      + (1 << (COLOR_SHIFT_BITS - 1))) >> COLOR_SHIFT_BITS;
+      jpeg_cr_g[i] = -COLOR_CONST (0.71414) * x;
+      jpeg_cb_g[i] = -COLOR_CONST (0.34414) * x
+	+ (1 << (COLOR_SHIFT_BITS - 1));
+    }
+}
+
+/* Convert the samples of MCU (r1, c1) to pixels, replicating chroma
+   over the luma blocks it covers.  */
+static void
+grub_jpeg_put_mcu (struct grub_jpeg_data *data, unsigned r1, unsigned c1)
+{
+  unsigned vb, hb, nr2, nc2, r2, c2;
+  grub_uint8_t *ptr;
+
+  vb = 8 << data->log_vs;
+  hb = 8 << data->log_hs;
+  nr2 = (r1 == data->mcu_rows - 1) ? (data->image_height - r1 * vb) : vb;
+  nc2 = (c1 == data->mcu_cols - 1) ? (data->image_width - c1 * hb) : hb;
+
+  ptr = data->bitmap_ptr + (r1 * vb * data->image_width + c1 * hb) * 3;
+  for (r2 = 0; r2 < nr2; r2++, ptr += data->image_width * 3)
+    {
+      /* The two luma blocks of a row are adjacent in ydu.  */
+      const grub_uint8_t *yrow = data->ydu[(r2 / 8) * 2] + (r2 % 8) * 8;
+      grub_uint8_t *p = ptr;
+
+      if (data->color_components >= 3)
+	{
+	  const grub_uint8_t *crrow = data->crdu + (r2 >> data->log_vs) * 8;
+	  const grub_uint8_t *cbrow = data->cbdu + (r2 >> data->log_vs) * 8;
+
+	  for (c2 = 0; c2 < nc2; c2++, p += 3)
+	    grub_jpeg_ycrcb_to_rgb (yrow[(c2 / 8) * 64 + (c2 % 8)],
+				    crrow[c2 >> data->log_hs],
+				    cbrow[c2 >> data->log_hs], p);
+	}
+      else
+	for (c2 = 0; c2 < nc2; c2++, p += 3)
+	  p[0] = p[1] = p[2] = yrow[c2];
+    }
+}
+
+static void
+grub_jpeg_reset (struct grub_jpeg_data *data)
+{
+  data->bit_count = 0;
+  data->eobrun = 0;
+
+  data->dc_value[0] = 0;
+  data->dc_value[1] = 0;
+  data->dc_value[2] = 0;
+}
+
+static grub_uint8_t
+grub_jpeg_get_marker (struct grub_jpeg_data *data)
+{
+  grub_uint8_t r;
+
+  /* Entropy coded data is padded to a byte boundary.  */
+  data->bit_count = 0;
+
+  if (data->marker)
+    {
+      r = data->marker;
+      data->marker = 0;
+      return r;
+    }
+
+  r = grub_jpeg_get_byte (data);
+
+  if (r != JPEG_ESC_CHAR)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid maker");
+      return 0;
+    }
+
+  /* Any number of fill bytes may precede a marker.  */
+  do
+    r = grub_jpeg_get_byte (data);
+  while (r == JPEG_ESC_CHAR && grub_errno == GRUB_ERR_NONE);
+
+  return r;
+}
+
+static grub_err_t
+grub_jpeg_alloc_coefs (struct grub_jpeg_data *data)
+{
+  int i;
+
+  for (i = 0; i < data->color_components; i++)
+    {
+      unsigned w = data->mcu_cols, h = data->mcu_rows;
+      grub_uint64_t size;
+
+      if (i == 0)
+	{
+	  w <<= data->log_hs;
+	  h <<= data->log_vs;
+	}
+
+      size = (grub_uint64_t) w * h * 64 * sizeof (grub_int16_t);
+      if (size > GRUB_SIZE_MAX)
+	return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+
+      data->coef_stride[i] = w;
+      data->coefs[i] = grub_zalloc (size);
+      if (!data->coefs[i])
+	return grub_errno;
+    }
+
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
 grub_jpeg_decode_sos (struct grub_jpeg_data *data)
 {
   int i, cc;
-  grub_uint32_t data_offset;
+  grub_size_t data_offset;
 
-  data_offset = data->file->offset;
+  data_offset = data->pos;
   data_offset += grub_jpeg_get_word (data);
 
+  if (!data->color_components)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: no frame header");
+
   cc = grub_jpeg_get_byte (data);
 
-  if (cc != 3 && cc != 1)
+  if (cc < 1 || cc > data->color_components)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 		       "jpeg: component count must be 1 or 3");
-  data->color_components = cc;
+  data->scan_components = cc;
 
   for (i = 0; i < cc; i++)
     {
       int id, ht;
 
       id = grub_jpeg_get_byte (data) - 1;
-      if ((id < 0) || (id >= 3))
+      if ((id < 0) || (id >= data->color_components))
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
 
       ht = grub_jpeg_get_byte (data);
+      if ((ht >> 4) > 3 || (ht & 0xF) > 3)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid huffman table");
       data->comp_index[id][1] = (ht >> 4);
-      data->comp_index[id][2] = (ht & 0xF) + 2;
+      data->comp_index[id][2] = (ht & 0xF) + 4;
+      data->scan_comp[i] = id;
     }
 
-  grub_jpeg_get_byte (data);	/* Skip 3 unused bytes.  */
-  grub_jpeg_get_word (data);
+  data->ss = grub_jpeg_get_byte (data);	/* Spectral selection.  */
+  data->se = grub_jpeg_get_byte (data);
+  data->al = grub_jpeg_get_byte (data);	/* Successive approximation.  */
+  data->ah = data->al >> 4;
+  data->al &= 0xF;
 
-  if (data->file->offset != data_offset)
+  if (data->pos != data_offset)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sos");
 
+  if (!data->progressive)
+    {
+      data->ss = 0;
+      data->se = 63;
+      data->ah = data->al = 0;
+    }
+  else if (data->ss > data->se || data->se > 63
+	   || (data->ss == 0 && data->se != 0)
+	   || (data->ss != 0 && cc != 1) || data->al > 13)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid scan");
+
+  if (!data->coefs[0]
+      && (data->progressive || cc != data->color_components))
+    {
+      if (data->bitmap_ptr)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: unexpected scan");
+      if (grub_jpeg_alloc_coefs (data))
+	return grub_errno;
+    }
+
+  grub_jpeg_reset (data);
+
+  if (data->bitmap_ptr)
+    return GRUB_ERR_NONE;
+
   if (grub_video_bitmap_create (data->bitmap, data->image_width,
 				data->image_height,
 				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
@@ -613,24 +1006,107 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
   return GRUB_ERR_NONE;
 }
 
+/* Read the restart marker expected after every DRI units.  */
+static grub_err_t
+grub_jpeg_restart (struct grub_jpeg_data *data)
+{
+  grub_uint8_t marker;
+
+  marker = grub_jpeg_get_marker (data);
+  if (grub_errno)
+    return grub_errno;
+
+  if (marker < JPEG_MARKER_RST0 || marker > JPEG_MARKER_RST7)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		       "jpeg: restart marker expected");
+
+  grub_jpeg_reset (data);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_jpeg_decode_data (struct grub_jpeg_data *data)
 {
-  unsigned c1, vb, hb, nr1, nc1;
+  unsigned r1, c1, nr1, nc1;
   int rst = data->dri;
 
-  vb = 8 << data->log_vs;
-  hb = 8 << data->log_hs;
-  nr1 = (data->image_height + vb - 1) >> (3 + data->log_vs);
-  nc1 = (data->image_width + hb - 1)  >> (3 + data->log_hs);
+  /* A single component scan of a color image codes each block of the
+     component on its own rather than in MCUs.  */
+  if (data->scan_components == 1 && data->color_components > 1)
+    {
+      int id = data->scan_comp[0];
+      grub_int16_t *coef = data->coefs[id];
 
-  for (; data->r1 < nr1 && (!data->dri || rst);
-       data->r1++, data->bitmap_ptr += (vb * data->image_width - hb * nc1) * 3)
-    for (c1 = 0;  c1 < nc1 && (!data->dri || rst);
-	c1++, rst--, data->bitmap_ptr += hb * 3)
+      nr1 = data->mcu_rows;
+      nc1 = data->mcu_cols;
+      if (id == 0)
+	{
+	  nr1 = (data->image_height + 7) / 8;
+	  nc1 = (data->image_width + 7) / 8;
+	}
+
+      for (r1 = 0; r1 < nr1; r1++)
+	for (c1 = 0; c1 < nc1; c1++)
+	  {
+	    if (data->dri && rst-- == 0)
+	      {
+		if (grub_jpeg_restart (data))
+		  return grub_errno;
+		rst = data->dri - 1;
+	      }
+
+	    grub_jpeg_decode_coefs (data, id, coef
+				    + (r1 * data->coef_stride[id] + c1) * 64);
+	    if (grub_errno)
+	      return grub_errno;
+	  }
+
+      return GRUB_ERR_NONE;
+    }
+
+  nr1 = data->mcu_rows;
+  nc1 = data->mcu_cols;
+  for (r1 = 0; r1 < nr1; r1++)
+    for (c1 = 0; c1 < nc1; c1++)
       {
-	unsigned r2, c2, nr2, nc2;
-	grub_uint8_t *ptr2;
+	unsigned r2, c2;
+
+	if (data->dri && rst-- == 0)
+	  {
+	    if (grub_jpeg_restart (data))
+	      return grub_errno;
+	    rst = data->dri - 1;
+	  }
+
+	if (data->coefs[0])
+	  {
+	    int i;
+
+	    for (i = 0; i < data->scan_components; i++)
+	      {
+		int id = data->scan_comp[i];
+
+		if (id)
+		  {
+		    grub_jpeg_decode_coefs (data, id, data->coefs[id]
+					    + (r1 * data->coef_stride[id]
+					       + c1) * 64);
+		    continue;
+		  }
+
+		for (r2 = 0; r2 < (1U << data->log_vs); r2++)
+		  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
+		    grub_jpeg_decode_coefs (data, 0, data->coefs[0]
+					    + ((((r1 << data->log_vs) + r2)
+						* data->coef_stride[0])
+					       + (c1 << data->log_hs) + c2)
+					    * 64);
+	      }
+
+	    if (grub_errno)
+	      return grub_errno;
+	    continue;
+	  }
 
 	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
 	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
@@ -645,62 +1121,44 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 	if (grub_errno)
 	  return grub_errno;
 
-	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
-	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
-
-	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
-	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
-	    {
-	      unsigned i0;
-	      int yy;
-
-	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
-
-	      if (data->color_components >= 3)
-		{
-		  int cr, cb;
-		  cr = data->crdu[i0];
-		  cb = data->cbdu[i0];
-		  grub_jpeg_ycrcb_to_rgb (yy, cr, cb, ptr2);
-		}
-	      else
-		{
-		  ptr2[0] = yy;
-		  ptr2[1] = yy;
-		  ptr2[2] = yy;
-		}
-	    }
+	grub_jpeg_put_mcu (data, r1, c1);
       }
 
   return grub_errno;
 }
 
-static void
-grub_jpeg_reset (struct grub_jpeg_data *data)
+/* Transform the coefficient buffer into the bitmap once all scans of a
+   progressive or non-interleaved image are in.  */
+static grub_err_t
+grub_jpeg_decode_coef_image (struct grub_jpeg_data *data)
 {
-  data->bit_mask = 0x0;
+  unsigned r1, c1, r2, c2;
 
-  data->dc_value[0] = 0;
-  data->dc_value[1] = 0;
-  data->dc_value[2] = 0;
-}
-
-static grub_uint8_t
-grub_jpeg_get_marker (struct grub_jpeg_data *data)
-{
-  grub_uint8_t r;
+  for (r1 = 0; r1 < data->mcu_rows; r1++)
+    for (c1 = 0; c1 < data->mcu_cols; c1++)
+      {
+	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
+	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
+	    grub_jpeg_idct_coefs (data, 0, data->coefs[0]
+				  + ((((r1 << data->log_vs) + r2)
+				      * data->coef_stride[0])
+				     + (c1 << data->log_hs) + c2) * 64,
+				  data->ydu[r2 * 2 + c2]);
 
-  r = grub_jpeg_get_byte (data);
+	if (data->color_components >= 3)
+	  {
+	    grub_jpeg_idct_coefs (data, 1, data->coefs[1]
+				  + (r1 * data->coef_stride[1] + c1) * 64,
+				  data->cbdu);
+	    grub_jpeg_idct_coefs (data, 2, data->coefs[2]
+				  + (r1 * data->coef_stride[2] + c1) * 64,
+				  data->crdu);
+	  }
 
-  if (r != JPEG_ESC_CHAR)
-    {
-      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid maker");
-      return 0;
-    }
+	grub_jpeg_put_mcu (data, r1, c1);
+      }
 
-  return grub_jpeg_get_byte (data);
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -728,15 +1186,21 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	  grub_jpeg_decode_quan_table (data);
 	  break;
 	case JPEG_MARKER_SOF0:	/* Start Of Frame 0.  */
+	case JPEG_MARKER_SOF1:	/* Extended sequential, same decoding.  */
+	  grub_jpeg_decode_sof (data);
+	  break;
+	case JPEG_MARKER_SOF2:	/* Progressive.  */
+	  data->progressive = 1;
 	  grub_jpeg_decode_sof (data);
 	  break;
 	case JPEG_MARKER_DRI:	/* Define Restart Interval.  */
 	  grub_jpeg_decode_dri (data);
 	  break;
 	case JPEG_MARKER_SOS:	/* Start Of Scan.  */
-	  if (grub_jpeg_decode_sos (data))
-	    break;
-	case JPEG_MARKER_RST0:	/* Restart.  */
+	  if (grub_jpeg_decode_sos (data) == GRUB_ERR_NONE)
+	    grub_jpeg_decode_data (data);
+	  break;
+	case JPEG_MARKER_RST0:	/* Stray restart, nothing to do.  */
 	case JPEG_MARKER_RST1:
 	case JPEG_MARKER_RST2:
 	case JPEG_MARKER_RST3:
@@ -744,10 +1208,10 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	case JPEG_MARKER_RST5:
 	case JPEG_MARKER_RST6:
 	case JPEG_MARKER_RST7:
-	  grub_jpeg_decode_data (data);
-	  grub_jpeg_reset (data);
 	  break;
 	case JPEG_MARKER_EOI:	/* End Of Image.  */
+	  if (data->coefs[0] && data->bitmap_ptr)
+	    grub_jpeg_decode_coef_image (data);
 	  return grub_errno;
 	default:		/* Skip unrecognized marker.  */
 	  {
@@ -756,7 +1220,10 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	    sz = grub_jpeg_get_word (data);
 	    if (grub_errno)
 	      return (grub_errno);
-	    grub_file_seek (data->file, data->file->offset + sz - 2);
+	    if (sz < 2 || sz - 2 > data->image_size - data->pos)
+	      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+				 "jpeg: premature end of file");
+	    data->pos += sz - 2;
 	  }
 	}
     }
@@ -775,6 +1242,14 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
   if (!file)
     return grub_errno;
 
+  if (grub_file_size (file) == GRUB_FILE_SIZE_UNKNOWN
+      || grub_file_size (file) > GRUB_SIZE_MAX)
+    {
+      grub_file_close (file);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "jpeg: file size unknown");
+    }
+
   data = grub_zalloc (sizeof (*data));
   if (data != NULL)
     {
@@ -782,11 +1257,25 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
 
       data->file = file;
       data->bitmap = bitmap;
-      grub_jpeg_decode_jpeg (data);
+      data->image_size = grub_file_size (file);
+      data->image = grub_malloc (data->image_size);
+      if (data->image
+	  && grub_file_read (file, data->image, data->image_size)
+	  != (grub_ssize_t) data->image_size)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: premature end of file");
+	}
+      else if (data->image)
+	grub_jpeg_decode_jpeg (data);
 
-      for (i = 0; i < 4; i++)
+      for (i = 0; i < 8; i++)
 	grub_free (data->huff_value[i]);
 
+      for (i = 0; i < 3; i++)
+	grub_free (data->coefs[i]);
+
+      grub_free (data->image);
       grub_free (data);
     }
 
@@ -834,6 +1323,7 @@ static struct grub_video_bitmap_reader jpeg_reader = {
 
 GRUB_MOD_INIT (jpeg)
 {
+  grub_jpeg_init_color_tables ();
   grub_video_bitmap_reader_register (&jpg_reader);
   grub_video_bitmap_reader_register (&jpeg_reader);
 #if defined(JPEG_DEBUG)
@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/bufio.h>
+#include <grub/deflate.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -60,70 +61,34 @@ enum
     PNG_CHUNK_PLTE = 0x504c5445
   };
 
-#define Z_DEFLATED		8
-#define Z_FLAG_DICT		32
-
-#define INFLATE_STORED		0
-#define INFLATE_FIXED		1
-#define INFLATE_DYNAMIC		2
-
-#define WSIZE			0x8000
-
-#define DEFLATE_HCLEN_BASE	4
-#define DEFLATE_HCLEN_MAX	19
-#define DEFLATE_HLIT_BASE	257
-#define DEFLATE_HLIT_MAX	288
-#define DEFLATE_HDIST_BASE	1
-#define DEFLATE_HDIST_MAX	30
-
-#define DEFLATE_HUFF_LEN	16
-
 #ifdef PNG_DEBUG
 static grub_command_t cmd;
 #endif
 
-struct huff_table
-{
-  int *values, *maxval, *offset;
-  int num_values, max_length;
-};
-
 struct grub_png_data
 {
   grub_file_t file;
   struct grub_video_bitmap **bitmap;
 
-  int bit_count, bit_save;
-
   grub_uint32_t next_offset;
 
   unsigned image_width, image_height;
   int bpp, is_16bit;
-  int raw_bytes, is_gray, is_alpha, is_palette;
+  int is_gray, is_alpha, is_palette;
   int row_bytes, color_bits;
-  grub_uint8_t *image_data;
 
-  int inside_idat, idat_remain;
+  /* Rows are unfiltered in the bitmap itself when its format matches
+     the PNG samples; otherwise in these two alternating rows and then
+     converted into the bitmap.  */
+  int direct;
+  grub_uint8_t *rows;
 
-  int code_values[DEFLATE_HLIT_MAX];
-  int code_maxval[DEFLATE_HUFF_LEN];
-  int code_offset[DEFLATE_HUFF_LEN];
-
-  int dist_values[DEFLATE_HDIST_MAX];
-  int dist_maxval[DEFLATE_HUFF_LEN];
-  int dist_offset[DEFLATE_HUFF_LEN];
+  /* The zlib stream of all the IDAT chunks.  */
+  grub_uint8_t *idat;
+  grub_size_t idat_len, idat_alloc;
 
+  /* Gray levels are looked up here too.  */
   grub_uint8_t palette[256][3];
-
-  struct huff_table code_table;
-  struct huff_table dist_table;
-
-  grub_uint8_t slide[WSIZE];
-  int wp;
-
-  grub_uint8_t *cur_rgb;
-
-  int cur_column, cur_filter, first_line;
 };
 
 static grub_uint32_t
@@ -142,85 +107,12 @@ grub_png_get_byte (struct grub_png_data *data)
 {
   grub_uint8_t r;
 
-  if ((data->inside_idat) && (data->idat_remain == 0))
-    {
-      grub_uint32_t len, type;
-
-      do
-	{
-          /* Skip crc checksum.  */
-	  grub_png_get_dword (data);
-
-          if (data->file->offset != data->next_offset)
-            {
-              grub_error (GRUB_ERR_BAD_FILE_TYPE,
-                          "png: chunk size error");
-              return 0;
-            }
-
-	  len = grub_png_get_dword (data);
-	  type = grub_png_get_dword (data);
-	  if (type != PNG_CHUNK_IDAT)
-	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "png: unexpected end of data");
-	      return 0;
-	    }
-
-          data->next_offset = data->file->offset + len + 4;
-	}
-      while (len == 0);
-      data->idat_remain = len;
-    }
-
   r = 0;
   grub_file_read (data->file, &r, 1);
 
-  if (data->inside_idat)
-    data->idat_remain--;
-
   return r;
 }
 
-static int
-grub_png_get_bits (struct grub_png_data *data, int num)
-{
-  int code, shift;
-
-  if (data->bit_count == 0)
-    {
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
-    }
-
-  code = 0;
-  shift = 0;
-  while (grub_errno == 0)
-    {
-      int n;
-
-      n = data->bit_count;
-      if (n > num)
-	n = num;
-
-      code += (int) (data->bit_save & ((1 << n) - 1)) << shift;
-      num -= n;
-      if (!num)
-	{
-	  data->bit_count -= n;
-	  data->bit_save >>= n;
-	  break;
-	}
-
-      shift += n;
-
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
-    }
-
-  return code;
-}
-
 static grub_err_t
 grub_png_decode_image_palette (struct grub_png_data *data,
 			       unsigned len)
@@ -269,7 +161,8 @@ grub_png_decode_image_header (struct grub_png_data *data)
   if (data->is_16bit && data->is_palette)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 		       "png: color type not supported");
-  if (color_type & PNG_COLOR_MASK_ALPHA)
+  data->is_alpha = !!(color_type & PNG_COLOR_MASK_ALPHA);
+  if (data->is_alpha)
     blt = GRUB_VIDEO_BLIT_FORMAT_RGBA_8888;
   else
     blt = GRUB_VIDEO_BLIT_FORMAT_RGB_888;
@@ -306,27 +199,14 @@ grub_png_decode_image_header (struct grub_png_data *data)
     data->row_bytes = (data->image_width * data->color_bits + 7) / 8;
 
 #ifndef GRUB_CPU_WORDS_BIGENDIAN
-  if (data->is_16bit || data->is_gray || data->is_palette)
+  data->direct = !(data->is_16bit || data->is_gray || data->is_palette);
 #endif
+  if (!data->direct)
     {
-      data->image_data = grub_malloc (data->image_height * data->row_bytes);
+      data->rows = grub_malloc (2 * data->row_bytes);
       if (grub_errno)
         return grub_errno;
-
-      data->cur_rgb = data->image_data;
-    }
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-  else
-    {
-      data->image_data = 0;
-      data->cur_rgb = (*data->bitmap)->data;
     }
-#endif
-
-  data->raw_bytes = data->image_height * (data->row_bytes + 1);
-
-  data->cur_column = 0;
-  data->first_line = 1;
 
   if (grub_png_get_byte (data) != PNG_COMPRESSION_BASE)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
@@ -346,466 +226,266 @@ grub_png_decode_image_header (struct grub_png_data *data)
   return grub_errno;
 }
 
-/* Order of the bit length code lengths.  */
-static const grub_uint8_t bitorder[] = {
-  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-};
-
-/* Copy lengths for literal codes 257..285.  */
-static const int cplens[] = {
-  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0
-};
-
-/* Extra bits for literal codes 257..285.  */
-static const grub_uint8_t cplext[] = {
-  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 99, 99
-};				/* 99==invalid  */
-
-/* Copy offsets for distance codes 0..29.  */
-static const int cpdist[] = {
-  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-  8193, 12289, 16385, 24577
-};
-
-/* Extra bits for distance codes.  */
-static const grub_uint8_t cpdext[] = {
-  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-  7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-  12, 12, 13, 13
-};
-
-static void
-grub_png_init_huff_table (struct huff_table *ht, int cur_maxlen,
-			  int *cur_values, int *cur_maxval, int *cur_offset)
-{
-  ht->values = cur_values;
-  ht->maxval = cur_maxval;
-  ht->offset = cur_offset;
-  ht->num_values = 0;
-  ht->max_length = cur_maxlen;
-  grub_memset (cur_maxval, 0, sizeof (int) * cur_maxlen);
-}
-
-static void
-grub_png_insert_huff_item (struct huff_table *ht, int code, int len)
+/* Undo FILTER on the row CUR.  UP is the previous row, already
+   unfiltered, or NULL for the first row, where it counts as zeroes.  */
+static grub_err_t
+grub_png_filter_row (struct grub_png_data *data, grub_uint8_t filter,
+		     grub_uint8_t *cur, const grub_uint8_t *up)
 {
-  int i, n;
-
-  if (len == 0)
-    return;
-
-  if (len > ht->max_length)
-    {
-      grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: invalid code length");
-      return;
-    }
-
-  n = 0;
-  for (i = len; i < ht->max_length; i++)
-    n += ht->maxval[i];
-
-  for (i = 0; i < n; i++)
-    ht->values[ht->num_values - i] = ht->values[ht->num_values - i - 1];
+  int i, bpp = data->bpp, n = data->row_bytes;
 
-  ht->values[ht->num_values - n] = code;
-  ht->num_values++;
-  ht->maxval[len - 1]++;
-}
+  if (filter >= PNG_FILTER_VALUE_LAST)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
 
-static void
-grub_png_build_huff_table (struct huff_table *ht)
-{
-  int base, ofs, i;
+  /* Without a row above, Paeth picks the left byte just like Sub.  */
+  if (!up && filter == PNG_FILTER_VALUE_PAETH)
+    filter = PNG_FILTER_VALUE_SUB;
 
-  base = 0;
-  ofs = 0;
-  for (i = 0; i < ht->max_length; i++)
+  switch (filter)
     {
-      base += ht->maxval[i];
-      ofs += ht->maxval[i];
+    case PNG_FILTER_VALUE_SUB:
+      for (i = bpp; i < n; i++)
+	cur[i] += cur[i - bpp];
+      break;
 
-      ht->maxval[i] = base;
-      ht->offset[i] = ofs - base;
-
-      base <<= 1;
-    }
-}
+    case PNG_FILTER_VALUE_UP:
+      if (!up)
+	break;
 
-static int
-grub_png_get_huff_code (struct grub_png_data *data, struct huff_table *ht)
-{
-  int code, i;
+      /* Bytewise addition, four bytes at a time: add the low 7 bits of
+	 each byte, then put back the top bits without carrying out.  */
+      for (i = 0; i + 4 <= n; i += 4)
+	{
+	  grub_uint32_t a = grub_get_unaligned32 (cur + i);
+	  grub_uint32_t b = grub_get_unaligned32 (up + i);
 
-  code = 0;
-  for (i = 0; i < ht->max_length; i++)
-    {
-      code = (code << 1) + grub_png_get_bits (data, 1);
-      if (code < ht->maxval[i])
-	return ht->values[code + ht->offset[i]];
-    }
-  return 0;
-}
+	  grub_set_unaligned32 (cur + i, ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f))
+				^ ((a ^ b) & 0x80808080));
+	}
+      for (; i < n; i++)
+	cur[i] += up[i];
+      break;
 
-static grub_err_t
-grub_png_init_fixed_block (struct grub_png_data *data)
-{
-  int i;
+    case PNG_FILTER_VALUE_AVG:
+      if (!up)
+	{
+	  for (i = bpp; i < n; i++)
+	    cur[i] += cur[i - bpp] >> 1;
+	  break;
+	}
 
-  grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
-			    data->code_values, data->code_maxval,
-			    data->code_offset);
+      for (i = 0; i < bpp; i++)
+	cur[i] += up[i] >> 1;
+      for (; i < n; i++)
+	cur[i] += ((int) up[i] + (int) cur[i - bpp]) >> 1;
+      break;
 
-  for (i = 0; i < 144; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
+    case PNG_FILTER_VALUE_PAETH:
+      for (i = 0; i < bpp; i++)
+	cur[i] += up[i];
 
-  for (; i < 256; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 9);
+      for (; i < n; i++)
+	{
+	  int a, b, c, pa, pb, pc;
 
-  for (; i < 280; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 7);
+	  a = cur[i - bpp];
+	  b = up[i];
+	  c = up[i - bpp];
 
-  for (; i < DEFLATE_HLIT_MAX; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
+	  pa = b - c;
+	  pb = a - c;
+	  pc = pa + pb;
 
-  grub_png_build_huff_table (&data->code_table);
+	  if (pa < 0)
+	    pa = -pa;
 
-  grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
-			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
+	  if (pb < 0)
+	    pb = -pb;
 
-  for (i = 0; i < DEFLATE_HDIST_MAX; i++)
-    grub_png_insert_huff_item (&data->dist_table, i, 5);
+	  if (pc < 0)
+	    pc = -pc;
 
-  grub_png_build_huff_table (&data->dist_table);
+	  cur[i] += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
+	}
+      break;
+    }
 
-  return grub_errno;
+  return GRUB_ERR_NONE;
 }
 
-static grub_err_t
-grub_png_init_dynamic_block (struct grub_png_data *data)
-{
-  int nl, nd, nb, i, prev;
-  struct huff_table cl;
-  int cl_values[sizeof (bitorder)];
-  int cl_maxval[8];
-  int cl_offset[8];
-  grub_uint8_t lens[DEFLATE_HCLEN_MAX];
-
-  nl = DEFLATE_HLIT_BASE + grub_png_get_bits (data, 5);
-  nd = DEFLATE_HDIST_BASE + grub_png_get_bits (data, 5);
-  nb = DEFLATE_HCLEN_BASE + grub_png_get_bits (data, 4);
-
-  if ((nl > DEFLATE_HLIT_MAX) || (nd > DEFLATE_HDIST_MAX) ||
-      (nb > DEFLATE_HCLEN_MAX))
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: too much data");
-
-  grub_png_init_huff_table (&cl, 8, cl_values, cl_maxval, cl_offset);
-
-  for (i = 0; i < nb; i++)
-    lens[bitorder[i]] = grub_png_get_bits (data, 3);
-
-  for (; i < DEFLATE_HCLEN_MAX; i++)
-    lens[bitorder[i]] = 0;
-
-  for (i = 0; i < DEFLATE_HCLEN_MAX; i++)
-    grub_png_insert_huff_item (&cl, i, lens[i]);
-
-  grub_png_build_huff_table (&cl);
-
-  grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
-			    data->code_values, data->code_maxval,
-			    data->code_offset);
+#ifndef GRUB_CPU_WORDS_BIGENDIAN
+#define R4 0
+#define G4 1
+#define B4 2
+#define A4 3
+#define R3 0
+#define G3 1
+#define B3 2
+#else
+#define R4 3
+#define G4 2
+#define B4 1
+#define A4 0
+#define R3 2
+#define G3 1
+#define B3 0
+#endif
 
-  grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
-			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
+/* Convert the unfiltered row IN to bitmap pixels at OUT.  Of 16-bit
+   samples only the upper 8 bits are kept.  */
+static void
+grub_png_convert_row (struct grub_png_data *data, const grub_uint8_t *in,
+		      grub_uint8_t *out)
+{
+  unsigned i;
+  int step = data->is_16bit + 1;
 
-  prev = 0;
-  for (i = 0; i < nl + nd; i++)
+  if (data->is_palette || (data->is_gray && data->bpp == 1))
     {
-      int n, code;
-      struct huff_table *ht;
+      if (data->color_bits < 8)
+	{
+	  int mask = (1 << data->color_bits) - 1;
+	  int shift = 8 - data->color_bits;
 
-      if (grub_errno)
-	return grub_errno;
+	  for (i = 0; i < data->image_width; i++, out += 3)
+	    {
+	      const grub_uint8_t *col = data->palette[(*in >> shift) & mask];
 
-      if (i < nl)
-	{
-	  ht = &data->code_table;
-	  code = i;
-	}
-      else
-	{
-	  ht = &data->dist_table;
-	  code = i - nl;
+	      out[R3] = col[0];
+	      out[G3] = col[1];
+	      out[B3] = col[2];
+	      shift -= data->color_bits;
+	      if (shift < 0)
+		{
+		  in++;
+		  shift += 8;
+		}
+	    }
+	  return;
 	}
 
-      n = grub_png_get_huff_code (data, &cl);
-      if (n < 16)
+      for (i = 0; i < data->image_width; i++, out += 3, in++)
 	{
-	  grub_png_insert_huff_item (ht, code, n);
-	  prev = n;
+	  out[R3] = data->palette[*in][0];
+	  out[G3] = data->palette[*in][1];
+	  out[B3] = data->palette[*in][2];
 	}
-      else if (n == 16)
-	{
-	  int c;
+      return;
+    }
 
-	  c = 3 + grub_png_get_bits (data, 2);
-	  while (c > 0)
-	    {
-	      grub_png_insert_huff_item (ht, code++, prev);
-	      i++;
-	      c--;
-	    }
-	  i--;
-	}
-      else if (n == 17)
-	i += 3 + grub_png_get_bits (data, 3) - 1;
+  if (data->is_gray)
+    {
+      if (data->is_alpha)
+	for (i = 0; i < data->image_width; i++, out += 4, in += data->bpp)
+	  {
+	    out[R4] = out[G4] = out[B4] = in[0];
+	    out[A4] = in[step];
+	  }
       else
-	i += 11 + grub_png_get_bits (data, 7) - 1;
+	for (i = 0; i < data->image_width; i++, out += 3, in += data->bpp)
+	  out[R3] = out[G3] = out[B3] = in[0];
+      return;
     }
 
-  grub_png_build_huff_table (&data->code_table);
-  grub_png_build_huff_table (&data->dist_table);
-
-  return grub_errno;
+  if (data->is_alpha)
+    for (i = 0; i < data->image_width; i++, out += 4, in += data->bpp)
+      {
+	out[R4] = in[0];
+	out[G4] = in[step];
+	out[B4] = in[2 * step];
+	out[A4] = in[3 * step];
+      }
+  else
+    for (i = 0; i < data->image_width; i++, out += 3, in += data->bpp)
+      {
+	out[R3] = in[0];
+	out[G3] = in[step];
+	out[B3] = in[2 * step];
+      }
 }
 
+/* Inflate the IDAT data a row at a time and unfilter and convert each
+   row straight into the bitmap.  */
 static grub_err_t
-grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
+grub_png_decode_image_data (struct grub_png_data *data)
 {
-  if (--data->raw_bytes < 0)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "image size overflown");
-
-  if (data->cur_column == 0)
-    {
-      if (n >= PNG_FILTER_VALUE_LAST)
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
+  struct grub_zlib_stream *stream;
+  grub_uint8_t *out, *cur, *up = NULL;
+  grub_size_t pitch;
+  unsigned y;
 
-      data->cur_filter = n;
-    }
-  else
-    *data->cur_rgb++ = n;
+  if (!data->row_bytes || !data->idat_len)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: no image data");
 
-  data->cur_column++;
-  if (data->cur_column == data->row_bytes + 1)
+  if (data->is_gray && data->bpp == 1)
     {
-      grub_uint8_t *blank_line = NULL;
-      grub_uint8_t *cur = data->cur_rgb - data->row_bytes;
-      grub_uint8_t *left = cur;
-      grub_uint8_t *up;
-
-      if (data->first_line)
-	{
-	  blank_line = grub_zalloc (data->row_bytes);
-	  if (blank_line == NULL)
-	    return grub_errno;
-
-	  up = blank_line;
-	}
-      else
-	up = cur - data->row_bytes;
-
-      switch (data->cur_filter)
-	{
-	case PNG_FILTER_VALUE_SUB:
-	  {
-	    int i;
-
-	    cur += data->bpp;
-	    for (i = data->bpp; i < data->row_bytes; i++, cur++, left++)
-	      *cur += *left;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_UP:
-	  {
-	    int i;
-
-	    for (i = 0; i < data->row_bytes; i++, cur++, up++)
-	      *cur += *up;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_AVG:
-	  {
-	    int i;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up >> 1;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++)
-	      *cur += ((int) *up + (int) *left) >> 1;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_PAETH:
-	  {
-	    int i;
-	    grub_uint8_t *upper_left = up;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++, upper_left++)
-	      {
-		int a, b, c, pa, pb, pc;
-
-                a = *left;
-                b = *up;
-                c = *upper_left;
-
-                pa = b - c;
-                pb = a - c;
-                pc = pa + pb;
-
-                if (pa < 0)
-                  pa = -pa;
-
-                if (pb < 0)
-                  pb = -pb;
-
-                if (pc < 0)
-                  pc = -pc;
+      /* Gray levels of 1 to 8 bits, scaled to 8 bits.  */
+      unsigned mul = 0xff / ((1U << data->color_bits) - 1);
 
-                *cur += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
-	      }
-	  }
-	}
-
-      grub_free (blank_line);
-
-      data->cur_column = 0;
-      data->first_line = 0;
+      for (y = 0; y < (1U << data->color_bits); y++)
+	data->palette[y][0] = data->palette[y][1] = data->palette[y][2]
+	  = y * mul;
     }
 
-  return grub_errno;
-}
+  stream = grub_zlib_stream_open (data->idat, data->idat_len);
+  if (!stream)
+    return grub_errno;
 
-static grub_err_t
-grub_png_read_dynamic_block (struct grub_png_data *data)
-{
-  while (grub_errno == 0)
+  out = (*data->bitmap)->data;
+  pitch = (grub_size_t) data->image_width * (data->is_alpha ? 4 : 3);
+  for (y = 0; y < data->image_height; y++, out += pitch)
     {
-      int n;
+      grub_uint8_t filter;
 
-      n = grub_png_get_huff_code (data, &data->code_table);
-      if (n < 256)
+      cur = data->direct ? out : data->rows + (y & 1) * data->row_bytes;
+      if (grub_zlib_stream_read (stream, &filter, 1) != 1
+	  || grub_zlib_stream_read (stream, cur, data->row_bytes)
+	  != data->row_bytes)
 	{
-	  data->slide[data->wp] = n;
-	  grub_png_output_byte (data, n);
-
-	  data->wp++;
-	  if (data->wp >= WSIZE)
-	    data->wp = 0;
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of data");
+	  break;
 	}
-      else if (n == 256)
+      if (grub_png_filter_row (data, filter, cur, up))
 	break;
-      else
-	{
-	  int len, dist, pos;
-
-	  n -= 257;
-	  len = cplens[n];
-	  if (cplext[n])
-	    len += grub_png_get_bits (data, cplext[n]);
-
-	  n = grub_png_get_huff_code (data, &data->dist_table);
-	  dist = cpdist[n];
-	  if (cpdext[n])
-	    dist += grub_png_get_bits (data, cpdext[n]);
-
-	  pos = data->wp - dist;
-	  if (pos < 0)
-	    pos += WSIZE;
-
-	  while (len > 0)
-	    {
-	      data->slide[data->wp] = data->slide[pos];
-	      grub_png_output_byte (data, data->slide[data->wp]);
-
-	      data->wp++;
-	      if (data->wp >= WSIZE)
-		data->wp = 0;
-
-	      pos++;
-	      if (pos >= WSIZE)
-		pos = 0;
-
-	      len--;
-	    }
-	}
+      if (!data->direct)
+	grub_png_convert_row (data, cur, out);
+      up = cur;
     }
 
+  grub_zlib_stream_close (stream);
   return grub_errno;
 }
 
+/* Append the LEN bytes of the current IDAT chunk to data->idat.  */
 static grub_err_t
-grub_png_decode_image_data (struct grub_png_data *data)
+grub_png_read_idat (struct grub_png_data *data, grub_uint32_t len)
 {
-  grub_uint8_t cmf, flg;
-  int final;
-
-  cmf = grub_png_get_byte (data);
-  flg = grub_png_get_byte (data);
-
-  if ((cmf & 0xF) != Z_DEFLATED)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		       "png: only support deflate compression method");
+  if (data->idat_len + len < data->idat_len)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "png: image data too large");
 
-  if (flg & Z_FLAG_DICT)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		       "png: dictionary not supported");
-
-  do
+  if (data->idat_len + len > data->idat_alloc)
     {
-      int block_type;
-
-      final = grub_png_get_bits (data, 1);
-      block_type = grub_png_get_bits (data, 2);
-
-      switch (block_type)
-	{
-	case INFLATE_STORED:
-	  {
-	    grub_uint16_t i, len;
-
-	    data->bit_count = 0;
-	    len = grub_png_get_byte (data);
-	    len += ((grub_uint16_t) grub_png_get_byte (data)) << 8;
-
-            /* Skip NLEN field.  */
-	    grub_png_get_byte (data);
-	    grub_png_get_byte (data);
-
-	    for (i = 0; i < len; i++)
-	      grub_png_output_byte (data, grub_png_get_byte (data));
-
-	    break;
-	  }
-
-	case INFLATE_FIXED:
-          grub_png_init_fixed_block (data);
-	  grub_png_read_dynamic_block (data);
-	  break;
-
-	case INFLATE_DYNAMIC:
-	  grub_png_init_dynamic_block (data);
-	  grub_png_read_dynamic_block (data);
-	  break;
+      grub_size_t alloc = data->idat_alloc ? data->idat_alloc : 0x10000;
+      grub_uint8_t *idat;
 
-	default:
-	  return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			     "png: unknown block type");
-	}
+      while (alloc < data->idat_len + len)
+	alloc *= 2;
+      idat = grub_realloc (data->idat, alloc);
+      if (!idat)
+	return grub_errno;
+      data->idat = idat;
+      data->idat_alloc = alloc;
     }
-  while ((!final) && (grub_errno == 0));
 
-  /* Skip adler checksum.  */
-  grub_png_get_dword (data);
+  if (grub_file_read (data->file, data->idat + data->idat_len, len)
+      != (grub_ssize_t) len)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of data");
+      return grub_errno;
+    }
+  data->idat_len += len;
 
   /* Skip crc checksum.  */
   grub_png_get_dword (data);
@@ -816,209 +496,6 @@ grub_png_decode_image_data (struct grub_png_data *data)
 static const grub_uint8_t png_magic[8] =
   { 0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0x0a };
 
-static void
-grub_png_convert_image (struct grub_png_data *data)
-{
-  unsigned i;
-  grub_uint8_t *d1, *d2;
-
-  d1 = (*data->bitmap)->data;
-  d2 = data->image_data + data->is_16bit;
-
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-#define R4 3
-#define G4 2
-#define B4 1
-#define A4 0
-#define R3 2
-#define G3 1
-#define B3 0
-#else
-#define R4 0
-#define G4 1
-#define B4 2
-#define A4 3
-#define R3 0
-#define G3 1
-#define B3 2
-#endif
-
-  if (data->color_bits <= 4)
-    {
-      grub_uint8_t palette[16][3];
-      grub_uint8_t *d1c, *d2c;
-      int shift;
-      int mask = (1 << data->color_bits) - 1;
-      unsigned j;
-      if (data->is_gray)
-	{
-	  /* Generic formula is
-	     (0xff * i) / ((1U << data->color_bits) - 1)
-	     but for allowed bit depth of 1, 2 and for it's
-	     equivalent to
-	     (0xff / ((1U << data->color_bits) - 1)) * i
-	     Precompute the multipliers to avoid division.
-	  */
-
-	  const grub_uint8_t multipliers[5] = { 0xff, 0xff, 0x55, 0x24, 0x11 };
-	  for (i = 0; i < (1U << data->color_bits); i++)
-	    {
-	      grub_uint8_t col = multipliers[data->color_bits] * i;
-	      palette[i][0] = col;
-	      palette[i][1] = col;
-	      palette[i][2] = col;
-	    }
-	}
-      else
-	grub_memcpy (palette, data->palette, 3 << data->color_bits);
-      d1c = d1;
-      d2c = d2;
-      for (j = 0; j < data->image_height; j++, d1c += data->image_width * 3,
-	   d2c += data->row_bytes)
-	{
-	  d1 = d1c;
-	  d2 = d2c;
-	  shift = 8 - data->color_bits;
-	  for (i = 0; i < data->image_width; i++, d1 += 3)
-	    {
-	      grub_uint8_t col = (d2[0] >> shift) & mask;
-	      d1[R3] = data->palette[col][2];
-	      d1[G3] = data->palette[col][1];
-	      d1[B3] = data->palette[col][0];
-	      shift -= data->color_bits;
-	      if (shift < 0)
-		{
-		  d2++;
-		  shift += 8;
-		}
-	    }
-	}
-      return;
-    }
-
-  if (data->is_palette)
-    {
-      for (i = 0; i < (data->image_width * data->image_height);
-	   i++, d1 += 3, d2++)
-	{
-	  d1[R3] = data->palette[d2[0]][2];
-	  d1[G3] = data->palette[d2[0]][1];
-	  d1[B3] = data->palette[d2[0]][0];
-	}
-      return;
-    }
-  
-  if (data->is_gray)
-    {
-      switch (data->bpp)
-	{
-	case 4:
-	  /* 16-bit gray with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[R4] = d2[3];
-	      d1[G4] = d2[3];
-	      d1[B4] = d2[3];
-	      d1[A4] = d2[1];
-	    }
-	  break;
-	case 2:
-	  if (data->is_16bit)
-	    /* 16-bit gray without alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R3] = d2[1];
-		  d1[G3] = d2[1];
-		  d1[B3] = d2[1];
-		}
-	    }
-	  else
-	    /* 8-bit gray with alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R4] = d2[1];
-		  d1[G4] = d2[1];
-		  d1[B4] = d2[1];
-		  d1[A4] = d2[0];
-		}
-	    }
-	  break;
-	  /* 8-bit gray without alpha.  */
-	case 1:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2++)
-	    {
-	      d1[R3] = d2[0];
-	      d1[G3] = d2[0];
-	      d1[B3] = d2[0];
-	    }
-	  break;
-	}
-      return;
-    }
-
-    {
-  /* Only copy the upper 8 bit.  */
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-      for (i = 0; i < (data->image_width * data->image_height * data->bpp >> 1);
-	   i++, d1++, d2 += 2)
-	*d1 = *d2;
-#else
-      switch (data->bpp)
-	{
-	  /* 16-bit with alpha.  */
-	case 8:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2+=8)
-	    {
-	      d1[0] = d2[7];
-	      d1[1] = d2[5];
-	      d1[2] = d2[3];
-	      d1[3] = d2[1];
-	    }
-	  break;
-	  /* 16-bit without alpha.  */
-	case 6:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2+=6)
-	    {
-	      d1[0] = d2[5];
-	      d1[1] = d2[3];
-	      d1[2] = d2[1];
-	    }
-	  break;
-	case 4:
-	  /* 8-bit with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[0] = d2[3];
-	      d1[1] = d2[2];
-	      d1[2] = d2[1];
-	      d1[3] = d2[0];
-	    }
-	  break;
-	  /* 8-bit without alpha.  */
-	case 3:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2 += 3)
-	    {
-	      d1[0] = d2[2];
-	      d1[1] = d2[1];
-	      d1[2] = d2[0];
-	    }
-	  break;
-	}
-#endif
-    }
-
-}
-
 static grub_err_t
 grub_png_decode_png (struct grub_png_data *data)
 {
@@ -1049,19 +526,11 @@ grub_png_decode_png (struct grub_png_data *data)
 	  break;
 
 	case PNG_CHUNK_IDAT:
-	  data->inside_idat = 1;
-	  data->idat_remain = len;
-	  data->bit_count = 0;
-
-	  grub_png_decode_image_data (data);
-
-	  data->inside_idat = 0;
+	  grub_png_read_idat (data, len);
 	  break;
 
 	case PNG_CHUNK_IEND:
-          if (data->image_data)
-            grub_png_convert_image (data);
-
+	  grub_png_decode_image_data (data);
 	  return grub_errno;
 
 	default:
@@ -1098,7 +567,8 @@ grub_video_reader_png (struct grub_video_bitmap **bitmap,
 
       grub_png_decode_png (data);
 
-      grub_free (data->image_data);
+      grub_free (data->rows);
+      grub_free (data->idat);
       grub_free (data);
     }
 
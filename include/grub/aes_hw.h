@@ -0,0 +1,43 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_AES_HW_HEADER
+#define GRUB_AES_HW_HEADER	1
+
+#include <grub/types.h>
+
+/* Return whether the CPU has the AES instructions and they may be used.  */
+int grub_aes_hw_supported (void);
+
+/* Encrypt the block IN into OUT with the ROUNDS + 1 round keys RK.  */
+void grub_aes_hw_encrypt (const grub_uint8_t *rk, unsigned rounds,
+			  grub_uint8_t *out, const grub_uint8_t *in);
+
+/* Decrypt the block IN into OUT with the ROUNDS + 1 round keys RK of the
+   equivalent inverse cipher.  */
+void grub_aes_hw_decrypt (const grub_uint8_t *rk, unsigned rounds,
+			  grub_uint8_t *out, const grub_uint8_t *in);
+
+/* The same for 4 consecutive blocks, interleaved so that the next block
+   goes through the AES unit while the previous one is still in it.  */
+void grub_aes_hw_encrypt4 (const grub_uint8_t *rk, unsigned rounds,
+			   grub_uint8_t *out, const grub_uint8_t *in);
+void grub_aes_hw_decrypt4 (const grub_uint8_t *rk, unsigned rounds,
+			   grub_uint8_t *out, const grub_uint8_t *in);
+
+#endif /* ! GRUB_AES_HW_HEADER */
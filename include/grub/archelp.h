@@ -47,6 +47,21 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Optional, for archives whose contents don't change under a disk:
+     with them, the names in the archive are read once and looked up in
+     an index kept until the disk cache is invalidated.  TELL returns
+     where the entry FIND_FILE reads next starts, SEEK makes FIND_FILE
+     read the entry starting at OFS next, and GET_DISK returns the disk
+     of the archive.  */
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t ofs);
+
+  grub_disk_t
+  (*get_disk) (struct grub_archelp_data *data);
 };
 
 grub_err_t
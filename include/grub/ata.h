@@ -85,6 +85,7 @@ enum grub_ata_commands
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
     GRUB_ATA_CMD_READ_SECTORS_DMA	= 0xc8,
     GRUB_ATA_CMD_READ_SECTORS_DMA_EXT	= 0x25,
+    GRUB_ATA_CMD_READ_FPDMA_QUEUED	= 0x60,
 
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
@@ -95,6 +96,7 @@ enum grub_ata_commands
     GRUB_ATA_CMD_WRITE_SECTORS_EXT	= 0x34,
     GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT	= 0x35,
     GRUB_ATA_CMD_WRITE_SECTORS_DMA	= 0xca,
+    GRUB_ATA_CMD_WRITE_FPDMA_QUEUED	= 0x61,
   };
 
 enum grub_ata_timeout_milliseconds
@@ -182,6 +184,9 @@ struct grub_ata
 
   int dma;
 
+  /* Depth of the native command queue, 0 without one.  */
+  unsigned ncq_depth;
+
   grub_size_t maxbuffer;
 
   int *present;
@@ -213,6 +218,11 @@ struct grub_ata_dev
 			   struct grub_disk_ata_pass_through_parms *parms,
 			   int spinup);
 
+  /* Optional.  Read or write SIZE sectors at SECTOR with several native
+     command queuing commands in flight.  */
+  grub_err_t (*readwrite_ncq) (struct grub_ata *ata, grub_disk_addr_t sector,
+			       grub_size_t size, char *buf, int rw);
+
   /* The next scsi device.  */
   struct grub_ata_dev *next;
 };
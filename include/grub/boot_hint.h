@@ -0,0 +1,88 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_BOOT_HINT_HEADER
+#define GRUB_BOOT_HINT_HEADER 1
+
+#include <grub/env.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+/* Boot hints remember on which device an earlier boot found something,
+   for example the filesystem with a given UUID, so that the next boot
+   looks there first.  They are the variables named hint_KIND_KEY, which
+   load_env restores from grubenv.  When "boot_hints" is 1, they are set
+   by what finds the devices, and the menu saves them to grubenv before
+   booting an entry.  A hint is only where to look first: what is found
+   there is checked like anything found by a full search.  */
+
+#define GRUB_BOOT_HINT_PREFIX	"hint_"
+
+/* Return the name of the variable for KEY of KIND, or NULL if KEY can't
+   be part of the name of a variable in grubenv.  */
+static inline char *
+grub_boot_hint_name (const char *kind, const char *key)
+{
+  const char *p;
+
+  for (p = key; *p; p++)
+    if (*p == '=' || *p == '\n' || *p == '\\' || *p == '#')
+      return NULL;
+  return grub_xasprintf (GRUB_BOOT_HINT_PREFIX "%s_%s", kind, key);
+}
+
+/* Return the device KEY of KIND was found on last time, or NULL.  */
+static inline const char *
+grub_boot_hint_get (const char *kind, const char *key)
+{
+  char *name = grub_boot_hint_name (kind, key);
+  const char *value;
+
+  if (! name)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  value = grub_env_get (name);
+  grub_free (name);
+  return value;
+}
+
+/* Remember that KEY of KIND was found on the device VALUE.  */
+static inline void
+grub_boot_hint_set (const char *kind, const char *key, const char *value)
+{
+  const char *enabled = grub_env_get ("boot_hints");
+  const char *old;
+  char *name;
+
+  if (! enabled || grub_strcmp (enabled, "1") != 0)
+    return;
+
+  name = grub_boot_hint_name (kind, key);
+  if (name)
+    {
+      old = grub_env_get (name);
+      if (! old || grub_strcmp (old, value) != 0)
+	grub_env_set (name, value);
+      grub_free (name);
+    }
+  grub_errno = GRUB_ERR_NONE;
+}
+
+#endif /* ! GRUB_BOOT_HINT_HEADER */
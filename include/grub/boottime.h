@@ -0,0 +1,89 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_BOOTTIME_HEADER
+#define GRUB_BOOTTIME_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+/* Boot phases timed by the profiler.  Nested calls of the same phase,
+   such as a RAID read issuing member reads, are counted once.  */
+enum grub_boot_phase
+  {
+    GRUB_BOOT_PHASE_DISK_READ,
+    GRUB_BOOT_PHASE_FILE_OPEN,
+    GRUB_BOOT_PHASE_MODULE_LOAD,
+    GRUB_BOOT_PHASE_SCRIPT,
+    GRUB_BOOT_PHASE_MENU,
+    GRUB_BOOT_PHASE_LOADER,
+    GRUB_BOOT_PHASE_COUNT
+  };
+
+struct grub_boot_phase_stats
+{
+  grub_uint64_t count;
+  /* In microseconds.  */
+  grub_uint64_t total;
+  grub_uint64_t max;
+} GRUB_PACKED;
+
+#define GRUB_BOOT_SPAN_LABEL_SIZE	16
+
+/* A labelled step on the boot timeline.  DEPTH is the number of steps
+   still open when it ended.  */
+struct grub_boot_span
+{
+  grub_uint64_t start;
+  grub_uint32_t duration;
+  grub_uint8_t phase;
+  grub_uint8_t depth;
+  grub_uint8_t reserved[2];
+  char label[GRUB_BOOT_SPAN_LABEL_SIZE];
+} GRUB_PACKED;
+
+#define GRUB_BOOT_SPANS	128
+
+/* Layout of the GrubBootPhases EFI variable: the header, NPHASES phase
+   records and NSPANS spans.  All times are in microseconds since GRUB's
+   timer was set up.  */
+#define GRUB_BOOT_PHASES_VERSION	1
+
+struct grub_boot_phases_header
+{
+  grub_uint32_t version;
+  grub_uint32_t nphases;
+  grub_uint32_t nspans;
+  grub_uint32_t dropped;
+  grub_uint64_t now;
+} GRUB_PACKED;
+
+extern struct grub_boot_phase_stats EXPORT_VAR(grub_boot_phases)[GRUB_BOOT_PHASE_COUNT];
+extern struct grub_boot_span EXPORT_VAR(grub_boot_spans)[GRUB_BOOT_SPANS];
+extern unsigned EXPORT_VAR(grub_boot_nspans);
+extern unsigned EXPORT_VAR(grub_boot_spans_dropped);
+
+grub_uint64_t EXPORT_FUNC(grub_boot_phase_begin) (enum grub_boot_phase phase);
+/* End a phase started at START.  A non-NULL LABEL also puts the step on
+   the timeline.  */
+void EXPORT_FUNC(grub_boot_phase_end) (enum grub_boot_phase phase,
+				       grub_uint64_t start, const char *label);
+/* Hand the profile over to the OS, on EFI as a volatile variable.  */
+void EXPORT_FUNC(grub_boot_phases_export) (void);
+
+#endif /* ! GRUB_BOOTTIME_HEADER */
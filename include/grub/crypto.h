@@ -117,6 +117,13 @@ typedef void (*gcry_cipher_stdecrypt_t) (void *c,
 					 const unsigned char *inbuf,
 					 unsigned int n);
 
+/* Type for the cipher_encrypt_blocks and cipher_decrypt_blocks functions,
+   which process N consecutive blocks at once.  */
+typedef void (*gcry_cipher_blocks_t) (void *c,
+				      unsigned char *outbuf,
+				      const unsigned char *inbuf,
+				      grub_size_t n);
+
 typedef struct gcry_cipher_oid_spec
 {
   const char *oid;
@@ -137,6 +144,9 @@ typedef struct gcry_cipher_spec
   gcry_cipher_decrypt_t decrypt;
   gcry_cipher_stencrypt_t stencrypt;
   gcry_cipher_stdecrypt_t stdecrypt;
+  /* Optional, used by ECB in place of encrypt and decrypt.  */
+  gcry_cipher_blocks_t encrypt_blocks;
+  gcry_cipher_blocks_t decrypt_blocks;
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
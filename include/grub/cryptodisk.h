@@ -54,8 +54,23 @@ typedef enum
 #define GRUB_CRYPTODISK_GF_BYTES (1U << GRUB_CRYPTODISK_GF_LOG_BYTES)
 #define GRUB_CRYPTODISK_MAX_KEYLEN 128
 
+/* Number of zones whose keys are kept expanded besides the current one.  */
+#define GRUB_CRYPTODISK_ZONE_KEYS 4
+
 struct grub_cryptodisk;
 
+/* The key of a zone other than the current one, with its own cipher
+   handles.  Switching to it swaps the handles with the device's.  */
+struct grub_cryptodisk_zone_key
+{
+  grub_uint64_t zone;
+  grub_crypto_cipher_handle_t cipher;
+  grub_crypto_cipher_handle_t secondary_cipher;
+  grub_uint8_t key[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_size_t keysize;
+  unsigned long last_use;
+};
+
 typedef gcry_err_code_t
 (*grub_cryptodisk_rekey_func_t) (struct grub_cryptodisk *dev,
 				 grub_uint64_t zoneno);
@@ -97,6 +112,8 @@ struct grub_cryptodisk
   grub_uint8_t rekey_key[64];
   grub_uint64_t last_rekey;
   int rekey_derived_size;
+  struct grub_cryptodisk_zone_key *zone_keys;
+  unsigned long zone_key_clock;
   grub_disk_addr_t partition_start;
 };
 typedef struct grub_cryptodisk *grub_cryptodisk_t;
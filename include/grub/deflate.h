@@ -27,4 +27,20 @@ grub_ssize_t
 grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 			 char *outbuf, grub_size_t outsize);
 
+/* Decompress an in-memory zlib stream piece by piece, for the callers that
+   can't or don't want to hold all of its output at once.  */
+struct grub_zlib_stream;
+
+struct grub_zlib_stream *
+grub_zlib_stream_open (const void *inbuf, grub_size_t insize);
+
+/* Return the number of bytes read, less than LEN at the end of the stream,
+   or -1 on error.  */
+grub_ssize_t
+grub_zlib_stream_read (struct grub_zlib_stream *stream, void *buf,
+		       grub_size_t len);
+
+void
+grub_zlib_stream_close (struct grub_zlib_stream *stream);
+
 #endif
@@ -39,5 +39,6 @@ grub_device_t EXPORT_FUNC(grub_device_open) (const char *name);
 grub_err_t EXPORT_FUNC(grub_device_close) (grub_device_t device);
 int EXPORT_FUNC(grub_device_iterate) (grub_device_iterate_hook_t hook,
 				      void *hook_data);
+void EXPORT_FUNC(grub_device_prefetch_all) (void);
 
 #endif /* ! GRUB_DEVICE_HEADER */
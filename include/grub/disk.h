@@ -49,6 +49,7 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_CBFSDISK_ID,
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
+    GRUB_DISK_DEVICE_NVME_ID,
   };
 
 struct grub_disk;
@@ -93,6 +94,12 @@ struct grub_disk_dev
   grub_err_t (*write) (struct grub_disk *disk, grub_disk_addr_t sector,
 		       grub_size_t size, const char *buf);
 
+  /* Start reading SIZE sectors from the sector SECTOR of the disk DISK
+     without waiting for the data, so that a later read of them completes
+     sooner.  Optional, and only a hint: it must not block.  */
+  grub_err_t (*prefetch) (struct grub_disk *disk, grub_disk_addr_t sector,
+			  grub_size_t size);
+
 #ifdef GRUB_UTIL
   struct grub_disk_memberlist *(*memberlist) (struct grub_disk *disk);
   const char * (*raidname) (struct grub_disk *disk);
@@ -107,6 +114,41 @@ extern grub_disk_dev_t EXPORT_VAR (grub_disk_dev_list);
 
 struct grub_partition;
 
+#define GRUB_DISK_STATS_BUCKETS	16
+
+/* I/O counters of a disk, kept across opens.  Times are in
+   microseconds.  */
+struct grub_disk_stats
+{
+  struct grub_disk_stats *next;
+  char *name;
+
+  /* grub_disk_read calls, as made by filesystems and partition maps.  */
+  grub_uint64_t reads;
+  grub_uint64_t bytes;
+  grub_uint64_t time;
+  grub_uint64_t errors;
+
+  /* Cache units found in and missing from the disk cache.  */
+  grub_uint64_t cache_hits;
+  grub_uint64_t cache_misses;
+
+  /* Reads passed to the driver.  */
+  grub_uint64_t dev_reads;
+  grub_uint64_t dev_bytes;
+  grub_uint64_t dev_time;
+  grub_uint64_t dev_max_time;
+  grub_uint64_t dev_errors;
+
+  /* Driver reads by size, bucket I holding those of up to 512 << I bytes,
+     and by latency, bucket I holding those of up to 1 << I microseconds.
+     The last buckets take all bigger ones.  */
+  grub_uint32_t dev_size_hist[GRUB_DISK_STATS_BUCKETS];
+  grub_uint32_t dev_time_hist[GRUB_DISK_STATS_BUCKETS];
+};
+
+extern struct grub_disk_stats *EXPORT_VAR(grub_disk_stats_list);
+
 typedef void (*grub_disk_read_hook_t) (grub_disk_addr_t sector,
 				       unsigned offset, unsigned length,
 				       void *data);
@@ -129,12 +171,34 @@ struct grub_disk
   /* Maximum number of sectors read divided by GRUB_DISK_CACHE_SIZE.  */
   unsigned int max_agglomerate;
 
+  /* Logarithm of the disk cache unit size in 512B units.  Chosen from
+     log_sector_size and max_agglomerate unless set by the driver.  */
+  unsigned int cache_bits;
+
   /* The id used by the disk cache manager.  */
   unsigned long id;
 
+  /* Set by drivers whose reads are about as cheap as a cache hit, so that
+     they don't go through the cache, and on the handles through which
+     cryptodisk and diskfilter read their sources, whose data is cached
+     above them.  */
+  int nocache;
+
+  /* Set by drivers of devices in memory to the address of the first
+     sector.  Implies NOCACHE, reads are copied straight from there.  */
+  char *mem;
+
+  /* Byte offset following the last read and the length of the sequential
+     run ending there.  Used to let streaming reads bypass the cache.  */
+  grub_uint64_t stream_next;
+  grub_uint64_t stream_length;
+
   /* The partition information. This is machine-specific.  */
   struct grub_partition *partition;
 
+  /* The I/O counters of this disk, or NULL.  */
+  struct grub_disk_stats *stats;
+
   /* Called when a sector was read. OFFSET is between 0 and
      the sector size minus 1, and LENGTH is between 0 and the sector size.  */
   grub_disk_read_hook_t read_hook;
@@ -160,21 +224,35 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
+/* The disk cache is set-associative: every cache unit hashes to one of
+   GRUB_DISK_CACHE_SETS sets and may live in any of its GRUB_DISK_CACHE_WAYS
+   slots.  The number of sets should be prime.  */
+#define GRUB_DISK_CACHE_WAYS	4
+#define GRUB_DISK_CACHE_SETS	257
+
 /* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+#define GRUB_DISK_CACHE_NUM	(GRUB_DISK_CACHE_SETS * GRUB_DISK_CACHE_WAYS)
 
-/* The size of a disk cache in 512B units. Must be at least as big as the
-   largest supported sector size, currently 16K.  */
+/* The default size of a disk cache in 512B units. Must be at least as big
+   as the largest supported sector size, currently 16K.  */
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* Bounds of the per-disk cache unit size, see cache_bits.  */
+#define GRUB_DISK_CACHE_MIN_BITS	3
+#define GRUB_DISK_CACHE_MAX_BITS	8
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
-/* This is called from the memory manager.  */
-void grub_disk_cache_invalidate_all (void);
+/* This is called from the memory manager and from testspeed.  */
+void EXPORT_FUNC(grub_disk_cache_invalidate_all) (void);
+
+/* Changes whenever grub_disk_cache_invalidate_all is called or a disk is
+   written to.  */
+extern unsigned long EXPORT_VAR(grub_disk_cache_generation);
 
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
@@ -199,6 +277,14 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 					grub_off_t offset,
 					grub_size_t size,
 					void *buf);
+void EXPORT_FUNC(grub_disk_prefetch) (grub_disk_t disk,
+				     grub_disk_addr_t sector,
+				     grub_off_t offset,
+				     grub_size_t size);
+const void *EXPORT_FUNC(grub_disk_map) (grub_disk_t disk,
+				       grub_disk_addr_t sector,
+				       grub_off_t offset,
+				       grub_size_t size);
 grub_err_t grub_disk_write (grub_disk_t disk,
 			    grub_disk_addr_t sector,
 			    grub_off_t offset,
@@ -240,7 +326,11 @@ struct grub_disk_cache
   unsigned long disk_id;
   grub_disk_addr_t sector;
   char *data;
+  /* Logarithm of the size of DATA in 512B units.  */
+  unsigned bits;
   int lock;
+  /* Value of the cache clock at the last use, for LRU replacement.  */
+  unsigned long age;
 };
 
 extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
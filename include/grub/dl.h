@@ -199,7 +199,9 @@ typedef struct grub_dl *grub_dl_t;
 
 grub_dl_t grub_dl_load_file (const char *filename);
 grub_dl_t EXPORT_FUNC(grub_dl_load) (const char *name);
+grub_err_t EXPORT_FUNC(grub_dl_load_list) (int num, char **names);
 grub_dl_t grub_dl_load_core (void *addr, grub_size_t size);
+grub_err_t grub_dl_defer_core (void *addr, grub_size_t size);
 grub_dl_t EXPORT_FUNC(grub_dl_load_core_noinit) (void *addr, grub_size_t size);
 int EXPORT_FUNC(grub_dl_unload) (grub_dl_t mod);
 void grub_dl_unload_unneeded (void);
@@ -216,6 +218,12 @@ void *
 grub_osdep_dl_memalign (grub_size_t align, grub_size_t size);
 void
 grub_dl_osdep_dl_free (void *ptr);
+/* Tell host debuggers and profilers about MOD, loaded from the SIZE bytes
+   of ELF image at EHDR, and that it is gone.  */
+void
+grub_dl_osdep_loaded (grub_dl_t mod, const void *ehdr, grub_size_t size);
+void
+grub_dl_osdep_unloaded (grub_dl_t mod);
 #endif
 
 static inline void
@@ -89,6 +89,16 @@
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define GRUB_EFI_BLOCK_IO2_GUID	\
+  { 0xa77b2472, 0xe282, 0x4e9f, \
+    { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } \
+  }
+
+#define GRUB_EFI_MP_SERVICES_PROTOCOL_GUID	\
+  { 0x3fdda605, 0xa76e, 0x4f46, \
+    { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } \
+  }
+
 #define GRUB_EFI_SERIAL_IO_GUID \
   { 0xbb25cf6f, 0xf1d4, 0x11d2, \
     { 0x9a, 0x0c, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0xfd } \
@@ -104,6 +114,16 @@
     { 0x9a, 0x2d, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } \
   }
 
+#define GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID \
+  { 0xbdc8e6af, 0xd9bc, 0x4379, \
+    { 0xa7, 0x2a, 0xe0, 0xc4, 0xe7, 0x5d, 0xae, 0x1c } \
+  }
+
+#define GRUB_EFI_HTTP_PROTOCOL_GUID \
+  { 0x7a59b29b, 0x910b, 0x4171, \
+    { 0x82, 0x42, 0xa8, 0x5a, 0x0d, 0xf2, 0x5b, 0x5b } \
+  }
+
 #define GRUB_EFI_DEVICE_PATH_GUID	\
   { 0x09576e91, 0x6d3f, 0x11d2, \
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
@@ -1664,6 +1684,127 @@ struct grub_efi_simple_network
 };
 typedef struct grub_efi_simple_network grub_efi_simple_network_t;
 
+struct grub_efi_service_binding
+{
+  grub_efi_status_t (*create_child) (struct grub_efi_service_binding *this,
+				     grub_efi_handle_t *child_handle);
+  grub_efi_status_t (*destroy_child) (struct grub_efi_service_binding *this,
+				      grub_efi_handle_t child_handle);
+};
+typedef struct grub_efi_service_binding grub_efi_service_binding_t;
+
+enum grub_efi_http_version
+  {
+    GRUB_EFI_HTTP_VERSION_10,
+    GRUB_EFI_HTTP_VERSION_11,
+    GRUB_EFI_HTTP_VERSION_UNSUPPORTED
+  };
+typedef enum grub_efi_http_version grub_efi_http_version_t;
+
+enum grub_efi_http_method
+  {
+    GRUB_EFI_HTTP_METHOD_GET,
+    GRUB_EFI_HTTP_METHOD_POST,
+    GRUB_EFI_HTTP_METHOD_PATCH,
+    GRUB_EFI_HTTP_METHOD_OPTIONS,
+    GRUB_EFI_HTTP_METHOD_CONNECT,
+    GRUB_EFI_HTTP_METHOD_HEAD,
+    GRUB_EFI_HTTP_METHOD_PUT,
+    GRUB_EFI_HTTP_METHOD_DELETE,
+    GRUB_EFI_HTTP_METHOD_TRACE
+  };
+typedef enum grub_efi_http_method grub_efi_http_method_t;
+
+/* Only the values GRUB looks at.  */
+enum grub_efi_http_status_code
+  {
+    GRUB_EFI_HTTP_STATUS_UNSUPPORTED_STATUS = 0,
+    GRUB_EFI_HTTP_STATUS_200_OK = 3,
+    GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT = 9,
+    GRUB_EFI_HTTP_STATUS_404_NOT_FOUND = 21
+  };
+typedef enum grub_efi_http_status_code grub_efi_http_status_code_t;
+
+struct grub_efi_httpv4_access_point
+{
+  grub_efi_boolean_t use_default_address;
+  grub_efi_ipv4_address_t local_address;
+  grub_efi_ipv4_address_t local_subnet;
+  grub_efi_uint16_t local_port;
+};
+typedef struct grub_efi_httpv4_access_point grub_efi_httpv4_access_point_t;
+
+struct grub_efi_http_config_data
+{
+  grub_efi_http_version_t http_version;
+  grub_efi_uint32_t timeout_millisec;
+  grub_efi_boolean_t local_address_is_ipv6;
+  union
+  {
+    grub_efi_httpv4_access_point_t *ipv4_node;
+    void *ipv6_node;
+  } access_point;
+};
+typedef struct grub_efi_http_config_data grub_efi_http_config_data_t;
+
+struct grub_efi_http_request_data
+{
+  grub_efi_http_method_t method;
+  grub_efi_char16_t *url;
+};
+typedef struct grub_efi_http_request_data grub_efi_http_request_data_t;
+
+struct grub_efi_http_response_data
+{
+  grub_efi_http_status_code_t status_code;
+};
+typedef struct grub_efi_http_response_data grub_efi_http_response_data_t;
+
+struct grub_efi_http_header
+{
+  grub_efi_char8_t *field_name;
+  grub_efi_char8_t *field_value;
+};
+typedef struct grub_efi_http_header grub_efi_http_header_t;
+
+struct grub_efi_http_message
+{
+  union
+  {
+    grub_efi_http_request_data_t *request;
+    grub_efi_http_response_data_t *response;
+  } data;
+  grub_efi_uintn_t header_count;
+  grub_efi_http_header_t *headers;
+  grub_efi_uintn_t body_length;
+  void *body;
+};
+typedef struct grub_efi_http_message grub_efi_http_message_t;
+
+struct grub_efi_http_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+  grub_efi_http_message_t *message;
+};
+typedef struct grub_efi_http_token grub_efi_http_token_t;
+
+struct grub_efi_http
+{
+  grub_efi_status_t (*get_mode_data) (struct grub_efi_http *this,
+				      grub_efi_http_config_data_t *config);
+  grub_efi_status_t (*configure) (struct grub_efi_http *this,
+				  grub_efi_http_config_data_t *config);
+  grub_efi_status_t (*request) (struct grub_efi_http *this,
+				grub_efi_http_token_t *token);
+  grub_efi_status_t (*cancel) (struct grub_efi_http *this,
+			       grub_efi_http_token_t *token);
+  grub_efi_status_t (*response) (struct grub_efi_http *this,
+				 grub_efi_http_token_t *token);
+  grub_efi_status_t (*poll) (struct grub_efi_http *this);
+};
+typedef struct grub_efi_http grub_efi_http_t;
+
 
 struct grub_efi_block_io
 {
@@ -1685,6 +1826,71 @@ struct grub_efi_block_io
 };
 typedef struct grub_efi_block_io grub_efi_block_io_t;
 
+struct grub_efi_block_io2_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t transaction_status;
+};
+typedef struct grub_efi_block_io2_token grub_efi_block_io2_token_t;
+
+struct grub_efi_block_io2
+{
+  grub_efi_block_io_media_t *media;
+  grub_efi_status_t (*reset) (struct grub_efi_block_io2 *this,
+			      grub_efi_boolean_t extended_verification);
+  grub_efi_status_t (*read_blocks_ex) (struct grub_efi_block_io2 *this,
+				       grub_efi_uint32_t media_id,
+				       grub_efi_lba_t lba,
+				       grub_efi_block_io2_token_t *token,
+				       grub_efi_uintn_t buffer_size,
+				       void *buffer);
+  grub_efi_status_t (*write_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_uint32_t media_id,
+					grub_efi_lba_t lba,
+					grub_efi_block_io2_token_t *token,
+					grub_efi_uintn_t buffer_size,
+					void *buffer);
+  grub_efi_status_t (*flush_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_block_io2_token_t *token);
+};
+typedef struct grub_efi_block_io2 grub_efi_block_io2_t;
+
+typedef void (*grub_efi_ap_procedure_t) (void *buffer);
+
+struct grub_efi_mp_services
+{
+  grub_efi_status_t (*get_number_of_processors) (struct grub_efi_mp_services *this,
+						 grub_efi_uintn_t *number,
+						 grub_efi_uintn_t *enabled);
+  grub_efi_status_t (*get_processor_info) (struct grub_efi_mp_services *this,
+					   grub_efi_uintn_t number,
+					   void *info);
+  grub_efi_status_t (*startup_all_aps) (struct grub_efi_mp_services *this,
+					grub_efi_ap_procedure_t procedure,
+					grub_efi_boolean_t single_thread,
+					grub_efi_event_t wait_event,
+					grub_efi_uintn_t timeout,
+					void *argument,
+					grub_efi_uintn_t **failed_cpu_list);
+  grub_efi_status_t (*startup_this_ap) (struct grub_efi_mp_services *this,
+					grub_efi_ap_procedure_t procedure,
+					grub_efi_uintn_t number,
+					grub_efi_event_t wait_event,
+					grub_efi_uintn_t timeout,
+					void *argument,
+					grub_efi_boolean_t *finished);
+  grub_efi_status_t (*switch_bsp) (struct grub_efi_mp_services *this,
+				   grub_efi_uintn_t number,
+				   grub_efi_boolean_t enable_old_bsp);
+  grub_efi_status_t (*enable_disable_ap) (struct grub_efi_mp_services *this,
+					  grub_efi_uintn_t number,
+					  grub_efi_boolean_t enable,
+					  grub_efi_uint32_t *health_flag);
+  grub_efi_status_t (*who_am_i) (struct grub_efi_mp_services *this,
+				 grub_efi_uintn_t *number);
+};
+typedef struct grub_efi_mp_services grub_efi_mp_services_t;
+
 #if (GRUB_TARGET_SIZEOF_VOID_P == 4) || defined (__ia64__) \
   || defined (__aarch64__) || defined (__MINGW64__) || defined (__CYGWIN__)
 
@@ -26,6 +26,7 @@
 grub_efi_handle_t
 EXPORT_FUNC(grub_efidisk_get_device_handle) (grub_disk_t disk);
 char *EXPORT_FUNC(grub_efidisk_get_device_name) (grub_efi_handle_t *handle);
+grub_size_t EXPORT_FUNC(grub_efidisk_get_io_align) (grub_disk_t disk);
 
 void grub_efidisk_init (void);
 void grub_efidisk_fini (void);
@@ -0,0 +1,37 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_EFI_HTTP_HEADER
+#define GRUB_EFI_HTTP_HEADER	1
+
+#include <grub/file.h>
+
+/* A transfer run by the firmware's HTTP protocol instead of GRUB's own
+   TCP/IP stack.  */
+struct grub_efihttp;
+
+/* Request FILENAME from OFFSET on.  Return GRUB_ERR_NET_NO_CARD without
+   setting an error when the firmware can't do it, so that the caller falls
+   back to its own stack.  */
+grub_err_t grub_efihttp_open (grub_file_t file, const char *filename,
+			      grub_off_t offset, struct grub_efihttp **out);
+/* Queue more of the body in the packets of FILE.  */
+grub_err_t grub_efihttp_fill (grub_file_t file, struct grub_efihttp *h);
+void grub_efihttp_close (struct grub_efihttp *h);
+
+#endif /* ! GRUB_EFI_HTTP_HEADER */
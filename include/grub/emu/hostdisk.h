@@ -25,9 +25,12 @@
 #include <sys/types.h>
 #include <grub/emu/hostfile.h>
 
+/* Open the device holding SECTOR of DISK.  SECTOR is updated to be
+   relative to the returned descriptor, and MAX is set to the number of
+   sectors which may be accessed through it from there.  */
 grub_util_fd_t
-grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags,
-			  grub_disk_addr_t *max);
+grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t *sector,
+			  int flags, grub_disk_addr_t *max);
 
 void grub_util_biosdisk_init (const char *dev_map);
 void grub_util_biosdisk_fini (void);
@@ -88,6 +91,9 @@ struct grub_util_hostdisk_data
   grub_util_fd_t fd;
   int is_disk;
   int device_map;
+  /* Read-only mapping of an image file and its size, or NULL.  */
+  void *map;
+  grub_uint64_t map_size;
 };
 
 void grub_host_init (void);
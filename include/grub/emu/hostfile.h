@@ -42,6 +42,11 @@ ssize_t
 EXPORT_FUNC(grub_util_fd_read) (grub_util_fd_t fd, char *buf, size_t len);
 ssize_t
 EXPORT_FUNC(grub_util_fd_write) (grub_util_fd_t fd, const char *buf, size_t len);
+ssize_t
+grub_util_fd_pread (grub_util_fd_t fd, char *buf, size_t len,
+		    grub_uint64_t off);
+void
+grub_util_fd_advise (grub_util_fd_t fd, grub_uint64_t off, grub_uint64_t len);
 
 grub_util_fd_t
 EXPORT_FUNC(grub_util_fd_open) (const char *os_dev, int flags);
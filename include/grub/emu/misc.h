@@ -30,6 +30,7 @@
 #include <grub/util/misc.h>
 
 extern int verbosity;
+extern int grub_emu_perf_map;
 extern const char *program_name;
 
 void grub_init_all (void);
@@ -21,14 +21,23 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
+/* The initial size of a hash table.  Tables double as they fill up.  */
+#define	HASHSZ	16
 
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /* A hash table for variables, HASHSZ << n buckets, allocated on the
+     first insertion.  */
+  struct grub_env_var **vars;
+  unsigned int size;
+  unsigned int count;
+
+  /* Variables of the previous context aren't copied in here but looked
+     up there, and only copied when they are changed.  Exported ones are
+     visible, or all of them if EXPORT_ALL is set.  A variable with a
+     NULL value hides one of the same name from the previous context.  */
+  int export_all;
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
@@ -43,4 +52,6 @@ struct grub_env_sorted_var
 
 extern struct grub_env_context *EXPORT_VAR(grub_current_context);
 
+void EXPORT_FUNC(grub_env_free_context) (struct grub_env_context *context);
+
 #endif /* ! GRUB_ENV_PRIVATE_HEADER */
@@ -105,6 +105,16 @@ int grub_fdt_add_subnode (void *fdt, unsigned int parentoffset,
 
 int grub_fdt_set_prop (void *fdt, unsigned int nodeoffset, const char *name,
 		      const void *val, grub_uint32_t len);
+
+struct grub_fdt_prop
+{
+  const char *name;
+  const void *val;
+  grub_uint32_t len;
+};
+
+int grub_fdt_set_props (void *fdt, unsigned int nodeoffset,
+			const struct grub_fdt_prop *props, unsigned int n);
 #define grub_fdt_set_prop32(fdt, nodeoffset, name, val)	\
 ({ \
   grub_uint32_t _val = grub_cpu_to_be32(val); \
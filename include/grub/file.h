@@ -25,6 +25,9 @@
 #include <grub/fs.h>
 #include <grub/disk.h>
 
+/* Enough for the headers the compression filters check.  */
+#define GRUB_FILE_HEAD_SIZE	64
+
 /* File description.  */
 struct grub_file
 {
@@ -60,21 +63,41 @@ struct grub_file
 
   /* Caller-specific data passed to the read hook.  */
   void *read_hook_data;
+
+  /* The first HEAD_LEN bytes of the file, read once before the filters
+     run.  Reads below HEAD_LEN are served from here, so that the filters
+     probing their magic and seeking back to 0 cause no device I/O.  */
+  grub_uint8_t head[GRUB_FILE_HEAD_SIZE];
+  grub_size_t head_len;
 };
 typedef struct grub_file *grub_file_t;
 
 extern grub_disk_read_hook_t EXPORT_VAR(grub_file_progress_hook);
 
+/* Called by the progress indicator, at most a few times a second, with the
+   bytes of FILE read so far.  Used by graphical menus to draw a progress
+   bar.  */
+extern void (*EXPORT_VAR (grub_file_progress_notify_hook)) (grub_file_t file);
+
+/* Called, when set, for files named by a path before their filesystem is
+   probed.  Return 1 after opening FILE, named NAME, some other way, or 0
+   to have it looked up in the filesystem.  Set by the pin module.  */
+extern int (*EXPORT_VAR (grub_file_pinned_open)) (grub_file_t file,
+						  const char *name);
+
 /* Filters with lower ID are executed first.  */
 typedef enum grub_file_filter_id
   {
+    GRUB_FILE_FILTER_PRELOAD,
     GRUB_FILE_FILTER_PUBKEY,
     GRUB_FILE_FILTER_GZIO,
     GRUB_FILE_FILTER_XZIO,
     GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_ZSTDIO,
+    GRUB_FILE_FILTER_LZ4IO,
     GRUB_FILE_FILTER_MAX,
     GRUB_FILE_FILTER_COMPRESSION_FIRST = GRUB_FILE_FILTER_GZIO,
-    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZ4IO,
   } grub_file_filter_id_t;
 
 typedef grub_file_t (*grub_file_filter_t) (grub_file_t in, const char *filename);
@@ -122,6 +145,17 @@ grub_file_filter_disable_all (void)
     grub_file_filters_enabled[id] = 0;
 }
 
+extern int EXPORT_VAR(grub_file_verify_deferred);
+
+/* The data of the next file opened is only relied on once booting, so its
+   signature, if one is required, may be checked while it is read instead of
+   before grub_file_open returns.  */
+static inline void
+grub_file_filter_defer_verification (void)
+{
+  grub_file_verify_deferred = 1;
+}
+
 static inline void
 grub_file_filter_disable_pubkey (void)
 {
@@ -134,6 +168,8 @@ char *EXPORT_FUNC(grub_file_get_device_name) (const char *name);
 grub_file_t EXPORT_FUNC(grub_file_open) (const char *name);
 grub_ssize_t EXPORT_FUNC(grub_file_read) (grub_file_t file, void *buf,
 					  grub_size_t len);
+void EXPORT_FUNC(grub_file_prefetch) (grub_file_t file, grub_off_t offset,
+				      grub_size_t len);
 grub_off_t EXPORT_FUNC(grub_file_seek) (grub_file_t file, grub_off_t offset);
 grub_err_t EXPORT_FUNC(grub_file_close) (grub_file_t file);
 
@@ -158,6 +194,22 @@ grub_file_seekable (const grub_file_t file)
   return !file->not_easily_seekable;
 }
 
+/* Keep the WINDOW bytes following the current offset of FILE prefetched.
+   *END holds how far prefetching was already requested.  */
+static inline void
+grub_file_prefetch_ahead (grub_file_t file, grub_off_t *end,
+			  grub_size_t window)
+{
+  grub_off_t start = grub_file_tell (file);
+
+  if (start + window / 2 < *end)
+    return;
+  if (start < *end)
+    start = *end;
+  *end = grub_file_tell (file) + window;
+  grub_file_prefetch (file, start, *end - start);
+}
+
 grub_file_t
 grub_file_offset_open (grub_file_t parent, grub_off_t start,
 		       grub_off_t size);
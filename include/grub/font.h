@@ -45,6 +45,11 @@ struct grub_font
   grub_uint32_t num_chars;
   struct char_index_entry *char_index;
   grub_uint16_t *bmp_idx;
+  /* The DATA section, if it was small enough to read in whole at load
+     time; glyphs are then decoded from memory and FILE is closed.  */
+  grub_uint8_t *data;
+  grub_off_t data_offset;
+  grub_size_t data_size;
 };
 
 /* Font type used to access font functions.  */
@@ -67,6 +67,11 @@ struct grub_fs
   /* Read LEN bytes data from FILE into BUF.  */
   grub_ssize_t (*read) (struct grub_file *file, char *buf, grub_size_t len);
 
+  /* Tell the underlying device that LEN bytes at OFFSET of FILE are going
+     to be read soon.  Optional.  */
+  void (*prefetch) (struct grub_file *file, grub_off_t offset,
+		    grub_size_t len);
+
   /* Close the file FILE.  */
   grub_err_t (*close) (struct grub_file *file);
 
@@ -102,14 +107,25 @@ typedef struct grub_fs *grub_fs_t;
 /* This is special, because block lists are not files in usual sense.  */
 extern struct grub_fs grub_fs_blocklist;
 
-/* This hook is used to automatically load filesystem modules.
+/* This hook is used to automatically load filesystem modules for DEVICE.
    If this hook loads a module, return non-zero. Otherwise return zero.
    The newly loaded filesystem is assumed to be inserted into the head of
    the linked list GRUB_FS_LIST through the function grub_fs_register.  */
-typedef int (*grub_fs_autoload_hook_t) (void);
+typedef int (*grub_fs_autoload_hook_t) (grub_device_t device);
 extern grub_fs_autoload_hook_t EXPORT_VAR(grub_fs_autoload_hook);
 extern grub_fs_t EXPORT_VAR (grub_fs_list);
 
+/* Declare that filesystems of this module start with the bytes MAGIC,
+   given in hex, at byte OFFSET of the device.  Both must be literals since
+   they are only collected into fssig.lst at build time, which lets the
+   autoloader skip modules that can't recognize a device.  A module with
+   several signatures matches if any of them does.  */
+#ifdef GRUB_LST_GENERATOR
+#define GRUB_FS_SIGNATURE(offset, magic) FS_SIGNATURE_LIST_MARKER (offset, magic)
+#else
+#define GRUB_FS_SIGNATURE(offset, magic)
+#endif
+
 #ifndef GRUB_LST_GENERATOR
 static inline void
 grub_fs_register (grub_fs_t fs)
@@ -118,9 +134,22 @@ grub_fs_register (grub_fs_t fs)
 }
 #endif
 
+/* Mounts handed back by drivers when an operation is done, so that the
+   next operation on the same disk takes them instead of reading and
+   checking the superblock again.  A mount is only ever used by whoever
+   took it, and they are all dropped whenever the disk cache is.  */
+void *EXPORT_FUNC(grub_fs_mount_cache_get) (grub_fs_t fs,
+					    struct grub_disk *disk);
+void EXPORT_FUNC(grub_fs_mount_cache_put) (grub_fs_t fs,
+					   struct grub_disk *disk, void *data,
+					   void (*free_data) (void *data));
+/* Drop the mounts of FS, or all of them if FS is NULL.  */
+void EXPORT_FUNC(grub_fs_mount_cache_flush) (grub_fs_t fs);
+
 static inline void
 grub_fs_unregister (grub_fs_t fs)
 {
+  grub_fs_mount_cache_flush (fs);
   grub_list_remove (GRUB_AS_LIST (fs));
 }
 
@@ -73,11 +73,41 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* What grub_fshelp_find_file_cached needs to remember the files found in
+   the directories of a filesystem on DISK.  FS_ID tells apart filesystems
+   that were on the same disk at different times, like a serial number.
+   NODE_KEY returns a number naming NODE within the filesystem, like its
+   inode number, and KEY_NODE makes a new malloc'ed node for the file KEY
+   names on the filesystem of the node DIR.  */
+struct grub_fshelp_dcache
+{
+  grub_disk_t disk;
+  grub_uint64_t fs_id;
+  grub_uint64_t (*node_key) (grub_fshelp_node_t node);
+  grub_fshelp_node_t (*key_node) (grub_fshelp_node_t dir, grub_uint64_t key);
+};
+
+/* The same as grub_fshelp_find_file, but the names looked up in each
+   directory and what they resolved to, if anything, are kept until the
+   disk cache is invalidated, so that looking up paths under the same
+   directories again doesn't scan them.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   const struct grub_fshelp_dcache *dcache);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
    blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+   blocks have a size of LOG2BLOCKSIZE (in log2).  Blocks that follow
+   each other on disk are read with a single disk read.  */
 grub_ssize_t
 EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_disk_read_hook_t read_hook,
@@ -88,4 +118,20 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* The same, but GET_RUN also stores in *RUN how many blocks from BLOCK on
+   follow each other on disk, or are all holes, so that they are read with
+   a single disk read.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_runs) (grub_disk_t disk,
+					 grub_fshelp_node_t node,
+					 grub_disk_read_hook_t read_hook,
+					 void *read_hook_data,
+					 grub_off_t pos, grub_size_t len,
+					 char *buf,
+					 grub_disk_addr_t (*get_run) (grub_fshelp_node_t node,
+								      grub_disk_addr_t block,
+								      grub_disk_addr_t *run),
+					 grub_off_t filesize, int log2blocksize,
+					 grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
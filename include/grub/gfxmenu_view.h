@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/err.h>
+#include <grub/file.h>
 #include <grub/menu.h>
 #include <grub/font.h>
 #include <grub/gfxwidgets.h>
@@ -45,6 +46,15 @@ grub_err_t grub_gui_recreate_box (grub_gfxmenu_box_t *boxptr,
 
 void grub_gfxmenu_view_draw (grub_gfxmenu_view_t view);
 
+/* Free the backgrounds kept scaled for earlier views.  */
+void grub_gfxmenu_free_background_cache (void);
+
+/* Free the text of the last theme file read.  */
+void grub_gfxmenu_free_theme_cache (void);
+
+/* Free the layouts kept for the strings drawn last.  */
+void grub_gfxmenu_free_layout_cache (void);
+
 void
 grub_gfxmenu_redraw_menu (grub_gfxmenu_view_t view);
 
@@ -60,6 +70,8 @@ grub_gfxmenu_clear_timeout (void *data);
 void 
 grub_gfxmenu_print_timeout (int timeout, void *data);
 void
+grub_gfxmenu_print_progress (grub_file_t file);
+void
 grub_gfxmenu_set_chosen_entry (int entry, void *data);
 
 grub_err_t grub_font_draw_string (const char *str,
@@ -95,8 +107,9 @@ struct grub_gfxmenu_view
   grub_video_rgba_color_t title_color;
   grub_video_rgba_color_t message_color;
   grub_video_rgba_color_t message_bg_color;
-  struct grub_video_bitmap *raw_desktop_image;
+  /* Owned by the scaled background cache in view.c.  */
   struct grub_video_bitmap *scaled_desktop_image;
+  char *desktop_image_path;
   grub_video_bitmap_selection_method_t desktop_image_scale_method;
   grub_video_bitmap_h_align_t desktop_image_h_align;
   grub_video_bitmap_v_align_t desktop_image_v_align;
@@ -31,6 +31,10 @@
    status changes.  */
 #define GRUB_GFXMENU_TIMEOUT_COMPONENT_ID "__timeout__"
 
+/* The component ID identifying GUI components showing how far the file
+   being loaded has been read.  */
+#define GRUB_GFXMENU_PROGRESS_COMPONENT_ID "__progress__"
+
 typedef struct grub_gui_component *grub_gui_component_t;
 typedef struct grub_gui_container *grub_gui_container_t;
 typedef struct grub_gui_list *grub_gui_list_t;
@@ -69,6 +73,13 @@ struct grub_gui_list_ops
                          grub_gfxmenu_view_t view);
   void (*refresh_list) (void *self,
                         grub_gfxmenu_view_t view);
+  /* Store in RECTS the screen areas to repaint for the current selection,
+     given what was painted last, and return how many there are (at most
+     2).  Return -1 if the whole list has to be repainted.  With AGAIN set,
+     return the same as the previous call, for the second pass of a double
+     repaint.  */
+  int (*get_selection_damage) (void *self, grub_video_rect_t *rects,
+			       int again);
 };
 
 struct grub_gui_progress_ops
@@ -87,28 +98,30 @@ struct grub_gfxmenu_timeout_notify
 };
 
 extern struct grub_gfxmenu_timeout_notify *grub_gfxmenu_timeout_notifications;
+extern struct grub_gfxmenu_timeout_notify *grub_gfxmenu_progress_notifications;
 
 static inline grub_err_t
-grub_gfxmenu_timeout_register (grub_gui_component_t self,
-			       grub_gfxmenu_set_state_t set_state)
+grub_gfxmenu_notify_register (struct grub_gfxmenu_timeout_notify **list,
+			      grub_gui_component_t self,
+			      grub_gfxmenu_set_state_t set_state)
 {
   struct grub_gfxmenu_timeout_notify *ne = grub_malloc (sizeof (*ne));
   if (!ne)
     return grub_errno;
   ne->set_state = set_state;
   ne->self = self;
-  ne->next = grub_gfxmenu_timeout_notifications;
-  grub_gfxmenu_timeout_notifications = ne;
+  ne->next = *list;
+  *list = ne;
   return GRUB_ERR_NONE;
 }
 
 static inline void
-grub_gfxmenu_timeout_unregister (grub_gui_component_t self)
+grub_gfxmenu_notify_unregister (struct grub_gfxmenu_timeout_notify **list,
+				grub_gui_component_t self)
 {
   struct grub_gfxmenu_timeout_notify **p, *q;
 
-  for (p = &grub_gfxmenu_timeout_notifications, q = *p;
-       q; p = &(q->next), q = q->next)
+  for (p = list, q = *p; q; p = &(q->next), q = q->next)
     if (q->self == self)
       {
 	*p = q->next;
@@ -117,6 +130,34 @@ grub_gfxmenu_timeout_unregister (grub_gui_component_t self)
       }
 }
 
+static inline grub_err_t
+grub_gfxmenu_timeout_register (grub_gui_component_t self,
+			       grub_gfxmenu_set_state_t set_state)
+{
+  return grub_gfxmenu_notify_register (&grub_gfxmenu_timeout_notifications,
+				       self, set_state);
+}
+
+static inline void
+grub_gfxmenu_timeout_unregister (grub_gui_component_t self)
+{
+  grub_gfxmenu_notify_unregister (&grub_gfxmenu_timeout_notifications, self);
+}
+
+static inline grub_err_t
+grub_gfxmenu_progress_register (grub_gui_component_t self,
+				grub_gfxmenu_set_state_t set_state)
+{
+  return grub_gfxmenu_notify_register (&grub_gfxmenu_progress_notifications,
+				       self, set_state);
+}
+
+static inline void
+grub_gfxmenu_progress_unregister (grub_gui_component_t self)
+{
+  grub_gfxmenu_notify_unregister (&grub_gfxmenu_progress_notifications, self);
+}
+
 typedef signed grub_fixed_signed_t;
 #define GRUB_FIXED_1 0x10000
 
@@ -90,8 +90,15 @@ struct grub_hfsplus_file
   struct grub_hfsplus_compress_index *compress_index;
   grub_uint32_t cbuf_block;
   grub_uint32_t compress_index_size;
+  /* Extent records found in the extent overflow tree so far, 8 extents
+     each in file order.  Only kept for the files owned by the mount.  */
+  struct grub_hfsplus_extent *overflow;
+  grub_size_t overflow_records;
 };
 
+/* Number of B+ tree nodes kept in memory per tree.  */
+#define GRUB_HFSPLUS_NODE_CACHE	8
+
 struct grub_hfsplus_btree
 {
   grub_uint32_t root;
@@ -99,6 +106,13 @@ struct grub_hfsplus_btree
 
   /* Catalog file node.  */
   struct grub_hfsplus_file file;
+
+  /* Copies of the last used nodes.  */
+  char *cache;
+  grub_uint64_t cache_node[GRUB_HFSPLUS_NODE_CACHE];
+  grub_uint32_t cache_used[GRUB_HFSPLUS_NODE_CACHE];
+  unsigned int cache_count;
+  grub_uint32_t cache_tick;
 };
 
 /* Information about a "mounted" HFS+ filesystem.  */
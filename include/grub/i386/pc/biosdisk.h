@@ -24,6 +24,8 @@
 
 #define GRUB_BIOSDISK_FLAG_LBA	1
 #define GRUB_BIOSDISK_FLAG_CDROM 2
+/* The BIOS takes flat 64-bit buffer addresses (EDD 3.0).  */
+#define GRUB_BIOSDISK_FLAG_FLAT	4
 
 #define GRUB_BIOSDISK_CDTYPE_NO_EMUL	0
 #define GRUB_BIOSDISK_CDTYPE_1_2_M	1
@@ -106,4 +108,16 @@ struct grub_biosdisk_dap
   grub_uint64_t block;
 } GRUB_PACKED;
 
+/* Disk Address Packet with a flat buffer address (EDD 3.0).  BUFFER must be
+   0xFFFF:0xFFFF for FLAT_BUFFER to be used.  */
+struct grub_biosdisk_dap64
+{
+  grub_uint8_t length;
+  grub_uint8_t reserved;
+  grub_uint16_t blocks;
+  grub_uint32_t buffer;
+  grub_uint64_t block;
+  grub_uint64_t flat_buffer;
+} GRUB_PACKED;
+
 #endif /* ! GRUB_BIOSDISK_MACHINE_HEADER */
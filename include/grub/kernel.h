@@ -28,7 +28,9 @@ enum
   OBJ_TYPE_MEMDISK,
   OBJ_TYPE_CONFIG,
   OBJ_TYPE_PREFIX,
-  OBJ_TYPE_PUBKEY
+  OBJ_TYPE_PUBKEY,
+  /* A module which is only loaded when something needs it.  */
+  OBJ_TYPE_DEFERRED_ELF
 };
 
 /* The module header.  */
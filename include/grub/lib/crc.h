@@ -21,5 +21,7 @@
 #define GRUB_CRC_H	1
 
 grub_uint32_t grub_getcrc32c (grub_uint32_t crc, const void *buf, int size);
+/* CRC-32 with the IEEE 802.3 polynomial, as used by GPT and zlib.  */
+grub_uint32_t grub_getcrc32 (grub_uint32_t crc, const void *buf, int size);
 
 #endif /* ! GRUB_CRC_H */
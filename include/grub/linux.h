@@ -16,9 +16,18 @@ grub_initrd_init (int argc, char *argv[],
 grub_size_t
 grub_get_initrd_size (struct grub_linux_initrd_context *ctx);
 
+grub_size_t
+grub_get_initrd_io_align (struct grub_linux_initrd_context *ctx);
+
 void
 grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx);
 
+grub_ssize_t
+grub_linux_file_read (grub_file_t file, void *buf, grub_size_t len);
+
+void
+grub_initrd_cache_free (void);
+
 grub_err_t
 grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 		  char *argv[], void *target);
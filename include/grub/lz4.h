@@ -0,0 +1,32 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_LZ4_HEADER
+#define GRUB_LZ4_HEADER 1
+
+#include <grub/types.h>
+
+/* Decompress the raw LZ4 block of SRCSIZE bytes at SRC to DEST, letting
+   matches reach up to PREFIX bytes of earlier output before DEST.  Return
+   the size of the output, or -1 when the block is corrupted or needs more
+   than DESTSIZE bytes.  */
+grub_ssize_t
+grub_lz4_decompress_block (const void *src, grub_size_t srcsize, void *dest,
+			   grub_size_t destsize, grub_size_t prefix);
+
+#endif
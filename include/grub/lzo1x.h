@@ -0,0 +1,31 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_LZO1X_HEADER
+#define GRUB_LZO1X_HEADER 1
+
+#include <grub/types.h>
+
+/* Decompress the LZO1X block of SRCSIZE bytes at SRC to DEST.  Return the
+   size of the output, or -1 when the block is corrupted, doesn't end
+   exactly at SRCSIZE or needs more than DESTSIZE bytes.  */
+grub_ssize_t
+grub_lzo1x_decompress (const void *src, grub_size_t srcsize, void *dest,
+		       grub_size_t destsize);
+
+#endif
@@ -71,6 +71,16 @@ struct grub_menu
 
   /* The list of menu entries.  */
   grub_menu_entry_t entry_list;
+
+  /* An entry at or near the end of ENTRY_LIST to start looking for the
+     end from when appending, or NULL.  */
+  grub_menu_entry_t last_entry;
+
+  /* The entries by index, made by grub_menu_get_entry for the first
+     INDEX_SIZE entries.  Entries are only ever appended, so it stays valid
+     until SIZE changes.  */
+  grub_menu_entry_t *index;
+  int index_size;
 };
 typedef struct grub_menu *grub_menu_t;
 
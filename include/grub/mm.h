@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/symbol.h>
+#include <grub/err.h>
 #include <config.h>
 
 #ifndef NULL
@@ -29,12 +30,52 @@
 #endif
 
 void grub_mm_init_region (void *addr, grub_size_t size);
+
+/* Called when the heap is exhausted to add at least SIZE bytes of free
+   space with grub_mm_init_region.  It must not allocate from the heap.  */
+typedef grub_err_t (*grub_mm_add_region_func_t) (grub_size_t size);
+extern grub_mm_add_region_func_t grub_mm_add_region_fn;
 void *EXPORT_FUNC(grub_malloc) (grub_size_t size);
 void *EXPORT_FUNC(grub_zalloc) (grub_size_t size);
 void EXPORT_FUNC(grub_free) (void *ptr);
 void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 #ifndef GRUB_MACHINE_EMU
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
+
+/* Blocks are accounted in size classes by the base 2 logarithm of their
+   size in allocation cells.  */
+#define GRUB_MM_STATS_CLASSES	20
+
+struct grub_mm_stats
+{
+  /* Whole heap, in bytes.  */
+  grub_size_t total;
+  unsigned regions;
+
+  /* Allocated blocks, headers included.  */
+  grub_size_t in_use;
+  grub_size_t peak;
+  unsigned long in_use_blocks;
+  unsigned long allocs;
+  unsigned long frees;
+
+  /* Free space.  BINNED is freed memory kept aside for quick reuse.  */
+  grub_size_t free;
+  grub_size_t largest_free;
+  unsigned long free_blocks;
+  grub_size_t binned;
+
+  struct
+  {
+    /* Size of the smallest block of this class in bytes.  */
+    grub_size_t min_size;
+    unsigned long blocks;
+    grub_size_t bytes;
+    unsigned long allocs;
+  } classes[GRUB_MM_STATS_CLASSES];
+};
+
+void EXPORT_FUNC(grub_mm_get_stats) (struct grub_mm_stats *stats);
 #endif
 
 void grub_mm_check_real (const char *file, int line);
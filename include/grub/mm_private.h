@@ -24,6 +24,7 @@
 /* Magic words.  */
 #define GRUB_MM_FREE_MAGIC	0x2d3c2808
 #define GRUB_MM_ALLOC_MAGIC	0x6db08fa4
+#define GRUB_MM_BINNED_MAGIC	0x5a1b3ce7
 
 typedef struct grub_mm_header
 {
@@ -48,6 +49,10 @@ typedef struct grub_mm_header
 
 #define GRUB_MM_ALIGN	(1 << GRUB_MM_ALIGN_LOG2)
 
+/* Freed blocks of up to this many cells, header included, are kept in
+   per-size bins for reuse.  */
+#define GRUB_MM_BIN_MAX	16
+
 typedef struct grub_mm_region
 {
   struct grub_mm_header *first;
@@ -59,6 +64,8 @@ typedef struct grub_mm_region
 
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+
+void EXPORT_FUNC (grub_mm_flush_bins) (void);
 #endif
 
 #endif
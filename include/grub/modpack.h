@@ -0,0 +1,58 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MODPACK_HEADER
+#define GRUB_MODPACK_HEADER	1
+
+#include <grub/types.h>
+
+/* A module pack holds every installed module of one platform in a single
+   file, so that loading many modules costs one transfer:
+
+     header
+     entries[count], sorted by module name
+     string table (names and dependency lists)
+     module images, every module after all of its dependencies
+
+   The header, the entries and the string table together are
+   sizeof (header) + toc_size bytes long.  All the numbers are
+   little-endian and all the offsets except the string ones are from the
+   start of the file.  */
+
+#define GRUB_MODPACK_FILENAME	"modules.pak"
+#define GRUB_MODPACK_MAGIC	"GRUBMPK1"
+
+struct grub_modpack_header
+{
+  char magic[8];
+  grub_uint32_t count;
+  grub_uint32_t toc_size;
+} GRUB_PACKED;
+
+struct grub_modpack_entry
+{
+  /* Offset of the module name in the string table.  */
+  grub_uint32_t name;
+  /* Offset of the direct dependencies in the string table, as a sequence
+     of NUL-terminated names ended by an empty one.  */
+  grub_uint32_t deps;
+  grub_uint32_t offset;
+  grub_uint32_t size;
+} GRUB_PACKED;
+
+#endif /* ! GRUB_MODPACK_HEADER */
@@ -0,0 +1,37 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MP_HEADER
+#define GRUB_MP_HEADER	1
+
+#include <grub/types.h>
+
+/* One piece of work for grub_mp_run.  Tasks may run on other processors
+   at the same time, so they may only compute on memory they are given:
+   no firmware calls, no memory allocation, no output and no grub_errno.  */
+typedef void (*grub_mp_task_t) (void *data, unsigned int index);
+
+/* Return the number of processors grub_mp_run spreads tasks over,
+   1 when the platform has no support for application processors.  */
+unsigned int grub_mp_nproc (void);
+
+/* Call TASK (DATA, I) for every I below COUNT and return when all calls
+   have finished.  */
+void grub_mp_run (grub_mp_task_t task, void *data, unsigned int count);
+
+#endif /* ! GRUB_MP_HEADER */
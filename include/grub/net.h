@@ -79,6 +79,10 @@ struct grub_net_card_driver
   grub_err_t (*send) (struct grub_net_card *dev,
 		      struct grub_net_buff *buf);
   struct grub_net_buff * (*recv) (struct grub_net_card *dev);
+  /* Optional: store up to MAX received frames in BUFS and return how many
+     there were.  */
+  unsigned (*recv_batch) (struct grub_net_card *dev,
+			  struct grub_net_buff **bufs, unsigned max);
 };
 
 typedef struct grub_net_packet
@@ -125,7 +129,6 @@ struct grub_net_card
   grub_uint64_t last_poll;
   grub_size_t mtu;
   struct grub_net_slaac_mac_list *slaac_list;
-  grub_ssize_t new_ll_entry;
   struct grub_net_link_layer_entry *link_layer_table;
   void *txbuf;
   void *rcvbuf;
@@ -139,7 +142,10 @@ struct grub_net_card
     {
       struct grub_efi_simple_network *efi_net;
       grub_efi_handle_t efi_handle;
-      grub_size_t last_pkt_size;
+      /* Transmit ring: the next slot of TXBUF to use and how many of
+	 those before it the firmware hasn't handed back.  */
+      unsigned tx_next;
+      unsigned tx_pending;
     };
 #endif
     void *data;
@@ -276,8 +282,22 @@ typedef struct grub_net
   grub_fs_t fs;
   int eof;
   int stall;
+  /* Opened by net_prefetch and not read by anybody yet.  */
+  int prefetch;
+  /* The protocol hands over the file compressed with gzip.  */
+  int gzip;
 } *grub_net_t;
 
+/* Packets a prefetched file may queue before its transfer is paused.  */
+#define GRUB_NET_PREFETCH_PACKETS 2048
+
+/* How many packets NET may queue, LIMIT unless it is being prefetched.  */
+static inline unsigned
+grub_net_queue_limit (grub_net_t net, unsigned limit)
+{
+  return net->prefetch ? GRUB_NET_PREFETCH_PACKETS : limit;
+}
+
 extern grub_net_t (*EXPORT_VAR (grub_net_open)) (const char *name);
 
 struct grub_net_network_level_interface
@@ -380,6 +400,8 @@ grub_net_card_unregister (struct grub_net_card *card);
 
 
 extern struct grub_net_route *grub_net_routes;
+/* Set when a router advertisement installs an IPv6 default route.  */
+extern int grub_net_ipv6_default_route;
 
 static inline void
 grub_net_route_register (struct grub_net_route *route)
@@ -542,6 +564,8 @@ grub_err_t
 grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
 			     const grub_net_network_level_address_t *proto_addr,
 			     grub_net_link_level_address_t *hw_addr);
+void
+grub_net_link_layer_prefetch (const grub_net_network_level_address_t *addr);
 grub_err_t
 grub_net_dns_lookup (const char *name,
 		     const struct grub_net_network_level_address *servers,
@@ -560,5 +584,9 @@ extern char *grub_net_default_server;
 #define GRUB_NET_TRIES 40
 #define GRUB_NET_INTERVAL 400
 #define GRUB_NET_INTERVAL_ADDITION 20
+/* Frames handled together, with one acknowledgement per TCP connection.  */
+#define GRUB_NET_RECV_BATCH 16
+/* Netbuffs preallocated when a card is opened.  */
+#define GRUB_NET_POOL_PACKETS 128
 
 #endif /* ! GRUB_NET_HEADER */
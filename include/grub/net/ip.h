@@ -43,6 +43,11 @@ grub_net_ipv6_get_id (const grub_net_link_level_address_t *addr)
 }
 
 grub_uint16_t grub_net_ip_chksum(void *ipv, grub_size_t len);
+/* Update CHKSUM for a 32-bit field of the data changing from FROM to TO,
+   all three as they are stored in the packet.  */
+grub_uint16_t grub_net_ip_chksum_update32 (grub_uint16_t chksum,
+					   grub_uint32_t from,
+					   grub_uint32_t to);
 
 grub_err_t
 grub_net_recv_ip_packets (struct grub_net_buff *nb,
@@ -27,5 +27,7 @@ grub_err_t grub_netbuff_clear (struct grub_net_buff *net_buff);
 struct grub_net_buff * grub_netbuff_alloc (grub_size_t len);
 struct grub_net_buff * grub_netbuff_make_pkt (grub_size_t len);
 void grub_netbuff_free (struct grub_net_buff *net_buff);
+grub_err_t grub_netbuff_pool_init (grub_size_t len, unsigned count);
+void grub_netbuff_pool_fini (void);
 
 #endif
@@ -128,6 +128,12 @@ void read_fs_list (const char *prefix);
 void grub_context_init (void);
 void grub_context_fini (void);
 
+/* Defined in `preload.c'.  */
+void grub_menu_preload_start (grub_menu_entry_t entry);
+void grub_menu_preload_step (void);
+void grub_menu_preload_chosen (grub_menu_entry_t entry);
+void grub_menu_preload_discard (void);
+
 void read_crypto_list (const char *prefix);
 
 void read_terminal_list (const char *prefix);
@@ -40,6 +40,18 @@
 #define UART_DATA_READY		0x01
 #define UART_EMPTY_TRANSMITTER	0x20
 
+/* For IIR bits.  */
+#define UART_IIR_FIFO_MASK	0xC0
+#define UART_IIR_FIFO_ENABLED	0xC0
+#define UART_IIR_FIFO64		0x20
+
+/* For FCR bits.  */
+#define UART_FCR_FIFO64		0x20
+
+/* Transmit FIFO depths.  */
+#define UART_FIFO_SIZE_16550A	16
+#define UART_FIFO_SIZE_16750	64
+
 /* The type of parity.  */
 #define UART_NO_PARITY		0x00
 #define UART_ODD_PARITY		0x08
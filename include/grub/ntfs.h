@@ -127,6 +127,13 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* Clusters VCN up to NEXT_VCN of an attribute, stored from LCN on, or
+   sparse if LCN is 0.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn, next_vcn, lcn;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -135,6 +142,12 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+
+  /* Set for the $DATA of the opened file, whose run list is then decoded
+     once into RUNS.  */
+  int cache_runs;
+  struct grub_ntfs_run *runs;
+  grub_size_t n_runs;
 };
 
 struct grub_ntfs_file
@@ -174,6 +187,8 @@ struct grub_ntfs_comp
   grub_uint32_t cbuf_ofs, cbuf_vcn;
   int log_spc;
   grub_uint8_t *cbuf;
+  /* A compressed chunk that straddles clusters, put together.  */
+  grub_uint8_t *chunk;
 };
 
 struct grub_ntfs_rlst
@@ -142,6 +142,18 @@ grub_pci_address_t EXPORT_FUNC(grub_pci_make_address) (grub_pci_device_t dev,
 void EXPORT_FUNC(grub_pci_iterate) (grub_pci_iteratefunc_t hook,
 				    void *hook_data);
 
+/* Like grub_pci_iterate, for the functions whose class, subclass and
+   programming interface (the class register shifted right by 8) masked
+   with MASK are CLASS.  */
+void EXPORT_FUNC(grub_pci_iterate_class) (grub_uint32_t class,
+					  grub_uint32_t mask,
+					  grub_pci_iteratefunc_t hook,
+					  void *hook_data);
+
+/* Forget the functions found so far, the next iteration probes the buses
+   again.  */
+void EXPORT_FUNC(grub_pci_rescan) (void);
+
 struct grub_pci_dma_chunk;
 
 struct grub_pci_dma_chunk *EXPORT_FUNC(grub_memalign_dma32) (grub_size_t align,
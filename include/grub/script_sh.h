@@ -86,6 +86,8 @@ struct grub_script_argv
 struct grub_script_wildcard_translator
 {
   grub_err_t (*expand) (const char *str, char ***expansions);
+  /* Drop what is kept from one expansion to the next.  */
+  void (*flush) (void);
 };
 extern struct grub_script_wildcard_translator *grub_wildcard_translator;
 extern struct grub_script_wildcard_translator grub_filename_translator;
@@ -98,6 +100,9 @@ struct grub_script_arglist
   struct grub_script_arg *arg;
   /* Only stored in the first link.  */
   int argcount;
+  /* The final value of ARG if it is made of literal text that expands
+   to itself, set by the parser; NULL if it must be expanded.  */
+  char *literal;
 };
 
 /* A single command line.  */
@@ -107,6 +112,15 @@ struct grub_script_cmdline
 
   /* The arguments for this command.  */
   struct grub_script_arglist *arglist;
+
+  /* What a literal command name resolved to, valid as long as both
+     generations are unchanged.  CACHED_CMD and CACHED_FUNC are both
+     NULL if the name was neither a command nor a function.  */
+  int cached;
+  grub_command_t cached_cmd;
+  struct grub_script_function *cached_func;
+  unsigned long cached_cmd_generation;
+  unsigned long cached_func_generation;
 };
 
 /* An if statement.  */
@@ -370,6 +384,8 @@ struct grub_script_function
 typedef struct grub_script_function *grub_script_function_t;
 
 extern grub_script_function_t grub_script_function_list;
+/* Incremented whenever a function is defined or removed.  */
+extern unsigned long grub_script_function_generation;
 
 #define FOR_SCRIPT_FUNCTIONS(var) for((var) = grub_script_function_list; \
 				      (var); (var) = (var)->next)
@@ -103,6 +103,10 @@ struct grub_scsi
   /* Size of one block.  */
   grub_uint32_t blocksize;
 
+  /* Largest data length in bytes of one READ/WRITE command, 0 for the
+     default of 32K.  Set by the underlying device when opening.  */
+  grub_size_t max_transfer;
+
   /* Device-specific data.  */
   void *data;
 };
@@ -43,6 +43,9 @@ struct grub_serial_driver
 			   struct grub_serial_config *config);
   int (*fetch) (struct grub_serial_port *port);
   void (*put) (struct grub_serial_port *port, const int c);
+  /* Optional: send LEN bytes; otherwise put is called for each.  */
+  void (*write) (struct grub_serial_port *port, const char *buf,
+		 grub_size_t len);
   void (*fini) (struct grub_serial_port *port);
 };
 
@@ -87,7 +90,12 @@ struct grub_serial_port
   union
   {
 #if defined(__mips__) || defined (__i386__) || defined (__x86_64__)
-    grub_port_t port;
+    struct
+    {
+      grub_port_t port;
+      /* Transmit FIFO depth detected at configuration time.  */
+      unsigned int fifo_size;
+    };
 #endif
     struct
     {
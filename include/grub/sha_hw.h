@@ -0,0 +1,53 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_SHA_HW_HEADER
+#define GRUB_SHA_HW_HEADER	1
+
+#include <grub/types.h>
+
+/* Only ARM64 has SHA-512 instructions usable without the AVX state.  */
+#ifdef __aarch64__
+#define GRUB_SHA_HW_HAVE_SHA512	1
+#endif
+
+#define GRUB_SHA_HW_SHA256	(1 << 0)
+#define GRUB_SHA_HW_SHA512	(1 << 1)
+
+/* The SHA-256 round constants.  */
+extern const grub_uint32_t grub_sha256_hw_k[64];
+
+/* Return which of the GRUB_SHA_HW_* instructions the CPU has and may be
+   used.  */
+int grub_sha_hw_supported (void);
+
+/* Run the SHA-256 compression function on STATE for the NBLOCKS 64-byte
+   blocks at DATA.  */
+void grub_sha256_hw_blocks (grub_uint32_t *state, const grub_uint8_t *data,
+			    grub_size_t nblocks);
+
+#ifdef GRUB_SHA_HW_HAVE_SHA512
+/* The SHA-512 round constants.  */
+extern const grub_uint64_t grub_sha512_hw_k[80];
+
+/* The same for SHA-512 and 128-byte blocks.  */
+void grub_sha512_hw_blocks (grub_uint64_t *state, const grub_uint8_t *data,
+			    grub_size_t nblocks);
+#endif
+
+#endif /* ! GRUB_SHA_HW_HEADER */
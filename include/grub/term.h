@@ -185,6 +185,11 @@ struct grub_term_output
   void (*putchar) (struct grub_term_output *term,
 		   const struct grub_unicode_glyph *c);
 
+  /* Put N characters at once, same as N calls to putchar.  Optional;
+     terminals where each call is costly batch the output here.  */
+  void (*putchars) (struct grub_term_output *term,
+		    const struct grub_unicode_glyph *c, grub_size_t n);
+
   /* Get the number of columns occupied by a given character C. C is
      encoded in Unicode.  */
   grub_size_t (*getcharwidth) (struct grub_term_output *term,
@@ -355,6 +360,17 @@ grub_term_refresh (struct grub_term_output *term)
     term->refresh (term);
 }
 
+static inline void
+grub_term_putchars (struct grub_term_output *term,
+		    const struct grub_unicode_glyph *c, grub_size_t n)
+{
+  if (term->putchars)
+    term->putchars (term, c, n);
+  else
+    for (; n; n--, c++)
+      term->putchar (term, c);
+}
+
 static inline void
 grub_term_gotoxy (struct grub_term_output *term, struct grub_term_coordinate pos)
 {
@@ -447,12 +463,7 @@ struct grub_term_autoload
 extern struct grub_term_autoload *grub_term_input_autoload;
 extern struct grub_term_autoload *grub_term_output_autoload;
 
-static inline void
-grub_print_spaces (struct grub_term_output *term, int number_spaces)
-{
-  while (--number_spaces >= 0)
-    grub_putcode (' ', term);
-}
+void grub_print_spaces (struct grub_term_output *term, int number_spaces);
 
 extern void (*EXPORT_VAR (grub_term_poll_usb)) (int wait_for_completion);
 
@@ -28,6 +28,7 @@ grub_err_t EXPORT_FUNC(grub_terminfo_set_current) (struct grub_term_output *term
 												const char *);
 
 #define GRUB_TERMINFO_READKEY_MAX_LEN 6
+#define GRUB_TERMINFO_OUTBUF_SIZE 128
 struct grub_terminfo_input_state
 {
   int input_buf[GRUB_TERMINFO_READKEY_MAX_LEN];
@@ -57,6 +58,27 @@ struct grub_terminfo_output_state
   struct grub_term_coordinate pos;
 
   void (*put) (struct grub_term_output *term, const int c);
+
+  /* Optional: write LEN bytes at once.  If set, output is collected in
+     OUTBUF and written when full, at each newline and on
+     grub_terminfo_refresh, instead of going byte by byte to put.  */
+  void (*write) (struct grub_term_output *term, const char *buf,
+		 grub_size_t len);
+  char outbuf[GRUB_TERMINFO_OUTBUF_SIZE];
+  grub_size_t outlen;
+
+  /* What we believe is on the screen of a cursor-addressable terminal,
+     one cell per position: the character in the low byte and the color
+     it was drawn with above it, 0 if unknown.  While it is valid, cursor
+     moves and color changes are only recorded and sent when text that
+     differs from the screen has to be drawn.  */
+  grub_uint16_t *screen;
+  struct grub_term_coordinate screen_size;
+  /* Where the terminal's cursor really is and which color it uses.  */
+  struct grub_term_coordinate hwpos;
+  int hwpos_valid;
+  int color;
+  int hwcolor;
 };
 
 grub_err_t EXPORT_FUNC(grub_terminfo_output_init) (struct grub_term_output *term);
@@ -74,6 +96,10 @@ grub_err_t EXPORT_FUNC (grub_terminfo_input_init) (struct grub_term_input *term)
 int EXPORT_FUNC (grub_terminfo_getkey) (struct grub_term_input *term);
 void EXPORT_FUNC (grub_terminfo_putchar) (struct grub_term_output *term,
 					  const struct grub_unicode_glyph *c);
+void EXPORT_FUNC (grub_terminfo_putchars) (struct grub_term_output *term,
+					   const struct grub_unicode_glyph *c,
+					   grub_size_t n);
+void EXPORT_FUNC (grub_terminfo_refresh) (struct grub_term_output *term);
 struct grub_term_coordinate EXPORT_FUNC (grub_terminfo_getwh) (struct grub_term_output *term);
 
 
@@ -73,6 +73,12 @@ void grub_test_assert_helper (int cond, const char *file,
 void grub_unit_test_init (void);
 void grub_unit_test_fini (void);
 
+/* Call FUNC (ARG) repeatedly for GRUB_BENCH_MS milliseconds (100 by default)
+   and print a line with the number of calls, nanoseconds per call and the
+   throughput for SIZE bytes per call.  Only available in unit tests.  */
+void grub_test_bench (const char *name, void (*func) (void *arg), void *arg,
+		      grub_size_t size);
+
 /* Macro to define a unit test.  */
 #define GRUB_UNIT_TEST(name, funp)		\
   void grub_unit_test_init (void)		\
@@ -32,6 +32,8 @@ grub_cpu_idle(void)
 
 void EXPORT_FUNC(grub_millisleep) (grub_uint32_t ms);
 grub_uint64_t EXPORT_FUNC(grub_get_time_ms) (void);
+grub_uint64_t EXPORT_FUNC(grub_get_time_us) (void);
+grub_uint64_t EXPORT_FUNC(grub_get_time_ns) (void);
 
 grub_uint64_t grub_rtc_get_time_ms (void);
 
@@ -42,5 +44,11 @@ grub_sleep (grub_uint32_t s)
 }
 
 void grub_install_get_time_ms (grub_uint64_t (*get_time_ms_func) (void));
+/* Optional finer clock.  Without one, grub_get_time_us has millisecond
+   resolution.  */
+void grub_install_get_time_us (grub_uint64_t (*get_time_us_func) (void));
+/* Optional clock with nanosecond resolution, read from a cycle counter.
+   Without one, grub_get_time_ns has the resolution of grub_get_time_us.  */
+void grub_install_get_time_ns (grub_uint64_t (*get_time_ns_func) (void));
 
 #endif /* ! KERNEL_TIME_HEADER */
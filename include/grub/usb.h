@@ -47,7 +47,8 @@ typedef enum
     GRUB_USB_SPEED_NONE,
     GRUB_USB_SPEED_LOW,
     GRUB_USB_SPEED_FULL,
-    GRUB_USB_SPEED_HIGH
+    GRUB_USB_SPEED_HIGH,
+    GRUB_USB_SPEED_SUPER
   } grub_usb_speed_t;
 
 typedef int (*grub_usb_iterate_hook_t) (grub_usb_device_t dev, void *data);
@@ -90,6 +91,9 @@ grub_usb_err_t
 grub_usb_bulk_write (grub_usb_device_t dev,
 		     struct grub_usb_desc_endp *endpoint,
 		     grub_size_t size, char *data);
+grub_size_t
+grub_usb_bulk_max_transfer (grub_usb_device_t dev,
+			    struct grub_usb_desc_endp *endpoint);
 
 grub_usb_err_t
 grub_usb_root_hub (grub_usb_controller_t controller);
@@ -205,6 +209,9 @@ struct grub_usb_device
   /* Data toggle values (used for bulk transfers only).  */
   int toggle[256];
 
+  /* Max. burst from the SuperSpeed endpoint companion descriptors.  */
+  grub_uint8_t ss_maxburst[256];
+
   /* Used by libusb wrapper.  Schedulded for removal. */
   void *data;
 
@@ -42,8 +42,10 @@
     "no|xz|gz|lzo", 0,				  \
     N_("compress GRUB files [optional]"), 1 },			          \
   {"core-compress", GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,		\
-      "xz|none|auto",						\
+      "xz|lz4|none|auto",						\
       0, N_("choose the compression to use for core image"), 2},	\
+  { "pack-modules", GRUB_INSTALL_OPTIONS_PACK_MODULES, 0, 0,		\
+    N_("also put the installed modules into a single module pack"), 1 }, \
     /* TRANSLATORS: platform here isn't identifier. It can be translated. */ \
   { "directory", 'd', N_("DIR"), 0,					\
     N_("use images and modules under DIR [default=%s/<platform>]"), 1 },  \
@@ -115,7 +117,8 @@ enum grub_install_options {
   GRUB_INSTALL_OPTIONS_LOCALE_DIRECTORY,
   GRUB_INSTALL_OPTIONS_THEMES_DIRECTORY,
   GRUB_INSTALL_OPTIONS_GRUB_MKIMAGE,
-  GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS
+  GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,
+  GRUB_INSTALL_OPTIONS_PACK_MODULES
 };
 
 extern char *grub_install_source_directory;
@@ -145,7 +148,8 @@ typedef enum {
   GRUB_COMPRESSION_AUTO,
   GRUB_COMPRESSION_NONE,
   GRUB_COMPRESSION_XZ,
-  GRUB_COMPRESSION_LZMA
+  GRUB_COMPRESSION_LZMA,
+  GRUB_COMPRESSION_LZ4
 } grub_compression_t;
 
 void
@@ -171,6 +175,7 @@ void
 grub_install_generate_image (const char *dir, const char *prefix,
 			     FILE *out,
 			     const char *outname, char *mods[],
+			     char *deferred_mods[],
 			     char *memdisk_path, char **pubkey_paths,
 			     size_t npubkeys,
 			     char *config_path,
@@ -33,4 +33,11 @@ grub_util_resolve_dependencies (const char *prefix,
 				char *modules[]);
 void grub_util_free_path_list (struct grub_util_path_list *path_list);
 
+/* Return the NULL-terminated list of the direct dependencies of the module
+   MODULE listed in the file DEP_LIST_FILE under PREFIX.  */
+char **
+grub_util_get_module_deps (const char *prefix,
+			   const char *dep_list_file,
+			   const char *module);
+
 #endif /* ! GRUB_UTIL_RESOLVE_HEADER */
@@ -142,6 +142,18 @@ EXPORT_FUNC (grub_video_fb_setup) (unsigned int mode_type, unsigned int mode_mas
 		     volatile void *page0_ptr,
 		     grub_video_fb_set_page_t set_page_in,
 		     volatile void *page1_ptr);
+
+/* Copy the damaged rectangle at X, Y of the shadow buffer DATA to the
+   screen.  */
+typedef void (*grub_video_fb_flush_t) (void *data, int x, int y,
+				       int width, int height);
+
+grub_err_t
+EXPORT_FUNC (grub_video_fb_setup_shadow) (struct grub_video_mode_info *mode_info,
+					  volatile void *framebuf,
+					  grub_video_fb_flush_t flush);
+void
+EXPORT_FUNC (grub_video_fb_set_flush) (grub_video_fb_flush_t flush);
 grub_err_t
 EXPORT_FUNC (grub_video_fb_swap_buffers) (void);
 grub_err_t
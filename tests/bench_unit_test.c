@@ -0,0 +1,630 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <grub/test.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/crypto.h>
+#include <grub/cryptodisk.h>
+#include <grub/deflate.h>
+#include <grub/lib/crc.h>
+#include <grub/video.h>
+#include <grub/fbutil.h>
+#include <grub/fbblit.h>
+#include <grub/lib/LzmaEnc.h>
+#include <grub/lzo1x.h>
+#include <minilzo.h>
+#include "xz.h"
+#include "xz_private.h"
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Amount of data every benchmark processes per call.  */
+#define BENCH_SIZE	(1024 * 1024)
+
+#define BLIT_WIDTH	1024
+#define BLIT_HEIGHT	768
+
+/* Modules which aren't part of libgcrypt.  */
+void grub_adler32_init (void);
+void grub_adler32_fini (void);
+void grub_crc64_init (void);
+void grub_crc64_fini (void);
+
+static grub_uint8_t *plain;
+static grub_uint8_t *out;
+
+/* Fill BUF with something resembling configuration files, so that the
+   decompressors see realistic match lengths and literal runs.  */
+static void
+make_text (grub_uint8_t *buf, grub_size_t size)
+{
+  static const char *const words[] =
+    {
+      "menuentry", "linux", "initrd", "insmod", "search", "--set=root",
+      "--fs-uuid", "set", "root", "(hd0,gpt2)", "/boot/vmlinuz", "ro",
+      "quiet", "echo", "'Loading", "kernel...'", "{", "}", "\n", "\t",
+      "if", "then", "fi", "0x7c00", "part_gpt", "ext2", "gzio"
+    };
+  grub_uint32_t seed = 1;
+  grub_size_t pos = 0, len;
+  const char *word;
+
+  while (pos < size)
+    {
+      seed = seed * 1103515245 + 12345;
+      word = words[(seed >> 16) % ARRAY_SIZE (words)];
+      len = grub_strlen (word);
+      if (len > size - pos - 1)
+	len = size - pos - 1;
+      grub_memcpy (buf + pos, word, len);
+      pos += len;
+      if (pos < size)
+	buf[pos++] = ' ';
+    }
+}
+
+/* Deflate with the fixed Huffman codes and greedy matching: enough to
+   exercise the whole inflate path without a zlib dependency.  */
+
+#define DEFLATE_HASH_SIZE	(1 << 15)
+#define DEFLATE_WINDOW		32768
+#define DEFLATE_MAX_MATCH	258
+
+static const grub_uint16_t length_base[] =
+  { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+    67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const grub_uint8_t length_extra[] =
+  { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const grub_uint16_t dist_base[] =
+  { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const grub_uint8_t dist_extra[] =
+  { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,
+    10, 10, 11, 11, 12, 12, 13, 13 };
+
+struct bit_writer
+{
+  grub_uint8_t *buf;
+  grub_size_t pos;
+  grub_uint32_t acc;
+  int nbits;
+};
+
+static void
+put_bits (struct bit_writer *w, grub_uint32_t bits, int n)
+{
+  w->acc |= bits << w->nbits;
+  w->nbits += n;
+  while (w->nbits >= 8)
+    {
+      w->buf[w->pos++] = w->acc;
+      w->acc >>= 8;
+      w->nbits -= 8;
+    }
+}
+
+/* Huffman codes are sent starting with the most significant bit.  */
+static void
+put_code (struct bit_writer *w, grub_uint32_t code, int n)
+{
+  grub_uint32_t rev = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    rev = (rev << 1) | ((code >> i) & 1);
+  put_bits (w, rev, n);
+}
+
+static void
+put_symbol (struct bit_writer *w, unsigned int sym)
+{
+  if (sym < 144)
+    put_code (w, 0x30 + sym, 8);
+  else if (sym < 256)
+    put_code (w, 0x190 + sym - 144, 9);
+  else if (sym < 280)
+    put_code (w, sym - 256, 7);
+  else
+    put_code (w, 0xc0 + sym - 280, 8);
+}
+
+static void
+put_match (struct bit_writer *w, unsigned int len, unsigned int dist)
+{
+  int i;
+
+  for (i = ARRAY_SIZE (length_base) - 1; length_base[i] > len; i--);
+  put_symbol (w, 257 + i);
+  put_bits (w, len - length_base[i], length_extra[i]);
+
+  for (i = ARRAY_SIZE (dist_base) - 1; dist_base[i] > dist; i--);
+  put_code (w, i, 5);
+  put_bits (w, dist - dist_base[i], dist_extra[i]);
+}
+
+static grub_size_t
+deflate_compress (const grub_uint8_t *src, grub_size_t size,
+		  grub_uint8_t *dst)
+{
+  /* Position plus one of the last occurrence of every hash, 0 if none.  */
+  grub_size_t *head;
+  struct bit_writer w = { dst, 0, 0, 0 };
+  grub_size_t pos = 0, cand, len, max, end;
+
+  head = grub_zalloc (DEFLATE_HASH_SIZE * sizeof (head[0]));
+  if (!head)
+    return 0;
+
+#define HASH(p) ((((p)[0] << 10) ^ ((p)[1] << 5) ^ (p)[2]) \
+		 & (DEFLATE_HASH_SIZE - 1))
+
+  /* A single final block with fixed codes.  */
+  put_bits (&w, 1, 1);
+  put_bits (&w, 1, 2);
+  while (pos < size)
+    {
+      len = 0;
+      if (pos + 3 <= size)
+	{
+	  cand = head[HASH (src + pos)];
+	  head[HASH (src + pos)] = pos + 1;
+	  if (cand && pos - (cand - 1) <= DEFLATE_WINDOW)
+	    {
+	      cand--;
+	      max = size - pos;
+	      if (max > DEFLATE_MAX_MATCH)
+		max = DEFLATE_MAX_MATCH;
+	      while (len < max && src[cand + len] == src[pos + len])
+		len++;
+	    }
+	}
+      if (len < 3)
+	{
+	  put_symbol (&w, src[pos++]);
+	  continue;
+	}
+      put_match (&w, len, pos - cand);
+      for (end = pos + len, pos++; pos < end; pos++)
+	if (pos + 3 <= size)
+	  head[HASH (src + pos)] = pos + 1;
+    }
+  put_symbol (&w, 256);
+  if (w.nbits)
+    w.buf[w.pos++] = w.acc;
+
+#undef HASH
+
+  grub_free (head);
+  return w.pos;
+}
+
+/* Raw LZMA2 made of independent chunks from the LZMA encoder, each
+   resetting the dictionary.  */
+
+#define LZMA2_CHUNK		(1 << 16)
+/* 128 KiB dictionary.  */
+#define LZMA2_DICT_PROPS	10
+#define LZMA2_DICT_SIZE		(1 << 17)
+
+static void *
+bench_alloc (void *p __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+bench_free (void *p __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static ISzAlloc bench_allocator = { bench_alloc, bench_free };
+
+static grub_size_t
+lzma2_compress (const grub_uint8_t *src, grub_size_t size, grub_uint8_t *dst)
+{
+  CLzmaEncProps props;
+  grub_uint8_t props_encoded[5];
+  SizeT props_size, packed;
+  grub_size_t off, chunk, pos = 0;
+
+  LzmaEncProps_Init (&props);
+  props.dictSize = LZMA2_CHUNK;
+  props.lc = 3;
+  props.lp = 0;
+  props.pb = 2;
+  props.numThreads = 1;
+
+  for (off = 0; off < size; off += chunk)
+    {
+      chunk = size - off;
+      if (chunk > LZMA2_CHUNK)
+	chunk = LZMA2_CHUNK;
+
+      packed = LZMA2_CHUNK;
+      props_size = sizeof (props_encoded);
+      if (LzmaEncode (dst + pos + 6, &packed, src + off, chunk, &props,
+		      props_encoded, &props_size, 0, NULL,
+		      &bench_allocator, &bench_allocator) == SZ_OK)
+	{
+	  /* Compressed chunk, resetting everything, with properties.  */
+	  dst[pos] = 0xe0 | ((chunk - 1) >> 16);
+	  dst[pos + 1] = (chunk - 1) >> 8;
+	  dst[pos + 2] = chunk - 1;
+	  dst[pos + 3] = (packed - 1) >> 8;
+	  dst[pos + 4] = packed - 1;
+	  dst[pos + 5] = (props.pb * 5 + props.lp) * 9 + props.lc;
+	  pos += 6 + packed;
+	}
+      else
+	{
+	  /* Stored chunk, resetting the dictionary.  */
+	  dst[pos] = 1;
+	  dst[pos + 1] = (chunk - 1) >> 8;
+	  dst[pos + 2] = chunk - 1;
+	  grub_memcpy (dst + pos + 3, src + off, chunk);
+	  pos += 3 + chunk;
+	}
+    }
+  dst[pos++] = 0;
+  return pos;
+}
+
+struct packed_data
+{
+  grub_uint8_t *data;
+  grub_size_t size;
+};
+
+static struct packed_data deflated, lzma2_packed, lzo_packed;
+static struct xz_dec_lzma2 *lzma2;
+
+static void
+bench_inflate (void *arg)
+{
+  struct packed_data *in = arg;
+
+  grub_deflate_decompress ((char *) in->data, in->size, 0,
+			   (char *) out, BENCH_SIZE);
+}
+
+static void
+bench_unxz (void *arg)
+{
+  struct packed_data *in = arg;
+  struct xz_buf b = { in->data, 0, in->size, out, 0, BENCH_SIZE };
+
+  xz_dec_lzma2_reset (lzma2, LZMA2_DICT_PROPS);
+  xz_dec_lzma2_run (lzma2, &b);
+}
+
+static void
+bench_unlzo (void *arg)
+{
+  struct packed_data *in = arg;
+
+  grub_lzo1x_decompress (in->data, in->size, out, BENCH_SIZE);
+}
+
+static void
+decompress_bench (void)
+{
+  struct xz_buf b;
+  grub_ssize_t len;
+  lzo_uint lzo_len;
+  void *wrkmem;
+
+  deflated.data = grub_malloc (BENCH_SIZE + BENCH_SIZE / 4 + 16);
+  grub_test_assert (deflated.data != NULL, "out of memory");
+  if (!deflated.data)
+    return;
+  deflated.size = deflate_compress (plain, BENCH_SIZE, deflated.data);
+  grub_memset (out, 0, BENCH_SIZE);
+  len = grub_deflate_decompress ((char *) deflated.data, deflated.size, 0,
+				 (char *) out, BENCH_SIZE);
+  grub_test_assert (len == BENCH_SIZE
+		    && grub_memcmp (out, plain, BENCH_SIZE) == 0,
+		    "inflate output differs");
+  grub_test_bench ("inflate", bench_inflate, &deflated, BENCH_SIZE);
+
+  lzma2 = xz_dec_lzma2_create (LZMA2_DICT_SIZE);
+  lzma2_packed.data = grub_malloc (2 * BENCH_SIZE);
+  grub_test_assert (lzma2 != NULL && lzma2_packed.data != NULL,
+		    "out of memory");
+  if (lzma2 && lzma2_packed.data)
+    {
+      enum xz_ret ret;
+
+      lzma2_packed.size = lzma2_compress (plain, BENCH_SIZE,
+					  lzma2_packed.data);
+      grub_memset (out, 0, BENCH_SIZE);
+      b.in = lzma2_packed.data;
+      b.in_pos = 0;
+      b.in_size = lzma2_packed.size;
+      b.out = out;
+      b.out_pos = 0;
+      b.out_size = BENCH_SIZE;
+      xz_dec_lzma2_reset (lzma2, LZMA2_DICT_PROPS);
+      ret = xz_dec_lzma2_run (lzma2, &b);
+      grub_test_assert (ret == XZ_STREAM_END && b.out_pos == BENCH_SIZE
+			&& grub_memcmp (out, plain, BENCH_SIZE) == 0,
+			"LZMA2 output differs");
+      grub_test_bench ("unxz", bench_unxz, &lzma2_packed, BENCH_SIZE);
+    }
+
+  grub_test_assert (lzo_init () == LZO_E_OK, "lzo_init failed");
+  lzo_packed.data = grub_malloc (BENCH_SIZE + BENCH_SIZE / 16 + 64 + 3);
+  wrkmem = grub_malloc (LZO1X_1_MEM_COMPRESS);
+  grub_test_assert (lzo_packed.data != NULL && wrkmem != NULL,
+		    "out of memory");
+  if (lzo_packed.data && wrkmem)
+    {
+      lzo_len = 0;
+      lzo1x_1_compress (plain, BENCH_SIZE, lzo_packed.data, &lzo_len, wrkmem);
+      lzo_packed.size = lzo_len;
+      grub_memset (out, 0, BENCH_SIZE);
+      grub_test_assert (grub_lzo1x_decompress (lzo_packed.data,
+					       lzo_packed.size, out,
+					       BENCH_SIZE) == BENCH_SIZE
+			&& grub_memcmp (out, plain, BENCH_SIZE) == 0,
+			"LZO output differs");
+      grub_test_bench ("unlzo", bench_unlzo, &lzo_packed, BENCH_SIZE);
+    }
+
+  grub_free (wrkmem);
+  grub_free (lzo_packed.data);
+  if (lzma2)
+    xz_dec_lzma2_end (lzma2);
+  grub_free (lzma2_packed.data);
+  grub_free (deflated.data);
+}
+
+static void
+bench_hash (void *arg)
+{
+  const gcry_md_spec_t *md = arg;
+  grub_uint8_t digest[GRUB_CRYPTO_MAX_MDLEN];
+
+  grub_crypto_hash (md, digest, plain, BENCH_SIZE);
+}
+
+static volatile grub_uint32_t crc_sink;
+
+static void
+bench_crc32c (void *arg __attribute__ ((unused)))
+{
+  crc_sink = grub_getcrc32c (0, plain, BENCH_SIZE);
+}
+
+static void
+checksum_bench (void)
+{
+  static const char *const names[] =
+    { "crc32", "adler32", "crc64", "md5", "sha1", "sha256", "sha512" };
+  const gcry_md_spec_t *md;
+  char name[32];
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE (names); i++)
+    {
+      md = grub_crypto_lookup_md_by_name (names[i]);
+      grub_test_assert (md != NULL, "%s is missing", names[i]);
+      if (!md)
+	continue;
+      grub_snprintf (name, sizeof (name), "hash-%s", names[i]);
+      grub_test_bench (name, bench_hash, (void *) md, BENCH_SIZE);
+    }
+  grub_test_bench ("hash-crc32c", bench_crc32c, NULL, BENCH_SIZE);
+}
+
+struct cipher_setup
+{
+  const char *cipher;
+  grub_cryptodisk_mode_t mode;
+  grub_cryptodisk_mode_iv_t mode_iv;
+  grub_size_t keysize;
+  const char *name;
+};
+
+static void
+bench_decrypt (void *arg)
+{
+  grub_cryptodisk_decrypt (arg, out, BENCH_SIZE, 0);
+}
+
+static void
+cryptodisk_bench (void)
+{
+  static const struct cipher_setup setups[] =
+    {
+      { "aes", GRUB_CRYPTODISK_MODE_XTS, GRUB_CRYPTODISK_MODE_IV_PLAIN64,
+	64, "decrypt-aes-xts-plain64" },
+      { "aes", GRUB_CRYPTODISK_MODE_CBC, GRUB_CRYPTODISK_MODE_IV_ESSIV,
+	32, "decrypt-aes-cbc-essiv" },
+      { "aes", GRUB_CRYPTODISK_MODE_CBC, GRUB_CRYPTODISK_MODE_IV_PLAIN,
+	16, "decrypt-aes-cbc-plain" },
+      { "twofish", GRUB_CRYPTODISK_MODE_XTS, GRUB_CRYPTODISK_MODE_IV_PLAIN64,
+	64, "decrypt-twofish-xts-plain64" },
+      { "serpent", GRUB_CRYPTODISK_MODE_XTS, GRUB_CRYPTODISK_MODE_IV_PLAIN64,
+	64, "decrypt-serpent-xts-plain64" }
+    };
+  struct grub_cryptodisk dev;
+  const gcry_cipher_spec_t *spec;
+  grub_uint8_t key[64];
+  unsigned int i;
+
+  for (i = 0; i < sizeof (key); i++)
+    key[i] = i * 7 + 1;
+
+  for (i = 0; i < ARRAY_SIZE (setups); i++)
+    {
+      spec = grub_crypto_lookup_cipher_by_name (setups[i].cipher);
+      grub_test_assert (spec != NULL, "%s is missing", setups[i].cipher);
+      if (!spec)
+	continue;
+
+      grub_memset (&dev, 0, sizeof (dev));
+      dev.mode = setups[i].mode;
+      dev.mode_iv = setups[i].mode_iv;
+      dev.log_sector_size = GRUB_DISK_SECTOR_BITS;
+      dev.cipher = grub_crypto_cipher_open (spec);
+      if (dev.mode == GRUB_CRYPTODISK_MODE_XTS)
+	dev.secondary_cipher = grub_crypto_cipher_open (spec);
+      if (dev.mode_iv == GRUB_CRYPTODISK_MODE_IV_ESSIV)
+	{
+	  dev.essiv_hash = grub_crypto_lookup_md_by_name ("sha256");
+	  dev.essiv_cipher = grub_crypto_cipher_open (spec);
+	}
+
+      grub_test_assert (grub_cryptodisk_setkey (&dev, key, setups[i].keysize)
+			== GPG_ERR_NO_ERROR, "%s: setting the key failed",
+			setups[i].name);
+      grub_memcpy (out, plain, BENCH_SIZE);
+      grub_test_bench (setups[i].name, bench_decrypt, &dev, BENCH_SIZE);
+
+      grub_crypto_cipher_close (dev.cipher);
+      if (dev.secondary_cipher)
+	grub_crypto_cipher_close (dev.secondary_cipher);
+      if (dev.essiv_cipher)
+	grub_crypto_cipher_close (dev.essiv_cipher);
+    }
+}
+
+struct blit_setup
+{
+  struct grub_video_fbblit_info *target;
+  struct grub_video_fbblit_info *source;
+  enum grub_video_blit_operators oper;
+};
+
+static void
+bench_blit (void *arg)
+{
+  struct blit_setup *setup = arg;
+
+  grub_video_fb_dispatch_blit (setup->target, setup->source, setup->oper,
+			       0, 0, BLIT_WIDTH, BLIT_HEIGHT, 0, 0);
+}
+
+static void
+fbblit_bench (void)
+{
+  struct grub_video_mode_info rgba, rgb, rgba_alpha;
+  struct grub_video_fbblit_info target32, target24, source;
+  struct blit_setup setup;
+  grub_uint8_t *target_data, *source_data;
+  grub_size_t i;
+
+  grub_memset (&rgba, 0, sizeof (rgba));
+  GRUB_VIDEO_MI_RGBA8888 (rgba);
+  rgba.width = BLIT_WIDTH;
+  rgba.height = BLIT_HEIGHT;
+  rgba.pitch = BLIT_WIDTH * 4;
+  rgba.blit_format = grub_video_get_blit_format (&rgba);
+
+  rgba_alpha = rgba;
+  rgba_alpha.mode_type |= GRUB_VIDEO_MODE_TYPE_ALPHA;
+  rgba_alpha.blit_format = grub_video_get_blit_format (&rgba_alpha);
+
+  grub_memset (&rgb, 0, sizeof (rgb));
+  GRUB_VIDEO_MI_RGB888 (rgb);
+  rgb.width = BLIT_WIDTH;
+  rgb.height = BLIT_HEIGHT;
+  rgb.pitch = BLIT_WIDTH * 3;
+  rgb.blit_format = grub_video_get_blit_format (&rgb);
+
+  target_data = grub_malloc (BLIT_WIDTH * BLIT_HEIGHT * 4);
+  source_data = grub_malloc (BLIT_WIDTH * BLIT_HEIGHT * 4);
+  grub_test_assert (target_data != NULL && source_data != NULL,
+		    "out of memory");
+  if (!target_data || !source_data)
+    {
+      grub_free (target_data);
+      grub_free (source_data);
+      return;
+    }
+
+  /* Alpha varies over the picture so that blending takes every path.  */
+  for (i = 0; i < BLIT_WIDTH * BLIT_HEIGHT * 4; i++)
+    source_data[i] = plain[i % BENCH_SIZE] ^ i;
+  grub_memset (target_data, 0x40, BLIT_WIDTH * BLIT_HEIGHT * 4);
+
+  source.mode_info = &rgba_alpha;
+  source.data = source_data;
+  target32.mode_info = &rgba;
+  target32.data = target_data;
+  target24.mode_info = &rgb;
+  target24.data = target_data;
+
+  setup.source = &source;
+
+  setup.target = &target32;
+  setup.oper = GRUB_VIDEO_BLIT_REPLACE;
+  grub_test_bench ("blit-replace-rgba8888", bench_blit, &setup,
+		   BLIT_WIDTH * BLIT_HEIGHT * 4);
+  setup.oper = GRUB_VIDEO_BLIT_BLEND;
+  grub_test_bench ("blit-blend-rgba8888", bench_blit, &setup,
+		   BLIT_WIDTH * BLIT_HEIGHT * 4);
+
+  setup.target = &target24;
+  setup.oper = GRUB_VIDEO_BLIT_REPLACE;
+  grub_test_bench ("blit-replace-rgb888", bench_blit, &setup,
+		   BLIT_WIDTH * BLIT_HEIGHT * 4);
+  setup.oper = GRUB_VIDEO_BLIT_BLEND;
+  grub_test_bench ("blit-blend-rgb888", bench_blit, &setup,
+		   BLIT_WIDTH * BLIT_HEIGHT * 4);
+
+  grub_free (target_data);
+  grub_free (source_data);
+}
+
+/* Unit test main method.  */
+static void
+bench_test (void)
+{
+  grub_gcry_init_all ();
+  grub_adler32_init ();
+  grub_crc64_init ();
+
+  plain = grub_malloc (BENCH_SIZE);
+  out = grub_malloc (BENCH_SIZE);
+  grub_test_assert (plain != NULL && out != NULL, "out of memory");
+  if (plain && out)
+    {
+      make_text (plain, BENCH_SIZE);
+
+      decompress_bench ();
+      checksum_bench ();
+      cryptodisk_bench ();
+      fbblit_bench ();
+    }
+
+  grub_free (plain);
+  grub_free (out);
+
+  grub_crc64_fini ();
+  grub_adler32_fini ();
+  grub_gcry_fini_all ();
+}
+
+/* Register bench_test method as a unit test.  */
+GRUB_UNIT_TEST ("bench_test", bench_test);
@@ -25,6 +25,54 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define MSG "cmp test failed"
 
+/* The word-wide paths of grub_memmove, grub_memcmp and grub_strcmp against
+   the C library, for every relative alignment and lengths around the word
+   size.  */
+static void
+cmp_alignment_test (void)
+{
+  char a[128], b[128], r1[128], r2[128];
+  int o1, o2, n, i;
+
+  for (o1 = 0; o1 < 16; o1++)
+    for (o2 = 0; o2 < 16; o2++)
+      for (n = 0; n < 40; n++)
+	{
+	  /* The same bytes at A + O1 and B + O2.  */
+	  for (i = 0; i < 128; i++)
+	    {
+	      a[i] = (char) ((i - o1) * 7 + 0x80);
+	      b[i] = (char) ((i - o2) * 7 + 0x80);
+	      r1[i] = r2[i] = (char) (i * 7 + 0x80);
+	    }
+
+	  grub_test_assert (grub_memcmp (a + o1, b + o2, n) == 0, MSG);
+	  if (n)
+	    {
+	      b[o2 + n - 1]++;
+	      grub_test_assert ((grub_memcmp (a + o1, b + o2, n) < 0)
+				== (memcmp (a + o1, b + o2, n) < 0), MSG);
+	      grub_test_assert (grub_memcmp (a + o1, b + o2, n) != 0, MSG);
+	      b[o2 + n - 1]--;
+	    }
+
+	  a[o1 + n] = 0;
+	  b[o2 + n] = 0;
+	  grub_test_assert (grub_strcmp (a + o1, b + o2) == 0, MSG);
+	  b[o2 + n] = 'x';
+	  b[o2 + n + 1] = 0;
+	  grub_test_assert (grub_strcmp (a + o1, b + o2) < 0, MSG);
+	  grub_test_assert (grub_strcmp (b + o2, a + o1) > 0, MSG);
+
+	  grub_memmove (r1 + o1 + 32, r1 + o2 + 32 + 5, n);
+	  memmove (r2 + o1 + 32, r2 + o2 + 32 + 5, n);
+	  grub_test_assert (memcmp (r1, r2, sizeof (r1)) == 0, MSG);
+	  grub_memmove (r1 + o1 + 32 + 5, r1 + o2 + 32, n);
+	  memmove (r2 + o1 + 32 + 5, r2 + o2 + 32, n);
+	  grub_test_assert (memcmp (r1, r2, sizeof (r1)) == 0, MSG);
+	}
+}
+
 /* Functional test main method.  */
 static void
 cmp_test (void)
@@ -220,6 +268,8 @@ cmp_test (void)
   grub_test_assert (strncasecmp (s3, s1, 1) > 0, MSG);
   grub_test_assert (strncasecmp (s3, s2, 1) > 0, MSG);
   grub_test_assert (strncasecmp (s3, s3, 1) == 0, MSG);
+
+  cmp_alignment_test ();
 }
 
 /* Register example_test method as a functional test.  */
@@ -20,10 +20,54 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 #include <grub/list.h>
 #include <grub/test.h>
 
+#define GRUB_TEST_BENCH_DEFAULT_MS	100
+
+static grub_uint64_t
+bench_now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+grub_test_bench (const char *name, void (*func) (void *arg), void *arg,
+		 grub_size_t size)
+{
+  const char *env = getenv ("GRUB_BENCH_MS");
+  grub_uint64_t limit, start, elapsed, calls = 0, batch = 1, i;
+
+  limit = (env ? strtoull (env, NULL, 0) : GRUB_TEST_BENCH_DEFAULT_MS)
+    * 1000000ULL;
+
+  /* Warm up caches and lazily built tables.  */
+  func (arg);
+
+  start = bench_now_ns ();
+  do
+    {
+      for (i = 0; i < batch; i++)
+	func (arg);
+      calls += batch;
+      batch *= 2;
+      elapsed = bench_now_ns () - start;
+    }
+  while (elapsed < limit);
+
+  /* One tab-separated line per benchmark so that runs can be compared
+     with simple tools.  */
+  printf ("BENCH\t%s\t%llu\t%llu\t%.1f\n", name,
+	  (unsigned long long) calls,
+	  (unsigned long long) (elapsed / calls),
+	  (double) size * calls * 1e9 / elapsed / (1024 * 1024));
+}
+
 int
 main (int argc __attribute__ ((unused)),
       char *argv[] __attribute__ ((unused)))
@@ -39,6 +39,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "progname.h"
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
@@ -75,60 +79,159 @@ enum {
 
 static grub_disk_addr_t skip, leng;
 static int uncompress = 0;
+static grub_size_t buf_size = BUF_SIZE;
+static int show_stats = 0;
+static grub_uint64_t stats_bytes, stats_files;
 
-static void
-read_file (char *pathname, int (*hook) (grub_off_t ofs, char *buf, int len, void *hook_arg), void *hook_arg)
-{
-  static char buf[BUF_SIZE];
-  grub_file_t file;
+typedef int (*read_hook_t) (grub_off_t ofs, char *buf, int len,
+			    void *hook_arg);
 
-  if ((pathname[0] == '-') && (pathname[1] == 0))
-    {
-      grub_device_t dev;
+/* Chunks read by read_file are handed to the hook through a ring of
+   buffers.  With threads, the hook runs in a second thread, so that GRUB
+   reading the next chunk overlaps comparing, checksumming or writing the
+   previous one; GRUB itself is only ever called from the main thread.  */
+#define PIPE_DEPTH 4
 
-      dev = grub_device_open (0);
-      if ((! dev) || (! dev->disk))
-        grub_util_error ("%s", grub_errmsg);
-
-      grub_util_info ("total sectors : %" GRUB_HOST_PRIuLONG_LONG,
-                      (unsigned long long) dev->disk->total_sectors);
+struct pipe_slot
+{
+  char *buf;
+  grub_off_t ofs;
+  int len;
+};
 
-      if (! leng)
-        leng = (dev->disk->total_sectors << GRUB_DISK_SECTOR_BITS) - skip;
+static struct
+{
+  struct pipe_slot slots[PIPE_DEPTH];
+  /* Number of chunks produced and consumed so far.  */
+  unsigned head, tail;
+  int done, stop;
+  read_hook_t hook;
+  void *hook_arg;
+#ifdef HAVE_PTHREAD
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+} chunks;
+
+#ifdef HAVE_PTHREAD
+static void *
+pipe_consumer (void *arg __attribute__ ((unused)))
+{
+  struct pipe_slot *slot;
+  int stop;
 
-      while (leng)
-        {
-          grub_size_t len;
+  for (;;)
+    {
+      pthread_mutex_lock (&chunks.lock);
+      while (chunks.tail == chunks.head && !chunks.done)
+	pthread_cond_wait (&chunks.cond, &chunks.lock);
+      if (chunks.tail == chunks.head)
+	{
+	  pthread_mutex_unlock (&chunks.lock);
+	  break;
+	}
+      slot = &chunks.slots[chunks.tail % PIPE_DEPTH];
+      pthread_mutex_unlock (&chunks.lock);
+
+      stop = chunks.hook (slot->ofs, slot->buf, slot->len, chunks.hook_arg);
+
+      pthread_mutex_lock (&chunks.lock);
+      chunks.tail++;
+      if (stop)
+	chunks.stop = 1;
+      pthread_cond_broadcast (&chunks.cond);
+      pthread_mutex_unlock (&chunks.lock);
+      if (stop)
+	break;
+    }
+  return NULL;
+}
+#endif
 
-          len = (leng > BUF_SIZE) ? BUF_SIZE : leng;
+static void
+pipe_start (read_hook_t hook, void *hook_arg)
+{
+  int i;
 
-          if (grub_disk_read (dev->disk, 0, skip, len, buf))
-	    {
-	      char *msg = grub_xasprintf (_("disk read fails at offset %lld, length %lld"),
-					  (long long) skip, (long long) len);
-	      grub_util_error ("%s", msg);
-	    }
+  if (!chunks.slots[0].buf)
+    for (i = 0; i < PIPE_DEPTH; i++)
+      chunks.slots[i].buf = xmalloc (buf_size);
+
+  chunks.head = chunks.tail = 0;
+  chunks.done = chunks.stop = 0;
+  chunks.hook = hook;
+  chunks.hook_arg = hook_arg;
+  stats_files++;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init (&chunks.lock, NULL);
+  pthread_cond_init (&chunks.cond, NULL);
+  i = pthread_create (&chunks.thread, NULL, pipe_consumer, NULL);
+  if (i)
+    grub_util_error ("%s", strerror (i));
+#endif
+}
 
-          if (hook (skip, buf, len, hook_arg))
-            break;
+/* Return the buffer to read the next chunk into, NULL if the hook asked
+   to stop.  */
+static char *
+pipe_get (void)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&chunks.lock);
+  while (chunks.head - chunks.tail == PIPE_DEPTH && !chunks.stop)
+    pthread_cond_wait (&chunks.cond, &chunks.lock);
+  pthread_mutex_unlock (&chunks.lock);
+#endif
+  if (chunks.stop)
+    return NULL;
+  return chunks.slots[chunks.head % PIPE_DEPTH].buf;
+}
 
-          skip += len;
-          leng -= len;
-        }
+/* Pass LEN bytes read at OFS to the hook.  Return non-zero to stop.  */
+static int
+pipe_put (grub_off_t ofs, int len)
+{
+  struct pipe_slot *slot = &chunks.slots[chunks.head % PIPE_DEPTH];
+
+  slot->ofs = ofs;
+  slot->len = len;
+  stats_bytes += len;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&chunks.lock);
+  chunks.head++;
+  pthread_cond_broadcast (&chunks.cond);
+  pthread_mutex_unlock (&chunks.lock);
+#else
+  chunks.head++;
+  if (chunks.hook (ofs, slot->buf, len, chunks.hook_arg))
+    chunks.stop = 1;
+  chunks.tail++;
+#endif
+  return chunks.stop;
+}
 
-      grub_device_close (dev);
-      return;
-    }
+/* Wait for the hook to process all chunks.  */
+static void
+pipe_finish (void)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&chunks.lock);
+  chunks.done = 1;
+  pthread_cond_broadcast (&chunks.cond);
+  pthread_mutex_unlock (&chunks.lock);
+  pthread_join (chunks.thread, NULL);
+  pthread_cond_destroy (&chunks.cond);
+  pthread_mutex_destroy (&chunks.lock);
+#endif
+}
 
-  if (uncompress == 0)
-    grub_file_filter_disable_compression ();
-  file = grub_file_open (pathname);
-  if (!file)
-    {
-      grub_util_error (_("cannot open `%s': %s"), pathname,
-		       grub_errmsg);
-      return;
-    }
+static void
+read_grub_file (grub_file_t file, read_hook_t hook, void *hook_arg)
+{
+  char *buf;
 
   grub_util_info ("file size : %" GRUB_HOST_PRIuLONG_LONG,
 		  (unsigned long long) file->size);
@@ -150,11 +253,12 @@ read_file (char *pathname, int (*hook) (grub_off_t ofs, char *buf, int len, void
 
     file->offset = skip;
 
-    while (len)
+    pipe_start (hook, hook_arg);
+    while (len && (buf = pipe_get ()))
       {
 	grub_ssize_t sz;
 
-	sz = grub_file_read (file, buf, (len > BUF_SIZE) ? BUF_SIZE : len);
+	sz = grub_file_read (file, buf, (len > buf_size) ? buf_size : len);
 	if (sz < 0)
 	  {
 	    char *msg = grub_xasprintf (_("read error at offset %llu: %s"),
@@ -163,14 +267,73 @@ read_file (char *pathname, int (*hook) (grub_off_t ofs, char *buf, int len, void
 	    break;
 	  }
 
-	if ((sz == 0) || (hook (ofs, buf, sz, hook_arg)))
+	if ((sz == 0) || pipe_put (ofs, sz))
 	  break;
 
 	ofs += sz;
 	len -= sz;
       }
+    pipe_finish ();
   }
+}
 
+static void
+read_file (char *pathname, read_hook_t hook, void *hook_arg)
+{
+  grub_file_t file;
+  char *buf;
+
+  if ((pathname[0] == '-') && (pathname[1] == 0))
+    {
+      grub_device_t dev;
+
+      dev = grub_device_open (0);
+      if ((! dev) || (! dev->disk))
+        grub_util_error ("%s", grub_errmsg);
+
+      grub_util_info ("total sectors : %" GRUB_HOST_PRIuLONG_LONG,
+                      (unsigned long long) dev->disk->total_sectors);
+
+      if (! leng)
+        leng = (dev->disk->total_sectors << GRUB_DISK_SECTOR_BITS) - skip;
+
+      pipe_start (hook, hook_arg);
+      while (leng && (buf = pipe_get ()))
+        {
+          grub_size_t len;
+
+          len = (leng > buf_size) ? buf_size : leng;
+
+          if (grub_disk_read (dev->disk, 0, skip, len, buf))
+	    {
+	      char *msg = grub_xasprintf (_("disk read fails at offset %lld, length %lld"),
+					  (long long) skip, (long long) len);
+	      grub_util_error ("%s", msg);
+	    }
+
+          if (pipe_put (skip, len))
+            break;
+
+          skip += len;
+          leng -= len;
+        }
+      pipe_finish ();
+
+      grub_device_close (dev);
+      return;
+    }
+
+  if (uncompress == 0)
+    grub_file_filter_disable_compression ();
+  file = grub_file_open (pathname);
+  if (!file)
+    {
+      grub_util_error (_("cannot open `%s': %s"), pathname,
+		       grub_errmsg);
+      return;
+    }
+
+  read_grub_file (file, hook, hook_arg);
   grub_file_close (file);
 }
 
@@ -240,7 +403,10 @@ static int
 cmp_hook (grub_off_t ofs, char *buf, int len, void *ff_in)
 {
   FILE *ff = ff_in;
-  static char buf_1[BUF_SIZE];
+  static char *buf_1;
+
+  if (!buf_1)
+    buf_1 = xmalloc (buf_size);
   if ((int) fread (buf_1, 1, len, ff) != len)
     {
       char *msg = grub_xasprintf (_("read error at offset %llu: %s"),
@@ -354,16 +520,135 @@ crc_hook (grub_off_t ofs, char *buf, int len, void *crc_ctx)
   return 0;
 }
 
+static void
+print_crc (grub_uint8_t *crc32_context, const char *name)
+{
+  GRUB_MD_CRC32->final(crc32_context);
+  printf ("%08x",
+	  grub_be_to_cpu32 (grub_get_unaligned32 (GRUB_MD_CRC32->read (crc32_context))));
+  if (name)
+    printf ("  %s", name);
+  printf ("\n");
+}
+
+/* Context for crc_tree.  */
+struct crc_tree_ctx
+{
+  char **names;
+  char *dirs;
+  int count;
+  int alloc;
+};
+
+/* Helper for crc_tree.  */
+static int
+crc_tree_hook (const char *filename, const struct grub_dirhook_info *info,
+	       void *data)
+{
+  struct crc_tree_ctx *ctx = data;
+
+  if (grub_strcmp (filename, ".") == 0 || grub_strcmp (filename, "..") == 0)
+    return 0;
+  if (ctx->count == ctx->alloc)
+    {
+      ctx->alloc = ctx->alloc ? 2 * ctx->alloc : 32;
+      ctx->names = xrealloc (ctx->names, ctx->alloc * sizeof (ctx->names[0]));
+      ctx->dirs = xrealloc (ctx->dirs, ctx->alloc);
+    }
+  ctx->names[ctx->count] = xstrdup (filename);
+  ctx->dirs[ctx->count] = info->dir;
+  ctx->count++;
+  return 0;
+}
+
+/* Print the crc32 checksum of every file under the directory PATHNAME, one
+   per line followed by its path, in the format of "crc FILE".  Symbolic
+   links to directories aren't followed.  */
+static void
+crc_tree (const char *pathname, grub_uint8_t *crc32_context)
+{
+  struct crc_tree_ctx ctx = { NULL, NULL, 0, 0 };
+  char *device_name;
+  const char *path;
+  grub_device_t dev;
+  grub_fs_t fs;
+  int i;
+
+  device_name = grub_file_get_device_name (pathname);
+  dev = grub_device_open (device_name);
+  if (!dev)
+    grub_util_error ("%s", grub_errmsg);
+  fs = grub_fs_probe (dev);
+  if (!fs)
+    grub_util_error ("%s", grub_errmsg);
+
+  path = grub_strchr (pathname, ')');
+  path = path ? path + 1 : pathname;
+  if (!*path)
+    path = "/";
+
+  if ((fs->dir) (dev, path, crc_tree_hook, &ctx))
+    grub_util_error (_("cannot open `%s': %s"), pathname, grub_errmsg);
+  grub_device_close (dev);
+  grub_free (device_name);
+
+  for (i = 0; i < ctx.count; i++)
+    {
+      char *child;
+      grub_file_t file;
+
+      child = xasprintf ("%s%s%s", pathname,
+			 pathname[strlen (pathname) - 1] == '/' ? "" : "/",
+			 ctx.names[i]);
+      if (ctx.dirs[i])
+	crc_tree (child, crc32_context);
+      else
+	{
+	  if (uncompress == 0)
+	    grub_file_filter_disable_compression ();
+	  file = grub_file_open (child);
+	  if (file)
+	    {
+	      GRUB_MD_CRC32->init(crc32_context);
+	      read_grub_file (file, crc_hook, crc32_context);
+	      grub_file_close (file);
+	      print_crc (crc32_context, child);
+	    }
+	  else if (grub_errno == GRUB_ERR_BAD_FILE_TYPE)
+	    grub_errno = GRUB_ERR_NONE;
+	  else
+	    grub_util_error (_("cannot open `%s': %s"), child, grub_errmsg);
+	}
+      free (child);
+      free (ctx.names[i]);
+    }
+  free (ctx.names);
+  free (ctx.dirs);
+}
+
 static void
 cmd_crc (char *pathname)
 {
   grub_uint8_t *crc32_context = xmalloc (GRUB_MD_CRC32->contextsize);
-  GRUB_MD_CRC32->init(crc32_context);
+  grub_file_t file;
 
+  if (!((pathname[0] == '-') && (pathname[1] == 0)))
+    {
+      file = grub_file_open (pathname);
+      if (!file && grub_errno == GRUB_ERR_BAD_FILE_TYPE)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  crc_tree (pathname, crc32_context);
+	  free (crc32_context);
+	  return;
+	}
+      if (file)
+	grub_file_close (file);
+    }
+
+  GRUB_MD_CRC32->init(crc32_context);
   read_file (pathname, crc_hook, crc32_context);
-  GRUB_MD_CRC32->final(crc32_context);
-  printf ("%08x\n",
-	  grub_be_to_cpu32 (grub_get_unaligned32 (GRUB_MD_CRC32->read (crc32_context))));
+  print_crc (crc32_context, NULL);
   free (crc32_context);
 }
 
@@ -507,9 +792,9 @@ static struct argp_option options[] = {
   {N_("ls PATH"),  0, 0      , OPTION_DOC, N_("List files in PATH."), 1},
   {N_("cp FILE LOCAL"),  0, 0, OPTION_DOC, N_("Copy FILE to local file LOCAL."), 1},
   {N_("cat FILE"), 0, 0      , OPTION_DOC, N_("Copy FILE to standard output."), 1},
-  {N_("cmp FILE LOCAL"), 0, 0, OPTION_DOC, N_("Compare FILE with local file LOCAL."), 1},
+  {N_("cmp FILE LOCAL"), 0, 0, OPTION_DOC, N_("Compare FILE with local file LOCAL, or every file under local directory LOCAL with FILE's."), 1},
   {N_("hex FILE"), 0, 0      , OPTION_DOC, N_("Show contents of FILE in hex."), 1},
-  {N_("crc FILE"), 0, 0     , OPTION_DOC, N_("Get crc32 checksum of FILE."), 1},
+  {N_("crc FILE"), 0, 0     , OPTION_DOC, N_("Get crc32 checksum of FILE, or of every file under FILE if it's a directory."), 1},
   {N_("blocklist FILE"), 0, 0, OPTION_DOC, N_("Display blocklist of FILE."), 1},
   {N_("xnu_uuid DEVICE"), 0, 0, OPTION_DOC, N_("Compute XNU UUID of the device."), 1},
   
@@ -524,6 +809,8 @@ static struct argp_option options[] = {
    N_("FILE|prompt"), 0, N_("Load zfs crypto key."),                 2},
   {"verbose",   'v', NULL, 0, N_("print verbose messages."), 2},
   {"uncompress", 'u', NULL, 0, N_("Uncompress data."), 2},
+  {"buffer-size", 'b', N_("NUM"), 0, N_("Read NUM bytes at a time."), 2},
+  {"stats",     'S', NULL, 0, N_("Print the amount of data read and the throughput."), 2},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -627,6 +914,21 @@ argp_parser (int key, char *arg, struct argp_state *state)
       uncompress = 1;
       return 0;
 
+    case 'b':
+      buf_size = grub_strtoul (arg, &p, 0);
+      if (*p == 's')
+	buf_size <<= GRUB_DISK_SECTOR_BITS;
+      if (buf_size == 0 || buf_size > GRUB_INT_MAX)
+	{
+	  fprintf (stderr, "%s", _("Invalid buffer size.\n"));
+	  argp_usage (state);
+	}
+      return 0;
+
+    case 'S':
+      show_stats = 1;
+      return 0;
+
     case ARGP_KEY_END:
       if (args_count < num_disks)
 	{
@@ -731,6 +1033,7 @@ main (int argc, char *argv[])
 {
   const char *default_root;
   char *alloc_root;
+  struct timeval start;
 
   grub_util_host_init (&argc, &argv);
 
@@ -766,8 +1069,22 @@ main (int argc, char *argv[])
     free (alloc_root);
 
   /* Do it.  */
+  gettimeofday (&start, NULL);
   fstest (args_count - 1 - num_disks);
 
+  if (show_stats)
+    {
+      struct timeval end;
+      double secs;
+
+      gettimeofday (&end, NULL);
+      secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+      fprintf (stderr, _("%llu files, %llu bytes in %.3f s (%.1f MiB/s)\n"),
+	       (unsigned long long) stats_files,
+	       (unsigned long long) stats_bytes, secs,
+	       secs > 0 ? stats_bytes / secs / (1 << 20) : 0.0);
+    }
+
   /* Free resources.  */
   grub_gcry_fini_all ();
   grub_fini_all ();
@@ -35,6 +35,7 @@
 #include <grub/zfs/zfs.h>
 #include <grub/util/install.h>
 #include <grub/util/resolve.h>
+#include <grub/modpack.h>
 #include <grub/emu/hostfile.h>
 #include <grub/emu/config.h>
 #include <grub/emu/hostfile.h>
@@ -44,6 +45,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
 
@@ -72,8 +76,51 @@ grub_install_help_filter (int key, const char *text,
 #pragma GCC diagnostic error "-Wformat-nonliteral"
 
 static int (*compress_func) (const char *src, const char *dest) = NULL;
+static int pack_modules = 0;
 char *grub_install_copy_buffer;
 
+#define GRUB_INSTALL_COMPARE_BUFFER_SIZE 65536
+
+/* Return 1 if the files A and B exist and have the same contents.  */
+static int
+files_identical (const char *a, const char *b)
+{
+  grub_util_fd_t fa, fb;
+  char *bufa, *bufb;
+  ssize_t ra, rb;
+  int ret = 0;
+
+  fa = grub_util_fd_open (a, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fa))
+    return 0;
+  fb = grub_util_fd_open (b, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fb))
+    {
+      grub_util_fd_close (fa);
+      return 0;
+    }
+
+  bufa = xmalloc (2 * GRUB_INSTALL_COMPARE_BUFFER_SIZE);
+  bufb = bufa + GRUB_INSTALL_COMPARE_BUFFER_SIZE;
+  while (1)
+    {
+      ra = grub_util_fd_read (fa, bufa, GRUB_INSTALL_COMPARE_BUFFER_SIZE);
+      rb = grub_util_fd_read (fb, bufb, GRUB_INSTALL_COMPARE_BUFFER_SIZE);
+      if (ra < 0 || ra != rb || memcmp (bufa, bufb, ra) != 0)
+	break;
+      if (ra == 0)
+	{
+	  ret = 1;
+	  break;
+	}
+    }
+
+  free (bufa);
+  grub_util_fd_close (fa);
+  grub_util_fd_close (fb);
+  return ret;
+}
+
 int
 grub_install_copy_file (const char *src,
 			const char *dst,
@@ -81,6 +128,15 @@ grub_install_copy_file (const char *src,
 {
   grub_util_fd_t in, out;  
   ssize_t r;
+  char *buf;
+
+  /* Don't rewrite files that are already installed: the destination is
+     often slow flash.  */
+  if (files_identical (src, dst))
+    {
+      grub_util_info ("`%s' is up to date", dst);
+      return 1;
+    }
 
   grub_util_info ("copying `%s' -> `%s'", src, dst);
 
@@ -103,16 +159,17 @@ grub_install_copy_file (const char *src,
       return 0;
     }
 
-  if (!grub_install_copy_buffer)
-    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+  /* Files may be copied by several threads at once.  */
+  buf = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
  
   while (1)
     {
-      r = grub_util_fd_read (in, grub_install_copy_buffer, GRUB_INSTALL_COPY_BUFFER_SIZE);
+      r = grub_util_fd_read (in, buf, GRUB_INSTALL_COPY_BUFFER_SIZE);
       if (r <= 0)
 	break;
-      grub_util_fd_write (out, grub_install_copy_buffer, r);
+      grub_util_fd_write (out, buf, r);
     }
+  free (buf);
   grub_util_fd_sync (out);
   grub_util_fd_close (in);
   grub_util_fd_close (out);
@@ -135,10 +192,29 @@ grub_install_compress_file (const char *in_name,
     ret = grub_install_copy_file (in_name, out_name, is_needed);
   else
     {
+      /* Compress next to the destination and only replace it if the
+	 result differs.  */
+      char *tmp_name = xasprintf ("%s.new", out_name);
+
       grub_util_info ("compressing `%s' -> `%s'", in_name, out_name);
-      ret = !compress_func (in_name, out_name);
-      if (!ret && is_needed)
-	grub_util_warn (_("can't compress `%s' to `%s'"), in_name, out_name);
+      ret = !compress_func (in_name, tmp_name);
+      if (!ret)
+	{
+	  grub_util_unlink (tmp_name);
+	  if (is_needed)
+	    grub_util_warn (_("can't compress `%s' to `%s'"), in_name, out_name);
+	}
+      else if (files_identical (tmp_name, out_name))
+	{
+	  grub_util_info ("`%s' is up to date", out_name);
+	  grub_util_unlink (tmp_name);
+	}
+      else if (grub_util_rename (tmp_name, out_name) < 0)
+	{
+	  grub_util_unlink (tmp_name);
+	  ret = 0;
+	}
+      free (tmp_name);
     }
 
   if (!ret && is_needed)
@@ -148,6 +224,115 @@ grub_install_compress_file (const char *in_name,
   return ret;
 }
 
+/* Files to install.  Copies are queued and run by copy_run, in parallel
+   when threads are available, and the list is kept until the end of
+   grub_install_copy_files so that old files that weren't installed again
+   can be removed.  */
+struct copy_job
+{
+  char *src;
+  char *dst;
+  int is_needed;
+  int done;
+};
+
+static struct copy_job *copy_jobs;
+static size_t copy_njobs, copy_alloc, copy_next;
+
+#define GRUB_INSTALL_COPY_THREADS 8
+
+static void
+copy_queue (const char *src, const char *dst, int is_needed)
+{
+  if (copy_njobs == copy_alloc)
+    {
+      copy_alloc = copy_alloc ? 2 * copy_alloc : 64;
+      copy_jobs = xrealloc (copy_jobs, copy_alloc * sizeof (copy_jobs[0]));
+    }
+  copy_jobs[copy_njobs].src = xstrdup (src);
+  copy_jobs[copy_njobs].dst = xstrdup (dst);
+  copy_jobs[copy_njobs].is_needed = is_needed;
+  copy_jobs[copy_njobs].done = 0;
+  copy_njobs++;
+}
+
+static void *
+copy_worker (void *arg __attribute__ ((unused)))
+{
+  size_t i;
+
+#ifdef HAVE_PTHREAD
+  while ((i = __sync_fetch_and_add (&copy_next, 1)) < copy_njobs)
+#else
+  while ((i = copy_next++) < copy_njobs)
+#endif
+    copy_jobs[i].done = grub_install_compress_file (copy_jobs[i].src,
+						    copy_jobs[i].dst,
+						    copy_jobs[i].is_needed);
+  return NULL;
+}
+
+/* Run the queued copies.  */
+static void
+copy_run (void)
+{
+  size_t pending = copy_njobs - copy_next;
+#ifdef HAVE_PTHREAD
+  pthread_t threads[GRUB_INSTALL_COPY_THREADS];
+  size_t nthreads, i;
+
+  nthreads = pending < GRUB_INSTALL_COPY_THREADS
+    ? pending : GRUB_INSTALL_COPY_THREADS;
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create (&threads[i], NULL, copy_worker, NULL) != 0)
+      break;
+  nthreads = i;
+  /* Help, and do everything if no thread could be started.  */
+  copy_worker (NULL);
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+#else
+  (void) pending;
+  copy_worker (NULL);
+#endif
+  copy_next = copy_njobs;
+}
+
+/* Copy SRC to DST right away and return whether it was done.  */
+static int
+copy_now (const char *src, const char *dst, int is_needed)
+{
+  copy_queue (src, dst, is_needed);
+  copy_run ();
+  return copy_jobs[copy_njobs - 1].done;
+}
+
+static int
+copy_installed (const char *dst)
+{
+  size_t i;
+
+  for (i = 0; i < copy_njobs; i++)
+    if (copy_jobs[i].done && strcmp (copy_jobs[i].dst, dst) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+copy_reset (void)
+{
+  size_t i;
+
+  for (i = 0; i < copy_njobs; i++)
+    {
+      free (copy_jobs[i].src);
+      free (copy_jobs[i].dst);
+    }
+  free (copy_jobs);
+  copy_jobs = NULL;
+  copy_njobs = copy_alloc = copy_next = 0;
+}
+
 static int
 is_path_separator (char c)
 {
@@ -196,12 +381,18 @@ clean_grub_dir (const char *di)
       if ((ext && (strcmp (ext, ".mod") == 0
 		   || strcmp (ext, ".lst") == 0
 		   || strcmp (ext, ".img") == 0
+		   || strcmp (ext, ".pak") == 0
 		   || strcmp (ext, ".mo") == 0)
 	   && strcmp (de->d_name, "menu.lst") != 0)
 	  || strcmp (de->d_name, "efiemu32.o") == 0
 	  || strcmp (de->d_name, "efiemu64.o") == 0)
 	{
 	  char *x = grub_util_path_concat (2, di, de->d_name);
+	  if (copy_installed (x))
+	    {
+	      free (x);
+	      continue;
+	    }
 	  if (grub_util_unlink (x) < 0)
 	    grub_util_error (_("cannot delete `%s': %s"), x,
 			     grub_util_fd_strerror ());
@@ -318,6 +509,8 @@ grub_install_parse (int key, char *arg)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	compression = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	compression = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -387,6 +580,9 @@ grub_install_parse (int key, char *arg)
 	  return 1;
 	}
       grub_util_error (_("Unrecognized compression `%s'"), arg);
+    case GRUB_INSTALL_OPTIONS_PACK_MODULES:
+      pack_modules = 1;
+      return 1;
     case GRUB_INSTALL_OPTIONS_GRUB_MKIMAGE:
       return 1;
     default:
@@ -432,6 +628,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
       [GRUB_COMPRESSION_NONE] = "none",
       [GRUB_COMPRESSION_XZ] = "xz",
       [GRUB_COMPRESSION_LZMA] = "lzma",
+      [GRUB_COMPRESSION_LZ4] = "lz4",
     };
   grub_size_t slen = 1;
   char *s, *p;
@@ -497,7 +694,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
     grub_util_error (_("unknown target format %s"), mkimage_target);
 
   grub_install_generate_image (dir, prefix, fp, outname,
-			       modules.entries, memdisk_path,
+			       modules.entries, NULL, memdisk_path,
 			       pubkeys, npubkeys, config_path, tgt,
 			       note, compression);
   while (dc--)
@@ -546,7 +743,7 @@ copy_by_ext (const char *srcd,
 	{
 	  char *srcf = grub_util_path_concat (2, srcd, de->d_name);
 	  char *dstf = grub_util_path_concat (2, dstd, de->d_name);
-	  grub_install_compress_file (srcf, dstf, 1);
+	  copy_queue (srcf, dstf, 1);
 	  free (srcf);
 	  free (dstf);
 	}
@@ -578,7 +775,7 @@ copy_all (const char *srcd,
 	  || grub_util_is_directory (srcf))
 	continue;
       dstf = grub_util_path_concat (2, dstd, de->d_name);
-      grub_install_compress_file (srcf, dstf, 1);
+      copy_queue (srcf, dstf, 1);
       free (srcf);
       free (dstf);
     }
@@ -633,7 +830,7 @@ copy_locales (const char *dstd)
 					    "LC_MESSAGES", PACKAGE, ".mo");
 	  dstf = grub_util_path_concat_ext (2, dstd, de->d_name, ".mo");
 	}
-      grub_install_compress_file (srcf, dstf, 0);
+      copy_queue (srcf, dstf, 0);
       free (srcf);
       free (dstf);
     }
@@ -718,6 +915,171 @@ grub_install_get_platform_platform (enum grub_install_plat platid)
 }
 
 
+struct pack_module
+{
+  char *name;
+  char **deps;
+  char *image;
+  size_t size;
+  grub_uint32_t offset;
+};
+
+static int
+pack_module_cmp (const void *a, const void *b)
+{
+  const struct pack_module *const *ma = a;
+  const struct pack_module *const *mb = b;
+
+  return strcmp ((*ma)->name, (*mb)->name);
+}
+
+/* Write the modules being installed from SRC, together with their
+   dependencies, into a single module pack in DST_PLATFORM.  */
+static void
+make_module_pack (const char *src, const char *dst_platform)
+{
+  struct grub_util_path_list *path_list, *p;
+  struct pack_module *mods, **sorted;
+  struct grub_modpack_header hdr;
+  struct grub_modpack_entry *entries;
+  char **names, *strings, *ptr;
+  size_t n = 0, i, strings_size = 0, offset;
+  char *tmpf, *dstf;
+  FILE *fp;
+
+  if (install_modules.is_default)
+    {
+      grub_util_fd_dir_t d;
+      grub_util_fd_dirent_t de;
+      size_t alloc = 32;
+
+      names = xmalloc (alloc * sizeof (names[0]));
+      d = grub_util_fd_opendir (src);
+      if (!d)
+	grub_util_error (_("cannot open directory `%s': %s"),
+			 src, grub_util_fd_strerror ());
+      while ((de = grub_util_fd_readdir (d)))
+	{
+	  const char *ext = strrchr (de->d_name, '.');
+	  if (!ext || strcmp (ext, ".mod") != 0)
+	    continue;
+	  if (n + 1 >= alloc)
+	    {
+	      alloc *= 2;
+	      names = xrealloc (names, alloc * sizeof (names[0]));
+	    }
+	  names[n++] = xstrdup (de->d_name);
+	}
+      grub_util_fd_closedir (d);
+      names[n] = NULL;
+      path_list = grub_util_resolve_dependencies (src, "moddep.lst", names);
+      for (i = 0; i < n; i++)
+	free (names[i]);
+      free (names);
+    }
+  else
+    path_list = grub_util_resolve_dependencies (src, "moddep.lst",
+						install_modules.entries);
+
+  n = 0;
+  for (p = path_list; p; p = p->next)
+    n++;
+  if (n == 0)
+    {
+      grub_util_free_path_list (path_list);
+      return;
+    }
+
+  /* The list is in dependency order already, which is the order the
+     images are laid out in.  */
+  mods = xmalloc (n * sizeof (mods[0]));
+  sorted = xmalloc (n * sizeof (sorted[0]));
+  for (p = path_list, i = 0; p; p = p->next, i++)
+    {
+      const char *base = strrchr (p->name, '/');
+      char **dep;
+
+      base = base ? base + 1 : p->name;
+      mods[i].name = xstrdup (base);
+      *strrchr (mods[i].name, '.') = '\0';
+      mods[i].deps = grub_util_get_module_deps (src, "moddep.lst",
+						mods[i].name);
+      mods[i].size = grub_util_get_image_size (p->name);
+      mods[i].image = grub_util_read_image (p->name);
+      sorted[i] = &mods[i];
+
+      strings_size += strlen (mods[i].name) + 1;
+      for (dep = mods[i].deps; *dep; dep++)
+	strings_size += strlen (*dep) + 1;
+      strings_size++;
+    }
+  qsort (sorted, n, sizeof (sorted[0]), pack_module_cmp);
+
+  offset = sizeof (hdr) + n * sizeof (entries[0]) + strings_size;
+  for (i = 0; i < n; i++)
+    {
+      mods[i].offset = offset;
+      offset += mods[i].size;
+    }
+  if (offset > GRUB_UINT_MAX)
+    grub_util_error (_("module pack is too big"));
+
+  entries = xmalloc (n * sizeof (entries[0]));
+  ptr = strings = xmalloc (strings_size);
+  for (i = 0; i < n; i++)
+    {
+      char **dep;
+
+      entries[i].name = grub_cpu_to_le32 (ptr - strings);
+      ptr = grub_stpcpy (ptr, sorted[i]->name) + 1;
+      entries[i].deps = grub_cpu_to_le32 (ptr - strings);
+      for (dep = sorted[i]->deps; *dep; dep++)
+	ptr = grub_stpcpy (ptr, *dep) + 1;
+      *ptr++ = '\0';
+      entries[i].offset = grub_cpu_to_le32 (sorted[i]->offset);
+      entries[i].size = grub_cpu_to_le32 (sorted[i]->size);
+    }
+
+  memcpy (hdr.magic, GRUB_MODPACK_MAGIC, sizeof (hdr.magic));
+  hdr.count = grub_cpu_to_le32 (n);
+  hdr.toc_size = grub_cpu_to_le32 (n * sizeof (entries[0]) + strings_size);
+
+  tmpf = grub_util_path_concat (2, dst_platform, GRUB_MODPACK_FILENAME ".tmp");
+  dstf = grub_util_path_concat (2, dst_platform, GRUB_MODPACK_FILENAME);
+  grub_util_info ("writing %u modules to `%s'", (unsigned) n, dstf);
+
+  fp = grub_util_fopen (tmpf, "wb");
+  if (!fp)
+    grub_util_error (_("cannot open `%s': %s"), tmpf, strerror (errno));
+  grub_util_write_image ((char *) &hdr, sizeof (hdr), fp, tmpf);
+  grub_util_write_image ((char *) entries, n * sizeof (entries[0]), fp, tmpf);
+  grub_util_write_image (strings, strings_size, fp, tmpf);
+  for (i = 0; i < n; i++)
+    grub_util_write_image (mods[i].image, mods[i].size, fp, tmpf);
+  fclose (fp);
+
+  copy_now (tmpf, dstf, 1);
+  grub_util_unlink (tmpf);
+
+  for (i = 0; i < n; i++)
+    {
+      char **dep;
+
+      for (dep = mods[i].deps; *dep; dep++)
+	free (*dep);
+      free (mods[i].deps);
+      free (mods[i].name);
+      free (mods[i].image);
+    }
+  free (mods);
+  free (sorted);
+  free (entries);
+  free (strings);
+  free (tmpf);
+  free (dstf);
+  grub_util_free_path_list (path_list);
+}
+
 void
 grub_install_copy_files (const char *src,
 			 const char *dst,
@@ -738,9 +1100,6 @@ grub_install_copy_files (const char *src,
   dst_fonts = grub_util_path_concat (2, dst, "fonts");
   grub_install_mkdir_p (dst_platform);
   grub_install_mkdir_p (dst_locale);
-  clean_grub_dir (dst);
-  clean_grub_dir (dst_platform);
-  clean_grub_dir (dst_locale);
 
   if (install_modules.is_default)
     copy_by_ext (src, dst_platform, ".mod", 1);
@@ -762,16 +1121,19 @@ grub_install_copy_files (const char *src,
 	  else
 	    dir = srcf;
 	  dstf = grub_util_path_concat (2, dst_platform, dir);
-	  grub_install_compress_file (srcf, dstf, 1);
+	  copy_queue (srcf, dstf, 1);
 	  free (dstf);
 	}
 
       grub_util_free_path_list (path_list);
     }
 
+  if (pack_modules)
+    make_module_pack (src, dst_platform);
+
   const char *pkglib_DATA[] = {"efiemu32.o", "efiemu64.o",
 			       "moddep.lst", "command.lst",
-			       "fs.lst", "partmap.lst",
+			       "fs.lst", "fssig.lst", "partmap.lst",
 			       "parttool.lst",
 			       "video.lst", "crypto.lst",
 			       "terminal.lst", "modinfo.sh" };
@@ -782,9 +1144,9 @@ grub_install_copy_files (const char *src,
       char *srcf = grub_util_path_concat (2, src, pkglib_DATA[i]);
       char *dstf = grub_util_path_concat (2, dst_platform, pkglib_DATA[i]);
       if (i == 0 || i == 1)
-	grub_install_compress_file (srcf, dstf, 0);
+	copy_queue (srcf, dstf, 0);
       else
-	grub_install_compress_file (srcf, dstf, 1);
+	copy_queue (srcf, dstf, 1);
       free (srcf);
       free (dstf);
     }
@@ -809,7 +1171,7 @@ grub_install_copy_files (const char *src,
 	  char *dstf = grub_util_path_concat_ext (2, dst_locale,
 						install_locales.entries[i],
 						".mo");
-	  if (grub_install_compress_file (srcf, dstf, 0))
+	  if (copy_now (srcf, dstf, 0))
 	    {
 	      free (srcf);
 	      free (dstf);
@@ -822,7 +1184,7 @@ grub_install_copy_files (const char *src,
 						 "LC_MESSAGES",
 						 PACKAGE,
 						 ".mo");
-	  if (grub_install_compress_file (srcf, dstf, 0))
+	  if (copy_now (srcf, dstf, 0))
 	    {
 	      free (srcf);
 	      free (dstf);
@@ -889,11 +1251,19 @@ grub_install_copy_files (const char *src,
 						   install_fonts.entries[i],
 						   ".pf2");
 
-      grub_install_compress_file (srcf, dstf, 0);
+      copy_queue (srcf, dstf, 0);
       free (srcf);
       free (dstf);
     }
 
+  copy_run ();
+
+  /* Remove what is left of a previous installation.  */
+  clean_grub_dir (dst);
+  clean_grub_dir (dst_platform);
+  clean_grub_dir (dst_locale);
+  copy_reset ();
+
   free (dst_platform);
   free (dst_locale);
   free (dst_fonts);
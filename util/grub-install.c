@@ -400,10 +400,29 @@ push_partmap_module (const char *map, void *data __attribute__ ((unused)))
   grub_install_push_module (buf);
 }
 
+static void
+push_hw_module (const char *hw)
+{
+  char *name = xasprintf ("%s.mod", hw);
+  char *path = grub_util_path_concat (2, grub_install_source_directory, name);
+
+  if (grub_util_is_regular (path))
+    grub_install_push_module (hw);
+  free (path);
+  free (name);
+}
+
 static void
 push_cryptodisk_module (const char *mod, void *data __attribute__ ((unused)))
 {
   grub_install_push_module (mod);
+
+  /* Let AES and SHA-2 use the instructions of the CPU if the platform has
+     them.  */
+  if (strcmp (mod, "gcry_rijndael") == 0)
+    push_hw_module ("aes_hw");
+  if (strcmp (mod, "gcry_sha256") == 0 || strcmp (mod, "gcry_sha512") == 0)
+    push_hw_module ("sha_hw");
 }
 
 static void
@@ -1280,6 +1299,7 @@ main (int argc, char *argv[])
     {
       grub_install_push_module ("pata");
       grub_install_push_module ("ahci");
+      grub_install_push_module ("nvme");
       grub_install_push_module ("ohci");
       grub_install_push_module ("uhci");
       grub_install_push_module ("ehci");
@@ -43,6 +43,12 @@
 
 #include <errno.h>
 
+#if defined (HAVE_PTHREAD) && !defined (GRUB_BUILD)
+#include <pthread.h>
+#include <unistd.h>
+#define GRUB_MKFONT_THREADS 1
+#endif
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_TRUETYPE_TAGS_H
@@ -114,20 +120,36 @@ struct grub_font_info
 
 static int font_verbosity;
 
+/* Append the WIDTH bits of ROW starting at bit START, most significant bit
+   first, to the bit stream in *ACC and *NBITS, flushing full bytes to *DATA.  */
 static void
-add_pixel (grub_uint8_t **data, int *mask, int not_blank)
+add_row (grub_uint8_t **data, grub_uint32_t *acc, int *nbits,
+	 const grub_uint8_t *row, int start, int width)
 {
-  if (*mask == 0)
+  const grub_uint8_t *src = row + start / 8;
+  int shift = start & 7;
+  int n;
+
+  for (; width > 0; width -= n, src++)
     {
-      (*data)++;
-      **data = 0;
-      *mask = 128;
+      grub_uint32_t bits;
+
+      n = width < 8 ? width : 8;
+      /* The next 8 bits of the row, whatever is left of the byte
+	 followed by the top of the next one if needed.  */
+      bits = (grub_uint8_t) (src[0] << shift);
+      if (shift && n > 8 - shift)
+	bits |= src[1] >> (8 - shift);
+      bits >>= 8 - n;
+
+      *acc = (*acc << n) | bits;
+      *nbits += n;
+      if (*nbits >= 8)
+	{
+	  *nbits -= 8;
+	  *(*data)++ = *acc >> *nbits;
+	}
     }
-
-  if (not_blank)
-    **data |= *mask;
-
-  *mask >>= 1;
 }
 
 static void
@@ -138,7 +160,8 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
   int width, height;
   int cuttop, cutbottom, cutleft, cutright;
   grub_uint8_t *data;
-  int mask, i, j, bitmap_size;
+  grub_uint32_t acc;
+  int nbits, j, bitmap_size;
   FT_GlyphSlot glyph;
   int flag = FT_LOAD_RENDER | FT_LOAD_MONOCHROME;
   FT_Error err;
@@ -263,13 +286,14 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
   if (glyph_info->y_ofs + height > font_info->max_y)
     font_info->max_y = glyph_info->y_ofs + height;
 
-  mask = 0;
-  data = &glyph_info->bitmap[0] - 1;
+  acc = 0;
+  nbits = 0;
+  data = &glyph_info->bitmap[0];
   for (j = cuttop; j < height + cuttop; j++)
-    for (i = cutleft; i < width + cutleft; i++)
-      add_pixel (&data, &mask,
-		 glyph->bitmap.buffer[i / 8 + j * glyph->bitmap.pitch] &
-		 (1 << (7 - (i & 7))));
+    add_row (&data, &acc, &nbits,
+	     glyph->bitmap.buffer + j * glyph->bitmap.pitch, cutleft, width);
+  if (nbits)
+    *data = acc << (8 - nbits);
 }
 
 struct glyph_replace *subst_rightjoin, *subst_leftjoin, *subst_medijoin;
@@ -587,11 +611,184 @@ process_cursive (struct gsub_feature *feature,
     }
 }
 
+#ifdef GRUB_MKFONT_THREADS
+
+/* Chunks of characters per thread: enough to keep the threads busy when
+   some ranges are much more expensive than others.  */
+#define GRUB_MKFONT_CHUNKS_PER_THREAD	4
+
+struct render_chunk
+{
+  const char *file;
+  int font_index;
+  const grub_uint32_t *codes;
+  size_t ncodes;
+  int nocut;
+  int failed;
+  /* Copy of the font parameters receiving this chunk's glyphs.  */
+  struct grub_font_info part;
+};
+
+struct render_job
+{
+  struct render_chunk *chunks;
+  size_t nchunks;
+  size_t next;
+};
+
+static int
+render_chunk (struct render_chunk *chunk)
+{
+  FT_Library lib;
+  FT_Face face;
+  size_t i;
+
+  /* Neither the library nor the face may be shared between threads.  */
+  if (FT_Init_FreeType (&lib))
+    return 0;
+  if (FT_New_Face (lib, chunk->file, chunk->font_index, &face))
+    {
+      FT_Done_FreeType (lib);
+      return 0;
+    }
+  if (FT_Set_Pixel_Sizes (face, chunk->part.size, chunk->part.size))
+    {
+      FT_Done_Face (face);
+      FT_Done_FreeType (lib);
+      return 0;
+    }
+
+  for (i = 0; i < chunk->ncodes; i++)
+    add_char (&chunk->part, face, chunk->codes[i], chunk->nocut);
+
+  FT_Done_Face (face);
+  FT_Done_FreeType (lib);
+  return 1;
+}
+
+static void *
+render_thread (void *arg)
+{
+  struct render_job *job = arg;
+  size_t i;
+
+  while ((i = __sync_fetch_and_add (&job->next, 1)) < job->nchunks)
+    job->chunks[i].failed = !render_chunk (&job->chunks[i]);
+
+  return NULL;
+}
+
+#endif
+
+/* Render CODES, which all have a glyph in FACE.  With threads every thread
+   opens FILE again and the results are merged in order, so the output
+   doesn't depend on the scheduling.  */
 static void
-add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
+render_chars (struct grub_font_info *font_info, FT_Face face,
+	      const char *file, int font_index,
+	      const grub_uint32_t *codes, size_t ncodes, int nocut)
+{
+  size_t i;
+#ifdef GRUB_MKFONT_THREADS
+  struct render_job job;
+  pthread_t *threads;
+  long nthreads;
+  size_t chunk_size;
+  int err;
+
+  nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (nthreads > 1 && ncodes >= 256)
+    {
+      job.nchunks = nthreads * GRUB_MKFONT_CHUNKS_PER_THREAD;
+      if (job.nchunks > ncodes / 64)
+	job.nchunks = ncodes / 64;
+      chunk_size = (ncodes + job.nchunks - 1) / job.nchunks;
+      job.nchunks = (ncodes + chunk_size - 1) / chunk_size;
+      job.next = 0;
+      job.chunks = xmalloc (job.nchunks * sizeof (job.chunks[0]));
+      for (i = 0; i < job.nchunks; i++)
+	{
+	  struct render_chunk *chunk = &job.chunks[i];
+
+	  chunk->file = file;
+	  chunk->font_index = font_index;
+	  chunk->codes = codes + i * chunk_size;
+	  chunk->ncodes = ncodes - i * chunk_size;
+	  if (chunk->ncodes > chunk_size)
+	    chunk->ncodes = chunk_size;
+	  chunk->nocut = nocut;
+	  chunk->failed = 1;
+	  chunk->part = *font_info;
+	  chunk->part.glyphs_unsorted = NULL;
+	  chunk->part.num_glyphs = 0;
+	}
+
+      if ((size_t) nthreads > job.nchunks)
+	nthreads = job.nchunks;
+      threads = xmalloc (nthreads * sizeof (threads[0]));
+      for (i = 0; i < (size_t) nthreads; i++)
+	{
+	  err = pthread_create (&threads[i], NULL, render_thread, &job);
+	  if (err)
+	    {
+	      grub_util_info ("couldn't create thread: %s", strerror (err));
+	      break;
+	    }
+	}
+      /* Whatever the threads didn't get to is rendered here.  */
+      render_thread (&job);
+      nthreads = i;
+      for (i = 0; i < (size_t) nthreads; i++)
+	pthread_join (threads[i], NULL);
+      free (threads);
+
+      /* Glyphs are prepended, so a later chunk goes in front.  */
+      for (i = 0; i < job.nchunks; i++)
+	{
+	  struct render_chunk *chunk = &job.chunks[i];
+	  struct grub_glyph_info *last;
+	  size_t j;
+
+	  if (chunk->failed)
+	    for (j = 0; j < chunk->ncodes; j++)
+	      add_char (font_info, face, chunk->codes[j], nocut);
+
+	  if (!chunk->part.glyphs_unsorted)
+	    continue;
+	  for (last = chunk->part.glyphs_unsorted; last->next;
+	       last = last->next);
+	  last->next = font_info->glyphs_unsorted;
+	  font_info->glyphs_unsorted = chunk->part.glyphs_unsorted;
+	  font_info->num_glyphs += chunk->part.num_glyphs;
+	  if (chunk->part.max_width > font_info->max_width)
+	    font_info->max_width = chunk->part.max_width;
+	  if (chunk->part.max_height > font_info->max_height)
+	    font_info->max_height = chunk->part.max_height;
+	  if (chunk->part.min_y < font_info->min_y)
+	    font_info->min_y = chunk->part.min_y;
+	  if (chunk->part.max_y > font_info->max_y)
+	    font_info->max_y = chunk->part.max_y;
+	}
+      free (job.chunks);
+      return;
+    }
+#else
+  (void) file;
+  (void) font_index;
+#endif
+
+  for (i = 0; i < ncodes; i++)
+    add_char (font_info, face, codes[i], nocut);
+}
+
+static void
+add_font (struct grub_font_info *font_info, FT_Face face,
+	  const char *file, int font_index, int nocut)
 {
   struct gsub_header *gsub = NULL;
   FT_ULong gsub_len = 0;
+  grub_uint32_t *codes = NULL;
+  size_t ncodes = 0, codes_max = 0;
 
   if (!FT_Load_Sfnt_Table (face, TTAG_GSUB, 0, NULL, &gsub_len))
     {
@@ -668,7 +865,15 @@ add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
       for (i = 0; i < font_info->num_range; i++)
 	for (j = font_info->ranges[i * 2]; j <= font_info->ranges[i * 2 + 1];
 	     j++)
-	  add_char (font_info, face, j, nocut);
+	  if (FT_Get_Char_Index (face, j))
+	    {
+	      if (ncodes == codes_max)
+		{
+		  codes_max = codes_max ? 2 * codes_max : 1024;
+		  codes = xrealloc (codes, codes_max * sizeof (codes[0]));
+		}
+	      codes[ncodes++] = j;
+	    }
     }
   else
     {
@@ -677,8 +882,18 @@ add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
       for (char_code = FT_Get_First_Char (face, &glyph_index);
 	   glyph_index;
 	   char_code = FT_Get_Next_Char (face, char_code, &glyph_index))
-	add_char (font_info, face, char_code, nocut);
+	{
+	  if (ncodes == codes_max)
+	    {
+	      codes_max = codes_max ? 2 * codes_max : 1024;
+	      codes = xrealloc (codes, codes_max * sizeof (codes[0]));
+	    }
+	  codes[ncodes++] = char_code;
+	}
     }
+
+  render_chars (font_info, face, file, font_index, codes, ncodes, nocut);
+  free (codes);
 }
 
 static void
@@ -1233,7 +1448,8 @@ main (int argc, char *argv[])
 			   size, size, err,
 			   (err > 0 && err < (signed) ARRAY_SIZE (ft_errmsgs))
 			   ? ft_errmsgs[err] : "");
-	add_font (&arguments.font_info, ft_face, arguments.file_format != PF2);
+	add_font (&arguments.font_info, ft_face, arguments.files[i],
+		  arguments.font_index, arguments.file_format != PF2);
 	FT_Done_Face (ft_face);
       }
   }
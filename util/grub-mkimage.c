@@ -73,13 +73,17 @@ static struct argp_option options[] = {
       " but the prefix itself can be overridden by later options"), 0},
    /* TRANSLATORS: "embed" is a verb (command description).  "*/
   {"config",   'c', N_("FILE"), 0, N_("embed FILE as an early config"), 0},
+  /* TRANSLATORS: "embed" is a verb (command description).  "*/
+  {"defer",   'D', N_("MODULE"), 0,
+   N_("embed MODULE but load it only when first needed, e.g. by a command"
+      " it provides or by insmod"), 0},
    /* TRANSLATORS: "embed" is a verb (command description).  "*/
   {"pubkey",   'k', N_("FILE"), 0, N_("embed FILE as public key for signature checking"), 0},
   /* TRANSLATORS: NOTE is a name of segment.  */
   {"note",   'n', 0, 0, N_("add NOTE segment for CHRP IEEE1275"), 0},
   {"output",  'o', N_("FILE"), 0, N_("output a generated image to FILE [default=stdout]"), 0},
   {"format",  'O', N_("FORMAT"), 0, 0, 0},
-  {"compression",  'C', "(xz|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"compression",  'C', "(xz|lz4|none|auto)", 0, N_("choose the compression to use for core image"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -113,6 +117,8 @@ struct arguments
   size_t nmodules;
   size_t modules_max;
   char **modules;
+  char **deferred;
+  size_t ndeferred;
   char *output;
   char *dir;
   char *prefix;
@@ -183,6 +189,17 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->pubkeys[arguments->npubkeys++] = xstrdup (arg);
       break;
 
+    case 'D':
+      arguments->deferred = xrealloc (arguments->deferred,
+				      sizeof (arguments->deferred[0])
+				      * (arguments->ndeferred + 2));
+      arguments->deferred[arguments->ndeferred++] = xstrdup (arg);
+      arguments->deferred[arguments->ndeferred] = NULL;
+
+      assert (arguments->nmodules < arguments->modules_max);
+      arguments->modules[arguments->nmodules++] = xstrdup (arg);
+      break;
+
     case 'c':
       if (arguments->config)
 	free (arguments->config);
@@ -200,6 +217,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	arguments->comp = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	arguments->comp = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -296,6 +315,7 @@ main (int argc, char *argv[])
 
   grub_install_generate_image (arguments.dir, arguments.prefix, fp,
 			       arguments.output, arguments.modules,
+			       arguments.deferred,
 			       arguments.memdisk, arguments.pubkeys,
 			       arguments.npubkeys, arguments.config,
 			       arguments.image_target, arguments.note,
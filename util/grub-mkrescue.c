@@ -36,6 +36,8 @@
 
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 
 static char *source_dirs[GRUB_INSTALL_PLATFORM_MAX];
 static char *rom_directory;
@@ -243,6 +245,60 @@ write_part (FILE *f, const char *srcdir)
   fclose (in);
 }
 
+/* The core images of the different platforms don't depend on each other,
+   so each one is built in a child process, up to image_jobs at a time.
+   wait_images must be called before using them.  */
+static pid_t *image_pids;
+static int image_npids;
+static int image_jobs;
+
+static void
+wait_image (pid_t pid)
+{
+  int status;
+
+  if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status)
+      || WEXITSTATUS (status) != 0)
+    grub_util_error ("%s", _("building a core image failed"));
+}
+
+static void
+wait_images (void)
+{
+  int i;
+
+  for (i = 0; i < image_npids; i++)
+    wait_image (image_pids[i]);
+  image_npids = 0;
+}
+
+/* Return 0 in the child process that is to build the image.  */
+static pid_t
+start_image (void)
+{
+  pid_t pid;
+
+  if (!image_pids)
+    image_pids = xmalloc (image_jobs * sizeof (image_pids[0]));
+
+  if (image_npids == image_jobs)
+    {
+      wait_image (image_pids[0]);
+      memmove (image_pids, image_pids + 1,
+	       (image_npids - 1) * sizeof (image_pids[0]));
+      image_npids--;
+    }
+
+  fflush (stdout);
+  fflush (stderr);
+  pid = fork ();
+  if (pid < 0)
+    grub_util_error (_("Unable to fork: %s"), strerror (errno));
+  if (pid > 0)
+    image_pids[image_npids++] = pid;
+  return pid;
+}
+
 static void
 make_image_abs (enum grub_install_plat plat,
 		const char *mkimage_target,
@@ -251,7 +307,7 @@ make_image_abs (enum grub_install_plat plat,
   char *load_cfg;
   FILE *load_cfg_f;
 
-  if (!source_dirs[plat])
+  if (!source_dirs[plat] || start_image ())
     return;
 
   grub_util_info (N_("enabling %s support ..."),
@@ -271,9 +327,8 @@ make_image_abs (enum grub_install_plat plat,
   grub_install_make_image_wrap (source_dirs[plat], "/boot/grub", output,
 				0, load_cfg,
 				mkimage_target, 0);
-  grub_install_pop_module ();
-  grub_install_pop_module ();
   grub_util_unlink (load_cfg);
+  exit (0);
 }
 
 static void
@@ -294,7 +349,7 @@ make_image_fwdisk_abs (enum grub_install_plat plat,
   char *load_cfg;
   FILE *load_cfg_f;
 
-  if (!source_dirs[plat])
+  if (!source_dirs[plat] || start_image ())
     return;
 
   grub_util_info (N_("enabling %s support ..."),
@@ -309,8 +364,8 @@ make_image_fwdisk_abs (enum grub_install_plat plat,
   grub_install_push_module ("iso9660");
   grub_install_make_image_wrap (source_dirs[plat], "()/boot/grub", output,
 				0, load_cfg, mkimage_target, 0);
-  grub_install_pop_module ();
   grub_util_unlink (load_cfg);
+  exit (0);
 }
 
 static int
@@ -430,6 +485,10 @@ main (int argc, char *argv[])
   grub_util_host_init (&argc, &argv);
   grub_util_disable_fd_syncs ();
 
+  image_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (image_jobs < 1)
+    image_jobs = 1;
+
   pkgdatadir = grub_util_get_pkgdatadir ();
 
   product_name = xstrdup (PACKAGE_NAME);
@@ -762,6 +821,8 @@ main (int argc, char *argv[])
 			     imgname);
       free (imgname);
 
+      wait_images ();
+
       if (source_dirs[GRUB_INSTALL_PLATFORM_I386_EFI])
 	{
 	  imgname = grub_util_path_concat (2, efidir_efi_boot, "boot.efi");
@@ -918,6 +979,8 @@ main (int argc, char *argv[])
   grub_install_pop_module ();
   grub_install_pop_module ();
 
+  wait_images ();
+
   if (rom_directory)
     {
       const struct
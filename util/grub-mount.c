@@ -34,12 +34,19 @@
 #include <grub/command.h>
 #include <grub/zfs/zfs.h>
 #include <grub/i18n.h>
+#include <grub/emu/hostfile.h>
 #include <fuse/fuse.h>
 
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 #pragma GCC diagnostic ignored "-Wmissing-declarations"
@@ -58,6 +65,7 @@ static char **fuse_args = NULL;
 static int fuse_argc = 0;
 static int num_disks = 0;
 static int mount_crypt = 0;
+static int jobs = 1;
 
 static grub_err_t
 execute_command (const char *name, int n, char **args)
@@ -121,7 +129,7 @@ translate_error (void)
   return ret;
 }
 
-/* Context for fuse_getattr.  */
+/* Context for do_getattr.  */
 struct fuse_getattr_ctx
 {
   char *filename;
@@ -147,7 +155,7 @@ fuse_getattr_find_file (const char *cur_filename,
 }
 
 static int
-fuse_getattr (const char *path, struct stat *st)
+do_getattr (const char *path, struct stat *st)
 {
   struct fuse_getattr_ctx ctx;
   char *pathname, *path2;
@@ -236,31 +244,71 @@ fuse_opendir (const char *path, struct fuse_file_info *fi)
   return 0;
 }
 
-/* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
+/* Files opened by fuse_open, indexed by handle.  Handles are never reused,
+   so a file that was dropped from here can be reopened by path when it is
+   read again; this way workers keep the files they read open without being
+   told about opens and releases that went to other workers.  */
+#define FILE_CACHE_SIZE 64
 
-static int 
-fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
+static struct
 {
+  grub_uint64_t handle;
   grub_file_t file;
+} file_cache[FILE_CACHE_SIZE];
+
+static grub_uint64_t last_handle;
+
+static void
+file_cache_drop (grub_uint64_t handle)
+{
+  unsigned slot = handle % FILE_CACHE_SIZE;
+
+  if (file_cache[slot].handle != handle || !file_cache[slot].file)
+    return;
+  grub_file_close (file_cache[slot].file);
+  file_cache[slot].file = NULL;
+  file_cache[slot].handle = 0;
+}
+
+static grub_file_t
+file_cache_get (grub_uint64_t handle, const char *path)
+{
+  unsigned slot = handle % FILE_CACHE_SIZE;
+  grub_file_t file;
+
+  if (file_cache[slot].handle == handle && file_cache[slot].file)
+    return file_cache[slot].file;
+
   file = grub_file_open (path);
   if (! file)
+    return NULL;
+  if (file_cache[slot].file)
+    grub_file_close (file_cache[slot].file);
+  file_cache[slot].handle = handle;
+  file_cache[slot].file = file;
+  return file;
+}
+
+static int
+do_open (grub_uint64_t handle, const char *path)
+{
+  if (! file_cache_get (handle, path))
     return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
   grub_errno = GRUB_ERR_NONE;
   return 0;
-} 
+}
 
-static int 
-fuse_read (const char *path, char *buf, size_t sz, off_t off,
-	   struct fuse_file_info *fi)
+static int
+do_read (grub_uint64_t handle, const char *path, char *buf, size_t sz,
+	 off_t off)
 {
-  grub_file_t file = files[fi->fh];
+  grub_file_t file;
   grub_ssize_t size;
 
+  file = file_cache_get (handle, path);
+  if (! file)
+    return translate_error ();
+
   if (off > file->size)
     return -EINVAL;
 
@@ -274,18 +322,9 @@ fuse_read (const char *path, char *buf, size_t sz, off_t off,
       grub_errno = GRUB_ERR_NONE;
       return size;
     }
-} 
-
-static int 
-fuse_release (const char *path, struct fuse_file_info *fi)
-{
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
-  grub_errno = GRUB_ERR_NONE;
-  return 0;
 }
 
-/* Context for fuse_readdir.  */
+/* Context for do_readdir.  */
 struct fuse_readdir_ctx
 {
   const char *path;
@@ -293,7 +332,7 @@ struct fuse_readdir_ctx
   fuse_fill_dir_t fill;
 };
 
-/* Helper for fuse_readdir.  */
+/* Helper for do_readdir.  */
 static int
 fuse_readdir_call_fill (const char *filename,
 			const struct grub_dirhook_info *info, void *data)
@@ -334,9 +373,8 @@ fuse_readdir_call_fill (const char *filename,
   return 0;
 }
 
-static int 
-fuse_readdir (const char *path, void *buf,
-	      fuse_fill_dir_t fill, off_t off, struct fuse_file_info *fi)
+static int
+do_readdir (const char *path, void *buf, fuse_fill_dir_t fill)
 {
   struct fuse_readdir_ctx ctx = {
     .path = path,
@@ -358,6 +396,530 @@ fuse_readdir (const char *path, void *buf,
   return 0;
 }
 
+/* With --jobs, requests are served by worker processes forked before FUSE
+   starts, each with its own copy of GRUB's state, so that the FUSE threads
+   can run them in parallel.  The workers share the devices opened so far,
+   which hostdisk only reads with pread or through a shared mapping.  */
+enum
+  {
+    WORKER_GETATTR,
+    WORKER_OPEN,
+    WORKER_READ,
+    WORKER_READDIR
+  };
+
+struct worker_request
+{
+  grub_uint32_t op;
+  grub_uint32_t pathlen;
+  grub_uint64_t handle;
+  grub_uint64_t off;
+  grub_uint64_t size;
+};
+
+struct worker_reply
+{
+  grub_int32_t ret;
+  grub_uint32_t len;
+};
+
+struct worker
+{
+  int fd;
+  pid_t pid;
+  int busy;
+};
+
+static struct worker *workers;
+static int nworkers;
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+
+/* Directory listing as built by do_readdir with dir_listing_fill: a struct
+   stat, the length of the name including its terminator and the name, for
+   every entry.  */
+struct dir_listing
+{
+  char *buf;
+  size_t len;
+  size_t alloc;
+};
+
+static int
+dir_listing_fill (void *data, const char *name, const struct stat *st,
+		  off_t off __attribute__ ((unused)))
+{
+  struct dir_listing *dir = data;
+  grub_uint32_t namelen = strlen (name) + 1;
+  size_t need = sizeof (*st) + sizeof (namelen) + namelen;
+  char *ptr;
+
+  if (dir->len + need > dir->alloc)
+    {
+      dir->alloc = 2 * (dir->len + need);
+      dir->buf = xrealloc (dir->buf, dir->alloc);
+    }
+  ptr = dir->buf + dir->len;
+  memcpy (ptr, st, sizeof (*st));
+  memcpy (ptr + sizeof (*st), &namelen, sizeof (namelen));
+  memcpy (ptr + sizeof (*st) + sizeof (namelen), name, namelen);
+  dir->len += need;
+  return 0;
+}
+
+static void __attribute__ ((noreturn))
+worker_loop (int fd)
+{
+  struct worker_request req;
+  struct worker_reply rep;
+  struct dir_listing dir = { NULL, 0, 0 };
+  struct stat st;
+  char *path = NULL;
+  char *data = NULL;
+  size_t data_alloc = 0;
+  const char *payload;
+
+  while (grub_util_fd_read (fd, (char *) &req, sizeof (req)) == sizeof (req))
+    {
+      path = xrealloc (path, req.pathlen + 1);
+      if (grub_util_fd_read (fd, path, req.pathlen) != (ssize_t) req.pathlen)
+	break;
+      path[req.pathlen] = 0;
+
+      payload = NULL;
+      rep.len = 0;
+      switch (req.op)
+	{
+	case WORKER_GETATTR:
+	  rep.ret = do_getattr (path, &st);
+	  if (rep.ret == 0)
+	    {
+	      payload = (const char *) &st;
+	      rep.len = sizeof (st);
+	    }
+	  break;
+
+	case WORKER_OPEN:
+	  rep.ret = do_open (req.handle, path);
+	  break;
+
+	case WORKER_READ:
+	  if (req.size > data_alloc)
+	    {
+	      data_alloc = req.size;
+	      data = xrealloc (data, data_alloc);
+	    }
+	  rep.ret = do_read (req.handle, path, data, req.size, req.off);
+	  if (rep.ret > 0)
+	    {
+	      payload = data;
+	      rep.len = rep.ret;
+	    }
+	  break;
+
+	case WORKER_READDIR:
+	  dir.len = 0;
+	  rep.ret = do_readdir (path, &dir, dir_listing_fill);
+	  payload = dir.buf;
+	  rep.len = dir.len;
+	  break;
+
+	default:
+	  rep.ret = -ENOSYS;
+	  break;
+	}
+
+      if (grub_util_fd_write (fd, (const char *) &rep, sizeof (rep))
+	  != sizeof (rep)
+	  || (rep.len && grub_util_fd_write (fd, payload, rep.len)
+	      != (ssize_t) rep.len))
+	break;
+    }
+
+  _exit (0);
+}
+
+static void
+start_workers (int n)
+{
+  int i, j;
+
+  workers = xmalloc (n * sizeof (workers[0]));
+  for (i = 0; i < n; i++)
+    {
+      int fds[2];
+      pid_t pid;
+
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+	grub_util_error (_("cannot create socket pair: %s"), strerror (errno));
+
+      fflush (stdout);
+      fflush (stderr);
+      pid = fork ();
+      if (pid < 0)
+	grub_util_error (_("Unable to fork: %s"), strerror (errno));
+      if (pid == 0)
+	{
+	  for (j = 0; j < i; j++)
+	    close (workers[j].fd);
+	  close (fds[0]);
+	  worker_loop (fds[1]);
+	}
+
+      close (fds[1]);
+      workers[i].fd = fds[0];
+      workers[i].pid = pid;
+      workers[i].busy = 0;
+    }
+  nworkers = n;
+
+  /* A worker that died is reported as EIO, not by killing the server.  */
+  signal (SIGPIPE, SIG_IGN);
+}
+
+static void
+stop_workers (void)
+{
+  int i;
+
+  /* Workers exit when their socket is closed.  */
+  for (i = 0; i < nworkers; i++)
+    if (workers[i].fd >= 0)
+      close (workers[i].fd);
+  for (i = 0; i < nworkers; i++)
+    waitpid (workers[i].pid, NULL, 0);
+  free (workers);
+  workers = NULL;
+  nworkers = 0;
+}
+
+static struct worker *
+worker_get (void)
+{
+  struct worker *w = NULL;
+  int i, alive;
+
+  pthread_mutex_lock (&workers_lock);
+  for (;;)
+    {
+      alive = 0;
+      for (i = 0; i < nworkers; i++)
+	{
+	  if (workers[i].fd < 0)
+	    continue;
+	  alive = 1;
+	  if (!workers[i].busy)
+	    {
+	      w = &workers[i];
+	      break;
+	    }
+	}
+      if (w || !alive)
+	break;
+      pthread_cond_wait (&workers_cond, &workers_lock);
+    }
+  if (w)
+    w->busy = 1;
+  pthread_mutex_unlock (&workers_lock);
+
+  return w;
+}
+
+static void
+worker_put (struct worker *w, int failed)
+{
+  pthread_mutex_lock (&workers_lock);
+  if (failed)
+    {
+      close (w->fd);
+      w->fd = -1;
+    }
+  w->busy = 0;
+  pthread_cond_broadcast (&workers_cond);
+  pthread_mutex_unlock (&workers_lock);
+}
+
+/* Run a request on an idle worker.  The reply payload is stored in OUT,
+   which has room for OUTSIZE bytes, or if OUTALLOC isn't NULL in a new
+   buffer returned there.  Its length is returned in *OUTLEN.  */
+static int
+worker_call (int op, grub_uint64_t handle, const char *path,
+	     grub_uint64_t off, grub_uint64_t size,
+	     void *out, size_t outsize, char **outalloc, size_t *outlen)
+{
+  struct worker_request req;
+  struct worker_reply rep;
+  struct worker *w;
+  char *buf;
+  int failed = 1;
+
+  w = worker_get ();
+  if (!w)
+    return -EIO;
+
+  req.op = op;
+  req.pathlen = strlen (path);
+  req.handle = handle;
+  req.off = off;
+  req.size = size;
+
+  if (grub_util_fd_write (w->fd, (const char *) &req, sizeof (req))
+      != sizeof (req)
+      || grub_util_fd_write (w->fd, path, req.pathlen) != (ssize_t) req.pathlen
+      || grub_util_fd_read (w->fd, (char *) &rep, sizeof (rep)) != sizeof (rep))
+    goto out;
+
+  if (outalloc)
+    buf = *outalloc = xmalloc (rep.len ? : 1);
+  else if (rep.len > outsize)
+    goto out;
+  else
+    buf = out;
+
+  if (grub_util_fd_read (w->fd, buf, rep.len) != (ssize_t) rep.len)
+    {
+      if (outalloc)
+	{
+	  free (*outalloc);
+	  *outalloc = NULL;
+	}
+      goto out;
+    }
+  if (outlen)
+    *outlen = rep.len;
+  failed = 0;
+
+ out:
+  worker_put (w, failed);
+  return failed ? -EIO : rep.ret;
+}
+
+/* Attributes and directory listings are kept for CACHE_TIMEOUT seconds,
+   which is also what the kernel is told it may cache them for.  Listings
+   fill the attribute cache for their entries, so "ls -l" doesn't look up
+   every file again.  */
+#define CACHE_TIMEOUT 30
+#define ATTR_CACHE_SIZE 1024
+#define DIR_CACHE_SIZE 64
+
+static struct
+{
+  char *path;
+  time_t time;
+  int ret;
+  struct stat st;
+} attr_cache[ATTR_CACHE_SIZE];
+
+static struct
+{
+  char *path;
+  time_t time;
+  char *entries;
+  size_t len;
+} dir_cache[DIR_CACHE_SIZE];
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned
+cache_hash (const char *path, unsigned size)
+{
+  grub_uint32_t hash = 2166136261U;
+
+  for (; *path; path++)
+    hash = (hash ^ (grub_uint8_t) *path) * 16777619U;
+  return hash % size;
+}
+
+static int
+cache_fresh (const char *cached, time_t stamp, const char *path)
+{
+  return cached && strcmp (cached, path) == 0
+    && stamp + CACHE_TIMEOUT > time (NULL);
+}
+
+static int
+attr_cache_lookup (const char *path, struct stat *st, int *ret)
+{
+  unsigned slot = cache_hash (path, ATTR_CACHE_SIZE);
+  int found = 0;
+
+  pthread_mutex_lock (&cache_lock);
+  if (cache_fresh (attr_cache[slot].path, attr_cache[slot].time, path))
+    {
+      *st = attr_cache[slot].st;
+      *ret = attr_cache[slot].ret;
+      found = 1;
+    }
+  pthread_mutex_unlock (&cache_lock);
+  return found;
+}
+
+static void
+attr_cache_store (const char *path, const struct stat *st, int ret)
+{
+  unsigned slot = cache_hash (path, ATTR_CACHE_SIZE);
+  char *copy = xstrdup (path);
+
+  pthread_mutex_lock (&cache_lock);
+  free (attr_cache[slot].path);
+  attr_cache[slot].path = copy;
+  attr_cache[slot].time = time (NULL);
+  attr_cache[slot].ret = ret;
+  attr_cache[slot].st = *st;
+  pthread_mutex_unlock (&cache_lock);
+}
+
+/* Return a copy of the cached listing of PATH in *ENTRIES.  */
+static int
+dir_cache_lookup (const char *path, char **entries, size_t *len)
+{
+  unsigned slot = cache_hash (path, DIR_CACHE_SIZE);
+  int found = 0;
+
+  pthread_mutex_lock (&cache_lock);
+  if (cache_fresh (dir_cache[slot].path, dir_cache[slot].time, path))
+    {
+      *len = dir_cache[slot].len;
+      *entries = xmalloc (*len ? : 1);
+      memcpy (*entries, dir_cache[slot].entries, *len);
+      found = 1;
+    }
+  pthread_mutex_unlock (&cache_lock);
+  return found;
+}
+
+static void
+dir_cache_store (const char *path, const char *entries, size_t len)
+{
+  unsigned slot = cache_hash (path, DIR_CACHE_SIZE);
+  char *path_copy = xstrdup (path);
+  char *copy = xmalloc (len ? : 1);
+
+  memcpy (copy, entries, len);
+  pthread_mutex_lock (&cache_lock);
+  free (dir_cache[slot].path);
+  free (dir_cache[slot].entries);
+  dir_cache[slot].path = path_copy;
+  dir_cache[slot].time = time (NULL);
+  dir_cache[slot].entries = copy;
+  dir_cache[slot].len = len;
+  pthread_mutex_unlock (&cache_lock);
+}
+
+static int
+fuse_getattr (const char *path, struct stat *st)
+{
+  int ret;
+
+  if (attr_cache_lookup (path, st, &ret))
+    return ret;
+
+  if (nworkers)
+    ret = worker_call (WORKER_GETATTR, 0, path, 0, 0, st, sizeof (*st),
+		       NULL, NULL);
+  else
+    ret = do_getattr (path, st);
+
+  if (ret == 0 || ret == -ENOENT)
+    attr_cache_store (path, st, ret);
+  return ret;
+}
+
+static int 
+fuse_open (const char *path, struct fuse_file_info *fi)
+{
+  grub_uint64_t handle;
+  int ret;
+
+  pthread_mutex_lock (&workers_lock);
+  handle = ++last_handle;
+  pthread_mutex_unlock (&workers_lock);
+
+  if (nworkers)
+    ret = worker_call (WORKER_OPEN, handle, path, 0, 0, NULL, 0, NULL, NULL);
+  else
+    ret = do_open (handle, path);
+  if (ret == 0)
+    fi->fh = handle;
+  return ret;
+} 
+
+static int 
+fuse_read (const char *path, char *buf, size_t sz, off_t off,
+	   struct fuse_file_info *fi)
+{
+  if (nworkers)
+    return worker_call (WORKER_READ, fi->fh, path, off, sz, buf, sz,
+			NULL, NULL);
+  return do_read (fi->fh, path, buf, sz, off);
+} 
+
+static int 
+fuse_release (const char *path, struct fuse_file_info *fi)
+{
+  /* Workers close their copies when the slot is reused.  */
+  if (!nworkers)
+    file_cache_drop (fi->fh);
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+static int 
+fuse_readdir (const char *path, void *buf,
+	      fuse_fill_dir_t fill, off_t off, struct fuse_file_info *fi)
+{
+  char *entries = NULL, *ptr, *end, *child;
+  size_t len = 0;
+  int ret = 0;
+
+  if (!dir_cache_lookup (path, &entries, &len))
+    {
+      if (nworkers)
+	ret = worker_call (WORKER_READDIR, 0, path, 0, 0, NULL, 0,
+			   &entries, &len);
+      else
+	{
+	  struct dir_listing dir = { NULL, 0, 0 };
+
+	  ret = do_readdir (path, &dir, dir_listing_fill);
+	  entries = dir.buf;
+	  len = dir.len;
+	}
+      if (ret)
+	{
+	  free (entries);
+	  return ret;
+	}
+      dir_cache_store (path, entries, len);
+    }
+
+  ptr = entries;
+  end = entries + len;
+  while ((size_t) (end - ptr) > sizeof (struct stat) + sizeof (grub_uint32_t))
+    {
+      struct stat st;
+      grub_uint32_t namelen;
+
+      memcpy (&st, ptr, sizeof (st));
+      memcpy (&namelen, ptr + sizeof (st), sizeof (namelen));
+      ptr += sizeof (st) + sizeof (namelen);
+      if (namelen == 0 || namelen > (size_t) (end - ptr)
+	  || ptr[namelen - 1] != 0)
+	break;
+      fill (buf, ptr, &st, 0);
+      if (strcmp (ptr, ".") != 0 && strcmp (ptr, "..") != 0)
+	{
+	  child = xasprintf ("%s%s%s", path,
+			     path[strlen (path) - 1] == '/' ? "" : "/", ptr);
+	  attr_cache_store (child, &st, 0);
+	  free (child);
+	}
+      ptr += namelen;
+    }
+  free (entries);
+  return 0;
+}
+
 struct fuse_operations grub_opers = {
   .getattr = fuse_getattr,
   .open = fuse_open,
@@ -424,9 +986,14 @@ fuse_init (void)
       return grub_errno;
     }
 
+  if (jobs > 1)
+    start_workers (jobs);
+
   if (fuse_main (fuse_argc, fuse_args, &grub_opers, NULL))
     grub_error (GRUB_ERR_IO, "fuse_main failed");
 
+  stop_workers ();
+
   for (i = 0; i < num_disks; i++)
     {
       char *argv[2];
@@ -452,6 +1019,7 @@ static struct argp_option options[] = {
   {"root",      'r', N_("DEVICE_NAME"), 0, N_("Set root device."),                 2},
   {"debug",     'd', N_("STRING"),           0, N_("Set debug environment variable."),  2},
   {"crypto",   'C', NULL, 0, N_("Mount crypto devices."), 2},
+  {"jobs",      'j', N_("NUM"), 0, N_("Serve requests with NUM worker processes."), 2},
   {"zfs-key",      'K',
    /* TRANSLATORS: "prompt" is a keyword.  */
    N_("FILE|prompt"), 0, N_("Load zfs crypto key."),                 2},
@@ -518,6 +1086,12 @@ argp_parser (int key, char *arg, struct argp_state *state)
       mount_crypt = 1;
       return 0;
 
+    case 'j':
+      jobs = grub_strtoul (arg, NULL, 0);
+      if (jobs < 1)
+	jobs = 1;
+      return 0;
+
     case 'd':
       debug_str = arg;
       return 0;
@@ -561,18 +1135,32 @@ main (int argc, char *argv[])
 
   grub_util_host_init (&argc, &argv);
 
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 3) * sizeof (fuse_args[0]));
   fuse_args[fuse_argc] = xstrdup (argv[0]);
   fuse_argc++;
-  /* Run single-threaded.  */
-  fuse_args[fuse_argc] = xstrdup ("-s");
+  /* The file system doesn't change under us: let the kernel keep what it
+     read and read ahead in large chunks.  Options given by the user come
+     later and take precedence.  */
+  fuse_args[fuse_argc] = xstrdup ("-o");
+  fuse_argc++;
+  fuse_args[fuse_argc] = xasprintf ("kernel_cache,max_readahead=%d,"
+				    "attr_timeout=%d,entry_timeout=%d,"
+				    "negative_timeout=%d", 1 << 20,
+				    CACHE_TIMEOUT, CACHE_TIMEOUT,
+				    CACHE_TIMEOUT);
   fuse_argc++;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
   
   if (num_disks < 2)
     grub_util_error ("%s", _("need an image and mountpoint"));
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 3) * sizeof (fuse_args[0]));
+  /* GRUB isn't thread-safe: without workers, run single-threaded.  */
+  if (jobs <= 1)
+    {
+      fuse_args[fuse_argc] = xstrdup ("-s");
+      fuse_argc++;
+    }
   fuse_args[fuse_argc] = images[num_disks - 1];
   fuse_argc++;
   num_disks--;
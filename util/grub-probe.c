@@ -38,6 +38,7 @@
 #include <grub/util/ofpath.h>
 #include <grub/crypto.h>
 #include <grub/cryptodisk.h>
+#include <grub/util/install.h>
 
 #include <stdio.h>
 #include <unistd.h>
@@ -74,7 +75,8 @@ enum {
   PRINT_MSDOS_PARTTYPE,
   PRINT_GPT_PARTTYPE,
   PRINT_ZERO_CHECK,
-  PRINT_DISK
+  PRINT_DISK,
+  PRINT_BLOCKLIST
 };
 
 static const char *targets[] =
@@ -98,11 +100,24 @@ static const char *targets[] =
     [PRINT_GPT_PARTTYPE]       = "gpt_parttype",
     [PRINT_ZERO_CHECK]         = "zero_check",
     [PRINT_DISK]               = "disk",
+    [PRINT_BLOCKLIST]          = "blocklist",
   };
 
 static int print = PRINT_FS;
 static unsigned int argument_is_device = 0;
 
+/* Return the index of the target called NAME or -1.  */
+static int
+find_target (const char *name)
+{
+  int i;
+
+  for (i = PRINT_FS; i < (int) ARRAY_SIZE (targets); i++)
+    if (strcmp (name, targets[i]) == 0)
+      return i;
+  return -1;
+}
+
 static char *
 get_targets_string (void)
 {
@@ -252,6 +267,50 @@ probe_abstraction (grub_disk_t disk, char delim)
     printf ("raid6rec%c", delim);
 }
 
+struct blocklist_ctx
+{
+  grub_disk_addr_t part_start;
+  grub_disk_addr_t start;
+  grub_disk_addr_t len;
+  unsigned last_length;
+  int printed;
+};
+
+static void
+print_blocklist_run (struct blocklist_ctx *ctx)
+{
+  printf ("%s%" GRUB_HOST_PRIuLONG_LONG "+%" GRUB_HOST_PRIuLONG_LONG,
+	  ctx->printed ? "," : "", (unsigned long long) ctx->start,
+	  (unsigned long long) ctx->len);
+  ctx->printed = 1;
+}
+
+/* Helper for probe: print the sectors of the file as a GRUB blocklist
+   relative to its partition, merging adjacent runs.  */
+static void
+blocklist_add (grub_disk_addr_t sector, unsigned offset, unsigned length,
+	       void *data)
+{
+  struct blocklist_ctx *ctx = data;
+  grub_disk_addr_t seclen;
+
+  if (offset != 0 || ctx->last_length != 0)
+    grub_util_error ("%s", _("non-sector-aligned data is found in the file"));
+
+  sector -= ctx->part_start;
+  seclen = (length + GRUB_DISK_SECTOR_SIZE - 1) >> GRUB_DISK_SECTOR_BITS;
+  if (ctx->len && ctx->start + ctx->len == sector)
+    ctx->len += seclen;
+  else
+    {
+      if (ctx->len)
+	print_blocklist_run (ctx);
+      ctx->start = sector;
+      ctx->len = seclen;
+    }
+  ctx->last_length = length & (GRUB_DISK_SECTOR_SIZE - 1);
+}
+
 static void
 probe (const char *path, char **device_names, char delim)
 {
@@ -367,6 +426,46 @@ probe (const char *path, char **device_names, char delim)
       grub_printf ("true\n");
     }
 
+  if (print == PRINT_BLOCKLIST)
+    {
+      struct blocklist_ctx ctx;
+      grub_device_t dev;
+      grub_fs_t fs;
+      size_t size;
+      char *img;
+
+      if (! path)
+	grub_util_error ("%s", _("the blocklist target needs a path"));
+
+      grub_util_info ("opening %s", drives_names[0]);
+      dev = grub_device_open (drives_names[0]);
+      if (! dev || ! dev->disk)
+	grub_util_error ("%s", grub_errmsg);
+
+      fs = grub_fs_probe (dev);
+      if (! fs)
+	grub_util_error ("%s", grub_errmsg);
+      /* The extents the OS reports are in the filesystem's own address
+	 space, not on the device.  */
+      if (strcmp (fs->name, "btrfs") == 0 || strcmp (fs->name, "zfs") == 0)
+	grub_util_error (_("filesystem `%s' doesn't support blocklists"),
+			 fs->name);
+
+      size = grub_util_get_image_size (path);
+      img = grub_util_read_image (path);
+
+      memset (&ctx, 0, sizeof (ctx));
+      ctx.part_start = grub_partition_get_start (dev->disk->partition);
+      grub_install_get_blocklist (dev, path, img, size, blocklist_add, &ctx);
+      if (ctx.len)
+	print_blocklist_run (&ctx);
+      putchar (delim);
+
+      free (img);
+      grub_device_close (dev);
+      goto end;
+    }
+
   if (print == PRINT_FS || print == PRINT_FS_UUID
       || print == PRINT_FS_LABEL)
     {
@@ -678,12 +777,74 @@ free_device_names:
     }
 }
 
+/* Answer the queries read from IN, one per line, each as one line of
+   space separated items.  A query is a target, optionally -d, and the
+   path or devices, separated by blanks.  All share a single
+   initialization of the disk layer.  */
+static void
+probe_batch (FILE *in)
+{
+  char *line = NULL;
+  size_t len = 0;
+  char **words = NULL;
+  size_t nwords_max = 0;
+
+  while (getline (&line, &len, in) >= 0)
+    {
+      size_t nwords = 0;
+      int is_device = 0;
+      char *word, *save;
+      int target;
+
+      if (nwords_max < len / 2 + 2)
+	{
+	  nwords_max = len / 2 + 2;
+	  words = xrealloc (words, nwords_max * sizeof (words[0]));
+	}
+
+      word = strtok_r (line, " \t\r\n", &save);
+      if (! word)
+	continue;
+      target = find_target (word);
+      if (target < 0)
+	grub_util_error (_("unknown target `%s'"), word);
+
+      while ((word = strtok_r (NULL, " \t\r\n", &save)))
+	{
+	  if (nwords == 0 && ! is_device
+	      && (strcmp (word, "-d") == 0 || strcmp (word, "--device") == 0))
+	    is_device = 1;
+	  else
+	    words[nwords++] = word;
+	}
+      words[nwords] = NULL;
+      if (nwords == 0 || (! is_device && nwords != 1))
+	grub_util_error (_("invalid query `%s'"), targets[target]);
+
+      print = target;
+      if (is_device)
+	probe (NULL, words, ' ');
+      else
+	probe (words[0], NULL, ' ');
+      if (print != PRINT_ZERO_CHECK)
+	putchar ('\n');
+      fflush (stdout);
+    }
+
+  free (words);
+  free (line);
+}
+
 static struct argp_option options[] = {
   {"device",  'd', 0, 0,
    N_("given argument is a system device, not a path"), 0},
   {"device-map",  'm', N_("FILE"), 0,
    N_("use FILE as the device map [default=%s]"), 0},
   {"target",  't', N_("TARGET"), 0, 0, 0},
+  {"batch",  'b', 0, 0,
+   N_("read queries of the form `TARGET [-d] PATH|DEVICE...' from "
+      "standard input, one per line, and print one line of answer for each"),
+   0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {0, '0', 0, 0, N_("separate items in output using ASCII NUL characters"), 0},
   { 0, 0, 0, 0, 0, 0 }
@@ -726,6 +887,9 @@ struct arguments
   size_t ndevices;
   char *dev_map;
   int zero_delim;
+  int batch;
+  int *targets;
+  size_t ntargets;
 };
 
 static error_t
@@ -750,19 +914,22 @@ argp_parser (int key, char *arg, struct argp_state *state)
 
     case 't':
       {
-	int i;
+	int i = find_target (arg);
 
-	for (i = PRINT_FS; i < ARRAY_SIZE (targets); i++)
-	  if (strcmp (arg, targets[i]) == 0)
-	    {
-	      print = i;
-	      break;
-	    }
-	if (i == ARRAY_SIZE (targets))
+	if (i < 0)
 	  argp_usage (state);
+	print = i;
+	arguments->targets = xrealloc (arguments->targets,
+				       (arguments->ntargets + 1)
+				       * sizeof (arguments->targets[0]));
+	arguments->targets[arguments->ntargets++] = i;
       }
       break;
 
+    case 'b':
+      arguments->batch = 1;
+      break;
+
     case '0':
       arguments->zero_delim = 1;
       break;
@@ -772,6 +939,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
       break;
 
     case ARGP_KEY_NO_ARGS:
+      if (arguments->batch)
+	break;
       fprintf (stderr, "%s", _("No path or device is specified.\n"));
       argp_usage (state);
       break;
@@ -820,7 +989,7 @@ main (int argc, char *argv[])
     grub_env_set ("debug", "all");
 
   /* Obtain ARGUMENT.  */
-  if (arguments.ndevices != 1 && !argument_is_device)
+  if (arguments.ndevices != 1 && !argument_is_device && !arguments.batch)
     {
       char *program = xstrdup(program_name);
       fprintf (stderr, _("Unknown extra argument `%s'."), arguments.devices[1]);
@@ -857,13 +1026,35 @@ main (int argc, char *argv[])
     delim = '\0';
 
   /* Do it.  */
-  if (argument_is_device)
-    probe (NULL, arguments.devices, delim);
+  if (arguments.batch)
+    probe_batch (stdin);
+  else if (arguments.ntargets > 1)
+    {
+      /* Several targets are answered one line each, like in batch
+	 mode.  */
+      size_t i;
+
+      for (i = 0; i < arguments.ntargets; i++)
+	{
+	  print = arguments.targets[i];
+	  if (argument_is_device)
+	    probe (NULL, arguments.devices, ' ');
+	  else
+	    probe (arguments.devices[0], NULL, ' ');
+	  if (print != PRINT_ZERO_CHECK)
+	    putchar ('\n');
+	}
+    }
   else
-    probe (arguments.devices[0], NULL, delim);
+    {
+      if (argument_is_device)
+	probe (NULL, arguments.devices, delim);
+      else
+	probe (arguments.devices[0], NULL, delim);
 
-  if (delim == ' ')
-    putchar ('\n');
+      if (delim == ' ')
+	putchar ('\n');
+    }
 
   /* Free resources.  */
   grub_gcry_fini_all ();
@@ -876,6 +1067,7 @@ main (int argc, char *argv[])
       free (arguments.devices[i]);
   }
   free (arguments.devices);
+  free (arguments.targets);
 
   free (arguments.dev_map);
 
@@ -96,6 +96,15 @@ cryptolist.write ("AES-128: gcry_rijndael\n");
 cryptolist.write ("AES-192: gcry_rijndael\n");
 cryptolist.write ("AES-256: gcry_rijndael\n");
 
+# aes_hw replaces rijndael where the CPU has AES instructions.
+for name in ["AES", "AES192", "AES256", "RIJNDAEL", "RIJNDAEL192",
+             "RIJNDAEL256", "AES128", "AES-128", "AES-192", "AES-256"]:
+    cryptolist.write ("%s: aes_hw\n" % name);
+
+# And sha_hw replaces sha256 and sha512 where the CPU has SHA instructions.
+for name in ["SHA224", "SHA256", "SHA384", "SHA512"]:
+    cryptolist.write ("%s: sha_hw\n" % name);
+
 cryptolist.write ("ADLER32: adler32\n");
 cryptolist.write ("CRC64: crc64\n");
 
@@ -654,6 +654,106 @@ compress_kernel_xz (char *kernel_img, size_t kernel_size,
 }
 #endif
 
+/* LZ4 trades some size for a decompressor that is several times faster
+   than LZMA.  A simple single-probe match finder is enough: the core
+   image is small and the decoder doesn't care how matches were found.  */
+#define LZ4_HASH_BITS		16
+#define LZ4_MIN_MATCH		4
+#define LZ4_MAX_OFFSET		65535
+/* The format requires the last match to start this far from the end and
+   the last bytes to be literals.  */
+#define LZ4_MF_LIMIT		12
+#define LZ4_LAST_LITERALS	5
+
+static grub_uint8_t *
+lz4_put_length (grub_uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+static grub_uint8_t *
+lz4_put_sequence (grub_uint8_t *op, const grub_uint8_t *lit, size_t nlit,
+		  size_t offset, size_t mlen)
+{
+  grub_uint8_t *token = op++;
+
+  *token = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15)
+    op = lz4_put_length (op, nlit - 15);
+  memcpy (op, lit, nlit);
+  op += nlit;
+
+  if (!mlen)
+    return op;
+
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  mlen -= LZ4_MIN_MATCH;
+  *token |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15)
+    op = lz4_put_length (op, mlen - 15);
+  return op;
+}
+
+static void
+compress_kernel_lz4 (char *kernel_img, size_t kernel_size,
+		     char **core_img, size_t *core_size)
+{
+  const grub_uint8_t *in = (const grub_uint8_t *) kernel_img;
+  grub_uint8_t *op;
+  size_t *table;
+  size_t ip = 0, anchor = 0;
+  size_t mflimit, matchlimit;
+
+  mflimit = kernel_size > LZ4_MF_LIMIT ? kernel_size - LZ4_MF_LIMIT : 0;
+  matchlimit = kernel_size - LZ4_LAST_LITERALS;
+
+  /* Incompressible input grows by one byte per 255.  */
+  *core_img = xmalloc (kernel_size + kernel_size / 255 + 16);
+  op = (grub_uint8_t *) *core_img;
+  /* Positions are stored plus one so that 0 means empty.  */
+  table = xmalloc ((1 << LZ4_HASH_BITS) * sizeof (table[0]));
+  memset (table, 0, (1 << LZ4_HASH_BITS) * sizeof (table[0]));
+
+  while (ip < mflimit)
+    {
+      grub_uint32_t seq, cand;
+      size_t h, ref, len;
+
+      memcpy (&seq, in + ip, sizeof (seq));
+      h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+      ref = table[h];
+      table[h] = ip + 1;
+      if (!ref || ip - (ref - 1) > LZ4_MAX_OFFSET)
+	{
+	  ip++;
+	  continue;
+	}
+      ref--;
+      memcpy (&cand, in + ref, sizeof (cand));
+      if (cand != seq)
+	{
+	  ip++;
+	  continue;
+	}
+
+      len = LZ4_MIN_MATCH;
+      while (ip + len < matchlimit && in[ref + len] == in[ip + len])
+	len++;
+
+      op = lz4_put_sequence (op, in + anchor, ip - anchor, ip - ref, len);
+      ip += len;
+      anchor = ip;
+    }
+
+  op = lz4_put_sequence (op, in + anchor, kernel_size - anchor, 0, 0);
+  *core_size = op - (grub_uint8_t *) *core_img;
+  free (table);
+}
+
 static void
 compress_kernel (const struct grub_install_image_target_desc *image_target, char *kernel_img,
 		 size_t kernel_size, char **core_img, size_t *core_size,
@@ -667,6 +767,14 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
       return;
     }
 
+  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
+      && (comp == GRUB_COMPRESSION_LZ4))
+    {
+      compress_kernel_lz4 (kernel_img, kernel_size, core_img,
+			   core_size);
+      return;
+    }
+
 #ifdef USE_LIBLZMA
  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
      && (comp == GRUB_COMPRESSION_XZ))
@@ -686,6 +794,28 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
   *core_size = kernel_size;
 }
 
+/* Return nonzero if the module file PATH is one of DEFERRED_MODS.  */
+static int
+module_is_deferred (const char *path, char *deferred_mods[])
+{
+  const char *base, *ext;
+  size_t len;
+  char **m;
+
+  if (!deferred_mods)
+    return 0;
+
+  base = strrchr (path, '/');
+  base = base ? base + 1 : path;
+  ext = strrchr (base, '.');
+  len = (ext && strcmp (ext, ".mod") == 0) ? (size_t) (ext - base) : strlen (base);
+
+  for (m = deferred_mods; *m; m++)
+    if (strlen (*m) == len && memcmp (*m, base, len) == 0)
+      return 1;
+  return 0;
+}
+
 const struct grub_install_image_target_desc *
 grub_install_get_image_target (const char *arg)
 {
@@ -735,7 +865,7 @@ grub_install_get_image_targets_string (void)
 void
 grub_install_generate_image (const char *dir, const char *prefix,
 			     FILE *out, const char *outname, char *mods[],
-			     char *memdisk_path, char **pubkey_paths,
+			     char *deferred_mods[], char *memdisk_path, char **pubkey_paths,
 			     size_t npubkeys, char *config_path,
 			     const struct grub_install_image_target_desc *image_target,
 			     int note,
@@ -754,9 +884,10 @@ grub_install_generate_image (const char *dir, const char *prefix,
   if (comp == GRUB_COMPRESSION_AUTO)
     comp = image_target->default_compression;
 
-  if (image_target->id == IMAGE_I386_PC
-      || image_target->id == IMAGE_I386_PC_PXE
-      || image_target->id == IMAGE_I386_PC_ELTORITO)
+  if ((image_target->id == IMAGE_I386_PC
+       || image_target->id == IMAGE_I386_PC_PXE
+       || image_target->id == IMAGE_I386_PC_ELTORITO)
+      && comp != GRUB_COMPRESSION_LZ4)
     comp = GRUB_COMPRESSION_LZMA;
 
   path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
@@ -871,7 +1002,10 @@ grub_install_generate_image (const char *dir, const char *prefix,
       mod_size = ALIGN_ADDR (grub_util_get_image_size (p->name));
 
       header = (struct grub_module_header *) (kernel_img + offset);
-      header->type = grub_host_to_target32 (OBJ_TYPE_ELF);
+      if (module_is_deferred (p->name, deferred_mods))
+	header->type = grub_host_to_target32 (OBJ_TYPE_DEFERRED_ELF);
+      else
+	header->type = grub_host_to_target32 (OBJ_TYPE_ELF);
       header->size = grub_host_to_target32 (mod_size + sizeof (*header));
       offset += sizeof (*header);
 
@@ -967,6 +1101,9 @@ grub_install_generate_image (const char *dir, const char *prefix,
 	case GRUB_COMPRESSION_LZMA:
 	  name = "lzma_decompress.img";
 	  break;
+	case GRUB_COMPRESSION_LZ4:
+	  name = "lz4_decompress.img";
+	  break;
 	case GRUB_COMPRESSION_NONE:
 	  name = "none_decompress.img";
 	  break;
@@ -272,6 +272,48 @@ grub_util_resolve_dependencies (const char *prefix,
   }
 }
 
+char **
+grub_util_get_module_deps (const char *prefix,
+			   const char *dep_list_file,
+			   const char *module)
+{
+  char *path;
+  FILE *fp;
+  struct dep_list *dep_list, *dep;
+  struct mod_list *mod;
+  char *name;
+  char **ret;
+  size_t n = 0;
+
+  path = grub_util_get_path (prefix, dep_list_file);
+  fp = grub_util_fopen (path, "r");
+  if (! fp)
+    grub_util_error (_("cannot open `%s': %s"), path, strerror (errno));
+
+  free (path);
+  dep_list = read_dep_list (fp);
+  fclose (fp);
+
+  name = get_module_name (module);
+  for (dep = dep_list; dep; dep = dep->next)
+    if (strcmp (dep->name, name) == 0)
+      break;
+  free (name);
+
+  if (dep)
+    for (mod = dep->list; mod; mod = mod->next)
+      n++;
+
+  ret = xmalloc ((n + 1) * sizeof (ret[0]));
+  ret[n] = NULL;
+  if (dep)
+    for (mod = dep->list; mod; mod = mod->next)
+      ret[--n] = xstrdup (mod->name);
+
+  free_dep_list (dep_list);
+  return ret;
+}
+
 void
 grub_util_free_path_list (struct grub_util_path_list *path_list)
 {